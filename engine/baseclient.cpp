@@ -547,7 +547,14 @@ bool CBaseClient::SendSignonData( void )
 		return false;
 	}
 
-	m_NetChannel->SendData( m_Server->m_Signon );
+	// Signon only grows while the map loads, so the bit count tells if the shared copy is current
+	CNetSharedData &signon = m_Server->m_SharedSignon;
+	if ( signon.GetNumBitsWritten() != m_Server->m_Signon.GetNumBitsWritten() )
+	{
+		signon.Set( m_Server->m_Signon );
+	}
+
+	static_cast<CNetChan *>( m_NetChannel )->SendSharedData( signon );
 		
 	m_nSignonState = SIGNONSTATE_PRESPAWN;
 	NET_SignonState signonState( m_nSignonState, m_Server->GetSpawnCount() );
@@ -16,6 +16,7 @@
 #include "dt_recv_eng.h"
 #include "ents_shared.h"
 #include "net_synctags.h"
+#include "net_compression.h"
 #include "filesystem_engine.h"
 #include "host_cmd.h"
 #include "GameEventManager.h"
@@ -548,6 +549,9 @@ void CBaseClientState::SendConnectPacket (int challengeNr, int authProtocol, uin
 									return;
 	}
 
+	// Optional trailer, tells the server which compression codecs we can decode
+	NET_WriteCompressionHandshake( msg );
+
 	// Mark time of this attempt for retransmit requests
 	m_flConnectTime = net_time;
 
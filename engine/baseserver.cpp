@@ -49,6 +49,8 @@
 #include "sv_ipratelimit.h"
 #include "cl_steamauth.h"
 #include "sv_filter.h"
+#include "net_chan.h"
+#include "net_compression.h"
 
 #include "tier0/icommandline.h"
 #include "tier0/vcrmode.h"
@@ -60,6 +62,7 @@
 #include "tier0/memdbgon.h"
 
 CThreadFastMutex g_svInstanceBaselineMutex;
+bool g_bSvInstanceBaselinesLocked = false;
 extern	CGlobalVars g_ServerGlobalVariables;
 
 static ConVar	sv_max_queries_sec( "sv_max_queries_sec", "3.0", 0, "Maximum queries per second to respond to from a single IP address." );
@@ -733,6 +736,8 @@ bool CBaseServer::ProcessConnectionlessPacket(netpacket_t * packet)
 //					break;
 // 				}
 
+				IClient *client = NULL;
+
 				if ( authProtocol == PROTOCOL_STEAM )
 				{
 					int keyLen = msg.ReadShort();
@@ -743,12 +748,24 @@ bool CBaseServer::ProcessConnectionlessPacket(netpacket_t * packet)
 					}
 					msg.ReadBytes( cdkey, keyLen );
 
-					ConnectClient( packet->from, protocol, challengeNr, clientChallenge, authProtocol, name, password, cdkey, keyLen );	// cd key is actually a raw encrypted key	
+					client = ConnectClient( packet->from, protocol, challengeNr, clientChallenge, authProtocol, name, password, cdkey, keyLen );	// cd key is actually a raw encrypted key	
 				}
 				else
 				{
 					msg.ReadString( cdkey );
-					ConnectClient( packet->from, protocol, challengeNr, clientChallenge, authProtocol, name, password, cdkey, V_strlen(cdkey) );
+					client = ConnectClient( packet->from, protocol, challengeNr, clientChallenge, authProtocol, name, password, cdkey, V_strlen(cdkey) );
+				}
+
+				// Older clients don't send the codec trailer and stay on Snappy
+				if ( client && client->GetNetChannel() )
+				{
+					int nCodecMask;
+					uint32 nDictionaryId;
+					(void)NET_ReadCompressionHandshake( msg, nCodecMask, nDictionaryId );
+
+					bool bUseDictionary;
+					const NetCompressionCodec_t codec = NET_SelectCompressionCodec( nCodecMask, nDictionaryId, bUseDictionary );
+					static_cast<CNetChan *>( client->GetNetChannel() )->SetCompressionCodec( codec, bUseDictionary );
 				}
 			}
 
@@ -1578,6 +1595,7 @@ void CBaseServer::Clear( void )
 	
 	m_Signon.StartWriting( m_SignonBuffer.Base(), m_SignonBuffer.Count() );
 	m_Signon.SetDebugName( "m_Signon" );
+	m_SharedSignon.Purge();
 
 	serverclasses = 0;
 	serverclassbits = 0;
@@ -1691,10 +1709,17 @@ bool CBaseServer::GetClassBaseline( ServerClass *pClass, void const **pData, int
 			("SV_GetInstanceBaseline: missing instance baseline for class '%s'", pClass->m_pNetworkName)
 		);
 		
-		AUTO_LOCK( g_svInstanceBaselineMutex );
+		// Snapshot workers only read the table, don't serialize them.
+		const bool bLock = g_bSvInstanceBaselinesLocked;
+		if ( bLock )
+			g_svInstanceBaselineMutex.Lock();
+
 		*pData = GetInstanceBaselineTable()->GetStringUserData(
 			pClass->m_InstanceBaselineIndex,
 			pDatalen );
+
+		if ( bLock )
+			g_svInstanceBaselineMutex.Unlock();
 		
 		return *pData != NULL;
 	}
@@ -12,6 +12,7 @@
 #include "baseclient.h"
 #include "netmessages.h"
 #include "net.h"
+#include "net_chan.h"
 #include "event_system.h"
 
 class CNetworkStringTableContainer;
@@ -97,7 +98,9 @@ public: // IServer implementation
 
 	virtual void	DisconnectClient(IClient *client, const char *reason );
 	
-	virtual void	WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CClientFrame *from,	bf_write &pBuf );
+	// Returns true if no entity was written from the client's baseline, the bits then
+	// only depend on the frames, the client entity and the client's baseline number.
+	virtual bool	WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CClientFrame *from,	bf_write &pBuf );
 	virtual void	WriteTempEntities( CBaseClient *client, CFrameSnapshot *to, CFrameSnapshot *from, bf_write &pBuf, int nMaxEnts );
 	
 public: // IConnectionlessPacketHandler implementation
@@ -213,6 +216,8 @@ public:
 	// This will get set to NET_MAX_PAYLOAD if the server is MP.
 	bf_write			m_Signon;
 	CUtlMemory<byte>	m_SignonBuffer;
+	// m_Signon as sent to clients, compressed once. Rebuilt when m_Signon grows.
+	CNetSharedData		m_SharedSignon;
 
 	int			serverclasses;		// number of unique server classes
 	int			serverclassbits;	// log2 of serverclasses
@@ -258,5 +263,8 @@ protected:
 };
 
 extern CThreadFastMutex g_svInstanceBaselineMutex;
+// Set while entities are packed in parallel, the only time instance baselines
+// are added from worker threads. Readers skip the mutex otherwise.
+extern bool g_bSvInstanceBaselinesLocked;
 
 #endif // BASESERVER_H
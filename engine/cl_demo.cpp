@@ -45,6 +45,7 @@ static ConVar demo_quitafterplayback( "demo_quitafterplayback", "0", 0, "Quits g
 static ConVar demo_debug( "demo_debug", "0", 0, "Demo debug info." );
 static ConVar demo_interpolateview( "demo_interpolateview", "1", 0, "Do view interpolation during dem playback." );
 static ConVar demo_pauseatservertick( "demo_pauseatservertick", "0", 0, "Pauses demo playback at server tick" );
+static ConVar demo_seekkeyframes( "demo_seekkeyframes", "1", 0, "Skip to ticks of indexed demos by starting from their nearest keyframe." );
 static ConVar timedemo_runcount( "timedemo_runcount", "0", 0, "Runs time demo X number of times." );
 
 // singeltons:
@@ -118,7 +119,7 @@ static bool IsControlCommand( unsigned char cmd )
 {
 	return ( (cmd == dem_signon) || (cmd == dem_stop) ||
 		     (cmd == dem_synctick) || (cmd == dem_datatables ) ||
-			 (cmd == dem_stringtables) );
+			 (cmd == dem_stringtables) || (cmd == dem_keyframe) );
 }
 
 
@@ -574,7 +575,7 @@ void CDemoRecorder::StartupDemoFile( void )
 		demoheader_t *dh = &m_DemoFile.m_DemoHeader;
 		Q_memset(dh, 0, sizeof(demoheader_t));
 
-		dh->demoprotocol = DEMO_PROTOCOL;
+		dh->demoprotocol = DEMO_PROTOCOL_LINEAR;
 		dh->networkprotocol = PROTOCOL_VERSION;
 		V_strcpy_safe( dh->demofilestamp, DEMO_HEADER_ID );
 
@@ -912,7 +913,11 @@ void CDemoPlayer::SkipToTick( int tick, bool bRelative, bool bPause )
 	if ( tick < 0 )
 		return;
 
-	if ( tick < GetPlaybackTick() )
+	if ( SeekToKeyframe( tick ) )
+	{
+		// the remaining ticks after the keyframe are skipped normally
+	}
+	else if ( tick < GetPlaybackTick() )
 	{
 		// we have to reload the whole demo file
 		// we need to create a temp copy of the filename
@@ -935,6 +940,48 @@ void CDemoPlayer::SkipToTick( int tick, bool bRelative, bool bPause )
 		PausePlayback( -1 );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Moves the read position to the last keyframe at or before tick, if
+//  that is closer than the current position. Returns false if the demo has no
+//  usable keyframe and skipping has to parse all packets up to tick.
+//
+//  Packets between the old position and the keyframe are never read. The
+//  keyframe restores string tables, replicated convars, the view entity and
+//  entities, but other reliable messages in that range (user messages, game
+//  events, pause state) are lost, so HUD state built from them may be off
+//  until the game sends it again. Packets from the keyframe on are parsed
+//  normally. demo_seekkeyframes 0 replays everything.
+//-----------------------------------------------------------------------------
+bool CDemoPlayer::SeekToKeyframe( int tick )
+{
+	// keyframes only replace the entity and string table state of a connected client
+	if ( !demo_seekkeyframes.GetBool() || !m_DemoFile.HasDemoIndex() || !cl.IsActive() )
+		return false;
+
+	const demoindexentry_t *pKeyframe = m_DemoFile.FindKeyframe( tick );
+
+	if ( !pKeyframe )
+		return false;
+
+	int nPlaybackTick = GetPlaybackTick();
+
+	if ( tick >= nPlaybackTick && pKeyframe->tick <= nPlaybackTick )
+		return false; // no keyframe in between, just skip forward
+
+	ETWMark1I( "DemoPlayer: SeekToKeyframe", pKeyframe->tick );
+
+	m_DemoFile.SeekTo( pKeyframe->fileoffset, true );
+	m_bSeekingToKeyframe = true;
+
+	// frames from the old position must never be used as delta source
+	cl.DeleteClientFrames( -1 );
+
+	m_DestCmdInfo.RemoveAll();
+	ResetDemoInterpolation();
+
+	return true;
+}
+
 void CDemoPlayer::SetEndTick( int tick )
 {
 	if ( tick < 0 )
@@ -1012,6 +1059,11 @@ bool CDemoPlayer::ParseAheadForInterval( int curtick, int intervalticks )
 					m_DemoFile.ReadStringTables( NULL );
 				}
 				break;
+			case dem_keyframe:
+				{
+					m_DemoFile.SkipKeyframe();
+				}
+				break;
 			default:
 				{
 					swallowmessages = false;
@@ -1064,6 +1116,37 @@ bool CDemoPlayer::ParseAheadForInterval( int curtick, int intervalticks )
 	return true;
 }
 
+void CDemoPlayer::ReadDemoStringTables()
+{
+	void *data = NULL;
+	int dataLen = 512 * 1024;
+	while ( dataLen <= DEMO_FILE_MAX_STRINGTABLE_SIZE )
+	{
+		data = realloc( data, dataLen );
+		bf_read buf( "dem_stringtables", data, dataLen );
+		// did we successfully read
+		if ( m_DemoFile.ReadStringTables( &buf ) > 0 )
+		{
+			buf.Seek( 0 );
+			if ( !networkStringTableContainerClient->ReadStringTables( buf ) )
+			{
+				Host_Error( "Error parsing string tables during demo playback." );
+			}
+			break;
+		}
+
+		// Didn't fit.  Try doubling the size of the buffer
+		dataLen *= 2;
+	}
+
+	if ( dataLen > DEMO_FILE_MAX_STRINGTABLE_SIZE )
+	{
+		Warning( "ReadPacket failed to read string tables. Trying to read string tables that's bigger than max string table size\n" );
+	}
+
+	free( data );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Read in next demo message and send to local client over network channel, if it's time.
 // Output : netpacket_t* -- NULL if there is no packet available at this time.
@@ -1232,33 +1315,32 @@ netpacket_t *CDemoPlayer::ReadPacket( void )
 			break;
 		case dem_stringtables:
 			{
-				void *data = NULL;
-				int dataLen = 512 * 1024;
-				while ( dataLen <= DEMO_FILE_MAX_STRINGTABLE_SIZE )
+				ReadDemoStringTables();
+			}
+			break;
+		case dem_keyframe:
+			{
+				if ( !m_bSeekingToKeyframe )
 				{
-					data = realloc( data, dataLen );
-					bf_read buf( "dem_stringtables", data, dataLen );
-					// did we successfully read
-					if ( m_DemoFile.ReadStringTables( &buf ) > 0 )
-					{
-						buf.Seek( 0 );
-						if ( !networkStringTableContainerClient->ReadStringTables( buf ) )
-						{
-							Host_Error( "Error parsing string tables during demo playback." );
-						}
-						break;
-					}
-
-					// Didn't fit.  Try doubling the size of the buffer
-					dataLen *= 2;
+					// only used to seek, linear playback has this state already
+					m_DemoFile.SkipKeyframe();
+					break;
 				}
 
-				if ( dataLen > DEMO_FILE_MAX_STRINGTABLE_SIZE )
+				if ( demo_debug.GetBool() )
 				{
-					Warning( "ReadPacket failed to read string tables. Trying to read string tables that's bigger than max string table size\n" );
+					Msg( "%d dem_keyframe\n", tick );
 				}
 
-				free( data );
+				m_bSeekingToKeyframe = false;
+
+				ReadDemoStringTables();
+
+				// the rest is a full entity update, read like a dem_packet
+				bStopReading = true;
+
+				// adjust playback host_tickcount to the keyframe
+				m_nStartTick = host_tickcount - tick;
 			}
 			break;
 		case dem_usercmd:
@@ -1602,6 +1684,7 @@ CDemoPlayer::CDemoPlayer()
 	m_flAutoResumeTime = 0.0;
 	m_flPlaybackRateModifier = 1.0f;
 	m_nSkipToTick = -1;
+	m_bSeekingToKeyframe = false;
 	m_nEndTick = 0;
 	m_bLoading = false;
 	
@@ -1693,6 +1776,7 @@ bool CDemoPlayer::StartPlayback( const char *filename, bool bAsTimeDemo )
  	cl.m_flNextCmdTime = net_time;
 
 	m_bTimeDemo = bAsTimeDemo;
+	m_bSeekingToKeyframe = false;
 	m_nTimeDemoCurrentFrame = -1;
 	m_nTimeDemoStartFrame = -1;
 
@@ -82,6 +82,8 @@ public:	// other public functions
 
 protected:
 	bool	OverrideView( democmdinfo_t& info );
+	bool	SeekToKeyframe( int tick );
+	void	ReadDemoStringTables();
 
 	virtual void	OnStopCommand();
 
@@ -97,6 +99,7 @@ public:
 	double			m_flAutoResumeTime; // how long do we pause demo playback
 	float			m_flPlaybackRateModifier;
 	int				m_nSkipToTick;	// skip to tick ASAP, -1 = off
+	bool			m_bSeekingToKeyframe; // file position is at a keyframe to apply
 	int				m_nEndTick; // if nonzero, stop playback once we reach this tick
 	bool			m_bLoading; // true if demo is loading
 
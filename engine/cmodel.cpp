@@ -14,6 +14,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include "mathlib/mathlib.h"
+#include "mathlib/ssemath.h"
 #include "common.h"
 #include "sysexternal.h"
 #include "zone.h"
@@ -28,6 +29,7 @@
 #include "collisionutils.h"
 #include "tier0/tslist.h"
 #include "tier0/vprof.h"
+#include "vstdlib/random.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1907,6 +1909,114 @@ void FASTCALL CM_RecursiveHullCheck ( TraceInfo_t *pTraceInfo, int num, const fl
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Up to four swept traces walking the tree together, see CM_BoxTraceBatch
+//-----------------------------------------------------------------------------
+struct TracePacket_t
+{
+	TraceInfo_t	*m_pTraceInfo[4];
+	FourVectors	m_start;
+	FourVectors	m_end;
+	FourVectors	m_extents;
+	fltx4		m_isPoint;		// ~0 in the lanes of point traces
+};
+
+// Walks the lanes of a packet down the tree as CM_RecursiveHullCheckImpl walks
+// one trace, for as long as all of them are on the same side of each plane.
+// Nothing gets clipped before that, so where a trace straddles a plane it
+// splits off and continues on its own from that node over its whole length,
+// and the lanes left on either side go on as smaller packets.
+static void FASTCALL CM_RecursiveHullCheckPacket( const TracePacket_t &packet, int nLanes, int num )
+{
+	// drop traces that already hit at their start
+	for ( int i = 0; i < 4; i++ )
+	{
+		if ( ( nLanes & ( 1 << i ) ) && packet.m_pTraceInfo[i]->m_trace.fraction <= 0 )
+		{
+			nLanes &= ~( 1 << i );
+		}
+	}
+
+	if ( !nLanes )
+		return;
+
+	CCollisionBSPData *pBSPData = packet.m_pTraceInfo[0]->m_pBSPData;
+
+	while ( num >= 0 )
+	{
+		cnode_t *node = pBSPData->map_rootnode + num;
+		cplane_t *plane = node->plane;
+		byte type = plane->type;
+		fltx4 dist = ReplicateX4( plane->dist );
+		fltx4 t1, t2, offset;
+
+		if ( type < 3 )
+		{
+			t1 = SubSIMD( packet.m_start[type], dist );
+			t2 = SubSIMD( packet.m_end[type], dist );
+			offset = packet.m_extents[type];
+		}
+		else
+		{
+			t1 = SubSIMD( packet.m_start * plane->normal, dist );
+			t2 = SubSIMD( packet.m_end * plane->normal, dist );
+
+			// extents are never negative, so |extents * normal| = extents * |normal|
+			Vector absNormal( fabsf( plane->normal.x ), fabsf( plane->normal.y ), fabsf( plane->normal.z ) );
+			offset = AndNotSIMD( packet.m_isPoint, packet.m_extents * absNormal );
+		}
+
+		fltx4 negOffset = NegSIMD( offset );
+		int nFront = TestSignSIMD( AndSIMD( CmpGtSIMD( t1, offset ), CmpGtSIMD( t2, offset ) ) ) & nLanes;
+		int nBack = TestSignSIMD( AndSIMD( CmpLtSIMD( t1, negOffset ), CmpLtSIMD( t2, negOffset ) ) ) & nLanes;
+
+		// see which sides we need to consider
+		if ( nFront == nLanes )
+		{
+			num = node->children[0];
+			continue;
+		}
+		if ( nBack == nLanes )
+		{
+			num = node->children[1];
+			continue;
+		}
+
+		// the packet diverges here
+		int nSplit = nLanes & ~( nFront | nBack );
+		for ( int i = 0; i < 4; i++ )
+		{
+			if ( nSplit & ( 1 << i ) )
+			{
+				CM_RecursiveHullCheck( packet.m_pTraceInfo[i], num, 0, 1 );
+			}
+		}
+
+		if ( nFront )
+		{
+			CM_RecursiveHullCheckPacket( packet, nFront, node->children[0] );
+		}
+		if ( nBack )
+		{
+			CM_RecursiveHullCheckPacket( packet, nBack, node->children[1] );
+		}
+		return;
+	}
+
+	// we are in a leaf node
+	for ( int i = 0; i < 4; i++ )
+	{
+		if ( !( nLanes & ( 1 << i ) ) )
+			continue;
+
+		TraceInfo_t *pTraceInfo = packet.m_pTraceInfo[i];
+		if ( pTraceInfo->m_ispoint )
+			CM_TraceToLeaf<true>( pTraceInfo, -1-num, 0, 1 );
+		else
+			CM_TraceToLeaf<false>( pTraceInfo, -1-num, 0, 1 );
+	}
+}
+
 void CM_ClearTrace( trace_t *trace )
 {
 	memset( trace, 0, sizeof(*trace));
@@ -2047,6 +2157,25 @@ void CM_BoxTraceAgainstLeafList( const Ray_t &ray, int *pLeafList, intp nLeafCou
 	Assert( !ray.m_IsRay || trace.allsolid || ( trace.fraction >= trace.fractionleftsolid ) );
 }
 
+//-----------------------------------------------------------------------------
+// Setup global trace data for a ray
+//-----------------------------------------------------------------------------
+static inline void CM_SetupBoxTrace( TraceInfo_t *pTraceInfo, const Ray_t& ray, int brushmask )
+{
+	pTraceInfo->m_bDispHit = false;
+	pTraceInfo->m_DispStabDir.Init();
+	pTraceInfo->m_contents = brushmask;
+	VectorCopy (ray.m_Start, pTraceInfo->m_start);
+	VectorAdd  (ray.m_Start, ray.m_Delta, pTraceInfo->m_end);
+	VectorMultiply (ray.m_Extents, -1.0f, pTraceInfo->m_mins);
+	VectorCopy (ray.m_Extents, pTraceInfo->m_maxs);
+	VectorCopy (ray.m_Extents, pTraceInfo->m_extents);
+	pTraceInfo->m_delta = ray.m_Delta;
+	pTraceInfo->m_invDelta = ray.InvDelta();
+	pTraceInfo->m_ispoint = ray.m_IsRay;
+	pTraceInfo->m_isswept = ray.m_IsSwept;
+}
+
 void CM_BoxTrace( const Ray_t& ray, int headnode, int brushmask, bool computeEndpt, trace_t& tr )
 {
 	VPROF("BoxTrace");
@@ -2071,18 +2200,7 @@ void CM_BoxTrace( const Ray_t& ray, int headnode, int brushmask, bool computeEnd
 		return;
 	}
 
-	pTraceInfo->m_bDispHit = false;
-	pTraceInfo->m_DispStabDir.Init();
-	pTraceInfo->m_contents = brushmask;
-	VectorCopy (ray.m_Start, pTraceInfo->m_start);
-	VectorAdd  (ray.m_Start, ray.m_Delta, pTraceInfo->m_end);
-	VectorMultiply (ray.m_Extents, -1.0f, pTraceInfo->m_mins);
-	VectorCopy (ray.m_Extents, pTraceInfo->m_maxs);
-	VectorCopy (ray.m_Extents, pTraceInfo->m_extents);
-	pTraceInfo->m_delta = ray.m_Delta;
-	pTraceInfo->m_invDelta = ray.InvDelta();
-	pTraceInfo->m_ispoint = ray.m_IsRay;
-	pTraceInfo->m_isswept = ray.m_IsSwept;
+	CM_SetupBoxTrace( pTraceInfo, ray, brushmask );
 
 	if (!ray.m_IsSwept)
 	{
@@ -2107,6 +2225,136 @@ void CM_BoxTrace( const Ray_t& ray, int headnode, int brushmask, bool computeEnd
 }
 
 
+//-----------------------------------------------------------------------------
+// Traces many rays at once, same results as CM_BoxTrace on each. Swept rays
+// go through the tree four at a time in a TracePacket_t, so batches of rays
+// that start close and point the same way share most of the walk.
+//-----------------------------------------------------------------------------
+static void CM_FinishPacket( TracePacket_t &packet, const intp *pRayIndex, int nLanes, int headnode,
+	const Ray_t *pRays, bool computeEndpt, trace_t *pTraces )
+{
+	// pad the packet with its first ray
+	for ( int i = nLanes; i < 4; i++ )
+	{
+		packet.m_pTraceInfo[i] = packet.m_pTraceInfo[0];
+		packet.m_start.X( i ) = packet.m_start.X( 0 );
+		packet.m_start.Y( i ) = packet.m_start.Y( 0 );
+		packet.m_start.Z( i ) = packet.m_start.Z( 0 );
+		packet.m_end.X( i ) = packet.m_end.X( 0 );
+		packet.m_end.Y( i ) = packet.m_end.Y( 0 );
+		packet.m_end.Z( i ) = packet.m_end.Z( 0 );
+		packet.m_extents.X( i ) = packet.m_extents.X( 0 );
+		packet.m_extents.Y( i ) = packet.m_extents.Y( 0 );
+		packet.m_extents.Z( i ) = packet.m_extents.Z( 0 );
+	}
+
+	alignas(16) int32 isPoint[4];
+	for ( int i = 0; i < 4; i++ )
+	{
+		isPoint[i] = packet.m_pTraceInfo[i]->m_ispoint ? ~0 : 0;
+	}
+	packet.m_isPoint = LoadAlignedSIMD( isPoint );
+
+	CM_RecursiveHullCheckPacket( packet, ( 1 << nLanes ) - 1, headnode );
+
+	for ( int i = 0; i < nLanes; i++ )
+	{
+		TraceInfo_t *pTraceInfo = packet.m_pTraceInfo[i];
+		const Ray_t &ray = pRays[ pRayIndex[i] ];
+		trace_t &tr = pTraces[ pRayIndex[i] ];
+
+		// Compute the trace start + end points
+		if (computeEndpt)
+		{
+			CM_ComputeTraceEndpoints( ray, pTraceInfo->m_trace );
+		}
+
+		// Copy off the results
+		tr = pTraceInfo->m_trace;
+		EndTrace( pTraceInfo );
+		Assert( !ray.m_IsRay || tr.allsolid || (tr.fraction >= tr.fractionleftsolid) );
+	}
+}
+
+void CM_BoxTraceBatch( const Ray_t *pRays, intp nRays, int headnode, int brushmask, bool computeEndpt, trace_t *pTraces )
+{
+	VPROF("BoxTraceBatch");
+
+	CCollisionBSPData *pBSPData = GetCollisionBSPData();
+
+	// check if the map is not loaded
+	if (!pBSPData->numnodes)
+	{
+		for ( intp i = 0; i < nRays; i++ )
+		{
+			CM_ClearTrace( &pTraces[i] );
+		}
+		return;
+	}
+
+	TracePacket_t packet;
+	intp rayIndex[4];
+	int nLanes = 0;
+
+	for ( intp i = 0; i < nRays; i++ )
+	{
+		const Ray_t &ray = pRays[i];
+
+		// for multi-check avoidance
+		TraceInfo_t *pTraceInfo = BeginTrace();
+
+#ifdef COUNT_COLLISIONS
+		// for statistics, may be zeroed
+		g_CollisionCounts.m_Traces++;
+#endif
+
+		// fill in a default trace
+		CM_ClearTrace( &pTraceInfo->m_trace );
+
+		pTraceInfo->m_pBSPData = pBSPData;
+		CM_SetupBoxTrace( pTraceInfo, ray, brushmask );
+
+		if (!ray.m_IsSwept)
+		{
+			// check for position test special case
+			CM_UnsweptBoxTrace( pTraceInfo, ray, headnode, brushmask );
+
+			if (computeEndpt)
+			{
+				CM_ComputeTraceEndpoints( ray, pTraceInfo->m_trace );
+			}
+
+			pTraces[i] = pTraceInfo->m_trace;
+			EndTrace( pTraceInfo );
+			continue;
+		}
+
+		packet.m_pTraceInfo[nLanes] = pTraceInfo;
+		packet.m_start.X( nLanes ) = pTraceInfo->m_start.x;
+		packet.m_start.Y( nLanes ) = pTraceInfo->m_start.y;
+		packet.m_start.Z( nLanes ) = pTraceInfo->m_start.z;
+		packet.m_end.X( nLanes ) = pTraceInfo->m_end.x;
+		packet.m_end.Y( nLanes ) = pTraceInfo->m_end.y;
+		packet.m_end.Z( nLanes ) = pTraceInfo->m_end.z;
+		packet.m_extents.X( nLanes ) = pTraceInfo->m_extents.x;
+		packet.m_extents.Y( nLanes ) = pTraceInfo->m_extents.y;
+		packet.m_extents.Z( nLanes ) = pTraceInfo->m_extents.z;
+		rayIndex[nLanes] = i;
+
+		if ( ++nLanes == 4 )
+		{
+			CM_FinishPacket( packet, rayIndex, nLanes, headnode, pRays, computeEndpt, pTraces );
+			nLanes = 0;
+		}
+	}
+
+	if ( nLanes )
+	{
+		CM_FinishPacket( packet, rayIndex, nLanes, headnode, pRays, computeEndpt, pTraces );
+	}
+}
+
+
 void CM_TransformedBoxTrace( const Ray_t& ray, int headnode, int brushmask,
 							const Vector& origin, QAngle const& angles, trace_t& tr )
 {
@@ -2890,3 +3138,92 @@ CON_COMMAND( opt_test_rotation, "Quick timing test of vector rotation my m3x4" )
 }
 
 #endif
+
+//-----------------------------------------------------------------------------
+// Compares CM_BoxTraceBatch with CM_BoxTrace on the loaded map. Traces fans
+// of rays from random open points, like AI sensing or a shotgun blast does.
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( trace_batch_bench, "Times batched against single world traces on the loaded map. Arguments: [number of fans of 16 rays] [1 to trace player hulls]", FCVAR_CHEAT )
+{
+	CCollisionBSPData *pBSPData = GetCollisionBSPData();
+	if ( !pBSPData->numnodes )
+	{
+		Msg( "No map loaded.\n" );
+		return;
+	}
+
+	const int nRaysPerFan = 16;
+	int nFans = args.ArgC() > 1 ? Max( 1, atoi( args[1] ) ) : 1000;
+	bool bHull = args.ArgC() > 2 && atoi( args[2] ) != 0;
+
+	Vector vecExtents = bHull ? Vector( 16, 16, 36 ) : vec3_origin;
+	const cmodel_t *pWorld = &pBSPData->map_cmodels[0];
+
+	// Same rays every run
+	CUniformRandomStream random;
+	random.SetSeed( 1 );
+
+	CUtlVector<Ray_t> rays;
+	rays.EnsureCapacity( nFans * nRaysPerFan );
+	for ( int nAttempts = 0; rays.Count() < nFans * nRaysPerFan && nAttempts < nFans * 100; ++nAttempts )
+	{
+		Vector vecStart( random.RandomFloat( pWorld->mins.x, pWorld->maxs.x ),
+			random.RandomFloat( pWorld->mins.y, pWorld->maxs.y ),
+			random.RandomFloat( pWorld->mins.z, pWorld->maxs.z ) );
+		if ( CM_PointContents( vecStart, 0 ) & MASK_SOLID )
+			continue;
+
+		QAngle angCenter( random.RandomFloat( -30, 30 ), random.RandomFloat( 0, 360 ), 0 );
+		for ( int i = 0; i < nRaysPerFan; i++ )
+		{
+			QAngle angRay = angCenter + QAngle( random.RandomFloat( -10, 10 ), random.RandomFloat( -10, 10 ), 0 );
+			Vector vecDir;
+			AngleVectors( angRay, &vecDir );
+
+			Ray_t &ray = rays[ rays.AddToTail() ];
+			ray.Init( vecStart, vecStart + vecDir * 4096.0f, -vecExtents, vecExtents );
+		}
+	}
+
+	if ( rays.IsEmpty() )
+	{
+		Msg( "Found no open space to trace from.\n" );
+		return;
+	}
+
+	CUtlVector<trace_t> scalarTraces, batchTraces;
+	scalarTraces.SetCount( rays.Count() );
+	batchTraces.SetCount( rays.Count() );
+
+	// warm up the caches
+	CM_BoxTraceBatch( rays.Base(), rays.Count(), 0, MASK_SOLID, true, batchTraces.Base() );
+
+	double flStart = Plat_FloatTime();
+	for ( intp i = 0; i < rays.Count(); i++ )
+	{
+		CM_BoxTrace( rays[i], 0, MASK_SOLID, true, scalarTraces[i] );
+	}
+	double flScalar = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	CM_BoxTraceBatch( rays.Base(), rays.Count(), 0, MASK_SOLID, true, batchTraces.Base() );
+	double flBatch = Plat_FloatTime() - flStart;
+
+	int nMismatched = 0;
+	for ( intp i = 0; i < rays.Count(); i++ )
+	{
+		const trace_t &scalar = scalarTraces[i];
+		const trace_t &batch = batchTraces[i];
+		if ( fabsf( scalar.fraction - batch.fraction ) > 1e-4f ||
+			scalar.startsolid != batch.startsolid || scalar.allsolid != batch.allsolid )
+		{
+			++nMismatched;
+		}
+	}
+
+	Msg( "%zd %s: single %.2fms (%.0f traces/s), batched %.2fms (%.0f traces/s), %.2fx, %d mismatched.\n",
+		rays.Count(), bHull ? "hulls" : "rays",
+		flScalar * 1000.0, flScalar > 0 ? rays.Count() / flScalar : 0.0,
+		flBatch * 1000.0, flBatch > 0 ? rays.Count() / flBatch : 0.0,
+		flBatch > 0 ? flScalar / flBatch : 0.0, nMismatched );
+}
@@ -38,7 +38,10 @@
 #include "tier3/tier3.h"
 #include "vgui/ILocalize.h"
 #include "tier1/lzss.h"
+#include "tier1/checksum_crc.h"
+#include "tier0/threadtools.h"
 #include <snappy.h>
+#include "zlib/zlib.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1348,6 +1351,124 @@ bool COM_BufferToBufferCompress_Snappy( OUT_BYTECAP(*destLen) void *dest, unsign
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+// Deflate buffers carry the dictionary they were compressed with, so the
+// receiver can refuse data it has no dictionary for.
+//-----------------------------------------------------------------------------
+struct deflate_header_t
+{
+	unsigned int	id;
+	unsigned int	actualSize;		// always little endian
+	unsigned int	dictionaryId;	// always little endian, 0 if no dictionary
+};
+
+// Deflate window is 32 KiB, nothing before that can be referenced.
+static byte s_DeflateDictionary[32768];
+static unsigned int s_nDeflateDictionarySize = 0;
+static uint32 s_nDeflateDictionaryId = 0;
+// Channels compress and decompress on several threads while the dictionary
+// convar may change on the main one.
+static CThreadSpinRWLock s_DeflateDictionaryLock;
+
+//-----------------------------------------------------------------------------
+void COM_SetDeflateDictionary( IN_BYTECAP(nSize) const void *pDictionary, unsigned int nSize )
+{
+	s_DeflateDictionaryLock.LockForWrite();
+
+	if ( !pDictionary || !nSize )
+	{
+		s_nDeflateDictionarySize = 0;
+		s_nDeflateDictionaryId = 0;
+
+		s_DeflateDictionaryLock.UnlockWrite();
+		return;
+	}
+
+	// Keep the tail, it's closest to the data and the most useful part.
+	if ( nSize > sizeof(s_DeflateDictionary) )
+	{
+		pDictionary = static_cast<const byte *>(pDictionary) + nSize - sizeof(s_DeflateDictionary);
+		nSize = sizeof(s_DeflateDictionary);
+	}
+
+	V_memcpy( s_DeflateDictionary, pDictionary, nSize );
+	s_nDeflateDictionarySize = nSize;
+
+	// 0 means no dictionary on the wire.
+	const uint32 nId = CRC32_ProcessSingleBuffer( s_DeflateDictionary, nSize );
+	s_nDeflateDictionaryId = nId ? nId : 1;
+
+	s_DeflateDictionaryLock.UnlockWrite();
+}
+
+//-----------------------------------------------------------------------------
+uint32 COM_GetDeflateDictionaryId()
+{
+	s_DeflateDictionaryLock.LockForRead();
+	const uint32 nId = s_nDeflateDictionaryId;
+	s_DeflateDictionaryLock.UnlockRead();
+
+	return nId;
+}
+
+//-----------------------------------------------------------------------------
+unsigned int COM_GetIdealDestinationCompressionBufferSize_Deflate( unsigned int uncompressedSize )
+{
+	// compressBound accounts for the zlib wrapper we don't write, so it's a safe upper bound for raw deflate.
+	return sizeof(deflate_header_t) + compressBound( uncompressedSize );
+}
+
+//-----------------------------------------------------------------------------
+bool COM_BufferToBufferCompress_Deflate( OUT_BYTECAP(*destLen) void *dest, unsigned int *destLen, IN_BYTECAP(sourceLen) const void *source, unsigned int sourceLen, int nLevel, bool bUseDictionary )
+{
+	Assert( dest );
+	Assert( destLen );
+	Assert( source );
+
+	if ( *destLen <= sizeof(deflate_header_t) )
+		return false;
+
+	z_stream stream;
+	BitwiseClear( stream );
+
+	// Raw deflate, the header below replaces the zlib wrapper.
+	if ( deflateInit2( &stream, clamp( nLevel, 1, 9 ), Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+		return false;
+
+	// zlib copies the dictionary into its window, so the lock only covers this.
+	s_DeflateDictionaryLock.LockForRead();
+	const uint32 nDictionaryId = bUseDictionary ? s_nDeflateDictionaryId : 0;
+	const bool bDictionarySet = !nDictionaryId || deflateSetDictionary( &stream, s_DeflateDictionary, s_nDeflateDictionarySize ) == Z_OK;
+	s_DeflateDictionaryLock.UnlockRead();
+
+	if ( !bDictionarySet )
+	{
+		deflateEnd( &stream );
+		return false;
+	}
+
+	stream.next_in = static_cast<Bytef *>(const_cast<void *>(source));
+	stream.avail_in = sourceLen;
+	stream.next_out = static_cast<Bytef *>(dest) + sizeof(deflate_header_t);
+	stream.avail_out = *destLen - sizeof(deflate_header_t);
+
+	const int ret = deflate( &stream, Z_FINISH );
+	const uLong nCompressedSize = stream.total_out;
+	deflateEnd( &stream );
+
+	// Anything else means the output didn't fit.
+	if ( ret != Z_STREAM_END )
+		return false;
+
+	deflate_header_t *pHeader = static_cast<deflate_header_t *>(dest);
+	pHeader->id = DEFLATE_ID;
+	pHeader->actualSize = LittleLong( sourceLen );
+	pHeader->dictionaryId = LittleLong( nDictionaryId );
+
+	*destLen = sizeof(deflate_header_t) + nCompressedSize;
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 unsigned COM_GetIdealDestinationCompressionBufferSize_LZSS( unsigned int uncompressedSize )
 {
@@ -1404,6 +1525,10 @@ int COM_GetUncompressedSize( IN_BYTECAP(compressedLen) const void *compressed, u
 	if ( ( compressedLen >= sizeof(lzss_header_t) ) && pHeader->id == LZSS_ID )
 		return LittleLong( pHeader->actualSize );
 
+	// Check for deflate compressed
+	if ( ( compressedLen >= sizeof(deflate_header_t) ) && pHeader->id == DEFLATE_ID )
+		return LittleLong( pHeader->actualSize );
+
 	// Check for Snappy compressed
 	if ( compressedLen > sizeof(pHeader->id) && pHeader->id == SNAPPY_ID )
 	{
@@ -1456,6 +1581,52 @@ bool COM_BufferToBufferDecompress( OUT_BYTECAP(*destLen) void *dest, unsigned in
 			return true;
 		}
 
+		if ( pHeader->id == DEFLATE_ID )
+		{
+			const uint32 nDictionaryId = LittleLong( static_cast<const deflate_header_t *>(source)->dictionaryId );
+
+			z_stream stream;
+			BitwiseClear( stream );
+
+			if ( inflateInit2( &stream, -MAX_WBITS ) != Z_OK )
+				return false;
+
+			// Check and set under one lock, the dictionary may change in between otherwise.
+			s_DeflateDictionaryLock.LockForRead();
+			const uint32 nLoadedDictionaryId = s_nDeflateDictionaryId;
+			const bool bDictionaryLoaded = nDictionaryId == 0 || nDictionaryId == nLoadedDictionaryId;
+			const bool bDictionarySet = !nDictionaryId || ( bDictionaryLoaded && inflateSetDictionary( &stream, s_DeflateDictionary, s_nDeflateDictionarySize ) == Z_OK );
+			s_DeflateDictionaryLock.UnlockRead();
+
+			if ( !bDictionaryLoaded )
+			{
+				Warning( "NET_BufferToBufferDecompress: deflate dictionary %08x is not loaded (current %08x)\n", nDictionaryId, nLoadedDictionaryId );
+			}
+
+			if ( !bDictionarySet )
+			{
+				inflateEnd( &stream );
+				return false;
+			}
+
+			stream.next_in = static_cast<Bytef *>(const_cast<void *>(source)) + sizeof(deflate_header_t);
+			stream.avail_in = sourceLen - sizeof(deflate_header_t);
+			stream.next_out = static_cast<Bytef *>(dest);
+			stream.avail_out = nDecompressedSize;
+
+			const int ret = inflate( &stream, Z_FINISH );
+			const uLong nInflatedSize = stream.total_out;
+			inflateEnd( &stream );
+
+			if ( ret != Z_STREAM_END || nInflatedSize != (uLong)nDecompressedSize )
+			{
+				Warning( "NET_BufferToBufferDecompress: header said %d bytes would be decompressed, but we inflated %lu\n", nDecompressedSize, nInflatedSize );
+				return false;
+			}
+			*destLen = nDecompressedSize;
+			return true;
+		}
+
 		// Mismatch between this routine and COM_GetUncompressedSize
 		AssertMsg( false, "Unknown compression type?" );
 		return false;
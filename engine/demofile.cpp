@@ -161,7 +161,8 @@ void CDemoFile::WriteCmdHeader( unsigned char cmd, int tick )
 		"dem_usercmd",
 		"dem_datatables",
 		"dem_stop",
-		"dem_stringtables"
+		"dem_stringtables",
+		"dem_keyframe"
 	};
 
 	DemoFileDbg( "WriteCmdHeader()..." );
@@ -322,6 +323,140 @@ int CDemoFile::ReadUserCmd( char *buffer, int &size )
 	return outgoing_sequence;
 }
 
+void CDemoFile::WriteKeyframeStringTables( bf_write *buf, int tick )
+{
+	DemoFileDbg( "WriteKeyframeStringTables()\n" );
+	MEM_ALLOC_CREDIT();
+
+	if ( !m_pBuffer || !m_pBuffer->IsValid() )
+	{
+		DevMsg("CDemoFile::WriteKeyframeStringTables: Haven't opened file yet!\n" );
+		return;
+	}
+
+	demoindexentry_t &entry = m_KeyframeIndex[ m_KeyframeIndex.AddToTail() ];
+	entry.tick = tick;
+	entry.fileoffset = GetCurPos( false );
+
+	WriteCmdHeader( dem_keyframe, tick );
+
+	WriteRawData( (char*)buf->GetBasePointer(), buf->GetNumBytesWritten() );
+}
+
+void CDemoFile::SkipKeyframe()
+{
+	ReadStringTables( NULL );
+
+	democmdinfo_t info;
+	ReadCmdInfo( info );
+
+	int nSeqNrIn, nSeqNrOutAck;
+	ReadSequenceInfo( nSeqNrIn, nSeqNrOutAck );
+
+	ReadRawData( NULL, 0 );
+}
+
+void CDemoFile::WriteDemoIndex()
+{
+	DemoFileDbg( "WriteDemoIndex()\n" );
+	Assert( m_pBuffer && m_pBuffer->IsValid() );
+
+	// keep the index aligned for readers using it in place
+	while ( GetCurPos( false ) % 4 )
+	{
+		m_pBuffer->PutUnsignedChar( 0 );
+	}
+
+	demoindexfooter_t footer;
+	V_memset( &footer, 0, sizeof(footer) );
+	V_strcpy_safe( footer.indexstamp, DEMO_INDEX_ID );
+	footer.numentries = m_KeyframeIndex.Count();
+	footer.indexoffset = GetCurPos( false );
+
+	for ( const auto &entry : m_KeyframeIndex )
+	{
+		demoindexentry_t littleEndianEntry = entry;
+		ByteSwap_demoindexentry_t( littleEndianEntry );
+		m_pBuffer->Put( &littleEndianEntry, sizeof(littleEndianEntry) ); //-V2002
+	}
+
+	ByteSwap_demoindexfooter_t( footer );
+	m_pBuffer->Put( &footer, sizeof(footer) ); //-V2002
+}
+
+bool CDemoFile::ReadDemoIndex()
+{
+	m_KeyframeIndex.RemoveAll();
+
+	const int nSize = GetSize();
+	if ( nSize < (int)( sizeof(demoheader_t) + sizeof(demoindexfooter_t) ) )
+		return false;
+
+	const unsigned int nStartPos = GetCurPos( true );
+
+	demoindexfooter_t footer;
+	m_pBuffer->SeekGet( CUtlBuffer::SEEK_HEAD, nSize - (int)sizeof(footer) );
+	m_pBuffer->Get( &footer, sizeof(footer) ); //-V2002
+	ByteSwap_demoindexfooter_t( footer );
+
+	bool bOk = m_pBuffer->IsValid() &&
+		!Q_strncmp( footer.indexstamp, DEMO_INDEX_ID, sizeof(footer.indexstamp) ) &&
+		footer.numentries >= 0 &&
+		footer.indexoffset >= (int)sizeof(demoheader_t) &&
+		footer.indexoffset + footer.numentries * (int)sizeof(demoindexentry_t) == nSize - (int)sizeof(footer);
+
+	if ( bOk && footer.numentries > 0 )
+	{
+		m_KeyframeIndex.SetCount( footer.numentries );
+
+		m_pBuffer->SeekGet( CUtlBuffer::SEEK_HEAD, footer.indexoffset );
+		m_pBuffer->Get( m_KeyframeIndex.Base(), footer.numentries * sizeof(demoindexentry_t) ); //-V2002
+
+		for ( auto &entry : m_KeyframeIndex )
+		{
+			ByteSwap_demoindexentry_t( entry );
+		}
+
+		bOk = m_pBuffer->IsValid();
+	}
+
+	if ( !bOk )
+	{
+		// demo still being recorded or cut, play it linearly
+		ConDMsg( "%s has no valid keyframe index.\n", m_szFileName );
+		m_KeyframeIndex.RemoveAll();
+	}
+
+	m_pBuffer->SeekGet( CUtlBuffer::SEEK_HEAD, nStartPos );
+
+	return bOk;
+}
+
+const demoindexentry_t *CDemoFile::FindKeyframe( int tick ) const
+{
+	const demoindexentry_t *pFound = NULL;
+
+	intp nLow = 0;
+	intp nHigh = m_KeyframeIndex.Count() - 1;
+
+	while ( nLow <= nHigh )
+	{
+		intp nMid = ( nLow + nHigh ) / 2;
+
+		if ( m_KeyframeIndex[nMid].tick <= tick )
+		{
+			pFound = &m_KeyframeIndex[nMid];
+			nLow = nMid + 1;
+		}
+		else
+		{
+			nHigh = nMid - 1;
+		}
+	}
+
+	return pFound;
+}
+
 //
 // Purpose: Rewind from the current spot by the time stamp, byte code and frame counter offsets
 //-----------------------------------------------------------------------------
@@ -465,6 +600,11 @@ demoheader_t *CDemoFile::ReadDemoHeader()
 		return NULL;
 	}
 
+	if ( m_DemoHeader.demoprotocol > DEMO_PROTOCOL_LINEAR )
+	{
+		ReadDemoIndex();
+	}
+
 	return &m_DemoHeader;
 }
 
@@ -497,6 +637,7 @@ bool CDemoFile::Open(const char *name, bool bReadOnly, bool bMemoryBuffer, int n
 
 	m_szFileName[0] = 0;  // clear name
 	Q_memset( &m_DemoHeader, 0, sizeof(m_DemoHeader) ); // and demo header
+	m_KeyframeIndex.RemoveAll();
 
 	// This is used by replay, which manually writes a header.
 	m_bAllowHeaderWrite = bAllowHeaderWrite;
@@ -70,6 +70,18 @@ public:
 	void	WriteUserCmd( int cmdnumber, const char *buffer, unsigned char bytes, int tick );
 	int		ReadUserCmd( char *buffer, int &size );
 
+	// Starts a dem_keyframe and adds it to the index. The caller writes the packet
+	// part (cmd info, sequence info, raw data) like for a dem_packet.
+	void	WriteKeyframeStringTables( bf_write *buf, int tick );
+	// After a dem_keyframe header, the string tables are read with ReadStringTables.
+	void	SkipKeyframe();
+
+	// Index of demo protocol 4 files, written after dem_stop and read by ReadDemoHeader.
+	void	WriteDemoIndex();
+	bool	HasDemoIndex() const { return m_KeyframeIndex.Count() > 0; }
+	// Returns the last keyframe at or before tick, NULL if there is none.
+	const demoindexentry_t *FindKeyframe( int tick ) const;
+
 	void	WriteDemoHeader();
 	demoheader_t *ReadDemoHeader();
 
@@ -83,6 +95,10 @@ public:
 	CUtlBuffer		*m_pBuffer;
 	bool			m_bAllowHeaderWrite;
 	bool			m_bIsStreamBuffer;
+	CUtlVector<demoindexentry_t>	m_KeyframeIndex;	// sorted by tick
+
+private:
+	bool	ReadDemoIndex();
 };
 
 #endif // DEMOFILE_H
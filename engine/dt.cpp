@@ -95,6 +95,7 @@ CSendTablePrecalc::CSendTablePrecalc() :
 	m_pDTITable = NULL;
 	m_pSendTable = 0;
 	m_nDataTableProxies = 0;
+	m_bHasPropOffsetMap = false;
 }
 
 
@@ -19,6 +19,7 @@
 #include "dt_encode.h"
 #include "utlmap.h"
 #include "tier1/bitbuf.h"
+#include "bitvec.h"
 
 
 class SendTable;
@@ -410,6 +411,12 @@ public:
 	
 	// Map prop offsets to indices for properties that can use it.
 	CUtlMap<unsigned short, unsigned short> m_PropOffsetToIndexMap;
+
+	// Props whose changes can't be seen through the edict change offsets (not in
+	// m_PropOffsetToIndexMap or encoded against tick count). SendTable_EncodeChanged
+	// always re-encodes these. Only valid if m_bHasPropOffsetMap is set.
+	CBitVec<MAX_DATATABLE_PROPS> m_UntrackedProps;
+	bool					m_bHasPropOffsetMap;
 };
 
 
@@ -13,6 +13,7 @@
 #include "convar.h"
 #include "con_nprint.h"
 #include "utldict.h"
+#include "tier0/threadtools.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -205,6 +206,33 @@ void BuildPropOffsetToIndexMap( CSendTablePrecalc *pPrecalc, const CStandardSend
 }
 
 
+void SendTable_InitPropOffsetMap( const SendTable *pSendTable, const CStandardSendProxies *pSendProxies )
+{
+	CSendTablePrecalc *pPrecalc = pSendTable->m_pPrecalc;
+
+	pPrecalc->m_PropOffsetToIndexMap.RemoveAll();
+	BuildPropOffsetToIndexMap( pPrecalc, pSendProxies );
+
+	// Everything that can't be reached through a change offset must always be re-encoded.
+	pPrecalc->m_UntrackedProps.SetAll();
+
+	FOR_EACH_MAP_FAST( pPrecalc->m_PropOffsetToIndexMap, i )
+	{
+		pPrecalc->m_UntrackedProps.Clear( pPrecalc->m_PropOffsetToIndexMap[i] & ~PROP_INDEX_VECTOR_ELEM_MARKER );
+	}
+
+	for ( intp iProp = 0; iProp < pPrecalc->GetNumProps(); iProp++ )
+	{
+		if ( pPrecalc->GetProp( iProp )->GetFlags() & SPROP_ENCODED_AGAINST_TICKCOUNT )
+		{
+			pPrecalc->m_UntrackedProps.Set( static_cast<int>(iProp) );
+		}
+	}
+
+	pPrecalc->m_bHasPropOffsetMap = true;
+}
+
+
 void LocalTransfer_InitFastCopy( 
 	const SendTable *pSendTable, 
 	const CStandardSendProxies *pSendProxies,
@@ -217,8 +245,7 @@ void LocalTransfer_InitFastCopy(
 	CSendTablePrecalc *pPrecalc = pSendTable->m_pPrecalc;
 
 	// Setup the offset-to-index map.
-	pPrecalc->m_PropOffsetToIndexMap.RemoveAll();
-	BuildPropOffsetToIndexMap( pPrecalc, pSendProxies );
+	SendTable_InitPropOffsetMap( pSendTable, pSendProxies );
 
 	// Clear the old lists.
 	pPrecalc->m_FastLocalTransfer.m_FastInt32.Purge();
@@ -291,7 +318,7 @@ void LocalTransfer_InitFastCopy(
 }
 
 
-inline int MapPropOffsetsToIndices( 
+int MapPropOffsetsToIndices( 
 	const CBaseEdict *pEdict,
 	CSendTablePrecalc *pPrecalc, 
 	const unsigned short *pOffsets,
@@ -320,9 +347,12 @@ inline int MapPropOffsetsToIndices(
 
 			if ( dt_ShowPartialChangeEnts.GetInt() )
 			{
+				// Entities are packed on several threads at once
+				static CThreadFastMutex testDictMutex;
 				static CUtlDict<int,int> testDict;
 				char str[512];
 				Q_snprintf( str, sizeof( str ), "LocalTransfer offset miss - class: %s, DT: %s, offset: %d", pEdict->GetClassName(), pPrecalc->m_pSendTable->m_pNetTableName, pOffsets[i] );
+				AUTO_LOCK( testDictMutex );
 				if ( testDict.Find( str ) == testDict.InvalidIndex() )
 				{
 					testDict.Insert( str );
@@ -17,6 +17,7 @@
 
 
 class CBaseEdict;
+class CSendTablePrecalc;
 
 
 // This sets up the ability to copy an entity with the specified SendTable directly
@@ -30,6 +31,18 @@ void LocalTransfer_InitFastCopy(
 	int &nFastCopyProps
 	);
 
+// Builds the SendTable's map from entity field offsets to prop indices, used to turn
+// the edict change offsets reported by the game into changed props.
+void SendTable_InitPropOffsetMap( const SendTable *pSendTable, const CStandardSendProxies *pSendProxies );
+
+// Maps edict change offsets to prop indices. pOut must have room for nOffsets*3 entries.
+int MapPropOffsetsToIndices( 
+	const CBaseEdict *pEdict,
+	CSendTablePrecalc *pPrecalc, 
+	const unsigned short *pOffsets,
+	unsigned short nOffsets,
+	unsigned short *pOut );
+
 // Transfer the data from pSrcEnt to pDestEnt using the specified SendTable and RecvTable.
 void LocalTransfer_TransferEntity( 
 	const CBaseEdict *pEdict, 
@@ -289,7 +289,8 @@ static inline void ShowEncodeDeltaWatchInfo(
 }
 
 // dimhotepus: unsigned long -> int.
-static FORCEINLINE void SendTable_EncodeProp( CEncodeInfo * pInfo, int iProp )
+// Returns the bit position where the prop data (after the index) starts.
+static FORCEINLINE intp SendTable_EncodeProp( CEncodeInfo * pInfo, int iProp )
 {
 	// Call their proxy to get the property's value.
 	DVariant var;
@@ -309,6 +310,8 @@ static FORCEINLINE void SendTable_EncodeProp( CEncodeInfo * pInfo, int iProp )
 	// Write the index.
 	pInfo->m_DeltaBitsWriter.WritePropIndex( iProp );
 
+	const intp iDataStartBit = pInfo->m_DeltaBitsWriter.GetBitBuf()->GetNumBitsWritten();
+
 	g_PropTypeFns[pProp->m_Type].Encode( 
 		pStructBase, 
 		&var, 
@@ -316,6 +319,8 @@ static FORCEINLINE void SendTable_EncodeProp( CEncodeInfo * pInfo, int iProp )
 		pInfo->m_DeltaBitsWriter.GetBitBuf(), 
 		pInfo->GetObjectID()
 		); 
+
+	return iDataStartBit;
 }
 
 // dimhotepus: unsigned long -> int.
@@ -453,6 +458,106 @@ bool SendTable_Encode(
 }
 
 
+int SendTable_EncodeChanged(
+	const SendTable *pTable,
+	const void *pStruct, 
+	bf_write *pOut, 
+	int objectID,
+	CUtlMemory<CSendProxyRecipients> *pRecipients,
+	const void *pPrevState,
+	const int nPrevBits,
+	const CBitVec<MAX_DATATABLE_PROPS> &dirtyProps,
+	int *pDeltaProps,
+	int nMaxDeltaProps
+	)
+{
+	CSendTablePrecalc *pPrecalc = pTable->m_pPrecalc;
+	ErrorIfNot( pPrecalc, ("SendTable_EncodeChanged: Missing m_pPrecalc for SendTable %s.", pTable->m_pNetTableName) );
+	Assert( pPrecalc->m_bHasPropOffsetMap );
+	if ( pRecipients )
+	{
+		ErrorIfNot(	pRecipients->NumAllocated() >= pPrecalc->GetNumDataTableProxies(), ("SendTable_EncodeChanged: pRecipients array too small.") );
+	}
+
+	VPROF( "SendTable_EncodeChanged" );
+
+	CServerDTITimer timer( pTable, SERVERDTI_ENCODE );
+
+	// Setup all the info we'll be walking the tree with. This calls the datatable proxies
+	// so the recipients and which props exist are always up to date.
+	CEncodeInfo info( pPrecalc, (unsigned char*)pStruct, objectID, pOut );
+	info.m_pRecipients = pRecipients;
+
+	info.Init();
+
+	bf_read prevBits( "SendTable_EncodeChanged->prevBits", pPrevState, BitByte( nPrevBits ), nPrevBits );
+	CDeltaBitsReader prevBitsReader( &prevBits );
+	unsigned int iPrevProp = prevBitsReader.ReadNextPropIndex();
+
+	const CBitVec<MAX_DATATABLE_PROPS> &untrackedProps = pPrecalc->m_UntrackedProps;
+
+	int *pDeltaPropsBase = pDeltaProps;
+	int *pDeltaPropsEnd = pDeltaProps + nMaxDeltaProps;
+
+	int iNumProps = pPrecalc->GetNumProps();
+
+	for ( int iProp=0; iProp < iNumProps; iProp++ )
+	{
+		// Skip any properties in the previous state that aren't in the new state.
+		while ( iPrevProp < (unsigned int)iProp )
+		{
+			prevBitsReader.SkipPropData( pPrecalc->GetProp( iPrevProp ) );
+			iPrevProp = prevBitsReader.ReadNextPropIndex();
+		}
+
+		// skip if we don't have a valid prop proxy
+		if ( !info.IsPropProxyValid( iProp ) )
+			continue;
+
+		const SendProp *pProp = pPrecalc->GetProp( iProp );
+		const bool bInPrev = ( iPrevProp == (unsigned int)iProp );
+
+		if ( bInPrev && !dirtyProps.IsBitSet( iProp ) && !untrackedProps.IsBitSet( iProp ) )
+		{
+			// Nobody touched it, reuse the bits from the previous state.
+			info.m_DeltaBitsWriter.WritePropIndex( iProp );
+			prevBitsReader.CopyPropData( info.m_DeltaBitsWriter.GetBitBuf(), pProp );
+
+			iPrevProp = prevBitsReader.ReadNextPropIndex();
+			continue;
+		}
+
+		info.SeekToProp( iProp );
+
+		const intp iDataStartBit = SendTable_EncodeProp( &info, iProp );
+
+		bool bChanged = true;
+
+		if ( bInPrev )
+		{
+			// Compare against the previous state, dirty doesn't mean the value is different.
+			bf_read newBits( "SendTable_EncodeChanged->newBits", pOut->GetData(), pOut->GetNumBytesWritten(), pOut->GetNumBitsWritten() );
+			newBits.Seek( iDataStartBit );
+
+			bChanged = g_PropTypeFns[pProp->m_Type].CompareDeltas( pProp, &prevBits, &newBits ) != 0;
+			iPrevProp = prevBitsReader.ReadNextPropIndex();
+		}
+
+		if ( bChanged && pDeltaProps < pDeltaPropsEnd )
+		{
+			*pDeltaProps++ = iProp;
+		}
+	}
+
+	prevBitsReader.ForceFinished(); // avoid a benign assert
+
+	if ( pOut->IsOverflowed() )
+		return -1;
+
+	return pDeltaProps - pDeltaPropsBase;
+}
+
+
 void SendTable_WritePropList(
 	const SendTable *pTable,
 	const void *pState,
@@ -15,6 +15,7 @@
 #include "dt_send.h"
 #include "bitbuf.h"
 #include "utlmemory.h"
+#include "bitvec.h"
 
 typedef unsigned int CRC32_t;
 
@@ -117,6 +118,25 @@ bool SendTable_Encode(
 	);
 
 
+// Like SendTable_Encode, but only calls the proxies of props in dirtyProps (or props that
+// can't be tracked, see CSendTablePrecalc::m_UntrackedProps) and copies the others from
+// pPrevState. Fills pDeltaProps with the props that differ from pPrevState and returns
+// their count, or -1 if pOut overflowed.
+// The prop offset map must have been set up with SendTable_InitPropOffsetMap.
+int SendTable_EncodeChanged(
+	const SendTable *pTable,
+	const void *pStruct, 
+	bf_write *pOut, 
+	int objectID,
+	CUtlMemory<CSendProxyRecipients> *pRecipients,
+	const void *pPrevState,
+	const int nPrevBits,
+	const CBitVec<MAX_DATATABLE_PROPS> &dirtyProps,
+	int *pDeltaProps,
+	int nMaxDeltaProps
+	);
+
+
 // In order to receive a table, you must send it from the server and receive its info
 // on the client so the client knows how to unpack it.
 bool SendTable_WriteInfos( SendTable *pTable, bf_write *pBuf );
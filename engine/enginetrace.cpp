@@ -125,6 +125,9 @@ public:
 	// Walks bsp to find the leaf containing the specified point
 	virtual int GetLeafContainingPoint( const Vector &ptTest );
 
+	// Traces many rays at once
+	virtual void	TraceRayBatch( const Ray_t *pRays, int nRays, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTraces );
+
 private:
 	// FIXME: Different versions for client + server. Eventually we need to make these go away
 	virtual void SetTraceEntity( ICollideable *pCollideable, trace_t *pTrace ) = 0;
@@ -158,6 +161,9 @@ private:
 
 	// Clips a trace to another trace
 	bool ClipTraceToTrace( trace_t &clipTrace, trace_t *pFinalTrace );
+
+	// Clips a trace of the world to the entities along the ray
+	void ClipTraceToEntities( const Ray_t &ray, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTrace );
 private:
 	int m_traceStatCounters[NUM_TRACE_STAT_COUNTER];
 	const matrix3x4_t *m_pRootMoveParent;
@@ -1727,6 +1733,70 @@ void CEngineTrace::TraceRay( const Ray_t &ray, unsigned int fMask, ITraceFilter
 		VectorAdd( pTrace->startpos, ray.m_Delta, pTrace->endpos );
 	}
 
+	ClipTraceToEntities( ray, fMask, pTraceFilter, pTrace );
+}
+
+//-----------------------------------------------------------------------------
+// Traces many rays at once, the world with CM_BoxTraceBatch
+//-----------------------------------------------------------------------------
+void CEngineTrace::TraceRayBatch( const Ray_t *pRays, int nRays, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTraces )
+{
+	tmZone( TELEMETRY_LEVEL1, TMZF_NONE, "%s:%d", __FUNCTION__, __LINE__ );
+	VPROF_INCREMENT_COUNTER( "TraceRay", nRays );
+	m_traceStatCounters[TRACE_STAT_COUNTER_TRACERAY] += nRays;
+
+	CTraceFilterHitAll traceFilter;
+	if ( !pTraceFilter )
+	{
+		pTraceFilter = &traceFilter;
+	}
+
+	if ( pTraceFilter->GetTraceType() == TRACE_ENTITIES_ONLY )
+	{
+		for ( int i = 0; i < nRays; ++i )
+		{
+			const Ray_t &ray = pRays[i];
+			trace_t *pTrace = &pTraces[i];
+
+			CM_ClearTrace( pTrace );
+			VectorAdd( ray.m_Start, ray.m_StartOffset, pTrace->startpos );
+			VectorAdd( pTrace->startpos, ray.m_Delta, pTrace->endpos );
+
+			ClipTraceToEntities( ray, fMask, pTraceFilter, pTrace );
+		}
+		return;
+	}
+
+	// Collide with the world.
+	ICollideable *pCollide = GetWorldCollideable();
+	Assert( pCollide );
+	Assert(!pCollide || pCollide->GetCollisionOrigin() == vec3_origin );
+	Assert(!pCollide || pCollide->GetCollisionAngles() == vec3_angle );
+
+	CM_BoxTraceBatch( pRays, nRays, 0, fMask, true, pTraces );
+
+	for ( int i = 0; i < nRays; ++i )
+	{
+		trace_t *pTrace = &pTraces[i];
+		SetTraceEntity( pCollide, pTrace );
+
+		// inside world, no need to check being inside anything else
+		if ( pTrace->startsolid )
+			continue;
+
+		// Early out if we only trace against the world
+		if ( pTraceFilter->GetTraceType() == TRACE_WORLD_ONLY )
+			continue;
+
+		ClipTraceToEntities( pRays[i], fMask, pTraceFilter, pTrace );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Clips a trace of the world to the entities along the ray
+//-----------------------------------------------------------------------------
+void CEngineTrace::ClipTraceToEntities( const Ray_t &ray, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTrace )
+{
 	// Save the world collision fraction.
 	float flWorldFraction = pTrace->fraction;
 	float flWorldFractionLeftSolidScale = flWorldFraction;
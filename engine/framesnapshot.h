@@ -81,6 +81,9 @@ public:
 
 	CFrameSnapshot*			NextSnapshot() const;						
 
+	// Points the arrays at their copy after the snapshot arena moved them.
+	void					RelocateArrays( const void *pOldBlock, void *pNewBlock );
+
 
 public:
 	CInterlockedInt			m_ListIndex;	// Index info CFrameSnapshotManager::m_FrameSnapshots.
@@ -105,6 +108,10 @@ public:
 
 	CUtlVector<int>			m_iExplicitDeleteSlots;
 
+	// Entity, valid entity, HLTV and Replay arrays in one g_SnapshotArena
+	// block, NULL if they were allocated separately on the heap.
+	void					*m_pArenaBlock;
+
 private:
 
 	// Snapshots auto-delete themselves when their refcount goes to zero.
@@ -163,8 +170,13 @@ public:
 	// List of entities to explicitly delete
 	void			AddExplicitDelete( int iSlot );
 
+	// While set, snapshots whose last reference is dropped are deleted at the
+	// next g_HostCommandRing drain. Set around the parallel snapshot send.
+	void			SetDeferSnapshotDeletes( bool bDefer );
+
 private:
 	void	DeleteFrameSnapshot( CFrameSnapshot* pSnapshot );
+	CFrameSnapshot*	CreateSnapshot( int tickcount, int maxEntities, int nValidEntities, bool bHLTV, bool bReplay );
 
 	CUtlLinkedList<CFrameSnapshot*, int>		m_FrameSnapshots;
 	CClassMemoryPool< PackedEntity >			m_PackedEntitiesPool;
@@ -179,6 +191,8 @@ private:
 	CThreadFastMutex		m_WriteMutex;
 
 	CUtlVector<int>			m_iExplicitDeleteSlots;
+
+	bool					m_bDeferSnapshotDeletes;
 };
 
 extern CFrameSnapshotManager *framesnapshotmanager;
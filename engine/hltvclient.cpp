@@ -490,12 +490,8 @@ void CHLTVClient::SendSnapshot( CClientFrame * pFrame )
 	NET_Tick tickmsg( pFrame->tick_count, host_frametime_unbounded, host_frametime_stddeviation );
 	tickmsg.WriteToBuffer( msg );
 
-	// Update shared client/server string tables. Must be done before sending entities
-	m_Server->m_StringTables->WriteUpdateMessage( NULL, GetMaxAckTickCount(), msg );
-
-	// TODO delta cache whole snapshots, not just packet entities. then use net_Align
-	// send entity update, delta compressed if deltaFrame != NULL
-	m_Server->WriteDeltaEntities( this, pFrame, pDeltaFrame, msg );
+	// string table updates and entity update, shared with spectators in the same state
+	m_pHLTV->WriteSnapshotPayload( this, pFrame, pDeltaFrame, msg );
 
 	// write message to packet and check for overflow
 	if ( msg.IsOverflowed() )
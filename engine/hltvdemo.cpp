@@ -29,6 +29,8 @@
 
 extern CNetworkStringTableContainer *networkStringTableContainerServer;
 
+static ConVar tv_keyframeinterval( "tv_keyframeinterval", "0", 0, "Write a keyframe into SourceTV demos every this many seconds, players seek to them instead of replaying the demo (0 = off)." );
+
 //////////////////////////////////////////////////////////////////////
 // Construction/Destruction
 //////////////////////////////////////////////////////////////////////
@@ -41,6 +43,8 @@ CHLTVDemoRecorder::CHLTVDemoRecorder()
 	m_SequenceInfo = 0;
 	m_nDeltaTick = 0;
 	m_nSignonTick = 0;
+	m_nKeyframeInterval = 0;
+	m_nLastKeyframeTick = -1;
 }
 
 CHLTVDemoRecorder::~CHLTVDemoRecorder()
@@ -80,7 +84,11 @@ void CHLTVDemoRecorder::StartRecording( const char *filename, bool bContinuously
 	Q_memset( dh, 0, sizeof(demoheader_t));
 
 	V_strcpy_safe( dh->demofilestamp, DEMO_HEADER_ID );
-	dh->demoprotocol = DEMO_PROTOCOL;
+	m_nKeyframeInterval = tv_keyframeinterval.GetFloat() > 0 ? max( TIME_TO_TICKS( tv_keyframeinterval.GetFloat() ), 1 ) : 0;
+	m_nLastKeyframeTick = -1;
+
+	// keyframes need the index, demos without stay readable by older engines
+	dh->demoprotocol = m_nKeyframeInterval > 0 ? DEMO_PROTOCOL : DEMO_PROTOCOL_LINEAR;
 	dh->networkprotocol = PROTOCOL_VERSION;
 
 	V_strcpy_safe( dh->mapname, hltv->GetMapName() );
@@ -124,6 +132,11 @@ void CHLTVDemoRecorder::StopRecording()
 	// Demo playback should read this as an incoming message.
 	m_DemoFile.WriteCmdHeader( dem_stop, GetRecordingTick() );
 
+	if ( m_nKeyframeInterval > 0 )
+	{
+		m_DemoFile.WriteDemoIndex();
+	}
+
 	// update demo header info
 	m_DemoFile.m_DemoHeader.playback_ticks = GetRecordingTick();
 	m_DemoFile.m_DemoHeader.playback_time =  host_state.interval_per_tick *	GetRecordingTick();
@@ -161,6 +174,23 @@ int CHLTVDemoRecorder::GetRecordingTick( void )
 
 
 
+// Replicated convars as demo players should see them.
+static void BuildDemoConVars( NET_SetConVar &convars, bool bNonDefault )
+{
+	// build a list of all replicated convars
+	Host_BuildConVarUpdateMessage( &convars, FCVAR_REPLICATED, bNonDefault );
+
+	if ( hltv->IsMasterProxy() )
+	{
+		// for SourceTV server demos write set "tv_transmitall 1" even
+		// if it's off for the real broadcast
+		NET_SetConVar::cvar_t acvar;
+		Q_strncpy( acvar.name, "tv_transmitall", MAX_OSPATH );
+		Q_strncpy( acvar.value, "1", MAX_OSPATH );
+		convars.m_ConVars.AddToTail( acvar );
+	}
+}
+
 void CHLTVDemoRecorder::WriteServerInfo()
 {
 	alignas(4) byte		buffer[ NET_MAX_PAYLOAD ];
@@ -187,19 +217,7 @@ void CHLTVDemoRecorder::WriteServerInfo()
 	
 	// Write replicated ConVars to non-listen server clients only
 	NET_SetConVar convars;
-
-	// build a list of all replicated convars
-	Host_BuildConVarUpdateMessage( &convars, FCVAR_REPLICATED, true );
-
-	if ( hltv->IsMasterProxy() )
-	{
-		// for SourceTV server demos write set "tv_transmitall 1" even
-		// if it's off for the real broadcast
-		NET_SetConVar::cvar_t acvar;
-		Q_strncpy( acvar.name, "tv_transmitall", MAX_OSPATH );
-		Q_strncpy( acvar.value, "1", MAX_OSPATH );
-		convars.m_ConVars.AddToTail( acvar );
-	}
+	BuildDemoConVars( convars, true );
 
 	// write convars to demo
 	convars.WriteToBuffer( msg );
@@ -237,9 +255,10 @@ void CHLTVDemoRecorder::RecordServerClasses( ServerClass *pClasses )
 	m_DemoFile.WriteNetworkDataTables( &buf, GetRecordingTick() );
 }
 
-void CHLTVDemoRecorder::RecordStringTables()
+// Writes all server string tables into buf, with a buffer grown until they fit.
+// Returns the buffer to free, NULL if the tables are too big.
+static void *WriteServerStringTables( bf_write &buf )
 {
-
 	// !KLUDGE! It would be nice if the bit buffer could write into a stream
 	// with the power to grow itself.  But it can't.  Hence this really bad
 	// kludge
@@ -248,30 +267,36 @@ void CHLTVDemoRecorder::RecordStringTables()
 	while ( dataLen <= DEMO_FILE_MAX_STRINGTABLE_SIZE )
 	{
 		data = realloc( data, dataLen );
-		bf_write buf( data, dataLen );
+		buf.StartWriting( data, dataLen );
 		buf.SetDebugName("CHLTVDemoRecorder_StringTables");
 		buf.SetAssertOnOverflow( false ); // Doesn't turn off all the spew / asserts, but turns off one
 		networkStringTableContainerServer->WriteStringTables( buf );
 
 		// Did we fit?
 		if ( !buf.IsOverflowed() )
-		{
-
-			// Now write the buffer into the demo file
-			m_DemoFile.WriteStringTables( &buf, GetRecordingTick() );
-			break;
-		}
+			return data;
 
 		// Didn't fit.  Try doubling the size of the buffer
 		dataLen *= 2;
 	}
 
-	if ( dataLen > DEMO_FILE_MAX_STRINGTABLE_SIZE )
-	{
-		Warning( "Failed to RecordStringTables. Trying to record string table that's bigger than max string table size\n" );
-	}
+	Warning( "Failed to RecordStringTables. Trying to record string table that's bigger than max string table size\n" );
 
 	free(data);
+	return NULL;
+}
+
+void CHLTVDemoRecorder::RecordStringTables()
+{
+	bf_write buf;
+	void *data = WriteServerStringTables( buf );
+
+	if ( data )
+	{
+		// Now write the buffer into the demo file
+		m_DemoFile.WriteStringTables( &buf, GetRecordingTick() );
+		free(data);
+	}
 }
 
 int CHLTVDemoRecorder::WriteSignonData()
@@ -373,23 +398,63 @@ void CHLTVDemoRecorder::WriteFrame( CHLTVFrame *pFrame )
 
 	// write packet to demo file
 	WriteMessages( dem_packet, msg ); 
+
+	if ( m_nKeyframeInterval > 0 &&
+		 ( m_nLastKeyframeTick < 0 || GetRecordingTick() - m_nLastKeyframeTick >= m_nKeyframeInterval ) )
+	{
+		WriteKeyframe( pFrame );
+	}
 }
 
-void CHLTVDemoRecorder::WriteMessages( unsigned char cmd, bf_write &message )
+void CHLTVDemoRecorder::WriteKeyframe( CHLTVFrame *pFrame )
 {
-	int len = message.GetNumBytesWritten();
+	alignas(4) byte buffer[ NET_MAX_PAYLOAD ];
+	bf_write	msg( "CHLTVDemo::WriteKeyframe", buffer );
 
-	if (len <= 0)
-		return;
+	// send tick time
+	NET_Tick tickmsg( pFrame->tick_count, host_frametime_unbounded, host_frametime_stddeviation );
+	tickmsg.WriteToBuffer( msg );
 
-	// fill last bits in last byte with NOP if necessary
-	int nRemainingBits = message.GetNumBitsWritten() % 8;
-	if ( nRemainingBits > 0 &&  nRemainingBits <= (8-NETMSG_TYPE_BITS) )
+	// players seeking here skipped the reliable data that set these
+	SVC_SetView viewent( hltv->m_nViewEntity );
+	viewent.WriteToBuffer( msg );
+
+	// all of them, the skipped data may have changed some back to default
+	NET_SetConVar convars;
+	BuildDemoConVars( convars, false );
+	convars.WriteToBuffer( msg );
+
+	// full entity update, players seeking here have no frame to delta from.
+	// The next dem_packet is delta compressed against this frame.
+	sv.WriteDeltaEntities( hltv->m_MasterClient, pFrame, NULL, msg );
+
+	if ( msg.IsOverflowed() )
 	{
-		message.WriteUBitLong( net_NOP, NETMSG_TYPE_BITS );
+		Warning( "SourceTV demo keyframe at tick %i overflowed, skipped.\n", pFrame->tick_count );
+		return;
 	}
 
-	Assert( len < NET_MAX_MESSAGE );
+	bf_write stringTables;
+	void *data = WriteServerStringTables( stringTables );
+
+	if ( !data )
+		return;
+
+	m_DemoFile.WriteKeyframeStringTables( &stringTables, GetRecordingTick() );
+	free( data );
+
+	// same sequence number as the dem_packet of this frame
+	WritePacketData( msg, m_SequenceInfo - 1 );
+
+	m_nLastKeyframeTick = GetRecordingTick();
+}
+
+void CHLTVDemoRecorder::WriteMessages( unsigned char cmd, bf_write &message )
+{
+	int len = message.GetNumBytesWritten();
+
+	if (len <= 0)
+		return;
 
 	// if signondata read as fast as possible, no rewind
 	// and wait for packet time
@@ -402,15 +467,31 @@ void CHLTVDemoRecorder::WriteMessages( unsigned char cmd, bf_write &message )
 
 	// write command & time
 	m_DemoFile.WriteCmdHeader( cmd, GetRecordingTick() ); 
-	
+
+	// write continously increasing sequence numbers
+	WritePacketData( message, m_SequenceInfo );
+	m_SequenceInfo++;
+}
+
+void CHLTVDemoRecorder::WritePacketData( bf_write &message, int nSequenceNr )
+{
+	int len = message.GetNumBytesWritten();
+
+	// fill last bits in last byte with NOP if necessary
+	int nRemainingBits = message.GetNumBitsWritten() % 8;
+	if ( nRemainingBits > 0 &&  nRemainingBits <= (8-NETMSG_TYPE_BITS) )
+	{
+		message.WriteUBitLong( net_NOP, NETMSG_TYPE_BITS );
+	}
+
+	Assert( len < NET_MAX_MESSAGE );
+
 	// write NULL democmdinfo just to keep same format as client demos
 	democmdinfo_t info;
 	Q_memset( &info, 0, sizeof( info ) );
 	m_DemoFile.WriteCmdInfo( info );
 
-	// write continously increasing sequence numbers
-	m_DemoFile.WriteSequenceInfo( m_SequenceInfo, m_SequenceInfo );
-	m_SequenceInfo++;
+	m_DemoFile.WriteSequenceInfo( nSequenceNr, nSequenceNr );
 	
 	// Output the buffer.  Skip the network packet stuff.
 	m_DemoFile.WriteRawData( (char*)message.GetBasePointer(), len );
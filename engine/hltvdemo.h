@@ -45,12 +45,14 @@ public:
 
 public:
 	void	WriteFrame( CHLTVFrame *pFrame );
+	void	WriteKeyframe( CHLTVFrame *pFrame );
 	void	CloseFile();
 	void	Reset();
 
 	void	WriteServerInfo();
 	int		WriteSignonData();  // write all necessary signon data and returns written bytes
 	void	WriteMessages( unsigned char cmd, bf_write &message );
+	void	WritePacketData( bf_write &message, int nSequenceNr );	// cmd info, sequence info and data
 	int		GetMaxAckTickCount();
 
 public:
@@ -62,6 +64,8 @@ public:
 	int				m_SequenceInfo;
 	int				m_nDeltaTick;	
 	int				m_nSignonTick;
+	int				m_nKeyframeInterval;	// in ticks, 0 = no keyframes and no index
+	int				m_nLastKeyframeTick;	// recording tick
 	bf_write		m_MessageData; // temp buffer for all network messages
 };
 
@@ -86,6 +86,7 @@ ConVar tv_transmitall( "tv_transmitall", "0", FCVAR_REPLICATED, "Transmit all en
 ConVar tv_debug( "tv_debug", "0", 0, "SourceTV debug info." );
 ConVar tv_title( "tv_title", "SourceTV", 0, "Set title for SourceTV spectator UI", tv_title_changed_f );
 static ConVar tv_deltacache( "tv_deltacache", "2", 0, "Enable delta entity bit stream cache" );
+static ConVar tv_broadcast( "tv_broadcast", "1", 0, "Encode snapshots once for all spectators that acknowledged the same tick" );
 static ConVar tv_relayvoice( "tv_relayvoice", "1", 0, "Relay voice data: 0=off, 1=on" );
 
 CDeltaEntityCache::CDeltaEntityCache()
@@ -212,6 +213,64 @@ void CDeltaEntityCache::AddDeltaBits( int nEntityIndex, int nDeltaTick, int nBit
 	}
 }
 
+CSnapshotBroadcastCache::CSnapshotBroadcastCache()
+{
+}
+
+void CSnapshotBroadcastCache::Flush()
+{
+	// keep the memory, it is refilled on every send pass
+	m_Entries.RemoveAll();
+	m_Data.RemoveAll();
+}
+
+const unsigned char* CSnapshotBroadcastCache::FindSnapshotBits( int nTick, int nDeltaTick, int nStringTableTick, int nBaselineUsed, int &nBits )
+{
+	nBits = -1;
+
+	FOR_EACH_VEC( m_Entries, i )
+	{
+		const SnapshotEntry_s &entry = m_Entries[i];
+
+		if ( entry.nTick == nTick && entry.nDeltaTick == nDeltaTick &&
+			 entry.nStringTableTick == nStringTableTick && entry.nBaselineUsed == nBaselineUsed )
+		{
+			nBits = entry.nBits;
+			return m_Data.Base() + entry.nOffset;
+		}
+	}
+
+	return NULL;
+}
+
+void CSnapshotBroadcastCache::AddSnapshotBits( int nTick, int nDeltaTick, int nStringTableTick, int nBaselineUsed, intp nStartBit, bf_write *pBuffer )
+{
+	if ( m_Entries.Count() >= MAX_ENTRIES )
+		return;
+
+	int nBits = (int)( pBuffer->GetNumBitsWritten() - nStartBit );
+	int nBufferSize = PAD_NUMBER( Bits2Bytes(nBits), 4 );
+
+	SnapshotEntry_s &entry = m_Entries[ m_Entries.AddToTail() ];
+	entry.nTick = nTick;
+	entry.nDeltaTick = nDeltaTick;
+	entry.nStringTableTick = nStringTableTick;
+	entry.nBaselineUsed = nBaselineUsed;
+	entry.nBits = nBits;
+	entry.nOffset = m_Data.Count();
+
+	m_Data.AddMultipleToTail( nBufferSize );
+
+	if ( nBits > 0 )
+	{
+		bf_read  inBuffer; 
+		inBuffer.StartReading( pBuffer->GetData(), pBuffer->m_nDataBytes, pBuffer->GetNumBitsWritten() );
+		inBuffer.Seek( nStartBit );
+		bf_write outBuffer( m_Data.Base() + entry.nOffset, nBufferSize );
+		outBuffer.WriteBitsFromBuffer( &inBuffer, nBits );
+	}
+}
+
 						  
 static RecvTable* FindRecvTable( const char *pName, RecvTable **pRecvTables, int nRecvTables )
 {
@@ -1373,6 +1432,9 @@ CClientFrame *CHLTVServer::AddNewFrame( CClientFrame *clientFrame )
 
 void CHLTVServer::SendClientMessages ( bool bSendSnapshots )
 {
+	// snapshot payloads are only shared within one pass, string tables may change in between
+	m_BroadcastCache.Flush();
+
 	// build individual updates
 	for ( int i=0; i< m_Clients.Count(); i++ )
 	{
@@ -1533,6 +1595,49 @@ CClientFrame *CHLTVServer::GetDeltaFrame( int nTick )
 	return entry.pFrame;
 }
 
+void CHLTVServer::WriteSnapshotPayload( CHLTVClient *client, CClientFrame *pFrame, CClientFrame *pDeltaFrame, bf_write &msg )
+{
+	int nStringTableTick = client->GetMaxAckTickCount();
+
+	// full updates may become the client's new baseline and tracing needs the
+	// client's own bits, only delta updates are shared
+	bool bShare = tv_broadcast.GetBool() && pDeltaFrame && !client->IsTracing();
+
+	if ( bShare )
+	{
+		int nBits;
+		const unsigned char *pBits = m_BroadcastCache.FindSnapshotBits( pFrame->tick_count, pDeltaFrame->tick_count,
+			nStringTableTick, client->m_nBaselineUsed, nBits );
+
+		if ( pBits )
+		{
+			// what WriteDeltaEntities does to the client when no entity is sent from its baseline
+			if ( client->m_nBaselineUpdateTick == -1 )
+			{
+				client->m_BaselinesSent.ClearAll();
+			}
+
+			msg.WriteBits( pBits, nBits );
+			return;
+		}
+	}
+
+	intp nStartBit = msg.GetNumBitsWritten();
+
+	// Update shared client/server string tables. Must be done before sending entities
+	m_StringTables->WriteUpdateMessage( NULL, nStringTableTick, msg );
+
+	// send entity update, delta compressed if pDeltaFrame != NULL
+	bool bShareable = WriteDeltaEntities( client, pFrame, pDeltaFrame, msg );
+
+	// all spectators use the same client entity, so only the baseline can differ
+	if ( bShare && bShareable && !msg.IsOverflowed() )
+	{
+		m_BroadcastCache.AddSnapshotBits( pFrame->tick_count, pDeltaFrame->tick_count,
+			nStringTableTick, client->m_nBaselineUsed, nStartBit, &msg );
+	}
+}
+
 void CHLTVServer::RunFrame()
 {
 	VPROF_BUDGET( "CHLTVServer::RunFrame", "HLTV" );
@@ -1677,6 +1782,7 @@ void CHLTVServer::Clear( void )
 	DeleteClientFrames( -1 );
 
 	m_DeltaCache.Flush();
+	m_BroadcastCache.Flush();
 	m_FrameCache.RemoveAll();
 }
 
@@ -1950,6 +2056,10 @@ void CHLTVServer::ReadCompleteDemoFile()
 				free( data );
 			}
 			break;
+		case dem_keyframe:
+			// the complete file is read, keyframes are only needed to seek
+			m_DemoFile.SkipKeyframe();
+			break;
 		case dem_usercmd:
 			{
 				char bufferIn[256];
@@ -84,6 +84,35 @@ protected:
 	DeltaEntityEntry_s* m_Cache[MAX_EDICTS]; // array of pointers to delta entries
 };
 
+// Snapshot payloads (string table updates and packet entities) encoded during
+// one send pass. Spectators that acknowledged the same ticks get the same bits,
+// so the payload is encoded for the first of them and copied for the others.
+class CSnapshotBroadcastCache
+{
+	struct SnapshotEntry_s
+	{
+		int	nTick;
+		int	nDeltaTick;
+		int	nStringTableTick;
+		int	nBaselineUsed;
+		int	nBits;
+		int	nOffset;	// into m_Data
+	};
+
+public:
+	CSnapshotBroadcastCache();
+
+	void Flush();
+	const unsigned char* FindSnapshotBits( int nTick, int nDeltaTick, int nStringTableTick, int nBaselineUsed, int &nBits );
+	void AddSnapshotBits( int nTick, int nDeltaTick, int nStringTableTick, int nBaselineUsed, intp nStartBit, bf_write *pBuffer );
+
+protected:
+	enum { MAX_ENTRIES = 32 };	// distinct acknowledged ticks per pass
+
+	CUtlVector<SnapshotEntry_s>	m_Entries;
+	CUtlVector<unsigned char>	m_Data;
+};
+
 
 class CGameClient;
 class CGameServer;
@@ -188,6 +217,7 @@ public:
 	bool	DispatchToRelay( CHLTVClient *pClient);
 	bf_write *GetBuffer( int nBuffer);
 	CClientFrame *GetDeltaFrame( int nTick );
+	void	WriteSnapshotPayload( CHLTVClient *client, CClientFrame *pFrame, CClientFrame *pDeltaFrame, bf_write &msg );
 		
 	inline  CHLTVClient* Client( int i ) { return static_cast<CHLTVClient*>(m_Clients[i]); }
 
@@ -246,6 +276,7 @@ public:
 	CNetworkStringTableContainer m_NetworkStringTables;
 
 	CDeltaEntityCache				m_DeltaCache;
+	CSnapshotBroadcastCache			m_BroadcastCache;
 	CUtlVector<CFrameCacheEntry_s>	m_FrameCache;
 
 	// demoplayer stuff:
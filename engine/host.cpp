@@ -62,6 +62,7 @@
 #include "gl_shader.h"
 #include "sys_dll.h"
 #include "cmodel_engine.h"
+#include "ispatialpartitioninternal.h"
 #ifndef SWDS
 #include "con_nprint.h"
 #endif
@@ -3080,6 +3081,9 @@ static void _Host_RunFrame (float time)
 
 		Host_UpdateMapList();
 
+		// The server and client frames are done, nobody is enumerating the partition.
+		SpatialPartition()->FrameUpdate();
+
 		host_framecount++;
 #if !defined(SWDS)
 		if ( !demoplayer->IsPlaybackPaused() )
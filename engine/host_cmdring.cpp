@@ -0,0 +1,145 @@
+// Copyright Valve Corporation, All rights reserved.
+//
+// Lock-free multi-producer single-consumer ring of deferred engine commands.
+
+#include "host_cmdring.h"
+
+#include "tier0/dbg.h"
+#include "tier0/threadtools.h"
+
+#include "sys_dll.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+CHostCommandRing g_HostCommandRing;
+
+CHostCommandRing::CHostCommandRing()
+{
+	static_assert( ( CAPACITY & ( CAPACITY - 1 ) ) == 0, "CAPACITY must be a power of two" );
+
+	// A cell is free for the producer at position N when its sequence is N,
+	// and ready for the consumer when it is N + 1.
+	for ( uint32 i = 0; i < CAPACITY; ++i )
+	{
+		m_Cells[i].nSequence.store( i, std::memory_order_relaxed );
+	}
+
+	m_nEnqueuePos.store( 0, std::memory_order_relaxed );
+	m_nDequeuePos = 0;
+	m_nOverflowed = 0;
+#ifdef _DEBUG
+	m_bDraining.store( false, std::memory_order_relaxed );
+#endif
+}
+
+CHostCommandRing::~CHostCommandRing()
+{
+	AssertMsg( IsEmpty() || IsInErrorExit(), "Deferred engine commands were never executed." );
+}
+
+bool CHostCommandRing::TryPush( const Command_t &command )
+{
+	uint32 nPos = m_nEnqueuePos.load( std::memory_order_relaxed );
+
+	for ( ;; )
+	{
+		Cell_t &cell = m_Cells[ nPos & ( CAPACITY - 1 ) ];
+		const uint32 nSequence = cell.nSequence.load( std::memory_order_acquire );
+		const int32 nDiff = static_cast<int32>( nSequence - nPos );
+
+		if ( nDiff == 0 )
+		{
+			// Cell is free, claim the position. On failure nPos is reloaded.
+			if ( m_nEnqueuePos.compare_exchange_weak( nPos, nPos + 1, std::memory_order_relaxed ) )
+			{
+				cell.command = command;
+				cell.nSequence.store( nPos + 1, std::memory_order_release );
+				return true;
+			}
+		}
+		else if ( nDiff < 0 )
+		{
+			// Consumer has not freed this cell yet, ring is full.
+			return false;
+		}
+		else
+		{
+			// Another producer took the position.
+			nPos = m_nEnqueuePos.load( std::memory_order_relaxed );
+		}
+	}
+}
+
+bool CHostCommandRing::TryPop( Command_t &command )
+{
+	Cell_t &cell = m_Cells[ m_nDequeuePos & ( CAPACITY - 1 ) ];
+	const uint32 nSequence = cell.nSequence.load( std::memory_order_acquire );
+
+	if ( static_cast<int32>( nSequence - ( m_nDequeuePos + 1 ) ) < 0 )
+		return false;
+
+	command = cell.command;
+	cell.nSequence.store( m_nDequeuePos + CAPACITY, std::memory_order_release );
+	++m_nDequeuePos;
+
+	return true;
+}
+
+void CHostCommandRing::Post( HostCommandFn_t pfnCommand, void *pContext, intp nArg )
+{
+	Assert( pfnCommand );
+
+	const Command_t command = { pfnCommand, pContext, nArg };
+
+	if ( !TryPush( command ) )
+	{
+		m_Overflow.PushItem( command );
+		++m_nOverflowed;
+	}
+}
+
+intp CHostCommandRing::Drain()
+{
+#ifdef _DEBUG
+	// Single consumer, but not necessarily the main thread.
+	const bool bWasDraining = m_bDraining.exchange( true, std::memory_order_acquire );
+	Assert( !bWasDraining );
+#endif
+
+	intp nExecuted = 0;
+	Command_t command;
+
+	for ( ;; )
+	{
+		if ( TryPop( command ) || m_Overflow.PopItem( &command ) )
+		{
+			command.pfnCommand( command.pContext, command.nArg );
+			++nExecuted;
+			continue;
+		}
+
+		break;
+	}
+
+	if ( m_nOverflowed )
+	{
+		DevWarning( "CHostCommandRing: %d commands did not fit in the ring (%d slots).\n",
+			m_nOverflowed.GetRaw(), static_cast<int>( CAPACITY ) );
+		m_nOverflowed = 0;
+	}
+
+#ifdef _DEBUG
+	m_bDraining.store( false, std::memory_order_release );
+#endif
+
+	return nExecuted;
+}
+
+bool CHostCommandRing::IsEmpty() const
+{
+	const Cell_t &cell = m_Cells[ m_nDequeuePos & ( CAPACITY - 1 ) ];
+	const uint32 nSequence = cell.nSequence.load( std::memory_order_acquire );
+
+	return static_cast<int32>( nSequence - ( m_nDequeuePos + 1 ) ) < 0 && m_Overflow.Count() == 0;
+}
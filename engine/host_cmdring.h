@@ -0,0 +1,78 @@
+// Copyright Valve Corporation, All rights reserved.
+//
+// Lock-free multi-producer single-consumer ring of deferred engine commands.
+
+#ifndef HOST_CMDRING_H
+#define HOST_CMDRING_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <atomic>
+
+#include "tier0/platform.h"
+#include "tier0/tslist.h"
+
+typedef void (*HostCommandFn_t)( void *pContext, intp nArg );
+
+//-----------------------------------------------------------------------------
+// Engine state mutations posted by worker threads (snapshot workers, game
+// frame jobs) and executed by the main thread at a sync point, instead of
+// taking a mutex around shared engine state from every worker.
+//
+// Post() may be called from any thread and never blocks: producers claim a
+// slot with one compare-and-swap and publish it through the slot sequence
+// number (bounded MPMC ring used with a single consumer). If the ring is
+// full the command goes to a lock-free overflow list, commands from the
+// overflow may run after commands posted later.
+//
+// Drain() must only be called by one thread at a time, the one running the
+// server frame (the main thread, or a pool thread under host_thread_mode),
+// while no producer can post commands the caller relies on being executed.
+//-----------------------------------------------------------------------------
+class CHostCommandRing
+{
+public:
+	enum { CAPACITY = 4096 };	// power of two
+
+	CHostCommandRing();
+	~CHostCommandRing();
+
+	void	Post( HostCommandFn_t pfnCommand, void *pContext, intp nArg = 0 );
+
+	// Runs all posted commands, including commands posted while draining.
+	// Returns the number of commands executed.
+	intp	Drain();
+
+	bool	IsEmpty() const;
+
+private:
+	struct Command_t
+	{
+		HostCommandFn_t	pfnCommand;
+		void			*pContext;
+		intp			nArg;
+	};
+
+	struct Cell_t
+	{
+		std::atomic<uint32>	nSequence;
+		Command_t			command;
+	};
+
+	bool	TryPush( const Command_t &command );
+	bool	TryPop( Command_t &command );
+
+	Cell_t						m_Cells[ CAPACITY ];
+	alignas(64) std::atomic<uint32>	m_nEnqueuePos;
+	alignas(64) uint32			m_nDequeuePos;		// consumer only
+	CTSList<Command_t>			m_Overflow;
+	CInterlockedInt				m_nOverflowed;
+#ifdef _DEBUG
+	std::atomic_bool			m_bDraining;
+#endif
+};
+
+extern CHostCommandRing g_HostCommandRing;
+
+#endif // HOST_CMDRING_H
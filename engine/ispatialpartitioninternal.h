@@ -23,6 +23,10 @@ public:
 	virtual void Init( const Vector& worldmin, const Vector& worldmax ) = 0;
 
 	virtual void DrawDebugOverlays() = 0;
+
+	// Called once a frame while no other thread queries the partition.
+	// Publishes batched updates and frees what older queries may still read.
+	virtual void FrameUpdate() = 0;
 };
 
 
@@ -37,6 +41,9 @@ ISpatialPartitionInternal* SpatialPartition();
 ISpatialPartition *CreateSpatialPartition( const Vector& worldmin, const Vector& worldmax );
 void DestroySpatialPartition( ISpatialPartition * );
 
+// Always backed by the hashed grid tree, whatever spatialpartition_grid says. Used by the self-tests.
+ISpatialPartitionInternal *CreateGridSpatialPartition( const Vector& worldmin, const Vector& worldmax );
+
 
 //-----------------------------------------------------------------------------
 // Method to get at the singleton implementation of the spatial partition mgr
@@ -129,6 +129,9 @@ void		NET_OutOfBandPrintf( intp sock, const netadr_t &adr, PRINTF_FORMAT_STRING
 int			NET_SendPacket( INetChannel *chan, intp sock,  const netadr_t &to, const  unsigned char *data, int length, bf_write *pVoicePayload = NULL, bool bUseCompression = false );
 // Called periodically to maybe send any queued packets (up to 4 per frame)
 void		NET_SendQueuedPackets();
+// Collect datagrams sent until NET_FlushSendBatch and send them with one syscall per socket (net_udp_batch)
+void		NET_BeginSendBatch();
+void		NET_FlushSendBatch();
 // Start set current network configuration
 void		NET_SetMutiplayer( bool multiplayer );
 // Set net_time
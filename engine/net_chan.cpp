@@ -19,6 +19,7 @@
 #include "tier1/strtools.h"
 #include "net_ws_headers.h"
 #include "net_ws_queued_packet_sender.h"
+#include "net_compression.h"
 #include "filesystem_init.h"
 #include "bzip2/bzlib.h"
 
@@ -128,6 +129,28 @@ void CNetChan::Clear()
 }
 
 
+static unsigned int GetCompressedBufferSize( int nCodec, unsigned int nSize )
+{
+	return nCodec == NET_COMPRESSION_DEFLATE ?
+		COM_GetIdealDestinationCompressionBufferSize_Deflate( nSize ) :
+		COM_GetIdealDestinationCompressionBufferSize_Snappy( nSize );
+}
+
+static bool CompressBuffer( int nCodec, bool bUseDictionary, char *dest, unsigned int *destLen, const char *source, unsigned int sourceLen )
+{
+	return nCodec == NET_COMPRESSION_DEFLATE ?
+		COM_BufferToBufferCompress_Deflate( dest, destLen, source, sourceLen, NET_GetCompressionLevel(), bUseDictionary ) :
+		COM_BufferToBufferCompress_Snappy( dest, destLen, source, sourceLen );
+}
+
+static const char *GetCodecName( int nCodec, bool bUseDictionary )
+{
+	if ( nCodec == NET_COMPRESSION_DEFLATE )
+		return bUseDictionary ? "deflate+dictionary" : "deflate";
+
+	return "snappy";
+}
+
 void CNetChan::CompressFragments()
 {
 	// We don't want this to go in the VCR file, because the compressed size can be different. The reason is 
@@ -166,15 +189,21 @@ void CNetChan::CompressFragments()
 			CFastTimer compressTimer;
 			compressTimer.Start();
 
+			if ( NET_IsRecordingCompressionSamples() )
+			{
+				NET_RecordCompressionSample( data->buffer, data->bytes );
+			}
+
 			// fragments data is in memory
-			unsigned int compressedSize = COM_GetIdealDestinationCompressionBufferSize_Snappy( data->bytes );
+			unsigned int compressedSize = GetCompressedBufferSize( m_nCompressionCodec, data->bytes );
 			std::unique_ptr<char[]> compressedData = std::make_unique<char[]>( compressedSize );
 
-			if ( COM_BufferToBufferCompress_Snappy( compressedData.get(), &compressedSize, data->buffer, data->bytes ) &&
+			if ( CompressBuffer( m_nCompressionCodec, m_bCompressionDictionary, compressedData.get(), &compressedSize, data->buffer, data->bytes ) &&
 				( compressedSize < data->bytes ) )
 			{
 				compressTimer.End(); 
-				DevMsg("Compressing fragments (%d -> %d bytes): %.2fms\n",
+				DevMsg("Compressing fragments with %s (%d -> %d bytes): %.2fms\n",
+						GetCodecName( m_nCompressionCodec, m_bCompressionDictionary ),
 						data->bytes, compressedSize, compressTimer.GetDuration().GetMillisecondsF() );
 
 				// copy compressed data but dont reallocate memory
@@ -262,25 +291,29 @@ void CNetChan::CompressFragments()
 	}
 }
 
-void CNetChan::UncompressFragments( dataFragments_t *data )
+bool CNetChan::UncompressFragments( dataFragments_t *data )
 {
 	if ( !data->isCompressed )
-		return;
+		return true;
 
 	 // allocate buffer for uncompressed data, align to 4 bytes boundary
 	char *newbuffer = new char[PAD_NUMBER( data->nUncompressedSize, 4 )];
 	unsigned int uncompressedSize = data->nUncompressedSize;
 
 	// uncompress data
-	COM_BufferToBufferDecompress( newbuffer, &uncompressedSize, data->buffer, data->bytes );
-
-	Assert( uncompressedSize == data->nUncompressedSize );
+	if ( !COM_BufferToBufferDecompress( newbuffer, &uncompressedSize, data->buffer, data->bytes ) ||
+		 uncompressedSize != data->nUncompressedSize )
+	{
+		delete [] newbuffer;
+		return false;
+	}
 
 	// free old buffer and set new buffer
 	delete [] data->buffer;
 	data->buffer = newbuffer;
 	data->bytes = uncompressedSize;
 	data->isCompressed = false;
+	return true;
 }
 
 unsigned int CNetChan::RequestFile(const char *filename)
@@ -454,6 +487,8 @@ CNetChan::CNetChan()
 	m_FileRequestCounter = 0;
 	m_bFileBackgroundTranmission = true;
 	m_bUseCompression = false;
+	m_bCompressionDictionary = false;
+	m_nCompressionCodec = NET_COMPRESSION_SNAPPY;
 	m_nQueuedPackets = 0;
 
 	m_flRemoteFrameTime = 0;
@@ -707,6 +742,14 @@ void CNetChan::SetCompressionMode( bool bUseCompression )
 	m_bUseCompression = bUseCompression;
 }
 
+void CNetChan::SetCompressionCodec( int nCodec, bool bUseDictionary )
+{
+	Assert( nCodec >= 0 && nCodec < NET_COMPRESSION_CODEC_COUNT );
+
+	m_nCompressionCodec = nCodec;
+	m_bCompressionDictionary = nCodec == NET_COMPRESSION_DEFLATE && bUseDictionary;
+}
+
 void CNetChan::SetDataRate(float rate)
 {
 	m_Rate = clamp( rate, (float) MIN_RATE, (float) MAX_RATE );
@@ -1017,7 +1060,7 @@ bool CNetChan::CreateFragmentsFromBuffer( bf_write *buffer, int stream )
 
 		totalBytes = PAD_NUMBER( totalBytes, 4 ); // align to 4 bytes boundary
 
-		if ( totalBytes < NET_MAX_PAYLOAD && data->buffer )
+		if ( totalBytes < NET_MAX_PAYLOAD && data->buffer && !data->isCompressed )
 		{
 			// we have enough space for it, create new larger mem buffer
 			char *newBuf = new char[totalBytes];
@@ -2188,9 +2231,10 @@ bool CNetChan::CheckReceivingList(int nList)
 	if ( net_showfragments.GetBool() )
 		ConMsg("Receiving complete: %i fragments, %i bytes\n", data->numFragments, data->bytes );
 
-	if ( data->isCompressed )
+	if ( data->isCompressed && !UncompressFragments( data ) )
 	{
-		UncompressFragments( data );
+		ConMsg( "Receiving failed: unable to decompress %i bytes from %s\n", data->bytes, GetAddress() );
+		return false;
 	}
 
 	if ( !data->filename[0] )
@@ -2606,6 +2650,176 @@ bool CNetChan::SendData( bf_write &msg, bool bReliable )
 	return buf->WriteBits( msg.GetData(), msg.GetNumBitsWritten() );
 }
 
+bool CNetChan::SendSharedData( CNetSharedData &shared )
+{
+	if ( remote_address.GetType() == NA_NULL )
+		return true;
+
+	if ( shared.GetNumBitsWritten() <= 0 )
+		return true;
+
+	char *pCompressed = nullptr;
+	unsigned int compressedSize = 0;
+	intp nBits = 0;
+
+	// Same rules as CompressFragments
+	if ( m_bUseCompression && VCRGetMode() == VCR_Disabled &&
+		 shared.GetNumBytesWritten() >= net_compresspackets_minsize.GetInt() )
+	{
+		pCompressed = shared.CopyCompressed( m_nCompressionCodec, m_bCompressionDictionary, compressedSize, nBits );
+	}
+
+	if ( !pCompressed )
+	{
+		AUTO_LOCK( shared.m_Mutex );
+
+		bf_write msg( "CNetChan::SendSharedData", shared.m_Data.Base(), shared.m_Data.Count() );
+		msg.SeekToBit( shared.m_nBits );
+		return SendData( msg );
+	}
+
+	if ( m_StreamReliable.IsOverflowed() )
+	{
+		delete[] pCompressed;
+		return false;
+	}
+
+	// Reliable data queued so far goes out first
+	if ( m_StreamReliable.GetNumBitsWritten() > 0 )
+	{
+		CreateFragmentsFromBuffer( &m_StreamReliable, FRAG_NORMAL_STREAM );
+		m_StreamReliable.Reset();
+	}
+
+	dataFragments_t *data = new dataFragments_t;
+	data->buffer = pCompressed;
+	data->bits = static_cast<unsigned int>( nBits );
+	data->bytes = compressedSize;
+	data->isCompressed = true;
+	data->nUncompressedSize = static_cast<unsigned int>( Bits2Bytes( nBits ) );
+	data->file = FILESYSTEM_INVALID_HANDLE;
+	data->filename[0] = 0;
+	data->asTCP = m_StreamActive && ( data->bytes > m_MaxReliablePayloadSize );
+	data->numFragments = BYTES2FRAGMENTS( data->bytes );
+	data->ackedFragments = 0;
+	data->pendingFragments = 0;
+
+	m_WaitingList[FRAG_NORMAL_STREAM].AddToTail( data );
+
+	return true;
+}
+
+CNetSharedData::CNetSharedData()
+{
+	m_nBits = 0;
+
+	for ( auto &c : m_Compressed )
+	{
+		c.nDictionaryId = 0;
+		c.bValid = false;
+	}
+}
+
+void CNetSharedData::Set( const bf_write &msg )
+{
+	const intp nBits = msg.GetNumBitsWritten();
+	if ( nBits <= 0 || msg.IsOverflowed() )
+	{
+		Purge();
+		return;
+	}
+
+	AUTO_LOCK( m_Mutex );
+
+	m_Data.SetCount( PAD_NUMBER( Bits2Bytes( nBits ), 4 ) );
+
+	bf_write buf( "CNetSharedData::Set", m_Data.Base(), m_Data.Count() );
+	buf.WriteBits( msg.GetData(), nBits );
+
+	// fill last bits in last byte with NOP if necessary, see CreateFragmentsFromBuffer
+	int nRemainingBits = buf.GetNumBitsWritten() % 8;
+	if ( nRemainingBits > 0 &&  nRemainingBits <= (8-NETMSG_TYPE_BITS) )
+	{
+		buf.WriteUBitLong( net_NOP, NETMSG_TYPE_BITS );
+	}
+
+	m_nBits = nBits;
+
+	for ( auto &c : m_Compressed )
+	{
+		c.data.Purge();
+		c.bValid = false;
+	}
+}
+
+void CNetSharedData::Purge()
+{
+	AUTO_LOCK( m_Mutex );
+
+	m_Data.Purge();
+	m_nBits = 0;
+
+	for ( auto &c : m_Compressed )
+	{
+		c.data.Purge();
+		c.bValid = false;
+	}
+}
+
+char *CNetSharedData::CopyCompressed( int nCodec, bool bUseDictionary, unsigned int &nCompressedSize, intp &nBits )
+{
+	AUTO_LOCK( m_Mutex );
+
+	nCompressedSize = 0;
+	nBits = m_nBits;
+
+	if ( nBits <= 0 )
+		return nullptr;
+
+	bUseDictionary = bUseDictionary && nCodec == NET_COMPRESSION_DEFLATE;
+
+	Compressed_t &c = m_Compressed[ bUseDictionary ? 2 : ( nCodec == NET_COMPRESSION_DEFLATE ? 1 : 0 ) ];
+
+	// Dictionary may be reloaded at any time
+	const uint32 nDictionaryId = bUseDictionary ? COM_GetDeflateDictionaryId() : 0;
+
+	if ( !c.bValid || c.nDictionaryId != nDictionaryId )
+	{
+		CFastTimer compressTimer;
+		compressTimer.Start();
+
+		const unsigned int nBytes = static_cast<unsigned int>( GetNumBytesWritten() );
+		unsigned int compressedSize = GetCompressedBufferSize( nCodec, nBytes );
+
+		c.data.SetCount( compressedSize );
+		c.nDictionaryId = nDictionaryId;
+		c.bValid = true;
+
+		if ( CompressBuffer( nCodec, bUseDictionary, c.data.Base(), &compressedSize, m_Data.Base(), nBytes ) &&
+			 compressedSize < nBytes )
+		{
+			c.data.SetCountNonDestructively( compressedSize );
+
+			compressTimer.End();
+			DevMsg( "Compressing shared data with %s (%u -> %u bytes): %.2fms\n",
+					GetCodecName( nCodec, bUseDictionary ), nBytes, compressedSize, compressTimer.GetDuration().GetMillisecondsF() );
+		}
+		else
+		{
+			c.data.Purge();
+		}
+	}
+
+	if ( !c.data.Count() )
+		return nullptr;
+
+	nCompressedSize = static_cast<unsigned int>( c.data.Count() );
+
+	char *pCopy = new char[ PAD_NUMBER( nCompressedSize, 4 ) ];
+	Q_memcpy( pCopy, c.data.Base(), nCompressedSize );
+	return pCopy;
+}
+
 bool CNetChan::SendReliableViaStream( dataFragments_t *data)
 {
 	// Always queue any pending reliable data ahead of the fragmentation buffer
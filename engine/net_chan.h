@@ -18,6 +18,7 @@
 #include "tier1/netadr.h"
 #include "tier1/utlvector.h"
 #include "tier1/utlbuffer.h"
+#include "tier0/threadtools.h"
 #include "const.h"
 #include "inetchannel.h"
 
@@ -37,6 +38,44 @@
 #define SUBCHANNEL_DIRTY	3	// subchannel is marked as dirty during changelevel
 
 
+//-----------------------------------------------------------------------------
+// Reliable payload sent unchanged to many channels, like the signon block.
+// Compressed once per codec on first use, channels then only copy the
+// compressed bytes into their waiting list, see CNetChan::SendSharedData.
+//-----------------------------------------------------------------------------
+class CNetSharedData
+{
+public:
+	CNetSharedData();
+
+	// Copies the written bits of msg and drops the compressed copies.
+	void	Set( const bf_write &msg );
+	void	Purge();
+
+	intp	GetNumBitsWritten() const { return m_nBits; }
+	intp	GetNumBytesWritten() const { return Bits2Bytes( m_nBits ); }
+
+private:
+	friend class CNetChan;
+
+	struct Compressed_t
+	{
+		CUtlVector<char>	data;		// empty if the payload did not shrink
+		uint32				nDictionaryId;	// dictionary the data was built with
+		bool				bValid;
+	};
+
+	// Copy of the compressed payload for codec in a new[] buffer padded like a
+	// fragment buffer, NULL if it does not shrink. Copied under the lock, the
+	// cached one is freed by Set() or a dictionary reload at any time.
+	char	*CopyCompressed( int nCodec, bool bUseDictionary, unsigned int &nCompressedSize, intp &nBits );
+
+	CUtlVector<char>	m_Data;		// padded as CreateFragmentsFromBuffer would queue it
+	intp				m_nBits;
+	Compressed_t		m_Compressed[ 3 ];	// snappy, deflate, deflate with dictionary
+	CThreadFastMutex	m_Mutex;
+};
+
 class CNetChan : public INetChannel
 {
 
@@ -166,6 +205,9 @@ public:	// INetChannel interface
 	void		ProcessPacket( netpacket_t * packet, bool bHasHeader );
 
 	void		SetCompressionMode( bool bUseCompression );
+	void		SetCompressionCodec( int nCodec, bool bUseDictionary ); // NetCompressionCodec_t
+	// Queues shared reliable data, sent precompressed when compression is on.
+	bool		SendSharedData( CNetSharedData &data );
 	void		SetFileTransmissionMode(bool bBackgroundMode);
 	bool		SendNetMsg( INetMessage &msg, bool bForceReliable = false, bool bVoice = false ); // send a net message
 	bool		SendData(bf_write &msg, bool bReliable = true); // send a chunk of data
@@ -230,7 +272,7 @@ private:
 	bool	CreateFragmentsFromFile( const char *filename, int stream, unsigned int transferID);
 
 	void	CompressFragments();
-	void	UncompressFragments( dataFragments_t *data );
+	bool	UncompressFragments( dataFragments_t *data );
 
 	bool	SendSubChannelData( bf_write &buf );
 	bool	ReadSubChannelData( bf_read &buf, int stream );
@@ -312,6 +354,8 @@ public:
 	unsigned int	m_FileRequestCounter;	// increasing counter with each file request
 	bool			m_bFileBackgroundTranmission; // if true, only send 1 fragment per packet
 	bool			m_bUseCompression;	// if true, larger reliable data will be bzip compressed
+	bool			m_bCompressionDictionary;	// deflate with the shared dictionary, remote has the same one
+	int				m_nCompressionCodec;	// NetCompressionCodec_t negotiated on connect
 	
 	// TCP stream state maschine:
 	bool		m_StreamActive;		// true if TCP is active
@@ -0,0 +1,343 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Net channel compression codec selection, connect handshake and
+//			deflate dictionary training.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "net_compression.h"
+
+#include <algorithm>
+
+#include "common.h"
+#include "filesystem_engine.h"
+#include "tier0/threadtools.h"
+#include "tier1/bitbuf.h"
+#include "tier1/checksum_crc.h"
+#include "tier1/convar.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/utlhashtable.h"
+#include "tier1/utlvector.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#define NET_COMPRESSION_HANDSHAKE_TAG	MAKEUID( 'C', 'O', 'D', 'C' )
+
+// Deflate can't reference more than its 32 KiB window.
+#define DICTIONARY_MAX_SIZE				32768
+#define DICTIONARY_MAX_SAMPLE_BYTES		( 32 * 1024 * 1024 )
+
+static void net_compresspackets_dictionary_changed_f( IConVar *var, const char *pOldValue, float flOldValue );
+
+static ConVar net_compresspackets_codec( "net_compresspackets_codec", "0", 0, "Codec for compressed reliable data if the client supports it: 0=snappy, 1=deflate", true, 0, true, NET_COMPRESSION_CODEC_COUNT - 1 );
+static ConVar net_compresspackets_level( "net_compresspackets_level", "6", 0, "Deflate compression level, 1=fastest, 9=smallest", true, 1, true, 9 );
+static ConVar net_compresspackets_dictionary( "net_compresspackets_dictionary", "", 0, "Deflate dictionary file, must be the same on server and client to be used", net_compresspackets_dictionary_changed_f );
+
+//-----------------------------------------------------------------------------
+// Dictionary loading
+//-----------------------------------------------------------------------------
+static void net_compresspackets_dictionary_changed_f( IConVar *var, const char *pOldValue, float flOldValue )
+{
+	ConVarRef dictionary( var );
+	const char *pszFile = dictionary.GetString();
+
+	if ( !pszFile[0] )
+	{
+		COM_SetDeflateDictionary( NULL, 0 );
+		return;
+	}
+
+	CUtlBuffer buf;
+	if ( !g_pFileSystem || !g_pFileSystem->ReadFile( pszFile, "GAME", buf ) || buf.TellPut() <= 0 )
+	{
+		Warning( "Unable to load net compression dictionary %s.\n", pszFile );
+		COM_SetDeflateDictionary( NULL, 0 );
+		return;
+	}
+
+	COM_SetDeflateDictionary( buf.Base(), static_cast<unsigned int>( buf.TellPut() ) );
+	DevMsg( "Loaded net compression dictionary %s (%zd bytes, id %08x).\n", pszFile, buf.TellPut(), COM_GetDeflateDictionaryId() );
+}
+
+//-----------------------------------------------------------------------------
+// Handshake
+//-----------------------------------------------------------------------------
+void NET_WriteCompressionHandshake( bf_write &msg )
+{
+	msg.WriteLong( NET_COMPRESSION_HANDSHAKE_TAG );
+	msg.WriteByte( ( 1 << NET_COMPRESSION_SNAPPY ) | ( 1 << NET_COMPRESSION_DEFLATE ) );
+	msg.WriteLong( COM_GetDeflateDictionaryId() );
+}
+
+bool NET_ReadCompressionHandshake( bf_read &msg, int &nCodecMask, uint32 &nDictionaryId )
+{
+	nCodecMask = 1 << NET_COMPRESSION_SNAPPY;
+	nDictionaryId = 0;
+
+	if ( msg.GetNumBytesLeft() < 9 )
+		return false;
+
+	if ( msg.ReadLong() != NET_COMPRESSION_HANDSHAKE_TAG )
+		return false;
+
+	nCodecMask |= msg.ReadByte();
+	nDictionaryId = (uint32)msg.ReadLong();
+
+	return !msg.IsOverflowed();
+}
+
+NetCompressionCodec_t NET_SelectCompressionCodec( int nCodecMask, uint32 nDictionaryId, bool &bUseDictionary )
+{
+	bUseDictionary = false;
+
+	const int nCodec = net_compresspackets_codec.GetInt();
+	if ( nCodec == NET_COMPRESSION_DEFLATE && ( nCodecMask & ( 1 << NET_COMPRESSION_DEFLATE ) ) )
+	{
+		bUseDictionary = nDictionaryId != 0 && nDictionaryId == COM_GetDeflateDictionaryId();
+		return NET_COMPRESSION_DEFLATE;
+	}
+
+	return NET_COMPRESSION_SNAPPY;
+}
+
+int NET_GetCompressionLevel()
+{
+	return net_compresspackets_level.GetInt();
+}
+
+//-----------------------------------------------------------------------------
+// Sample recording
+//-----------------------------------------------------------------------------
+static CThreadFastMutex s_SamplesMutex;
+static CUtlBuffer s_SampleData;
+static CUtlVector<intp> s_SampleOffsets;	// start of each sample in s_SampleData
+static bool s_bRecordingSamples = false;
+
+bool NET_IsRecordingCompressionSamples()
+{
+	return s_bRecordingSamples;
+}
+
+void NET_RecordCompressionSample( const void *pData, unsigned int nSize )
+{
+	AUTO_LOCK( s_SamplesMutex );
+
+	if ( !s_bRecordingSamples || nSize == 0 )
+		return;
+
+	if ( s_SampleData.TellPut() + (intp)nSize > DICTIONARY_MAX_SAMPLE_BYTES )
+	{
+		s_bRecordingSamples = false;
+		Msg( "Net compression sample buffer is full (%zd samples), recording stopped.\n", s_SampleOffsets.Count() );
+		return;
+	}
+
+	s_SampleOffsets.AddToTail( s_SampleData.TellPut() );
+	s_SampleData.Put( pData, nSize );
+}
+
+CON_COMMAND( net_compresspackets_dictionary_record, "Start/stop recording uncompressed reliable data (signon, string tables) for net_compresspackets_dictionary_build: <0|1>" )
+{
+	AUTO_LOCK( s_SamplesMutex );
+
+	if ( args.ArgC() > 1 )
+	{
+		s_bRecordingSamples = atoi( args[1] ) != 0;
+	}
+
+	Msg( "Net compression sample recording is %s, %zd samples, %zd bytes.\n",
+		s_bRecordingSamples ? "on" : "off", s_SampleOffsets.Count(), s_SampleData.TellPut() );
+}
+
+//-----------------------------------------------------------------------------
+// Dictionary training.
+//
+// Recorded samples are cut into overlapping segments, a segment scores one
+// point per sample it appears in. The best segments are kept in their sample,
+// overlapping ones merge into longer runs, and the runs are concatenated with
+// the highest scoring last so they are the cheapest to reference.
+//-----------------------------------------------------------------------------
+#define DICTIONARY_SEGMENT_SIZE		64
+#define DICTIONARY_SEGMENT_STEP		16
+
+struct DictionarySegment_t
+{
+	int		nScore;		// number of samples containing the segment
+	intp	nSample;	// first sample containing it
+	intp	nOffset;
+	intp	nLastSample;
+};
+
+struct DictionaryRun_t
+{
+	int		nScore;
+	intp	nStart;		// absolute offset into sample data
+	intp	nSize;
+};
+
+static intp SampleSize( intp nSample )
+{
+	const intp nEnd = nSample + 1 < s_SampleOffsets.Count() ? s_SampleOffsets[nSample + 1] : s_SampleData.TellPut();
+	return nEnd - s_SampleOffsets[nSample];
+}
+
+static void BuildDictionary( CUtlBuffer &dictionary )
+{
+	const byte *pData = static_cast<const byte *>( s_SampleData.Base() );
+	const intp nSamples = s_SampleOffsets.Count();
+
+	CUtlHashtable<uint32, DictionarySegment_t> segments( 64 * 1024 );
+
+	for ( intp s = 0; s < nSamples; ++s )
+	{
+		const intp nSize = SampleSize( s );
+		const byte *pSample = pData + s_SampleOffsets[s];
+
+		for ( intp nOffset = 0; nOffset + DICTIONARY_SEGMENT_SIZE <= nSize; nOffset += DICTIONARY_SEGMENT_STEP )
+		{
+			const uint32 nHash = CRC32_ProcessSingleBuffer( pSample + nOffset, DICTIONARY_SEGMENT_SIZE );
+
+			UtlHashHandle_t h = segments.Find( nHash );
+			if ( h == segments.InvalidHandle() )
+			{
+				segments.Insert( nHash, DictionarySegment_t{ 1, s, nOffset, s } );
+				continue;
+			}
+
+			DictionarySegment_t &segment = segments.Element( h );
+			if ( segment.nLastSample != s )
+			{
+				segment.nLastSample = s;
+				++segment.nScore;
+			}
+		}
+	}
+
+	// Only segments shared between samples are worth anything.
+	CUtlVector<DictionarySegment_t> candidates;
+	for ( UtlHashHandle_t h = segments.FirstHandle(); h != segments.InvalidHandle(); h = segments.NextHandle( h ) )
+	{
+		if ( segments.Element( h ).nScore > 1 )
+		{
+			candidates.AddToTail( segments.Element( h ) );
+		}
+	}
+
+	std::sort( candidates.begin(), candidates.end(), []( const DictionarySegment_t &a, const DictionarySegment_t &b )
+	{
+		if ( a.nScore != b.nScore )
+			return a.nScore > b.nScore;
+		if ( a.nSample != b.nSample )
+			return a.nSample < b.nSample;
+		return a.nOffset < b.nOffset;
+	} );
+
+	// Score per segment step, 0 if not selected.
+	CUtlVector<int> coverage;
+	coverage.SetCount( s_SampleData.TellPut() / DICTIONARY_SEGMENT_STEP + 1 );
+	memset( coverage.Base(), 0, coverage.Count() * sizeof( int ) );
+
+	intp nBudget = DICTIONARY_MAX_SIZE;
+	for ( const auto &segment : candidates )
+	{
+		if ( nBudget <= 0 )
+			break;
+
+		const intp nFirst = ( s_SampleOffsets[segment.nSample] + segment.nOffset ) / DICTIONARY_SEGMENT_STEP;
+		for ( int i = 0; i < DICTIONARY_SEGMENT_SIZE / DICTIONARY_SEGMENT_STEP; ++i )
+		{
+			if ( !coverage[nFirst + i] )
+			{
+				coverage[nFirst + i] = segment.nScore;
+				nBudget -= DICTIONARY_SEGMENT_STEP;
+			}
+		}
+	}
+
+	// Merge selected steps into runs, never across samples.
+	CUtlVector<DictionaryRun_t> runs;
+	for ( intp s = 0; s < nSamples; ++s )
+	{
+		const intp nStart = s_SampleOffsets[s];
+		const intp nEnd = nStart + SampleSize( s );
+
+		for ( intp i = nStart / DICTIONARY_SEGMENT_STEP; i * DICTIONARY_SEGMENT_STEP < nEnd; ++i )
+		{
+			if ( !coverage[i] )
+				continue;
+
+			DictionaryRun_t run = { 0, max( i * DICTIONARY_SEGMENT_STEP, nStart ), 0 };
+			while ( i * DICTIONARY_SEGMENT_STEP < nEnd && coverage[i] )
+			{
+				run.nScore = max( run.nScore, coverage[i] );
+				++i;
+			}
+
+			run.nSize = min( i * DICTIONARY_SEGMENT_STEP, nEnd ) - run.nStart;
+			runs.AddToTail( run );
+		}
+	}
+
+	std::stable_sort( runs.begin(), runs.end(), []( const DictionaryRun_t &a, const DictionaryRun_t &b )
+	{
+		return a.nScore < b.nScore;
+	} );
+
+	intp nTotal = 0;
+	for ( const auto &run : runs )
+	{
+		nTotal += run.nSize;
+	}
+
+	// Merged runs may go over the window a bit, drop the lowest scoring bytes.
+	intp nSkip = max( nTotal - DICTIONARY_MAX_SIZE, (intp)0 );
+	for ( const auto &run : runs )
+	{
+		const intp nRunSkip = min( nSkip, run.nSize );
+		nSkip -= nRunSkip;
+
+		dictionary.Put( pData + run.nStart + nRunSkip, run.nSize - nRunSkip );
+	}
+}
+
+CON_COMMAND( net_compresspackets_dictionary_build, "Build a deflate dictionary from recorded reliable data: <file>" )
+{
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: net_compresspackets_dictionary_build <file>\n" );
+		return;
+	}
+
+	AUTO_LOCK( s_SamplesMutex );
+
+	s_bRecordingSamples = false;
+
+	if ( s_SampleOffsets.Count() < 2 )
+	{
+		Msg( "Not enough samples, record some connects with net_compresspackets_dictionary_record 1 first.\n" );
+		return;
+	}
+
+	CUtlBuffer dictionary;
+	BuildDictionary( dictionary );
+
+	if ( dictionary.TellPut() <= 0 )
+	{
+		Msg( "Recorded samples have nothing in common, no dictionary written.\n" );
+		return;
+	}
+
+	if ( !g_pFileSystem->WriteFile( args[1], "MOD", dictionary ) )
+	{
+		Warning( "Unable to write net compression dictionary %s.\n", args[1] );
+		return;
+	}
+
+	Msg( "Wrote net compression dictionary %s (%zd bytes from %zd samples).\n",
+		args[1], dictionary.TellPut(), s_SampleOffsets.Count() );
+
+	s_SampleData.Purge();
+	s_SampleOffsets.Purge();
+}
@@ -0,0 +1,49 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Net channel compression codec selection, connect handshake and
+//			deflate dictionary training.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef NET_COMPRESSION_H
+#define NET_COMPRESSION_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+
+class bf_read;
+class bf_write;
+
+// Codecs for compressed reliable data, see CNetChan::CompressFragments.
+// Compressed buffers are self describing, so only the sender has to pick one
+// the receiver understands.
+enum NetCompressionCodec_t
+{
+	NET_COMPRESSION_SNAPPY = 0,
+	NET_COMPRESSION_DEFLATE,
+
+	NET_COMPRESSION_CODEC_COUNT
+};
+
+// Appended to C2S_CONNECT by the client: tag, mask of codecs the client can
+// decode, deflate dictionary id. Old servers ignore the trailing bytes, old
+// clients don't send it and get Snappy.
+void	NET_WriteCompressionHandshake( bf_write &msg );
+// Returns false if the packet has no handshake, outputs are set to Snappy only then.
+bool	NET_ReadCompressionHandshake( bf_read &msg, int &nCodecMask, uint32 &nDictionaryId );
+
+// Picks the server preferred codec the client supports.
+NetCompressionCodec_t NET_SelectCompressionCodec( int nCodecMask, uint32 nDictionaryId, bool &bUseDictionary );
+
+// Level for NET_COMPRESSION_DEFLATE.
+int		NET_GetCompressionLevel();
+
+// Sample collection for net_compresspackets_dictionary_build, called with
+// uncompressed reliable data. May be called from snapshot worker threads.
+bool	NET_IsRecordingCompressionSamples();
+void	NET_RecordCompressionSample( const void *pData, unsigned int nSize );
+
+#endif // NET_COMPRESSION_H
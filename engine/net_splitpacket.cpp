@@ -0,0 +1,316 @@
+// Copyright Valve Corporation, All rights reserved.
+//
+// Fixed-capacity split packet reassembly.
+
+#include "net_splitpacket.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "tier0/commonmacros.h"
+#include "tier0/dbg.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+CSplitPacketSlab::CSplitPacketSlab( int nMaxEntries, int nMaxPacketSize, double flStaleTime )
+{
+	Assert( nMaxEntries > 0 && nMaxPacketSize > 0 );
+
+	m_nMaxEntries = nMaxEntries;
+	m_nMaxPacketSize = nMaxPacketSize;
+	m_flStaleTime = flStaleTime;
+
+	// Power of two, at least twice the entries to keep chains short.
+	int nBuckets = 1;
+	while ( nBuckets < nMaxEntries * 2 )
+		nBuckets <<= 1;
+
+	m_nHashMask = nBuckets - 1;
+	m_pHash = new int[ nBuckets ];
+	m_pEntries = new SplitEntry_t[ nMaxEntries ];
+
+	for ( int i = 0; i < nMaxEntries; ++i )
+	{
+		m_pEntries[i].pBuffer = nullptr;
+	}
+
+	m_nActive = 0;
+	m_iHead = m_iTail = -1;
+	m_iFree = -1;
+	m_iCompleted = -1;
+
+	Purge();
+}
+
+CSplitPacketSlab::~CSplitPacketSlab()
+{
+	Purge();
+
+	delete[] m_pEntries;
+	delete[] m_pHash;
+}
+
+void CSplitPacketSlab::Purge()
+{
+	for ( int i = 0; i <= m_nHashMask; ++i )
+	{
+		m_pHash[i] = -1;
+	}
+
+	// Rebuild free list in order, lowest slots are reused first.
+	for ( int i = 0; i < m_nMaxEntries; ++i )
+	{
+		SplitEntry_t &entry = m_pEntries[i];
+
+		free( entry.pBuffer );
+		entry.pBuffer = nullptr;
+		entry.from.Clear();
+		entry.nHashNext = -1;
+		entry.nPrev = -1;
+		entry.nNext = i + 1 < m_nMaxEntries ? i + 1 : -1;
+	}
+
+	m_nActive = 0;
+	m_iHead = m_iTail = -1;
+	m_iFree = 0;
+	m_iCompleted = -1;
+}
+
+int CSplitPacketSlab::HashBucket( const netadr_t &from ) const
+{
+	unsigned int h = from.GetIPHostByteOrder() * 2654435761u;
+	h ^= ( h >> 16 ) ^ ( from.GetPort() * 40503u );
+	return static_cast<int>( h & m_nHashMask );
+}
+
+int CSplitPacketSlab::Find( const netadr_t &from ) const
+{
+	for ( int i = m_pHash[ HashBucket( from ) ]; i != -1; i = m_pEntries[i].nHashNext )
+	{
+		if ( from.CompareAdr( m_pEntries[i].from ) )
+			return i;
+	}
+
+	return -1;
+}
+
+void CSplitPacketSlab::LinkTail( int iEntry )
+{
+	SplitEntry_t &entry = m_pEntries[iEntry];
+
+	entry.nPrev = m_iTail;
+	entry.nNext = -1;
+
+	if ( m_iTail != -1 )
+		m_pEntries[m_iTail].nNext = iEntry;
+	else
+		m_iHead = iEntry;
+
+	m_iTail = iEntry;
+}
+
+void CSplitPacketSlab::UnlinkList( int iEntry )
+{
+	SplitEntry_t &entry = m_pEntries[iEntry];
+
+	if ( entry.nPrev != -1 )
+		m_pEntries[entry.nPrev].nNext = entry.nNext;
+	else
+		m_iHead = entry.nNext;
+
+	if ( entry.nNext != -1 )
+		m_pEntries[entry.nNext].nPrev = entry.nPrev;
+	else
+		m_iTail = entry.nPrev;
+
+	entry.nPrev = entry.nNext = -1;
+}
+
+void CSplitPacketSlab::Unlink( int iEntry )
+{
+	UnlinkList( iEntry );
+
+	SplitEntry_t &entry = m_pEntries[iEntry];
+
+	// Remove from hash chain.
+	int *pLink = &m_pHash[ HashBucket( entry.from ) ];
+	while ( *pLink != -1 )
+	{
+		if ( *pLink == iEntry )
+		{
+			*pLink = entry.nHashNext;
+			break;
+		}
+
+		pLink = &m_pEntries[*pLink].nHashNext;
+	}
+
+	entry.nHashNext = -1;
+	--m_nActive;
+}
+
+void CSplitPacketSlab::Free( int iEntry )
+{
+	Unlink( iEntry );
+
+	SplitEntry_t &entry = m_pEntries[iEntry];
+	entry.from.Clear();
+	entry.nNext = m_iFree;
+	m_iFree = iEntry;
+}
+
+int CSplitPacketSlab::Alloc( const netadr_t &from )
+{
+	// Full, recycle the least recently active entry.
+	if ( m_iFree == -1 )
+	{
+		Assert( m_iHead != -1 );
+		Free( m_iHead );
+	}
+
+	const int iEntry = m_iFree;
+	SplitEntry_t &entry = m_pEntries[iEntry];
+
+	if ( !entry.pBuffer )
+	{
+		entry.pBuffer = static_cast<byte *>( malloc( m_nMaxPacketSize ) );
+		if ( !entry.pBuffer )
+			return -1;
+	}
+
+	m_iFree = entry.nNext;
+
+	entry.from = from;
+
+	const int iBucket = HashBucket( from );
+	entry.nHashNext = m_pHash[iBucket];
+	m_pHash[iBucket] = iEntry;
+
+	LinkTail( iEntry );
+	++m_nActive;
+
+	return iEntry;
+}
+
+void CSplitPacketSlab::Reset( SplitEntry_t &entry, int nSequence, int nPacketCount, int nSplitSize )
+{
+	entry.nSequence = nSequence;
+	entry.nSplitCount = nPacketCount;
+	entry.nSplitSize = nSplitSize;
+	entry.nRemaining = nPacketCount;
+	entry.nTotalSize = 0;
+
+	BitwiseClear( entry.received );
+}
+
+void CSplitPacketSlab::ReleaseCompleted()
+{
+	if ( m_iCompleted == -1 )
+		return;
+
+	SplitEntry_t &entry = m_pEntries[m_iCompleted];
+	entry.from.Clear();
+	entry.nNext = m_iFree;
+	m_iFree = m_iCompleted;
+	m_iCompleted = -1;
+}
+
+byte *CSplitPacketSlab::GetCompletedData() const
+{
+	return m_iCompleted != -1 ? m_pEntries[m_iCompleted].pBuffer : nullptr;
+}
+
+int CSplitPacketSlab::GetCompletedSize() const
+{
+	return m_iCompleted != -1 ? m_pEntries[m_iCompleted].nTotalSize : 0;
+}
+
+void CSplitPacketSlab::DiscardStale( double flTime )
+{
+	ReleaseCompleted();
+
+	// Activity list is ordered by time, stop at the first live entry.
+	while ( m_iHead != -1 && flTime >= m_pEntries[m_iHead].flLastActive + m_flStaleTime )
+	{
+		Free( m_iHead );
+	}
+}
+
+CSplitPacketSlab::Result_t CSplitPacketSlab::AddFragment( const netadr_t &from, int nSequence,
+	int nPacketNumber, int nPacketCount, int nSplitSize, const byte *pData, int nSize, double flTime )
+{
+	ReleaseCompleted();
+
+	if ( nPacketCount <= 0 || nPacketCount > MAX_SPLITS ||
+		 nPacketNumber < 0 || nPacketNumber >= nPacketCount ||
+		 nSplitSize <= 0 || nSize > nSplitSize )
+		return SPLIT_INVALID;
+
+	const bool bLast = nPacketNumber == nPacketCount - 1;
+
+	// Only the last fragment may be shorter than the split size.
+	if ( nSize <= 0 || ( !bLast && nSize != nSplitSize ) )
+		return SPLIT_TRUNCATED;
+
+	const int nOffset = nPacketNumber * nSplitSize;
+	if ( nOffset + nSize > m_nMaxPacketSize )
+		return SPLIT_TOO_LARGE;
+
+	int iEntry = Find( from );
+	if ( iEntry == -1 )
+	{
+		iEntry = Alloc( from );
+		if ( iEntry == -1 )
+			return SPLIT_INVALID;
+
+		Reset( m_pEntries[iEntry], nSequence, nPacketCount, nSplitSize );
+	}
+	else
+	{
+		SplitEntry_t &entry = m_pEntries[iEntry];
+
+		if ( entry.nSequence != nSequence )
+		{
+			// New packet from this source, previous one is lost.
+			Reset( entry, nSequence, nPacketCount, nSplitSize );
+		}
+		else if ( entry.nSplitSize != nSplitSize || entry.nSplitCount != nPacketCount )
+		{
+			Free( iEntry );
+			return SPLIT_INCONSISTENT;
+		}
+
+		// Keep the activity list ordered.
+		if ( iEntry != m_iTail )
+		{
+			UnlinkList( iEntry );
+			LinkTail( iEntry );
+		}
+	}
+
+	SplitEntry_t &entry = m_pEntries[iEntry];
+	entry.flLastActive = flTime;
+
+	const uint32 nBit = 1u << ( nPacketNumber & 31 );
+	uint32 &received = entry.received[ nPacketNumber >> 5 ];
+	if ( received & nBit )
+		return SPLIT_DUPLICATE;
+
+	received |= nBit;
+	memcpy( entry.pBuffer + nOffset, pData, nSize );
+
+	if ( bLast )
+	{
+		entry.nTotalSize = nOffset + nSize;
+	}
+
+	if ( --entry.nRemaining > 0 )
+		return SPLIT_INCOMPLETE;
+
+	// Hand the buffer out, the slot goes back to the free list on the next call.
+	Unlink( iEntry );
+	m_iCompleted = iEntry;
+
+	return SPLIT_COMPLETE;
+}
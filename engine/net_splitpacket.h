@@ -0,0 +1,103 @@
+// Copyright Valve Corporation, All rights reserved.
+//
+// Fixed-capacity split packet reassembly.
+
+#ifndef NET_SPLITPACKET_H
+#define NET_SPLITPACKET_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+#include "tier1/netadr.h"
+
+//-----------------------------------------------------------------------------
+// Reassembles split packets for one socket.
+//
+// The slab tracks at most nMaxEntries packets in flight, one per source
+// address, found through a small hash on the address. Fragments are copied
+// straight to their final offset in the entry buffer. Entry buffers are
+// allocated the first time a slot is used and kept, so steady state
+// reassembly does not allocate. Entries are kept in last activity order:
+// stale ones are dropped from the head in bulk, and when the slab is full
+// the oldest entry is recycled.
+//
+// Not thread safe, each socket is only read by one thread at a time.
+//-----------------------------------------------------------------------------
+class CSplitPacketSlab
+{
+public:
+	// Packet count is sent in one byte.
+	enum { MAX_SPLITS = 256 };
+
+	enum Result_t
+	{
+		SPLIT_INCOMPLETE = 0,	// fragment stored, waiting for the rest
+		SPLIT_COMPLETE,			// all fragments in, see GetCompletedData()
+		SPLIT_DUPLICATE,		// fragment already received, ignored
+		SPLIT_INVALID,			// fragment number / count / size out of range
+		SPLIT_TRUNCATED,		// fragment shorter than the split size and not the last one
+		SPLIT_TOO_LARGE,		// fragment ends past the max packet size
+		SPLIT_INCONSISTENT,		// split size or count differs from earlier fragments, packet dropped
+	};
+
+	CSplitPacketSlab( int nMaxEntries, int nMaxPacketSize, double flStaleTime );
+	~CSplitPacketSlab();
+
+	Result_t	AddFragment( const netadr_t &from, int nSequence, int nPacketNumber, int nPacketCount,
+					int nSplitSize, const byte *pData, int nSize, double flTime );
+
+	// Valid after SPLIT_COMPLETE until the next AddFragment, DiscardStale or Purge call.
+	// The buffer is nMaxPacketSize bytes long and may be modified in place.
+	byte		*GetCompletedData() const;
+	int			GetCompletedSize() const;
+
+	// Drops entries without any activity for flStaleTime.
+	void		DiscardStale( double flTime );
+	// Drops all entries and frees the buffers.
+	void		Purge();
+
+	int			Count() const { return m_nActive; }
+	int			MaxCount() const { return m_nMaxEntries; }
+
+private:
+	struct SplitEntry_t
+	{
+		netadr_t	from;
+		double		flLastActive;
+		int			nSequence;
+		int			nSplitCount;
+		int			nSplitSize;
+		int			nRemaining;
+		int			nTotalSize;
+		int			nHashNext;
+		int			nPrev;		// activity list
+		int			nNext;		// activity list or free list
+		uint32		received[ MAX_SPLITS / 32 ];
+		byte		*pBuffer;
+	};
+
+	int			Find( const netadr_t &from ) const;
+	int			Alloc( const netadr_t &from );
+	void		Free( int iEntry );
+	void		Reset( SplitEntry_t &entry, int nSequence, int nPacketCount, int nSplitSize );
+	void		LinkTail( int iEntry );
+	void		UnlinkList( int iEntry );
+	void		Unlink( int iEntry );
+	void		ReleaseCompleted();
+	int			HashBucket( const netadr_t &from ) const;
+
+	SplitEntry_t	*m_pEntries;
+	int				*m_pHash;
+	int				m_nHashMask;
+	int				m_nMaxEntries;
+	int				m_nMaxPacketSize;
+	int				m_nActive;
+	int				m_iHead;		// least recently active
+	int				m_iTail;		// most recently active
+	int				m_iFree;
+	int				m_iCompleted;	// unlinked until the caller is done with it
+	double			m_flStaleTime;
+};
+
+#endif // NET_SPLITPACKET_H
@@ -10,6 +10,7 @@
 
 #include "net_ws_headers.h"
 #include "net_ws_queued_packet_sender.h"
+#include "net_splitpacket.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -66,6 +67,7 @@ struct netsocket_t
 	bool		bListening;	// true if TCP port is listening
 	socket_handle	hUDP;		// handle to UDP socket from socket()
 	socket_handle	hTCP;		// handle to TCP socket from socket()
+	CSplitPacketSlab	*pSplitPackets;	// split packet reassembly, created on demand
 };
 
 struct pendingsocket_t
@@ -93,16 +95,6 @@ struct loopback_t
 
 DEFINE_FIXEDSIZE_ALLOCATOR( loopback_t, 2, CUtlMemoryPool::GROW_SLOW );
 
-// Split long packets.  Anything over 1460 is failing on some routers
-struct LONGPACKET
-{
-	int		currentSequence;
-	int		splitCount;
-	int		totalSize;
-	int		nExpectedSplitSize;
-	char	buffer[ NET_MAX_MESSAGE ];	// This has to be big enough to hold the largest message
-};
-
 // Use this to pick apart the network stream, must be packed
 #pragma pack(1)
 struct SPLITPACKET
@@ -1040,94 +1032,37 @@ bool NET_LagPacket (bool newdata, netpacket_t * packet)
 // Calculate MAX_SPLITPACKET_SPLITS according to the smallest split size
 #define MAX_SPLITPACKET_SPLITS ( NET_MAX_MESSAGE / MIN_SPLIT_SIZE )
 #define SPLIT_PACKET_STALE_TIME		2.0f
-#define SPLIT_PACKET_TRACKING_MAX 256  // most number of outstanding split packets to allow
-
-class CSplitPacketEntry
-{
-public:
-	CSplitPacketEntry()
-	{
-		from.Clear();
-
-		BitwiseSet( splitflags, 0xFF );
-		BitwiseClear( netsplit );
-
-		lastactivetime = 0.0;
-	}
-
-public:
-	netadr_t		from;
-	int				splitflags[ MAX_SPLITPACKET_SPLITS ];
-	LONGPACKET		netsplit;
-	// host_time the last time any entry was received for this entry
-	// dimhotepus: float -> double.
-	double			lastactivetime;
-};
-
-typedef CUtlVector< CSplitPacketEntry > vecSplitPacketEntries_t;
-static CUtlVector<vecSplitPacketEntries_t> net_splitpackets;
+#define SPLIT_PACKET_TRACKING_MAX 64  // most number of outstanding split packets to allow per socket
 
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
 void NET_DiscardStaleSplitpackets( const intp sock )
 {
-	vecSplitPacketEntries_t &splitPacketEntries = net_splitpackets[sock];
-	intp i;
-	for ( i = splitPacketEntries.Count() - 1; i >= 0; i-- )
+	CSplitPacketSlab *pSlab = net_sockets[sock].pSplitPackets;
+	if ( pSlab )
 	{
-		CSplitPacketEntry *entry = &splitPacketEntries[ i ];
-		Assert( entry );
-
-		if ( net_time < ( entry->lastactivetime + SPLIT_PACKET_STALE_TIME ) )
-			continue;
-
-		splitPacketEntries.Remove( i );
-	}
-
-	if ( splitPacketEntries.Count() > SPLIT_PACKET_TRACKING_MAX )
-	{
-		while ( splitPacketEntries.Count() > SPLIT_PACKET_TRACKING_MAX )
-		{
-			CSplitPacketEntry *entry = &splitPacketEntries[ i ];
-			if ( net_time != entry->lastactivetime )
-				splitPacketEntries.Remove(0); // we add to tail each time, so head is the oldest entry, kill them first
-		}
+		pSlab->DiscardStale( net_time );
 	}
 }
 
-//-----------------------------------------------------------------------------
-// Purpose: 
-// Input  : *from - 
-// Output : CSplitPacketEntry
-//-----------------------------------------------------------------------------
-CSplitPacketEntry *NET_FindOrCreateSplitPacketEntry( const intp sock, netadr_t *from )
+static CSplitPacketSlab *NET_GetSplitPacketSlab( const intp sock )
 {
-	vecSplitPacketEntries_t &splitPacketEntries = net_splitpackets[sock];
-	intp i = 0, count = splitPacketEntries.Count();
-	
-	CSplitPacketEntry *entry = nullptr;
-	for ( auto &it : splitPacketEntries )
-	{
-		entry = &it;
+	netsocket_t &netsock = net_sockets[sock];
 
-		if ( from->CompareAdr(it.from) )
-			break;
-
-		++i;
-	}
-	
-	if ( i >= count )
+	// Created on the first split packet, most sockets never see one.
+	if ( !netsock.pSplitPackets )
 	{
-		// RaphaelIT7: Use AddToTailGetPtr to avoid stack allocating CSplitPacketEntry as it was allocated either way & this way won't hit a stack overflow.
-		CSplitPacketEntry* newentry = splitPacketEntries.AddToTailGetPtr();
-		newentry->from = *from;
-
-		entry = newentry;
+		netsock.pSplitPackets = new CSplitPacketSlab( SPLIT_PACKET_TRACKING_MAX, NET_MAX_MESSAGE, SPLIT_PACKET_STALE_TIME );
 	}
 
-	Assert( entry );
-	return entry;
+	return netsock.pSplitPackets;
+}
+
+static void NET_FreeSplitPacketSlab( netsocket_t &netsock )
+{
+	delete netsock.pSplitPackets;
+	netsock.pSplitPackets = nullptr;
 }
 
 static char const *DescribeSocket( intp sock )
@@ -1217,50 +1152,16 @@ bool NET_GetLong( const intp sock, netpacket_t *packet )
 		return false;
 	}
 
-	CSplitPacketEntry *entry = NET_FindOrCreateSplitPacketEntry( sock, &packet->from );
-	Assert( entry );
-	if ( !entry )
-		return false;
-
-	entry->lastactivetime = net_time;
-	Assert( packet->from.CompareAdr( entry->from ) );
-
-	// First packet in split series?
-	if ( entry->netsplit.currentSequence == -1 || 
-		sequenceNumber != entry->netsplit.currentSequence )
-	{
-		entry->netsplit.currentSequence	= sequenceNumber;
-		entry->netsplit.splitCount		= packetCount;
-		entry->netsplit.nExpectedSplitSize = nSplitSizeMinusHeader;
-	}
-
-	if ( entry->netsplit.nExpectedSplitSize != nSplitSizeMinusHeader )
-	{
-		char buffer[32];
-		Msg( "NET_GetLong:  Split packet from %s with inconsistent split size (number %i/ count %i) where size %i not equal to initial size of %i\n", 
-			packet->from.ToString_safe(buffer), 
-			packetNumber, 
-			packetCount, 
-			nSplitSizeMinusHeader,
-			entry->netsplit.nExpectedSplitSize
-			);
-		entry->lastactivetime = net_time + SPLIT_PACKET_STALE_TIME;
-		return false;
-	}
+	const int size = packet->size - static_cast<int>(sizeof(SPLITPACKET));
 
-	int size = packet->size - sizeof(SPLITPACKET);
+	CSplitPacketSlab *pSlab = NET_GetSplitPacketSlab( sock );
+	const CSplitPacketSlab::Result_t result = pSlab->AddFragment( packet->from, sequenceNumber,
+		packetNumber, packetCount, nSplitSizeMinusHeader, packet->data + sizeof(SPLITPACKET), size, net_time );
 
-	if ( entry->splitflags[ packetNumber ] != sequenceNumber )
+	switch ( result )
 	{
-		// Last packet in sequence? set size
-		if ( packetNumber == (packetCount-1) )
-		{
-			entry->netsplit.totalSize = (packetCount-1) * nSplitSizeMinusHeader + size;
-		}
-
-		entry->netsplit.splitCount--;		// Count packet
-		entry->splitflags[ packetNumber ] = sequenceNumber;
-
+	case CSplitPacketSlab::SPLIT_INCOMPLETE:
+	case CSplitPacketSlab::SPLIT_COMPLETE:
 		if ( net_showsplits.GetInt() && net_showsplits.GetInt() != 3 )
 		{
 			char buffer[32];
@@ -1273,36 +1174,66 @@ bool NET_GetLong( const intp sock, netpacket_t *packet )
 				(uint64)(nSplitSizeMinusHeader + sizeof( SPLITPACKET )), 
 				packet->from.ToString_safe(buffer) );
 		}
-	}
-	else
-	{
-		char buffer[32];
-		Msg( "NET_GetLong:  Ignoring duplicated split packet %i of %i ( %i bytes ) from %s\n", packetNumber + 1, packetCount, size, packet->from.ToString_safe(buffer) );
-	}
+		break;
 
+	case CSplitPacketSlab::SPLIT_DUPLICATE:
+		{
+			char buffer[32];
+			Msg( "NET_GetLong:  Ignoring duplicated split packet %i of %i ( %i bytes ) from %s\n", packetNumber + 1, packetCount, size, packet->from.ToString_safe(buffer) );
+		}
+		return false;
 
-	// Copy the incoming data to the appropriate place in the buffer
-	int offset = (packetNumber * nSplitSizeMinusHeader);
-	memcpy( entry->netsplit.buffer + offset, packet->data + sizeof(SPLITPACKET), size );
-	
-	// Have we received all of the pieces to the packet?
-	if ( entry->netsplit.splitCount <= 0 )
-	{
-		entry->netsplit.currentSequence = -1;	// Clear packet
-		if ( entry->netsplit.totalSize > static_cast<int>(sizeof(entry->netsplit.buffer)) )
+	case CSplitPacketSlab::SPLIT_INVALID:
 		{
 			char buffer[32];
-			Msg("Split packet too large! %d bytes from %s\n", entry->netsplit.totalSize, packet->from.ToString_safe(buffer) );
-			return false;
+			Msg( "NET_GetLong:  Split packet from %s with invalid split part (number %i/ count %i)\n", 
+				packet->from.ToString_safe(buffer), 
+				packetNumber, 
+				packetCount );
 		}
+		return false;
 
-		Q_memcpy( packet->data, entry->netsplit.buffer, entry->netsplit.totalSize );
-		packet->size = entry->netsplit.totalSize;
-		packet->wiresize = entry->netsplit.totalSize;
-		return true;
+	case CSplitPacketSlab::SPLIT_TRUNCATED:
+		{
+			char buffer[32];
+			Msg( "NET_GetLong:  Split packet from %s with truncated split part (number %i/ count %i) where size %i does not match split size %i\n", 
+				packet->from.ToString_safe(buffer), 
+				packetNumber, 
+				packetCount, 
+				size,
+				nSplitSizeMinusHeader );
+		}
+		return false;
+
+	case CSplitPacketSlab::SPLIT_TOO_LARGE:
+		{
+			char buffer[32];
+			Msg( "Split packet too large! %d bytes from %s\n", packetNumber * nSplitSizeMinusHeader + size, packet->from.ToString_safe(buffer) );
+		}
+		return false;
+
+	case CSplitPacketSlab::SPLIT_INCONSISTENT:
+		{
+			char buffer[32];
+			Msg( "NET_GetLong:  Split packet from %s with inconsistent split size or count (number %i/ count %i, size %i)\n", 
+				packet->from.ToString_safe(buffer), 
+				packetNumber, 
+				packetCount, 
+				nSplitSizeMinusHeader );
+		}
+		return false;
 	}
 
-	return false;
+	if ( result != CSplitPacketSlab::SPLIT_COMPLETE )
+		return false;
+
+	// Hand out the reassembled buffer instead of copying it back into the scratch buffer.
+	// It stays valid until the next NET_GetPacket on this socket and is NET_MAX_MESSAGE
+	// bytes long, same as scratch, so decompression may still write into it.
+	packet->data = pSlab->GetCompletedData();
+	packet->size = pSlab->GetCompletedSize();
+	packet->wiresize = packet->size;
+	return true;
 }
 
 
@@ -1347,6 +1278,268 @@ bool NET_GetLoopPacket ( netpacket_t * packet )
 	return ( NET_LagPacket( true, packet ) );	
 }
 
+//-----------------------------------------------------------------------------
+// Batched UDP I/O for Linux dedicated servers. Incoming datagrams are drained
+// with one recvmmsg into a per-socket ring and handed out one by one, outgoing
+// datagrams sent between NET_BeginSendBatch and NET_FlushSendBatch go out with
+// one sendmmsg per socket.
+//-----------------------------------------------------------------------------
+#ifdef LINUX
+
+constexpr inline int NET_UDP_BATCH_MAX{32};
+// No UDP datagram is larger than 64k, NET_ReceiveDatagram treats anything bigger than NET_MAX_MESSAGE as oversize.
+constexpr inline int NET_UDP_BATCH_RECV_SLOT{NET_MAX_MESSAGE < 65536 ? NET_MAX_MESSAGE : 65536};
+// Largest datagram NET_SendPacket produces, bigger ones bypass the batch.
+constexpr inline int NET_UDP_BATCH_SEND_SLOT{MAX_USER_MAXROUTABLE_SIZE + static_cast<int>(sizeof( SPLITPACKET )) + 64};
+
+static ConVar net_udp_batch( "net_udp_batch", "0", 0, "Max datagrams per recvmmsg/sendmmsg call on dedicated servers (0 = one syscall per datagram)", true, 0, true, NET_UDP_BATCH_MAX );
+static ConVar net_showudp_batch( "net_showudp_batch", "0", 0, "Show batched UDP I/O counters each frame" );
+
+struct netrecvbatch_t
+{
+	mmsghdr		msgs[ NET_UDP_BATCH_MAX ];
+	iovec		iov[ NET_UDP_BATCH_MAX ];
+	sockaddr	from[ NET_UDP_BATCH_MAX ];
+	int			nCount;		// datagrams received by the last recvmmsg
+	int			nNext;		// next datagram to hand out
+	byte		data[ NET_UDP_BATCH_MAX ][ NET_UDP_BATCH_RECV_SLOT ];
+};
+
+struct netsendbatch_t
+{
+	CThreadFastMutex	mutex;	// snapshots are sent from SV_ParallelSendSnapshot workers
+	socket_handle		hUDP;
+	mmsghdr		msgs[ NET_UDP_BATCH_MAX ];
+	iovec		iov[ NET_UDP_BATCH_MAX ];
+	sockaddr	to[ NET_UDP_BATCH_MAX ];
+	int			nCount;
+	byte		data[ NET_UDP_BATCH_MAX ][ NET_UDP_BATCH_SEND_SLOT ];
+};
+
+static netrecvbatch_t	*s_pRecvBatch[ MAX_SOCKETS ];
+static netsendbatch_t	*s_pSendBatch[ MAX_SOCKETS ];
+static bool				s_bSendBatchActive = false;
+
+// Per frame counters, printed and reset by NET_FlushSendBatch
+static CInterlockedInt	s_nBatchRecvCalls;
+static CInterlockedInt	s_nBatchRecvDatagrams;
+static CInterlockedInt	s_nBatchSendCalls;
+static CInterlockedInt	s_nBatchSendDatagrams;
+static CInterlockedInt	s_nBatchSendDropped;
+
+static bool NET_UseUDPBatch()
+{
+	return net_dedicated && net_udp_batch.GetInt() > 0 && VCRGetMode() == VCR_Disabled;
+}
+
+static void NET_FreeUDPBatches()
+{
+	for ( intp i = 0; i < MAX_SOCKETS; i++ )
+	{
+		delete s_pRecvBatch[i];
+		s_pRecvBatch[i] = nullptr;
+
+		delete s_pSendBatch[i];
+		s_pSendBatch[i] = nullptr;
+	}
+
+	s_bSendBatchActive = false;
+}
+
+// Returns datagram size or -1 with errno set, like recvfrom.
+static int NET_ReceiveBatchedDatagram( const intp sock, socket_handle hSocket, unsigned char *data, struct sockaddr *from )
+{
+	netrecvbatch_t *pBatch = s_pRecvBatch[sock];
+	if ( !pBatch )
+	{
+		pBatch = s_pRecvBatch[sock] = new netrecvbatch_t;
+		pBatch->nCount = pBatch->nNext = 0;
+	}
+
+	if ( pBatch->nNext >= pBatch->nCount )
+	{
+		pBatch->nCount = pBatch->nNext = 0;
+
+		const int nMaxBatch = min( net_udp_batch.GetInt(), NET_UDP_BATCH_MAX );
+		for ( int i = 0; i < nMaxBatch; i++ )
+		{
+			pBatch->iov[i].iov_base = pBatch->data[i];
+			pBatch->iov[i].iov_len = sizeof( pBatch->data[i] );
+
+			msghdr &hdr = pBatch->msgs[i].msg_hdr;
+			memset( &hdr, 0, sizeof( hdr ) );
+			hdr.msg_name = &pBatch->from[i];
+			hdr.msg_namelen = sizeof( pBatch->from[i] );
+			hdr.msg_iov = &pBatch->iov[i];
+			hdr.msg_iovlen = 1;
+			pBatch->msgs[i].msg_len = 0;
+		}
+
+		int ret;
+		{
+			VPROF_BUDGET( "recvmmsg", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+			ret = recvmmsg( hSocket, pBatch->msgs, nMaxBatch, MSG_DONTWAIT, nullptr );
+		}
+
+		if ( ret <= 0 )
+			return -1;
+
+		++s_nBatchRecvCalls;
+		s_nBatchRecvDatagrams += ret;
+
+		pBatch->nCount = ret;
+	}
+
+	const int i = pBatch->nNext++;
+
+	// Truncated datagrams did not fit the slot, make them look oversized.
+	int ret = static_cast<int>( pBatch->msgs[i].msg_len );
+	if ( pBatch->msgs[i].msg_hdr.msg_flags & MSG_TRUNC )
+		ret = NET_MAX_MESSAGE;
+
+	memcpy( data, pBatch->data[i], min( ret, NET_UDP_BATCH_RECV_SLOT ) );
+	memcpy( from, &pBatch->from[i], sizeof( *from ) );
+
+	// Handing out a buffered datagram is not a socket error, see NET_ReceiveValidDatagram.
+	errno = 0;
+	return ret;
+}
+
+// Must hold pBatch->mutex.
+static void NET_FlushSendBatchLocked( netsendbatch_t *pBatch )
+{
+	int nSent = 0;
+
+	while ( nSent < pBatch->nCount )
+	{
+		int ret;
+		{
+			VPROF_BUDGET( "sendmmsg", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+			ret = sendmmsg( pBatch->hUDP, pBatch->msgs + nSent, pBatch->nCount - nSent, 0 );
+		}
+
+		++s_nBatchSendCalls;
+
+		if ( ret > 0 )
+		{
+			s_nBatchSendDatagrams += ret;
+			nSent += ret;
+		}
+		else
+		{
+			// Same as a failed sendto, the datagram is lost.
+			++s_nBatchSendDropped;
+			++nSent;
+		}
+	}
+
+	pBatch->nCount = 0;
+}
+
+// Returns false if the datagram must be sent right away.
+static bool NET_QueueBatchedSend( socket_handle s, const char *buf, int len, const struct sockaddr *to, int tolen )
+{
+	if ( !s_bSendBatchActive || len > NET_UDP_BATCH_SEND_SLOT || tolen > static_cast<int>(sizeof( sockaddr )) )
+		return false;
+
+	netsendbatch_t *pBatch = nullptr;
+	for ( auto *b : s_pSendBatch )
+	{
+		if ( b && b->hUDP == s )
+		{
+			pBatch = b;
+			break;
+		}
+	}
+
+	if ( !pBatch )
+		return false;
+
+	AUTO_LOCK( pBatch->mutex );
+
+	if ( pBatch->nCount >= min( net_udp_batch.GetInt(), NET_UDP_BATCH_MAX ) )
+	{
+		NET_FlushSendBatchLocked( pBatch );
+	}
+
+	const int i = pBatch->nCount++;
+
+	memcpy( pBatch->data[i], buf, len );
+	memcpy( &pBatch->to[i], to, tolen );
+
+	pBatch->iov[i].iov_base = pBatch->data[i];
+	pBatch->iov[i].iov_len = len;
+
+	msghdr &hdr = pBatch->msgs[i].msg_hdr;
+	memset( &hdr, 0, sizeof( hdr ) );
+	hdr.msg_name = &pBatch->to[i];
+	hdr.msg_namelen = tolen;
+	hdr.msg_iov = &pBatch->iov[i];
+	hdr.msg_iovlen = 1;
+	pBatch->msgs[i].msg_len = 0;
+
+	return true;
+}
+
+#endif // LINUX
+
+void NET_BeginSendBatch()
+{
+#ifdef LINUX
+	if ( !NET_UseUDPBatch() )
+		return;
+
+	for ( intp i = 0; i < min( net_sockets.Count(), static_cast<intp>(MAX_SOCKETS) ); i++ )
+	{
+		if ( !net_sockets[i].hUDP )
+			continue;
+
+		netsendbatch_t *pBatch = s_pSendBatch[i];
+		if ( !pBatch )
+		{
+			pBatch = s_pSendBatch[i] = new netsendbatch_t;
+		}
+
+		pBatch->hUDP = net_sockets[i].hUDP;
+		pBatch->nCount = 0;
+	}
+
+	s_bSendBatchActive = true;
+#endif
+}
+
+void NET_FlushSendBatch()
+{
+#ifdef LINUX
+	if ( s_bSendBatchActive )
+	{
+		s_bSendBatchActive = false;
+
+		for ( auto *pBatch : s_pSendBatch )
+		{
+			if ( pBatch )
+			{
+				AUTO_LOCK( pBatch->mutex );
+				NET_FlushSendBatchLocked( pBatch );
+			}
+		}
+	}
+
+	if ( net_showudp_batch.GetBool() && ( s_nBatchRecvCalls || s_nBatchSendCalls ) )
+	{
+		Msg( "UDP batch: recv %d datagrams in %d recvmmsg, sent %d datagrams in %d sendmmsg (%d dropped) tm=%f\n",
+			s_nBatchRecvDatagrams.GetRaw(), s_nBatchRecvCalls.GetRaw(),
+			s_nBatchSendDatagrams.GetRaw(), s_nBatchSendCalls.GetRaw(), s_nBatchSendDropped.GetRaw(), net_time );
+	}
+
+	s_nBatchRecvCalls = 0;
+	s_nBatchRecvDatagrams = 0;
+	s_nBatchSendCalls = 0;
+	s_nBatchSendDatagrams = 0;
+	s_nBatchSendDropped = 0;
+#endif
+}
+
 bool NET_ReceiveDatagram ( const intp sock, netpacket_t * packet )
 {
 	VPROF_BUDGET( "NET_ReceiveDatagram", VPROF_BUDGETGROUP_OTHER_NETWORKING );
@@ -1359,6 +1552,13 @@ bool NET_ReceiveDatagram ( const intp sock, netpacket_t * packet )
 	socket_handle	net_socket = net_sockets[packet->source].hUDP;
 
 	int ret = 0;
+#ifdef LINUX
+	if ( NET_UseUDPBatch() && packet->source < MAX_SOCKETS )
+	{
+		ret = NET_ReceiveBatchedDatagram( packet->source, net_socket, packet->data, &from );
+	}
+	else
+#endif
 	{
 		VPROF_BUDGET( "recvfrom", VPROF_BUDGETGROUP_OTHER_NETWORKING );
 		ret = VCRHook_recvfrom(net_socket, (char *)packet->data, NET_MAX_MESSAGE, 0, &from, &fromlen );
@@ -1480,8 +1680,13 @@ bool NET_ReceiveValidDatagram ( const intp sock, netpacket_t * packet )
 	// you're basically flooding the network and you need to solve this at a higher
 	// firewall or router level instead which is beyond the scope of our netcode.
 	// --henryg 10/12/2011
+	unsigned char *scratch = packet->data;
 	for ( int i = 1000; i > 0; --i )
 	{
+		// A reassembled split packet that failed later checks points into the split
+		// slab, receive the next datagram into scratch again.
+		packet->data = scratch;
+
 		// Attempt to receive a valid packet.
 		if ( NET_ReceiveDatagram ( sock, packet ) )
 		{
@@ -1865,15 +2070,24 @@ int NET_SendTo( bool verbose, SOCKET s, const char FAR * buf, int len, const str
 	// Don't send anything out in VCR mode.. it just annoys other people testing in multiplayer.
 	if ( VCRGetMode() != VCR_Playback )
 	{
-		nSend = NET_SendToImpl
-		( 
-			s, 
-			buf,
-			len,
-			to, 
-			tolen, 
-			iGameDataLength 
-		);
+#ifdef LINUX
+		if ( NET_QueueBatchedSend( s, buf, len, to, tolen ) )
+		{
+			nSend = len;
+		}
+		else
+#endif
+		{
+			nSend = NET_SendToImpl
+			( 
+				s, 
+				buf,
+				len,
+				to, 
+				tolen, 
+				iGameDataLength 
+			);
+		}
 	}
 
 #if defined( _DEBUG )
@@ -2395,6 +2609,11 @@ NET_CloseAllSockets
 */
 void NET_CloseAllSockets (void)
 {
+#ifdef LINUX
+	// buffered datagrams belong to the old sockets
+	NET_FreeUDPBatches();
+#endif
+
 	// shut down any existing and open sockets
 	for (int i=0 ; i<net_sockets.Count() ; i++)
 	{
@@ -2408,6 +2627,8 @@ void NET_CloseAllSockets (void)
 			net_sockets[i].hUDP = 0;
 			net_sockets[i].hTCP = 0;
 		}
+
+		NET_FreeSplitPacketSlab( net_sockets[i] );
 	}
 
 	// shut down all pending sockets
@@ -2585,7 +2806,6 @@ intp NET_AddExtraSocket( int port )
 	OpenSocketInternal( newSocket, port, PORT_ANY, "extra", IPPROTO_UDP, true );
 
 	net_packets.EnsureCount( newSocket+1 );
-	net_splitpackets.EnsureCount( newSocket+1 );
 
 	return newSocket;
 }
@@ -2599,6 +2819,8 @@ void NET_RemoveAllExtraSockets()
 			NET_CloseSocket( net_sockets[i].hUDP );
 			NET_CloseSocket( net_sockets[i].hTCP );
 		}
+
+		NET_FreeSplitPacketSlab( net_sockets[i] );
 	}
 	net_sockets.RemoveMultiple( MAX_SOCKETS, net_sockets.Count()-MAX_SOCKETS );
 
@@ -2969,7 +3191,6 @@ void NET_Init( bool bIsDedicated )
 	// clear static stuff
 	net_sockets.EnsureCount( MAX_SOCKETS );
 	net_packets.EnsureCount( MAX_SOCKETS );
-	net_splitpackets.EnsureCount( MAX_SOCKETS );
 
 	for ( int i = 0; i < MAX_SOCKETS; ++i )
 	{
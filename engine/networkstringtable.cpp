@@ -15,7 +15,8 @@
 #include "baseclient.h"
 #include "vprof.h"
 #include "tier1/utlstring.h"
-#include "tier1/utlhashtable.h"
+#include "tier1/generichash.h"
+#include "tier0/threadtools.h"
 #include "tier0/etwprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -29,6 +30,51 @@ struct StringHistoryEntry
 	char string[ (1<<SUBSTRING_BITS) ];
 };
 
+//-----------------------------------------------------------------------------
+// Last 32 strings of an update, the bases for substring encoding. Index 0 is
+// the oldest, like the list it replaces, but adding never shifts entries.
+//-----------------------------------------------------------------------------
+class CStringHistory
+{
+public:
+	enum
+	{
+		MAX_ENTRIES = 32	// indices are sent in 5 bits
+	};
+
+	int Count() const
+	{
+		return m_nCount;
+	}
+
+	const char *String( int index ) const
+	{
+		Assert( index >= 0 && index < m_nCount );
+		return m_Entries[ ( m_nFirst + index ) & ( MAX_ENTRIES - 1 ) ].string;
+	}
+
+	void AddString( const char *pString )
+	{
+		const int slot = ( m_nFirst + m_nCount ) & ( MAX_ENTRIES - 1 );
+		if ( m_nCount == MAX_ENTRIES )
+		{
+			// drop the oldest
+			m_nFirst = ( m_nFirst + 1 ) & ( MAX_ENTRIES - 1 );
+		}
+		else
+		{
+			++m_nCount;
+		}
+
+		Q_strncpy( m_Entries[ slot ].string, pString, sizeof( m_Entries[ slot ].string ) );
+	}
+
+private:
+	StringHistoryEntry	m_Entries[ MAX_ENTRIES ];
+	int					m_nFirst = 0;
+	int					m_nCount = 0;
+};
+
 static int CountSimilarCharacters( char const *str1, char const *str2 )
 {
 	int c = 0;
@@ -43,14 +89,14 @@ static int CountSimilarCharacters( char const *str1, char const *str2 )
 	return c;
 }
 
-static int GetBestPreviousString( CUtlVector< StringHistoryEntry >& history, char const *newstring, int& substringsize )
+static int GetBestPreviousString( const CStringHistory& history, char const *newstring, int& substringsize )
 {
 	int bestindex = -1;
 	int bestcount = 0;
 	int c = history.Count();
 	for ( int i = 0; i < c; i++ )
 	{
-		char const *prev = history[ i ].string;
+		char const *prev = history.String( i );
 		int similar = CountSimilarCharacters( prev, newstring );
 		
 		if ( similar < 3 )
@@ -67,6 +113,152 @@ static int GetBestPreviousString( CUtlVector< StringHistoryEntry >& history, cha
 	return bestindex;
 }
 
+//-----------------------------------------------------------------------------
+// Interned, immutable storage for the strings of all string tables in the
+// process. The server tables and their SourceTV, replay and local client
+// mirrors hold the same strings, each is stored once here and dictionaries
+// keep pointers to it. Strings never move and are freed together when the
+// last table is destroyed, on map change or shutdown.
+//
+// No destructor and no containers with one on purpose: the static string
+// table containers may destroy their tables after this is gone.
+//-----------------------------------------------------------------------------
+class CNetworkStringPool
+{
+public:
+	void AddTable()
+	{
+		AUTO_LOCK( m_Mutex );
+		++m_nTables;
+	}
+
+	void RemoveTable()
+	{
+		AUTO_LOCK( m_Mutex );
+		Assert( m_nTables > 0 );
+		if ( --m_nTables == 0 )
+		{
+			Purge();
+		}
+	}
+
+	// Returns the pooled copy of pString, case sensitive.
+	const char *Intern( const char *pString )
+	{
+		const unsigned hash = HashString( pString );
+
+		AUTO_LOCK( m_Mutex );
+
+		if ( ( m_nStrings + 1 ) * 2 > m_nSlots )
+		{
+			Rehash( m_nSlots ? m_nSlots * 2 : 1024 );
+		}
+
+		for ( int i = hash & ( m_nSlots - 1 ); ; i = ( i + 1 ) & ( m_nSlots - 1 ) )
+		{
+			Slot_t &slot = m_pSlots[ i ];
+			if ( !slot.m_pString )
+			{
+				slot.m_pString = Store( pString );
+				slot.m_nHash = hash;
+				++m_nStrings;
+				return slot.m_pString;
+			}
+
+			if ( slot.m_nHash == hash && V_strcmp( slot.m_pString, pString ) == 0 )
+				return slot.m_pString;
+		}
+	}
+
+private:
+	enum
+	{
+		BLOCK_SIZE = 64 * 1024
+	};
+
+	struct Slot_t
+	{
+		const char	*m_pString;
+		unsigned	m_nHash;
+	};
+
+	// Blocks are chained through their first pointer.
+	const char *Store( const char *pString )
+	{
+		const intp size = V_strlen( pString ) + 1;
+		const intp header = sizeof( char * );
+
+		if ( size > m_nBlockLeft )
+		{
+			const intp blockSize = Max( static_cast<intp>( BLOCK_SIZE ), header + size );
+			char *pBlock = new char[ blockSize ];
+			*reinterpret_cast<char **>( pBlock ) = m_pBlocks;
+			m_pBlocks = pBlock;
+			m_pBlockPos = pBlock + header;
+			m_nBlockLeft = blockSize - header;
+		}
+
+		char *pCopy = m_pBlockPos;
+		memcpy( pCopy, pString, size );
+		m_pBlockPos += size;
+		m_nBlockLeft -= size;
+		return pCopy;
+	}
+
+	void Rehash( int nSlots )
+	{
+		Slot_t *pOld = m_pSlots;
+		const int nOld = m_nSlots;
+
+		m_pSlots = new Slot_t[ nSlots ];
+		memset( m_pSlots, 0, nSlots * sizeof( Slot_t ) );
+		m_nSlots = nSlots;
+
+		for ( int i = 0; i < nOld; i++ )
+		{
+			if ( !pOld[ i ].m_pString )
+				continue;
+
+			int j = pOld[ i ].m_nHash & ( nSlots - 1 );
+			while ( m_pSlots[ j ].m_pString )
+			{
+				j = ( j + 1 ) & ( nSlots - 1 );
+			}
+			m_pSlots[ j ] = pOld[ i ];
+		}
+
+		delete[] pOld;
+	}
+
+	void Purge()
+	{
+		while ( m_pBlocks )
+		{
+			char *pNext = *reinterpret_cast<char **>( m_pBlocks );
+			delete[] m_pBlocks;
+			m_pBlocks = pNext;
+		}
+
+		delete[] m_pSlots;
+		m_pSlots = nullptr;
+		m_nSlots = 0;
+		m_nStrings = 0;
+		m_pBlockPos = nullptr;
+		m_nBlockLeft = 0;
+	}
+
+	CThreadFastMutex	m_Mutex;
+	int					m_nTables = 0;
+	Slot_t				*m_pSlots = nullptr;	// open addressing, power of 2 sized, at most half full
+	int					m_nSlots = 0;
+	int					m_nStrings = 0;
+	char				*m_pBlocks = nullptr;	// most recent block first
+	char				*m_pBlockPos = nullptr;
+	intp				m_nBlockLeft = 0;
+};
+
+static CNetworkStringPool g_NetworkStringPool;
+
 static bool CNetworkStringTable_LessFunc( FileNameHandle_t const &a, FileNameHandle_t const &b )
 {
 	return a < b;
@@ -139,7 +331,9 @@ private:
 };
 
 //-----------------------------------------------------------------------------
-// Implementation for general purpose strings
+// Implementation for general purpose strings: entries in insertion order,
+// indexed by a flat open addressing table of caseless hashes. Strings are
+// pooled, see CNetworkStringPool.
 //-----------------------------------------------------------------------------
 class CNetworkStringDict : public INetworkStringDict
 {
@@ -154,46 +348,104 @@ public:
 
 	unsigned int Count() override
 	{
-		return m_Lookup.Count();
+		return static_cast<unsigned int>( m_Items.Count() );
 	}
 
 	void Purge() override
 	{
-		m_Lookup.Purge();
+		m_Strings.Purge();
+		m_Items.Purge();
+		m_Slots.Purge();
 	}
 
 	const char *String( int index ) override
 	{
-		return m_Lookup.Key( index ).Get();
+		return m_Strings[ index ].m_pString;
 	}
 
 	bool IsValidIndex( int index ) override
 	{
-		return m_Lookup.IsValidHandle( index );
+		return m_Items.IsValidIndex( index );
 	}
 
 	int Insert( const char *pString ) override
 	{
-		return m_Lookup.Insert( pString );
+		const unsigned hash = HashStringCaseless( pString );
+
+		if ( ( m_Strings.Count() + 1 ) * 2 > m_Slots.Count() )
+		{
+			Rehash( Max( static_cast<intp>( 64 ), m_Slots.Count() * 2 ) );
+		}
+
+		const intp mask = m_Slots.Count() - 1;
+		intp i = hash & mask;
+		for ( ; m_Slots[ i ]; i = ( i + 1 ) & mask )
+		{
+			const String_t &entry = m_Strings[ m_Slots[ i ] - 1 ];
+			if ( entry.m_nHash == hash && V_stricmp( entry.m_pString, pString ) == 0 )
+				return m_Slots[ i ] - 1;
+		}
+
+		const String_t entry = { g_NetworkStringPool.Intern( pString ), hash };
+		const int index = static_cast<int>( m_Strings.AddToTail( entry ) );
+		m_Items.AddToTail();
+		m_Slots[ i ] = index + 1;
+		return index;
 	}
 
 	int Find( const char *pString ) override
 	{
-		return pString ? m_Lookup.Find( pString ) : m_Lookup.InvalidHandle();
+		if ( !pString || m_Slots.IsEmpty() )
+			return -1;
+
+		const unsigned hash = HashStringCaseless( pString );
+		const intp mask = m_Slots.Count() - 1;
+		for ( intp i = hash & mask; m_Slots[ i ]; i = ( i + 1 ) & mask )
+		{
+			const String_t &entry = m_Strings[ m_Slots[ i ] - 1 ];
+			if ( entry.m_nHash == hash && V_stricmp( entry.m_pString, pString ) == 0 )
+				return m_Slots[ i ] - 1;
+		}
+
+		return -1;
 	}
 
 	CNetworkStringTableItem	&Element( int index ) override
 	{
-		return m_Lookup.Element( index );
+		return m_Items[ index ];
 	}
 
 	const CNetworkStringTableItem &Element( int index ) const override
 	{
-		return m_Lookup.Element( index );
+		return m_Items[ index ];
 	}
 
 private:
-	CUtlStableHashtable< CUtlConstString, CNetworkStringTableItem, CaselessStringHashFunctor, UTLConstStringCaselessStringEqualFunctor<char>, int32 > m_Lookup;
+	struct String_t
+	{
+		const char	*m_pString;	// pooled
+		unsigned	m_nHash;	// caseless
+	};
+
+	void Rehash( intp nSlots )
+	{
+		m_Slots.SetCount( nSlots );
+		memset( m_Slots.Base(), 0, nSlots * sizeof( int ) );
+
+		for ( int index = 0; index < m_Strings.Count(); index++ )
+		{
+			intp i = m_Strings[ index ].m_nHash & ( nSlots - 1 );
+			while ( m_Slots[ i ] )
+			{
+				i = ( i + 1 ) & ( nSlots - 1 );
+			}
+			m_Slots[ i ] = index + 1;
+		}
+	}
+
+	CUtlVector< String_t >					m_Strings;
+	CUtlVector< CNetworkStringTableItem >	m_Items;
+	CUtlVector< int >						m_Slots;	// m_Strings index + 1, 0 if empty; power of 2 sized, at most half full
 };
 
 //-----------------------------------------------------------------------------
@@ -206,6 +458,8 @@ CNetworkStringTable::CNetworkStringTable( TABLEID id, const char *tableName, int
 	m_bAllowClientSideAddString( false ),
 	m_pItemsClientSide( NULL )
 {
+	g_NetworkStringPool.AddTable();
+
 	m_id = id;
 	Assert( tableName );
 	m_pszTableName = V_strdup( tableName );
@@ -216,6 +470,11 @@ CNetworkStringTable::CNetworkStringTable( TABLEID id, const char *tableName, int
 	m_nTickCount = 0;
 	m_pMirrorTable = NULL;
 	m_nLastChangedTick = 0;
+	m_nChangeSerial = 0;
+#ifndef SHARED_NET_STRING_TABLES
+	m_nBaselineSerial = -1;
+	m_nBaselineBits = 0;
+#endif
 	m_bChangeHistoryEnabled = false;
 	m_bLocked = false;
 
@@ -321,6 +580,8 @@ CNetworkStringTable::~CNetworkStringTable( void )
 	delete[] m_pszTableName;
 	delete m_pItems;
 	delete m_pItemsClientSide;
+
+	g_NetworkStringPool.RemoveTable();
 }
 
 //-----------------------------------------------------------------------------
@@ -328,6 +589,10 @@ CNetworkStringTable::~CNetworkStringTable( void )
 //-----------------------------------------------------------------------------
 void CNetworkStringTable::DeleteAllStrings( void )
 {
+	++m_nChangeSerial;
+
+	m_EntryTicks.RemoveAll();
+
 	delete m_pItems;
 	if ( m_bIsFilenames )
 	{
@@ -438,6 +703,7 @@ void CNetworkStringTable::RestoreTick(int tick)
 	// TODO optimize this, most of the time the tables doens't really change
 
 	m_nLastChangedTick = 0;
+	++m_nChangeSerial;
 
 	int count = m_pItems->Count();
 		
@@ -445,6 +711,7 @@ void CNetworkStringTable::RestoreTick(int tick)
 	{
 		// restore tick in all entries
 		int tickChanged = m_pItems->Element( i ).RestoreTick( tick );
+		m_EntryTicks[ i ] = tickChanged;
 
 		if ( tickChanged > m_nLastChangedTick )
 			m_nLastChangedTick = tickChanged;
@@ -462,16 +729,17 @@ void CNetworkStringTable::UpdateMirrorTable( int tick_ack  )
 
 	m_pMirrorTable->SetTick( m_nTickCount ); // use same tick
 
-	int count = m_pItems->Count();
+	const intp count = m_EntryTicks.Count();
+	const int *pEntryTicks = m_EntryTicks.Base();
 	
 	for ( int i = 0; i < count; i++ )
 	{
-		CNetworkStringTableItem *p = &m_pItems->Element( i );
-
 		// mirror is up to date
-		if ( p->GetTickChanged() <= tick_ack )
+		if ( pEntryTicks[ i ] <= tick_ack )
 			continue;
 
+		CNetworkStringTableItem *p = &m_pItems->Element( i );
+
 		const void *pUserData = p->GetUserData();
 
 		int nBytes = p->GetUserDataLength();
@@ -499,22 +767,24 @@ void CNetworkStringTable::UpdateMirrorTable( int tick_ack  )
 
 int CNetworkStringTable::WriteUpdate( CBaseClient *client, bf_write &buf, int tick_ack )
 {
-	CUtlVector< StringHistoryEntry > history;
+	CStringHistory history;
 
 	int entriesUpdated = 0;
 	int lastEntry = -1;
 	int nTableStartBit = buf.GetNumBitsWritten();
 
-	int count = m_pItems->Count();
+	// Scan the packed change ticks, most entries are unchanged for most clients
+	const intp count = m_EntryTicks.Count();
+	const int *pEntryTicks = m_EntryTicks.Base();
 
 	for ( int i = 0; i < count; i++ )
 	{
-		CNetworkStringTableItem *p = &m_pItems->Element( i );
-
 		// Client is up to date
-		if ( p->GetTickChanged() <= tick_ack )
+		if ( pEntryTicks[ i ] <= tick_ack )
 			continue;
 
+		CNetworkStringTableItem *p = &m_pItems->Element( i );
+
 		int nStartBit = buf.GetNumBitsWritten();
 
 		// Write Entry index
@@ -558,7 +828,7 @@ int CNetworkStringTable::WriteUpdate( CBaseClient *client, bf_write &buf, int ti
 
 		// Write the item's user data.
 		intp len;
-		const void *pUserData = GetStringUserData( i, &len );
+		const void *pUserData = p->GetUserData( &len );
 		if ( pUserData && len > 0 )
 		{
 			buf.WriteOneBit( 1 );
@@ -579,16 +849,8 @@ int CNetworkStringTable::WriteUpdate( CBaseClient *client, bf_write &buf, int ti
 			buf.WriteOneBit( 0 );
 		}
 
-		// limit string history to 32 entries
-		if ( history.Count() > 31 )
-		{
-			history.Remove( 0 );
-		}
-
-		// add string to string history
-		StringHistoryEntry she;
-		Q_strncpy( she.string, pEntry, sizeof( she.string ) );
-		history.AddToTail( she );
+		// add string to string history, keeps the last 32 entries
+		history.AddString( pEntry );
 
 		entriesUpdated++;
 		lastEntry = i;
@@ -613,7 +875,7 @@ void CNetworkStringTable::ParseUpdate( bf_read &buf, int entries )
 {
 	int lastEntry = -1;
 
-	CUtlVector< StringHistoryEntry > history;
+	CStringHistory history;
 
 	for (int i=0; i<entries; i++)
 	{
@@ -648,7 +910,7 @@ void CNetworkStringTable::ParseUpdate( bf_read &buf, int entries )
 					Host_Error( "Server sent bogus substring index %i for table %s\n",
 					            entryIndex, GetTableName() );
 				}
-				Q_strncpy( entry, history[ index ].string, Min( sizeof( entry ), (size_t)bytestocopy + 1 ) );
+				Q_strncpy( entry, history.String( index ), Min( sizeof( entry ), (size_t)bytestocopy + 1 ) );
 				buf.ReadString( substr );
 				Q_strncat( entry, substr, sizeof(entry), COPY_ALL_CHARACTERS );
 			}
@@ -715,14 +977,7 @@ void CNetworkStringTable::ParseUpdate( bf_read &buf, int entries )
 			AddString( true, pEntry, nBytes, pUserData );
 		}
 
-		if ( history.Count() > 31 )
-		{
-			history.Remove( 0 );
-		}
-
-		StringHistoryEntry she;
-		Q_strncpy( she.string, pEntry, sizeof( she.string ) );
-		history.AddToTail( she );
+		history.AddString( pEntry );
 	}
 }
 
@@ -749,16 +1004,17 @@ void CNetworkStringTable::TriggerCallbacks( int tick_ack )
 
 	COM_TimestampedLog( "Change(%s):Start", GetTableName() );
 
-	int count = m_pItems->Count();
+	const intp count = m_EntryTicks.Count();
+	const int *pEntryTicks = m_EntryTicks.Base();
 
 	for ( int i = 0; i < count; i++ )
 	{
-		CNetworkStringTableItem *pItem = &m_pItems->Element( i );
-
 		// mirror is up to date
-		if ( pItem->GetTickChanged() <= tick_ack )
+		if ( pEntryTicks[ i ] <= tick_ack )
 			continue;
 
+		CNetworkStringTableItem *pItem = &m_pItems->Element( i );
+
 		intp userDataSize;
 		const void *pUserData = pItem->GetUserData( &userDataSize );
 
@@ -873,9 +1129,12 @@ int CNetworkStringTable::AddString( bool bIsServer, const char *string, intp len
 			}
 		}
 
-		if ( bHasChanged && !m_bChangeHistoryEnabled )
+		if ( bHasChanged )
 		{
-			DataChanged( -i, item );
+			if ( !m_bChangeHistoryEnabled )
+				DataChanged( -i, item );
+			else
+				++m_nChangeSerial;	// DataChanged does it otherwise
 		}
 
 		// Negate i for returning to client
@@ -933,9 +1192,19 @@ int CNetworkStringTable::AddString( bool bIsServer, const char *string, intp len
 			}
 		}
 
-		if ( bHasChanged && !m_bChangeHistoryEnabled )
+		if ( i >= m_EntryTicks.Count() )
+		{
+			Assert( i == m_EntryTicks.Count() );
+			m_EntryTicks.EnsureCount( i + 1 );
+		}
+		m_EntryTicks[ i ] = item->GetTickChanged();
+
+		if ( bHasChanged )
 		{
-			DataChanged( i, item );
+			if ( !m_bChangeHistoryEnabled )
+				DataChanged( i, item );
+			else
+				++m_nChangeSerial;	// DataChanged does it otherwise
 		}
 	}
 
@@ -996,6 +1265,11 @@ void CNetworkStringTable::SetStringUserData( int stringNumber, intp length /*=0*
 
 	if ( p->SetUserData( m_nTickCount, length, userdata ) )
 	{
+		if ( dict == m_pItems )
+		{
+			m_EntryTicks[ stringNumber ] = p->GetTickChanged();
+		}
+
 		// Mark changed
 		DataChanged( saveStringNumber, p );
 	}
@@ -1014,6 +1288,7 @@ void CNetworkStringTable::DataChanged( int stringNumber, CNetworkStringTableItem
 
 	// Mark table as changed
 	m_nLastChangedTick = m_nTickCount;
+	++m_nChangeSerial;
 	
 	// Invoke callback if one was installed
 	
@@ -1037,9 +1312,9 @@ void CNetworkStringTable::WriteStringTable( bf_write& buf )
 	buf.WriteWord( numstrings );
 	for ( int i = 0 ; i < numstrings; i++ )
 	{
-		buf.WriteString( GetString( i ) );
+		buf.WriteString( m_pItems->String( i ) );
 		intp userDataSize;
-		const void *pUserData = GetStringUserData( i, &userDataSize );
+		const void *pUserData = m_pItems->Element( i ).GetUserData( &userDataSize );
 		if ( userDataSize > 0 )
 		{
 			buf.WriteOneBit( 1 );
@@ -1245,8 +1520,23 @@ bool CNetworkStringTable::WriteBaselines( SVC_CreateStringTable &msg, char *msg_
 	return entries == msg.m_nNumEntries;
 }
 
-#endif
+void CNetworkStringTable::SetBaselineCache( const bf_write &msg )
+{
+	m_nBaselineBits = msg.GetNumBitsWritten();
+	m_BaselineCache.SetCount( msg.GetNumBytesWritten() );
+	Q_memcpy( m_BaselineCache.Base(), msg.GetData(), m_BaselineCache.Count() );
 
+	m_nBaselineSerial = m_nChangeSerial;
+}
+
+bool CNetworkStringTable::WriteBaselineCache( bf_write &buf ) const
+{
+	Assert( HasBaselineCache() );
+
+	return buf.WriteBits( m_BaselineCache.Base(), m_nBaselineBits );
+}
+
+#endif
 
 //-----------------------------------------------------------------------------
 // Purpose: 
@@ -1397,58 +1687,73 @@ void CNetworkStringTableContainer::WriteBaselines( bf_write &buf )
 
 	SVC_CreateStringTable msg;
 
+	// Only allocated when some table changed since its baseline was encoded
 	constexpr intp msg_buffer_size = 2 * NET_MAX_PAYLOAD;
-	char *msg_buffer = new char[ msg_buffer_size ];
-	if ( !msg_buffer )
-	{
-		Host_Error( "Failed to allocate %llu bytes of memory in CNetworkStringTableContainer::WriteBaselines\n", (uint64)msg_buffer_size );
-	}
+	char *msg_buffer = nullptr;
+	byte *baseline_buffer = nullptr;
 
 	for ( int i = 0 ; i < m_Tables.Count() ; i++ )
 	{
 		CNetworkStringTable *table = (CNetworkStringTable*) GetTable( i );
 
-		int before = buf.GetNumBytesWritten();
-		if ( !table->WriteBaselines( msg, msg_buffer, msg_buffer_size ) )
+		if ( !table->HasBaselineCache() )
 		{
-			Host_Error( "Index error writing string table baseline %s\n", table->GetTableName() );
-		}
-
-		if ( msg.m_DataOut.IsOverflowed() )
-		{
-			Warning( "Warning:  Overflowed writing uncompressed string table data for %s\n", table->GetTableName() );
-		}
+			if ( !msg_buffer )
+			{
+				msg_buffer = new char[ msg_buffer_size ];
+				baseline_buffer = new byte[ NET_MAX_PAYLOAD ];
+			}
 
-		msg.m_bDataCompressed = false;
-		if ( msg.m_DataOut.GetNumBytesWritten() >= sv_compressstringtablebaselines_threshhold.GetInt() )
-		{
-			CFastTimer compressTimer;
-			compressTimer.Start();
+			if ( !table->WriteBaselines( msg, msg_buffer, msg_buffer_size ) )
+			{
+				Host_Error( "Index error writing string table baseline %s\n", table->GetTableName() );
+			}
 
-			// TERROR: bzip-compress the stringtable before adding it to the packet.  Yes, the whole packet will be bzip'd,
-			// but the uncompressed data also has to be under the NET_MAX_PAYLOAD limit.
-			unsigned int numBytes = msg.m_DataOut.GetNumBytesWritten();
-			unsigned int compressedSize = numBytes;
-			std::unique_ptr<char[]> compressedData = std::make_unique<char[]>(numBytes);
+			if ( msg.m_DataOut.IsOverflowed() )
+			{
+				Warning( "Warning:  Overflowed writing uncompressed string table data for %s\n", table->GetTableName() );
+			}
 
-			if ( COM_BufferToBufferCompress_Snappy( compressedData.get(), &compressedSize, (char *)msg.m_DataOut.GetData(), numBytes ) )
+			msg.m_bDataCompressed = false;
+			if ( msg.m_DataOut.GetNumBytesWritten() >= sv_compressstringtablebaselines_threshhold.GetInt() )
 			{
-				msg.m_bDataCompressed = true;
-				msg.m_DataOut.Reset();
-				msg.m_DataOut.WriteLong( numBytes );	// uncompressed size
-				msg.m_DataOut.WriteLong( compressedSize );	// compressed size
-				msg.m_DataOut.WriteBits( compressedData.get(), compressedSize * 8 );	// compressed data
+				CFastTimer compressTimer;
+				compressTimer.Start();
+
+				// TERROR: bzip-compress the stringtable before adding it to the packet.  Yes, the whole packet will be bzip'd,
+				// but the uncompressed data also has to be under the NET_MAX_PAYLOAD limit.
+				unsigned int numBytes = msg.m_DataOut.GetNumBytesWritten();
+				unsigned int compressedSize = numBytes;
+				std::unique_ptr<char[]> compressedData = std::make_unique<char[]>(numBytes);
 
-				// if ( compressstringtablbaselines > 1 )
+				if ( COM_BufferToBufferCompress_Snappy( compressedData.get(), &compressedSize, (char *)msg.m_DataOut.GetData(), numBytes ) )
 				{
-					compressTimer.End(); 
-					DevMsg( "Stringtable %s compression: %d -> %d bytes: %.2fms\n",
-							table->GetTableName(), numBytes, compressedSize, compressTimer.GetDuration().GetMillisecondsF() );
+					msg.m_bDataCompressed = true;
+					msg.m_DataOut.Reset();
+					msg.m_DataOut.WriteLong( numBytes );	// uncompressed size
+					msg.m_DataOut.WriteLong( compressedSize );	// compressed size
+					msg.m_DataOut.WriteBits( compressedData.get(), compressedSize * 8 );	// compressed data
+
+					// if ( compressstringtablbaselines > 1 )
+					{
+						compressTimer.End(); 
+						DevMsg( "Stringtable %s compression: %d -> %d bytes: %.2fms\n",
+								table->GetTableName(), numBytes, compressedSize, compressTimer.GetDuration().GetMillisecondsF() );
+					}
 				}
 			}
+
+			bf_write baseline( "CNetworkStringTableContainer::WriteBaselines", baseline_buffer, NET_MAX_PAYLOAD );
+			if ( !msg.WriteToBuffer( baseline ) )
+			{
+				Host_Error( "Overflow error writing string table baseline %s\n", table->GetTableName() );
+			}
+
+			table->SetBaselineCache( baseline );
 		}
 
-		if ( !msg.WriteToBuffer( buf ) )
+		int before = buf.GetNumBytesWritten();
+		if ( !table->WriteBaselineCache( buf ) )
 		{
 			Host_Error( "Overflow error writing string table baseline %s\n", table->GetTableName() );
 		}
@@ -1460,6 +1765,7 @@ void CNetworkStringTableContainer::WriteBaselines( bf_write &buf )
 		}
 	}
 
+	delete[] baseline_buffer;
 	delete[] msg_buffer;
 }
 
@@ -1488,13 +1794,13 @@ bool CNetworkStringTableContainer::ReadStringTables( bf_read& buf )
 		Assert( table );
 
 		// Now read the data for the table
-		if ( table && !table->ReadStringTable( buf ) )
+		if ( !table )
 		{
-			Host_Error( "Error reading string table %s\n", tablename );
+			Warning( "Could not find table \"%s\"\n", tablename );
 		}
-		else
+		else if ( !table->ReadStringTable( buf ) )
 		{
-			Warning( "Could not find table \"%s\"\n", tablename );
+			Host_Error( "Error reading string table %s\n", tablename );
 		}
 	}
 
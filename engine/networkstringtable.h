@@ -15,6 +15,7 @@
 
 #include "tier0/basetypes.h"
 #include "tier1/utldict.h"
+#include "tier1/utlvector.h"
 #include "tier1/utlbuffer.h"
 #include "tier1/bitbuf.h"
 
@@ -92,6 +93,11 @@ public:
 	bool			ReadStringTable( bf_read& buf );
 
 	bool			WriteBaselines( SVC_CreateStringTable &msg, char *msg_buffer, int msg_buffer_size );
+
+	// Encoded SVC_CreateStringTable baseline, reused until the table changes
+	bool			HasBaselineCache() const { return m_nBaselineSerial == m_nChangeSerial; }
+	void			SetBaselineCache( const bf_write &msg );
+	bool			WriteBaselineCache( bf_write &buf ) const;
 #endif
 
 	void			TriggerCallbacks( int tick_ack  );
@@ -120,6 +126,13 @@ protected:
 	int						m_nEntryBits;
 	int						m_nTickCount;
 	int						m_nLastChangedTick;
+	int						m_nChangeSerial;	// bumped on every content change
+
+#ifndef SHARED_NET_STRING_TABLES
+	int						m_nBaselineSerial;	// m_nChangeSerial m_BaselineCache was built at
+	intp					m_nBaselineBits;
+	CUtlVector<byte>		m_BaselineCache;
+#endif
 
 	bool					m_bChangeHistoryEnabled : 1;
 	bool					m_bLocked : 1;
@@ -140,6 +153,7 @@ protected:
 
 	INetworkStringDict		*m_pItems;
 	INetworkStringDict		*m_pItemsClientSide;	 // For m_bAllowClientSideAddString, these items are non-networked and are referenced by a negative string index!!!
+	CUtlVector<int>			m_EntryTicks;			// tick changed of each m_pItems entry, packed for the per client update scans
 };
 
 //-----------------------------------------------------------------------------
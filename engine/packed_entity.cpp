@@ -13,6 +13,7 @@
 #include "dt_send.h"
 #include "dt_send_eng.h"
 #include "server_class.h"
+#include "sv_snapshotarena.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -33,6 +34,8 @@ PackedEntity::PackedEntity()
 	m_pData = nullptr;
 	m_nBits = -1;
 	m_pChangeFrameList = nullptr;
+	m_bClientSpecificRecipients = false;
+	m_bArenaData = false;
 
 	m_nSnapshotCreationTick = 0;
 	m_nShouldCheckCreationTick = 0;
@@ -50,14 +53,47 @@ PackedEntity::~PackedEntity()
 }
 
 
-bool PackedEntity::AllocAndCopyPadded( const void *pData, intp size )
+void PackedEntity::FreeData()
+{
+	if ( m_pData )
+	{
+		if ( m_bArenaData )
+		{
+			g_SnapshotArena.Free( m_pData );
+		}
+		else
+		{
+			free(m_pData);
+		}
+
+		m_pData = NULL;
+		m_bArenaData = false;
+	}
+}
+
+void PackedEntity::RelocateData( void *pData )
+{
+	Assert( m_bArenaData );
+	m_pData = pData;
+}
+
+bool PackedEntity::AllocAndCopyPadded( const void *pData, intp size, bool bUseSnapshotArena )
 {
 	FreeData();
 	
 	intp nBytes = PAD_NUMBER( size, 4 );
 
 	// allocate the memory
-	m_pData = malloc( nBytes );
+	if ( bUseSnapshotArena )
+	{
+		m_pData = g_SnapshotArena.AllocPackedData( this, nBytes );
+		m_bArenaData = m_pData != NULL;
+	}
+
+	if ( !m_pData )
+	{
+		m_pData = malloc( nBytes );
+	}
 
 	if ( !m_pData )
 	{
@@ -101,6 +137,18 @@ int PackedEntity::GetNumRecipients() const
 void PackedEntity::SetRecipients( const CUtlMemory<CSendProxyRecipients> &recipients )
 {
 	m_Recipients.CopyArray( recipients.Base(), recipients.Count() );
+
+	m_bClientSpecificRecipients = false;
+	for ( const auto &r : m_Recipients )
+	{
+		// IsAllSet() touches the unused tail bits, so test a copy to keep CompareRecipients exact.
+		CBitVec< ABSOLUTE_PLAYER_LIMIT > bits = r.m_Bits;
+		if ( !bits.IsAllSet() )
+		{
+			m_bClientSpecificRecipients = true;
+			break;
+		}
+	}
 }
 
 
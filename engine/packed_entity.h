@@ -74,8 +74,11 @@ public:
 	void		FreeData();
 
 	// Copy the data into the PackedEntity's data and make sure the # bytes allocated is
-	// an integer multiple of 4.
-	bool		AllocAndCopyPadded( const void *pData, intp size );
+	// an integer multiple of 4. The server allocates from g_SnapshotArena when enabled.
+	bool		AllocAndCopyPadded( const void *pData, intp size, bool bUseSnapshotArena = false );
+
+	// Called by the snapshot arena after it moved the data.
+	void		RelocateData( void *pData );
 
 	// These are like Get/Set, except SnagChangeFrameList clears out the
 	// PackedEntity's pointer since the usage model in sv_main is to keep
@@ -97,6 +100,9 @@ public:
 	void				SetRecipients( const CUtlMemory<CSendProxyRecipients> &recipients );
 	bool				CompareRecipients( const CUtlMemory<CSendProxyRecipients> &recipients );
 
+	// True if any datatable proxy excluded some client, so the props sent depend on who receives them.
+	bool				HasClientSpecificRecipients() const;
+
 	void				SetSnapshotCreationTick( int nTick );
 	int					GetSnapshotCreationTick() const;
 
@@ -120,6 +126,8 @@ private:
 	void				*m_pData;				// Packed data.
 	int					m_nBits;				// Number of bits used to encode.
 	IChangeFrameList	*m_pChangeFrameList;	// Only the most current 
+	bool				m_bClientSpecificRecipients;
+	bool				m_bArenaData;			// m_pData is a g_SnapshotArena block
 
 	// This is the tick this PackedEntity was created on
 	unsigned int		m_nSnapshotCreationTick : 31;
@@ -159,15 +167,6 @@ inline void* PackedEntity::GetData()
 	return m_pData;
 }
 
-inline void PackedEntity::FreeData()
-{
-	if ( m_pData )
-	{
-		free(m_pData);
-		m_pData = NULL;
-	}
-}
-
 inline void PackedEntity::SetChangeFrameList( IChangeFrameList *pList )
 {
 	Assert( !m_pChangeFrameList );
@@ -186,6 +185,11 @@ inline IChangeFrameList* PackedEntity::SnagChangeFrameList()
 	return pRet;
 }
 
+inline bool PackedEntity::HasClientSpecificRecipients() const
+{
+	return m_bClientSpecificRecipients;
+}
+
 inline void PackedEntity::SetSnapshotCreationTick( int nTick )
 {
 	m_nSnapshotCreationTick = (unsigned int)nTick;
@@ -19,6 +19,7 @@
 #include "ispatialpartition.h"
 #include "utllinkedlist.h"
 #include "framesnapshot.h"
+#include "sv_clusterindex.h"
 #include "sv_log.h"
 #include "tier1/utlmap.h"
 #include "tier1/utlvector.h"
@@ -308,6 +309,8 @@ void ED_Free (edict_t *ed)
 	ed->SetFree();
 	ed->freetime = sv.GetTime();
 
+	g_EntityClusterIndex.Remove( ed->m_EdictIndex );
+
 	++sv.free_edicts;
 	Assert( !g_FreeEdicts.IsBitSet( ed->m_EdictIndex ) );
 	g_FreeEdicts.Set( ed->m_EdictIndex );
@@ -112,7 +112,7 @@ void CReplayDemoRecorder::StartRecording( const char *pFilename, bool bContinuou
 	Q_memset( dh, 0, sizeof(demoheader_t) );
 
 	Q_strncpy( dh->demofilestamp, DEMO_HEADER_ID, sizeof(dh->demofilestamp) );
-	dh->demoprotocol = DEMO_PROTOCOL;
+	dh->demoprotocol = DEMO_PROTOCOL_LINEAR;
 	dh->networkprotocol = PROTOCOL_VERSION;
 
 	Q_strncpy( dh->mapname, m_pReplayServer->GetMapName(), sizeof( dh->mapname ) );
@@ -114,6 +114,7 @@ public:
 
 	bf_write			m_FullSendTables;
 	CUtlMemory<byte>	m_FullSendTablesBuffer;
+	CNetSharedData		m_SharedSendTables;	// m_FullSendTables compressed once for all clients
 
 	bool		m_bLoadedPlugins;
 
@@ -31,11 +31,13 @@
 #include "tier2/renderutils.h"
 #include "bitvec.h"
 #include "tier1/mempool.h"
+#include <atomic>
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 class CVoxelTree;
+class CGridTree;
 class CIntersectSweptBox;
 
 #define SPHASH_LEVEL_SKIP	2
@@ -218,11 +220,41 @@ private:
 
 class CSpatialPartition;
 
+//-----------------------------------------------------------------------------
+// What the spatial partition needs from one of its trees
+//-----------------------------------------------------------------------------
+abstract_class IPartitionTree
+{
+public:
+	virtual ~IPartitionTree() = default;
+
+	virtual void Init( CSpatialPartition *pOwner, int iTree, const Vector& worldmin, const Vector& worldmax ) = 0;
+	virtual void Shutdown( void ) = 0;
+
+	virtual void InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs ) = 0;
+	virtual void RemoveFromTree( SpatialPartitionHandle_t hPartition ) = 0;
+
+	virtual void ElementMoved( SpatialPartitionHandle_t handle, const Vector& mins, const Vector& maxs ) = 0;
+	virtual void EnumerateElementsInBox( SpatialPartitionListMask_t listMask, const Vector& mins, const Vector& maxs, bool coarseTest, IPartitionEnumerator* pIterator ) = 0;
+	virtual void EnumerateElementsInSphere( SpatialPartitionListMask_t listMask, const Vector& origin, float radius, bool coarseTest, IPartitionEnumerator* pIterator ) = 0;
+	virtual void EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask, const Ray_t& ray, bool coarseTest, IPartitionEnumerator* pIterator ) = 0;
+	virtual void EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask, const Vector& pt, bool coarseTest, IPartitionEnumerator* pIterator ) = 0;
+
+	// Called once a frame, when no query is running on another thread
+	virtual void FrameUpdate() = 0;
+
+	virtual void RenderAllObjectsInTree( float flTime ) = 0;
+	virtual void RenderObjectsInPlayerLeafs( const Vector &vecPlayerMin, const Vector &vecPlayerMax, float flTime ) = 0;
+
+	virtual void ReportStats( const char *pFileName ) = 0;
+	virtual void DrawDebugOverlays() = 0;
+};
+
 //-----------------------------------------------------------------------------
 // 
 //-----------------------------------------------------------------------------
 
-class CVoxelTree
+class CVoxelTree : public IPartitionTree
 {
 public:
 	// constructor, destructor
@@ -241,6 +273,8 @@ public:
 	virtual void RenderAllObjectsInTree( float flTime );
 	virtual void RenderObjectsInPlayerLeafs( const Vector &vecPlayerMin, const Vector &vecPlayerMax, float flTime );
 
+	virtual void FrameUpdate()	{ }
+
 	virtual void ReportStats( const char *pFileName );
 	virtual void DrawDebugOverlays();
 
@@ -254,13 +288,13 @@ public:
 	void EndVisit( CPartitionVisits * );
 
 	// Shut down the allocated memory
-	void Shutdown( void );
+	virtual void Shutdown( void );
 
 	// Insert into the appropriate tree
-	void InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs );
+	virtual void InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs );
 
 	// Remove from appropriate tree
-	void RemoveFromTree( SpatialPartitionHandle_t hPartition );
+	virtual void RemoveFromTree( SpatialPartitionHandle_t hPartition );
 
 	void LockForWrite()		{ m_lock.LockForWrite(); }
 	void UnlockWrite()		{ m_lock.UnlockWrite(); }
@@ -294,6 +328,158 @@ private:
 	CThreadSpinRWLock					m_lock;
 };
 
+//-----------------------------------------------------------------------------
+// Hashed grid tree. Elements live in the sparse cells of one of two grid
+// levels (or in the overflow list when they are bigger than a coarse cell),
+// and every cell holds an immutable array of its elements. Writers queue
+// updates and publish them in batches by swapping in new cell arrays, so
+// queries never take a lock. Retired arrays are freed a frame later.
+//
+// A thread sees its own updates on its next query that overlaps a coarse
+// cell they touched, other threads see the last published batch. Removals
+// are published right away since the handle may be reused before the batch
+// goes out.
+//-----------------------------------------------------------------------------
+#define SPGRID_LEVEL_COUNT		2
+#define SPGRID_CELL_SHIFT		SPHASH_VOXEL_SHIFT	// fine cells are as big as level 0 voxels
+#define SPGRID_LEVEL_SHIFT		3					// a coarse cell is 8x8x8 fine cells
+#define SPGRID_OVERFLOW_LEVEL	SPGRID_LEVEL_COUNT
+#define SPGRID_OVERFLOW_CELL	0xffffffff
+#define SPGRID_TABLE_SIZE		1024				// initial cell slots, must be power of 2
+#define SPGRID_DIRTY_LEVEL		( SPGRID_LEVEL_COUNT - 1 )	// queued updates are tracked per coarse cell
+#define SPGRID_DIRTY_CELLS		( COORD_EXTENT >> ( SPGRID_CELL_SHIFT + SPGRID_LEVEL_SHIFT * SPGRID_DIRTY_LEVEL ) )
+#define SPGRID_DIRTY_WORDS		( ( SPGRID_DIRTY_CELLS * SPGRID_DIRTY_CELLS * SPGRID_DIRTY_CELLS + 31 ) / 32 )
+
+struct GridEntry_t
+{
+	Vector						m_vecMin;			// Bloated bounds
+	Vector						m_vecMax;
+	IHandleEntity *				m_pHandleEntity;
+	SpatialPartitionHandle_t	m_hPartition;
+	unsigned short				m_nCellMin[3];		// Cells covered at the element's level
+	unsigned short				m_nCellMax[3];
+};
+
+// One published version of a cell.
+struct GridCell_t
+{
+	int							m_nCount;
+	GridEntry_t					m_Entries[1];
+};
+
+struct GridSlot_t
+{
+	std::atomic<uint32>			m_nKey;				// Cell key + 1, 0 if the slot is free
+	std::atomic<GridCell_t *>	m_pCell;
+};
+
+// Open addressing cell hash. Slots are never freed, the table is replaced when it grows.
+struct GridCellTable_t
+{
+	uint32						m_nMask;
+	uint32						m_nCount;			// Used slots
+	GridSlot_t					m_Slots[1];
+};
+
+class CGridTree : public IPartitionTree
+{
+public:
+	CGridTree();
+	virtual ~CGridTree();
+
+	virtual void Init( CSpatialPartition *pOwner, int iTree, const Vector& worldmin, const Vector& worldmax );
+	virtual void Shutdown( void );
+
+	virtual void InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs );
+	virtual void RemoveFromTree( SpatialPartitionHandle_t hPartition );
+
+	virtual void ElementMoved( SpatialPartitionHandle_t handle, const Vector& mins, const Vector& maxs );
+	virtual void EnumerateElementsInBox( SpatialPartitionListMask_t listMask, const Vector& mins, const Vector& maxs, bool coarseTest, IPartitionEnumerator* pIterator );
+	virtual void EnumerateElementsInSphere( SpatialPartitionListMask_t listMask, const Vector& origin, float radius, bool coarseTest, IPartitionEnumerator* pIterator );
+	virtual void EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask, const Ray_t& ray, bool coarseTest, IPartitionEnumerator* pIterator );
+	virtual void EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask, const Vector& pt, bool coarseTest, IPartitionEnumerator* pIterator );
+
+	virtual void FrameUpdate();
+
+	virtual void RenderAllObjectsInTree( float flTime );
+	virtual void RenderObjectsInPlayerLeafs( const Vector &vecPlayerMin, const Vector &vecPlayerMax, float flTime );
+
+	virtual void ReportStats( const char *pFileName );
+	virtual void DrawDebugOverlays();
+
+	EntityInfo_t &EntityInfo( SpatialPartitionHandle_t hPartition );
+
+private:
+	// Writer side state of an element
+	struct GridElement_t
+	{
+		Vector				m_vecMin;			// Latest bloated bounds
+		Vector				m_vecMax;
+		unsigned short		m_nCellMin[3];		// Published cells
+		unsigned short		m_nCellMax[3];
+		int8				m_nLevel;			// Published level, -1 if not in the grid
+		bool				m_bInTree;			// Latest state
+		bool				m_bPending;			// Queued in m_Pending
+	};
+
+	struct Edit_t
+	{
+		uint32						m_nCell;
+		SpatialPartitionHandle_t	m_hPartition;
+		bool						m_bAdd;
+	};
+
+	static int CellFromCoord( float flCoord, int nLevel );
+	static int CellCount( int nLevel );
+	static uint32 PackCell( int iX, int iY, int iZ, int nLevel );
+	static void CellRange( const Vector &vecMin, const Vector &vecMax, int nLevel, int nCellMin[3], int nCellMax[3] );
+	static uint32 HashCell( uint32 nCell );
+	static const GridCell_t *FindCell( const GridCellTable_t *pTable, uint32 nCell );
+	static GridCellTable_t *AllocTable( uint32 nSize );
+
+	// Writer side, m_WriteMutex must be held
+	GridElement_t &Element( SpatialPartitionHandle_t hPartition );
+	void QueueUpdate( SpatialPartitionHandle_t hPartition );
+	void Flush();
+	void AddEdits( SpatialPartitionHandle_t hPartition, const GridElement_t &element, bool bAdd );
+	void ApplyEdits( const Edit_t *pEdits, int nEdits );
+	void PublishCell( uint32 nCell, GridCell_t *pCell );
+	void Retire( void *pMemory );
+	void FreeAll();
+	void MarkDirty( const Vector &vecMin, const Vector &vecMax );
+	void ClearDirty();
+
+	// Publishes the queued updates when this thread queued some of them and
+	// the query overlaps a dirty cell, so it reads its own writes
+	bool IsDirty( const Vector &vecMin, const Vector &vecMax ) const;
+	void FlushOwnUpdates( const Vector &vecMin, const Vector &vecMax );
+
+	// Reader side, never blocks
+	template <class T> bool EnumerateCells( const GridCellTable_t *pTable, int nLevel, const int nMin[3], const int nMax[3], const int *pSkipMin, const int *pSkipMax,
+		const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator *pIterator );
+	template <class T> bool EnumerateOverflow( const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator *pIterator );
+	template <class T> bool EnumerateAlongRay( const GridCellTable_t *pTable, int nLevel, const Ray_t &ray, const Vector &vecEnd, const Vector &vecInvDelta,
+		const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator *pIterator );
+	template <class T> bool EnumerateElement( const GridEntry_t &entry, const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator *pIterator );
+
+	void RenderEntry( const GridEntry_t &entry, int nLevel, float flTime );
+
+	CSpatialPartition *						m_pOwner;
+	int										m_TreeId;
+
+	std::atomic<GridCellTable_t *>			m_pCells;
+	std::atomic<GridCell_t *>				m_pOverflow;
+
+	CThreadFastMutex						m_WriteMutex;
+	CUtlVector<GridElement_t>				m_Elements;			// Indexed by handle
+	CUtlVector<SpatialPartitionHandle_t>	m_Pending;
+	CUtlVector<Edit_t>						m_Edits;
+	CUtlVector<void *>						m_Retired[2];		// Retired this frame, the frame before
+	std::atomic<int>						m_nFlushSerial;
+	CThreadLocalInt<int>					m_nQueuedSerial;	// m_nFlushSerial when this thread last queued an update
+	std::atomic<uint32>						m_nDirty[SPGRID_DIRTY_WORDS];	// Coarse cells touched by queued updates, one bit each
+};
+
 //-----------------------------------------------------------------------------
 // The spatial partition
 //-----------------------------------------------------------------------------
@@ -311,6 +497,7 @@ public:
 
 	// Inherited from ISpatialPartition
 	virtual void Init( const Vector& worldmin, const Vector& worldmax );
+	void Init( const Vector& worldmin, const Vector& worldmax, bool bGrid );
 	void Shutdown( void );
 
 	virtual SpatialPartitionHandle_t CreateHandle( IHandleEntity *pHandleEntity );
@@ -355,6 +542,7 @@ public:
 	virtual void RenderObjectsInPlayerLeafs( const Vector &vecPlayerMin, const Vector &vecPlayerMax, float flTime );
 	virtual void ReportStats( const char *pFileName );
 	virtual void DrawDebugOverlays();
+	virtual void FrameUpdate();
 
 	// Gets entity info (for enumerations).
 	EntityInfo_t &EntityInfo( SpatialPartitionHandle_t hPartition );
@@ -362,8 +550,8 @@ public:
 	virtual void InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs );
 	virtual void RemoveFromTree( SpatialPartitionHandle_t hPartition );
 
-	CVoxelTree * VoxelTree( SpatialPartitionListMask_t listMask );
-	CVoxelTree * VoxelTreeForHandle( SpatialPartitionHandle_t handle );
+	IPartitionTree * Tree( SpatialPartitionListMask_t listMask );
+	IPartitionTree * TreeForHandle( SpatialPartitionHandle_t handle );
 
 protected:
 	// Invokes the pre-query callbacks.
@@ -376,6 +564,8 @@ private:
 	CThreadFastMutex										m_HandlesMutex;
 
 	CVoxelTree												m_VoxelTrees[NUM_TREES];
+	CGridTree												m_GridTrees[NUM_TREES];
+	IPartitionTree											*m_pTrees[NUM_TREES];		// Backend picked by spatialpartition_grid at Init
 
 	IPartitionQueryCallback									*m_pQueryCallback[MAX_QUERY_CALLBACK];		// Query callbacks.
 	bool													m_bUseOldQueryCallback[MAX_QUERY_CALLBACK];
@@ -429,15 +619,20 @@ inline void CVoxelTree::EndVisit( CPartitionVisits *pPrev )
 	m_pVisits = pPrev;
 }
 
-inline CVoxelTree *CSpatialPartition::VoxelTree( SpatialPartitionListMask_t listMask )
+inline EntityInfo_t &CGridTree::EntityInfo( SpatialPartitionHandle_t hPartition )
+{
+	return m_pOwner->EntityInfo( hPartition );
+}
+
+inline IPartitionTree *CSpatialPartition::Tree( SpatialPartitionListMask_t listMask )
 {
 	int iTree = ( ( listMask & PARTITION_ALL_CLIENT_EDICTS ) == 0 ) ? SERVER_TREE : CLIENT_TREE;
-	return &m_VoxelTrees[iTree];
+	return m_pTrees[iTree];
 }
 
-inline CVoxelTree *CSpatialPartition::VoxelTreeForHandle( SpatialPartitionHandle_t handle )
+inline IPartitionTree *CSpatialPartition::TreeForHandle( SpatialPartitionHandle_t handle )
 {
-	return VoxelTree( m_aHandles[handle].m_fList );
+	return Tree( m_aHandles[handle].m_fList );
 }
 
 
@@ -2394,187 +2589,1138 @@ void CVoxelTree::RenderObjectsInPlayerLeafs( const Vector &vecPlayerMin, const V
 
 
 //-----------------------------------------------------------------------------
-// Expose CSpatialPartition to the game + client DLL.
+// Grid tree
 //-----------------------------------------------------------------------------
-static CSpatialPartition	g_SpatialPartition;
-EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CSpatialPartition, ISpatialPartition, INTERFACEVERSION_SPATIALPARTITION, g_SpatialPartition );
+CGridTree::CGridTree() : m_pOwner( NULL ), m_TreeId( -1 ), m_pCells( NULL ), m_pOverflow( NULL ), m_nFlushSerial( 1 )
+{
+	ClearDirty();
+}
 
-//-----------------------------------------------------------------------------
-// Expose ISpatialPartitionInternal to the engine.
-//-----------------------------------------------------------------------------
-ISpatialPartitionInternal *SpatialPartition()
+CGridTree::~CGridTree()
 {
-	return &g_SpatialPartition;
+	FreeAll();
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Constructor
+// Cell math. Cells are counted from MIN_COORD_FLOAT and clamped to the world.
 //-----------------------------------------------------------------------------
-CSpatialPartition::CSpatialPartition()
+inline int CGridTree::CellCount( int nLevel )
 {
-	memset(m_pQueryCallback, 0, sizeof(m_pQueryCallback));
-	memset(m_bUseOldQueryCallback, 0, sizeof(m_bUseOldQueryCallback));
-	m_nQueryCallbackCount = 0;
-	m_nSuppressedListMask = 0;
+	return COORD_EXTENT >> ( SPGRID_CELL_SHIFT + SPGRID_LEVEL_SHIFT * nLevel );
 }
 
-
-CSpatialPartition::~CSpatialPartition()
+inline int CGridTree::CellFromCoord( float flCoord, int nLevel )
 {
-	Shutdown();
+	int nCell = static_cast<int>( flCoord - MIN_COORD_FLOAT ) >> ( SPGRID_CELL_SHIFT + SPGRID_LEVEL_SHIFT * nLevel );
+	return clamp( nCell, 0, CellCount( nLevel ) - 1 );
 }
 
-//-----------------------------------------------------------------------------
-// Purpose:
-//   Input: worldmin - 
-//          worldmax - 
-//-----------------------------------------------------------------------------
-void CSpatialPartition::Init( const Vector &worldmin, const Vector &worldmax )
+inline uint32 CGridTree::PackCell( int iX, int iY, int iZ, int nLevel )
 {
-	// Clear the handle list and ensure some new memory.
-	m_aHandles.Purge();
-	m_aHandles.EnsureCapacity( SPHASH_HANDLELIST_BLOCK );
+	return static_cast<uint32>( iX ) | ( static_cast<uint32>( iY ) << 10 ) | ( static_cast<uint32>( iZ ) << 20 ) | ( static_cast<uint32>( nLevel ) << 30 );
+}
 
-	for ( int i = 0; i < NUM_TREES; i++ )
+inline void CGridTree::CellRange( const Vector &vecMin, const Vector &vecMax, int nLevel, int nCellMin[3], int nCellMax[3] )
+{
+	for ( int i = 0; i < 3; ++i )
 	{
-		m_VoxelTrees[i].Init( this, i, worldmin, worldmax );
+		nCellMin[i] = CellFromCoord( vecMin[i], nLevel );
+		nCellMax[i] = CellFromCoord( vecMax[i], nLevel );
 	}
 }
 
+inline uint32 CGridTree::HashCell( uint32 nCell )
+{
+	uint32 nHash = nCell * 0x9e3779b1;
+	return nHash ^ ( nHash >> 15 );
+}
+
+
 //-----------------------------------------------------------------------------
-// Purpose:
+// Finds the published version of a cell, NULL if the cell is empty
 //-----------------------------------------------------------------------------
-void CSpatialPartition::Shutdown( void )
+const GridCell_t *CGridTree::FindCell( const GridCellTable_t *pTable, uint32 nCell )
 {
-	for ( int i = 0; i < NUM_TREES; i++ )
+	for ( uint32 i = HashCell( nCell ) & pTable->m_nMask; ; i = ( i + 1 ) & pTable->m_nMask )
 	{
-		m_VoxelTrees[i].Shutdown();
+		uint32 nKey = pTable->m_Slots[i].m_nKey.load( std::memory_order_acquire );
+		if ( nKey == 0 )
+			return NULL;
+
+		if ( nKey == nCell + 1 )
+			return pTable->m_Slots[i].m_pCell.load( std::memory_order_acquire );
 	}
-	m_aHandles.Purge();
+}
+
+GridCellTable_t *CGridTree::AllocTable( uint32 nSize )
+{
+	Assert( IsPowerOfTwo( nSize ) );
+	GridCellTable_t *pTable = static_cast<GridCellTable_t *>( malloc( sizeof( GridCellTable_t ) + ( nSize - 1 ) * sizeof( GridSlot_t ) ) );
+	memset( pTable, 0, sizeof( GridCellTable_t ) + ( nSize - 1 ) * sizeof( GridSlot_t ) );
+	pTable->m_nMask = nSize - 1;
+	return pTable;
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Add a callback to the query callback list.  Functions get called 
-//          right before a query occurs.
-//   Input: pCallback - pointer to the callback function to add
+// Init, shutdown
 //-----------------------------------------------------------------------------
-void CSpatialPartition::InstallQueryCallback( IPartitionQueryCallback *pCallback )
+void CGridTree::Init( CSpatialPartition *pOwner, int iTree, const Vector &worldmin, const Vector &worldmax )
 {
-	// Verify data.
-	Assert( pCallback && m_nQueryCallbackCount < MAX_QUERY_CALLBACK );
-	if ( !pCallback || ( m_nQueryCallbackCount >= MAX_QUERY_CALLBACK ) )
-		return;
+	FreeAll();
 
-	m_pQueryCallback[m_nQueryCallbackCount] = pCallback;
-	m_bUseOldQueryCallback[m_nQueryCallbackCount] = false;
-	++m_nQueryCallbackCount;
+	m_pOwner = pOwner;
+	m_TreeId = iTree;
+	m_pCells.store( AllocTable( SPGRID_TABLE_SIZE ), std::memory_order_release );
+}
+
+void CGridTree::Shutdown( void )
+{
+	FreeAll();
+}
+
+void CGridTree::FreeAll()
+{
+	// Nobody may be enumerating, everything goes.
+	GridCellTable_t *pTable = m_pCells.exchange( NULL );
+	if ( pTable )
+	{
+		for ( uint32 i = 0; i <= pTable->m_nMask; ++i )
+		{
+			free( pTable->m_Slots[i].m_pCell.load() );
+		}
+		free( pTable );
+	}
+	free( m_pOverflow.exchange( NULL ) );
+
+	for ( auto &retired : m_Retired )
+	{
+		for ( void *pMemory : retired )
+		{
+			free( pMemory );
+		}
+		retired.Purge();
+	}
+
+	m_Elements.Purge();
+	m_Pending.Purge();
+	m_Edits.Purge();
+	ClearDirty();
 }
 
+
 //-----------------------------------------------------------------------------
-// Purpose: Add a callback to the query callback list.  Functions get called 
-//          right before a query occurs.
-//   Input: pCallback - pointer to the callback function to add
+// Writer side
 //-----------------------------------------------------------------------------
-void CSpatialPartition::InstallQueryCallback_V1( IPartitionQueryCallback *pCallback )
+CGridTree::GridElement_t &CGridTree::Element( SpatialPartitionHandle_t hPartition )
 {
-	// Verify data.
-	Assert( pCallback && m_nQueryCallbackCount < MAX_QUERY_CALLBACK );
-	if ( !pCallback || ( m_nQueryCallbackCount >= MAX_QUERY_CALLBACK ) )
+	Assert( hPartition != PARTITION_INVALID_HANDLE );
+	while ( m_Elements.Count() <= hPartition )
+	{
+		GridElement_t &element = m_Elements[m_Elements.AddToTail()];
+		element.m_nLevel = -1;
+		element.m_bInTree = false;
+		element.m_bPending = false;
+	}
+	return m_Elements[hPartition];
+}
+
+void CGridTree::QueueUpdate( SpatialPartitionHandle_t hPartition )
+{
+	GridElement_t &element = m_Elements[hPartition];
+	if ( !element.m_bPending )
+	{
+		element.m_bPending = true;
+		m_Pending.AddToTail( hPartition );
+	}
+	m_nQueuedSerial = m_nFlushSerial.load( std::memory_order_relaxed );
+}
+
+void CGridTree::InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs )
+{
+	ElementMoved( hPartition, mins, maxs );
+}
+
+void CGridTree::RemoveFromTree( SpatialPartitionHandle_t hPartition )
+{
+	AUTO_LOCK( m_WriteMutex );
+
+	if ( hPartition >= m_Elements.Count() )
 		return;
 
-	// NOTE: the query callbacks are not mutexed. Only add and remove when threads are joined
+	GridElement_t &element = m_Elements[hPartition];
+	if ( !element.m_bInTree && !element.m_bPending )
+		return;
 
-	m_pQueryCallback[m_nQueryCallbackCount] = pCallback;
-	m_bUseOldQueryCallback[m_nQueryCallbackCount] = true;
-	++m_nQueryCallbackCount;
+	element.m_bInTree = false;
+	QueueUpdate( hPartition );
+	Flush();
 }
 
+void CGridTree::ElementMoved( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs )
+{
+	if ( hPartition == PARTITION_INVALID_HANDLE )
+		return;
 
-//-----------------------------------------------------------------------------
-// Purpose: Remove a callback from the query callback list.
-//   Input: pCallback - pointer to the callback function to remove
-//-----------------------------------------------------------------------------
-void CSpatialPartition::RemoveQueryCallback( IPartitionQueryCallback *pCallback )
+	// Bloat by an eps, the same as the voxel tree.
+	Vector vecMin( mins.x - SPHASH_EPS, mins.y - SPHASH_EPS, mins.z - SPHASH_EPS );
+	Vector vecMax( maxs.x + SPHASH_EPS, maxs.y + SPHASH_EPS, maxs.z + SPHASH_EPS );
+	ClampVector( vecMin, s_PartitionMin, s_PartitionMax );
+	ClampVector( vecMax, s_PartitionMin, s_PartitionMax );
+
+	AUTO_LOCK( m_WriteMutex );
+
+	GridElement_t &element = Element( hPartition );
+	if ( element.m_bInTree && ( element.m_vecMin == vecMin ) && ( element.m_vecMax == vecMax ) )
+		return;
+
+	// Both where the element is published and where it is going are stale until the flush.
+	if ( element.m_bInTree )
+	{
+		MarkDirty( element.m_vecMin, element.m_vecMax );
+	}
+	MarkDirty( vecMin, vecMax );
+
+	element.m_vecMin = vecMin;
+	element.m_vecMax = vecMax;
+	element.m_bInTree = true;
+	QueueUpdate( hPartition );
+}
+
+void CGridTree::AddEdits( SpatialPartitionHandle_t hPartition, const GridElement_t &element, bool bAdd )
 {
-	// Verify data.
-	if ( !pCallback )
+	if ( element.m_nLevel == SPGRID_OVERFLOW_LEVEL )
+	{
+		Edit_t &edit = m_Edits[m_Edits.AddToTail()];
+		edit.m_nCell = SPGRID_OVERFLOW_CELL;
+		edit.m_hPartition = hPartition;
+		edit.m_bAdd = bAdd;
 		return;
+	}
 
-	for ( int iQuery = m_nQueryCallbackCount; --iQuery >= 0;  )
+	for ( int iX = element.m_nCellMin[0]; iX <= element.m_nCellMax[0]; ++iX )
 	{
-		if ( m_pQueryCallback[iQuery] == pCallback )
+		for ( int iY = element.m_nCellMin[1]; iY <= element.m_nCellMax[1]; ++iY )
 		{
-			--m_nQueryCallbackCount;
-			m_pQueryCallback[iQuery] = m_pQueryCallback[m_nQueryCallbackCount];
-			return;
+			for ( int iZ = element.m_nCellMin[2]; iZ <= element.m_nCellMax[2]; ++iZ )
+			{
+				Edit_t &edit = m_Edits[m_Edits.AddToTail()];
+				edit.m_nCell = PackCell( iX, iY, iZ, element.m_nLevel );
+				edit.m_hPartition = hPartition;
+				edit.m_bAdd = bAdd;
+			}
 		}
 	}
 }
 
-
 //-----------------------------------------------------------------------------
-// Purpose: Invokes the pre-query callbacks.
+// Publishes all queued updates. Every touched cell gets one new version.
 //-----------------------------------------------------------------------------
-void CSpatialPartition::InvokeQueryCallbacks( SpatialPartitionListMask_t listMask, bool bDone )
+void CGridTree::Flush()
 {
-	for ( int iQuery = 0; iQuery < m_nQueryCallbackCount; ++iQuery )
+	if ( m_Pending.IsEmpty() )
+		return;
+
+	m_Edits.RemoveAll();
+	for ( SpatialPartitionHandle_t hPartition : m_Pending )
 	{
-		if ( !bDone )
+		GridElement_t &element = m_Elements[hPartition];
+		element.m_bPending = false;
+
+		if ( element.m_nLevel >= 0 )
 		{
-			if ( m_bUseOldQueryCallback[iQuery] )
-			{
-				m_pQueryCallback[iQuery]->OnPreQuery_V1();
-			}
-			else
-			{
-				m_pQueryCallback[iQuery]->OnPreQuery( listMask );
-			}
+			AddEdits( hPartition, element, false );
+			element.m_nLevel = -1;
 		}
-		else
+
+		if ( !element.m_bInTree )
+			continue;
+
+		// Smallest level whose cells are bigger than the element, so it touches at most 2 cells a side.
+		Vector vecSize;
+		VectorSubtract( element.m_vecMax, element.m_vecMin, vecSize );
+		int nLevel;
+		for ( nLevel = 0; nLevel < SPGRID_LEVEL_COUNT; ++nLevel )
 		{
-			if ( !m_bUseOldQueryCallback[iQuery] )
+			float flCellSize = 1 << ( SPGRID_CELL_SHIFT + SPGRID_LEVEL_SHIFT * nLevel );
+			if ( ( vecSize.x < flCellSize ) && ( vecSize.y < flCellSize ) && ( vecSize.z < flCellSize ) )
+				break;
+		}
+
+		element.m_nLevel = nLevel;
+		if ( nLevel != SPGRID_OVERFLOW_LEVEL )
+		{
+			int nCellMin[3], nCellMax[3];
+			CellRange( element.m_vecMin, element.m_vecMax, nLevel, nCellMin, nCellMax );
+			for ( int i = 0; i < 3; ++i )
 			{
-				m_pQueryCallback[iQuery]->OnPostQuery( listMask );
+				element.m_nCellMin[i] = nCellMin[i];
+				element.m_nCellMax[i] = nCellMax[i];
 			}
 		}
+		AddEdits( hPartition, element, true );
 	}
+	m_Pending.RemoveAll();
+
+	// Group the edits by cell.
+	m_Edits.SortPredicate( []( const Edit_t &left, const Edit_t &right ) { return left.m_nCell < right.m_nCell; } );
+	for ( intp iFirst = 0, iLast; iFirst < m_Edits.Count(); iFirst = iLast )
+	{
+		for ( iLast = iFirst + 1; iLast < m_Edits.Count() && m_Edits[iLast].m_nCell == m_Edits[iFirst].m_nCell; ++iLast )
+		{
+		}
+		ApplyEdits( &m_Edits[iFirst], static_cast<int>( iLast - iFirst ) );
+	}
+
+	m_nFlushSerial.fetch_add( 1, std::memory_order_release );
+	ClearDirty();
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Create spatial partition object handle.
-//   Input: pHandleEntity - entity handle of the object to create a spatial partition handle for
+// Builds and publishes the next version of one cell
 //-----------------------------------------------------------------------------
-SpatialPartitionHandle_t CSpatialPartition::CreateHandle( IHandleEntity *pHandleEntity )
+void CGridTree::ApplyEdits( const Edit_t *pEdits, int nEdits )
 {
-	// dimhotepus: Lock should live till end of m_aHandles modification as DestroyHandle may cause data race.
-	AUTO_LOCK(m_HandlesMutex);
-
-	const SpatialPartitionHandle_t hPartition = m_aHandles.AddToTail();
-	auto &handle = m_aHandles[hPartition];
-
-	handle.m_pHandleEntity = pHandleEntity;
-	handle.m_vecMin.Init( FLT_MAX, FLT_MAX, FLT_MAX );
-	handle.m_vecMax.Init( FLT_MIN, FLT_MIN, FLT_MIN );
-	handle.m_fList = 0;
-	handle.m_flags = 0;
+	uint32 nCell = pEdits[0].m_nCell;
+	GridCell_t *pOld = ( nCell == SPGRID_OVERFLOW_CELL ) ? m_pOverflow.load( std::memory_order_relaxed ) :
+		const_cast<GridCell_t *>( FindCell( m_pCells.load( std::memory_order_relaxed ), nCell ) );
 
-	for ( int i = 0; i < NUM_TREES; i++ )
+	int nOld = pOld ? pOld->m_nCount : 0;
+	int nAdd = 0;
+	for ( int i = 0; i < nEdits; ++i )
 	{
-		handle.m_nVisitBit[i] = 0xffff;
-		handle.m_nLevel[i] = (uint8)-1;
-		handle.m_iLeafList[i] = CLeafList::InvalidIndex();
+		nAdd += pEdits[i].m_bAdd;
 	}
-	
-	return hPartition;
-}
 
+	GridCell_t *pNew = NULL;
+	int nCount = 0;
+	if ( nOld + nAdd > 0 )
+	{
+		pNew = static_cast<GridCell_t *>( malloc( sizeof( GridCell_t ) + ( nOld + nAdd - 1 ) * sizeof( GridEntry_t ) ) );
 
-//-----------------------------------------------------------------------------
-// Purpose: Destroy spatial partition object handle.
-//   Input: handle - handle of the spatial partition object handle to destroy
-//-----------------------------------------------------------------------------
+		for ( int i = 0; i < nOld; ++i )
+		{
+			const GridEntry_t &entry = pOld->m_Entries[i];
+
+			bool bRemoved = false;
+			for ( int j = 0; j < nEdits && !bRemoved; ++j )
+			{
+				bRemoved = !pEdits[j].m_bAdd && ( pEdits[j].m_hPartition == entry.m_hPartition );
+			}
+
+			if ( !bRemoved )
+			{
+				pNew->m_Entries[nCount++] = entry;
+			}
+		}
+
+		for ( int i = 0; i < nEdits; ++i )
+		{
+			if ( !pEdits[i].m_bAdd )
+				continue;
+
+			const GridElement_t &element = m_Elements[pEdits[i].m_hPartition];
+			GridEntry_t &entry = pNew->m_Entries[nCount++];
+			entry.m_vecMin = element.m_vecMin;
+			entry.m_vecMax = element.m_vecMax;
+			entry.m_pHandleEntity = EntityInfo( pEdits[i].m_hPartition ).m_pHandleEntity;
+			entry.m_hPartition = pEdits[i].m_hPartition;
+			for ( int j = 0; j < 3; ++j )
+			{
+				entry.m_nCellMin[j] = element.m_nCellMin[j];
+				entry.m_nCellMax[j] = element.m_nCellMax[j];
+			}
+		}
+
+		pNew->m_nCount = nCount;
+		if ( nCount == 0 )
+		{
+			free( pNew );
+			pNew = NULL;
+		}
+	}
+
+	PublishCell( nCell, pNew );
+	if ( pOld )
+	{
+		Retire( pOld );
+	}
+}
+
+void CGridTree::PublishCell( uint32 nCell, GridCell_t *pCell )
+{
+	if ( nCell == SPGRID_OVERFLOW_CELL )
+	{
+		m_pOverflow.store( pCell, std::memory_order_release );
+		return;
+	}
+
+	GridCellTable_t *pTable = m_pCells.load( std::memory_order_relaxed );
+	uint32 i = HashCell( nCell ) & pTable->m_nMask;
+	for ( ; pTable->m_Slots[i].m_nKey.load( std::memory_order_relaxed ) != 0; i = ( i + 1 ) & pTable->m_nMask )
+	{
+		if ( pTable->m_Slots[i].m_nKey.load( std::memory_order_relaxed ) == nCell + 1 )
+		{
+			pTable->m_Slots[i].m_pCell.store( pCell, std::memory_order_release );
+			return;
+		}
+	}
+
+	if ( !pCell )
+		return;
+
+	// Keep the table at most half full. Readers holding the old one keep using it.
+	if ( ( pTable->m_nCount + 1 ) * 2 > pTable->m_nMask + 1 )
+	{
+		GridCellTable_t *pGrown = AllocTable( ( pTable->m_nMask + 1 ) * 2 );
+		for ( uint32 j = 0; j <= pTable->m_nMask; ++j )
+		{
+			uint32 nKey = pTable->m_Slots[j].m_nKey.load( std::memory_order_relaxed );
+			if ( nKey == 0 )
+				continue;
+
+			uint32 k = HashCell( nKey - 1 ) & pGrown->m_nMask;
+			while ( pGrown->m_Slots[k].m_nKey.load( std::memory_order_relaxed ) != 0 )
+			{
+				k = ( k + 1 ) & pGrown->m_nMask;
+			}
+			pGrown->m_Slots[k].m_pCell.store( pTable->m_Slots[j].m_pCell.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+			pGrown->m_Slots[k].m_nKey.store( nKey, std::memory_order_relaxed );
+		}
+		pGrown->m_nCount = pTable->m_nCount;
+
+		m_pCells.store( pGrown, std::memory_order_release );
+		Retire( pTable );
+		pTable = pGrown;
+
+		for ( i = HashCell( nCell ) & pTable->m_nMask; pTable->m_Slots[i].m_nKey.load( std::memory_order_relaxed ) != 0; i = ( i + 1 ) & pTable->m_nMask )
+		{
+		}
+	}
+
+	pTable->m_Slots[i].m_pCell.store( pCell, std::memory_order_relaxed );
+	pTable->m_Slots[i].m_nKey.store( nCell + 1, std::memory_order_release );
+	++pTable->m_nCount;
+}
+
+void CGridTree::Retire( void *pMemory )
+{
+	m_Retired[0].AddToTail( pMemory );
+}
+
+//-----------------------------------------------------------------------------
+// Dirty coarse cells. Only written with m_WriteMutex held; the bits are
+// cleared after the flushed cells are published, so a reader that finds
+// them clear also sees the cells.
+//-----------------------------------------------------------------------------
+void CGridTree::MarkDirty( const Vector &vecMin, const Vector &vecMax )
+{
+	int nMin[3], nMax[3];
+	CellRange( vecMin, vecMax, SPGRID_DIRTY_LEVEL, nMin, nMax );
+	for ( int iZ = nMin[2]; iZ <= nMax[2]; ++iZ )
+	{
+		for ( int iY = nMin[1]; iY <= nMax[1]; ++iY )
+		{
+			for ( int iX = nMin[0]; iX <= nMax[0]; ++iX )
+			{
+				int nBit = ( iZ * SPGRID_DIRTY_CELLS + iY ) * SPGRID_DIRTY_CELLS + iX;
+				m_nDirty[nBit >> 5].fetch_or( 1u << ( nBit & 31 ), std::memory_order_relaxed );
+			}
+		}
+	}
+}
+
+void CGridTree::ClearDirty()
+{
+	for ( int i = 0; i < SPGRID_DIRTY_WORDS; ++i )
+	{
+		m_nDirty[i].store( 0, std::memory_order_release );
+	}
+}
+
+bool CGridTree::IsDirty( const Vector &vecMin, const Vector &vecMax ) const
+{
+	int nMin[3], nMax[3];
+	CellRange( vecMin, vecMax, SPGRID_DIRTY_LEVEL, nMin, nMax );
+	for ( int iZ = nMin[2]; iZ <= nMax[2]; ++iZ )
+	{
+		for ( int iY = nMin[1]; iY <= nMax[1]; ++iY )
+		{
+			for ( int iX = nMin[0]; iX <= nMax[0]; ++iX )
+			{
+				int nBit = ( iZ * SPGRID_DIRTY_CELLS + iY ) * SPGRID_DIRTY_CELLS + iX;
+				if ( m_nDirty[nBit >> 5].load( std::memory_order_acquire ) & ( 1u << ( nBit & 31 ) ) )
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Queries elsewhere in the world leave the batch alone until FrameUpdate.
+//-----------------------------------------------------------------------------
+inline void CGridTree::FlushOwnUpdates( const Vector &vecMin, const Vector &vecMax )
+{
+	if ( ( m_nQueuedSerial == m_nFlushSerial.load( std::memory_order_acquire ) ) && IsDirty( vecMin, vecMax ) )
+	{
+		AUTO_LOCK( m_WriteMutex );
+		Flush();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Publishes everything queued and frees what was retired the frame before;
+// a query may hold on to cell versions until the end of the next frame.
+//-----------------------------------------------------------------------------
+void CGridTree::FrameUpdate()
+{
+	AUTO_LOCK( m_WriteMutex );
+
+	Flush();
+
+	for ( void *pMemory : m_Retired[1] )
+	{
+		free( pMemory );
+	}
+	m_Retired[1].RemoveAll();
+	m_Retired[0].Swap( m_Retired[1] );
+}
+
+
+//-----------------------------------------------------------------------------
+// Reader side
+//-----------------------------------------------------------------------------
+template <class T>
+inline bool CGridTree::EnumerateElement( const GridEntry_t &entry, const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator *pIterator )
+{
+	EntityInfo_t &hInfo = EntityInfo( entry.m_hPartition );
+
+	// Keep going if this dude isn't in the list
+	if ( !( listMask & hInfo.m_fList ) )
+		return true;
+
+	if ( hInfo.m_flags & ENTITY_HIDDEN )
+		return true;
+
+	if ( !intersectTest( entry.m_vecMin, entry.m_vecMax ) )
+		return true;
+
+	return pIterator->EnumElement( entry.m_pHandleEntity ) != ITERATION_STOP;
+}
+
+//-----------------------------------------------------------------------------
+// Enumerates the cells nMin..nMax of a level. An element is reported from
+// the first of its cells in the range only, and not at all if it overlaps
+// the (unclamped) cells pSkipMin..pSkipMax, which were enumerated before.
+//-----------------------------------------------------------------------------
+template <class T>
+bool CGridTree::EnumerateCells( const GridCellTable_t *pTable, int nLevel, const int nMin[3], const int nMax[3], const int *pSkipMin, const int *pSkipMax,
+	const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator *pIterator )
+{
+	for ( int iX = nMin[0]; iX <= nMax[0]; ++iX )
+	{
+		for ( int iY = nMin[1]; iY <= nMax[1]; ++iY )
+		{
+			for ( int iZ = nMin[2]; iZ <= nMax[2]; ++iZ )
+			{
+				const GridCell_t *pCell = FindCell( pTable, PackCell( iX, iY, iZ, nLevel ) );
+				if ( !pCell )
+					continue;
+
+				for ( int i = 0; i < pCell->m_nCount; ++i )
+				{
+					const GridEntry_t &entry = pCell->m_Entries[i];
+					if ( ( iX != Max<int>( entry.m_nCellMin[0], nMin[0] ) ) ||
+						 ( iY != Max<int>( entry.m_nCellMin[1], nMin[1] ) ) ||
+						 ( iZ != Max<int>( entry.m_nCellMin[2], nMin[2] ) ) )
+						continue;
+
+					if ( pSkipMin &&
+						 ( entry.m_nCellMin[0] <= pSkipMax[0] ) && ( entry.m_nCellMax[0] >= pSkipMin[0] ) &&
+						 ( entry.m_nCellMin[1] <= pSkipMax[1] ) && ( entry.m_nCellMax[1] >= pSkipMin[1] ) &&
+						 ( entry.m_nCellMin[2] <= pSkipMax[2] ) && ( entry.m_nCellMax[2] >= pSkipMin[2] ) )
+						continue;
+
+					if ( !EnumerateElement( entry, intersectTest, listMask, pIterator ) )
+						return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+template <class T>
+bool CGridTree::EnumerateOverflow( const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator *pIterator )
+{
+	const GridCell_t *pCell = m_pOverflow.load( std::memory_order_acquire );
+	if ( !pCell )
+		return true;
+
+	for ( int i = 0; i < pCell->m_nCount; ++i )
+	{
+		if ( !EnumerateElement( pCell->m_Entries[i], intersectTest, listMask, pIterator ) )
+			return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Walks the cells of a level along the ray (3D DDA). A swept box widens the
+// walk by the cells its extents can reach. The coordinates of the walk only
+// ever step one way, so an element overlaps one contiguous run of steps:
+// each step enumerates the newly covered slab of cells and skips elements
+// that overlap the previous step.
+//-----------------------------------------------------------------------------
+template <class T>
+bool CGridTree::EnumerateAlongRay( const GridCellTable_t *pTable, int nLevel, const Ray_t &ray, const Vector &vecEnd, const Vector &vecInvDelta,
+	const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator *pIterator )
+{
+	const int nShift = SPGRID_CELL_SHIFT + SPGRID_LEVEL_SHIFT * nLevel;
+	const float flCellSize = 1 << nShift;
+	const int nCellCount = CellCount( nLevel );
+
+	int nCell[3], nStep[3], nRemaining[3], nRadius[3];
+	float flMax[3], flDelta[3];
+	for ( int i = 0; i < 3; ++i )
+	{
+		nCell[i] = CellFromCoord( ray.m_Start[i], nLevel );
+		int nEnd = CellFromCoord( vecEnd[i], nLevel );
+		nRadius[i] = ( ray.m_Extents[i] > 0.0f ) ? ( static_cast<int>( ray.m_Extents[i] ) >> nShift ) + 1 : 0;
+
+		nStep[i] = ( nEnd > nCell[i] ) ? 1 : ( ( nEnd < nCell[i] ) ? -1 : 0 );
+		nRemaining[i] = abs( nEnd - nCell[i] );
+		if ( nStep[i] != 0 )
+		{
+			// Ray fraction to the next cell boundary, and per cell.
+			float flBoundary = ( ( nCell[i] + ( nStep[i] > 0 ) ) << nShift ) + MIN_COORD_FLOAT;
+			flMax[i] = ( flBoundary - ray.m_Start[i] ) * vecInvDelta[i];
+			flDelta[i] = flCellSize * fabsf( vecInvDelta[i] );
+		}
+		else
+		{
+			flMax[i] = FLT_MAX;
+			flDelta[i] = 0.0f;
+		}
+	}
+
+	int nBoxMin[3], nBoxMax[3], nPrevMin[3], nPrevMax[3], nSlabMin[3], nSlabMax[3];
+	for ( int i = 0; i < 3; ++i )
+	{
+		nBoxMin[i] = nCell[i] - nRadius[i];
+		nBoxMax[i] = nCell[i] + nRadius[i];
+		nSlabMin[i] = Max( nBoxMin[i], 0 );
+		nSlabMax[i] = Min( nBoxMax[i], nCellCount - 1 );
+	}
+
+	if ( !EnumerateCells( pTable, nLevel, nSlabMin, nSlabMax, NULL, NULL, intersectTest, listMask, pIterator ) )
+		return false;
+
+	while ( nRemaining[0] + nRemaining[1] + nRemaining[2] > 0 )
+	{
+		// Step along the axis whose next boundary is closest.
+		int iAxis = -1;
+		for ( int i = 0; i < 3; ++i )
+		{
+			if ( nRemaining[i] > 0 && ( iAxis < 0 || flMax[i] < flMax[iAxis] ) )
+			{
+				iAxis = i;
+			}
+		}
+
+		for ( int i = 0; i < 3; ++i )
+		{
+			nPrevMin[i] = nBoxMin[i];
+			nPrevMax[i] = nBoxMax[i];
+		}
+
+		--nRemaining[iAxis];
+		flMax[iAxis] += flDelta[iAxis];
+		nBoxMin[iAxis] += nStep[iAxis];
+		nBoxMax[iAxis] += nStep[iAxis];
+
+		bool bEmpty = false;
+		for ( int i = 0; i < 3; ++i )
+		{
+			nSlabMin[i] = nBoxMin[i];
+			nSlabMax[i] = nBoxMax[i];
+		}
+		if ( nStep[iAxis] > 0 )
+		{
+			nSlabMin[iAxis] = nBoxMax[iAxis];
+		}
+		else
+		{
+			nSlabMax[iAxis] = nBoxMin[iAxis];
+		}
+		for ( int i = 0; i < 3; ++i )
+		{
+			nSlabMin[i] = Max( nSlabMin[i], 0 );
+			nSlabMax[i] = Min( nSlabMax[i], nCellCount - 1 );
+			bEmpty = bEmpty || ( nSlabMin[i] > nSlabMax[i] );
+		}
+
+		if ( bEmpty )
+			continue;
+
+		if ( !EnumerateCells( pTable, nLevel, nSlabMin, nSlabMax, nPrevMin, nPrevMax, intersectTest, listMask, pIterator ) )
+			return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CGridTree::EnumerateElementsInBox( SpatialPartitionListMask_t listMask, 
+										const Vector& vecMins, const Vector& vecMaxs, 
+										bool coarseTest, IPartitionEnumerator* pIterator )
+{
+	VPROF( "BoxTest/SphereTest" );
+
+	// Early-out.
+	if ( listMask == 0 )
+		return;
+
+	// Clamp bounds to extant space
+	Vector mins, maxs;
+	VectorMax( vecMins, s_PartitionMin, mins );
+	VectorMin( mins, s_PartitionMax, mins );
+
+	VectorMax( vecMaxs, s_PartitionMin, maxs );
+	VectorMin( maxs, s_PartitionMax, maxs );
+
+	FlushOwnUpdates( mins, maxs );
+
+	auto intersectTest = [&mins, &maxs]( const Vector &vecMin, const Vector &vecMax )
+	{
+		return IsBoxIntersectingBox( vecMin, vecMax, mins, maxs );
+	};
+
+	const GridCellTable_t *pTable = m_pCells.load( std::memory_order_acquire );
+	for ( int nLevel = 0; nLevel < SPGRID_LEVEL_COUNT; ++nLevel )
+	{
+		int nMin[3], nMax[3];
+		CellRange( mins, maxs, nLevel, nMin, nMax );
+		if ( !EnumerateCells( pTable, nLevel, nMin, nMax, NULL, NULL, intersectTest, listMask, pIterator ) )
+			return;
+	}
+
+	EnumerateOverflow( intersectTest, listMask, pIterator );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CGridTree::EnumerateElementsInSphere( SpatialPartitionListMask_t listMask, 
+										   const Vector& origin, float radius, bool coarseTest, IPartitionEnumerator* pIterator )
+{
+	// Otherwise they might as well just walk the entire ent list!!!
+	Assert( radius <= MAX_COORD_FLOAT );
+
+	// Same as the voxel tree, the box test is good enough.
+	Vector vecMin( origin.x - radius, origin.y - radius, origin.z - radius );
+	Vector vecMax( origin.x + radius, origin.y + radius, origin.z + radius );
+	EnumerateElementsInBox( listMask, vecMin, vecMax, coarseTest, pIterator );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CGridTree::EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask, 
+										   const Ray_t &ray, bool coarseTest, IPartitionEnumerator *pIterator )
+{
+	VPROF("EnumerateElementsAlongRay");
+
+	if ( !ray.m_IsSwept )
+	{
+		Vector vecMin, vecMax;
+		VectorSubtract( ray.m_Start, ray.m_Extents, vecMin );
+		VectorAdd( ray.m_Start, ray.m_Extents, vecMax );
+		return EnumerateElementsInBox( listMask, vecMin, vecMax, coarseTest, pIterator );
+	}
+
+	// Early-out.
+	if ( listMask == 0 )
+		return;
+
+	// Calculate the end of the ray
+	Vector vecEnd;
+	Vector vecInvDelta;
+	Ray_t clippedRay = ray;
+	VectorAdd( clippedRay.m_Start, clippedRay.m_Delta, vecEnd );
+
+	bool bStartIn = IsPointInBox( ray.m_Start, s_PartitionMin, s_PartitionMax );
+	bool bEndIn = IsPointInBox( vecEnd, s_PartitionMin, s_PartitionMax );
+	if ( !bStartIn && !bEndIn )
+		return;
+
+	if ( !bStartIn )
+	{
+		ClampStartPoint( clippedRay, vecEnd );
+	}
+	else if ( !bEndIn )
+	{
+		ClampEndPoint( clippedRay, vecEnd );
+	}
+
+	vecInvDelta[0] = ( clippedRay.m_Delta[0] != 0.0f ) ? 1.0f / clippedRay.m_Delta[0] : FLT_MAX;
+	vecInvDelta[1] = ( clippedRay.m_Delta[1] != 0.0f ) ? 1.0f / clippedRay.m_Delta[1] : FLT_MAX;
+	vecInvDelta[2] = ( clippedRay.m_Delta[2] != 0.0f ) ? 1.0f / clippedRay.m_Delta[2] : FLT_MAX;
+
+	{
+		Vector vecRayMin, vecRayMax;
+		VectorMin( clippedRay.m_Start, vecEnd, vecRayMin );
+		VectorMax( clippedRay.m_Start, vecEnd, vecRayMax );
+		VectorSubtract( vecRayMin, clippedRay.m_Extents, vecRayMin );
+		VectorAdd( vecRayMax, clippedRay.m_Extents, vecRayMax );
+		FlushOwnUpdates( vecRayMin, vecRayMax );
+	}
+
+	const GridCellTable_t *pTable = m_pCells.load( std::memory_order_acquire );
+	if ( ray.m_IsRay )
+	{
+		auto intersectTest = [&clippedRay, &vecInvDelta]( const Vector &vecMin, const Vector &vecMax )
+		{
+			return IsBoxIntersectingRay( vecMin, vecMax, clippedRay.m_Start, clippedRay.m_Delta, vecInvDelta );
+		};
+
+		for ( int nLevel = 0; nLevel < SPGRID_LEVEL_COUNT; ++nLevel )
+		{
+			if ( !EnumerateAlongRay( pTable, nLevel, clippedRay, vecEnd, vecInvDelta, intersectTest, listMask, pIterator ) )
+				return;
+		}
+		EnumerateOverflow( intersectTest, listMask, pIterator );
+	}
+	else
+	{
+		auto intersectTest = [&clippedRay, &vecInvDelta]( const Vector &vecMin, const Vector &vecMax )
+		{
+			Vector vecTestMin, vecTestMax;
+			VectorSubtract( vecMin, clippedRay.m_Extents, vecTestMin );
+			VectorAdd( vecMax, clippedRay.m_Extents, vecTestMax );
+			return IsBoxIntersectingRay( vecTestMin, vecTestMax, clippedRay.m_Start, clippedRay.m_Delta, vecInvDelta );
+		};
+
+		for ( int nLevel = 0; nLevel < SPGRID_LEVEL_COUNT; ++nLevel )
+		{
+			if ( !EnumerateAlongRay( pTable, nLevel, clippedRay, vecEnd, vecInvDelta, intersectTest, listMask, pIterator ) )
+				return;
+		}
+		EnumerateOverflow( intersectTest, listMask, pIterator );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CGridTree::EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask, 
+										  const Vector& pt, bool coarseTest, IPartitionEnumerator* pIterator )
+{
+	// Early-out.
+	if ( listMask == 0 )
+		return;
+
+	FlushOwnUpdates( pt, pt );
+
+	auto intersectTest = [&pt]( const Vector &vecMin, const Vector &vecMax )
+	{
+		return IsPointInBox( pt, vecMin, vecMax );
+	};
+
+	const GridCellTable_t *pTable = m_pCells.load( std::memory_order_acquire );
+	for ( int nLevel = 0; nLevel < SPGRID_LEVEL_COUNT; ++nLevel )
+	{
+		int nCell[3];
+		CellRange( pt, pt, nLevel, nCell, nCell );
+		if ( !EnumerateCells( pTable, nLevel, nCell, nCell, NULL, NULL, intersectTest, listMask, pIterator ) )
+			return;
+	}
+
+	EnumerateOverflow( intersectTest, listMask, pIterator );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Debug! Render boxes around objects in tree.
+//-----------------------------------------------------------------------------
+void CGridTree::RenderEntry( const GridEntry_t &entry, int nLevel, float flTime )
+{
+#ifndef SWDS
+	CDebugOverlay::AddBoxOverlay( vec3_origin, entry.m_vecMin, entry.m_vecMax, vec3_angle, s_pVoxelColor[nLevel][0], s_pVoxelColor[nLevel][1], s_pVoxelColor[nLevel][2], 75, flTime );
+#endif
+}
+
+void CGridTree::RenderAllObjectsInTree( float flTime )
+{
+	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
+
+	const GridCellTable_t *pTable = m_pCells.load( std::memory_order_acquire );
+	if ( !pTable )
+		return;
+
+	for ( uint32 i = 0; i <= pTable->m_nMask; ++i )
+	{
+		uint32 nKey = pTable->m_Slots[i].m_nKey.load( std::memory_order_acquire );
+		const GridCell_t *pCell = pTable->m_Slots[i].m_pCell.load( std::memory_order_acquire );
+		if ( nKey == 0 || !pCell )
+			continue;
+
+		// Once per element, from its first cell.
+		uint32 nCell = nKey - 1;
+		for ( int j = 0; j < pCell->m_nCount; ++j )
+		{
+			const GridEntry_t &entry = pCell->m_Entries[j];
+			if ( PackCell( entry.m_nCellMin[0], entry.m_nCellMin[1], entry.m_nCellMin[2], nCell >> 30 ) == nCell )
+			{
+				RenderEntry( entry, nCell >> 30, flTime );
+			}
+		}
+	}
+
+	const GridCell_t *pOverflow = m_pOverflow.load( std::memory_order_acquire );
+	for ( int j = 0; pOverflow && j < pOverflow->m_nCount; ++j )
+	{
+		RenderEntry( pOverflow->m_Entries[j], SPGRID_OVERFLOW_LEVEL, flTime );
+	}
+}
+
+void CGridTree::RenderObjectsInPlayerLeafs( const Vector &vecPlayerMin, const Vector &vecPlayerMax, float flTime )
+{
+	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
+
+	const GridCellTable_t *pTable = m_pCells.load( std::memory_order_acquire );
+	if ( !pTable )
+		return;
+
+	for ( int nLevel = 0; nLevel < SPGRID_LEVEL_COUNT; ++nLevel )
+	{
+		int nMin[3], nMax[3];
+		CellRange( vecPlayerMin, vecPlayerMax, nLevel, nMin, nMax );
+		for ( int iX = nMin[0]; iX <= nMax[0]; ++iX )
+		{
+			for ( int iY = nMin[1]; iY <= nMax[1]; ++iY )
+			{
+				for ( int iZ = nMin[2]; iZ <= nMax[2]; ++iZ )
+				{
+					const GridCell_t *pCell = FindCell( pTable, PackCell( iX, iY, iZ, nLevel ) );
+					for ( int i = 0; pCell && i < pCell->m_nCount; ++i )
+					{
+						RenderEntry( pCell->m_Entries[i], nLevel, flTime );
+					}
+				}
+			}
+		}
+	}
+}
+
+
+static ConVar spatialpartition_grid( "spatialpartition_grid", "0", 0, "Use the hashed grid spatial partition, whose queries never block on updates. Takes effect on the next map load." );
+
+//-----------------------------------------------------------------------------
+// Expose CSpatialPartition to the game + client DLL.
+//-----------------------------------------------------------------------------
+static CSpatialPartition	g_SpatialPartition;
+EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CSpatialPartition, ISpatialPartition, INTERFACEVERSION_SPATIALPARTITION, g_SpatialPartition );
+
+//-----------------------------------------------------------------------------
+// Expose ISpatialPartitionInternal to the engine.
+//-----------------------------------------------------------------------------
+ISpatialPartitionInternal *SpatialPartition()
+{
+	return &g_SpatialPartition;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Constructor
+//-----------------------------------------------------------------------------
+CSpatialPartition::CSpatialPartition()
+{
+	memset(m_pQueryCallback, 0, sizeof(m_pQueryCallback));
+	memset(m_bUseOldQueryCallback, 0, sizeof(m_bUseOldQueryCallback));
+	m_nQueryCallbackCount = 0;
+	m_nSuppressedListMask = 0;
+
+	for ( int i = 0; i < NUM_TREES; i++ )
+	{
+		m_pTrees[i] = &m_VoxelTrees[i];
+	}
+}
+
+
+CSpatialPartition::~CSpatialPartition()
+{
+	Shutdown();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//   Input: worldmin - 
+//          worldmax - 
+//-----------------------------------------------------------------------------
+void CSpatialPartition::Init( const Vector &worldmin, const Vector &worldmax )
+{
+	Init( worldmin, worldmax, spatialpartition_grid.GetBool() );
+}
+
+void CSpatialPartition::Init( const Vector &worldmin, const Vector &worldmax, bool bGrid )
+{
+	// Clear the handle list and ensure some new memory.
+	m_aHandles.Purge();
+	m_aHandles.EnsureCapacity( SPHASH_HANDLELIST_BLOCK );
+
+	for ( int i = 0; i < NUM_TREES; i++ )
+	{
+		IPartitionTree *pTree = bGrid ? static_cast<IPartitionTree *>( &m_GridTrees[i] ) : &m_VoxelTrees[i];
+		if ( m_pTrees[i] != pTree )
+		{
+			m_pTrees[i]->Shutdown();
+			m_pTrees[i] = pTree;
+		}
+
+		m_pTrees[i]->Init( this, i, worldmin, worldmax );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CSpatialPartition::Shutdown( void )
+{
+	for ( int i = 0; i < NUM_TREES; i++ )
+	{
+		m_pTrees[i]->Shutdown();
+	}
+	m_aHandles.Purge();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Add a callback to the query callback list.  Functions get called 
+//          right before a query occurs.
+//   Input: pCallback - pointer to the callback function to add
+//-----------------------------------------------------------------------------
+void CSpatialPartition::InstallQueryCallback( IPartitionQueryCallback *pCallback )
+{
+	// Verify data.
+	Assert( pCallback && m_nQueryCallbackCount < MAX_QUERY_CALLBACK );
+	if ( !pCallback || ( m_nQueryCallbackCount >= MAX_QUERY_CALLBACK ) )
+		return;
+
+	m_pQueryCallback[m_nQueryCallbackCount] = pCallback;
+	m_bUseOldQueryCallback[m_nQueryCallbackCount] = false;
+	++m_nQueryCallbackCount;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Add a callback to the query callback list.  Functions get called 
+//          right before a query occurs.
+//   Input: pCallback - pointer to the callback function to add
+//-----------------------------------------------------------------------------
+void CSpatialPartition::InstallQueryCallback_V1( IPartitionQueryCallback *pCallback )
+{
+	// Verify data.
+	Assert( pCallback && m_nQueryCallbackCount < MAX_QUERY_CALLBACK );
+	if ( !pCallback || ( m_nQueryCallbackCount >= MAX_QUERY_CALLBACK ) )
+		return;
+
+	// NOTE: the query callbacks are not mutexed. Only add and remove when threads are joined
+
+	m_pQueryCallback[m_nQueryCallbackCount] = pCallback;
+	m_bUseOldQueryCallback[m_nQueryCallbackCount] = true;
+	++m_nQueryCallbackCount;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Remove a callback from the query callback list.
+//   Input: pCallback - pointer to the callback function to remove
+//-----------------------------------------------------------------------------
+void CSpatialPartition::RemoveQueryCallback( IPartitionQueryCallback *pCallback )
+{
+	// Verify data.
+	if ( !pCallback )
+		return;
+
+	for ( int iQuery = m_nQueryCallbackCount; --iQuery >= 0;  )
+	{
+		if ( m_pQueryCallback[iQuery] == pCallback )
+		{
+			--m_nQueryCallbackCount;
+			m_pQueryCallback[iQuery] = m_pQueryCallback[m_nQueryCallbackCount];
+			return;
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Invokes the pre-query callbacks.
+//-----------------------------------------------------------------------------
+void CSpatialPartition::InvokeQueryCallbacks( SpatialPartitionListMask_t listMask, bool bDone )
+{
+	for ( int iQuery = 0; iQuery < m_nQueryCallbackCount; ++iQuery )
+	{
+		if ( !bDone )
+		{
+			if ( m_bUseOldQueryCallback[iQuery] )
+			{
+				m_pQueryCallback[iQuery]->OnPreQuery_V1();
+			}
+			else
+			{
+				m_pQueryCallback[iQuery]->OnPreQuery( listMask );
+			}
+		}
+		else
+		{
+			if ( !m_bUseOldQueryCallback[iQuery] )
+			{
+				m_pQueryCallback[iQuery]->OnPostQuery( listMask );
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Create spatial partition object handle.
+//   Input: pHandleEntity - entity handle of the object to create a spatial partition handle for
+//-----------------------------------------------------------------------------
+SpatialPartitionHandle_t CSpatialPartition::CreateHandle( IHandleEntity *pHandleEntity )
+{
+	// dimhotepus: Lock should live till end of m_aHandles modification as DestroyHandle may cause data race.
+	AUTO_LOCK(m_HandlesMutex);
+
+	const SpatialPartitionHandle_t hPartition = m_aHandles.AddToTail();
+	auto &handle = m_aHandles[hPartition];
+
+	handle.m_pHandleEntity = pHandleEntity;
+	handle.m_vecMin.Init( FLT_MAX, FLT_MAX, FLT_MAX );
+	handle.m_vecMax.Init( FLT_MIN, FLT_MIN, FLT_MIN );
+	handle.m_fList = 0;
+	handle.m_flags = 0;
+
+	for ( int i = 0; i < NUM_TREES; i++ )
+	{
+		handle.m_nVisitBit[i] = 0xffff;
+		handle.m_nLevel[i] = (uint8)-1;
+		handle.m_iLeafList[i] = CLeafList::InvalidIndex();
+	}
+	
+	return hPartition;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Destroy spatial partition object handle.
+//   Input: handle - handle of the spatial partition object handle to destroy
+//-----------------------------------------------------------------------------
 void CSpatialPartition::DestroyHandle( SpatialPartitionHandle_t hPartition )
 {
 	if ( hPartition != PARTITION_INVALID_HANDLE )
@@ -2718,19 +3864,19 @@ void CSpatialPartition::ElementMoved( SpatialPartitionHandle_t handle, const Vec
 	{
 		if ( listMask & PARTITION_ALL_CLIENT_EDICTS )
 		{
-			m_VoxelTrees[CLIENT_TREE].ElementMoved( handle, mins, maxs );
+			m_pTrees[CLIENT_TREE]->ElementMoved( handle, mins, maxs );
 			entityInfo.m_flags |= IN_CLIENT_TREE;
 		}
 
 		if ( listMask & ~PARTITION_ALL_CLIENT_EDICTS )
 		{
-			m_VoxelTrees[SERVER_TREE].ElementMoved( handle, mins, maxs );
+			m_pTrees[SERVER_TREE]->ElementMoved( handle, mins, maxs );
 			entityInfo.m_flags |= IN_SERVER_TREE;
 		}
 	}
 	else
 	{
-		m_VoxelTrees[CLIENT_TREE].ElementMoved( handle, mins, maxs );
+		m_pTrees[CLIENT_TREE]->ElementMoved( handle, mins, maxs );
 		entityInfo.m_flags |= IN_CLIENT_TREE;
 	}
 }
@@ -2741,7 +3887,7 @@ void CSpatialPartition::ElementMoved( SpatialPartitionHandle_t handle, const Vec
 void CSpatialPartition::EnumerateElementsInBox( SpatialPartitionListMask_t listMask, const Vector& mins, const Vector& maxs, bool coarseTest, IPartitionEnumerator* pIterator )
 {
 	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
-	CVoxelTree *pTree = VoxelTree( listMask );
+	IPartitionTree *pTree = Tree( listMask );
 	InvokeQueryCallbacks( listMask );
 	pTree->EnumerateElementsInBox( listMask, mins, maxs, coarseTest, pIterator );
 	InvokeQueryCallbacks( listMask, true );
@@ -2753,7 +3899,7 @@ void CSpatialPartition::EnumerateElementsInBox( SpatialPartitionListMask_t listM
 void CSpatialPartition::EnumerateElementsInSphere( SpatialPartitionListMask_t listMask, const Vector& origin, float radius, bool coarseTest, IPartitionEnumerator* pIterator )
 {
 	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
-	CVoxelTree *pTree = VoxelTree( listMask );
+	IPartitionTree *pTree = Tree( listMask );
 	InvokeQueryCallbacks( listMask );
 	pTree->EnumerateElementsInSphere( listMask, origin, radius, coarseTest, pIterator );
 	InvokeQueryCallbacks( listMask, true );
@@ -2765,7 +3911,7 @@ void CSpatialPartition::EnumerateElementsInSphere( SpatialPartitionListMask_t li
 void CSpatialPartition::EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask, const Ray_t& ray, bool coarseTest, IPartitionEnumerator* pIterator )
 {
 	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
-	CVoxelTree *pTree = VoxelTree( listMask );
+	IPartitionTree *pTree = Tree( listMask );
 	InvokeQueryCallbacks( listMask );
 	pTree->EnumerateElementsAlongRay( listMask, ray, coarseTest, pIterator );
 	InvokeQueryCallbacks( listMask, true );
@@ -2777,7 +3923,7 @@ void CSpatialPartition::EnumerateElementsAlongRay( SpatialPartitionListMask_t li
 void CSpatialPartition::EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask, const Vector& pt, bool coarseTest, IPartitionEnumerator* pIterator )
 {
 	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
-	CVoxelTree *pTree = VoxelTree( listMask );
+	IPartitionTree *pTree = Tree( listMask );
 	InvokeQueryCallbacks( listMask );
 	pTree->EnumerateElementsAtPoint( listMask, pt, coarseTest, pIterator );
 	InvokeQueryCallbacks( listMask, true );
@@ -2796,19 +3942,19 @@ void CSpatialPartition::InsertIntoTree( SpatialPartitionHandle_t hPartition, con
 	{
 		if ( ( listMask & PARTITION_ALL_CLIENT_EDICTS ) && !( entityInfo.m_flags & IN_CLIENT_TREE ) )
 		{
-			m_VoxelTrees[CLIENT_TREE].InsertIntoTree( hPartition, mins, maxs );
+			m_pTrees[CLIENT_TREE]->InsertIntoTree( hPartition, mins, maxs );
 			entityInfo.m_flags |= IN_CLIENT_TREE;
 		}
 
 		if ( ( listMask & ~PARTITION_ALL_CLIENT_EDICTS ) && !( entityInfo.m_flags & IN_SERVER_TREE ) )
 		{
-			m_VoxelTrees[SERVER_TREE].InsertIntoTree( hPartition, mins, maxs );
+			m_pTrees[SERVER_TREE]->InsertIntoTree( hPartition, mins, maxs );
 			entityInfo.m_flags |= IN_SERVER_TREE;
 		}
 	}
 	else if ( !( entityInfo.m_flags & IN_CLIENT_TREE ) )
 	{
-		m_VoxelTrees[CLIENT_TREE].InsertIntoTree( hPartition, mins, maxs );
+		m_pTrees[CLIENT_TREE]->InsertIntoTree( hPartition, mins, maxs );
 		entityInfo.m_flags |= IN_CLIENT_TREE;
 	}
 }
@@ -2822,13 +3968,13 @@ void CSpatialPartition::RemoveFromTree( SpatialPartitionHandle_t hPartition )
 
 	if ( entityInfo.m_flags & IN_CLIENT_TREE )
 	{
-		m_VoxelTrees[CLIENT_TREE].RemoveFromTree( hPartition ); 
+		m_pTrees[CLIENT_TREE]->RemoveFromTree( hPartition ); 
 		entityInfo.m_flags &= ~IN_CLIENT_TREE;
 	}
 
 	if ( entityInfo.m_flags & IN_SERVER_TREE )
 	{
-		m_VoxelTrees[SERVER_TREE].RemoveFromTree( hPartition ); 
+		m_pTrees[SERVER_TREE]->RemoveFromTree( hPartition ); 
 		entityInfo.m_flags &= ~IN_SERVER_TREE;
 	}
 }
@@ -2861,7 +4007,7 @@ void CSpatialPartition::RenderAllObjectsInTree( float flTime )
 {
 	for ( int i = 0; i < NUM_TREES; i++ )
 	{
-		m_VoxelTrees[i].RenderAllObjectsInTree( flTime );
+		m_pTrees[i]->RenderAllObjectsInTree( flTime );
 	}
 }
 
@@ -2869,7 +4015,7 @@ void CSpatialPartition::RenderObjectsInPlayerLeafs( const Vector &vecPlayerMin,
 {
 	for ( int i = 0; i < NUM_TREES; i++ )
 	{
-		m_VoxelTrees[i].RenderObjectsInPlayerLeafs( vecPlayerMin, vecPlayerMax, flTime );
+		m_pTrees[i]->RenderObjectsInPlayerLeafs( vecPlayerMin, vecPlayerMax, flTime );
 	}
 }
 
@@ -2885,12 +4031,40 @@ void CVoxelTree::ReportStats( const char *pFileName )
 	}
 }
 
+void CGridTree::ReportStats( const char *pFileName )
+{
+	int nCells[SPGRID_LEVEL_COUNT] = {}, nEntries[SPGRID_LEVEL_COUNT] = {};
+
+	const GridCellTable_t *pTable = m_pCells.load( std::memory_order_acquire );
+	for ( uint32 i = 0; pTable && i <= pTable->m_nMask; ++i )
+	{
+		uint32 nKey = pTable->m_Slots[i].m_nKey.load( std::memory_order_acquire );
+		const GridCell_t *pCell = pTable->m_Slots[i].m_pCell.load( std::memory_order_acquire );
+		if ( nKey == 0 || !pCell )
+			continue;
+
+		int nLevel = ( nKey - 1 ) >> 30;
+		++nCells[nLevel];
+		nEntries[nLevel] += pCell->m_nCount;
+	}
+
+	const GridCell_t *pOverflow = m_pOverflow.load( std::memory_order_acquire );
+
+	Msg( "Grid : cells / entries per level\n" );
+	for ( int i = 0; i < SPGRID_LEVEL_COUNT; ++i )
+	{
+		Msg( "\t%d - %d / %d\n", i, nCells[i], nEntries[i] );
+	}
+	Msg( "\toverflow - %d\n", pOverflow ? pOverflow->m_nCount : 0 );
+	Msg( "\t%u cell slots, %zd retired blocks\n", pTable ? pTable->m_nMask + 1 : 0, m_Retired[0].Count() + m_Retired[1].Count() );
+}
+
 void CSpatialPartition::ReportStats( const char *pFileName )
 {
 	Msg( "Handle Count %hu (%zu bytes)\n", m_aHandles.Count(), m_aHandles.Count() * ( sizeof(EntityInfo_t) + 2 * sizeof(SpatialPartitionHandle_t) ) );
 	for ( int i = 0; i < NUM_TREES; i++ )
 	{
-		m_VoxelTrees[i].ReportStats( pFileName );
+		m_pTrees[i]->ReportStats( pFileName );
 	}
 }
 
@@ -2915,11 +4089,31 @@ void CVoxelTree::DrawDebugOverlays()
 	}
 }
 
+void CGridTree::DrawDebugOverlays()
+{
+	int nLevel = r_partition_level.GetInt();
+	if ( nLevel < 0 )
+		return;
+
+	RenderAllObjectsInTree( 0.01f );
+}
+
 void CSpatialPartition::DrawDebugOverlays()
 {
 	for ( int i = 0; i < NUM_TREES; i++ )
 	{
-		m_VoxelTrees[i].DrawDebugOverlays();
+		m_pTrees[i]->DrawDebugOverlays();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Publishes batched tree updates, once a frame when the game threads are joined.
+//-----------------------------------------------------------------------------
+void CSpatialPartition::FrameUpdate()
+{
+	for ( int i = 0; i < NUM_TREES; i++ )
+	{
+		m_pTrees[i]->FrameUpdate();
 	}
 }
 
@@ -2931,6 +4125,13 @@ ISpatialPartition *CreateSpatialPartition( const Vector& worldmin, const Vector&
 	return pResult;
 }
 
+ISpatialPartitionInternal *CreateGridSpatialPartition( const Vector& worldmin, const Vector& worldmax )
+{
+	CSpatialPartition *pResult = new CSpatialPartition;
+	pResult->Init( worldmin, worldmax, true );
+	return pResult;
+}
+
 void DestroySpatialPartition( ISpatialPartition *pPartition )
 {
 	Assert( pPartition != (ISpatialPartition*)&g_SpatialPartition );
@@ -0,0 +1,191 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Flat bounding volume hierarchy over the static props of a map
+//
+//=============================================================================//
+
+#include "staticpropbvh.h"
+#include <algorithm>
+#include "mathlib/mathlib.h"
+#include "collisionutils.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+CStaticPropBVH::CStaticPropBVH()
+{
+	m_vecMins.Init();
+	m_vecMaxs.Init();
+	m_vecScale.Init();
+}
+
+void CStaticPropBVH::Purge()
+{
+	for ( int i = 0; i < 3; ++i )
+	{
+		m_NodeMins[i].Purge();
+		m_NodeMaxs[i].Purge();
+	}
+	m_NodeSkip.Purge();
+	m_NodeFirst.Purge();
+	m_NodeCount.Purge();
+	m_Items.Purge();
+	m_ItemMins.Purge();
+	m_ItemMaxs.Purge();
+}
+
+
+//-----------------------------------------------------------------------------
+// Quantization, rounds outwards so quantized boxes never shrink
+//-----------------------------------------------------------------------------
+inline unsigned short CStaticPropBVH::QuantizeDown( float flValue, int nAxis ) const
+{
+	float flQuantized = floorf( ( flValue - m_vecMins[nAxis] ) * m_vecScale[nAxis] );
+	return static_cast<unsigned short>( clamp( flQuantized, 0.0f, 65535.0f ) );
+}
+
+inline unsigned short CStaticPropBVH::QuantizeUp( float flValue, int nAxis ) const
+{
+	float flQuantized = ceilf( ( flValue - m_vecMins[nAxis] ) * m_vecScale[nAxis] );
+	return static_cast<unsigned short>( clamp( flQuantized, 0.0f, 65535.0f ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Build
+//-----------------------------------------------------------------------------
+void CStaticPropBVH::Build( const Vector *pMins, const Vector *pMaxs, int nCount )
+{
+	Purge();
+	if ( nCount <= 0 )
+		return;
+
+	m_vecMins = pMins[0];
+	m_vecMaxs = pMaxs[0];
+	for ( int i = 1; i < nCount; ++i )
+	{
+		VectorMin( m_vecMins, pMins[i], m_vecMins );
+		VectorMax( m_vecMaxs, pMaxs[i], m_vecMaxs );
+	}
+	for ( int i = 0; i < 3; ++i )
+	{
+		m_vecScale[i] = 65535.0f / Max( m_vecMaxs[i] - m_vecMins[i], 1.0f );
+	}
+
+	m_Items.SetCount( nCount );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		m_Items[i] = i;
+	}
+
+	// A binary tree with up to MAX_LEAF_ITEMS per leaf.
+	int nMaxNodes = 2 * ( nCount / MAX_LEAF_ITEMS + 1 );
+	for ( int i = 0; i < 3; ++i )
+	{
+		m_NodeMins[i].EnsureCapacity( nMaxNodes );
+		m_NodeMaxs[i].EnsureCapacity( nMaxNodes );
+	}
+	m_NodeSkip.EnsureCapacity( nMaxNodes );
+	m_NodeFirst.EnsureCapacity( nMaxNodes );
+	m_NodeCount.EnsureCapacity( nMaxNodes );
+
+	BuildNode( 0, nCount, pMins, pMaxs );
+
+	m_ItemMins.SetCount( nCount );
+	m_ItemMaxs.SetCount( nCount );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		m_ItemMins[i] = pMins[m_Items[i]];
+		m_ItemMaxs[i] = pMaxs[m_Items[i]];
+	}
+}
+
+void CStaticPropBVH::BuildNode( int nFirst, int nCount, const Vector *pMins, const Vector *pMaxs )
+{
+	int *pItems = m_Items.Base() + nFirst;
+
+	Vector vecMins = pMins[pItems[0]], vecMaxs = pMaxs[pItems[0]];
+	Vector vecCenterMins = ( vecMins + vecMaxs ) * 0.5f, vecCenterMaxs = vecCenterMins;
+	for ( int i = 1; i < nCount; ++i )
+	{
+		VectorMin( vecMins, pMins[pItems[i]], vecMins );
+		VectorMax( vecMaxs, pMaxs[pItems[i]], vecMaxs );
+
+		Vector vecCenter = ( pMins[pItems[i]] + pMaxs[pItems[i]] ) * 0.5f;
+		VectorMin( vecCenterMins, vecCenter, vecCenterMins );
+		VectorMax( vecCenterMaxs, vecCenter, vecCenterMaxs );
+	}
+
+	int iNode = m_NodeSkip.AddToTail();
+	m_NodeFirst.AddToTail( nFirst );
+	m_NodeCount.AddToTail( 0 );
+	for ( int i = 0; i < 3; ++i )
+	{
+		m_NodeMins[i].AddToTail( QuantizeDown( vecMins[i], i ) );
+		m_NodeMaxs[i].AddToTail( QuantizeUp( vecMaxs[i], i ) );
+	}
+
+	if ( nCount <= MAX_LEAF_ITEMS )
+	{
+		m_NodeCount[iNode] = static_cast<unsigned char>( nCount );
+		m_NodeSkip[iNode] = iNode + 1;
+		return;
+	}
+
+	// Split at the median center along the widest axis of the centers.
+	Vector vecCenterExtent = vecCenterMaxs - vecCenterMins;
+	int nAxis = ( vecCenterExtent.x >= vecCenterExtent.y ) ? 0 : 1;
+	if ( vecCenterExtent.z > vecCenterExtent[nAxis] )
+	{
+		nAxis = 2;
+	}
+
+	int nLeft = nCount / 2;
+	std::nth_element( pItems, pItems + nLeft, pItems + nCount, [pMins, pMaxs, nAxis]( int a, int b )
+	{
+		return ( pMins[a][nAxis] + pMaxs[a][nAxis] ) < ( pMins[b][nAxis] + pMaxs[b][nAxis] );
+	} );
+
+	BuildNode( nFirst, nLeft, pMins, pMaxs );
+	BuildNode( nFirst + nLeft, nCount - nLeft, pMins, pMaxs );
+	m_NodeSkip[iNode] = m_NodeSkip.Count();
+}
+
+
+//-----------------------------------------------------------------------------
+// Queries
+//-----------------------------------------------------------------------------
+void CStaticPropBVH::EnumerateInBox( const Vector &vecMins, const Vector &vecMaxs, CUtlVector<int> &items ) const
+{
+	if ( !NodeCount() || !IsBoxIntersectingBox( vecMins, vecMaxs, m_vecMins, m_vecMaxs ) )
+		return;
+
+	unsigned short nMins[3], nMaxs[3];
+	for ( int i = 0; i < 3; ++i )
+	{
+		nMins[i] = QuantizeDown( vecMins[i], i );
+		nMaxs[i] = QuantizeUp( vecMaxs[i], i );
+	}
+
+	const int nNodes = NodeCount();
+	for ( int iNode = 0; iNode < nNodes; )
+	{
+		if ( ( m_NodeMins[0][iNode] > nMaxs[0] ) || ( m_NodeMaxs[0][iNode] < nMins[0] ) ||
+			 ( m_NodeMins[1][iNode] > nMaxs[1] ) || ( m_NodeMaxs[1][iNode] < nMins[1] ) ||
+			 ( m_NodeMins[2][iNode] > nMaxs[2] ) || ( m_NodeMaxs[2][iNode] < nMins[2] ) )
+		{
+			iNode = m_NodeSkip[iNode];
+			continue;
+		}
+
+		for ( int i = m_NodeFirst[iNode], nEnd = i + m_NodeCount[iNode]; i < nEnd; ++i )
+		{
+			if ( IsBoxIntersectingBox( m_ItemMins[i], m_ItemMaxs[i], vecMins, vecMaxs ) )
+			{
+				items.AddToTail( m_Items[i] );
+			}
+		}
+		++iNode;
+	}
+}
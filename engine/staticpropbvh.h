@@ -0,0 +1,64 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Flat bounding volume hierarchy over the static props of a map
+//
+//=============================================================================//
+
+#ifndef STATICPROPBVH_H
+#define STATICPROPBVH_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "mathlib/vector.h"
+#include "tier1/utlvector.h"
+
+
+//-----------------------------------------------------------------------------
+// Built once when the map loads. Nodes are stored depth first as SoA arrays
+// of bounds quantized to 16 bits inside the bounds of all items, so a query
+// walks them front to back without a stack: a node that misses jumps past
+// its subtree. Items keep their exact bounds for the final test.
+//-----------------------------------------------------------------------------
+class CStaticPropBVH
+{
+public:
+	CStaticPropBVH();
+
+	// Builds the tree over nCount boxes, item i is pMins[i]..pMaxs[i]
+	void Build( const Vector *pMins, const Vector *pMaxs, int nCount );
+	void Purge();
+
+	int NodeCount() const { return m_NodeSkip.Count(); }
+
+	// Adds the items whose boxes intersect vecMins..vecMaxs to items
+	void EnumerateInBox( const Vector &vecMins, const Vector &vecMaxs, CUtlVector<int> &items ) const;
+
+private:
+	enum
+	{
+		MAX_LEAF_ITEMS = 4,
+	};
+
+	void BuildNode( int nFirst, int nCount, const Vector *pMins, const Vector *pMaxs );
+	unsigned short QuantizeDown( float flValue, int nAxis ) const;
+	unsigned short QuantizeUp( float flValue, int nAxis ) const;
+
+	Vector					m_vecMins;			// Bounds of all items, the quantization range
+	Vector					m_vecMaxs;
+	Vector					m_vecScale;			// 65535 / extent
+
+	// Nodes, depth first
+	CUtlVector<unsigned short>	m_NodeMins[3];
+	CUtlVector<unsigned short>	m_NodeMaxs[3];
+	CUtlVector<int>			m_NodeSkip;			// First node after the subtree
+	CUtlVector<int>			m_NodeFirst;		// First item of a leaf
+	CUtlVector<unsigned char>	m_NodeCount;		// Items of a leaf, 0 for inner nodes
+
+	// Items in leaf order
+	CUtlVector<int>			m_Items;
+	CUtlVector<Vector>		m_ItemMins;
+	CUtlVector<Vector>		m_ItemMaxs;
+};
+
+#endif // STATICPROPBVH_H
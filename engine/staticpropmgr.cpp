@@ -11,6 +11,7 @@
 
 
 #include "staticpropmgr.h"
+#include "staticpropbvh.h"
 #include "convar.h"
 #include "vcollide_parse.h"
 #include "engine/ICollideable.h"
@@ -398,6 +399,9 @@ private:
 	void UnserializeModels( CUtlBuffer& buf );
 	void UnserializeStaticProps();
 
+	// Flattens the prop bounds and leaf lists for queries
+	void BuildStaticPropQueryData();
+
 	int HandleEntityToIndex( IHandleEntity *pHandleEntity ) const;
 
 	// Computes fade from screen-space fading
@@ -434,6 +438,14 @@ private:
 	CUtlVector <CStaticProp>		m_StaticProps;
 	CUtlVector <StaticPropLeafLump_t> m_StaticPropLeaves;
 
+	// Bounds of all static props, built at level init
+	CStaticPropBVH					m_StaticPropBVH;
+
+	// Unique clusters touched by each prop, prop i owns
+	// m_StaticPropClusters[m_StaticPropFirstCluster[i]..m_StaticPropFirstCluster[i+1]-1]
+	CUtlVector<int>					m_StaticPropClusters;
+	CUtlVector<int>					m_StaticPropFirstCluster;
+
 	// Static props that fade...
 	CUtlVector<StaticPropFade_t>	m_StaticPropFade;
 
@@ -1448,6 +1460,60 @@ void CStaticPropMgr::UnserializeStaticProps()
 }
 
 
+//-----------------------------------------------------------------------------
+// Builds the bounds hierarchy used by the box queries, and the cluster list
+// of every prop so PVS tests don't go through the leaves
+//-----------------------------------------------------------------------------
+void CStaticPropMgr::BuildStaticPropQueryData()
+{
+	COM_TimestampedLog( "BuildStaticPropQueryData - start" );
+
+	const intp nProps = m_StaticProps.Count();
+
+	CUtlVector<Vector> propMins, propMaxs;
+	propMins.SetCount( nProps );
+	propMaxs.SetCount( nProps );
+	for ( intp i = 0; i < nProps; ++i )
+	{
+		m_StaticProps[i].WorldSpaceSurroundingBounds( &propMins[i], &propMaxs[i] );
+	}
+	m_StaticPropBVH.Build( propMins.Base(), propMaxs.Base(), static_cast<int>( nProps ) );
+
+	m_StaticPropFirstCluster.SetCount( nProps + 1 );
+	m_StaticPropClusters.EnsureCapacity( m_StaticPropLeaves.Count() );
+	for ( intp i = 0; i < nProps; ++i )
+	{
+		const CStaticProp &prop = m_StaticProps[i];
+		const int nFirst = m_StaticPropClusters.Count();
+		m_StaticPropFirstCluster[i] = nFirst;
+
+		const int nEnd = prop.FirstLeaf() + prop.LeafCount();
+		for ( int j = prop.FirstLeaf(); j < nEnd; ++j )
+		{
+			Assert( j >= 0 && j < m_StaticPropLeaves.Count() );
+			const int nCluster = CM_LeafCluster( m_StaticPropLeaves[j].m_Leaf );
+			if ( nCluster < 0 )
+				continue;
+
+			// Props touch a handful of leaves, a linear search is fine.
+			int k;
+			for ( k = nFirst; k < m_StaticPropClusters.Count(); ++k )
+			{
+				if ( m_StaticPropClusters[k] == nCluster )
+					break;
+			}
+			if ( k == m_StaticPropClusters.Count() )
+			{
+				m_StaticPropClusters.AddToTail( nCluster );
+			}
+		}
+	}
+	m_StaticPropFirstCluster[nProps] = m_StaticPropClusters.Count();
+
+	COM_TimestampedLog( "BuildStaticPropQueryData - end" );
+}
+
+
 //-----------------------------------------------------------------------------
 // Level init, shutdown
 //-----------------------------------------------------------------------------
@@ -1461,6 +1527,7 @@ void CStaticPropMgr::LevelInit()
 
 	// Read in static props that have been compiled into the bsp file
 	UnserializeStaticProps();
+	BuildStaticPropQueryData();
 
 	//	OutputLevelStats();
 }
@@ -1486,6 +1553,9 @@ void CStaticPropMgr::LevelShutdown()
 	m_StaticProps.Purge();
 	m_StaticPropDict.Purge();
 	m_StaticPropFade.Purge();
+	m_StaticPropBVH.Purge();
+	m_StaticPropClusters.Purge();
+	m_StaticPropFirstCluster.Purge();
 }
 
 void CStaticPropMgr::LevelInitClient()
@@ -1503,7 +1573,10 @@ void CStaticPropMgr::LevelInitClient()
 	Assert( !m_bClientInitialized );
 
 	// Since the client will be ready at a later time than the server
-	// to set up its data, we need a separate call to handle that
+	// to set up its data, we need a separate call to handle that.
+	// Visibility culling stays with the client leaf system: it only reaches
+	// a prop through the visible leaves it is added to here, so the prop BVH
+	// would not save it any work.
 	for ( auto &prop : m_StaticProps )
 	{
 		clientleafsystem->CreateRenderableHandle( &prop, true );
@@ -1622,25 +1695,16 @@ void CStaticPropMgr::GetAllStaticProps( CUtlVector<ICollideable *> *pOutput )
 void CStaticPropMgr::GetAllStaticPropsInAABB( const Vector &vMins, const Vector &vMaxs, CUtlVector<ICollideable *> *pOutput )
 {
 	if ( pOutput == NULL ) return;
-	intp iPropVectorSize = m_StaticProps.Count();
 
-	intp counter;
-	for ( counter = 0; counter != iPropVectorSize; ++counter )
-	{
-		CStaticProp *pProp = &m_StaticProps[counter];
-
-		Vector vPropMins, vPropMaxs;
-		pProp->WorldSpaceSurroundingBounds( &vPropMins, &vPropMaxs );
+	CUtlVector<int> props( 0, 64 );
+	m_StaticPropBVH.EnumerateInBox( vMins, vMaxs, props );
 
-		if( vPropMaxs.x < vMins.x ) continue;
-		if( vPropMaxs.y < vMins.y ) continue;
-		if( vPropMaxs.z < vMins.z ) continue;
+	// Callers got props in lump order before the tree, keep it.
+	props.Sort();
 
-		if( vPropMins.x > vMaxs.x ) continue;
-		if( vPropMins.y > vMaxs.y ) continue;
-		if( vPropMins.z > vMaxs.z ) continue;
-
-		pOutput->AddToTail( pProp );
+	FOR_EACH_VEC( props, i )
+	{
+		pOutput->AddToTail( &m_StaticProps[props[i]] );
 	}
 }
 
@@ -1692,24 +1756,13 @@ void CStaticPropMgr::GetAllStaticPropsInOBB( const Vector &ptOrigin, const Vecto
 	vOBBPlaneNormals[5] = -vOBBPlaneNormals[4];
 	fOBBPlaneDists[5] = vOBBPlaneNormals[5].Dot( ptOrigin );
 
-	intp iPropVectorSize = m_StaticProps.Count();
+	CUtlVector<int> props( 0, 64 );
+	m_StaticPropBVH.EnumerateInBox( vAABBMins, vAABBMaxs, props );
+	props.Sort();
 
-	for ( counter = 0; counter != iPropVectorSize; ++counter )
+	FOR_EACH_VEC( props, iProp )
 	{
-		CStaticProp *pProp = &m_StaticProps[counter];
-
-		Vector vPropMins, vPropMaxs;
-		pProp->WorldSpaceSurroundingBounds( &vPropMins, &vPropMaxs );
-
-		if( vPropMaxs.x < vAABBMins.x ) continue;
-		if( vPropMaxs.y < vAABBMins.y ) continue;
-		if( vPropMaxs.z < vAABBMins.z ) continue;
-
-		if( vPropMins.x > vAABBMaxs.x ) continue;
-		if( vPropMins.y > vAABBMaxs.y ) continue;
-		if( vPropMins.z > vAABBMaxs.z ) continue;
-
-
+		CStaticProp *pProp = &m_StaticProps[props[iProp]];
 
 		//static prop AABB and desired AABB intersect, do OBB tests
 
@@ -1830,15 +1883,11 @@ bool CStaticPropMgr::IsPropInPVS( IHandleEntity *pHandleEntity, const byte *pVis
 	// Strip off the bits
 	int nIndex = HandleEntityToIndex( pHandleEntity );
 
-	// Get the prop
-	const CStaticProp &prop = m_StaticProps[nIndex];
-
-	int i;
-	int end = prop.FirstLeaf() + prop.LeafCount();
-	for( i = prop.FirstLeaf(); i < end; i++ )
+	// Clusters of the prop, cooked at level init
+	int end = m_StaticPropFirstCluster[nIndex + 1];
+	for( int i = m_StaticPropFirstCluster[nIndex]; i < end; i++ )
 	{
-		Assert( i >= 0 && i < m_StaticPropLeaves.Count() );
-		int clusterID = CM_LeafCluster( m_StaticPropLeaves[i].m_Leaf );
+		int clusterID = m_StaticPropClusters[i];
 		if( pVis[ clusterID >> 3 ] & ( 1 << ( clusterID & 7 ) ) )
 		{
 			return true;
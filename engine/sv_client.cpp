@@ -960,7 +960,7 @@ bool CGameClient::SendSignonData( void )
 		{
 			// send client class table descriptions so it can rebuild tables
 			ConDMsg("Client sent different SendTable CRC, sending full tables.\n" );
-			m_NetChannel->SendData( sv.m_FullSendTables );
+			static_cast<CNetChan *>( m_NetChannel )->SendSharedData( sv.m_SharedSendTables );
 		}
 		else
 		{
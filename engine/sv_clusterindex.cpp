@@ -0,0 +1,257 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-cluster entity buckets used to narrow CheckTransmit input.
+//
+//=============================================================================//
+
+#include "sv_clusterindex.h"
+#include "server.h"
+#include "edict.h"
+#include "iservernetworkable.h"
+#include "tier1/convar.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static ConVar sv_transmit_clusterindex( "sv_transmit_clusterindex", "1", 0, "Only pass entities in the client PVS clusters to CheckTransmit." );
+
+CEntityClusterIndex g_EntityClusterIndex;
+
+CEntityClusterIndex::CEntityClusterIndex()
+{
+	for ( auto &e : m_Entries )
+	{
+		e.bIndexed = false;
+		e.bBucketed = false;
+		e.nClusters = 0;
+		e.nArea = 0;
+	}
+
+	m_nTick = -1;
+	m_pTickEdicts = nullptr;
+	m_nTickEdicts = 0;
+}
+
+void CEntityClusterIndex::Reset()
+{
+	for ( auto &e : m_Entries )
+	{
+		e.bIndexed = false;
+		e.bBucketed = false;
+		e.nClusters = 0;
+	}
+
+	m_ClusterBuckets.Purge();
+	m_AreaBuckets.Purge();
+	m_SharedResults.Purge();
+
+	m_nTick = -1;
+	m_pTickEdicts = nullptr;
+	m_nTickEdicts = 0;
+}
+
+void CEntityClusterIndex::AddToBucket( CUtlVector<Bucket_t> &buckets, int iBucket, int iEdict, int iSlot )
+{
+	if ( iBucket >= buckets.Count() )
+	{
+		buckets.AddMultipleToTail( iBucket + 1 - buckets.Count() );
+	}
+
+	BucketItem_t item;
+	item.iEdict = static_cast<unsigned short>( iEdict );
+	item.iSlot = static_cast<unsigned short>( iSlot );
+
+	m_Entries[iEdict].bucketPos[iSlot] = static_cast<unsigned short>( buckets[iBucket].AddToTail( item ) );
+}
+
+void CEntityClusterIndex::RemoveFromBucket( CUtlVector<Bucket_t> &buckets, int iBucket, int iEdict, int iSlot )
+{
+	Bucket_t &bucket = buckets[iBucket];
+	const intp iPos = m_Entries[iEdict].bucketPos[iSlot];
+
+	Assert( bucket[iPos].iEdict == iEdict && bucket[iPos].iSlot == iSlot );
+
+	// Last item moves into the hole
+	bucket.FastRemove( iPos );
+
+	if ( iPos < bucket.Count() )
+	{
+		const BucketItem_t &moved = bucket[iPos];
+		m_Entries[moved.iEdict].bucketPos[moved.iSlot] = static_cast<unsigned short>( iPos );
+	}
+}
+
+void CEntityClusterIndex::Unlink( int iEdict )
+{
+	Entry_t &e = m_Entries[iEdict];
+
+	if ( e.bBucketed )
+	{
+		for ( int i = 0; i < e.nClusters; ++i )
+		{
+			RemoveFromBucket( m_ClusterBuckets, e.clusters[i], iEdict, i );
+		}
+
+		RemoveFromBucket( m_AreaBuckets, e.nArea, iEdict, AREA_SLOT );
+	}
+
+	e.bIndexed = false;
+	e.bBucketed = false;
+	e.nClusters = 0;
+}
+
+void CEntityClusterIndex::Update( int iEdict, const PVSInfo_t &info )
+{
+	if ( iEdict < 0 || iEdict >= MAX_EDICTS )
+		return;
+
+	Unlink( iEdict );
+
+	Entry_t &e = m_Entries[iEdict];
+	e.bIndexed = true;
+	e.nArea = info.m_nAreaNum;
+
+	// Headnode only or too large, CheckTransmit always looks at those
+	if ( info.m_nClusterCount < 0 || info.m_nClusterCount > MAX_INDEXED_CLUSTERS || e.nArea < 0 )
+		return;
+
+	e.bBucketed = true;
+	e.nClusters = info.m_nClusterCount;
+
+	for ( int i = 0; i < e.nClusters; ++i )
+	{
+		e.clusters[i] = info.m_pClusters[i];
+		AddToBucket( m_ClusterBuckets, e.clusters[i], iEdict, i );
+	}
+
+	AddToBucket( m_AreaBuckets, e.nArea, iEdict, AREA_SLOT );
+}
+
+void CEntityClusterIndex::Remove( int iEdict )
+{
+	if ( iEdict < 0 || iEdict >= MAX_EDICTS )
+		return;
+
+	Unlink( iEdict );
+}
+
+void CEntityClusterIndex::BuildTickState( const unsigned short *pEdictIndices, int nEdicts )
+{
+	m_nTick = sv.m_nTickCount;
+	m_pTickEdicts = pEdictIndices;
+	m_nTickEdicts = nEdicts;
+
+	m_TickValid.ClearAll();
+	m_TickAlways.ClearAll();
+	m_SharedResults.RemoveAll();
+
+	for ( int i = 0; i < nEdicts; ++i )
+	{
+		const int iEdict = pEdictIndices[i];
+		m_TickValid.Set( iEdict );
+
+		const int nFlags = sv.edicts[iEdict].m_fStateFlags;
+
+		// CheckTransmit skips them
+		if ( nFlags & FL_EDICT_DONTSEND )
+			continue;
+
+		const Entry_t &e = m_Entries[iEdict];
+
+		// Anything but a plain PVS check, stale PVS info or a network parent
+		// needs the full CheckTransmit treatment.
+		const bool bPVSOnly = ( nFlags & ( FL_EDICT_ALWAYS | FL_EDICT_PVSCHECK ) ) == FL_EDICT_PVSCHECK;
+		if ( !bPVSOnly || !e.bBucketed ||
+			 ( nFlags & ( FL_EDICT_DIRTY_PVS_INFORMATION | FL_EDICT_NETWORK_CHILD ) ) )
+		{
+			m_TickAlways.Set( iEdict );
+		}
+	}
+}
+
+int CEntityClusterIndex::GetTransmitCandidates( const CCheckTransmitInfo *pInfo, int nSkyboxArea,
+	const unsigned short *pEdictIndices, int nEdicts, unsigned short *pOutEdicts )
+{
+	if ( !sv_transmit_clusterindex.GetBool() )
+		return -1;
+
+	if ( m_nTick != sv.m_nTickCount || m_pTickEdicts != pEdictIndices || m_nTickEdicts != nEdicts )
+	{
+		BuildTickState( pEdictIndices, nEdicts );
+	}
+
+	const int nPVSSize = clamp( pInfo->m_nPVSSize, 0, static_cast<int>( sizeof( pInfo->m_PVS ) ) );
+	const CRC32_t crc = CRC32_ProcessSingleBuffer( pInfo->m_PVS, nPVSSize );
+
+	// Clients in the same cluster usually have the same PVS
+	for ( const auto &shared : m_SharedResults )
+	{
+		if ( shared.crc == crc && shared.nSkyboxArea == nSkyboxArea && shared.pvs.Count() == nPVSSize &&
+			 !memcmp( shared.pvs.Base(), pInfo->m_PVS, nPVSSize ) )
+		{
+			memcpy( pOutEdicts, shared.edicts.Base(), shared.edicts.Count() * sizeof( unsigned short ) );
+			return shared.edicts.Count();
+		}
+	}
+
+	CBitVec<MAX_EDICTS> candidates;
+	m_TickAlways.CopyTo( &candidates );
+
+	const int nClusterBuckets = m_ClusterBuckets.Count();
+
+	for ( int iByte = 0; iByte < nPVSSize; ++iByte )
+	{
+		unsigned int bits = pInfo->m_PVS[iByte];
+
+		for ( int iBit = 0; bits; ++iBit, bits >>= 1 )
+		{
+			if ( !( bits & 1 ) )
+				continue;
+
+			const int iCluster = iByte * 8 + iBit;
+			if ( iCluster >= nClusterBuckets )
+				break;
+
+			for ( const auto &item : m_ClusterBuckets[iCluster] )
+			{
+				candidates.Set( item.iEdict );
+			}
+		}
+	}
+
+	// CheckTransmit sends everything in the player's 3d skybox
+	if ( nSkyboxArea >= 0 && nSkyboxArea < m_AreaBuckets.Count() )
+	{
+		for ( const auto &item : m_AreaBuckets[nSkyboxArea] )
+		{
+			candidates.Set( item.iEdict );
+		}
+	}
+
+	// Keep the snapshot order, which is ascending.
+	int nCount = 0;
+
+	for ( int iWord = 0; iWord < candidates.GetNumDWords(); ++iWord )
+	{
+		uint32 bits = candidates.GetDWord( iWord ) & m_TickValid.GetDWord( iWord );
+
+		for ( int iBit = 0; bits; ++iBit, bits >>= 1 )
+		{
+			if ( bits & 1 )
+			{
+				pOutEdicts[nCount++] = static_cast<unsigned short>( iWord * 32 + iBit );
+			}
+		}
+	}
+
+	if ( m_SharedResults.Count() < MAX_SHARED_RESULTS )
+	{
+		SharedResult_t &shared = m_SharedResults[ m_SharedResults.AddToTail() ];
+		shared.crc = crc;
+		shared.nSkyboxArea = nSkyboxArea;
+		shared.pvs.CopyArray( pInfo->m_PVS, nPVSSize );
+		shared.edicts.CopyArray( pOutEdicts, nCount );
+	}
+
+	return nCount;
+}
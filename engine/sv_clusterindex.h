@@ -0,0 +1,105 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-cluster entity buckets used to narrow CheckTransmit input.
+//
+//=============================================================================//
+
+#ifndef SV_CLUSTERINDEX_H
+#define SV_CLUSTERINDEX_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+#include "tier1/checksum_crc.h"
+#include "tier1/utlvector.h"
+#include "bitvec.h"
+#include "const.h"
+
+struct PVSInfo_t;
+class CCheckTransmitInfo;
+
+//-----------------------------------------------------------------------------
+// Keeps, for every visible cluster and every area, the edicts touching it.
+//
+// Entries are updated from CVEngineServer::BuildEntityClusterList, which the
+// game calls when an entity changed leaves (FL_EDICT_DIRTY_PVS_INFORMATION),
+// and dropped when the edict is freed. Entities spanning more clusters than
+// an entry holds, or only known by headnode, are not bucketed.
+//
+// GetTransmitCandidates() returns the entities CheckTransmit has to look at
+// for a PVS: everything in visible clusters and in the skybox area, plus all
+// entities whose transmit state does not depend on the PVS alone. Results are
+// shared by clients with the same PVS during a tick.
+//-----------------------------------------------------------------------------
+class CEntityClusterIndex
+{
+public:
+	CEntityClusterIndex();
+
+	// Drops all entries, called when edicts are (re)allocated for a map.
+	void	Reset();
+
+	void	Update( int iEdict, const PVSInfo_t &info );
+	void	Remove( int iEdict );
+
+	// Returns the number of edicts written to pOutEdicts, in pEdictIndices
+	// order, or -1 if the index is disabled.
+	int		GetTransmitCandidates( const CCheckTransmitInfo *pInfo, int nSkyboxArea,
+				const unsigned short *pEdictIndices, int nEdicts, unsigned short *pOutEdicts );
+
+private:
+	enum
+	{
+		MAX_INDEXED_CLUSTERS = 8,	// more and the entity is always a candidate
+		AREA_SLOT = MAX_INDEXED_CLUSTERS,
+		MAX_SHARED_RESULTS = 32,	// distinct PVS per tick
+	};
+
+	struct BucketItem_t
+	{
+		unsigned short	iEdict;
+		unsigned short	iSlot;		// slot in Entry_t
+	};
+
+	struct Entry_t
+	{
+		bool			bIndexed;
+		bool			bBucketed;	// false if too many clusters or headnode only
+		unsigned short	nClusters;
+		unsigned short	clusters[ MAX_INDEXED_CLUSTERS ];
+		short			nArea;
+		unsigned short	bucketPos[ MAX_INDEXED_CLUSTERS + 1 ];	// position in each bucket, last one is the area
+	};
+
+	struct SharedResult_t
+	{
+		CRC32_t						crc;
+		int							nSkyboxArea;
+		CUtlVector<byte>			pvs;
+		CUtlVector<unsigned short>	edicts;
+	};
+
+	typedef CUtlVector<BucketItem_t> Bucket_t;
+
+	void	Unlink( int iEdict );
+	void	AddToBucket( CUtlVector<Bucket_t> &buckets, int iBucket, int iEdict, int iSlot );
+	void	RemoveFromBucket( CUtlVector<Bucket_t> &buckets, int iBucket, int iEdict, int iSlot );
+	void	BuildTickState( const unsigned short *pEdictIndices, int nEdicts );
+
+	Entry_t					m_Entries[ MAX_EDICTS ];
+	CUtlVector<Bucket_t>	m_ClusterBuckets;
+	CUtlVector<Bucket_t>	m_AreaBuckets;
+
+	// Per tick state, rebuilt when the tick or the valid entity list changes.
+	int							m_nTick;
+	const unsigned short		*m_pTickEdicts;
+	int							m_nTickEdicts;
+	CBitVec<MAX_EDICTS>			m_TickValid;		// in the snapshot
+	CBitVec<MAX_EDICTS>			m_TickAlways;		// candidate regardless of the PVS
+	CUtlVector<SharedResult_t>	m_SharedResults;
+};
+
+extern CEntityClusterIndex g_EntityClusterIndex;
+
+#endif // SV_CLUSTERINDEX_H
@@ -0,0 +1,156 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-tick cache of encoded entity delta bit streams shared by all
+//			clients of the game server.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "server_pch.h"
+#include "sv_deltacache.h"
+#include "packed_entity.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static ConVar sv_deltacache( "sv_deltacache", "4096", 0, "Size in KB of the per-tick delta entity bit stream cache shared by all clients (0 = off)", true, 0, true, 65536 );
+
+CSharedDeltaEntityCache g_SharedDeltaCache;
+
+CSharedDeltaEntityCache::CSharedDeltaEntityCache()
+{
+	m_nTick = -1;
+	m_nMaxEntities = 0;
+	m_nCacheSize = 0;
+}
+
+CSharedDeltaEntityCache::~CSharedDeltaEntityCache()
+{
+	Flush();
+}
+
+void CSharedDeltaEntityCache::Flush()
+{
+	for ( int i=0; i<m_nMaxEntities; i++ )
+	{
+		DeltaEntityEntry_s *pEntry = m_Cache[i];
+
+		while ( pEntry )
+		{
+			DeltaEntityEntry_s *pNext = pEntry->pNext;
+			free( pEntry );
+			pEntry = pNext;
+		}
+
+		m_Cache[i] = NULL;
+	}
+
+	m_nTick = -1;
+	m_nMaxEntities = 0;
+	m_nCacheSize = 0;
+	m_nBytesUsed = 0;
+}
+
+void CSharedDeltaEntityCache::SetTick( int nTick, int nMaxEntities )
+{
+	if ( nTick == m_nTick )
+		return;
+
+	Flush();
+
+	m_nTick = nTick;
+	m_nCacheSize = sv_deltacache.GetInt() * 1024;
+
+	if ( m_nCacheSize <= 0 )
+		return;
+
+	m_nMaxEntities = min( nMaxEntities, MAX_EDICTS );
+}
+
+const unsigned char* CSharedDeltaEntityCache::FindDeltaBits( int nEntityIndex, int nFromTick, const PackedEntity *pFromPack, const PackedEntity *pToPack, int &nBits )
+{
+	nBits = -1;
+
+	if ( nEntityIndex < 0 || nEntityIndex >= m_nMaxEntities )
+		return NULL;
+
+	for ( DeltaEntityEntry_s *pEntry = m_Cache[nEntityIndex]; pEntry; pEntry = pEntry->pNext )
+	{
+		if ( pEntry->nFromTick == nFromTick &&
+			 pEntry->pFromPack == pFromPack &&
+			 pEntry->pToPack == pToPack )
+		{
+			++m_nHits;
+			nBits = pEntry->nBits;
+			return (unsigned char*)(pEntry) + sizeof(DeltaEntityEntry_s);
+		}
+	}
+
+	++m_nMisses;
+	return NULL;
+}
+
+void CSharedDeltaEntityCache::AddDeltaBits( int nEntityIndex, int nFromTick, const PackedEntity *pFromPack, const PackedEntity *pToPack, int nBits, const bf_write *pStart )
+{
+	if ( nEntityIndex < 0 || nEntityIndex >= m_nMaxEntities )
+		return;
+
+	const int nBufferSize = PAD_NUMBER( Bits2Bytes(nBits), 4 );
+	const int nEntrySize = nBufferSize + static_cast<int>(sizeof(DeltaEntityEntry_s));
+
+	// reserve room in the budget, another worker may be adding at the same time
+	for ( ;; )
+	{
+		int nUsed = m_nBytesUsed;
+
+		if ( nUsed + nEntrySize > m_nCacheSize )
+			return; // cache is full for this tick
+
+		if ( m_nBytesUsed.AssignIfWeak( nUsed, nUsed + nEntrySize ) )
+			break;
+	}
+
+	DeltaEntityEntry_s *pEntry = (DeltaEntityEntry_s *) malloc( nEntrySize );
+	if ( !pEntry )
+		return;
+
+	pEntry->pFromPack = pFromPack;
+	pEntry->pToPack = pToPack;
+	pEntry->nFromTick = nFromTick;
+	pEntry->nBits = nBits;
+
+	if ( nBits > 0 )
+	{
+		bf_read  inBuffer;
+		inBuffer.StartReading( pStart->GetData(), pStart->m_nDataBytes, pStart->GetNumBitsWritten() );
+		bf_write outBuffer( (char*)(pEntry) + sizeof(DeltaEntityEntry_s), nBufferSize );
+		outBuffer.WriteBitsFromBuffer( &inBuffer, nBits );
+	}
+
+	// Publish the entry. Two workers may race to add the same delta, both entries are
+	// identical so it doesn't matter which one is found later.
+	for ( ;; )
+	{
+		DeltaEntityEntry_s *pHead = m_Cache[nEntityIndex];
+		pEntry->pNext = pHead;
+
+		if ( m_Cache[nEntityIndex].AssignIf( pHead, pEntry ) )
+			break;
+	}
+}
+
+void CSharedDeltaEntityCache::PrintStats() const
+{
+	const int nHits = m_nHits;
+	const int nMisses = m_nMisses;
+	const int nTotal = nHits + nMisses;
+
+	ConMsg( "Delta cache: %d hits, %d misses (%.1f%% hit rate), %d / %d bytes used at tick %d.\n",
+		nHits, nMisses, nTotal ? nHits * 100.0f / nTotal : 0.0f,
+		m_nBytesUsed.GetRaw(), m_nCacheSize, m_nTick );
+}
+
+CON_COMMAND( sv_deltacache_stats, "Print shared delta entity cache statistics" )
+{
+	g_SharedDeltaCache.PrintStats();
+}
@@ -0,0 +1,77 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-tick cache of encoded entity delta bit streams shared by all
+//			clients of the game server.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef SV_DELTACACHE_H
+#define SV_DELTACACHE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "const.h"
+#include "tier0/threadtools.h"
+
+class bf_write;
+class PackedEntity;
+
+
+//-----------------------------------------------------------------------------
+// Many clients usually ack the same snapshot, so the delta between the same
+// two PackedEntity versions gets encoded over and over in WriteDeltaEntities.
+// This cache stores each (entity, from tick, to tick) delta once.
+//
+// Entries are immutable once published and are pushed onto per-entity lists
+// with an interlocked compare-exchange, so FindDeltaBits / AddDeltaBits may be called
+// from the SV_ParallelSendSnapshot workers. SetTick and Flush must only be
+// called from the main thread while no snapshot is being written.
+//-----------------------------------------------------------------------------
+class CSharedDeltaEntityCache
+{
+	struct DeltaEntityEntry_s
+	{
+		DeltaEntityEntry_s	*pNext;
+		const PackedEntity	*pFromPack;
+		const PackedEntity	*pToPack;
+		int					nFromTick;
+		int					nBits;
+	};
+
+public:
+	CSharedDeltaEntityCache();
+	~CSharedDeltaEntityCache();
+
+	// Drops all entries if nTick differs from the current tick.
+	void	SetTick( int nTick, int nMaxEntities );
+	void	Flush();
+
+	// Is the cache collecting deltas towards snapshot nToTick?
+	bool	IsActiveForTick( int nToTick ) const { return m_nCacheSize > 0 && m_nTick == nToTick; }
+
+	// Returns cached bits or NULL if not found. nBits == 0 means no props changed.
+	const unsigned char *FindDeltaBits( int nEntityIndex, int nFromTick, const PackedEntity *pFromPack, const PackedEntity *pToPack, int &nBits );
+
+	// pStart is a copy of the output buffer taken before the props were written.
+	void	AddDeltaBits( int nEntityIndex, int nFromTick, const PackedEntity *pFromPack, const PackedEntity *pToPack, int nBits, const bf_write *pStart );
+
+	void	PrintStats() const;
+
+private:
+	int		m_nTick;		// snapshot tick the cached deltas are encoded towards
+	int		m_nMaxEntities;	// max entities = length of cache
+	int		m_nCacheSize;	// byte budget for this tick
+
+	CInterlockedInt	m_nBytesUsed;
+	CInterlockedInt	m_nHits;
+	CInterlockedInt	m_nMisses;
+
+	CInterlockedPtr<DeltaEntityEntry_s> m_Cache[MAX_EDICTS]; // array of pointers to delta entries
+};
+
+extern CSharedDeltaEntityCache g_SharedDeltaCache;
+
+
+#endif // SV_DELTACACHE_H
@@ -21,6 +21,7 @@
 #include "replayserver.h"
 #include "tier0/vcrmode.h"
 #include "framesnapshot.h"
+#include "sv_deltacache.h"
 
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -77,6 +78,8 @@ public:
 
 	int				m_nFullProps;	// number of properties send as full update (Enter PVS)
 	bool			m_bCullProps;	// filter props by clients in recipient lists
+	bool			m_bSharedDelta;	// current entity delta is the same for all clients, use g_SharedDeltaCache
+	bool			m_bClientBaseline;	// an entity was sent from the client baseline (or its absence)
 	
 	/* Some profiling data
 	int				m_nTotalGap;
@@ -281,8 +284,8 @@ static inline void SV_WritePropsFromPackedEntity(
 
 
 	// cull properties that are removed by SendProxies for this client.
-	// don't do that for HLTV relay proxies
-	if ( u.m_bCullProps )
+	// don't do that for HLTV relay proxies or if no proxy excludes any client
+	if ( u.m_bCullProps && !u.m_bSharedDelta )
 	{
 		sendProps = pSendProps;
 
@@ -304,7 +307,7 @@ static inline void SV_WritePropsFromPackedEntity(
 	}
 	else
 	{
-		// this is a HLTV relay proxy
+		// this is a HLTV relay proxy or a delta shared by all clients
 		bufStart = *u.m_pBuf;
 	}
 		
@@ -319,7 +322,13 @@ static inline void SV_WritePropsFromPackedEntity(
 		nSendProps
 		);
 
-	if ( !u.m_bCullProps && hltv )
+	if ( u.m_bSharedDelta )
+	{
+		// same bits for every client, cache them for the others
+		intp nBits = u.m_pBuf->GetNumBitsWritten() - bufStart.GetNumBitsWritten();
+		g_SharedDeltaCache.AddDeltaBits( pTo->m_nEntityIndex, u.m_pFromSnapshot->m_nTickCount, pFrom, pTo, nBits, &bufStart );
+	}
+	else if ( !u.m_bCullProps && hltv )
 	{
 		// this is a HLTV relay proxy, cache delta bits
 		intp nBits = u.m_pBuf->GetNumBitsWritten() - bufStart.GetNumBitsWritten();
@@ -377,8 +386,32 @@ static bool SV_NeedsExplicitCreate( CEntityWriteInfo &u )
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Can the delta of the current entity be shared with other clients
+//  through g_SharedDeltaCache? Only if no SendProxy restricted any of its
+//  datatables to some clients, since culled props differ per client.
+//-----------------------------------------------------------------------------
+static inline bool SV_CanShareDelta( const CEntityWriteInfo &u )
+{
+	// HLTV and replay have their own caches and relays don't cull
+	if ( !u.m_bCullProps || u.m_pServer->IsHLTV() || u.m_pServer->IsReplay() )
+		return false;
+
+	// DT instrumentation wants an encode event for each client
+	if ( g_bServerDTIEnabled )
+		return false;
+
+	if ( !g_SharedDeltaCache.IsActiveForTick( u.m_pToSnapshot->m_nTickCount ) )
+		return false;
+
+	return !u.m_pOldPack->HasClientSpecificRecipients() && !u.m_pNewPack->HasClientSpecificRecipients();
+}
+
+
 static inline void SV_DetermineUpdateType( CEntityWriteInfo &u )
 {
+	u.m_bSharedDelta = false;
+
 	// Figure out how we want to update the entity.
 	if( u.m_nNewEntity < u.m_nOldEntity )
 	{
@@ -452,6 +485,33 @@ static inline void SV_DetermineUpdateType( CEntityWriteInfo &u )
 	}
 #endif
 
+	u.m_bSharedDelta = SV_CanShareDelta( u );
+	if ( u.m_bSharedDelta )
+	{
+		int nSharedBits;
+		const unsigned char *pBuffer = g_SharedDeltaCache.FindDeltaBits( u.m_nNewEntity, u.m_pFromSnapshot->m_nTickCount, u.m_pOldPack, u.m_pNewPack, nSharedBits );
+
+		if ( pBuffer )
+		{
+			if ( nSharedBits > 0 )
+			{
+				// Write a header.
+				SV_WriteDeltaHeader( u, u.m_nNewEntity, FHDR_ZERO );
+
+				// another client already encoded this delta
+				u.m_pBuf->WriteBits( pBuffer, nSharedBits );
+
+				u.m_UpdateType = DeltaEnt;
+			}
+			else
+			{
+				u.m_UpdateType = PreserveEnt;
+			}
+
+			return;
+		}
+	}
+
 	int checkProps[MAX_DATATABLE_PROPS];
 	int nCheckProps = u.m_pNewPack->GetPropsChangedAfterTick( u.m_pFromSnapshot->m_nTickCount, checkProps, ARRAYSIZE( checkProps ) );
 	
@@ -520,6 +580,12 @@ static inline void SV_DetermineUpdateType( CEntityWriteInfo &u )
 	}
 	else
 	{
+		if ( u.m_bSharedDelta )
+		{
+			// no bits changed, PreserveEnt
+			g_SharedDeltaCache.AddDeltaBits( u.m_nNewEntity, u.m_pFromSnapshot->m_nTickCount, u.m_pOldPack, u.m_pNewPack, 0, NULL );
+		}
+
 #ifndef _X360
 		if ( !u.m_bCullProps )
 		{
@@ -582,6 +648,7 @@ static inline void SV_WriteEnterPVS( CEntityWriteInfo &u )
 	// Get the baseline.
 	// Since the ent is in the fullpack, then it must have either a static or an instance baseline.
 	PackedEntity *pBaseline = u.m_bAsDelta ? framesnapshotmanager->GetPackedEntity( u.m_pBaseline, u.m_nNewEntity ) : NULL;
+	u.m_bClientBaseline = true;
 	const void *pFromData;
 	int nFromBits;
 
@@ -778,7 +845,7 @@ Returns the size IN BITS of the message buffer created.
 =============
 */
 
-void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CClientFrame *from, bf_write &pBuf )
+bool CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CClientFrame *from, bf_write &pBuf )
 {
 	VPROF_BUDGET( "CBaseServer::WriteDeltaEntities", VPROF_BUDGETGROUP_OTHER_NETWORKING );
 	// Setup the CEntityWriteInfo structure.
@@ -788,6 +855,8 @@ void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CCl
 	u.m_pToSnapshot = to->GetSnapshot();
 	u.m_pBaseline = client->m_pBaseline;
 	u.m_nFullProps = 0;
+	u.m_bSharedDelta = false;
+	u.m_bClientBaseline = false;
 	u.m_pServer = this;
 	u.m_nClientEntity = client->m_nEntityIndex;
 #ifndef _XBOX
@@ -946,6 +1015,9 @@ void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CCl
 	{
 		client->TraceNetworkData( pBuf, "Delta Finish" );
 	}
+
+	// full updates are written from the instance baselines, but may become the client baseline
+	return u.m_bAsDelta && !u.m_bClientBaseline;
 }
 
 
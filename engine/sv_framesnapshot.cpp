@@ -12,6 +12,9 @@
 #include "replayserver.h"
 #endif
 #include "framesnapshot.h"
+#include "clientframe.h"
+#include "host_cmdring.h"
+#include "sv_snapshotarena.h"
 #include "sys_dll.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -22,6 +25,7 @@ DEFINE_FIXEDSIZE_ALLOCATOR( CFrameSnapshot, 64, 64 );
 
 static ConVar sv_creationtickcheck( "sv_creationtickcheck", "1", FCVAR_CHEAT | FCVAR_DEVELOPMENTONLY, "Do extended check for encoding of timestamps against tickcount" );
 extern	CGlobalVars g_ServerGlobalVariables;
+extern ConVar sv_maxreplay;
 
 // Expose interface
 static CFrameSnapshotManager g_FrameSnapshotManager;
@@ -35,6 +39,7 @@ CFrameSnapshotManager::CFrameSnapshotManager( void )
 {
 	COMPILE_TIME_ASSERT( INVALID_PACKED_ENTITY_HANDLE == 0 );
 	m_nPackedEntityCacheCounter = 0;
+	m_bDeferSnapshotDeletes = false;
 	V_memset( m_pPackedData, 0x00, sizeof(m_pPackedData) );
 	V_memset( m_pSerialNumber, 0x00, sizeof(m_pSerialNumber) );
 }
@@ -56,11 +61,25 @@ CFrameSnapshotManager::~CFrameSnapshotManager( void )
 
 void CFrameSnapshotManager::LevelChanged()
 {
+	// Run deferred snapshot deletes before checking the list is empty.
+	g_HostCommandRing.Drain();
+
 	// Clear all lists...
 	Assert( m_FrameSnapshots.Count() == 0 );
 
 	// Release the most recent snapshot...
 	m_PackedEntityCache.RemoveAll();
+
+	// No snapshot is left, so this is the last reference. Free the packed
+	// entities instead of leaking them, their data would pin arena memory.
+	for ( auto &handle : m_pPackedData )
+	{
+		if ( handle != INVALID_PACKED_ENTITY_HANDLE )
+		{
+			RemoveEntityReference( handle );
+		}
+	}
+
 	COMPILE_TIME_ASSERT( INVALID_PACKED_ENTITY_HANDLE == 0 );
 	Q_memset( m_pPackedData, 0x00, MAX_EDICTS * sizeof(PackedEntityHandle_t) );
 }
@@ -80,16 +99,41 @@ CFrameSnapshot*	CFrameSnapshotManager::NextSnapshot( const CFrameSnapshot *pSnap
 }
 
 CFrameSnapshot*	CFrameSnapshotManager::CreateEmptySnapshot( int tickcount, int maxEntities )
+{
+	return CreateSnapshot( tickcount, maxEntities, 0, false, false );
+}
+
+CFrameSnapshot*	CFrameSnapshotManager::CreateSnapshot( int tickcount, int maxEntities, int nValidEntities, bool bHLTV, bool bReplay )
 {
 	CFrameSnapshot *snap = new CFrameSnapshot;
 	snap->AddReference();
 	snap->m_nTickCount = tickcount;
 	snap->m_nNumEntities = maxEntities;
-	snap->m_nValidEntities = 0;
-	snap->m_pValidEntities = NULL;
-	snap->m_pHLTVEntityData = NULL;
-	snap->m_pReplayEntityData = NULL;
-	snap->m_pEntities = new CFrameSnapshotEntry[maxEntities];
+	snap->m_nValidEntities = nValidEntities;
+
+	// All arrays in one arena block, largest alignment first.
+	const intp nEntityBytes = AlignValue( maxEntities * sizeof(CFrameSnapshotEntry), CSnapshotArena::ALIGNMENT );
+	const intp nHLTVBytes = bHLTV ? AlignValue( nValidEntities * sizeof(CHLTVEntityData), CSnapshotArena::ALIGNMENT ) : 0;
+	const intp nReplayBytes = bReplay ? AlignValue( nValidEntities * sizeof(CReplayEntityData), CSnapshotArena::ALIGNMENT ) : 0;
+	const intp nValidBytes = nValidEntities * sizeof(unsigned short);
+
+	byte *pBlock = static_cast<byte *>( g_SnapshotArena.AllocSnapshotData( snap, nEntityBytes + nHLTVBytes + nReplayBytes + nValidBytes ) );
+	snap->m_pArenaBlock = pBlock;
+
+	if ( pBlock )
+	{
+		snap->m_pEntities = reinterpret_cast<CFrameSnapshotEntry *>( pBlock );
+		snap->m_pHLTVEntityData = bHLTV ? reinterpret_cast<CHLTVEntityData *>( pBlock + nEntityBytes ) : NULL;
+		snap->m_pReplayEntityData = bReplay ? reinterpret_cast<CReplayEntityData *>( pBlock + nEntityBytes + nHLTVBytes ) : NULL;
+		snap->m_pValidEntities = nValidEntities ? reinterpret_cast<unsigned short *>( pBlock + nEntityBytes + nHLTVBytes + nReplayBytes ) : NULL;
+	}
+	else
+	{
+		snap->m_pEntities = new CFrameSnapshotEntry[maxEntities];
+		snap->m_pHLTVEntityData = bHLTV ? new CHLTVEntityData[nValidEntities] : NULL;
+		snap->m_pReplayEntityData = bReplay ? new CReplayEntityData[nValidEntities] : NULL;
+		snap->m_pValidEntities = nValidEntities ? new unsigned short[nValidEntities] : NULL;
+	}
 
 	CFrameSnapshotEntry *entry = snap->m_pEntities;
 	
@@ -102,6 +146,16 @@ CFrameSnapshot*	CFrameSnapshotManager::CreateEmptySnapshot( int tickcount, int m
 		entry++;
 	}
 
+	if ( snap->m_pHLTVEntityData )
+	{
+		Q_memset( snap->m_pHLTVEntityData, 0, nValidEntities * sizeof(CHLTVEntityData) );
+	}
+
+	if ( snap->m_pReplayEntityData )
+	{
+		Q_memset( snap->m_pReplayEntityData, 0, nValidEntities * sizeof(CReplayEntityData) );
+	}
+
 	snap->m_ListIndex = m_FrameSnapshots.AddToTail( snap );
 	return snap;
 }
@@ -113,19 +167,25 @@ CFrameSnapshot*	CFrameSnapshotManager::CreateEmptySnapshot( int tickcount, int m
 CFrameSnapshot* CFrameSnapshotManager::TakeTickSnapshot( int tickcount )
 {
 	unsigned short nValidEntities[MAX_EDICTS];
+	int nValid = 0;
 
-	CFrameSnapshot *snap = CreateEmptySnapshot( tickcount, sv.num_edicts );
+	// Everything allocated for this tick goes to a new arena generation. Blocks
+	// stay in place as long as a client may still ack or replay their tick.
+	int nWindow = MAX_CLIENT_FRAMES;
+	if ( sv_maxreplay.GetFloat() > 0 )
+	{
+		nWindow += static_cast<int>( ceilf( sv_maxreplay.GetFloat() / sv.GetTickInterval() ) );
+	}
+	g_SnapshotArena.BeginGeneration( tickcount, nWindow );
 	
 	intp maxclients = sv.GetClientCount();
 
-	CFrameSnapshotEntry *entry = snap->m_pEntities - 1;
 	edict_t *edict= sv.edicts - 1;
 	
-	// Build the snapshot.
+	// Find the entities in the snapshot.
 	for ( int i = 0; i < sv.num_edicts; i++ )
 	{
 		edict++;
-		entry++;
 
 		IServerUnknown *pUnk = edict->GetUnknown();
 
@@ -148,28 +208,33 @@ CFrameSnapshot* CFrameSnapshotManager::TakeTickSnapshot( int tickcount )
 		Assert( edict->GetNetworkable() );
 		Assert( edict->GetNetworkable()->GetServerClass() );
 
-		entry->m_nSerialNumber	= edict->m_NetworkSerialNumber;
-		entry->m_pClass			= edict->GetNetworkable()->GetServerClass();
-		nValidEntities[snap->m_nValidEntities++] = i;
+		nValidEntities[nValid++] = i;
 	}
 
-	// create dynamic valid entities array and copy indices
-	snap->m_pValidEntities = new unsigned short[snap->m_nValidEntities];
-	Q_memcpy( snap->m_pValidEntities, nValidEntities, snap->m_nValidEntities * sizeof(unsigned short) );
+	const bool bHLTV = hltv && hltv->IsActive();
+#if defined( REPLAY_ENABLED )
+	const bool bReplay = replay && replay->IsActive();
+#else
+	const bool bReplay = false;
+#endif
+
+	CFrameSnapshot *snap = CreateSnapshot( tickcount, sv.num_edicts, nValid, bHLTV, bReplay );
 
-	if ( hltv && hltv->IsActive() )
+	// Build the snapshot.
+	for ( int i = 0; i < nValid; i++ )
 	{
-		snap->m_pHLTVEntityData = new CHLTVEntityData[snap->m_nValidEntities];
-		Q_memset( snap->m_pHLTVEntityData, 0, snap->m_nValidEntities * sizeof(CHLTVEntityData) );
+		const int iEdict = nValidEntities[i];
+		edict = &sv.edicts[iEdict];
+
+		CFrameSnapshotEntry *entry = &snap->m_pEntities[iEdict];
+		entry->m_nSerialNumber	= edict->m_NetworkSerialNumber;
+		entry->m_pClass			= edict->GetNetworkable()->GetServerClass();
 	}
 
-#if defined( REPLAY_ENABLED )
-	if ( replay && replay->IsActive() )
+	if ( nValid )
 	{
-		snap->m_pReplayEntityData = new CReplayEntityData[snap->m_nValidEntities];
-		Q_memset( snap->m_pReplayEntityData, 0, snap->m_nValidEntities * sizeof(CReplayEntityData) );
+		Q_memcpy( snap->m_pValidEntities, nValidEntities, nValid * sizeof(unsigned short) );
 	}
-#endif
 
 	snap->m_iExplicitDeleteSlots.CopyArray( m_iExplicitDeleteSlots.Base(), m_iExplicitDeleteSlots.Count() );
 	m_iExplicitDeleteSlots.Purge();
@@ -317,6 +382,11 @@ CThreadFastMutex &CFrameSnapshotManager::GetMutex()
 	return m_WriteMutex;
 }
 
+void CFrameSnapshotManager::SetDeferSnapshotDeletes( bool bDefer )
+{
+	m_bDeferSnapshotDeletes = bDefer;
+}
+
 //-----------------------------------------------------------------------------
 // Returns the pack data for a particular entity for a particular snapshot
 //-----------------------------------------------------------------------------
@@ -443,6 +513,7 @@ CFrameSnapshot::CFrameSnapshot()
 	m_nTempEntities = 0;
 	m_pTempEntities = NULL;
 	m_pValidEntities = NULL;
+	m_pArenaBlock = NULL;
 	m_nReferences = 0;
 #if defined( _DEBUG )
 	++g_nAllocatedSnapshots;
@@ -453,8 +524,17 @@ CFrameSnapshot::CFrameSnapshot()
 
 CFrameSnapshot::~CFrameSnapshot()
 {
-	delete [] m_pValidEntities;
-	delete [] m_pEntities;
+	if ( m_pArenaBlock )
+	{
+		g_SnapshotArena.Free( m_pArenaBlock );
+	}
+	else
+	{
+		delete [] m_pValidEntities;
+		delete [] m_pEntities;
+		delete [] m_pHLTVEntityData;
+		delete [] m_pReplayEntityData;
+	}
 
 	if ( m_pTempEntities )
 	{
@@ -467,9 +547,6 @@ CFrameSnapshot::~CFrameSnapshot()
 		delete [] m_pTempEntities;
 	}
 
-	delete [] m_pHLTVEntityData;
-
-	delete [] m_pReplayEntityData;
 	Assert ( m_nReferences == 0 );
 
 #if defined( _DEBUG )
@@ -485,13 +562,26 @@ void CFrameSnapshot::AddReference()
 	++m_nReferences;
 }
 
+static void DeleteDeferredFrameSnapshot( void *pContext, intp )
+{
+	g_FrameSnapshotManager.DeleteFrameSnapshot( static_cast<CFrameSnapshot *>( pContext ) );
+}
+
 void CFrameSnapshot::ReleaseReference()
 {
 	Assert( m_nReferences > 0 );
 
-	--m_nReferences;
-	if ( m_nReferences == 0 )
+	if ( --m_nReferences == 0 )
 	{
+		// Snapshot workers drop old client frames while other workers walk the
+		// snapshot list in WriteTempEntities, unlink after the parallel send instead.
+		// The server frame itself may run on a pool thread, see host_thread_mode.
+		if ( g_FrameSnapshotManager.m_bDeferSnapshotDeletes )
+		{
+			g_HostCommandRing.Post( &DeleteDeferredFrameSnapshot, this );
+			return;
+		}
+
 		g_FrameSnapshotManager.DeleteFrameSnapshot( this );
 	}
 }
@@ -501,4 +591,27 @@ CFrameSnapshot* CFrameSnapshot::NextSnapshot() const
 	return g_FrameSnapshotManager.NextSnapshot( this );
 }
 
+template <typename T>
+static void RelocatePointer( T *&p, intp nDelta )
+{
+	if ( p )
+	{
+		p = reinterpret_cast<T *>( reinterpret_cast<byte *>( p ) + nDelta );
+	}
+}
+
+void CFrameSnapshot::RelocateArrays( const void *pOldBlock, void *pNewBlock )
+{
+	Assert( m_pArenaBlock == pOldBlock );
+
+	const intp nDelta = static_cast<byte *>( pNewBlock ) - static_cast<const byte *>( pOldBlock );
+
+	RelocatePointer( m_pEntities, nDelta );
+	RelocatePointer( m_pValidEntities, nDelta );
+	RelocatePointer( m_pHLTVEntityData, nDelta );
+	RelocatePointer( m_pReplayEntityData, nDelta );
+
+	m_pArenaBlock = pNewBlock;
+}
+
 
@@ -32,7 +32,12 @@
 #include "vstdlib/random.h"
 #include "networkstringtable.h"
 #include "dt_send_eng.h"
+#include "dt_localtransfer.h"
 #include "sv_packedentities.h"
+#include "sv_deltacache.h"
+#include "sv_clusterindex.h"
+#include "host_cmdring.h"
+#include "sv_snapshotarena.h"
 #include "testscriptmgr.h"
 #include "PlayerState.h"
 #include "saverestoretypes.h"
@@ -300,6 +305,8 @@ void CGameServer::Clear( void )
 	
 	host_state.SetWorldModel( NULL );	
 
+	g_SharedDeltaCache.Flush();
+
 	BitwiseClear( m_szStartspot );
 	
 	num_edicts = 0;
@@ -697,6 +704,18 @@ void SV_InitSendTables( ServerClass *pClasses )
 	int nTables = SV_BuildSendTablesArray( pClasses, pTables, ARRAYSIZE( pTables ) );
 
 	SendTable_Init( pTables, nTables );
+
+	// Map change offsets to props so SV_PackEntity can re-encode only what the game marked
+	// as changed. Older game DLLs don't expose the non-modified pointer proxies we need.
+	if ( g_iServerGameDLLVersion >= 5 )
+	{
+		const CStandardSendProxies *pSendProxies = serverGameDLL->GetStandardSendProxies();
+
+		for ( int i = 0; i < nTables; i++ )
+		{
+			SendTable_InitPropOffsetMap( pTables[i], pSendProxies );
+		}
+	}
 }
 
 
@@ -1712,6 +1731,9 @@ void CGameServer::CopyTempEntities( CFrameSnapshot* pSnapshot )
 //   are running many instances anyway. It's off in Dota and CSGO dedicated servers.
 //
 // Bruce also had a patch to disable this in //ValveGames/staging/game/tf/cfg/unencrypted/print_instance_config.py
+//
+// Snapshots released during the parallel send are now deleted through g_HostCommandRing,
+// drained right after the workers are done, so m_FrameSnapshots doesn't change under them.
 static ConVar sv_parallel_sendsnapshot( "sv_parallel_sendsnapshot", "0" );
 
 static void SV_ParallelSendSnapshot( CGameClient *& pClient )
@@ -1738,6 +1760,9 @@ static void SV_ParallelSendSnapshot( CGameClient *& pClient )
 void CGameServer::SendClientMessages ( bool bSendSnapshots )
 {
 	VPROF_BUDGET( "SendClientMessages", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+
+	// Datagrams sent from here on go out in one batch per socket, see net_udp_batch.
+	NET_BeginSendBatch();
 	
 	// build individual updates
 	int receivingClientCount = 0;
@@ -1790,12 +1815,21 @@ void CGameServer::SendClientMessages ( bool bSendSnapshots )
 		// Compute the client packs
 		SV_ComputeClientPacks( receivingClientCount, pReceivingClients, pSnapshot );
 
+		// Drop last tick's deltas, clients that ack the same frame share them from now on.
+		// Must happen before the snapshot workers start.
+		g_SharedDeltaCache.SetTick( pSnapshot->m_nTickCount, pSnapshot->m_nNumEntities );
+
 		if ( receivingClientCount > 1 && sv_parallel_sendsnapshot.GetBool() )
 		{
 			// SV_ParallelSendSnapshot will not process HLTV or Replay clients as they
 			// must be run on the main thread due to un-threadsafe global state access.
 			// It will replace anything that it does process with a NULL pointer.
+			framesnapshotmanager->SetDeferSnapshotDeletes( true );
 			ParallelProcess( "SV_ParallelSendSnapshot", pReceivingClients, receivingClientCount, &SV_ParallelSendSnapshot );
+			framesnapshotmanager->SetDeferSnapshotDeletes( false );
+
+			// Sync point, apply what the workers deferred.
+			g_HostCommandRing.Drain();
 		}
 		
 		for (int i = 0; i < receivingClientCount; ++i)
@@ -1811,7 +1845,15 @@ void CGameServer::SendClientMessages ( bool bSendSnapshots )
 		}
 	
 		pSnapshot->ReleaseReference();
+
+		// Relay frames and client baselines created until the next tick use the heap.
+		g_SnapshotArena.EndGeneration();
 	}
+
+	// Anything else posted during the frame, whatever path the snapshots took.
+	g_HostCommandRing.Drain();
+
+	NET_FlushSendBatch();
 }
 
 void CGameServer::SetMaxClients( int number )
@@ -1927,6 +1969,8 @@ void SV_CreateBaseline (void)
 
 	ServerClass *pClasses = serverGameDLL->GetAllServerClasses();
 
+	sv.m_SharedSendTables.Purge();
+
 	// Send SendTable info.
 	if ( sv_sendtables.GetInt() )
 	{
@@ -1952,6 +1996,8 @@ void SV_CreateBaseline (void)
 			Host_Error("SV_CreateBaseline: WriteClassInfos overflow.\n" );
 			return;
 		}
+
+		sv.m_SharedSendTables.Set( sv.m_FullSendTables );
 	}
 
 	// If we're using the local network backdoor, we'll never use the instance baselines.
@@ -2210,6 +2256,7 @@ static void SV_AllocateEdicts()
 		sv.edicts[i].freetime = 0;
 	}
 	ED_ClearFreeEdictList();
+	g_EntityClusterIndex.Reset();
 
 	sv.edictchangeinfo = Hunk_AllocName<IChangeInfoAccessor>( sv.max_edicts, "edictchangeinfo" );
 }
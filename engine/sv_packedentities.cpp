@@ -13,6 +13,7 @@
 #include "eiface.h"
 #include "dt_send_eng.h"
 #include "dt_common_eng.h"
+#include "dt_localtransfer.h"
 #include "changeframelist.h"
 #include "sv_main.h"
 #include "hltvserver.h"
@@ -42,6 +43,12 @@ IClientEntityList *entitylist = NULL;
 #include "tier0/memdbgon.h"
 
 ConVar sv_debugmanualmode( "sv_debugmanualmode", "0", 0, "Make sure entities correctly report whether or not their network data has changed." );
+static ConVar sv_packentities_partial( "sv_packentities_partial", "1", 0, "Only re-encode the props entities reported as changed when packing them." );
+static ConVar sv_packentities_partial_verify( "sv_packentities_partial_verify", "0", 0, "Also fully encode entities packed from their change offsets and report props that changed without being reported." );
+
+// Number of PackEntities_Normal calls so far, and the call each edict was last looked at in.
+static int s_nPackCount = 0;
+static int s_EdictPackCount[MAX_EDICTS];
 
 // This function makes sure that this entity class has an instance baseline.
 // If it doesn't have one yet, it makes a new one.
@@ -88,6 +95,76 @@ void SV_EnsureInstanceBaseline( ServerClass *pServerClass, int iEdict, const voi
 	ThreadMemoryBarrier();
 }
 
+//-----------------------------------------------------------------------------
+// Turn the change offsets the game reported for this edict into a bitmask of
+// dirty props. Returns false if all props have to be treated as changed.
+//-----------------------------------------------------------------------------
+static bool SV_GetDirtyProps( 
+	const edict_t *edict, 
+	CSendTablePrecalc *pPrecalc, 
+	bool bPackedLastTime,
+	CBitVec<MAX_DATATABLE_PROPS> &dirtyProps )
+{
+	if ( !sv_packentities_partial.GetBool() || sv_debugmanualmode.GetInt() || !pPrecalc->m_bHasPropOffsetMap )
+		return false;
+
+	// Change offsets are dropped after each pack, so they only cover all changes since
+	// the previously sent state if the edict was packed last time as well.
+	if ( !bPackedLastTime )
+		return false;
+
+	if ( !edict->HasStateChanged() || ( edict->m_fStateFlags & FL_FULL_EDICT_CHANGED ) )
+		return false;
+
+	if ( edict->GetChangeInfoSerialNumber() != g_pSharedChangeInfo->m_iSerialNumber )
+		return false;
+
+	const CEdictChangeInfo *pCI = &g_pSharedChangeInfo->m_ChangeInfos[edict->GetChangeInfo()];
+
+	unsigned short propIndices[MAX_CHANGE_OFFSETS*3];
+	int nProps = MapPropOffsetsToIndices( edict, pPrecalc, pCI->m_ChangeOffsets, pCI->m_nChangeOffsets, propIndices );
+
+	dirtyProps.ClearAll();
+	for ( int i = 0; i < nProps; i++ )
+	{
+		dirtyProps.Set( propIndices[i] );
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Compare a pack built from change offsets against a full encode and report
+// props that changed without the game telling us.
+//-----------------------------------------------------------------------------
+static void SV_VerifyPartialPack( int edictIdx, edict_t *edict, SendTable *pSendTable, const bf_write &partialBuf )
+{
+	alignas(4) char fullData[MAX_PACKEDENTITY_DATA];
+	bf_write fullBuf( "SV_VerifyPartialPack->fullBuf", fullData );
+
+	if ( !SendTable_Encode( pSendTable, edict->GetUnknown(), &fullBuf, edictIdx, NULL, false ) )
+		return;
+
+	int diffProps[MAX_DATATABLE_PROPS];
+	int nDiffs = SendTable_CalcDelta(
+		pSendTable,
+		fullData, fullBuf.GetNumBitsWritten(),
+		partialBuf.GetData(), partialBuf.GetNumBitsWritten(),
+		diffProps,
+		ARRAYSIZE( diffProps ),
+		edictIdx );
+
+	for ( int i = 0; i < nDiffs; i++ )
+	{
+		const SendProp *pProp = pSendTable->m_pPrecalc->GetProp( diffProps[i] );
+
+		Warning( "Entity %d (class '%s') changed '%s' without reporting its offset.\n", 
+			edictIdx,
+			edict->GetClassName(),
+			pProp->GetName() );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Pack the entity....
 //-----------------------------------------------------------------------------
@@ -103,6 +180,9 @@ static inline void SV_PackEntity(
 
 	int iSerialNum = pSnapshot->m_pEntities[ edictIdx ].m_nSerialNumber;
 
+	const bool bPackedLastTime = s_EdictPackCount[ edictIdx ] != 0 && s_EdictPackCount[ edictIdx ] == s_nPackCount - 1;
+	s_EdictPackCount[ edictIdx ] = s_nPackCount;
+
 	// Check to see if this entity specifies its changes.
 	// If so, then try to early out making the fullpack
 	bool bUsedPrev = false;
@@ -130,7 +210,41 @@ static inline void SV_PackEntity(
 	unsigned char tempData[ sizeof( CSendProxyRecipients ) * MAX_DATATABLE_PROXIES ];
 	CUtlMemory< CSendProxyRecipients > recip( (CSendProxyRecipients*)tempData, pSendTable->m_pPrecalc->GetNumDataTableProxies() );
 
-	if( !SendTable_Encode( pSendTable, edict->GetUnknown(), &writeBuf, edictIdx, &recip, false ) )
+	// If this entity was previously in there, then it should have a valid IChangeFrameList 
+	// which we can delta against to figure out which properties have changed.
+	//
+	// If not, then we want to setup a new IChangeFrameList.
+
+	PackedEntity *pPrevFrame = framesnapshotmanager->GetPreviouslySentPacket( edictIdx, pSnapshot->m_pEntities[ edictIdx ].m_nSerialNumber );
+
+	int deltaProps[MAX_DATATABLE_PROPS];
+	int nChanges = -1; // not known yet
+
+	CBitVec<MAX_DATATABLE_PROPS> dirtyProps;
+
+	if ( pPrevFrame && SV_GetDirtyProps( edict, pSendTable->m_pPrecalc, bPackedLastTime, dirtyProps ) )
+	{
+		// Only the props the game marked as changed get encoded and compared, copy the rest.
+		Assert( !pPrevFrame->IsCompressed() );
+
+		nChanges = SendTable_EncodeChanged( 
+			pSendTable, edict->GetUnknown(), &writeBuf, edictIdx, &recip, 
+			pPrevFrame->GetData(), pPrevFrame->GetNumBits(), 
+			dirtyProps, 
+			deltaProps, 
+			ARRAYSIZE( deltaProps ) );
+
+		if ( nChanges < 0 )
+		{
+			Host_Error( "SV_PackEntity: SendTable_EncodeChanged returned false (ent %d).\n", edictIdx );
+		}
+
+		if ( sv_packentities_partial_verify.GetBool() )
+		{
+			SV_VerifyPartialPack( edictIdx, edict, pSendTable, writeBuf );
+		}
+	}
+	else if( !SendTable_Encode( pSendTable, edict->GetUnknown(), &writeBuf, edictIdx, &recip, false ) )
 	{							 
 		Host_Error( "SV_PackEntity: SendTable_Encode returned false (ent %d).\n", edictIdx );
 	}
@@ -146,29 +260,24 @@ static inline void SV_PackEntity(
 	int nFlatProps = SendTable_GetNumFlatProps( pSendTable );
 	IChangeFrameList *pChangeFrame = NULL;
 
-	// If this entity was previously in there, then it should have a valid IChangeFrameList 
-	// which we can delta against to figure out which properties have changed.
-	//
-	// If not, then we want to setup a new IChangeFrameList.
-
-	PackedEntity *pPrevFrame = framesnapshotmanager->GetPreviouslySentPacket( edictIdx, pSnapshot->m_pEntities[ edictIdx ].m_nSerialNumber );
 	if ( pPrevFrame )
 	{
-		// Calculate a delta.
+		// Calculate a delta unless SendTable_EncodeChanged already did.
 		Assert( !pPrevFrame->IsCompressed() );
-		
-		int deltaProps[MAX_DATATABLE_PROPS];
 
-		int nChanges = SendTable_CalcDelta(
-			pSendTable, 
-			pPrevFrame->GetData(), pPrevFrame->GetNumBits(),
-			packedData,	writeBuf.GetNumBitsWritten(),
-			
-			deltaProps,
-			ARRAYSIZE( deltaProps ),
+		if ( nChanges < 0 )
+		{
+			nChanges = SendTable_CalcDelta(
+				pSendTable, 
+				pPrevFrame->GetData(), pPrevFrame->GetNumBits(),
+				packedData,	writeBuf.GetNumBitsWritten(),
+				
+				deltaProps,
+				ARRAYSIZE( deltaProps ),
 
-			edictIdx
-			);
+				edictIdx
+				);
+		}
 
 #ifndef NO_VCR
 		if ( vcr_verbose.GetInt() )
@@ -252,7 +361,7 @@ static inline void SV_PackEntity(
 		PackedEntity *pPackedEntity = framesnapshotmanager->CreatePackedEntity( pSnapshot, edictIdx );
 		pPackedEntity->SetChangeFrameList( pChangeFrame );
 		pPackedEntity->SetServerAndClientClass( pServerClass, NULL );
-		pPackedEntity->AllocAndCopyPadded( packedData, writeBuf.GetNumBytesWritten() );
+		pPackedEntity->AllocAndCopyPadded( packedData, writeBuf.GetNumBytesWritten(), true );
 		pPackedEntity->SetRecipients( recip );
 	}
 
@@ -396,6 +505,9 @@ void PackEntities_Normal(
 
 	CUtlVectorFixed< PackWork_t, MAX_EDICTS > workItems;
 
+	// SV_PackEntity uses this to see which edicts were packed last time.
+	++s_nPackCount;
+
 	// check for all active entities, if they are seen by at least on client, if
 	// so, bit pack them 
 	for ( int iValidEdict=0; iValidEdict < snapshot->m_nValidEntities; ++iValidEdict )
@@ -437,7 +549,9 @@ void PackEntities_Normal(
 	// Process work
 	if ( sv_parallel_packentities.GetBool() )
 	{
+		g_bSvInstanceBaselinesLocked = true;
 		ParallelProcess( "PackWork_t::Process", workItems.Base(), workItems.Count(), &PackWork_t::Process );
+		g_bSvInstanceBaselinesLocked = false;
 	}
 	else
 	{
@@ -0,0 +1,308 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Tick scoped arena for frame snapshot arrays and packed entity data.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "sv_snapshotarena.h"
+
+#include <cstring>
+#include <new>
+
+#include "tier0/dbg.h"
+#include "tier0/memalloc.h"
+#include "tier1/convar.h"
+
+#include "framesnapshot.h"
+#include "packed_entity.h"
+#include "sys_dll.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static ConVar sv_snapshot_arena( "sv_snapshot_arena", "1", 0, "Allocate frame snapshots and packed entity data from per tick arenas instead of the heap." );
+
+CSnapshotArena g_SnapshotArena;
+
+CSnapshotArena::CSnapshotArena()
+{
+	m_pCurrent.store( nullptr, std::memory_order_relaxed );
+	m_pFreeChunks = nullptr;
+	m_nFreeChunks = 0;
+}
+
+CSnapshotArena::~CSnapshotArena()
+{
+	Purge();
+}
+
+CSnapshotArena::BlockHeader_t *CSnapshotArena::GetHeader( void *pData )
+{
+	return static_cast<BlockHeader_t *>( pData ) - 1;
+}
+
+byte *CSnapshotArena::GetChunkData( Chunk_t *pChunk )
+{
+	return reinterpret_cast<byte *>( pChunk ) + AlignValue( sizeof( Chunk_t ), ALIGNMENT );
+}
+
+CSnapshotArena::Chunk_t *CSnapshotArena::GetChunk( intp nMinSize )
+{
+	if ( nMinSize <= CHUNK_SIZE && m_pFreeChunks )
+	{
+		Chunk_t *pChunk = m_pFreeChunks;
+		m_pFreeChunks = pChunk->pNext;
+		--m_nFreeChunks;
+
+		pChunk->pNext = nullptr;
+		pChunk->nUsed.store( 0, std::memory_order_relaxed );
+		return pChunk;
+	}
+
+	const intp nSize = max( nMinSize, static_cast<intp>( CHUNK_SIZE ) );
+	void *pMemory = MemAlloc_AllocAligned( AlignValue( sizeof( Chunk_t ), ALIGNMENT ) + nSize, ALIGNMENT );
+	if ( !pMemory )
+		return nullptr;
+
+	Chunk_t *pChunk = new ( pMemory ) Chunk_t;
+	pChunk->pNext = nullptr;
+	pChunk->nSize = nSize;
+	pChunk->nUsed.store( 0, std::memory_order_relaxed );
+	return pChunk;
+}
+
+void *CSnapshotArena::AllocFromChunk( Chunk_t *pChunk, intp nTotal )
+{
+	intp nUsed = pChunk->nUsed.load( std::memory_order_relaxed );
+
+	do
+	{
+		if ( nUsed + nTotal > pChunk->nSize )
+			return nullptr;
+	}
+	while ( !pChunk->nUsed.compare_exchange_weak( nUsed, nUsed + nTotal, std::memory_order_relaxed ) );
+
+	return GetChunkData( pChunk ) + nUsed;
+}
+
+void *CSnapshotArena::Alloc( void *pOwner, BlockOwner_t eOwnerType, intp nBytes )
+{
+	Assert( pOwner && nBytes >= 0 );
+
+	Generation_t *pGeneration = m_pCurrent.load( std::memory_order_acquire );
+	if ( !pGeneration )
+		return nullptr;
+
+	const intp nPayload = AlignValue( nBytes, ALIGNMENT );
+	const intp nTotal = static_cast<intp>( sizeof( BlockHeader_t ) ) + nPayload;
+
+	BlockHeader_t *pHeader = nullptr;
+
+	while ( !pHeader )
+	{
+		Chunk_t *pChunk = pGeneration->pChunks.load( std::memory_order_acquire );
+		if ( pChunk )
+		{
+			pHeader = static_cast<BlockHeader_t *>( AllocFromChunk( pChunk, nTotal ) );
+			if ( pHeader )
+				break;
+		}
+
+		AUTO_LOCK( m_GrowMutex );
+
+		// Another thread may have added a chunk meanwhile.
+		if ( pGeneration->pChunks.load( std::memory_order_relaxed ) != pChunk )
+			continue;
+
+		Chunk_t *pNewChunk = GetChunk( nTotal );
+		if ( !pNewChunk )
+			return nullptr;
+
+		pNewChunk->nUsed.store( nTotal, std::memory_order_relaxed );
+		pNewChunk->pNext = pChunk;
+
+		pHeader = reinterpret_cast<BlockHeader_t *>( GetChunkData( pNewChunk ) );
+		pGeneration->pChunks.store( pNewChunk, std::memory_order_release );
+	}
+
+	pHeader->pOwner = pOwner;
+	pHeader->pGeneration = pGeneration;
+	pHeader->nSize = static_cast<uint32>( nPayload );
+	pHeader->nOwnerType = eOwnerType;
+
+	pGeneration->nLive.fetch_add( 1, std::memory_order_relaxed );
+
+	return pHeader + 1;
+}
+
+void *CSnapshotArena::AllocPackedData( PackedEntity *pOwner, intp nBytes )
+{
+	return sv_snapshot_arena.GetBool() ? Alloc( pOwner, OWNER_PACKED_DATA, nBytes ) : nullptr;
+}
+
+void *CSnapshotArena::AllocSnapshotData( CFrameSnapshot *pOwner, intp nBytes )
+{
+	return sv_snapshot_arena.GetBool() ? Alloc( pOwner, OWNER_SNAPSHOT, nBytes ) : nullptr;
+}
+
+void CSnapshotArena::Free( void *pData )
+{
+	BlockHeader_t *pHeader = GetHeader( pData );
+	Assert( pHeader->pOwner );
+
+	pHeader->pOwner = nullptr;
+	pHeader->pGeneration->nLive.fetch_sub( 1, std::memory_order_release );
+}
+
+void CSnapshotArena::Evacuate( Generation_t *pGeneration )
+{
+	for ( Chunk_t *pChunk = pGeneration->pChunks.load( std::memory_order_relaxed ); pChunk; pChunk = pChunk->pNext )
+	{
+		byte *pData = GetChunkData( pChunk );
+		const intp nUsed = pChunk->nUsed.load( std::memory_order_relaxed );
+
+		for ( intp nOffset = 0; nOffset < nUsed; )
+		{
+			BlockHeader_t *pHeader = reinterpret_cast<BlockHeader_t *>( pData + nOffset );
+			nOffset += static_cast<intp>( sizeof( BlockHeader_t ) ) + pHeader->nSize;
+
+			if ( !pHeader->pOwner )
+				continue;
+
+			// Also done with sv_snapshot_arena 0, owners only know arena blocks by their origin.
+			void *pOld = pHeader + 1;
+			void *pNew = Alloc( pHeader->pOwner, static_cast<BlockOwner_t>( pHeader->nOwnerType ), pHeader->nSize );
+			if ( !pNew )
+			{
+				Error( "CSnapshotArena: out of memory when moving a %u byte block of tick %d.\n", pHeader->nSize, pGeneration->nTick );
+			}
+
+			memcpy( pNew, pOld, pHeader->nSize );
+
+			if ( pHeader->nOwnerType == OWNER_SNAPSHOT )
+			{
+				static_cast<CFrameSnapshot *>( pHeader->pOwner )->RelocateArrays( pOld, pNew );
+			}
+			else
+			{
+				static_cast<PackedEntity *>( pHeader->pOwner )->RelocateData( pNew );
+			}
+
+			Free( pOld );
+		}
+	}
+
+	Assert( pGeneration->nLive.load( std::memory_order_relaxed ) == 0 );
+}
+
+void CSnapshotArena::ReleaseGeneration( Generation_t *pGeneration )
+{
+	Assert( pGeneration->nLive.load( std::memory_order_acquire ) == 0 );
+
+	Chunk_t *pChunk = pGeneration->pChunks.load( std::memory_order_relaxed );
+	while ( pChunk )
+	{
+		Chunk_t *pNext = pChunk->pNext;
+
+		if ( pChunk->nSize == CHUNK_SIZE && m_nFreeChunks < MAX_FREE_CHUNKS )
+		{
+			pChunk->pNext = m_pFreeChunks;
+			m_pFreeChunks = pChunk;
+			++m_nFreeChunks;
+		}
+		else
+		{
+			pChunk->~Chunk_t();
+			MemAlloc_FreeAligned( pChunk );
+		}
+
+		pChunk = pNext;
+	}
+
+	pGeneration->pChunks.store( nullptr, std::memory_order_relaxed );
+	m_FreeGenerations.AddToTail( pGeneration );
+}
+
+void CSnapshotArena::BeginGeneration( int nTick, int nWindow )
+{
+	Generation_t *pGeneration;
+	if ( m_FreeGenerations.Count() )
+	{
+		pGeneration = m_FreeGenerations.Tail();
+		m_FreeGenerations.RemoveMultipleFromTail( 1 );
+	}
+	else
+	{
+		pGeneration = new Generation_t;
+	}
+
+	pGeneration->nTick = nTick;
+	pGeneration->pChunks.store( nullptr, std::memory_order_relaxed );
+	pGeneration->nLive.store( 0, std::memory_order_relaxed );
+
+	m_Generations.AddToTail( pGeneration );
+	m_pCurrent.store( pGeneration, std::memory_order_release );
+
+	for ( intp i = 0; i < m_Generations.Count() - 1; )
+	{
+		Generation_t *pOld = m_Generations[i];
+
+		// Tick goes back on map change, treat anything from the future as old.
+		if ( pOld->nLive.load( std::memory_order_acquire ) > 0 &&
+			( nTick - pOld->nTick > nWindow || nTick < pOld->nTick ) )
+		{
+			Evacuate( pOld );
+		}
+
+		if ( pOld->nLive.load( std::memory_order_acquire ) == 0 )
+		{
+			AUTO_LOCK( m_GrowMutex );
+			ReleaseGeneration( pOld );
+			m_Generations.Remove( i );
+			continue;
+		}
+
+		++i;
+	}
+}
+
+void CSnapshotArena::EndGeneration()
+{
+	m_pCurrent.store( nullptr, std::memory_order_release );
+}
+
+void CSnapshotArena::Purge()
+{
+	AUTO_LOCK( m_GrowMutex );
+
+	m_pCurrent.store( nullptr, std::memory_order_release );
+
+	for ( auto *pGeneration : m_Generations )
+	{
+		AssertMsg( pGeneration->nLive.load( std::memory_order_relaxed ) == 0 || IsInErrorExit(),
+			"Snapshot arena generation of tick %d still has live blocks.", pGeneration->nTick );
+
+		// Leak live blocks rather than free memory still pointed to.
+		if ( pGeneration->nLive.load( std::memory_order_relaxed ) == 0 )
+		{
+			ReleaseGeneration( pGeneration );
+		}
+	}
+	m_Generations.Purge();
+
+	while ( m_pFreeChunks )
+	{
+		Chunk_t *pNext = m_pFreeChunks->pNext;
+		m_pFreeChunks->~Chunk_t();
+		MemAlloc_FreeAligned( m_pFreeChunks );
+		m_pFreeChunks = pNext;
+	}
+	m_nFreeChunks = 0;
+
+	for ( auto *pGeneration : m_FreeGenerations )
+	{
+		delete pGeneration;
+	}
+	m_FreeGenerations.Purge();
+}
@@ -0,0 +1,126 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Tick scoped arena for frame snapshot arrays and packed entity data.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef SV_SNAPSHOTARENA_H
+#define SV_SNAPSHOTARENA_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <atomic>
+
+#include "tier0/platform.h"
+#include "tier0/threadtools.h"
+#include "tier1/utlvector.h"
+
+class CFrameSnapshot;
+class PackedEntity;
+
+
+//-----------------------------------------------------------------------------
+// Everything the server allocates for one tick (the snapshot arrays and the
+// data of every entity packed for it) is carved out of that tick's
+// generation: a few large chunks filled by bumping an offset. Freeing a block
+// only marks it dead. Once a generation has no live blocks left, all its
+// chunks go back to a free list in one operation and are reused by the next
+// ticks, so steady state snapshot building does not touch the heap.
+//
+// Packed entities are shared by later snapshots as long as the entity does
+// not change, and client baselines keep theirs for a long time. Blocks still
+// alive when their generation falls out of the window (sv_maxreplay plus the
+// client frame window) are copied into the current generation and their
+// owner is pointed at the copy, so old generations can always be released.
+//
+// Alloc and Free may be called from the pack and snapshot workers.
+// BeginGeneration must be called from the main thread while nothing reads
+// snapshot or packed entity data, it is the only place blocks move.
+// EndGeneration must be called once the workers of the frame are done.
+//-----------------------------------------------------------------------------
+class CSnapshotArena
+{
+public:
+	CSnapshotArena();
+	~CSnapshotArena();
+
+	// Starts the generation for nTick. Releases dead generations and moves live
+	// blocks of generations more than nWindow ticks old into the new one.
+	void	BeginGeneration( int nTick, int nWindow );
+
+	// Ends the server frame. Allocations until the next BeginGeneration (relay
+	// frames, client baselines) go to the heap.
+	void	EndGeneration();
+
+	// Return NULL if the arena is disabled, outside a server frame or out of
+	// memory, callers use the heap then.
+	void	*AllocPackedData( PackedEntity *pOwner, intp nBytes );
+	void	*AllocSnapshotData( CFrameSnapshot *pOwner, intp nBytes );
+
+	void	Free( void *pData );
+
+	// Frees all cached chunks, called at shutdown. There must be no live blocks.
+	void	Purge();
+
+	// Payload alignment of every block.
+	enum { ALIGNMENT = 16 };
+
+private:
+	enum
+	{
+		CHUNK_SIZE = 64 * 1024,
+		MAX_FREE_CHUNKS = 256,	// 16 MB cached
+	};
+
+	enum BlockOwner_t
+	{
+		OWNER_PACKED_DATA = 0,
+		OWNER_SNAPSHOT,
+	};
+
+	struct Chunk_t
+	{
+		Chunk_t				*pNext;
+		intp				nSize;		// bytes after the header
+		std::atomic<intp>	nUsed;
+	};
+
+	struct Generation_t;
+
+	struct alignas( ALIGNMENT ) BlockHeader_t
+	{
+		void				*pOwner;	// NULL once freed
+		Generation_t		*pGeneration;
+		uint32				nSize;		// payload bytes, multiple of ALIGNMENT
+		uint32				nOwnerType;
+	};
+
+	struct Generation_t
+	{
+		int					nTick;
+		std::atomic<Chunk_t *>	pChunks;	// head is the one allocations go to
+		std::atomic<int>	nLive;
+	};
+
+	void	*Alloc( void *pOwner, BlockOwner_t eOwnerType, intp nBytes );
+	void	*AllocFromChunk( Chunk_t *pChunk, intp nTotal );
+	Chunk_t	*GetChunk( intp nMinSize );
+	void	ReleaseGeneration( Generation_t *pGeneration );
+	void	Evacuate( Generation_t *pGeneration );
+
+	static BlockHeader_t	*GetHeader( void *pData );
+	static byte				*GetChunkData( Chunk_t *pChunk );
+
+	std::atomic<Generation_t *>	m_pCurrent;
+	CUtlVector<Generation_t *>	m_Generations;		// oldest first, current last
+	CUtlVector<Generation_t *>	m_FreeGenerations;
+	Chunk_t						*m_pFreeChunks;
+	int							m_nFreeChunks;
+	CThreadFastMutex			m_GrowMutex;		// new chunk for the current generation
+};
+
+extern CSnapshotArena g_SnapshotArena;
+
+#endif // SV_SNAPSHOTARENA_H
@@ -0,0 +1,154 @@
+// Copyright Valve Corporation, All rights reserved.
+//
+// Deferred engine command ring self-tests.
+
+#include "tests_host_cmdring.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "tier0/dbg.h"
+#include "tier0/threadtools.h"
+
+#include "host_cmdring.h"
+
+#include "tier0/memdbgon.h"
+
+namespace {
+
+struct RingTest {
+  CHostCommandRing *ring;
+  std::vector<int> runs;  // times each command ran, indexed by nArg
+  std::atomic_int started_num{0};
+  std::atomic_int finished_num{0};
+  std::atomic_bool start{false};
+  int commands_num;
+};
+
+struct ProducerContext {
+  RingTest *test;
+  int producer_idx;
+};
+
+void CountCommand(void *context, intp arg) {
+  auto *test = static_cast<RingTest *>(context);
+  ++test->runs[arg];
+}
+
+unsigned ProducerThreadFunc(void *ctx) {
+  ThreadSetDebugName("CmdRingProducer");
+
+  auto *producer = static_cast<ProducerContext *>(ctx);
+  RingTest *test = producer->test;
+
+  test->started_num.fetch_add(1, std::memory_order_acq_rel);
+  while (!test->start.load(std::memory_order_acquire)) {
+    ThreadSleep(0);
+  }
+
+  const intp first{static_cast<intp>(producer->producer_idx) *
+                   test->commands_num};
+  for (intp i{0}; i < test->commands_num; i++) {
+    test->ring->Post(&CountCommand, test, first + i);
+  }
+
+  test->finished_num.fetch_add(1, std::memory_order_acq_rel);
+  return 0;
+}
+
+bool CheckRuns(const RingTest &test, const char *name) {
+  for (size_t i{0}; i < test.runs.size(); i++) {
+    if (test.runs[i] != 1) {
+      Msg("%s: FAIL, command %zu ran %d times.\n", name, i, test.runs[i]);
+      return false;
+    }
+  }
+
+  Msg("%s: pass.\n", name);
+  return true;
+}
+
+bool OverflowTest() {
+  auto ring = std::make_unique<CHostCommandRing>();
+
+  RingTest test;
+  test.ring = ring.get();
+  test.commands_num = CHostCommandRing::CAPACITY * 2 + 1;
+  test.runs.resize(test.commands_num);
+
+  for (intp i{0}; i < test.commands_num; i++) {
+    ring->Post(&CountCommand, &test, i);
+  }
+
+  const intp executed_num{ring->Drain()};
+  if (executed_num != test.commands_num || !ring->IsEmpty()) {
+    Msg("Overflow test: FAIL, %zd of %d commands drained.\n", executed_num,
+        test.commands_num);
+    return false;
+  }
+
+  return CheckRuns(test, "Overflow test");
+}
+
+bool ProducersTest(int producers_num, int commands_num) {
+  auto ring = std::make_unique<CHostCommandRing>();
+
+  RingTest test;
+  test.ring = ring.get();
+  test.commands_num = commands_num;
+  test.runs.resize(static_cast<size_t>(producers_num) * commands_num);
+
+  std::vector<ProducerContext> producers(producers_num);
+  std::vector<ThreadHandle_t> threads;
+
+  for (int i{0}; i < producers_num; i++) {
+    producers[i] = {&test, i};
+    threads.push_back(CreateSimpleThread(&ProducerThreadFunc, &producers[i]));
+  }
+
+  while (test.started_num.load(std::memory_order_acquire) < producers_num) {
+    ThreadSleep(0);
+  }
+
+  test.start.store(true, std::memory_order_release);
+
+  // Drain while producers post, like the main thread at its sync point.
+  while (test.finished_num.load(std::memory_order_acquire) < producers_num) {
+    ring->Drain();
+  }
+  ring->Drain();
+
+  for (ThreadHandle_t h : threads) {
+    ThreadJoin(h, 0);
+    ReleaseThreadHandle(h);
+  }
+
+  if (!ring->IsEmpty()) {
+    Msg("Producers test: FAIL, ring not empty.\n");
+    return false;
+  }
+
+  return CheckRuns(test, "Producers test");
+}
+
+}  // namespace
+
+namespace se::engine::tests::host_cmdring {
+
+bool RunHostCommandRingTests(int producers_num, int commands_num) {
+  if (producers_num <= 0 || commands_num <= 0) {
+    Msg("Need at least one producer and one command.\n");
+    return false;
+  }
+
+  Msg("Host command ring tests, %d producers x %d commands...\n",
+      producers_num, commands_num);
+
+  bool ok{OverflowTest()};
+  ok = ProducersTest(producers_num, commands_num) && ok;
+
+  return ok;
+}
+
+}  // namespace se::engine::tests::host_cmdring
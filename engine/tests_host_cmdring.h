@@ -0,0 +1,16 @@
+// Copyright Valve Corporation, All rights reserved.
+//
+// Deferred engine command ring self-tests.
+
+#ifndef SE_ENGINE_TESTS_HOST_CMDRING_H_
+#define SE_ENGINE_TESTS_HOST_CMDRING_H_
+
+namespace se::engine::tests::host_cmdring {
+
+// Posts commands_num commands from each of producers_num threads while the
+// main thread drains, and checks every command ran exactly once.
+bool RunHostCommandRingTests(int producers_num, int commands_num);
+
+}  // namespace se::engine::tests::host_cmdring
+
+#endif  // !SE_ENGINE_TESTS_HOST_CMDRING_H_
@@ -2,7 +2,10 @@
 //
 // Self-tests commands.
 
+#include "tests_host_cmdring.h"
+#include "tests_spatial_partition.h"
 #include "tests_thread_pool.h"
+#include "tests_thread_pool_bench.h"
 #include "tests_ts_collections.h"
 
 #include <atomic>
@@ -94,11 +97,37 @@ CON_COMMAND(thread_test_tsqueue,
   se::engine::tests::ts_collections::RunTSQueueTests(tests_num);
 }
 
+CON_COMMAND(thread_test_cmdring,
+            "Run deferred engine command ring tests. 4 producers x 100000 "
+            "commands by default.") {
+  const int producers_num{args.ArgC() < 2 ? 4 : atoi(args.Arg(1))};
+  const int commands_num{args.ArgC() < 3 ? 100000 : atoi(args.Arg(2))};
+
+  se::engine::tests::host_cmdring::RunHostCommandRingTests(producers_num,
+                                                           commands_num);
+}
+
+CON_COMMAND(spatialpartition_run_tests,
+            "Run hashed grid spatial partition tests.") {
+  se::engine::tests::spatial_partition::RunGridPartitionTests();
+}
+
 CON_COMMAND(threadpool_run_tests,
             "Run thread pool tests. 1 test run by default.") {
   const int tests_num{args.ArgC() == 1 ? 1 : atoi(args.Arg(1))};
 
   for (int i = 0; i < tests_num; i++) {
-    se::engine::tests::thread_pool::RunThreadPoolTests();
+    if (!se::engine::tests::thread_pool::RunThreadPoolTests()) {
+      Msg("Thread pool tests failed on run #%d.\n", i);
+      break;
+    }
   }
 }
+
+CON_COMMAND(threadpool_run_benchmark,
+            "Benchmark shared queue vs work-stealing thread pool scheduling. "
+            "100 rounds by default.") {
+  const int rounds_num{args.ArgC() == 1 ? 100 : atoi(args.Arg(1))};
+
+  se::engine::tests::thread_pool::RunThreadPoolBenchmark(rounds_num);
+}
@@ -0,0 +1,332 @@
+// Copyright Valve Corporation, All rights reserved.
+//
+// Hashed grid spatial partition self-tests.
+
+#include "tests_spatial_partition.h"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include "tier0/dbg.h"
+#include "tier0/threadtools.h"
+
+#include "basehandle.h"
+#include "cmodel.h"
+#include "ihandleentity.h"
+#include "ispatialpartitioninternal.h"
+#include "worldsize.h"
+
+#include "tier0/memdbgon.h"
+
+namespace {
+
+constexpr SpatialPartitionListMask_t kListMask{PARTITION_ENGINE_SOLID_EDICTS};
+
+class TestEntity : public IHandleEntity {
+ public:
+  void SetRefEHandle(const CBaseHandle &handle) override { handle_ = handle; }
+  const CBaseHandle &GetRefEHandle() const override { return handle_; }
+
+ private:
+  CBaseHandle handle_;
+};
+
+class Collector : public IPartitionEnumerator {
+ public:
+  IterationRetval_t EnumElement(IHandleEntity *entity) override {
+    hits.push_back(entity);
+
+    if (on_first_hit) {
+      std::function<void()> callback{std::move(on_first_hit)};
+      on_first_hit = nullptr;
+      callback();
+    }
+
+    return ITERATION_CONTINUE;
+  }
+
+  intp Count(const IHandleEntity *entity) const {
+    return std::count(hits.begin(), hits.end(), entity);
+  }
+
+  std::vector<IHandleEntity *> hits;
+  // Runs in the middle of the query, on the first element it reports.
+  std::function<void()> on_first_hit;
+};
+
+struct PartitionDeleter {
+  void operator()(ISpatialPartitionInternal *partition) const {
+    DestroySpatialPartition(partition);
+  }
+};
+
+using PartitionPtr =
+    std::unique_ptr<ISpatialPartitionInternal, PartitionDeleter>;
+
+PartitionPtr CreatePartition() {
+  return PartitionPtr{CreateGridSpatialPartition(
+      Vector{MIN_COORD_FLOAT, MIN_COORD_FLOAT, MIN_COORD_FLOAT},
+      Vector{MAX_COORD_FLOAT, MAX_COORD_FLOAT, MAX_COORD_FLOAT})};
+}
+
+Vector Extents(float extent) { return Vector{extent, extent, extent}; }
+
+intp CountInBox(ISpatialPartition *partition, const Vector &center,
+                const IHandleEntity *entity) {
+  Collector collector;
+  partition->EnumerateElementsInBox(kListMask, center - Extents(32),
+                                    center + Extents(32), false, &collector);
+  return collector.Count(entity);
+}
+
+struct RemoteQuery {
+  ISpatialPartition *partition;
+  Vector center;
+  const IHandleEntity *entity;
+  intp found_num;
+};
+
+unsigned RemoteQueryThreadFunc(void *ctx) {
+  ThreadSetDebugName("PartitionQuery");
+
+  auto *query = static_cast<RemoteQuery *>(ctx);
+  query->found_num =
+      CountInBox(query->partition, query->center, query->entity);
+  return 0;
+}
+
+// What a thread that queued nothing sees.
+intp CountInBoxOnOtherThread(ISpatialPartition *partition,
+                             const Vector &center,
+                             const IHandleEntity *entity) {
+  RemoteQuery query{partition, center, entity, -1};
+
+  ThreadHandle_t thread{CreateSimpleThread(&RemoteQueryThreadFunc, &query)};
+  ThreadJoin(thread, 0);
+  ReleaseThreadHandle(thread);
+
+  return query.found_num;
+}
+
+bool Expect(bool condition, const char *name, const char *what) {
+  if (!condition) {
+    Msg("%s: FAIL, %s.\n", name, what);
+  }
+  return condition;
+}
+
+bool Report(bool ok, const char *name) {
+  if (ok) {
+    Msg("%s: pass.\n", name);
+  }
+  return ok;
+}
+
+bool UpdatesTest() {
+  constexpr char kName[]{"Updates test"};
+
+  PartitionPtr partition{CreatePartition()};
+  TestEntity entity;
+
+  const Vector start{100, 100, 100};
+  const Vector end{5000, -3000, 200};
+
+  const SpatialPartitionHandle_t handle{partition->CreateHandle(
+      &entity, kListMask, start - Extents(16), start + Extents(16))};
+
+  bool ok{Expect(CountInBox(partition.get(), start, &entity) == 1, kName,
+                 "inserted element not found once")};
+
+  partition->ElementMoved(handle, end - Extents(16), end + Extents(16));
+  ok = Expect(CountInBox(partition.get(), start, &entity) == 0, kName,
+              "moved element still found at its old place") &&
+       ok;
+  ok = Expect(CountInBox(partition.get(), end, &entity) == 1, kName,
+              "moved element not found once at its new place") &&
+       ok;
+
+  partition->DestroyHandle(handle);
+  ok = Expect(CountInBox(partition.get(), end, &entity) == 0, kName,
+              "removed element still found") &&
+       ok;
+
+  return Report(ok, kName);
+}
+
+// Queued moves stay unpublished until a query of the moving thread overlaps
+// them or the frame ends.
+bool BatchingTest() {
+  constexpr char kName[]{"Batching test"};
+
+  PartitionPtr partition{CreatePartition()};
+  TestEntity entity;
+
+  // All in different coarse cells.
+  const Vector start{1000, 1000, 0};
+  const Vector end{3000, 3000, 0};
+  const Vector elsewhere{-9000, -9000, 0};
+
+  const SpatialPartitionHandle_t handle{partition->CreateHandle(
+      &entity, kListMask, start - Extents(16), start + Extents(16))};
+  partition->FrameUpdate();
+
+  partition->ElementMoved(handle, end - Extents(16), end + Extents(16));
+  bool ok{Expect(
+      CountInBoxOnOtherThread(partition.get(), end, &entity) == 0, kName,
+      "queued move seen by another thread before it was published")};
+
+  CountInBox(partition.get(), elsewhere, &entity);
+  ok = Expect(CountInBoxOnOtherThread(partition.get(), end, &entity) == 0,
+              kName, "query away from the move published the batch") &&
+       ok;
+
+  ok = Expect(CountInBox(partition.get(), end, &entity) == 1, kName,
+              "moving thread does not see its own move") &&
+       ok;
+  ok = Expect(CountInBoxOnOtherThread(partition.get(), end, &entity) == 1,
+              kName, "published move not seen by another thread") &&
+       ok;
+
+  partition->ElementMoved(handle, start - Extents(16), start + Extents(16));
+  partition->FrameUpdate();
+  ok = Expect(CountInBoxOnOtherThread(partition.get(), start, &entity) == 1,
+              kName, "FrameUpdate did not publish the batch") &&
+       ok;
+
+  return Report(ok, kName);
+}
+
+// A query walks the cell versions it started with, even when its own
+// callback republishes them and ends the frame.
+bool CopyOnWriteTest() {
+  constexpr char kName[]{"Copy-on-write test"};
+  constexpr int kEntitiesNum{8};
+
+  PartitionPtr partition{CreatePartition()};
+  TestEntity entities[kEntitiesNum];
+  SpatialPartitionHandle_t handles[kEntitiesNum];
+
+  // All in one fine cell, so the callback runs in the middle of its walk.
+  const Vector cell{128, 128, 128};
+  const Vector away{-6000, -6000, -6000};
+
+  for (int i{0}; i < kEntitiesNum; i++) {
+    handles[i] = partition->CreateHandle(
+        &entities[i], kListMask, cell - Extents(8), cell + Extents(8));
+  }
+  partition->FrameUpdate();
+
+  Collector outer, inner;
+  outer.on_first_hit = [&]() {
+    for (SpatialPartitionHandle_t handle : handles) {
+      partition->ElementMoved(handle, away - Extents(8), away + Extents(8));
+    }
+
+    // Publishes new versions of the cells the outer query is walking...
+    partition->EnumerateElementsInBox(kListMask, cell - Extents(32),
+                                      cell + Extents(32), false, &inner);
+    // ...and retires the old ones, which must outlive one frame.
+    partition->FrameUpdate();
+  };
+  partition->EnumerateElementsInBox(kListMask, cell - Extents(32),
+                                    cell + Extents(32), false, &outer);
+
+  bool ok{Expect(inner.hits.empty(), kName,
+                 "nested query saw the elements at their old place")};
+  for (const TestEntity &entity : entities) {
+    ok = Expect(outer.Count(&entity) == 1, kName,
+                "outer query did not finish its cell versions") &&
+         ok;
+    ok = Expect(CountInBox(partition.get(), away, &entity) == 1, kName,
+                "moved element not found once at its new place") &&
+         ok;
+  }
+
+  // Frees the retired versions.
+  partition->FrameUpdate();
+  partition->FrameUpdate();
+
+  return Report(ok, kName);
+}
+
+// Elements that span several cells are reported once per query.
+bool DedupTest() {
+  constexpr char kName[]{"Dedup test"};
+
+  struct Case {
+    const char *level;
+    Vector center;  // on a cell corner of the level
+    float extent;
+  };
+
+  const Case cases[]{
+      {"fine", Vector{256, 256, 0}, 100},
+      {"coarse", Vector{2048, 2048, 0}, 500},
+      {"overflow", Vector{-4096, 4096, 0}, 2500},
+  };
+
+  PartitionPtr partition{CreatePartition()};
+  TestEntity entities[std::size(cases)];
+
+  for (size_t i{0}; i < std::size(cases); i++) {
+    partition->CreateHandle(&entities[i], kListMask,
+                            cases[i].center - Extents(cases[i].extent),
+                            cases[i].center + Extents(cases[i].extent));
+  }
+  partition->FrameUpdate();
+
+  bool ok{true};
+  for (size_t i{0}; i < std::size(cases); i++) {
+    const Case &test{cases[i]};
+
+    // Diagonal through the corner, so the walk crosses every axis.
+    const Vector delta{test.extent * 1.5f, test.extent * 1.4f,
+                       test.extent * 1.3f};
+
+    Collector line;
+    Ray_t ray;
+    ray.Init(test.center - delta, test.center + delta);
+    partition->EnumerateElementsAlongRay(kListMask, ray, false, &line);
+
+    Collector swept;
+    ray.Init(test.center - delta, test.center + delta, -Extents(16),
+             Extents(16));
+    partition->EnumerateElementsAlongRay(kListMask, ray, false, &swept);
+
+    Collector box;
+    partition->EnumerateElementsInBox(
+        kListMask, test.center - Extents(test.extent * 2),
+        test.center + Extents(test.extent * 2), false, &box);
+
+    if (line.Count(&entities[i]) != 1 || swept.Count(&entities[i]) != 1 ||
+        box.Count(&entities[i]) != 1) {
+      Msg("%s: FAIL, %s level element reported %zd/%zd/%zd times by "
+          "ray/swept box/box.\n",
+          kName, test.level, line.Count(&entities[i]),
+          swept.Count(&entities[i]), box.Count(&entities[i]));
+      ok = false;
+    }
+  }
+
+  return Report(ok, kName);
+}
+
+}  // namespace
+
+namespace se::engine::tests::spatial_partition {
+
+bool RunGridPartitionTests() {
+  Msg("Grid spatial partition tests...\n");
+
+  bool ok{UpdatesTest()};
+  ok = BatchingTest() && ok;
+  ok = CopyOnWriteTest() && ok;
+  ok = DedupTest() && ok;
+
+  return ok;
+}
+
+}  // namespace se::engine::tests::spatial_partition
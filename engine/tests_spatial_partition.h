@@ -0,0 +1,16 @@
+// Copyright Valve Corporation, All rights reserved.
+//
+// Hashed grid spatial partition self-tests.
+
+#ifndef SE_ENGINE_TESTS_SPATIAL_PARTITION_H_
+#define SE_ENGINE_TESTS_SPATIAL_PARTITION_H_
+
+namespace se::engine::tests::spatial_partition {
+
+// Runs the grid tree tests: updates, batching, copy-on-write cells, retire
+// lists and ray walk dedup.
+bool RunGridPartitionTests();
+
+}  // namespace se::engine::tests::spatial_partition
+
+#endif  // !SE_ENGINE_TESTS_SPATIAL_PARTITION_H_
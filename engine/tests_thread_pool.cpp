@@ -289,6 +289,159 @@ void TestForcedExecute(IThreadPool *pool) {
       max_threads_num);
 }
 
+// Job which records that it ran and computes a result from its index. Roots
+// queue children from the pool thread, so they land in that thread's deque and
+// have to be stolen by the others.
+class StealTestJob : public CJob {
+ public:
+  static constexpr int kChildrenNum{3};
+
+  StealTestJob(IThreadPool *pool, int index, bool is_root,
+               std::atomic_int *runs_num, unsigned *results,
+               std::atomic_int &done_num)
+      : pool_{pool},
+        index_{index},
+        is_root_{is_root},
+        runs_num_{runs_num},
+        results_{results},
+        done_num_{done_num} {}
+
+  static unsigned ExpectedResult(int index) {
+    return HashInt(index) ^ static_cast<unsigned>(index * 2654435761U);
+  }
+
+  JobStatus_t DoExecute() override {
+    if (is_root_) {
+      for (int i{1}; i <= kChildrenNum; i++) {
+        auto *child = new StealTestJob{pool_, index_ + i, false,
+                                       runs_num_, results_, done_num_};
+        child->SetFlags(JF_QUEUE);
+
+        pool_->AddJob(child);
+
+        child->Release();
+      }
+    }
+
+    runs_num_[index_].fetch_add(1, std::memory_order::memory_order_relaxed);
+    results_[index_] = ExpectedResult(index_);
+
+    done_num_.fetch_add(1, std::memory_order::memory_order_release);
+
+    return JOB_OK;
+  }
+
+ private:
+  IThreadPool *pool_;
+  const int index_;
+  const bool is_root_;
+  std::atomic_int *runs_num_;
+  unsigned *results_;
+  std::atomic_int &done_num_;
+};
+
+struct StealTestItem {
+  std::atomic_int runs_num;
+  unsigned result;
+  int index;
+};
+
+void ProcessStealTestItem(StealTestItem &item) {
+  item.runs_num.fetch_add(1, std::memory_order::memory_order_relaxed);
+  item.result = StealTestJob::ExpectedResult(item.index);
+}
+
+bool TestWorkStealing(IThreadPool *pool) {
+  const int max_threads_num{GetCPUInformation()->m_nLogicalProcessors};
+  constexpr int kRootsNum{1000};
+  constexpr int kJobsNum{kRootsNum * (StealTestJob::kChildrenNum + 1)};
+  constexpr int kItemsNum{10000};
+
+  Msg("RunThreadPoolTests: Work stealing (%d jobs, %d items, max threads "
+      "%d).\n",
+      kJobsNum, kItemsNum, max_threads_num);
+
+  bool is_ok{true};
+
+  for (int i{1}; i <= max_threads_num; i += 2) {
+    ThreadPoolStartParams_t params;
+    params.nThreads = i;
+    params.bWorkStealing = true;
+    pool->Start(params, "StealTstJob");
+
+    // Queued jobs, roots from this thread and children from pool threads.
+    std::unique_ptr<std::atomic_int[]> runs_num{
+        std::make_unique<std::atomic_int[]>(kJobsNum)};
+    std::unique_ptr<unsigned[]> results{std::make_unique<unsigned[]>(kJobsNum)};
+    std::atomic_int done_num{0};
+
+    for (int j{0}; j < kJobsNum; j++) {
+      runs_num[j].store(0, std::memory_order::memory_order_relaxed);
+    }
+
+    for (int j{0}; j < kJobsNum; j += StealTestJob::kChildrenNum + 1) {
+      auto *job = new StealTestJob{pool, j, true, runs_num.get(),
+                                   results.get(), done_num};
+      job->SetFlags(JF_QUEUE);
+
+      pool->AddJob(job);
+
+      job->Release();
+    }
+
+    // Jobs may not run at all if the pool loses them, so don't wait forever.
+    for (int waited_ms{0};
+         done_num.load(std::memory_order::memory_order_acquire) < kJobsNum &&
+         waited_ms < 10000;
+         waited_ms++) {
+      ThreadSleep(1);
+    }
+
+    // Ranges, executed by several pool threads at once.
+    std::unique_ptr<StealTestItem[]> items{
+        std::make_unique<StealTestItem[]>(kItemsNum)};
+    for (int j{0}; j < kItemsNum; j++) {
+      items[j].runs_num.store(0, std::memory_order::memory_order_relaxed);
+      items[j].result = 0;
+      items[j].index = j;
+    }
+
+    ParallelProcess("StealTstRange", pool, items.get(), kItemsNum,
+                    &ProcessStealTestItem);
+
+    pool->Stop();
+
+    int bad_jobs_num{0}, bad_items_num{0};
+    for (int j{0}; j < kJobsNum; j++) {
+      if (runs_num[j].load(std::memory_order::memory_order_relaxed) != 1 ||
+          results[j] != StealTestJob::ExpectedResult(j)) {
+        ++bad_jobs_num;
+      }
+    }
+    for (int j{0}; j < kItemsNum; j++) {
+      if (items[j].runs_num.load(std::memory_order::memory_order_relaxed) !=
+              1 ||
+          items[j].result != StealTestJob::ExpectedResult(j)) {
+        ++bad_items_num;
+      }
+    }
+
+    Msg("RunThreadPoolTests:     %d threads -- %d of %d jobs and %d of %d "
+        "items did not run exactly once.\n",
+        i, bad_jobs_num, kJobsNum, bad_items_num, kItemsNum);
+
+    if (bad_jobs_num || bad_items_num) {
+      Msg("Work stealing test failed!\n");
+
+      DebuggerBreakIfDebugging();
+
+      is_ok = false;
+    }
+  }
+
+  return is_ok;
+}
+
 class ScopedThreadPool {
  public:
   ScopedThreadPool() : pool_{CreateThreadPool()} {}
@@ -331,7 +484,7 @@ std::uintptr_t GetProcessAffinity() {
 
 namespace se::engine::tests::thread_pool {
 
-void RunThreadPoolTests() {
+bool RunThreadPoolTests() {
   ScopedThreadPool pool;
 
   const std::uintptr_t process_mask{GetProcessAffinity()};
@@ -400,6 +553,11 @@ void RunThreadPoolTests() {
   }
 
   TestForcedExecute(&pool);
+
+  bool ok{true};
+  ok = TestWorkStealing(&pool) && ok;
+
+  return ok;
 }
 
 }  // namespace se::engine::tests::thread_pool
@@ -7,7 +7,8 @@
 
 namespace se::engine::tests::thread_pool {
 
-void RunThreadPoolTests();
+// Returns false if any test that checks its results failed.
+bool RunThreadPoolTests();
 
 }  // namespace se::engine::tests::thread_pool
 
@@ -0,0 +1,133 @@
+// Copyright Valve Corporation, All rights reserved.
+//
+// Thread pool scheduling microbenchmark.
+
+#include "tests_thread_pool_bench.h"
+
+#include <atomic>
+#include <memory>
+
+#include "tier0/dbg.h"
+#include "tier0/fasttimer.h"
+#include "tier0/threadtools.h"
+#include "tier1/generichash.h"
+#include "vstdlib/jobthread.h"
+
+#include "tier0/memdbgon.h"
+
+namespace {
+
+// Small, roughly equal items, like packing entities or building snapshots.
+struct BenchItem {
+  unsigned char data[64];
+  unsigned hash;
+};
+
+void ProcessBenchItem(BenchItem &item) {
+  unsigned hash{0};
+
+  for (int i{0}; i < 16; i++) {
+    hash ^= HashBlock(item.data, sizeof(item.data)) + i;
+  }
+
+  item.hash = hash;
+}
+
+std::atomic_int g_flood_jobs_done_num{0};
+
+void FloodJob(BenchItem *item) {
+  ProcessBenchItem(*item);
+
+  g_flood_jobs_done_num.fetch_add(1, std::memory_order::memory_order_release);
+}
+
+class ScopedBenchPool {
+ public:
+  ScopedBenchPool(bool work_stealing) : pool_{CreateThreadPool()} {
+    ThreadPoolStartParams_t params;
+    params.nThreads = GetCPUInformation()->m_nLogicalProcessors - 1;
+    params.bWorkStealing = work_stealing;
+
+    pool_->Start(params, work_stealing ? "StealBench" : "SharedBench");
+  }
+  ~ScopedBenchPool() {
+    pool_->Stop();
+    DestroyThreadPool(pool_);
+  }
+
+  IThreadPool *operator->() { return pool_; }
+  IThreadPool *get() { return pool_; }
+
+ private:
+  IThreadPool *pool_;
+};
+
+void Bench(bool work_stealing, int rounds_num) {
+  constexpr intp kItemsNum{512};
+  constexpr int kFloodJobsNum{4096};
+
+  std::unique_ptr<BenchItem[]> items{std::make_unique<BenchItem[]>(kItemsNum)};
+  for (intp i{0}; i < kItemsNum; i++) {
+    for (size_t j{0}; j < std::size(items[i].data); j++) {
+      items[i].data[j] = static_cast<unsigned char>(i + j);
+    }
+  }
+
+  ScopedBenchPool pool{work_stealing};
+  const char *mode{work_stealing ? "work stealing" : "shared queues"};
+
+  // ParallelProcess fan-out: one range per round.
+  CFastTimer timer;
+  timer.Start();
+
+  for (int r{0}; r < rounds_num; r++) {
+    ParallelProcess("ThreadPoolBench", pool.get(), items.get(), kItemsNum,
+                    &ProcessBenchItem);
+  }
+
+  timer.End();
+
+  Msg("RunThreadPoolBenchmark: %s, %zd threads -- %d ParallelProcess x %zd "
+      "items in %.4fms (%.4fus per fan-out).\n",
+      mode, pool->NumThreads(), rounds_num, kItemsNum,
+      timer.GetDuration().GetMillisecondsF(),
+      timer.GetDuration().GetMicrosecondsF() / rounds_num);
+
+  // Job flood: lots of tiny independent jobs queued from the main thread.
+  timer.Start();
+
+  for (int r{0}; r < rounds_num; r++) {
+    g_flood_jobs_done_num.store(0, std::memory_order::memory_order_relaxed);
+
+    for (int j{0}; j < kFloodJobsNum; j++) {
+      pool->QueueCall(&FloodJob, &items[j % kItemsNum])->Release();
+    }
+
+    while (g_flood_jobs_done_num.load(std::memory_order::memory_order_acquire) <
+           kFloodJobsNum) {
+      ThreadPause();
+    }
+  }
+
+  timer.End();
+
+  Msg("RunThreadPoolBenchmark: %s, %zd threads -- %d x %d queued jobs in "
+      "%.4fms (%.4fus per job).\n",
+      mode, pool->NumThreads(), rounds_num, kFloodJobsNum,
+      timer.GetDuration().GetMillisecondsF(),
+      timer.GetDuration().GetMicrosecondsF() /
+          (static_cast<double>(rounds_num) * kFloodJobsNum));
+}
+
+}  // namespace
+
+namespace se::engine::tests::thread_pool {
+
+void RunThreadPoolBenchmark(int rounds_num) {
+  if (rounds_num <= 0) rounds_num = 1;
+
+  Bench(false, rounds_num);
+  Bench(true, rounds_num);
+}
+
+}  // namespace se::engine::tests::thread_pool
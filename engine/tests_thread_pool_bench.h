@@ -0,0 +1,16 @@
+// Copyright Valve Corporation, All rights reserved.
+//
+// Thread pool scheduling microbenchmark.
+
+#ifndef SE_ENGINE_TESTS_THREAD_POOL_BENCH_H_
+#define SE_ENGINE_TESTS_THREAD_POOL_BENCH_H_
+
+namespace se::engine::tests::thread_pool {
+
+// Compares shared priority queues against work stealing on ParallelProcess
+// fan-outs and a flood of small queued jobs.
+void RunThreadPoolBenchmark(int rounds_num);
+
+}  // namespace se::engine::tests::thread_pool
+
+#endif  // !SE_ENGINE_TESTS_THREAD_POOL_BENCH_H_
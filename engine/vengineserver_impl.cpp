@@ -48,6 +48,7 @@
 #include "replay_internal.h"
 #include "replayserver.h"
 #include "replay/iserverengine.h"
+#include "sv_clusterindex.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1638,6 +1639,12 @@ public:
 		sv.SetPausedForced( bPaused, flDuration );
 	}
 
+	int GetTransmitCandidates( const CCheckTransmitInfo *pInfo, int nSkyboxArea,
+		const unsigned short *pEdictIndices, int nEdicts, unsigned short *pOutEdicts ) override
+	{
+		return g_EntityClusterIndex.GetTransmitCandidates( pInfo, nSkyboxArea, pEdictIndices, nEdicts, pOutEdicts );
+	}
+
 private:
 	
 	// Purpose: Sends a temp entity to the client ( follows the format of the original MESSAGE_BEGIN stuff from HL1
@@ -1685,10 +1692,12 @@ static CVEngineServer22 g_VEngineServer22;
 // INTERFACEVERSION_VENGINESERVER_VERSION_21 is compatible with 22 latest since we only added virtuals to the end, so expose that as well.
 EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CVEngineServer, IVEngineServer021, INTERFACEVERSION_VENGINESERVER_VERSION_21, g_VEngineServer22 );
 EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CVEngineServer, IVEngineServer022, INTERFACEVERSION_VENGINESERVER_VERSION_22, g_VEngineServer22 );
+// INTERFACEVERSION_VENGINESERVER_VERSION_23 is compatible with 24 since GetTransmitCandidates was added to the end.
+EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CVEngineServer, IVEngineServer023, INTERFACEVERSION_VENGINESERVER_VERSION_23, g_VEngineServer );
 EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CVEngineServer, IVEngineServer, INTERFACEVERSION_VENGINESERVER, g_VEngineServer );
 
 // When bumping the version to this interface, check that our assumption is still valid and expose the older version in the same way
-COMPILE_TIME_ASSERT( INTERFACEVERSION_VENGINESERVER_INT == 23 );
+COMPILE_TIME_ASSERT( INTERFACEVERSION_VENGINESERVER_INT == 24 );
 
 //-----------------------------------------------------------------------------
 // Expose CVEngineServer to the engine.
@@ -1855,6 +1864,9 @@ void CVEngineServer::BuildEntityClusterList( edict_t *pEdict, PVSInfo_t *pPVSInf
 	if ( !pEdict )
 		return;
 
+	// Keep the transmit cluster index in sync, whichever way we leave
+	RunCodeAtScopeExit( g_EntityClusterIndex.Update( pEdict->m_EdictIndex, *pPVSInfo ) );
+
 	ICollideable *pCollideable = pEdict->GetCollideable();
 	Assert( pCollideable );
 	if ( !pCollideable )
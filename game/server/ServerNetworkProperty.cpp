@@ -84,6 +84,11 @@ void CServerNetworkProperty::AttachEdict( edict_t *pRequiredEdict )
 
 	m_pPev = pRequiredEdict;
 	m_pPev->SetEdict( GetBaseEntity(), true );
+
+	// SetEdict resets the state flags, the engine may still index the edict
+	// with its previous owner's PVS information.
+	MarkPVSInformationDirty();
+	UpdateNetworkChildFlag();
 }
 
 void CServerNetworkProperty::DetachEdict()
@@ -146,6 +151,7 @@ void CServerNetworkProperty::RecomputePVSInformation()
 	if ( m_pPev && ( ( m_pPev->m_fStateFlags & FL_EDICT_DIRTY_PVS_INFORMATION ) != 0 ) )
 	{
 		m_pPev->m_fStateFlags &= ~FL_EDICT_DIRTY_PVS_INFORMATION;
+		UpdateNetworkChildFlag();
 		engine->BuildEntityClusterList( edict(), &m_PVSInfo );
 	}
 }
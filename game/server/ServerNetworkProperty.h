@@ -71,6 +71,7 @@ public:
 	// Sets the network parent
 	void SetNetworkParent( EHANDLE hParent );
 	CServerNetworkProperty* GetNetworkParent();
+	void UpdateNetworkChildFlag();
 
 	// This is useful for entities that don't change frequently or that the client
 	// doesn't need updates on very often. If you use this mode, the server will only try to
@@ -170,6 +171,26 @@ inline void CServerNetworkProperty::MarkPVSInformationDirty()
 inline void CServerNetworkProperty::SetNetworkParent( EHANDLE hParent )
 {
 	m_hParent = hParent;
+	UpdateNetworkChildFlag();
+}
+
+
+//-----------------------------------------------------------------------------
+// Children may be sent with their parent, the engine must not PVS cull them
+//-----------------------------------------------------------------------------
+inline void CServerNetworkProperty::UpdateNetworkChildFlag()
+{
+	if ( !m_pPev )
+		return;
+
+	if ( m_hParent.IsValid() )
+	{
+		m_pPev->m_fStateFlags |= FL_EDICT_NETWORK_CHILD;
+	}
+	else
+	{
+		m_pPev->m_fStateFlags &= ~FL_EDICT_NETWORK_CHILD;
+	}
 }
 
 
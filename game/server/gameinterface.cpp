@@ -2441,6 +2441,24 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 		    bIsReplay == ( pInfo->m_pTransmitAlways != NULL) );
 #endif
 
+	// Let the engine drop entities outside the PVS clusters up front. HLTV and
+	// Replay don't cull against the PVS, and sv_force_transmit_ents sends
+	// everything regardless of it, so they need the full list.
+	unsigned short candidates[MAX_EDICTS];
+#ifndef _X360
+	if ( !bIsHLTV && !bIsReplay && !sv_force_transmit_ents.GetBool() )
+#else
+	if ( !sv_force_transmit_ents.GetBool() )
+#endif
+	{
+		const int nCandidates = engine->GetTransmitCandidates( pInfo, skyBoxArea, pEdictIndices, nEdicts, candidates );
+		if ( nCandidates >= 0 )
+		{
+			pEdictIndices = candidates;
+			nEdicts = nCandidates;
+		}
+	}
+
 	for ( int i=0; i < nEdicts; i++ )
 	{
 		int iEdict = pEdictIndices[i];
@@ -10,8 +10,8 @@
 #include "igamesystem.h"
 #include "ilagcompensationmanager.h"
 #include "inetchannelinfo.h"
-#include "utllinkedlist.h"
 #include "BaseAnimatingOverlay.h"
+#include "mathlib/ssemath.h"
 #include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -134,6 +134,226 @@ public:
 	float					m_flPoseParameters[MAXSTUDIOPOSEPARAM];
 };
 
+//-----------------------------------------------------------------------------
+// Purpose: Animation part of a history record, only read once the record to
+// backtrack to is known.
+//-----------------------------------------------------------------------------
+struct LagAnimRecord
+{
+	LayerRecord				m_layerRecords[MAX_LAYER_RECORDS];
+	int						m_masterSequence;
+	float					m_masterCycle;
+
+	float					m_flPoseParameters[MAXSTUDIOPOSEPARAM];
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Lag history of one player, a ring of records from oldest to newest
+// stored as structure of arrays.
+//
+// Simulation times only grow, so the record to backtrack to is a binary
+// search away. Every record also keeps how far the player moved 2D to the next
+// newer record (or FLT_MAX if the player was dead), so validating a backtrack
+// is one SIMD compare of that array against the teleport distance instead of
+// a walk over the positions.
+//-----------------------------------------------------------------------------
+class CLagTrack
+{
+public:
+	CLagTrack() : m_nMask( 0 ), m_iTail( 0 ), m_nCount( 0 ) {}
+
+	int		Count() const { return m_nCount; }
+
+	// Ring slot of the i-th oldest record
+	int		Slot( int i ) const { Assert( i >= 0 && i < m_nCount ); return ( m_iTail + i ) & m_nMask; }
+	int		TailSlot() const { return Slot( 0 ); }
+	int		HeadSlot() const { return Slot( m_nCount - 1 ); }
+
+	void	RemoveTail()
+	{
+		Assert( m_nCount > 0 );
+		m_iTail = ( m_iTail + 1 ) & m_nMask;
+		--m_nCount;
+	}
+
+	void	RemoveAll()
+	{
+		m_iTail = 0;
+		m_nCount = 0;
+	}
+
+	void	Purge();
+
+	// Adds a new newest record and returns its slot for the caller to fill in
+	// the rest. Drops the oldest record if the ring is full.
+	int		AddToHead( float flSimulationTime, const Vector &vecOrigin, bool bAlive );
+
+	// Index of the newest record not newer than flTargetTime, or the oldest
+	// record if they are all newer.
+	int		FindRecord( float flTargetTime ) const;
+
+	// Is any record from the i-th oldest one on dead or followed by a move of
+	// more than sqrt( flMaxDistSqr )?
+	bool	IsBrokenFrom( int i, float flMaxDistSqr ) const;
+
+	CUtlVector< float >			m_flSimulationTime;
+	CUtlVector< float >			m_flMoveDistSqr;	// 2D distance to the next record squared, FLT_MAX if dead
+	CUtlVector< Vector >		m_vecOrigin;
+	CUtlVector< QAngle >		m_vecAngles;
+	CUtlVector< Vector >		m_vecMinsPreScaled;
+	CUtlVector< Vector >		m_vecMaxsPreScaled;
+	CUtlVector< LagAnimRecord >	m_Animation;
+
+private:
+	void	Allocate();
+
+	int		m_nMask;	// capacity - 1, 0 until the first record
+	int		m_iTail;	// slot of the oldest record
+	int		m_nCount;
+};
+
+void CLagTrack::Allocate()
+{
+	// A player gets at most one record per tick and records older than
+	// sv_maxunlag are dropped each frame, so this never has to overwrite.
+	float flMaxUnlag = 1.0f;
+	(void)sv_maxunlag.GetMax( flMaxUnlag );
+
+	const int nCapacity = static_cast<int>( SmallestPowerOfTwoGreaterOrEqual( TIME_TO_TICKS( flMaxUnlag ) + 2 ) );
+
+	m_flSimulationTime.SetCount( nCapacity );
+	m_flMoveDistSqr.SetCount( nCapacity );
+	m_vecOrigin.SetCount( nCapacity );
+	m_vecAngles.SetCount( nCapacity );
+	m_vecMinsPreScaled.SetCount( nCapacity );
+	m_vecMaxsPreScaled.SetCount( nCapacity );
+	m_Animation.SetCount( nCapacity );
+
+	m_nMask = nCapacity - 1;
+	m_iTail = 0;
+	m_nCount = 0;
+}
+
+void CLagTrack::Purge()
+{
+	m_flSimulationTime.Purge();
+	m_flMoveDistSqr.Purge();
+	m_vecOrigin.Purge();
+	m_vecAngles.Purge();
+	m_vecMinsPreScaled.Purge();
+	m_vecMaxsPreScaled.Purge();
+	m_Animation.Purge();
+
+	m_nMask = 0;
+	m_iTail = 0;
+	m_nCount = 0;
+}
+
+int CLagTrack::AddToHead( float flSimulationTime, const Vector &vecOrigin, bool bAlive )
+{
+	if ( !m_nMask )
+	{
+		Allocate();
+	}
+
+	if ( m_nCount > m_nMask )
+	{
+		Assert( 0 ); // tickrate above what the ring was sized for
+		RemoveTail();
+	}
+
+	if ( m_nCount > 0 )
+	{
+		// Finish the move distance of the previous newest record.
+		const int iHead = HeadSlot();
+		if ( m_flMoveDistSqr[ iHead ] != FLT_MAX )
+		{
+			m_flMoveDistSqr[ iHead ] = ( vecOrigin - m_vecOrigin[ iHead ] ).Length2DSqr();
+		}
+	}
+
+	const int slot = ( m_iTail + m_nCount ) & m_nMask;
+	++m_nCount;
+
+	m_flSimulationTime[ slot ] = flSimulationTime;
+	m_flMoveDistSqr[ slot ] = bAlive ? 0.0f : FLT_MAX;
+	m_vecOrigin[ slot ] = vecOrigin;
+
+	return slot;
+}
+
+int CLagTrack::FindRecord( float flTargetTime ) const
+{
+	// first record newer than the target time
+	int lo = 0;
+	int hi = m_nCount;
+	while ( lo < hi )
+	{
+		const int mid = ( lo + hi ) / 2;
+		if ( m_flSimulationTime[ Slot( mid ) ] <= flTargetTime )
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	return lo > 0 ? lo - 1 : 0;
+}
+
+// Is any of the values greater than the limit?
+static bool AnyGreaterThan( const float *pValues, int nCount, float flLimit )
+{
+	const fltx4 limit = ReplicateX4( flLimit );
+
+	int i = 0;
+	for ( ; i + 4 <= nCount; i += 4 )
+	{
+		if ( TestSignSIMD( CmpGtSIMD( LoadUnalignedSIMD( pValues + i ), limit ) ) )
+			return true;
+	}
+
+	for ( ; i < nCount; ++i )
+	{
+		if ( pValues[i] > flLimit )
+			return true;
+	}
+
+	return false;
+}
+
+bool CLagTrack::IsBrokenFrom( int i, float flMaxDistSqr ) const
+{
+	// The records from i on are at most two contiguous runs of the ring.
+	const int first = Slot( i );
+	const int count = m_nCount - i;
+	const int nFirstRun = Min( count, m_nMask + 1 - first );
+
+	const float *pMoveDistSqr = m_flMoveDistSqr.Base();
+	return AnyGreaterThan( pMoveDistSqr + first, nFirstRun, flMaxDistSqr ) ||
+		AnyGreaterThan( pMoveDistSqr, count - nFirstRun, flMaxDistSqr );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Where one player gets moved back to, see FindBacktrack.
+//-----------------------------------------------------------------------------
+struct LagBacktrack
+{
+	CBasePlayer				*m_pPlayer;
+	const CLagTrack			*m_pTrack;
+	int						m_iRecord;		// slot of the record to backtrack to
+	int						m_iPrevRecord;	// slot of the next newer record, -1 if none
+	float					m_flFrac;		// how far to interpolate toward m_iPrevRecord
+
+	// Filled in by InterpolateBacktracks
+	Vector					m_vecOrigin;
+	QAngle					m_vecAngles;
+	Vector					m_vecMinsPreScaled;
+	Vector					m_vecMaxsPreScaled;
+};
+
 
 //
 // Try to take the player from his current origin to vWantedPos.
@@ -220,6 +440,11 @@ public:
 
 private:
 	void			BacktrackPlayer( CBasePlayer *player, float flTargetTime );
+	void			BacktrackPlayers( CBasePlayer * const *ppPlayers, int nPlayers, float flTargetTime );
+
+	bool			FindBacktrack( CBasePlayer *pPlayer, float flTargetTime, LagBacktrack &backtrack ) const;
+	void			InterpolateBacktracks( LagBacktrack *pBacktracks, int nBacktracks ) const;
+	void			ApplyBacktrack( const LagBacktrack &backtrack, float flTargetTime );
 
 	void ClearHistory()
 	{
@@ -227,8 +452,11 @@ private:
 			m_PlayerTrack[i].Purge();
 	}
 
-	// keep a list of lag records for each player
-	CUtlFixedLinkedList< LagRecord >	m_PlayerTrack[ MAX_PLAYERS ];
+	// keep a history of lag records for each player
+	CLagTrack				m_PlayerTrack[ MAX_PLAYERS ];
+
+	// Scratchpad for the players backtracked by one command
+	LagBacktrack			m_Backtracks[ MAX_PLAYERS ];
 
 	// Scratchpad for determining what needs to be restored
 	CBitVec<MAX_PLAYERS>	m_RestorePlayer;
@@ -272,7 +500,7 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	{
 		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
 
-		CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[i-1];
+		CLagTrack *track = &m_PlayerTrack[i-1];
 
 		if ( !pPlayer )
 		{
@@ -284,47 +512,32 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 			continue;
 		}
 
-		Assert( track->Count() < 1000 ); // insanity check
-
 		// remove tail records that are too old
-		intp tailIndex = track->Tail();
-		while ( track->IsValidIndex( tailIndex ) )
+		while ( track->Count() > 0 )
 		{
-			LagRecord &tail = track->Element( tailIndex );
-
 			// if tail is within limits, stop
-			if ( tail.m_flSimulationTime >= flDeadtime )
+			if ( track->m_flSimulationTime[ track->TailSlot() ] >= flDeadtime )
 				break;
-			
-			// remove tail, get new tail
-			track->Remove( tailIndex );
-			tailIndex = track->Tail();
+
+			track->RemoveTail();
 		}
 
 		// check if head has same simulation time
 		if ( track->Count() > 0 )
 		{
-			LagRecord &head = track->Element( track->Head() );
-
 			// check if player changed simulation time since last time updated
-			if ( head.m_flSimulationTime >= pPlayer->GetSimulationTime() )
+			if ( track->m_flSimulationTime[ track->HeadSlot() ] >= pPlayer->GetSimulationTime() )
 				continue; // don't add new entry for same or older time
 		}
 
 		// add new record to player track
-		LagRecord &record = track->Element( track->AddToHead() );
+		const int slot = track->AddToHead( pPlayer->GetSimulationTime(), pPlayer->GetLocalOrigin(), pPlayer->IsAlive() );
 
-		record.m_fFlags = 0;
-		if ( pPlayer->IsAlive() )
-		{
-			record.m_fFlags |= LC_ALIVE;
-		}
+		track->m_vecAngles[ slot ]			= pPlayer->GetLocalAngles();
+		track->m_vecMinsPreScaled[ slot ]	= pPlayer->CollisionProp()->OBBMinsPreScaled();
+		track->m_vecMaxsPreScaled[ slot ]	= pPlayer->CollisionProp()->OBBMaxsPreScaled();
 
-		record.m_flSimulationTime	= pPlayer->GetSimulationTime();
-		record.m_vecAngles			= pPlayer->GetLocalAngles();
-		record.m_vecOrigin			= pPlayer->GetLocalOrigin();
-		record.m_vecMinsPreScaled	= pPlayer->CollisionProp()->OBBMinsPreScaled();
-		record.m_vecMaxsPreScaled	= pPlayer->CollisionProp()->OBBMaxsPreScaled();
+		LagAnimRecord &record = track->m_Animation[ slot ];
 
 		int layerCount = pPlayer->GetNumAnimOverlays();
 		for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
@@ -421,7 +634,10 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		targettick = gpGlobals->tickcount - TIME_TO_TICKS( correct );
 	}
 	
-	// Iterate all active players
+	// Collect the players to move back
+	CBasePlayer *pTargets[ MAX_PLAYERS ];
+	int nTargets = 0;
+
 	const CBitVec<MAX_EDICTS> *pEntityTransmitBits = engine->GetEntityTransmitBitsForClient( player->entindex() - 1 );
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
 	{
@@ -442,110 +658,188 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		if ( !player->WantsLagCompensationOnEntity( pPlayer, cmd, pEntityTransmitBits ) )
 			continue;
 
-		// Move other player back in time
-		BacktrackPlayer( pPlayer, TICKS_TO_TIME( targettick ) );
+		pTargets[ nTargets++ ] = pPlayer;
 	}
+
+	// Move other players back in time
+	BacktrackPlayers( pTargets, nTargets, TICKS_TO_TIME( targettick ) );
 }
 
 void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTargetTime )
 {
-	Vector org;
-	Vector minsPreScaled;
-	Vector maxsPreScaled;
-	QAngle ang;
-
 	VPROF_BUDGET( "BacktrackPlayer", "CLagCompensationManager" );
-	int pl_index = pPlayer->entindex() - 1;
-
-	// get track history of this player
-	CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[ pl_index ];
 
-	// check if we have at leat one entry
-	if ( track->Count() <= 0 )
+	LagBacktrack backtrack;
+	if ( !FindBacktrack( pPlayer, flTargetTime, backtrack ) )
 		return;
 
-	intp curr = track->Head();
+	InterpolateBacktracks( &backtrack, 1 );
+	ApplyBacktrack( backtrack, flTargetTime );
+}
 
-	LagRecord *prevRecord = NULL;
-	LagRecord *record = NULL;
+//-----------------------------------------------------------------------------
+// Purpose: Moves all the players a command wants lag compensated back in one
+// pass: find their records first, then interpolate them four at a time, then
+// move them.
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::BacktrackPlayers( CBasePlayer * const *ppPlayers, int nPlayers, float flTargetTime )
+{
+	VPROF_BUDGET( "BacktrackPlayers", "CLagCompensationManager" );
 
-	Vector prevOrg = pPlayer->GetLocalOrigin();
-	
-	// Walk context looking for any invalidating event
-	while( track->IsValidIndex(curr) )
+	int nBacktracks = 0;
+	for ( int i = 0; i < nPlayers; i++ )
 	{
-		// remember last record
-		prevRecord = record;
-
-		// get next record
-		record = &track->Element( curr );
-
-		if ( !(record->m_fFlags & LC_ALIVE) )
-		{
-			// player most be alive, lost track
-			return;
-		}
-
-		Vector delta = record->m_vecOrigin - prevOrg;
-		if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
+		if ( FindBacktrack( ppPlayers[i], flTargetTime, m_Backtracks[ nBacktracks ] ) )
 		{
-			// lost track, too much difference
-			return; 
+			++nBacktracks;
 		}
-
-		// did we find a context smaller than target time ?
-		if ( record->m_flSimulationTime <= flTargetTime )
-			break; // hurra, stop
-
-		prevOrg = record->m_vecOrigin;
-
-		// go one step back
-		curr = track->Next( curr );
 	}
 
-	Assert( record );
+	InterpolateBacktracks( m_Backtracks, nBacktracks );
 
-	if ( !record )
+	for ( int i = 0; i < nBacktracks; i++ )
 	{
-		if ( sv_unlag_debug.GetBool() )
+		const LagBacktrack &backtrack = m_Backtracks[i];
+
+		// sv_unlag_fixstuck may have moved this player back already while
+		// unsticking an earlier one, so it no longer is where it was found.
+		if ( m_RestorePlayer.Get( backtrack.m_pPlayer->entindex() - 1 ) )
 		{
-			DevMsg( "No valid positions in history for BacktrackPlayer client ( %s )\n", pPlayer->GetPlayerName() );
+			BacktrackPlayer( backtrack.m_pPlayer, flTargetTime );
+			continue;
 		}
 
-		return; // that should never happen
+		ApplyBacktrack( backtrack, flTargetTime );
 	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds the records to move a player back to, false if the history
+// is empty or lost track of the player since the target time.
+//-----------------------------------------------------------------------------
+bool CLagCompensationManager::FindBacktrack( CBasePlayer *pPlayer, float flTargetTime, LagBacktrack &backtrack ) const
+{
+	// get track history of this player
+	const CLagTrack *track = &m_PlayerTrack[ pPlayer->entindex() - 1 ];
 
-	float frac = 0.0f;
-	if ( prevRecord && 
-		 (record->m_flSimulationTime < flTargetTime) &&
-		 (record->m_flSimulationTime < prevRecord->m_flSimulationTime) )
+	// check if we have at leat one entry
+	if ( track->Count() <= 0 )
+		return false;
+
+	// Player must have been alive and not moved too far by game code between
+	// any two records since the target time, or we lost track.
+	const int head = track->HeadSlot();
+	if ( ( pPlayer->GetLocalOrigin() - track->m_vecOrigin[ head ] ).Length2DSqr() > m_flTeleportDistanceSqr )
+		return false;
+
+	const int i = track->FindRecord( flTargetTime );
+	if ( track->IsBrokenFrom( i, m_flTeleportDistanceSqr ) )
+		return false;
+
+	backtrack.m_pPlayer = pPlayer;
+	backtrack.m_pTrack = track;
+	backtrack.m_iRecord = track->Slot( i );
+	backtrack.m_iPrevRecord = i + 1 < track->Count() ? track->Slot( i + 1 ) : -1;
+	backtrack.m_flFrac = 0.0f;
+
+	const float flRecordTime = track->m_flSimulationTime[ backtrack.m_iRecord ];
+	if ( backtrack.m_iPrevRecord >= 0 && flRecordTime < flTargetTime )
 	{
 		// we didn't find the exact time but have a valid previous record
 		// so interpolate between these two records;
+		const float flPrevTime = track->m_flSimulationTime[ backtrack.m_iPrevRecord ];
 
-		Assert( prevRecord->m_flSimulationTime > record->m_flSimulationTime );
-		Assert( flTargetTime < prevRecord->m_flSimulationTime );
+		Assert( flPrevTime > flRecordTime );
+		Assert( flTargetTime < flPrevTime );
 
 		// calc fraction between both records
-		frac = ( flTargetTime - record->m_flSimulationTime ) / 
-			( prevRecord->m_flSimulationTime - record->m_flSimulationTime );
+		backtrack.m_flFrac = ( flTargetTime - flRecordTime ) / ( flPrevTime - flRecordTime );
 
-		Assert( frac > 0 && frac < 1 ); // should never extrapolate
+		Assert( backtrack.m_flFrac > 0 && backtrack.m_flFrac < 1 ); // should never extrapolate
+	}
 
-		ang				= Lerp( frac, record->m_vecAngles, prevRecord->m_vecAngles );
-		org				= Lerp( frac, record->m_vecOrigin, prevRecord->m_vecOrigin );
-		minsPreScaled	= Lerp( frac, record->m_vecMinsPreScaled, prevRecord->m_vecMinsPreScaled );
-		maxsPreScaled	= Lerp( frac, record->m_vecMaxsPreScaled, prevRecord->m_vecMaxsPreScaled );
+	return true;
+}
+
+// Lerps one vector field of four backtracks from their from[] toward their to[] records.
+static void LerpFourVectors( LagBacktrack * const group[4], const int from[4], const int to[4], const fltx4 &frac,
+	CUtlVector< Vector > CLagTrack::*pField, Vector LagBacktrack::*pResult )
+{
+	FourVectors a, b;
+	a.LoadAndSwizzle( ( group[0]->m_pTrack->*pField )[ from[0] ], ( group[1]->m_pTrack->*pField )[ from[1] ],
+		( group[2]->m_pTrack->*pField )[ from[2] ], ( group[3]->m_pTrack->*pField )[ from[3] ] );
+	b.LoadAndSwizzle( ( group[0]->m_pTrack->*pField )[ to[0] ], ( group[1]->m_pTrack->*pField )[ to[1] ],
+		( group[2]->m_pTrack->*pField )[ to[2] ], ( group[3]->m_pTrack->*pField )[ to[3] ] );
+
+	// a + ( b - a ) * frac
+	b -= a;
+	b *= frac;
+	b += a;
+
+	for ( int j = 0; j < 4; j++ )
+	{
+		group[j]->*pResult = b.Vec( j );
 	}
-	else
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Interpolates the position and bbox of the backtracks with
+// FourVectors, four players at a time.
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::InterpolateBacktracks( LagBacktrack *pBacktracks, int nBacktracks ) const
+{
+	for ( int i = 0; i < nBacktracks; i += 4 )
 	{
-		// we found the exact record or no other record to interpolate with
-		// just copy these values since they are the best we have
-		org				= record->m_vecOrigin;
-		ang				= record->m_vecAngles;
-		minsPreScaled	= record->m_vecMinsPreScaled;
-		maxsPreScaled	= record->m_vecMaxsPreScaled;
+		// Pad the last group with its first backtrack
+		LagBacktrack *group[4];
+		alignas(16) float flFrac[4];
+		for ( int j = 0; j < 4; j++ )
+		{
+			group[j] = &pBacktracks[ i + j < nBacktracks ? i + j : i ];
+			flFrac[j] = group[j]->m_flFrac;
+		}
+
+		const fltx4 frac = LoadAlignedSIMD( flFrac );
+
+		// Records without a fraction lerp toward themselves
+		int from[4], to[4];
+		for ( int j = 0; j < 4; j++ )
+		{
+			from[j] = group[j]->m_iRecord;
+			to[j] = group[j]->m_flFrac > 0.0f ? group[j]->m_iPrevRecord : from[j];
+		}
+
+		LerpFourVectors( group, from, to, frac, &CLagTrack::m_vecOrigin, &LagBacktrack::m_vecOrigin );
+		LerpFourVectors( group, from, to, frac, &CLagTrack::m_vecMinsPreScaled, &LagBacktrack::m_vecMinsPreScaled );
+		LerpFourVectors( group, from, to, frac, &CLagTrack::m_vecMaxsPreScaled, &LagBacktrack::m_vecMaxsPreScaled );
+
+		// Angles interpolate through quaternions
+		for ( int j = 0; j < 4; j++ )
+		{
+			const QAngle &angles = group[j]->m_pTrack->m_vecAngles[ from[j] ];
+			group[j]->m_vecAngles = from[j] != to[j] ?
+				Lerp( flFrac[j], angles, group[j]->m_pTrack->m_vecAngles[ to[j] ] ) : angles;
+		}
 	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Moves a player to its interpolated backtrack and remembers what
+// to restore.
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::ApplyBacktrack( const LagBacktrack &backtrack, float flTargetTime )
+{
+	CBasePlayer *pPlayer = backtrack.m_pPlayer;
+	int pl_index = pPlayer->entindex() - 1;
+
+	Vector org = backtrack.m_vecOrigin;
+	const Vector &minsPreScaled = backtrack.m_vecMinsPreScaled;
+	const Vector &maxsPreScaled = backtrack.m_vecMaxsPreScaled;
+	const QAngle &ang = backtrack.m_vecAngles;
+
+	const float frac = backtrack.m_flFrac;
+	const LagAnimRecord *record = &backtrack.m_pTrack->m_Animation[ backtrack.m_iRecord ];
+	const LagAnimRecord *prevRecord = backtrack.m_iPrevRecord >= 0 ? &backtrack.m_pTrack->m_Animation[ backtrack.m_iPrevRecord ] : NULL;
 
 	// See if this is still a valid position for us to teleport to
 	if ( sv_unlag_fixstuck.GetBool() )
@@ -717,8 +1011,8 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 			bool interpolated = false;
 			if( (frac > 0.0f)  &&  interpolationAllowed )
 			{
-				LayerRecord &recordsLayerRecord = record->m_layerRecords[layerIndex];
-				LayerRecord &prevRecordsLayerRecord = prevRecord->m_layerRecords[layerIndex];
+				const LayerRecord &recordsLayerRecord = record->m_layerRecords[layerIndex];
+				const LayerRecord &prevRecordsLayerRecord = prevRecord->m_layerRecords[layerIndex];
 				if( (recordsLayerRecord.m_order == prevRecordsLayerRecord.m_order)
 					&& (recordsLayerRecord.m_sequence == prevRecordsLayerRecord.m_sequence)
 					)
@@ -15,7 +15,9 @@
 #include "tier0/platform.h"
 
 #define DEMO_HEADER_ID		"HL2DEMO"
-#define DEMO_PROTOCOL		3
+#define DEMO_PROTOCOL		4	// newest protocol readers understand
+#define DEMO_PROTOCOL_LINEAR	3	// demos without keyframes and index
+#define DEMO_INDEX_ID		"HL2DIDX"
 
 #if !defined( MAX_OSPATH )
 #define	MAX_OSPATH		260			// max length of a filesystem pathname
@@ -41,8 +43,12 @@ enum
 
 	dem_stringtables,
 
+	// full string tables and entity update to start playback from, only used when
+	// seeking (protocol 4). Layout is the string tables data followed by a dem_packet.
+	dem_keyframe,
+
 	// Last command
-	dem_lastcmd		= dem_stringtables
+	dem_lastcmd		= dem_keyframe
 };
 
 struct demoheader_t
@@ -70,6 +76,35 @@ inline void ByteSwap_demoheader_t( demoheader_t &swap )
 	swap.signonlength = LittleDWord( swap.signonlength );
 }
 
+// Demo protocol 4 files end with the index of their keyframes, after dem_stop:
+// numentries demoindexentry_t sorted by tick, then demoindexfooter_t as the last
+// bytes of the file. Everything is little endian and 4 byte aligned, readers can
+// use the index in place from a memory mapped file.
+struct demoindexentry_t
+{
+	int		tick;				// recording tick of the keyframe
+	int		fileoffset;			// offset of its dem_keyframe command
+};
+
+struct demoindexfooter_t
+{
+	char	indexstamp[8];		// Should be HL2DIDX
+	int		numentries;
+	int		indexoffset;		// offset of the first demoindexentry_t
+};
+
+inline void ByteSwap_demoindexentry_t( demoindexentry_t &swap )
+{
+	swap.tick = LittleDWord( swap.tick );
+	swap.fileoffset = LittleDWord( swap.fileoffset );
+}
+
+inline void ByteSwap_demoindexfooter_t( demoindexfooter_t &swap )
+{
+	swap.numentries = LittleDWord( swap.numentries );
+	swap.indexoffset = LittleDWord( swap.indexoffset );
+}
+
 #define FDEMO_NORMAL		0
 #define FDEMO_USE_ORIGIN2	(1<<0)
 #define FDEMO_USE_ANGLES2	(1<<1)
@@ -97,6 +97,10 @@ class IServerEntity;
 // "full change list" - all its properties might have changed their value.
 #define FL_FULL_EDICT_CHANGED			(1<<8)
 
+// Game DLL sets this while the entity has a network parent. A child may be
+// sent because its parent is, so it can't be culled by its own clusters.
+#define FL_EDICT_NETWORK_CHILD			(1<<9)
+
 
 // Max # of variable changes we'll track in an entity before we treat it
 // like they all changed.
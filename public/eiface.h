@@ -75,8 +75,9 @@ typedef struct player_info_s player_info_t;
 
 #define INTERFACEVERSION_VENGINESERVER_VERSION_21	"VEngineServer021"
 #define INTERFACEVERSION_VENGINESERVER_VERSION_22	"VEngineServer022"
-#define INTERFACEVERSION_VENGINESERVER				"VEngineServer023"
-#define INTERFACEVERSION_VENGINESERVER_INT			23
+#define INTERFACEVERSION_VENGINESERVER_VERSION_23	"VEngineServer023"
+#define INTERFACEVERSION_VENGINESERVER				"VEngineServer024"
+#define INTERFACEVERSION_VENGINESERVER_INT			24
 
 struct bbox_t
 {
@@ -466,6 +467,13 @@ public:
 	virtual eFindMapResult FindMap( /* in/out */ char *pMapName, int nMapNameMax ) = 0;
 	
 	virtual void SetPausedForced( bool bPaused, float flDuration = -1.f ) = 0;
+
+	// Fills pOutEdicts with the part of pEdictIndices CheckTransmit has to look at for this
+	// client: entities in clusters visible from pInfo->m_PVS or in nSkyboxArea, and all entities
+	// whose transmit state doesn't depend on their own PVS information only. Keeps the order
+	// of pEdictIndices. Returns -1 if the engine has no such index, use pEdictIndices then.
+	virtual int GetTransmitCandidates( const CCheckTransmitInfo *pInfo, int nSkyboxArea,
+		const unsigned short *pEdictIndices, int nEdicts, unsigned short *pOutEdicts ) = 0;
 };
 
 // These only differ in new items added to the end
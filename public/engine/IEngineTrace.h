@@ -185,6 +185,11 @@ public:
 
 	// Walks bsp to find the leaf containing the specified point
 	virtual int GetLeafContainingPoint( const Vector &ptTest ) = 0;
+
+	// Traces many rays at once, same results as TraceRay on each of them. Rays that
+	// start close and point the same way (sensing, spread shots) go through the world
+	// together, so keep those next to each other.
+	virtual void	TraceRayBatch( const Ray_t *pRays, int nRays, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTraces ) = 0;
 };
 
 
@@ -40,6 +40,31 @@ public:
 
 };
 
+/// Eight rays for Trace8Rays, stored coordinate major so each coordinate of all 8 loads into one
+/// AVX register. Like FourRays, all 8 must have the same direction signs to be traced as a group.
+class EightRays
+{
+public:
+	alignas(32) float origin[3][8];							// [coordinate][ray]
+	alignas(32) float direction[3][8];
+
+	inline void SetRay(int i, const Vector &vecOrigin, const Vector &vecDirection)
+	{
+		for(int c=0;c<3;c++)
+		{
+			origin[c][i]=vecOrigin[c];
+			direction[c][i]=vecDirection[c];
+		}
+	}
+
+	// rays 4*half..4*half+3 as a FourRays
+	FourRays Half(int half) const;
+
+	// returns direction sign mask for 8 rays. returns -1 if the rays can not be traced as a
+	// bundle.
+	int CalculateDirectionSignMask(void) const;
+};
+
 /// The format a triangle is stored in for intersections. size of this structure is important.
 /// This structure can be in one of two forms. Before the ray tracing environment is set up, the
 /// ProjectedEdgeEquations hold the coordinates of the 3 vertices, for facilitating bounding box
@@ -83,8 +108,8 @@ struct TriGeometryData_t
 	float m_VertexCoordData[9];								// can't use a vector in a union
 
 	uint8 m_nFlags;											// triangle flags
-	signed char m_nTmpData0;								// used by kd-tree builder
-	signed char m_nTmpData1;								// used by kd-tree builder
+	signed char m_nTmpData0;								// no longer used
+	signed char m_nTmpData1;								// no longer used
 
 
 	// accessors to get around union annoyance
@@ -119,7 +144,7 @@ struct CacheOptimizedTriangle
 	void ChangeIntoIntersectionFormat(void);				// change information storage format for
 	                                                        // computing intersections.
 
-	int ClassifyAgainstAxisSplit(int split_plane, float split_value); // PLANECHECK_xxx below
+	int ClassifyAgainstAxisSplit(int split_plane, float split_value) const; // PLANECHECK_xxx below
 	
 };
 
@@ -132,6 +157,11 @@ struct CacheOptimizedTriangle
 #define KDNODE_STATE_ZSPLIT 2								// this node is a zsplit
 #define KDNODE_STATE_LEAF 3									// this node is a leaf
 
+// kd-tree limits shared by the build and the 4 and 8 wide traversals
+#define MAILBOX_HASH_SIZE 256									// triangle mailbox slots per traversal
+#define MAX_TREE_DEPTH 21
+#define MAX_NODE_STACK_LEN (40*MAX_TREE_DEPTH)					// traversal stack size
+
 struct CacheOptimizedKDNode
 {
 	// this is the cache intensive data structure. "Tricks" are used to fit it into 8 bytes:
@@ -191,6 +221,46 @@ protected:
 
 };
 
+/// Node of the bounding volume hierarchy built instead of the kd-tree with RTE_FLAGS_USE_BVH. 32
+/// bytes, so two to a cache line. Children is packed like CacheOptimizedKDNode's: the low 2 bits
+/// are the axis the children were split on or KDNODE_STATE_LEAF, the rest the index of the left
+/// child (the right one follows it) or of the first triangle index of the leaf.
+struct CacheOptimizedBVHNode
+{
+	float m_flMins[3];
+	int32 Children;
+	float m_flMaxs[3];
+	int32 m_nTriangles;										// triangles in a leaf, 0 otherwise
+
+	inline int NodeType(void) const
+	{
+		return Children & 3;
+	}
+
+	inline int32 TriangleIndexStart(void) const
+	{
+		assert(NodeType()==KDNODE_STATE_LEAF);
+		return Children>>2;
+	}
+
+	inline int LeftChild(void) const
+	{
+		assert(NodeType()!=KDNODE_STATE_LEAF);
+		return Children>>2;
+	}
+
+	inline int RightChild(void) const
+	{
+		return LeftChild()+1;
+	}
+
+	inline int NumberOfTrianglesInLeaf(void) const
+	{
+		assert(NodeType()==KDNODE_STATE_LEAF);
+		return m_nTriangles;
+	}
+};
+
 
 struct RayTracingSingleResult
 {
@@ -207,6 +277,13 @@ struct RayTracingResult
 	fltx4 HitDistance;										// distance to intersection
 };
 
+struct RayTracingResult8
+{
+	alignas(32) float surface_normal[3][8];					// [coordinate][ray]
+	alignas(32) int32 HitIds[8];							// -1=no hit. otherwise, triangle index
+	alignas(32) float HitDistance[8];						// distance to intersection
+};
+
 
 class RayTraceLight
 {
@@ -219,6 +296,10 @@ public:
 #define RTE_FLAGS_FAST_TREE_GENERATION 1
 #define RTE_FLAGS_DONT_STORE_TRIANGLE_COLORS 2				// saves memory if not needed
 #define RTE_FLAGS_DONT_STORE_TRIANGLE_MATERIALS 4
+#define RTE_FLAGS_USE_BVH 8									// build a bounding volume hierarchy
+															// instead of a kd-tree. better for
+															// lots of small overlapping triangles
+															// (props), which a kd-tree duplicates
 
 enum RayTraceLightingMode_t {
 	DIRECT_LIGHTING,										// just dot product lighting
@@ -263,6 +344,7 @@ public:
 
 	FourVectors BackgroundColor;							//< color where no intersection
 	CUtlVector<CacheOptimizedKDNode> OptimizedKDTree;		//< the packed kdtree. root is 0
+	CUtlVector<CacheOptimizedBVHNode> OptimizedBVH;		//< the bvh with RTE_FLAGS_USE_BVH. root is 0
 	CUtlBlockVector<CacheOptimizedTriangle> OptimizedTriangleList; //< the packed triangles
 	CUtlVector<int32> TriangleIndexList;					//< the list of triangle indices.
 	CUtlVector<LightDesc_t> LightList;						//< the list of lights
@@ -297,8 +379,11 @@ public:
 										const Vector &color);
 
 
-	// SetupAccelerationStructure to prepare for tracing
-	void SetupAccelerationStructure(void);
+	// SetupAccelerationStructure to prepare for tracing. Subtrees are built on up to nThreads
+	// threads, 0 uses one per logical processor. The default builds on the calling thread only,
+	// callers that own a thread budget (vrad) pass it in. The tree is the same whatever the
+	// thread count.
+	void SetupAccelerationStructure(int nThreads = 1);
 
 
 	// lowest level intersection routine - fire 4 rays through the scene. all 4 rays must pass the
@@ -313,6 +398,18 @@ public:
 					RayTracingResult *rslt_out,
 					int32 skip_id=-1, ITransparentTriangleCallback *pCallback = NULL);
 
+	// Trace4Rays through the bvh, used instead of the kd-tree traversal with RTE_FLAGS_USE_BVH.
+	void TraceBVH4Rays(const FourRays &rays, fltx4 TMin, fltx4 TMax,int DirectionSignMask,
+					   RayTracingResult *rslt_out,
+					   int32 skip_id=-1, ITransparentTriangleCallback *pCallback = NULL);
+
+	// fire 8 rays through the scene with AVX. Rays which do not match in direction sign, cpus
+	// without AVX and the bvh are handled by tracing each half with Trace4Rays. Hits closer than
+	// TMax are the same as Trace4Rays'. Like it, a hit past TMax may or may not be reported.
+	void Trace8Rays(const EightRays &rays, const float TMin[8], const float TMax[8],
+					RayTracingResult8 *rslt_out,
+					int32 skip_id=-1, ITransparentTriangleCallback *pCallback = NULL);
+
 	// compute virtual light sources to model inter-reflection
 	void ComputeVirtualLightSources(void);
 
@@ -345,17 +442,6 @@ public:
 	void FinishRayStream(RayStream &s);
 
 
-	intp MakeLeafNode(int first_tri, int last_tri);
-
-
-	float CalculateCostsOfSplit(
-		int split_plane,int32 const *tri_list,int ntris,
-		Vector MinBound,Vector MaxBound, float &split_value,
-		int &nleft, int &nright, int &nboth);
-		
-	void RefineNode(intp node_number,int32 const *tri_list,intp ntris,
-						 Vector MinBound,Vector MaxBound, int depth);
-	
 	void CalculateTriangleListBounds(int32 const *tris,intp ntris,
 									 Vector &minout, Vector &maxout);
 
@@ -16,6 +16,8 @@
 #include "tier0/basetypes.h"
 #include "tier0/dbg.h"
 
+#include <cstring>
+
 
 #if _DEBUG
 #define BITBUF_INLINE inline
@@ -128,6 +130,22 @@ namespace bitbuf
 
 	constexpr inline int kMaxVarintBytes = 10;
 	constexpr inline int kMaxVarint32Bytes = 5;
+
+	// Unaligned little endian qword access. Bit i of a buffer is bit (i & 7)
+	// of byte (i >> 3), so any 64 bit window starting at a byte holds the
+	// next 57..64 bits whatever the bit position is.
+	[[nodiscard]] FORCEINLINE uint64 LoadLittleQWord( const void *pData )
+	{
+		uint64 qword;
+		memcpy( &qword, pData, sizeof(qword) );
+		return LittleQWord( qword );
+	}
+
+	FORCEINLINE void StoreLittleQWord( void *pData, uint64 qword )
+	{
+		qword = LittleQWord( qword );
+		memcpy( pData, &qword, sizeof(qword) );
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -420,6 +438,23 @@ BITBUF_INLINE void bf_write::WriteUBitLong( uint32 curData, int numbits, [[maybe
 		return;
 	}
 
+	// Fast path: up to 7 + 32 bits fit a single qword read-modify-write.
+	// Only the last few bytes of the buffer take the dword path below.
+	const intp iByte = m_iCurBit >> 3;
+	if ( iByte + static_cast<intp>(sizeof(uint64)) <= m_nDataBytes )
+	{
+		const unsigned iShift = m_iCurBit & 7;
+		const uint64 mask = ( ( uint64{1} << numbits ) - 1 ) << iShift;
+		byte * RESTRICT pOut = (byte *)m_pData + iByte;
+
+		uint64 qword = bitbuf::LoadLittleQWord( pOut );
+		qword ^= mask & ( ( static_cast<uint64>(curData) << iShift ) ^ qword );
+		bitbuf::StoreLittleQWord( pOut, qword );
+
+		m_iCurBit += numbits;
+		return;
+	}
+
 	intp iCurBitMasked = m_iCurBit & 31;
 	intp iDWord = m_iCurBit >> 5;
 	m_iCurBit += numbits;
@@ -824,6 +859,16 @@ BITBUF_INLINE uint32 bf_read::ReadUBitLong( int numbits )
 		return 0;
 	}
 
+	// Fast path: one unaligned qword load holds the 7 + 32 bits we may need.
+	// Only the last few bytes of the buffer take the dword path below.
+	const intp iByte = m_iCurBit >> 3;
+	if ( iByte + static_cast<intp>(sizeof(uint64)) <= m_nDataBytes )
+	{
+		const uint64 qword = bitbuf::LoadLittleQWord( m_pData + iByte ) >> ( m_iCurBit & 7 );
+		m_iCurBit += numbits;
+		return static_cast<uint32>( qword & ( ( uint64{1} << numbits ) - 1 ) );
+	}
+
 	unsigned int iStartBit = m_iCurBit & 31u;
 	intp iLastBit = m_iCurBit + numbits - 1;
 	size_t iWordOffset1 = m_iCurBit >> 5;
@@ -12,6 +12,7 @@
 
 constexpr inline uint32 LZSS_ID{MAKEUID('L', 'Z', 'S', 'S')};
 constexpr inline uint32 SNAPPY_ID{MAKEUID('S', 'N', 'A', 'P')};
+constexpr inline uint32 DEFLATE_ID{MAKEUID('D', 'F', 'L', 'T')};
 
 // bind the buffer for correct identification
 struct lzss_header_t
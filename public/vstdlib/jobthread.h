@@ -66,6 +66,7 @@ constexpr inline int MAX_THREADS = 64;
 //-----------------------------------------------------------------------------
 
 class CJob;
+class CRangeJob;
 
 //-----------------------------------------------------------------------------
 // 
@@ -88,6 +89,7 @@ enum JobFlags_t
 	JF_BOOST_THREAD		= ( 1 << 1 ),	// Up the thread priority to max allowed while processing task
 	JF_SERIAL			= ( 1 << 2 ),	// Job cannot be executed out of order relative to other "strict" jobs
 	JF_QUEUE			= ( 1 << 3 ),	// Queue it, even if not an IO job
+	JF_RANGE			= ( 1 << 4 ),	// CRangeJob, may be executed by several threads at once
 };
 
 enum JobPriority_t
@@ -108,6 +110,7 @@ struct ThreadPoolStartParams_t
 		  bIOThreads( bIOThreads_ )
 	{
 		bExecOnThreadPoolThreadsOnly = false;
+		bWorkStealing = false;
 
 		bUseAffinityTable = ( pAffinities != nullptr ) && ( fDistribute == TRS_TRUE ) && ( nThreads != -1 );
 		if ( bUseAffinityTable )
@@ -136,6 +139,9 @@ struct ThreadPoolStartParams_t
 	bool			bIOThreads : 1;
 	bool			bUseAffinityTable : 1;
 	bool			bExecOnThreadPoolThreadsOnly : 1;
+	// Per-thread job deques with stealing instead of the shared priority queues.
+	// Job priorities are ignored in this mode.
+	bool			bWorkStealing : 1;
 };
 
 //-----------------------------------------------------------------------------
@@ -225,7 +231,9 @@ public:
 	virtual int AbortAll() = 0;
 
 	//-----------------------------------------------------
-	virtual void Reserved1() = 0;
+	// Queue a job which idle threads execute together (see CRangeJob)
+	//-----------------------------------------------------
+	virtual void AddRangeJob( CRangeJob *pJob ) = 0;
 
 	//-----------------------------------------------------
 	// Add an arbitrary call to the queue (master thread) 
@@ -710,6 +718,80 @@ private:
 	char m_szDescription[32];
 };
 
+//-----------------------------------------------------------------------------
+// A job which up to nMaxHelpers pool threads may execute at the same time, all
+// pulling items from the same source. It is queued once with AddRangeJob(). On a
+// work-stealing pool every thread which picks it up queues it again for the
+// next idle thread while helper slots are left, so a whole range fans out from
+// a single stealable task. The submitter works on the range as well and calls
+// Close() when the range is exhausted.
+//-----------------------------------------------------------------------------
+
+class CRangeJob : public CJob
+{
+public:
+	explicit CRangeJob( intp nMaxHelpers )
+	{
+		m_nHelpers.store( nMaxHelpers, std::memory_order::memory_order_relaxed );
+		m_nActive.store( 0, std::memory_order::memory_order_relaxed );
+
+		SetFlags( JF_RANGE | JF_QUEUE );
+	}
+
+	[[nodiscard]] intp NumHelperSlots() const { return m_nHelpers.load( std::memory_order::memory_order_relaxed ); }
+
+	//-----------------------------------------------------
+	// Called by pool threads. Returns false when all helper slots are taken
+	// or the job was closed.
+	//-----------------------------------------------------
+	bool Help()
+	{
+		// Must be visible before a slot is taken, see Close().
+		m_nActive.fetch_add( 1 );
+
+		intp nHelpers = m_nHelpers.load();
+		while ( nHelpers > 0 )
+		{
+			if ( m_nHelpers.compare_exchange_weak( nHelpers, nHelpers - 1 ) )
+			{
+				DoHelp();
+
+				m_nActive.fetch_sub( 1, std::memory_order::memory_order_release );
+				return true;
+			}
+		}
+
+		m_nActive.fetch_sub( 1, std::memory_order::memory_order_release );
+		return false;
+	}
+
+	//-----------------------------------------------------
+	// Stop handing out helper slots and wait for the running helpers. Pools may
+	// still hold references afterwards but never call DoHelp() again.
+	//-----------------------------------------------------
+	void Close()
+	{
+		m_nHelpers.store( 0 );
+
+		while ( m_nActive.load( std::memory_order::memory_order_acquire ) )
+		{
+			ThreadPause();
+		}
+	}
+
+private:
+	virtual void DoHelp() = 0;
+
+	JobStatus_t DoExecute() override
+	{
+		Help();
+		return JOB_OK;
+	}
+
+	std::atomic<intp>	m_nHelpers;
+	std::atomic<intp>	m_nActive;
+};
+
 //-----------------------------------------------------------------------------
 // Utility for managing multiple jobs
 //-----------------------------------------------------------------------------
@@ -1019,22 +1101,16 @@ public:
 
 		if ( nJobs > 1 )
 		{
-			CJob **jobs = stackallocT( CJob*, nJobs );
-			intp i = nJobs;
+			// The whole range goes out as one job, helpers pull items from m_pItems.
+			auto *pJob = new CHelperJob( this, nJobs );
+			pJob->SetDescription( m_szDescription );
 
-			while( i-- )
-			{
-				jobs[i] = pThreadPool->QueueCall( this, &CParallelProcessor<ITEM_TYPE, ITEM_PROCESSOR_TYPE>::DoExecute );
-				jobs[i]->SetDescription( m_szDescription );
-			}
+			pThreadPool->AddRangeJob( pJob );
 
 			DoExecute();
 
-			for ( i = 0; i < nJobs; i++ )
-			{
-				jobs[i]->Abort(); // will either abort ones that never got a thread, or noop on ones that did
-				jobs[i]->Release();
-			}
+			pJob->Close(); // waits for helpers which got a thread, the rest never run
+			pJob->Release();
 		}
 		else
 			DoExecute();
@@ -1043,6 +1119,20 @@ public:
 	ITEM_PROCESSOR_TYPE m_ItemProcessor;
 
 private:
+	class CHelperJob : public CRangeJob
+	{
+	public:
+		CHelperJob( CParallelProcessor *pProcessor, intp nMaxHelpers )
+			: CRangeJob( nMaxHelpers ), m_pProcessor( pProcessor )
+		{
+		}
+
+	private:
+		void DoHelp() override { m_pProcessor->DoExecute(); }
+
+		CParallelProcessor *m_pProcessor;
+	};
+
 	void DoExecute()
 	{
 		tmZone( TELEMETRY_LEVEL0, TMZF_NONE, "DoExecute %s", m_szDescription );
@@ -5,8 +5,12 @@
 #include "filesystem_tools.h"
 #include "cmdlib.h"
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <cstdio>
 #include <memory>
+#include <thread>
 
 // NOTE: This has to be the last file included!
 #include "tier0/memdbgon.h"
@@ -239,7 +243,7 @@ void CacheOptimizedTriangle::ChangeIntoIntersectionFormat(void)
 
 }
 
-int CacheOptimizedTriangle::ClassifyAgainstAxisSplit(int split_plane, float split_value)
+int CacheOptimizedTriangle::ClassifyAgainstAxisSplit(int split_plane, float split_value) const
 {
 	// classify a triangle against an axis-aligned plane
 	float minc=Vertex(0)[split_plane];
@@ -259,9 +263,7 @@ int CacheOptimizedTriangle::ClassifyAgainstAxisSplit(int split_plane, float spli
 	return PLANECHECK_STRADDLING;
 }
 
-#define MAILBOX_HASH_SIZE 256
-#define MAX_TREE_DEPTH 21
-#define MAX_NODE_STACK_LEN (40*MAX_TREE_DEPTH)
+#define BVH_MAX_DEPTH 64									// also the bvh traversal stack size
 
 struct NodeToVisit {
 	CacheOptimizedKDNode const *node;
@@ -280,12 +282,120 @@ static float BoxSurfaceArea(Vector const &boxmin, Vector const &boxmax)
 	return 2.0f*((boxdim[0]*boxdim[2])+(boxdim[0]*boxdim[1])+(boxdim[1]*boxdim[2]));
 }
 
+// intersect 4 rays with one triangle, keeping the hits which are closer than the ones already in
+// rslt_out.
+static FORCEINLINE void IntersectTriangle4(TriIntersectData_t const *tri, int32 tnum,
+										   const FourRays &rays, RayTracingResult *rslt_out,
+										   ITransparentTriangleCallback *pCallback)
+{
+	// compute plane intersection
+	FourVectors N;
+	N.x = ReplicateX4( tri->m_flNx );
+	N.y = ReplicateX4( tri->m_flNy );
+	N.z = ReplicateX4( tri->m_flNz );
+
+	fltx4 DDotN = rays.direction * N;
+	// mask off zero or near zero (ray parallel to surface)
+	fltx4 did_hit = OrSIMD( CmpGtSIMD( DDotN,FourEpsilons ),
+							CmpLtSIMD( DDotN, FourNegativeEpsilons ) );
+
+	fltx4 numerator=SubSIMD( ReplicateX4( tri->m_flD ), rays.origin * N );
+
+	fltx4 isect_t=DivSIMD( numerator,DDotN );
+	// now, we have the distance to the plane. lets update our mask
+	did_hit = AndSIMD( did_hit, CmpGtSIMD( isect_t, FourZeros ) );
+	//did_hit=AndSIMD(did_hit,CmpLtSIMD(isect_t,TMax));
+	did_hit = AndSIMD( did_hit, CmpLtSIMD( isect_t, rslt_out->HitDistance ) );
+
+	if ( ! IsAnyNegative( did_hit ) )
+		return;
+
+	// now, check 3 edges
+	fltx4 hitc1 = MaddSIMD(
+		isect_t,
+		rays.direction[ tri->m_nCoordSelect0],
+		rays.origin[tri->m_nCoordSelect0] );
+	fltx4 hitc2 = MaddSIMD(
+		isect_t,
+		rays.direction[tri->m_nCoordSelect1],
+		rays.origin[tri->m_nCoordSelect1] );
+	
+	// do barycentric coordinate check
+	fltx4 B0 = MulSIMD( ReplicateX4( tri->m_ProjectedEdgeEquations[0] ), hitc1 );
+
+	B0 = MaddSIMD(
+		ReplicateX4( tri->m_ProjectedEdgeEquations[1] ), hitc2,
+		B0 );
+	B0 = AddSIMD(
+		B0, ReplicateX4( tri->m_ProjectedEdgeEquations[2] ) );
+
+	did_hit = AndSIMD( did_hit, CmpGeSIMD( B0, FourZeros ) );
+
+	fltx4 B1 = MulSIMD( ReplicateX4( tri->m_ProjectedEdgeEquations[3] ), hitc1 );
+	B1 = MaddSIMD(
+		ReplicateX4( tri->m_ProjectedEdgeEquations[4]), hitc2,
+		B1 );
+
+	B1 = AddSIMD(
+		B1, ReplicateX4( tri->m_ProjectedEdgeEquations[5] ) );
+	
+	did_hit = AndSIMD( did_hit, CmpGeSIMD( B1, FourZeros ) );
+
+	fltx4 B2 = AddSIMD( B1, B0 );
+	did_hit = AndSIMD( did_hit, CmpLeSIMD( B2, Four_Ones ) );
+
+	if ( ! IsAnyNegative( did_hit ) )
+		return;
+
+	// if the triangle is transparent
+	if ( tri->m_nFlags & FCACHETRI_TRANSPARENT )
+	{
+		if ( pCallback )
+		{
+			// assuming a triangle indexed as v0, v1, v2
+			// the projected edge equations are set up such that the vert opposite the first
+			// equation is v2, and the vert opposite the second equation is v0
+			// Therefore we pass them back in 1, 2, 0 order
+			// Also B2 is currently B1 + B0 and needs to be 1 - (B1+B0) in order to be a real
+			// barycentric coordinate.  Compute that now and pass it to the callback
+			fltx4 b2 = SubSIMD( Four_Ones, B2 );
+			if ( pCallback->VisitTriangle_ShouldContinue( *tri, rays, &did_hit, &B1, &b2, &B0, tnum ) )
+			{
+				did_hit = Four_Zeros;
+			}
+		}
+	}
+	// now, set the hit_id and closest_hit fields for any enabled rays
+	fltx4 replicated_n = ReplicateIX4(tnum);
+	DirectX::XMStoreInt4A((uint32_t *) rslt_out->HitIds,
+				 OrSIMD(AndSIMD(replicated_n,did_hit),
+						   AndNotSIMD(did_hit,DirectX::XMLoadInt4A(
+											 (uint32_t *) rslt_out->HitIds))));
+	rslt_out->HitDistance=OrSIMD(AndSIMD(isect_t,did_hit),
+					 AndNotSIMD(did_hit,rslt_out->HitDistance));
+
+	rslt_out->surface_normal.x=OrSIMD(
+		AndSIMD(N.x,did_hit),
+		AndNotSIMD(did_hit,rslt_out->surface_normal.x));
+	rslt_out->surface_normal.y=OrSIMD(
+		AndSIMD(N.y,did_hit),
+		AndNotSIMD(did_hit,rslt_out->surface_normal.y));
+	rslt_out->surface_normal.z=OrSIMD(
+		AndSIMD(N.z,did_hit),
+		AndNotSIMD(did_hit,rslt_out->surface_normal.z));
+}
+
 void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 TMax,
 									   RayTracingResult *rslt_out,
 									   int32 skip_id, ITransparentTriangleCallback *pCallback)
 {
 	int msk=rays.CalculateDirectionSignMask();
-	if (msk!=-1)
+	if ( Flags & RTE_FLAGS_USE_BVH )
+	{
+		// the bvh doesn't need the rays to go the same way
+		TraceBVH4Rays(rays,TMin,TMax,msk,rslt_out,skip_id, pCallback);
+	}
+	else if (msk!=-1)
 		Trace4Rays(rays,TMin,TMax,msk,rslt_out,skip_id, pCallback);
 	else
 	{
@@ -352,6 +462,12 @@ void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 T
 									   int DirectionSignMask, RayTracingResult *rslt_out,
 									   int32 skip_id, ITransparentTriangleCallback *pCallback)
 {
+	if ( Flags & RTE_FLAGS_USE_BVH )
+	{
+		TraceBVH4Rays( rays, TMin, TMax, DirectionSignMask, rslt_out, skip_id, pCallback );
+		return;
+	}
+
 	rays.Check();
 
 	BitwiseSet(rslt_out->HitIds,0xff);
@@ -481,104 +597,7 @@ void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 T
 				if ( ( mailboxids[mbox_slot] != tnum ) && ( tri->m_nTriangleID != skip_id ) )
 				{
 					mailboxids[mbox_slot] = tnum;
-					// compute plane intersection
-
-
-					FourVectors N;
-					N.x = ReplicateX4( tri->m_flNx );
-					N.y = ReplicateX4( tri->m_flNy );
-					N.z = ReplicateX4( tri->m_flNz );
-
-					fltx4 DDotN = rays.direction * N;
-					// mask off zero or near zero (ray parallel to surface)
-					fltx4 did_hit = OrSIMD( CmpGtSIMD( DDotN,FourEpsilons ),
-											CmpLtSIMD( DDotN, FourNegativeEpsilons ) );
-
-					fltx4 numerator=SubSIMD( ReplicateX4( tri->m_flD ), rays.origin * N );
-
-					fltx4 isect_t=DivSIMD( numerator,DDotN );
-					// now, we have the distance to the plane. lets update our mask
-					did_hit = AndSIMD( did_hit, CmpGtSIMD( isect_t, FourZeros ) );
-					//did_hit=AndSIMD(did_hit,CmpLtSIMD(isect_t,TMax));
-					did_hit = AndSIMD( did_hit, CmpLtSIMD( isect_t, rslt_out->HitDistance ) );
-
-					if ( ! IsAnyNegative( did_hit ) )
-						continue;
-
-					// now, check 3 edges
-					fltx4 hitc1 = MaddSIMD(
-						isect_t,
-						rays.direction[ tri->m_nCoordSelect0],
-						rays.origin[tri->m_nCoordSelect0] );
-					fltx4 hitc2 = MaddSIMD(
-						isect_t,
-						rays.direction[tri->m_nCoordSelect1],
-						rays.origin[tri->m_nCoordSelect1] );
-					
-					// do barycentric coordinate check
-					fltx4 B0 = MulSIMD( ReplicateX4( tri->m_ProjectedEdgeEquations[0] ), hitc1 );
-
-					B0 = MaddSIMD(
-						ReplicateX4( tri->m_ProjectedEdgeEquations[1] ), hitc2,
-						B0 );
-					B0 = AddSIMD(
-						B0, ReplicateX4( tri->m_ProjectedEdgeEquations[2] ) );
-
-					did_hit = AndSIMD( did_hit, CmpGeSIMD( B0, FourZeros ) );
-
-					fltx4 B1 = MulSIMD( ReplicateX4( tri->m_ProjectedEdgeEquations[3] ), hitc1 );
-					B1 = MaddSIMD(
-						ReplicateX4( tri->m_ProjectedEdgeEquations[4]), hitc2,
-						B1 );
-
-					B1 = AddSIMD(
-						B1, ReplicateX4( tri->m_ProjectedEdgeEquations[5] ) );
-					
-					did_hit = AndSIMD( did_hit, CmpGeSIMD( B1, FourZeros ) );
-
-					fltx4 B2 = AddSIMD( B1, B0 );
-					did_hit = AndSIMD( did_hit, CmpLeSIMD( B2, Four_Ones ) );
-
-					if ( ! IsAnyNegative( did_hit ) )
-						continue;
-
-					// if the triangle is transparent
-					if ( tri->m_nFlags & FCACHETRI_TRANSPARENT )
-					{
-						if ( pCallback )
-						{
-							// assuming a triangle indexed as v0, v1, v2
-							// the projected edge equations are set up such that the vert opposite the first
-							// equation is v2, and the vert opposite the second equation is v0
-							// Therefore we pass them back in 1, 2, 0 order
-							// Also B2 is currently B1 + B0 and needs to be 1 - (B1+B0) in order to be a real
-							// barycentric coordinate.  Compute that now and pass it to the callback
-							fltx4 b2 = SubSIMD( Four_Ones, B2 );
-							if ( pCallback->VisitTriangle_ShouldContinue( *tri, rays, &did_hit, &B1, &b2, &B0, tnum ) )
-							{
-								did_hit = Four_Zeros;
-							}
-						}
-					}
-					// now, set the hit_id and closest_hit fields for any enabled rays
-					fltx4 replicated_n = ReplicateIX4(tnum);
-					DirectX::XMStoreInt4A((uint32_t *) rslt_out->HitIds,
-								 OrSIMD(AndSIMD(replicated_n,did_hit),
-										   AndNotSIMD(did_hit,DirectX::XMLoadInt4A(
-															 (uint32_t *) rslt_out->HitIds))));
-					rslt_out->HitDistance=OrSIMD(AndSIMD(isect_t,did_hit),
-									 AndNotSIMD(did_hit,rslt_out->HitDistance));
-
-					rslt_out->surface_normal.x=OrSIMD(
-						AndSIMD(N.x,did_hit),
-						AndNotSIMD(did_hit,rslt_out->surface_normal.x));
-					rslt_out->surface_normal.y=OrSIMD(
-						AndSIMD(N.y,did_hit),
-						AndNotSIMD(did_hit,rslt_out->surface_normal.y));
-					rslt_out->surface_normal.z=OrSIMD(
-						AndSIMD(N.z,did_hit),
-						AndNotSIMD(did_hit,rslt_out->surface_normal.z));
-					
+					IntersectTriangle4( tri, tnum, rays, rslt_out, pCallback );
 				}
 			} while (--ntris);
 			// now, check if all rays have terminated
@@ -602,15 +621,74 @@ void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 T
 }
 
 
-intp RayTracingEnvironment::MakeLeafNode(int first_tri, int last_tri)
+void RayTracingEnvironment::TraceBVH4Rays(const FourRays &rays, fltx4 TMin, fltx4 TMax,
+										  int DirectionSignMask, RayTracingResult *rslt_out,
+										  int32 skip_id, ITransparentTriangleCallback *pCallback)
 {
-	CacheOptimizedKDNode ret;
-	ret.Children=KDNODE_STATE_LEAF+(TriangleIndexList.Count()<<2);
-	ret.SetNumberOfTrianglesInLeafNode(1+(last_tri-first_tri));
-	for(int tnum=first_tri;tnum<=last_tri;tnum++)
-		TriangleIndexList.AddToTail(tnum);
-	OptimizedKDTree.AddToTail(ret);
-	return OptimizedKDTree.Count()-1;
+	BitwiseSet(rslt_out->HitIds,0xff);
+
+	rslt_out->HitDistance=ReplicateX4(1.0e23f);
+
+	rslt_out->surface_normal.DuplicateVector(Vector(0.,0.,0.));
+
+	if ( !OptimizedBVH.Count() )
+		return;
+
+	FourVectors OneOverRayDir=rays.direction;
+	OneOverRayDir.MakeReciprocalSaturate();
+
+	// visit the child on the side the rays come from first. rays going different ways just use
+	// the order of the first one.
+	if ( DirectionSignMask == -1 )
+		DirectionSignMask = ( rays.direction.X(0) < 0 ? 1 : 0 ) | ( rays.direction.Y(0) < 0 ? 2 : 0 ) |
+			( rays.direction.Z(0) < 0 ? 4 : 0 );
+
+	CacheOptimizedBVHNode const *NodeStack[BVH_MAX_DEPTH];
+	int nStack = 0;
+	CacheOptimizedBVHNode const *CurNode=&(OptimizedBVH[0]);
+	while(1)
+	{
+		// clip the rays against the node's box, and the closest hit so far
+		fltx4 node_tmin=TMin;
+		fltx4 node_tmax=MinSIMD(TMax,rslt_out->HitDistance);
+		for(int c=0;c<3;c++)
+		{
+			fltx4 isect_min_t=
+				MulSIMD(SubSIMD(ReplicateX4(CurNode->m_flMins[c]),rays.origin[c]),OneOverRayDir[c]);
+			fltx4 isect_max_t=
+				MulSIMD(SubSIMD(ReplicateX4(CurNode->m_flMaxs[c]),rays.origin[c]),OneOverRayDir[c]);
+			node_tmin=MaxSIMD(node_tmin,MinSIMD(isect_min_t,isect_max_t));
+			node_tmax=MinSIMD(node_tmax,MaxSIMD(isect_min_t,isect_max_t));
+		}
+
+		if ( IsAnyNegative( CmpLeSIMD( node_tmin, node_tmax ) ) )
+		{
+			if ( CurNode->NodeType() != KDNODE_STATE_LEAF )
+			{
+				// the high side child is the right one
+				CacheOptimizedBVHNode const *LeftChild=&(OptimizedBVH[CurNode->LeftChild()]);
+				int nFirst=( DirectionSignMask >> CurNode->NodeType() ) & 1;
+				Assert( nStack < BVH_MAX_DEPTH );
+				NodeStack[nStack++]=LeftChild+(nFirst^1);
+				CurNode=LeftChild+nFirst;
+				continue;
+			}
+
+			int ntris=CurNode->NumberOfTrianglesInLeaf();
+			int32 const *tlist=TriangleIndexList.Base()+CurNode->TriangleIndexStart();
+			for(int i=0;i<ntris;i++)
+			{
+				int tnum=tlist[i];
+				TriIntersectData_t const *tri = &( OptimizedTriangleList[tnum].m_Data.m_IntersectData );
+				if ( tri->m_nTriangleID != skip_id )
+					IntersectTriangle4( tri, tnum, rays, rslt_out, pCallback );
+			}
+		}
+
+		if ( !nStack )
+			return;
+		CurNode=NodeStack[--nStack];
+	}
 }
 
 
@@ -668,23 +746,150 @@ void RayTracingEnvironment::CalculateTriangleListBounds(int32 const *tris,intp n
 #define COST_OF_INTERSECTION 167							// approximate #operations
 
 
-float RayTracingEnvironment::CalculateCostsOfSplit(
-	int split_plane, int32 const *tri_list, int ntris,
+// below this many triangles the build isn't worth spreading over threads
+#define MIN_TRIANGLES_FOR_PARALLEL_BUILD 4096
+
+// how many triangles are converted into intersection format per job
+#define TRIANGLES_PER_CONVERSION_JOB 4096
+
+#define BVH_BINS 16											// split candidates per axis
+#define BVH_MAX_LEAF_TRIS 8									// bigger leaves are always split
+
+
+namespace
+{
+
+// Calls fnJob( i ) for each i in [0, nJobs) on up to nThreads threads, the calling one included.
+template <typename FN>
+void RunJobsInParallel( int nThreads, intp nJobs, FN &&fnJob )
+{
+	std::atomic<intp> nNextJob{ 0 };
+	auto worker = [&]()
+	{
+		for ( intp i = nNextJob++; i < nJobs; i = nNextJob++ )
+			fnJob( i );
+	};
+
+	const intp nHelpers = min( (intp)nThreads, nJobs ) - 1;
+	std::unique_ptr<std::thread[]> helpers;
+	if ( nHelpers > 0 )
+	{
+		helpers = std::make_unique<std::thread[]>( nHelpers );
+		for ( intp i = 0; i < nHelpers; i++ )
+			helpers[i] = std::thread( worker );
+	}
+
+	worker();
+
+	for ( intp i = 0; i < nHelpers; i++ )
+		helpers[i].join();
+}
+
+// Number of levels built on the calling thread before the subtrees below are handed out, about 8
+// subtrees a thread so they balance out.
+int DeferDepthForThreads( int nThreads, intp ntris )
+{
+	if ( nThreads <= 1 || ntris < MIN_TRIANGLES_FOR_PARALLEL_BUILD )
+		return INT_MAX;
+
+	int nDepth = 0;
+	while ( ( 1 << nDepth ) < 8 * nThreads )
+		nDepth++;
+	return nDepth;
+}
+
+// Appends a subtree built with its root at 0 to the tree, its root replacing the placeholder node
+// left for it. Node and triangle indices are relocated.
+template <typename NODE>
+void SpliceSubtree( CUtlVector<NODE> &tree, intp nPlaceholder, const CUtlVector<NODE> &subtree,
+					intp nTriangleIndexOffset )
+{
+	const intp nBase = tree.Count() - 1;					// subtree node i>0 goes to nBase+i
+	tree.EnsureCapacity( tree.Count() + subtree.Count() - 1 );
+	for ( intp i = 0; i < subtree.Count(); i++ )
+	{
+		NODE node = subtree[i];
+		if ( node.NodeType() == KDNODE_STATE_LEAF )
+			node.Children += (int32)( nTriangleIndexOffset << 2 );
+		else
+			node.Children += (int32)( nBase << 2 );
+
+		if ( i == 0 )
+			tree[nPlaceholder] = node;
+		else
+			tree.AddToTail( node );
+	}
+}
+
+
+struct KDSubtree_t
+{
+	intp m_nNode;											// placeholder for the root
+	CUtlVector<int32> m_TriList;
+	Vector m_MinBound, m_MaxBound;
+	int m_nDepth;
+
+	// what it was built into
+	CUtlVector<CacheOptimizedKDNode> m_Nodes;
+	CUtlVector<int32> m_TriangleIndices;
+};
+
+
+//-----------------------------------------------------------------------------
+// Builds the kd-tree, or a subtree of it, into its own node and triangle index
+// lists. Triangles are only read, the split classification is kept on the side,
+// so subtrees can be built on several threads at once. Nodes at m_nDeferDepth
+// are queued to m_pDeferred instead of being refined.
+//-----------------------------------------------------------------------------
+class CKDTreeBuilder
+{
+public:
+	CKDTreeBuilder( const CUtlBlockVector<CacheOptimizedTriangle> &triangles,
+					CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &triangleIndices,
+					CUtlVector<KDSubtree_t> *pDeferred = nullptr, int nDeferDepth = INT_MAX ) :
+		m_Triangles( triangles ), m_Nodes( nodes ), m_TriangleIndices( triangleIndices ),
+		m_pDeferred( pDeferred ), m_nDeferDepth( nDeferDepth )
+	{
+	}
+
+	void RefineNode(intp node_number,int32 const *tri_list,intp ntris,
+					Vector MinBound,Vector MaxBound, int depth);
+
+private:
+	float CalculateCostsOfSplit(
+		int split_plane,int32 const *tri_list,intp ntris,
+		Vector MinBound,Vector MaxBound, float &split_value,
+		int &nleft, int &nright, int &nboth, int8 *sides) const;
+
+	void MakeLeafNode(intp node_number,int32 const *tri_list,intp ntris,
+					  Vector MinBound,Vector MaxBound);
+
+	const CUtlBlockVector<CacheOptimizedTriangle> &m_Triangles;
+	CUtlVector<CacheOptimizedKDNode> &m_Nodes;
+	CUtlVector<int32> &m_TriangleIndices;
+	CUtlVector<KDSubtree_t> *m_pDeferred;
+	int m_nDeferDepth;
+};
+
+}  // namespace
+
+
+float CKDTreeBuilder::CalculateCostsOfSplit(
+	int split_plane, int32 const *tri_list, intp ntris,
 	Vector MinBound, Vector MaxBound, float &split_value,
-	int &nleft, int &nright, int &nboth)
+	int &nleft, int &nright, int &nboth, int8 *sides) const
 {
 	// determine the costs of splitting on a given axis, and label triangles with respect to
-	// that axis by storing the value in coordselect0. It will also return the number of
+	// that axis by storing the value in sides. It will also return the number of
 	// tris in the left, right, and nboth groups, in order to facilitate memory
 	nleft=nright=nboth=0;
-	
-	// now, label each triangle. Since we have not converted the triangles into
-	// intersection fromat yet, we can use the CoordSelect0 field of each as a temp.
+
+	// now, label each triangle.
 	float min_coord=FLT_MAX,max_coord=FLT_MIN;
 
-	for(int t=0;t<ntris;t++)
+	for(intp t=0;t<ntris;t++)
 	{
-		CacheOptimizedTriangle &tri=OptimizedTriangleList[tri_list[t]];
+		CacheOptimizedTriangle const &tri=m_Triangles[tri_list[t]];
 		// determine max and min coordinate values for later optimization
 		for(int v=0;v<3;v++)
 		{
@@ -698,17 +903,17 @@ float RayTracingEnvironment::CalculateCostsOfSplit(
 		{
 			case PLANECHECK_NEGATIVE:
 				nleft++;
-				tri.m_Data.m_GeometryData.m_nTmpData0 = PLANECHECK_NEGATIVE;
+				sides[t] = PLANECHECK_NEGATIVE;
 				break;
 
 			case PLANECHECK_POSITIVE:
 				nright++;
-				tri.m_Data.m_GeometryData.m_nTmpData0 = PLANECHECK_POSITIVE;
+				sides[t] = PLANECHECK_POSITIVE;
 				break;
 
 			case PLANECHECK_STRADDLING:
 				nboth++;
-				tri.m_Data.m_GeometryData.m_nTmpData0 = PLANECHECK_STRADDLING;
+				sides[t] = PLANECHECK_STRADDLING;
 				break;
 		}
 	}
@@ -732,27 +937,44 @@ float RayTracingEnvironment::CalculateCostsOfSplit(
 }
 
 
+void CKDTreeBuilder::MakeLeafNode(intp node_number,int32 const *tri_list,intp ntris,
+								  Vector MinBound,Vector MaxBound)
+{
+	auto &kdnode = m_Nodes[node_number];
+	kdnode.Children=KDNODE_STATE_LEAF+(m_TriangleIndices.Count()<<2);
+	kdnode.SetNumberOfTrianglesInLeafNode(ntris);
+
+#ifdef DEBUG_RAYTRACE
+	kdnode.vecMins = MinBound;
+	kdnode.vecMaxs = MaxBound;
+#endif
+
+	for(intp t=0;t<ntris;t++)
+		m_TriangleIndices.AddToTail(tri_list[t]);
+}
+
+
 #define NEVER_SPLIT 0
 
-void RayTracingEnvironment::RefineNode(intp node_number,int32 const *tri_list,intp ntris,
-									   Vector MinBound,Vector MaxBound, int depth)
+void CKDTreeBuilder::RefineNode(intp node_number,int32 const *tri_list,intp ntris,
+								Vector MinBound,Vector MaxBound, int depth)
 {
-	auto &kdnode = OptimizedKDTree[node_number];
+	if ( m_pDeferred && depth >= m_nDeferDepth )
+	{
+		// leave it for a worker thread
+		KDSubtree_t &subtree = (*m_pDeferred)[m_pDeferred->AddToTail()];
+		subtree.m_nNode = node_number;
+		subtree.m_TriList.CopyArray( tri_list, ntris );
+		subtree.m_MinBound = MinBound;
+		subtree.m_MaxBound = MaxBound;
+		subtree.m_nDepth = depth;
+		return;
+	}
 
 	if (ntris<3)											// never split empty lists
 	{
 		// no point in continuing
-		kdnode.Children=KDNODE_STATE_LEAF+(TriangleIndexList.Count()<<2);
-		kdnode.SetNumberOfTrianglesInLeafNode(ntris);
-
-#ifdef DEBUG_RAYTRACE
-		kdnode.vecMins = MinBound;
-		kdnode.vecMaxs = MaxBound;
-#endif
-
-		for(intp t=0;t<ntris;t++)
-			TriangleIndexList.AddToTail(tri_list[t]);
-
+		MakeLeafNode(node_number,tri_list,ntris,MinBound,MaxBound);
 		return;
 	}
 
@@ -761,6 +983,10 @@ void RayTracingEnvironment::RefineNode(intp node_number,int32 const *tri_list,in
 	float best_splitvalue=0;
 	int split_plane=0;
 
+	// which side of the split each triangle is on, for the split being tried and the best one
+	std::unique_ptr<int8[]> trial_sides = std::make_unique<int8[]>(ntris);
+	std::unique_ptr<int8[]> best_sides = std::make_unique<int8[]>(ntris);
+
 	int tri_skip=1+(ntris/10);								// don't try all trinagles as split
 															// points when there are a lot of them
 	for(int axis=0;axis<3;axis++)
@@ -776,18 +1002,15 @@ void RayTracingEnvironment::RefineNode(intp node_number,int32 const *tri_list,in
 				else
 				{
 					// else, split at the triangle vertex if possible
-					CacheOptimizedTriangle &tri=OptimizedTriangleList[tri_list[ts]];
+					CacheOptimizedTriangle const &tri=m_Triangles[tri_list[ts]];
 					trial_splitvalue = tri.Vertex(tv)[axis];
 					if ((trial_splitvalue>MaxBound[axis]) || (trial_splitvalue<MinBound[axis]))
 						continue;							// don't try this vertex - not inside
-					
+
 				}
-//				printf("ts=%d tv=%d tp=%f\n",ts,tv,trial_splitvalue);
 				float trial_cost=
 					CalculateCostsOfSplit(axis,tri_list,ntris,MinBound,MaxBound,trial_splitvalue,
-										  trial_nleft,trial_nright, trial_nboth);
-// 				printf("try %d cost=%f nl=%d nr=%d nb=%d sp=%f\n",axis,trial_cost,trial_nleft,trial_nright, trial_nboth,
-// 					   trial_splitvalue);
+										  trial_nleft,trial_nright, trial_nboth, trial_sides.get());
 				if (trial_cost<best_cost)
 				{
 					split_plane=axis;
@@ -797,11 +1020,7 @@ void RayTracingEnvironment::RefineNode(intp node_number,int32 const *tri_list,in
 					best_nboth=trial_nboth;
 					best_splitvalue=trial_splitvalue;
 					// save away the axis classification of each triangle
-					for(intp t=0 ; t < ntris; t++)
-					{
-						CacheOptimizedTriangle &tri=OptimizedTriangleList[tri_list[t]];
-						tri.m_Data.m_GeometryData.m_nTmpData1 = tri.m_Data.m_GeometryData.m_nTmpData0;
-					}
+					memcpy(best_sides.get(),trial_sides.get(),ntris);
 				}
 				if (ts==-1)
 					break;
@@ -813,63 +1032,48 @@ void RayTracingEnvironment::RefineNode(intp node_number,int32 const *tri_list,in
 	if ( (cost_of_no_split<=best_cost) || NEVER_SPLIT || (depth>MAX_TREE_DEPTH))
 	{
 		// no benefit to splitting. just make this a leaf node
-		kdnode.Children=KDNODE_STATE_LEAF+(TriangleIndexList.Count()<<2);
-		kdnode.SetNumberOfTrianglesInLeafNode(ntris);
-
-#ifdef DEBUG_RAYTRACE
-		kdnode.vecMins = MinBound;
-		kdnode.vecMaxs = MaxBound;
-#endif
-		for(intp t=0;t<ntris;t++)
-			TriangleIndexList.AddToTail(tri_list[t]);
+		MakeLeafNode(node_number,tri_list,ntris,MinBound,MaxBound);
+		return;
 	}
-	else
+
+	// its worth splitting!
+	// we will achieve the splitting without sorting by using a selection algorithm.
+	std::unique_ptr<int32[]> new_triangle_list = std::make_unique<int32[]>(ntris);
+
+	// now, perform surface area/cost check to determine whether this split was worth it
+	Vector LeftMins=MinBound;
+	Vector LeftMaxes=MaxBound;
+	Vector RightMins=MinBound;
+	Vector RightMaxes=MaxBound;
+	LeftMaxes[split_plane]=best_splitvalue;
+	RightMins[split_plane]=best_splitvalue;
+
+	int n_left_output=0;
+	int n_both_output=0;
+	int n_right_output=0;
+	for(intp t=0;t<ntris;t++)
 	{
-// 		printf("best split was %d at %f (mid=%f,n=%d, sk=%d)\n",split_plane,best_splitvalue,
-// 			   0.5*(MinBound[split_plane]+MaxBound[split_plane]),ntris,tri_skip);
-		// its worth splitting!
-		// we will achieve the splitting without sorting by using a selection algorithm.
-		std::unique_ptr<int32[]> new_triangle_list = std::make_unique<int32[]>(ntris);
-
-		// now, perform surface area/cost check to determine whether this split was worth it
-		Vector LeftMins=MinBound;
-		Vector LeftMaxes=MaxBound;
-		Vector RightMins=MinBound;
-		Vector RightMaxes=MaxBound;
-		LeftMaxes[split_plane]=best_splitvalue;
-		RightMins[split_plane]=best_splitvalue;
-		
-		int n_left_output=0;
-		int n_both_output=0;
-		int n_right_output=0;
-		for(intp t=0;t<ntris;t++)
+		switch( best_sides[t] )
 		{
-			const int optIndex = tri_list[t];
-			CacheOptimizedTriangle &tri=OptimizedTriangleList[optIndex];
-			switch( tri.m_Data.m_GeometryData.m_nTmpData1 )
-			{
-				case PLANECHECK_NEGATIVE:
-//					printf("%d goes left\n",t);
-					new_triangle_list[n_left_output++]=optIndex;
-					break;
-				case PLANECHECK_POSITIVE:
-					n_right_output++;
-//					printf("%d goes right\n",t);
-					new_triangle_list[ntris-n_right_output]=optIndex;
-					break;
-				case PLANECHECK_STRADDLING:
-//					printf("%d goes both\n",t);
-					new_triangle_list[best_nleft+n_both_output]=optIndex;
-					n_both_output++;
-					break;
-			}
+			case PLANECHECK_NEGATIVE:
+				new_triangle_list[n_left_output++]=tri_list[t];
+				break;
+			case PLANECHECK_POSITIVE:
+				n_right_output++;
+				new_triangle_list[ntris-n_right_output]=tri_list[t];
+				break;
+			case PLANECHECK_STRADDLING:
+				new_triangle_list[best_nleft+n_both_output]=tri_list[t];
+				n_both_output++;
+				break;
 		}
+	}
 
-		intp left_child=OptimizedKDTree.Count();
-		intp right_child=left_child+1;
-// 		printf("node %zd split on axis %d at %f, nl=%d nr=%d nb=%d lc=%d rc=%d\n",node_number,
-// 			   split_plane,best_splitvalue,best_nleft,best_nright,best_nboth,
-// 			   left_child,right_child);
+	intp left_child=m_Nodes.Count();
+	intp right_child=left_child+1;
+
+	{
+		auto &kdnode = m_Nodes[node_number];
 		kdnode.Children=split_plane+(left_child<<2);
 		kdnode.SplittingPlaneValue=best_splitvalue;
 
@@ -877,29 +1081,321 @@ void RayTracingEnvironment::RefineNode(intp node_number,int32 const *tri_list,in
 		kdnode.vecMins = MinBound;
 		kdnode.vecMaxs = MaxBound;
 #endif
+	}
+
+	CacheOptimizedKDNode newnode;
+	m_Nodes.AddToTail(newnode);
+	m_Nodes.AddToTail(newnode);
+
+	// now, recurse!
+	if ( (ntris<20) && ((best_nleft==0) || (best_nright==0)) )
+		depth+=100;
+
+	RefineNode(left_child,new_triangle_list.get(),best_nleft+best_nboth,LeftMins,LeftMaxes,depth+1);
+	RefineNode(right_child,new_triangle_list.get()+best_nleft,best_nright+best_nboth,
+			   RightMins,RightMaxes,depth+1);
+}
+
+
+namespace
+{
+
+struct BVHTriangle_t
+{
+	Vector m_vecMins;
+	Vector m_vecMaxs;
+	Vector m_vecCenter;
+};
+
+struct BVHSubtree_t
+{
+	intp m_nNode;											// placeholder for the root
+	intp m_nFirstTriangle;
+	intp m_nTriangles;
+	int m_nDepth;
+
+	// what it was built into
+	CUtlVector<CacheOptimizedBVHNode> m_Nodes;
+};
+
+
+//-----------------------------------------------------------------------------
+// Builds the bvh, or a subtree of it, with binned SAH over the triangle
+// centers. Every triangle is in exactly one leaf, so the triangle index list is
+// partitioned in place and subtrees only touch their own range of it. Nodes at
+// m_nDeferDepth are queued to m_pDeferred instead of being split.
+//-----------------------------------------------------------------------------
+class CBVHBuilder
+{
+public:
+	CBVHBuilder( const CUtlVector<BVHTriangle_t> &triangles, int32 *pTriangleIndices,
+				 CUtlVector<CacheOptimizedBVHNode> &nodes,
+				 CUtlVector<BVHSubtree_t> *pDeferred = nullptr, int nDeferDepth = INT_MAX ) :
+		m_Triangles( triangles ), m_pTriangleIndices( pTriangleIndices ), m_Nodes( nodes ),
+		m_pDeferred( pDeferred ), m_nDeferDepth( nDeferDepth )
+	{
+	}
+
+	void BuildNode( intp node_number, intp first_tri, intp ntris, int depth );
+
+private:
+	const CUtlVector<BVHTriangle_t> &m_Triangles;
+	int32 *m_pTriangleIndices;
+	CUtlVector<CacheOptimizedBVHNode> &m_Nodes;
+	CUtlVector<BVHSubtree_t> *m_pDeferred;
+	int m_nDeferDepth;
+};
+
+}  // namespace
+
+
+void CBVHBuilder::BuildNode( intp node_number, intp first_tri, intp ntris, int depth )
+{
+	if ( m_pDeferred && depth >= m_nDeferDepth )
+	{
+		// leave it for a worker thread
+		BVHSubtree_t &subtree = (*m_pDeferred)[m_pDeferred->AddToTail()];
+		subtree.m_nNode = node_number;
+		subtree.m_nFirstTriangle = first_tri;
+		subtree.m_nTriangles = ntris;
+		subtree.m_nDepth = depth;
+		return;
+	}
+
+	int32 *tri_list = m_pTriangleIndices + first_tri;
+
+	Vector MinBound( FLT_MAX, FLT_MAX, FLT_MAX ), MaxBound( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+	Vector CenterMins = MinBound, CenterMaxs = MaxBound;
+	for ( intp t = 0; t < ntris; t++ )
+	{
+		const BVHTriangle_t &tri = m_Triangles[tri_list[t]];
+		VectorMin( MinBound, tri.m_vecMins, MinBound );
+		VectorMax( MaxBound, tri.m_vecMaxs, MaxBound );
+		VectorMin( CenterMins, tri.m_vecCenter, CenterMins );
+		VectorMax( CenterMaxs, tri.m_vecCenter, CenterMaxs );
+	}
+
+	{
+		CacheOptimizedBVHNode &node = m_Nodes[node_number];
+		for ( int c = 0; c < 3; c++ )
+		{
+			node.m_flMins[c] = MinBound[c];
+			node.m_flMaxs[c] = MaxBound[c];
+		}
+	}
+
+	// find the cheapest split between bins on any axis
+	float best_cost = FLT_MAX;
+	int best_axis = -1;
+	int best_bin = 0;										// bins below this go left
+	if ( ntris > 2 && depth < BVH_MAX_DEPTH )
+	{
+		const float ISA = 1.0f / max( BoxSurfaceArea( MinBound, MaxBound ), FLT_MIN );
+		for ( int axis = 0; axis < 3; axis++ )
+		{
+			const float flExtent = CenterMaxs[axis] - CenterMins[axis];
+			if ( flExtent <= 1.0e-6f )
+				continue;
+
+			const float flBinScale = BVH_BINS / flExtent;
+			int bin_count[BVH_BINS] = {};
+			Vector bin_mins[BVH_BINS], bin_maxs[BVH_BINS];
+			for ( int b = 0; b < BVH_BINS; b++ )
+			{
+				bin_mins[b].Init( FLT_MAX, FLT_MAX, FLT_MAX );
+				bin_maxs[b].Init( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+			}
+			for ( intp t = 0; t < ntris; t++ )
+			{
+				const BVHTriangle_t &tri = m_Triangles[tri_list[t]];
+				const int b = min( (int)( ( tri.m_vecCenter[axis] - CenterMins[axis] ) * flBinScale ), BVH_BINS - 1 );
+				bin_count[b]++;
+				VectorMin( bin_mins[b], tri.m_vecMins, bin_mins[b] );
+				VectorMax( bin_maxs[b], tri.m_vecMaxs, bin_maxs[b] );
+			}
+
+			// sweep from the right to get the cost of everything above each split
+			float right_cost[BVH_BINS];
+			Vector mins( FLT_MAX, FLT_MAX, FLT_MAX ), maxs( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+			int nright = 0;
+			for ( int b = BVH_BINS - 1; b > 0; b-- )
+			{
+				nright += bin_count[b];
+				VectorMin( mins, bin_mins[b], mins );
+				VectorMax( maxs, bin_maxs[b], maxs );
+				right_cost[b] = nright ? BoxSurfaceArea( mins, maxs ) * nright : -1.0f;
+			}
+
+			mins.Init( FLT_MAX, FLT_MAX, FLT_MAX );
+			maxs.Init( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+			int nleft = 0;
+			for ( int b = 1; b < BVH_BINS; b++ )
+			{
+				nleft += bin_count[b - 1];
+				VectorMin( mins, bin_mins[b - 1], mins );
+				VectorMax( maxs, bin_maxs[b - 1], maxs );
+				if ( !nleft || right_cost[b] < 0 )
+					continue;
+
+				const float cost = COST_OF_TRAVERSAL + COST_OF_INTERSECTION *
+					( BoxSurfaceArea( mins, maxs ) * nleft + right_cost[b] ) * ISA;
+				if ( cost < best_cost )
+				{
+					best_cost = cost;
+					best_axis = axis;
+					best_bin = b;
+				}
+			}
+		}
+	}
 
-		CacheOptimizedKDNode newnode;
-		OptimizedKDTree.AddToTail(newnode);
-		OptimizedKDTree.AddToTail(newnode);
+	const float cost_of_no_split = COST_OF_INTERSECTION * ntris;
+	if ( best_axis < 0 || ( ntris <= BVH_MAX_LEAF_TRIS && cost_of_no_split <= best_cost ) )
+	{
+		CacheOptimizedBVHNode &node = m_Nodes[node_number];
+		node.Children = KDNODE_STATE_LEAF + (int32)( first_tri << 2 );
+		node.m_nTriangles = (int32)ntris;
+		return;
+	}
 
-		// now, recurse!
-		if ( (ntris<20) && ((best_nleft==0) || (best_nright==0)) )
-			depth+=100;
+	const float flBinScale = BVH_BINS / ( CenterMaxs[best_axis] - CenterMins[best_axis] );
+	int32 *pMid = std::partition( tri_list, tri_list + ntris, [&]( int32 tnum )
+	{
+		const float flCenter = m_Triangles[tnum].m_vecCenter[best_axis];
+		return min( (int)( ( flCenter - CenterMins[best_axis] ) * flBinScale ), BVH_BINS - 1 ) < best_bin;
+	} );
+	const intp nleft = pMid - tri_list;
+	Assert( nleft > 0 && nleft < ntris );
 
-		RefineNode(left_child,new_triangle_list.get(),best_nleft+best_nboth,LeftMins,LeftMaxes,depth+1);
-		RefineNode(right_child,new_triangle_list.get()+best_nleft,best_nright+best_nboth,
-				   RightMins,RightMaxes,depth+1);
+	const intp left_child = m_Nodes.Count();
+	{
+		CacheOptimizedBVHNode &node = m_Nodes[node_number];
+		node.Children = best_axis + (int32)( left_child << 2 );
+		node.m_nTriangles = 0;
 	}
+
+	CacheOptimizedBVHNode newnode{};
+	m_Nodes.AddToTail( newnode );
+	m_Nodes.AddToTail( newnode );
+
+	BuildNode( left_child, first_tri, nleft, depth + 1 );
+	BuildNode( left_child + 1, first_tri + nleft, ntris - nleft, depth + 1 );
 }
 
 
-void RayTracingEnvironment::SetupAccelerationStructure()
+static void BuildKDTree( RayTracingEnvironment &env, int32 const *tri_list, intp ntris, int nThreads )
 {
+	CUtlVector<KDSubtree_t> subtrees;
+	const int nDeferDepth = DeferDepthForThreads( nThreads, ntris );
+
 	CacheOptimizedKDNode root{};
-	OptimizedKDTree.AddToTail(root);
+	env.OptimizedKDTree.AddToTail(root);
+
+	CKDTreeBuilder builder( env.OptimizedTriangleList, env.OptimizedKDTree, env.TriangleIndexList,
+							&subtrees, nDeferDepth );
+	builder.RefineNode( 0, tri_list, ntris, env.m_MinBound, env.m_MaxBound, 0 );
+
+	// biggest first so the stragglers at the end are small
+	CUtlVector<KDSubtree_t *> order;
+	order.EnsureCapacity( subtrees.Count() );
+	for ( KDSubtree_t &subtree : subtrees )
+		order.AddToTail( &subtree );
+	std::sort( order.begin(), order.end(), []( const KDSubtree_t *a, const KDSubtree_t *b )
+	{
+		return a->m_TriList.Count() > b->m_TriList.Count();
+	} );
+
+	RunJobsInParallel( nThreads, order.Count(), [&env, &order]( intp i )
+	{
+		KDSubtree_t &subtree = *order[i];
+		subtree.m_Nodes.AddToTail( CacheOptimizedKDNode{} );
+
+		CKDTreeBuilder subtreeBuilder( env.OptimizedTriangleList, subtree.m_Nodes, subtree.m_TriangleIndices );
+		subtreeBuilder.RefineNode( 0, subtree.m_TriList.Base(), subtree.m_TriList.Count(),
+								   subtree.m_MinBound, subtree.m_MaxBound, subtree.m_nDepth );
+		subtree.m_TriList.Purge();
+	} );
+
+	// splice in the order they were deferred so the tree is the same whatever the thread count
+	for ( KDSubtree_t &subtree : subtrees )
+	{
+		SpliceSubtree( env.OptimizedKDTree, subtree.m_nNode, subtree.m_Nodes, env.TriangleIndexList.Count() );
+		env.TriangleIndexList.AddMultipleToTail( subtree.m_TriangleIndices.Count(), subtree.m_TriangleIndices.Base() );
+	}
+}
+
+
+static void BuildBVH( RayTracingEnvironment &env, intp ntris, int nThreads )
+{
+	CUtlVector<BVHTriangle_t> triangles;
+	triangles.SetCount( ntris );
+	env.TriangleIndexList.SetCount( ntris );
+	for ( intp t = 0; t < ntris; t++ )
+	{
+		CacheOptimizedTriangle const &tri = env.OptimizedTriangleList[t];
+		BVHTriangle_t &bounds = triangles[t];
+		bounds.m_vecMins = bounds.m_vecMaxs = tri.Vertex( 0 );
+		for ( int v = 1; v < 3; v++ )
+		{
+			VectorMin( bounds.m_vecMins, tri.Vertex( v ), bounds.m_vecMins );
+			VectorMax( bounds.m_vecMaxs, tri.Vertex( v ), bounds.m_vecMaxs );
+		}
+		bounds.m_vecCenter = ( bounds.m_vecMins + bounds.m_vecMaxs ) * 0.5f;
+		env.TriangleIndexList[t] = (int32)t;
+	}
+
+	CUtlVector<BVHSubtree_t> subtrees;
+	const int nDeferDepth = DeferDepthForThreads( nThreads, ntris );
+
+	CacheOptimizedBVHNode root{};
+	env.OptimizedBVH.AddToTail( root );
+
+	CBVHBuilder builder( triangles, env.TriangleIndexList.Base(), env.OptimizedBVH, &subtrees, nDeferDepth );
+	builder.BuildNode( 0, 0, ntris, 0 );
+
+	CUtlVector<BVHSubtree_t *> order;
+	order.EnsureCapacity( subtrees.Count() );
+	for ( BVHSubtree_t &subtree : subtrees )
+		order.AddToTail( &subtree );
+	std::sort( order.begin(), order.end(), []( const BVHSubtree_t *a, const BVHSubtree_t *b )
+	{
+		return a->m_nTriangles > b->m_nTriangles;
+	} );
+
+	RunJobsInParallel( nThreads, order.Count(), [&env, &order, &triangles]( intp i )
+	{
+		BVHSubtree_t &subtree = *order[i];
+		subtree.m_Nodes.AddToTail( CacheOptimizedBVHNode{} );
+
+		CBVHBuilder subtreeBuilder( triangles, env.TriangleIndexList.Base(), subtree.m_Nodes );
+		subtreeBuilder.BuildNode( 0, subtree.m_nFirstTriangle, subtree.m_nTriangles, subtree.m_nDepth );
+	} );
+
+	// leaves already point into the shared triangle index list
+	for ( BVHSubtree_t &subtree : subtrees )
+	{
+		SpliceSubtree( env.OptimizedBVH, subtree.m_nNode, subtree.m_Nodes, 0 );
+	}
+}
+
+
+void RayTracingEnvironment::SetupAccelerationStructure(int nThreads)
+{
+	if ( nThreads <= 0 )
+		nThreads = max( 1, (int)GetCPUInformation()->m_nLogicalProcessors );
 
 	const intp trianglesCount = OptimizedTriangleList.Count();
 
+	if ( Flags & RTE_FLAGS_USE_BVH )
+	{
+		BuildBVH( *this, trianglesCount, nThreads );
+		if ( trianglesCount )
+		{
+			m_MinBound.Init( OptimizedBVH[0].m_flMins[0], OptimizedBVH[0].m_flMins[1], OptimizedBVH[0].m_flMins[2] );
+			m_MaxBound.Init( OptimizedBVH[0].m_flMaxs[0], OptimizedBVH[0].m_flMaxs[1], OptimizedBVH[0].m_flMaxs[2] );
+		}
+	}
+	else
 	{
 		std::unique_ptr<int32[]> root_triangle_list = std::make_unique<int32[]>(trianglesCount);
 		for(intp t = 0; t < trianglesCount; t++)
@@ -907,12 +1403,17 @@ void RayTracingEnvironment::SetupAccelerationStructure()
 
 		CalculateTriangleListBounds(root_triangle_list.get(),trianglesCount,m_MinBound,
 									m_MaxBound);
-		RefineNode(0,root_triangle_list.get(),trianglesCount,m_MinBound,m_MaxBound,0);
+		BuildKDTree( *this, root_triangle_list.get(), trianglesCount, nThreads );
 	}
 
 	// now, convert all triangles to "intersection format"
-	for(intp i = 0; i < OptimizedTriangleList.Count(); i++)
-		OptimizedTriangleList[i].ChangeIntoIntersectionFormat();
+	const intp nJobs = ( trianglesCount + TRIANGLES_PER_CONVERSION_JOB - 1 ) / TRIANGLES_PER_CONVERSION_JOB;
+	RunJobsInParallel( nThreads, nJobs, [this, trianglesCount]( intp nJob )
+	{
+		const intp nEnd = min( ( nJob + 1 ) * TRIANGLES_PER_CONVERSION_JOB, trianglesCount );
+		for ( intp i = nJob * TRIANGLES_PER_CONVERSION_JOB; i < nEnd; i++ )
+			OptimizedTriangleList[i].ChangeIntoIntersectionFormat();
+	} );
 }
 
 
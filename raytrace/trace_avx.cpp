@@ -0,0 +1,370 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+// $Id$
+//
+// 8 wide AVX version of the kd-tree traversal in raytrace.cpp. The file is built with the same
+// instruction set as the rest of the library, only the functions marked RT_AVX_FUNCTION use AVX,
+// and those only run when the cpu and os support it.
+#include "raytrace.h"
+
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+// NOTE: This has to be the last file included!
+#include "tier0/memdbgon.h"
+
+// gcc and clang put a vzeroupper before every call and return of an RT_AVX_FUNCTION. msvc has
+// no target attribute and does not, so the AVX code clears the upper halves itself with
+// _mm256_zeroupper() before it hands control back to SSE code, or every SSE instruction after it
+// pays for the state transition.
+#if defined( __GNUC__ ) || defined( __clang__ )
+#define RT_AVX_FUNCTION __attribute__(( target( "avx" ) ))
+#else
+#define RT_AVX_FUNCTION
+#endif
+
+
+FourRays EightRays::Half(int half) const
+{
+	FourRays ret;
+	ret.origin.x=LoadUnalignedSIMD(&origin[0][4*half]);
+	ret.origin.y=LoadUnalignedSIMD(&origin[1][4*half]);
+	ret.origin.z=LoadUnalignedSIMD(&origin[2][4*half]);
+	ret.direction.x=LoadUnalignedSIMD(&direction[0][4*half]);
+	ret.direction.y=LoadUnalignedSIMD(&direction[1][4*half]);
+	ret.direction.z=LoadUnalignedSIMD(&direction[2][4*half]);
+	return ret;
+}
+
+int EightRays::CalculateDirectionSignMask(void) const
+{
+	// like FourRays, only the sign bits matter, so -0 counts as negative
+	int ret=0;
+	for(int c=0;c<3;c++)
+	{
+		int nNegative=0;
+		for(int i=0;i<8;i++)
+			nNegative+=std::signbit(direction[c][i]) ? 1 : 0;
+
+		if (nNegative==8)
+			ret|=1<<c;
+		else if (nNegative)
+			return -1;
+	}
+	return ret;
+}
+
+
+// AVX also needs the os to save the upper halves of the registers on context switches.
+static bool IsAVXSupported()
+{
+	static const bool s_bAVX = []()
+	{
+		constexpr uint32 nOSXSaveAndAVX = ( 1U << 27 ) | ( 1U << 28 );	// cpuid 1, ecx
+		if ( ( GetCPUInformation()->m_nFeatures[1] & nOSXSaveAndAVX ) != nOSXSaveAndAVX )
+			return false;
+
+#ifdef _MSC_VER
+		const uint64 xcr0 = _xgetbv( 0 );
+#else
+		uint32 eax, edx;
+		__asm__ __volatile__( "xgetbv" : "=a"( eax ), "=d"( edx ) : "c"( 0 ) );
+		const uint64 xcr0 = eax | ( (uint64)edx << 32 );
+#endif
+		return ( xcr0 & 6 ) == 6;										// xmm and ymm state
+	}();
+	return s_bAVX;
+}
+
+
+namespace
+{
+
+struct NodeToVisit8
+{
+	CacheOptimizedKDNode const *node;
+	__m256 TMin;
+	__m256 TMax;
+};
+
+RT_AVX_FUNCTION FORCEINLINE bool IsAnyTrue8( __m256 a )
+{
+	return _mm256_movemask_ps( a ) != 0;
+}
+
+// same as ReciprocalSaturateSIMD: 0 becomes FLT_EPSILON, then one newton step on the estimate
+RT_AVX_FUNCTION FORCEINLINE __m256 ReciprocalSaturate8( __m256 a )
+{
+	const __m256 zero_mask = _mm256_cmp_ps( a, _mm256_setzero_ps(), _CMP_EQ_OQ );
+	const __m256 b = _mm256_or_ps( a, _mm256_and_ps( _mm256_set1_ps( FLT_EPSILON ), zero_mask ) );
+	const __m256 est = _mm256_rcp_ps( b );
+	return _mm256_sub_ps( _mm256_add_ps( est, est ), _mm256_mul_ps( b, _mm256_mul_ps( est, est ) ) );
+}
+
+RT_AVX_FUNCTION FORCEINLINE fltx4 Half8( __m256 a, int half )
+{
+	return half ? _mm256_extractf128_ps( a, 1 ) : _mm256_castps256_ps128( a );
+}
+
+// IntersectTriangle4 for 8 rays. The arithmetic is done in the same order so the hits are the
+// same as tracing each half with Trace4Rays.
+RT_AVX_FUNCTION FORCEINLINE void IntersectTriangle8( TriIntersectData_t const *tri, int32 tnum,
+													 const EightRays &rays, const __m256 *org,
+													 const __m256 *dir, __m256 &hit_dist,
+													 RayTracingResult8 *rslt_out,
+													 ITransparentTriangleCallback *pCallback )
+{
+	const __m256 Epsilons = _mm256_set1_ps( 1.0e-10f );
+	const __m256 NegativeEpsilons = _mm256_set1_ps( -1.0e-10f );
+	const __m256 Zeros = _mm256_setzero_ps();
+	const __m256 Ones = _mm256_set1_ps( 1.0f );
+
+	// compute plane intersection
+	const __m256 Nx = _mm256_set1_ps( tri->m_flNx );
+	const __m256 Ny = _mm256_set1_ps( tri->m_flNy );
+	const __m256 Nz = _mm256_set1_ps( tri->m_flNz );
+
+	__m256 DDotN = _mm256_mul_ps( dir[0], Nx );
+	DDotN = _mm256_add_ps( _mm256_mul_ps( dir[1], Ny ), DDotN );
+	DDotN = _mm256_add_ps( _mm256_mul_ps( dir[2], Nz ), DDotN );
+
+	// mask off zero or near zero (ray parallel to surface)
+	__m256 did_hit = _mm256_or_ps( _mm256_cmp_ps( DDotN, Epsilons, _CMP_GT_OQ ),
+								   _mm256_cmp_ps( DDotN, NegativeEpsilons, _CMP_LT_OQ ) );
+
+	__m256 ODotN = _mm256_mul_ps( org[0], Nx );
+	ODotN = _mm256_add_ps( _mm256_mul_ps( org[1], Ny ), ODotN );
+	ODotN = _mm256_add_ps( _mm256_mul_ps( org[2], Nz ), ODotN );
+	const __m256 numerator = _mm256_sub_ps( _mm256_set1_ps( tri->m_flD ), ODotN );
+
+	const __m256 isect_t = _mm256_div_ps( numerator, DDotN );
+	// now, we have the distance to the plane. lets update our mask
+	did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( isect_t, Zeros, _CMP_GT_OQ ) );
+	did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( isect_t, hit_dist, _CMP_LT_OQ ) );
+
+	if ( !IsAnyTrue8( did_hit ) )
+		return;
+
+	// now, check 3 edges
+	const __m256 hitc1 = _mm256_add_ps( _mm256_mul_ps( isect_t, dir[tri->m_nCoordSelect0] ), org[tri->m_nCoordSelect0] );
+	const __m256 hitc2 = _mm256_add_ps( _mm256_mul_ps( isect_t, dir[tri->m_nCoordSelect1] ), org[tri->m_nCoordSelect1] );
+
+	// do barycentric coordinate check
+	__m256 B0 = _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[0] ), hitc1 );
+	B0 = _mm256_add_ps( _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[1] ), hitc2 ), B0 );
+	B0 = _mm256_add_ps( B0, _mm256_set1_ps( tri->m_ProjectedEdgeEquations[2] ) );
+
+	did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B0, Zeros, _CMP_GE_OQ ) );
+
+	__m256 B1 = _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[3] ), hitc1 );
+	B1 = _mm256_add_ps( _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[4] ), hitc2 ), B1 );
+	B1 = _mm256_add_ps( B1, _mm256_set1_ps( tri->m_ProjectedEdgeEquations[5] ) );
+
+	did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B1, Zeros, _CMP_GE_OQ ) );
+
+	const __m256 B2 = _mm256_add_ps( B1, B0 );
+	did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B2, Ones, _CMP_LE_OQ ) );
+
+	if ( !IsAnyTrue8( did_hit ) )
+		return;
+
+	// the callback only knows about 4 rays, give it each half that hit. See IntersectTriangle4
+	// for the order of the barycentric coordinates.
+	if ( ( tri->m_nFlags & FCACHETRI_TRANSPARENT ) && pCallback )
+	{
+		const __m256 b2 = _mm256_sub_ps( Ones, B2 );
+		for ( int h = 0; h < 2; h++ )
+		{
+			fltx4 hit4 = Half8( did_hit, h );
+			if ( !IsAnyNegative( hit4 ) )
+				continue;
+
+			const FourRays rays4 = rays.Half( h );
+			fltx4 B1_4 = Half8( B1, h );
+			fltx4 b2_4 = Half8( b2, h );
+			fltx4 B0_4 = Half8( B0, h );
+			_mm256_zeroupper();									// the callback is SSE code
+			if ( pCallback->VisitTriangle_ShouldContinue( *tri, rays4, &hit4, &B1_4, &b2_4, &B0_4, tnum ) )
+			{
+				hit4 = Four_Zeros;
+			}
+			did_hit = h ? _mm256_insertf128_ps( did_hit, hit4, 1 ) : _mm256_insertf128_ps( did_hit, hit4, 0 );
+		}
+	}
+
+	// now, set the hit_id and closest_hit fields for any enabled rays
+	const __m256 old_ids = _mm256_load_ps( reinterpret_cast<const float *>( rslt_out->HitIds ) );
+	const __m256 new_ids = _mm256_castsi256_ps( _mm256_set1_epi32( tnum ) );
+	_mm256_store_ps( reinterpret_cast<float *>( rslt_out->HitIds ), _mm256_blendv_ps( old_ids, new_ids, did_hit ) );
+
+	hit_dist = _mm256_blendv_ps( hit_dist, isect_t, did_hit );
+	_mm256_store_ps( rslt_out->HitDistance, hit_dist );
+
+	_mm256_store_ps( rslt_out->surface_normal[0], _mm256_blendv_ps( _mm256_load_ps( rslt_out->surface_normal[0] ), Nx, did_hit ) );
+	_mm256_store_ps( rslt_out->surface_normal[1], _mm256_blendv_ps( _mm256_load_ps( rslt_out->surface_normal[1] ), Ny, did_hit ) );
+	_mm256_store_ps( rslt_out->surface_normal[2], _mm256_blendv_ps( _mm256_load_ps( rslt_out->surface_normal[2] ), Nz, did_hit ) );
+}
+
+// the kd-tree traversal of Trace4Rays, 8 rays at a time
+RT_AVX_FUNCTION void TraceKD8Rays( RayTracingEnvironment &env, const EightRays &rays,
+								   const float *pTMin, const float *pTMax, int DirectionSignMask,
+								   RayTracingResult8 *rslt_out, int32 skip_id,
+								   ITransparentTriangleCallback *pCallback )
+{
+	memset( rslt_out->HitIds, 0xff, sizeof( rslt_out->HitIds ) );
+	__m256 hit_dist = _mm256_set1_ps( 1.0e23f );
+	_mm256_store_ps( rslt_out->HitDistance, hit_dist );
+	memset( rslt_out->surface_normal, 0, sizeof( rslt_out->surface_normal ) );
+
+	__m256 org[3], dir[3], OneOverRayDir[3];
+	for ( int c = 0; c < 3; c++ )
+	{
+		org[c] = _mm256_load_ps( rays.origin[c] );
+		dir[c] = _mm256_load_ps( rays.direction[c] );
+		OneOverRayDir[c] = ReciprocalSaturate8( dir[c] );
+	}
+
+	// now, clip rays against bounding box
+	__m256 TMin = _mm256_loadu_ps( pTMin );
+	__m256 TMax = _mm256_loadu_ps( pTMax );
+	for ( int c = 0; c < 3; c++ )
+	{
+		const __m256 isect_min_t =
+			_mm256_mul_ps( _mm256_sub_ps( _mm256_set1_ps( env.m_MinBound[c] ), org[c] ), OneOverRayDir[c] );
+		const __m256 isect_max_t =
+			_mm256_mul_ps( _mm256_sub_ps( _mm256_set1_ps( env.m_MaxBound[c] ), org[c] ), OneOverRayDir[c] );
+		TMin = _mm256_max_ps( TMin, _mm256_min_ps( isect_min_t, isect_max_t ) );
+		TMax = _mm256_min_ps( TMax, _mm256_max_ps( isect_min_t, isect_max_t ) );
+	}
+	__m256 active = _mm256_cmp_ps( TMin, TMax, _CMP_LE_OQ );			// mask of which rays are active
+	if ( !IsAnyTrue8( active ) )
+		return;													// missed bounding box
+
+	int32 mailboxids[MAILBOX_HASH_SIZE];						// used to avoid redundant triangle tests
+	memset( mailboxids, 0xff, sizeof( mailboxids ) );
+
+	// based on ray direction, whether to visit left or right node first
+	int front_idx[3], back_idx[3];
+	for ( int c = 0; c < 3; c++ )
+	{
+		back_idx[c] = ( DirectionSignMask >> c ) & 1 ? 0 : 1;
+		front_idx[c] = back_idx[c] ^ 1;
+	}
+
+	NodeToVisit8 NodeQueue[MAX_NODE_STACK_LEN];
+	CacheOptimizedKDNode const *CurNode = &( env.OptimizedKDTree[0] );
+	NodeToVisit8 *stack_ptr = &NodeQueue[MAX_NODE_STACK_LEN];
+	while ( 1 )
+	{
+		while ( CurNode->NodeType() != KDNODE_STATE_LEAF )		// traverse until next leaf
+		{
+			const int split_plane_number = CurNode->NodeType();
+			CacheOptimizedKDNode const *FrontChild = &( env.OptimizedKDTree[CurNode->LeftChild()] );
+
+			const __m256 dist_to_sep_plane =						// dist=(split-org)/dir
+				_mm256_mul_ps( _mm256_sub_ps( _mm256_set1_ps( CurNode->SplittingPlaneValue ), org[split_plane_number] ),
+							   OneOverRayDir[split_plane_number] );
+			active = _mm256_cmp_ps( TMin, TMax, _CMP_LE_OQ );		// mask of which rays are active
+
+			// now, decide how to traverse children. can either do front,back, or do front and push
+			// back.
+			const __m256 hits_front = _mm256_and_ps( active, _mm256_cmp_ps( dist_to_sep_plane, TMin, _CMP_GE_OQ ) );
+			if ( !IsAnyTrue8( hits_front ) )
+			{
+				// missed the front. only traverse back
+				CurNode = FrontChild + back_idx[split_plane_number];
+				TMin = _mm256_max_ps( TMin, dist_to_sep_plane );
+			}
+			else
+			{
+				const __m256 hits_back = _mm256_and_ps( active, _mm256_cmp_ps( dist_to_sep_plane, TMax, _CMP_LE_OQ ) );
+				if ( !IsAnyTrue8( hits_back ) )
+				{
+					// missed the back - only need to traverse front node
+					CurNode = FrontChild + front_idx[split_plane_number];
+					TMax = _mm256_min_ps( TMax, dist_to_sep_plane );
+				}
+				else
+				{
+					// at least some rays hit both nodes.
+					// must push far, traverse near
+					Assert( stack_ptr > NodeQueue );
+					--stack_ptr;
+					stack_ptr->node = FrontChild + back_idx[split_plane_number];
+					stack_ptr->TMin = _mm256_max_ps( TMin, dist_to_sep_plane );
+					stack_ptr->TMax = TMax;
+					CurNode = FrontChild + front_idx[split_plane_number];
+					TMax = _mm256_min_ps( TMax, dist_to_sep_plane );
+				}
+			}
+		}
+		// hit a leaf! must do intersection check
+		int ntris = CurNode->NumberOfTrianglesInLeaf();
+		if ( ntris )
+		{
+			int32 const *tlist = &( env.TriangleIndexList[CurNode->TriangleIndexStart()] );
+			do
+			{
+				const int tnum = *( tlist++ );
+				// check mailbox
+				const int mbox_slot = tnum & ( MAILBOX_HASH_SIZE - 1 );
+				TriIntersectData_t const *tri = &( env.OptimizedTriangleList[tnum].m_Data.m_IntersectData );
+				if ( ( mailboxids[mbox_slot] != tnum ) && ( tri->m_nTriangleID != skip_id ) )
+				{
+					mailboxids[mbox_slot] = tnum;
+					IntersectTriangle8( tri, tnum, rays, org, dir, hit_dist, rslt_out, pCallback );
+				}
+			} while ( --ntris );
+			// now, check if all rays have terminated
+			if ( !IsAnyTrue8( _mm256_cmp_ps( TMax, hit_dist, _CMP_LE_OQ ) ) )
+				return;
+		}
+
+		if ( stack_ptr == &NodeQueue[MAX_NODE_STACK_LEN] )
+			return;
+
+		// pop stack!
+		CurNode = stack_ptr->node;
+		TMin = stack_ptr->TMin;
+		TMax = stack_ptr->TMax;
+		stack_ptr++;
+	}
+}
+
+// called on the way out of the AVX path, before the SSE callers run again
+RT_AVX_FUNCTION void ZeroUpper8()
+{
+	_mm256_zeroupper();
+}
+
+}  // namespace
+
+
+void RayTracingEnvironment::Trace8Rays(const EightRays &rays, const float TMin[8], const float TMax[8],
+									   RayTracingResult8 *rslt_out,
+									   int32 skip_id, ITransparentTriangleCallback *pCallback)
+{
+	const int msk=rays.CalculateDirectionSignMask();
+	if ( msk != -1 && !( Flags & RTE_FLAGS_USE_BVH ) && IsAVXSupported() )
+	{
+		TraceKD8Rays( *this, rays, TMin, TMax, msk, rslt_out, skip_id, pCallback );
+		ZeroUpper8();
+		return;
+	}
+
+	// trace each half 4 wide
+	for(int h=0;h<2;h++)
+	{
+		RayTracingResult rslt;
+		Trace4Rays( rays.Half(h), LoadUnalignedSIMD(TMin+4*h), LoadUnalignedSIMD(TMax+4*h), &rslt,
+					skip_id, pCallback );
+		for(int i=0;i<4;i++)
+		{
+			rslt_out->HitIds[4*h+i]=rslt.HitIds[i];
+			rslt_out->HitDistance[4*h+i]=SubFloat(rslt.HitDistance,i);
+			rslt_out->surface_normal[0][4*h+i]=rslt.surface_normal.X(i);
+			rslt_out->surface_normal[1][4*h+i]=rslt.surface_normal.Y(i);
+			rslt_out->surface_normal[2][4*h+i]=rslt.surface_normal.Z(i);
+		}
+	}
+}
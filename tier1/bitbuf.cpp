@@ -435,7 +435,7 @@ bool bf_write::WriteBits(const void *pInData, intp nBits)
 	VPROF( "bf_write::WriteBits" );
 #endif
 
-	const auto *pOut = (const unsigned char*)pInData;
+	const auto *pIn = static_cast<const byte *>(pInData);
 	intp nBitsLeft = nBits;
 
 	// Bounds checking..
@@ -446,72 +446,54 @@ bool bf_write::WriteBits(const void *pInData, intp nBits)
 		return false;
 	}
 
-	// Align output to dword boundary
-	while (((uintp)pOut & 3) != 0 && nBitsLeft >= CHAR_BIT)
-	{
-		WriteUBitLong( *pOut, CHAR_BIT, false );
-		++pOut;
-		nBitsLeft -= CHAR_BIT;
-	}
-	
-	if ( (nBitsLeft >= 32) && (m_iCurBit & 7) == 0 )
+	auto *pOut = reinterpret_cast<byte *>(m_pData) + (m_iCurBit >> 3);
+	const unsigned iShift = m_iCurBit & 7;
+
+	if ( iShift == 0 )
 	{
 		// current bit is byte aligned, do block copy
-		intp numbytes = nBitsLeft / CHAR_BIT; 
-		intp numbits = numbytes * CHAR_BIT;
-		
-		Q_memcpy( (char*)m_pData+(m_iCurBit>>3), pOut, numbytes );
-		pOut += numbytes;
+		const intp numbytes = nBitsLeft / CHAR_BIT;
+		const intp numbits = numbytes * CHAR_BIT;
+
+		memcpy( pOut, pIn, numbytes );
+		pIn += numbytes;
 		nBitsLeft -= numbits;
 		m_iCurBit += numbits;
 	}
-
-	constexpr int kUint32Bits = CHAR_BIT * sizeof(uint32);
-
-	if ( nBitsLeft >= kUint32Bits )
+	else if ( nBitsLeft >= 64 )
 	{
-		unsigned iBitsRight = (m_iCurBit & 31);
-		unsigned iBitsLeft = kUint32Bits - iBitsRight;
-		unsigned bitMaskLeft = g_BitWriteMasks[iBitsRight][kUint32Bits];
-		unsigned bitMaskRight = g_BitWriteMasks[0][iBitsRight];
+		// Shift whole qwords into place. The top iShift bits of each qword
+		// spill into the next one, the bits below the current bit are kept.
+		const unsigned lowMask = (1u << iShift) - 1;
+		uint64 carry = *pOut & lowMask;
 
-		unsigned *pData = &m_pData[m_iCurBit>>5];
-
-		// Read dwords.
-		while ( nBitsLeft >= kUint32Bits )
+		while ( nBitsLeft >= 64 )
 		{
-			uint32 curData = *(uint32 *)pOut;
-			pOut += sizeof(uint32);
-
-			*pData &= bitMaskLeft;
-			*pData |= curData << iBitsRight;
-
-			pData++; 
-
-			if ( iBitsLeft < kUint32Bits )
-			{
-				curData >>= iBitsLeft;
-				*pData &= bitMaskRight;
-				*pData |= curData;
-			}
-
-			nBitsLeft -= kUint32Bits;
-			m_iCurBit += kUint32Bits;
+			const uint64 curData = bitbuf::LoadLittleQWord( pIn );
+			bitbuf::StoreLittleQWord( pOut, carry | (curData << iShift) );
+			carry = curData >> (64 - iShift);
+
+			pIn += sizeof(uint64);
+			pOut += sizeof(uint64);
+			nBitsLeft -= 64;
+			m_iCurBit += 64;
 		}
+
+		*pOut = static_cast<byte>( (*pOut & ~lowMask) | carry );
 	}
 
 	// write remaining bytes
 	while ( nBitsLeft >= CHAR_BIT )
 	{
-		WriteUBitLong( *pOut, CHAR_BIT, false );
-		++pOut;
+		WriteUBitLong( *pIn, CHAR_BIT, false );
+		++pIn;
 		nBitsLeft -= CHAR_BIT;
 	}
 	
 	// write remaining bits
 	if ( nBitsLeft )
 	{
-		WriteUBitLong( *pOut, static_cast<int>(nBitsLeft), false );
+		WriteUBitLong( *pIn, static_cast<int>(nBitsLeft), false );
 	}
 
 	return !IsOverflowed();
@@ -520,16 +502,31 @@ bool bf_write::WriteBits(const void *pInData, intp nBits)
 
 bool bf_write::WriteBitsFromBuffer( bf_read *pIn, intp nBits )
 {
-	constexpr int kUint32Bits = CHAR_BIT * sizeof(uint32);
+	if ( nBits <= 0 )
+		return !IsOverflowed() && !pIn->IsOverflowed();
 
-	// This could be optimized a little by
-	while ( nBits > kUint32Bits )
+	// Byte aligned source, copy straight out of it.
+	if ( (pIn->m_iCurBit & 7) == 0 && pIn->GetNumBitsLeft() >= nBits )
 	{
-		WriteUBitLong( pIn->ReadUBitLong( kUint32Bits ), kUint32Bits );
-		nBits -= kUint32Bits;
+		const bool bOk = WriteBits( pIn->GetBasePointer() + (pIn->m_iCurBit >> 3), nBits );
+		pIn->SeekRelative( nBits );
+		return bOk && !pIn->IsOverflowed();
+	}
+
+	// Otherwise go through a small buffer so both sides move whole qwords.
+	alignas(uint64) byte temp[256];
+	constexpr intp kTempBits = sizeof(temp) * CHAR_BIT;
+
+	while ( nBits > 0 )
+	{
+		const intp nChunkBits = Min( nBits, kTempBits );
+		pIn->ReadBits( temp, nChunkBits );
+		if ( !WriteBits( temp, nChunkBits ) )
+			break;
+
+		nBits -= nChunkBits;
 	}
 
-	WriteUBitLong( pIn->ReadUBitLong( static_cast<int>(nBits) ), static_cast<int>(nBits) );
 	return !IsOverflowed() && !pIn->IsOverflowed();
 }
 
@@ -886,24 +883,39 @@ void bf_read::ReadBits(void *pOutData, intp nBits)
 
 	auto *pOut = static_cast<uint8 *>(pOutData);
 	intp nBitsLeft = nBits;
-	
-	// align output to dword boundary
-	while( ((size_t)pOut & 3) != 0 && nBitsLeft >= CHAR_BIT )
-	{
-		*pOut = (unsigned char)ReadUBitLong(CHAR_BIT);
-		++pOut;
-		nBitsLeft -= CHAR_BIT;
-	}
-
-	// dimhotepus: Fix reading int32 bits in LP64 model.
-	constexpr int kUint32Bits{CHAR_BIT * sizeof(uint32)};
 
-	// read dwords
-	while ( nBitsLeft >= kUint32Bits )
+	// Overruns take the byte loop below, which zero fills like ReadUBitLong.
+	if ( nBitsLeft <= GetNumBitsLeft() )
 	{
-		*((uint32*)pOut) = ReadUBitLong(kUint32Bits);
-		pOut += sizeof(uint32);
-		nBitsLeft -= kUint32Bits;
+		const unsigned char *pIn = m_pData + (m_iCurBit >> 3);
+		const unsigned iShift = m_iCurBit & 7;
+
+		if ( iShift == 0 )
+		{
+			// current bit is byte aligned, do block copy
+			const intp numbytes = nBitsLeft / CHAR_BIT;
+			const intp numbits = numbytes * CHAR_BIT;
+
+			memcpy( pOut, pIn, numbytes );
+			pOut += numbytes;
+			nBitsLeft -= numbits;
+			m_iCurBit += numbits;
+		}
+		else
+		{
+			// Every qword straddles nine source bytes.
+			while ( nBitsLeft >= 64 )
+			{
+				const uint64 lo = bitbuf::LoadLittleQWord( pIn );
+				const uint64 hi = pIn[sizeof(uint64)];
+				bitbuf::StoreLittleQWord( pOut, (lo >> iShift) | (hi << (64 - iShift)) );
+
+				pIn += sizeof(uint64);
+				pOut += sizeof(uint64);
+				nBitsLeft -= 64;
+				m_iCurBit += 64;
+			}
+		}
 	}
 
 	// read remaining bytes
@@ -0,0 +1,14 @@
+#!perl
+
+# flow datafiles/vvis_rooms.prt with both the scalar and the -simd vvis
+# kernels. vvis fails if their portal vis differs.
+
+print "Running vvis simd check\n";
+
+$output=`vvis -simdcheck datafiles/vvis_rooms 2>&1`;
+foreach $_ (split(/\n/, $output))
+  {
+	s/[\n\r]//g;
+	print "$_\n" if ( /^simdcheck:/ || /:=/ );
+  }
+print "vvis exit code $?\n";
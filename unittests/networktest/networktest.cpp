@@ -28,6 +28,9 @@
 IFileSystem *g_pFileSystem;
 INetworkSystem *g_pNetworkSystem;
 
+// splitpackettest.cpp
+bool RunSplitPacketTests();
+
 
 //-----------------------------------------------------------------------------
 // Purpose: Warning/Msg call back through this API
@@ -304,6 +307,10 @@ bool CTestNetworkMessage::Process()
 //-----------------------------------------------------------------------------
 int CNetworkTestApp::Main()
 {
+	// Offline tests first, no point in connecting if they fail
+	if ( !RunSplitPacketTests() )
+		return 0;
+
 	// Network messages must be registered before the server or client is started
 	g_pNetworkSystem->RegisterMessage( new CTestNetworkMessage() );
 
@@ -0,0 +1,229 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Split packet reassembly tests
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "net_splitpacket.h"
+#include "tier0/dbg.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#define SPLIT_TEST_CHECK( _exp ) \
+	if ( !( _exp ) ) \
+	{ \
+		Warning( "Split packet test failed: %s (%s:%d)\n", #_exp, __FILE__, __LINE__ ); \
+		return false; \
+	}
+
+static const int TEST_SPLIT_SIZE = 600;
+static const int TEST_MAX_PACKET = 8 * TEST_SPLIT_SIZE;
+static const int TEST_MAX_ENTRIES = 4;
+static const double TEST_STALE_TIME = 2.0;
+
+//-----------------------------------------------------------------------------
+// Fills a packet with a pattern that differs for every byte and source
+//-----------------------------------------------------------------------------
+static void FillPacket( byte *pData, int nSize, int nSeed )
+{
+	for ( int i = 0; i < nSize; ++i )
+	{
+		pData[i] = (byte)( i * 7 + ( i >> 8 ) + nSeed );
+	}
+}
+
+static CSplitPacketSlab::Result_t SendFragment( CSplitPacketSlab &slab, const netadr_t &from, int nSequence,
+	const byte *pPacket, int nPacketSize, int nNumber, double flTime, int nTruncate = 0 )
+{
+	const int nCount = ( nPacketSize + TEST_SPLIT_SIZE - 1 ) / TEST_SPLIT_SIZE;
+	const int nOffset = nNumber * TEST_SPLIT_SIZE;
+	int nSize = nPacketSize - nOffset;
+	if ( nSize > TEST_SPLIT_SIZE )
+		nSize = TEST_SPLIT_SIZE;
+
+	return slab.AddFragment( from, nSequence, nNumber, nCount, TEST_SPLIT_SIZE, pPacket + nOffset, nSize - nTruncate, flTime );
+}
+
+static bool CheckCompleted( const CSplitPacketSlab &slab, const byte *pPacket, int nPacketSize )
+{
+	SPLIT_TEST_CHECK( slab.GetCompletedData() != NULL );
+	SPLIT_TEST_CHECK( slab.GetCompletedSize() == nPacketSize );
+	SPLIT_TEST_CHECK( memcmp( slab.GetCompletedData(), pPacket, nPacketSize ) == 0 );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Fragments arrive in any order and land at their final offset
+//-----------------------------------------------------------------------------
+static bool TestOutOfOrder()
+{
+	CSplitPacketSlab slab( TEST_MAX_ENTRIES, TEST_MAX_PACKET, TEST_STALE_TIME );
+	netadr_t from( 0x7f000001, 27015 );
+
+	// 4 fragments, the last one short
+	byte packet[ 3 * TEST_SPLIT_SIZE + 100 ];
+	FillPacket( packet, sizeof( packet ), 1 );
+
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 10, packet, sizeof( packet ), 3, 0.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 10, packet, sizeof( packet ), 0, 0.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 10, packet, sizeof( packet ), 2, 0.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( slab.Count() == 1 );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 10, packet, sizeof( packet ), 1, 0.0 ) == CSplitPacketSlab::SPLIT_COMPLETE );
+	SPLIT_TEST_CHECK( CheckCompleted( slab, packet, sizeof( packet ) ) );
+	SPLIT_TEST_CHECK( slab.Count() == 0 );
+
+	// Two sources interleaved
+	netadr_t other( 0x0a000002, 27005 );
+	byte packet2[ 2 * TEST_SPLIT_SIZE ];
+	FillPacket( packet2, sizeof( packet2 ), 2 );
+
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 11, packet, sizeof( packet ), 1, 1.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( SendFragment( slab, other, 5, packet2, sizeof( packet2 ), 1, 1.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 11, packet, sizeof( packet ), 0, 1.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( SendFragment( slab, other, 5, packet2, sizeof( packet2 ), 0, 1.0 ) == CSplitPacketSlab::SPLIT_COMPLETE );
+	SPLIT_TEST_CHECK( CheckCompleted( slab, packet2, sizeof( packet2 ) ) );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 11, packet, sizeof( packet ), 3, 1.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( slab.GetCompletedData() == NULL );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 11, packet, sizeof( packet ), 2, 1.0 ) == CSplitPacketSlab::SPLIT_COMPLETE );
+	SPLIT_TEST_CHECK( CheckCompleted( slab, packet, sizeof( packet ) ) );
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Duplicates are ignored, a new sequence restarts the packet
+//-----------------------------------------------------------------------------
+static bool TestDuplicates()
+{
+	CSplitPacketSlab slab( TEST_MAX_ENTRIES, TEST_MAX_PACKET, TEST_STALE_TIME );
+	netadr_t from( 0x7f000001, 27015 );
+
+	byte packet[ 3 * TEST_SPLIT_SIZE ];
+	FillPacket( packet, sizeof( packet ), 3 );
+
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 1, packet, sizeof( packet ), 1, 0.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 1, packet, sizeof( packet ), 1, 0.0 ) == CSplitPacketSlab::SPLIT_DUPLICATE );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 1, packet, sizeof( packet ), 0, 0.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 1, packet, sizeof( packet ), 0, 0.0 ) == CSplitPacketSlab::SPLIT_DUPLICATE );
+
+	// Sequence 2 drops what we had of sequence 1
+	byte packet2[ 2 * TEST_SPLIT_SIZE + 1 ];
+	FillPacket( packet2, sizeof( packet2 ), 4 );
+
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 2, packet2, sizeof( packet2 ), 0, 0.5 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 2, packet2, sizeof( packet2 ), 1, 0.5 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( slab.Count() == 1 );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 2, packet2, sizeof( packet2 ), 2, 0.5 ) == CSplitPacketSlab::SPLIT_COMPLETE );
+	SPLIT_TEST_CHECK( CheckCompleted( slab, packet2, sizeof( packet2 ) ) );
+
+	// Late duplicate of a completed packet starts a new, never finished entry
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 2, packet2, sizeof( packet2 ), 2, 0.5 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( slab.Count() == 1 );
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Truncated, oversized and inconsistent fragments are rejected
+//-----------------------------------------------------------------------------
+static bool TestMalformed()
+{
+	CSplitPacketSlab slab( TEST_MAX_ENTRIES, TEST_MAX_PACKET, TEST_STALE_TIME );
+	netadr_t from( 0x7f000001, 27015 );
+
+	byte packet[ 3 * TEST_SPLIT_SIZE ];
+	FillPacket( packet, sizeof( packet ), 5 );
+
+	// Middle fragment cut short, then resent intact
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 1, packet, sizeof( packet ), 0, 0.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 1, packet, sizeof( packet ), 1, 0.0, 10 ) == CSplitPacketSlab::SPLIT_TRUNCATED );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 1, packet, sizeof( packet ), 1, 0.0, TEST_SPLIT_SIZE ) == CSplitPacketSlab::SPLIT_TRUNCATED );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 1, packet, sizeof( packet ), 1, 0.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( SendFragment( slab, from, 1, packet, sizeof( packet ), 2, 0.0 ) == CSplitPacketSlab::SPLIT_COMPLETE );
+	SPLIT_TEST_CHECK( CheckCompleted( slab, packet, sizeof( packet ) ) );
+
+	// Fragment larger than the split size, number out of range
+	SPLIT_TEST_CHECK( slab.AddFragment( from, 2, 0, 2, TEST_SPLIT_SIZE, packet, TEST_SPLIT_SIZE + 1, 0.0 ) == CSplitPacketSlab::SPLIT_INVALID );
+	SPLIT_TEST_CHECK( slab.AddFragment( from, 2, 2, 2, TEST_SPLIT_SIZE, packet, TEST_SPLIT_SIZE, 0.0 ) == CSplitPacketSlab::SPLIT_INVALID );
+	SPLIT_TEST_CHECK( slab.AddFragment( from, 2, 0, 0, TEST_SPLIT_SIZE, packet, TEST_SPLIT_SIZE, 0.0 ) == CSplitPacketSlab::SPLIT_INVALID );
+	SPLIT_TEST_CHECK( slab.AddFragment( from, 2, 0, CSplitPacketSlab::MAX_SPLITS + 1, TEST_SPLIT_SIZE, packet, TEST_SPLIT_SIZE, 0.0 ) == CSplitPacketSlab::SPLIT_INVALID );
+
+	// Would write past the end of the reassembly buffer
+	const int nTooMany = TEST_MAX_PACKET / TEST_SPLIT_SIZE + 1;
+	SPLIT_TEST_CHECK( slab.AddFragment( from, 2, nTooMany - 1, nTooMany, TEST_SPLIT_SIZE, packet, 1, 0.0 ) == CSplitPacketSlab::SPLIT_TOO_LARGE );
+	SPLIT_TEST_CHECK( slab.Count() == 0 );
+
+	// Split size changes mid packet, whole packet is dropped
+	SPLIT_TEST_CHECK( slab.AddFragment( from, 3, 0, 3, TEST_SPLIT_SIZE, packet, TEST_SPLIT_SIZE, 0.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( slab.AddFragment( from, 3, 1, 3, TEST_SPLIT_SIZE - 1, packet, TEST_SPLIT_SIZE - 1, 0.0 ) == CSplitPacketSlab::SPLIT_INCONSISTENT );
+	SPLIT_TEST_CHECK( slab.Count() == 0 );
+
+	// Same for the fragment count
+	SPLIT_TEST_CHECK( slab.AddFragment( from, 4, 0, 3, TEST_SPLIT_SIZE, packet, TEST_SPLIT_SIZE, 0.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( slab.AddFragment( from, 4, 1, 4, TEST_SPLIT_SIZE, packet, TEST_SPLIT_SIZE, 0.0 ) == CSplitPacketSlab::SPLIT_INCONSISTENT );
+	SPLIT_TEST_CHECK( slab.Count() == 0 );
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Stale entries are dropped, a full slab recycles the oldest entry
+//-----------------------------------------------------------------------------
+static bool TestEviction()
+{
+	CSplitPacketSlab slab( TEST_MAX_ENTRIES, TEST_MAX_PACKET, TEST_STALE_TIME );
+
+	byte packet[ 2 * TEST_SPLIT_SIZE ];
+	FillPacket( packet, sizeof( packet ), 6 );
+
+	for ( int i = 0; i < TEST_MAX_ENTRIES; ++i )
+	{
+		netadr_t from( 0x0a000001 + i, 27005 );
+		SPLIT_TEST_CHECK( SendFragment( slab, from, 1, packet, sizeof( packet ), 0, i * 0.5 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	}
+	SPLIT_TEST_CHECK( slab.Count() == TEST_MAX_ENTRIES );
+
+	// Touch the first source, so the second one is now the oldest
+	netadr_t first( 0x0a000001, 27005 );
+	SPLIT_TEST_CHECK( SendFragment( slab, first, 1, packet, sizeof( packet ), 0, 2.0 ) == CSplitPacketSlab::SPLIT_DUPLICATE );
+
+	netadr_t extra( 0x0b000001, 27005 );
+	SPLIT_TEST_CHECK( SendFragment( slab, extra, 1, packet, sizeof( packet ), 0, 2.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+	SPLIT_TEST_CHECK( slab.Count() == TEST_MAX_ENTRIES );
+
+	// Second source was recycled, its next fragment alone can't complete the packet.
+	// Restarting it recycles the third source.
+	netadr_t second( 0x0a000002, 27005 );
+	SPLIT_TEST_CHECK( SendFragment( slab, second, 1, packet, sizeof( packet ), 1, 2.0 ) == CSplitPacketSlab::SPLIT_INCOMPLETE );
+
+	// First source survived
+	SPLIT_TEST_CHECK( SendFragment( slab, first, 1, packet, sizeof( packet ), 1, 2.0 ) == CSplitPacketSlab::SPLIT_COMPLETE );
+	SPLIT_TEST_CHECK( CheckCompleted( slab, packet, sizeof( packet ) ) );
+
+	// Fourth was last seen at 1.5, the rest at 2.0
+	slab.DiscardStale( 3.0 );
+	SPLIT_TEST_CHECK( slab.Count() == 3 );
+	slab.DiscardStale( 3.5 );
+	SPLIT_TEST_CHECK( slab.Count() == 2 );
+	slab.DiscardStale( 4.0 );
+	SPLIT_TEST_CHECK( slab.Count() == 0 );
+
+	slab.Purge();
+	SPLIT_TEST_CHECK( slab.Count() == 0 );
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Runs all split packet tests, returns false on the first failure
+//-----------------------------------------------------------------------------
+bool RunSplitPacketTests()
+{
+	if ( !TestOutOfOrder() || !TestDuplicates() || !TestMalformed() || !TestEviction() )
+		return false;
+
+	Msg( "Split packet tests passed.\n" );
+	return true;
+}
@@ -9,24 +9,10 @@
 #include "raytrace.h"
 #include "bitmap/tgawriter.h"
 
-int main(int argc, char **argv) {
-  InitCommandLineProgram(argc, argv);
-
-  if (argc != 5) {
-    fprintf(stderr, "format is 'rt_test src_image dest_image xsize ysize'\n");
-    return 1;
-  }
-
-  ReportProgress("reading src texture", 0, 0);
-
-  FloatBitMap_t src_texture(argv[1]);
-
-  int xsize = atoi(argv[3]);
-  int ysize = atoi(argv[4]);
-
-  // render a simple scene of a terrain, using a bitmap for color data and its
-  // alpha channel for the height
-  RayTracingEnvironment rt_Env;
+// render a simple scene of a terrain, using a bitmap for color data and its
+// alpha channel for the height. Returns the number of triangles added.
+static int AddTerrain(RayTracingEnvironment &rt_Env,
+                      FloatBitMap_t &src_texture) {
   int id = 1;
 
   float flXScale = (1.0 / (src_texture.Width - 1));
@@ -62,6 +48,151 @@ int main(int argc, char **argv) {
   rt_Env.AddTriangle(id++, Vector(0, 0, -.2), Vector(.2, 0, .2),
                      Vector(-.2, 0, .2), Vector(0, 0, 1));
 
+  return id;
+}
+
+// Traces a grid of parallel rays down onto the terrain, 4 or 8 at a time, and
+// returns the rays traced per second.
+static double TraceRate(RayTracingEnvironment &rt_Env, bool bEightWide) {
+  const int nGrid = 1024;
+  const float flTMin[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  const float flTMax[8] = {1.0e30f, 1.0e30f, 1.0e30f, 1.0e30f,
+                           1.0e30f, 1.0e30f, 1.0e30f, 1.0e30f};
+
+  double stime = Plat_FloatTime();
+  for (int y = 0; y < nGrid; y++)
+    for (int x = 0; x < nGrid; x += 8) {
+      EightRays rays;
+      for (int i = 0; i < 8; i++)
+        rays.SetRay(i,
+                    Vector(2.0 * ((x + i) * (1.0 / (nGrid - 1)) - 0.5), 2,
+                           2.0 * (y * (1.0 / (nGrid - 1)) - 0.5)),
+                    Vector(0.1, -1, 0.2));
+
+      if (bEightWide) {
+        RayTracingResult8 rslt;
+        rt_Env.Trace8Rays(rays, flTMin, flTMax, &rslt);
+      } else {
+        for (int h = 0; h < 2; h++) {
+          RayTracingResult rslt;
+          rt_Env.Trace4Rays(rays.Half(h), Four_Zeros, ReplicateX4(1.0e30f),
+                            &rslt);
+        }
+      }
+    }
+  return (nGrid * nGrid) / (Plat_FloatTime() - stime);
+}
+
+// Traces 8 rays 8 wide and each half 4 wide, and returns how many of the 8
+// results differ.
+static int CompareEightWide(RayTracingEnvironment &rt_Env,
+                            const EightRays &rays) {
+  const float flTMin[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  const float flTMax[8] = {1.0e30f, 1.0e30f, 1.0e30f, 1.0e30f,
+                           1.0e30f, 1.0e30f, 1.0e30f, 1.0e30f};
+
+  RayTracingResult8 rslt8;
+  rt_Env.Trace8Rays(rays, flTMin, flTMax, &rslt8);
+
+  int nMismatches = 0;
+  for (int h = 0; h < 2; h++) {
+    RayTracingResult rslt;
+    rt_Env.Trace4Rays(rays.Half(h), Four_Zeros, ReplicateX4(1.0e30f), &rslt);
+    for (int i = 0; i < 4; i++) {
+      const int j = 4 * h + i;
+      if (rslt8.HitIds[j] != rslt.HitIds[i]) {
+        nMismatches++;
+      } else if (rslt.HitIds[i] != -1 &&
+                 (rslt8.HitDistance[j] != SubFloat(rslt.HitDistance, i) ||
+                  rslt8.surface_normal[0][j] != rslt.surface_normal.X(i) ||
+                  rslt8.surface_normal[1][j] != rslt.surface_normal.Y(i) ||
+                  rslt8.surface_normal[2][j] != rslt.surface_normal.Z(i))) {
+        nMismatches++;
+      }
+    }
+  }
+  return nMismatches;
+}
+
+// Returns how many rays Trace8Rays and Trace4Rays disagree on. The rays go
+// straight down through every vertex, edge midpoint and quad center of the
+// terrain, so many of them land exactly on an edge two triangles share, and
+// then slanted across it like TraceRate's.
+static int CountEightWideMismatches(RayTracingEnvironment &rt_Env,
+                                    FloatBitMap_t &src_texture) {
+  const int nXSamples = 2 * (src_texture.Width - 1) + 1;
+  const int nZSamples = 2 * (src_texture.Height - 1) + 1;
+  const float flXScale = 0.5 / (src_texture.Width - 1);
+  const float flZScale = 0.5 / (src_texture.Height - 1);
+
+  int nMismatches = 0;
+  for (int z = 0; z < nZSamples; z++)
+    for (int x = 0; x < nXSamples; x += 8) {
+      EightRays rays;
+      for (int i = 0; i < 8; i++) {
+        const int xs = min(x + i, nXSamples - 1);
+        rays.SetRay(i,
+                    Vector(2.0 * (xs * flXScale - 0.5), 2,
+                           -2.0 * (z * flZScale - 0.5)),
+                    Vector(0, -1, 0));
+      }
+      nMismatches += CompareEightWide(rt_Env, rays);
+    }
+
+  const int nGrid = 1024;
+  for (int y = 0; y < nGrid; y++)
+    for (int x = 0; x < nGrid; x += 8) {
+      EightRays rays;
+      for (int i = 0; i < 8; i++)
+        rays.SetRay(i,
+                    Vector(2.0 * ((x + i) * (1.0 / (nGrid - 1)) - 0.5), 2,
+                           2.0 * (y * (1.0 / (nGrid - 1)) - 0.5)),
+                    Vector(0.1, -1, 0.2));
+      nMismatches += CompareEightWide(rt_Env, rays);
+    }
+
+  return nMismatches;
+}
+
+// Builds the scene with one of the acceleration structures and prints how long
+// that took and how fast it traces, as metrics the file comparison test masks.
+// nThreads of 0 uses every cpu.
+static void BenchmarkAccelerationStructure(FloatBitMap_t &src_texture,
+                                           const char *pszName, int nThreads,
+                                           bool bBVH) {
+  RayTracingEnvironment rt_Env;
+  AddTerrain(rt_Env, src_texture);
+  if (bBVH) rt_Env.Flags |= RTE_FLAGS_USE_BVH;
+
+  double stime = Plat_FloatTime();
+  rt_Env.SetupAccelerationStructure(nThreads);
+  double flBuildTime = Plat_FloatTime() - stime;
+
+  printf("%s build time := %f\n", pszName, flBuildTime);
+  printf("%s rays per second 4 wide := %f\n", pszName,
+         TraceRate(rt_Env, false));
+  printf("%s rays per second 8 wide := %f\n", pszName,
+         TraceRate(rt_Env, true));
+}
+
+int main(int argc, char **argv) {
+  InitCommandLineProgram(argc, argv);
+
+  if (argc != 5) {
+    fprintf(stderr, "format is 'rt_test src_image dest_image xsize ysize'\n");
+    return 1;
+  }
+
+  ReportProgress("reading src texture", 0, 0);
+
+  FloatBitMap_t src_texture(argv[1]);
+
+  int xsize = atoi(argv[3]);
+  int ysize = atoi(argv[4]);
+
+  RayTracingEnvironment rt_Env;
+  int id = AddTerrain(rt_Env, src_texture);
+
   printf("n triangles %d\n", id);
   ReportProgress("Creating kd-tree", 0, 0);
 
@@ -93,5 +224,16 @@ int main(int argc, char **argv) {
 
   MemAlloc_FreeAligned(buf);
 
+  const int nMismatches = CountEightWideMismatches(rt_Env, src_texture);
+  if (nMismatches) {
+    printf("8 wide trace differs from 4 wide on %d rays\n", nMismatches);
+    return 1;
+  }
+  printf("8 wide trace matches 4 wide\n");
+
+  BenchmarkAccelerationStructure(src_texture, "kd-tree 1 thread", 1, false);
+  BenchmarkAccelerationStructure(src_texture, "kd-tree all threads", 0, false);
+  BenchmarkAccelerationStructure(src_texture, "bvh all threads", 0, true);
+
   return 0;
 }
@@ -0,0 +1,358 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit test program for bf_read / bf_write, and a throughput
+//			comparison against the previous dword at a time implementation
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "unitlib/unitlib.h"
+#include "tier0/platform.h"
+#include "tier1/bitbuf.h"
+#include "tier1/utlvector.h"
+
+
+DEFINE_TESTSUITE( BitBufTestSuite )
+
+namespace
+{
+
+//-----------------------------------------------------------------------------
+// The dword at a time ReadUBitLong / WriteUBitLong / WriteBitsFromBuffer
+// bitbuf used before the qword paths, kept as the baseline.
+//-----------------------------------------------------------------------------
+class CDWordBitReader
+{
+public:
+	CDWordBitReader( const void *pData, intp nBytes )
+		: m_pData( static_cast<const uint32 *>(pData) ), m_nDataBits( nBytes * CHAR_BIT ), m_iCurBit( 0 )
+	{
+	}
+
+	uint32 ReadUBitLong( int numbits )
+	{
+		if ( m_nDataBits - m_iCurBit < numbits )
+		{
+			m_iCurBit = m_nDataBits;
+			return 0;
+		}
+
+		unsigned int iStartBit = m_iCurBit & 31u;
+		intp iLastBit = m_iCurBit + numbits - 1;
+		size_t iWordOffset1 = m_iCurBit >> 5;
+		size_t iWordOffset2 = iLastBit >> 5;
+		m_iCurBit += numbits;
+
+		unsigned bitmask = numbits == 32 ? ~0u : (1u << numbits) - 1;
+		unsigned dw1 = LoadLittleDWord( m_pData, iWordOffset1 ) >> iStartBit;
+		unsigned dw2 = LoadLittleDWord( m_pData, iWordOffset2 ) << (32 - iStartBit);
+
+		return (dw1 | dw2) & bitmask;
+	}
+
+	intp GetNumBitsLeft() const { return m_nDataBits - m_iCurBit; }
+
+private:
+	const uint32	*m_pData;
+	intp			m_nDataBits;
+	intp			m_iCurBit;
+};
+
+class CDWordBitWriter
+{
+public:
+	CDWordBitWriter( void *pData, intp nBytes )
+		: m_pData( static_cast<uint32 *>(pData) ), m_nDataBits( nBytes * CHAR_BIT ), m_iCurBit( 0 )
+	{
+	}
+
+	void WriteUBitLong( uint32 curData, int numbits )
+	{
+		if ( m_nDataBits - m_iCurBit < numbits )
+		{
+			m_iCurBit = m_nDataBits;
+			return;
+		}
+
+		intp iCurBitMasked = m_iCurBit & 31;
+		intp iDWord = m_iCurBit >> 5;
+		m_iCurBit += numbits;
+
+		uint32 *pOut = &m_pData[iDWord];
+
+		curData = (curData << iCurBitMasked) | (curData >> (32 - iCurBitMasked));
+
+		unsigned temp = 1 << (numbits-1);
+		unsigned mask1 = (temp*2-1) << iCurBitMasked;
+		unsigned mask2 = (temp-1) >> (31 - iCurBitMasked);
+
+		int i = mask2 & 1;
+		unsigned dword1 = LoadLittleDWord( pOut, 0 );
+		unsigned dword2 = LoadLittleDWord( pOut, i );
+
+		dword1 ^= ( mask1 & ( curData ^ dword1 ) );
+		dword2 ^= ( mask2 & ( curData ^ dword2 ) );
+
+		StoreLittleDWord( pOut, i, dword2 );
+		StoreLittleDWord( pOut, 0, dword1 );
+	}
+
+	void WriteBitsFromBuffer( CDWordBitReader &in, intp nBits )
+	{
+		while ( nBits > 32 )
+		{
+			WriteUBitLong( in.ReadUBitLong( 32 ), 32 );
+			nBits -= 32;
+		}
+		WriteUBitLong( in.ReadUBitLong( static_cast<int>(nBits) ), static_cast<int>(nBits) );
+	}
+
+	intp GetNumBitsWritten() const { return m_iCurBit; }
+
+private:
+	uint32	*m_pData;
+	intp	m_nDataBits;
+	intp	m_iCurBit;
+};
+
+// Small deterministic generator so every run sees the same packets.
+class CTestRandom
+{
+public:
+	explicit CTestRandom( uint32 nSeed ) : m_nState( nSeed ) {}
+
+	uint32 Next()
+	{
+		m_nState ^= m_nState << 13;
+		m_nState ^= m_nState >> 17;
+		m_nState ^= m_nState << 5;
+		return m_nState;
+	}
+
+private:
+	uint32	m_nState;
+};
+
+//-----------------------------------------------------------------------------
+// Field widths in the proportions an svc_PacketEntities stream has them:
+// mostly one bit flags and short prop indices, then ints, 32 bit floats and
+// the odd full dword of a string.
+//-----------------------------------------------------------------------------
+struct PacketField_t
+{
+	uint32	m_nValue;
+	int		m_nBits;
+};
+
+void BuildPacketFields( CUtlVector<PacketField_t> &fields, int nFields )
+{
+	static constexpr int s_FieldBits[] = { 1, 1, 1, 1, 2, 3, 5, 6, 7, 8, 10, 11, 12, 16, 17, 20, 32, 32 };
+
+	CTestRandom random( 0x5eed1234 );
+	fields.SetCount( nFields );
+	for ( auto &field : fields )
+	{
+		field.m_nBits = s_FieldBits[ random.Next() % std::size( s_FieldBits ) ];
+		field.m_nValue = random.Next() & ( field.m_nBits == 32 ? ~0u : ( 1u << field.m_nBits ) - 1 );
+	}
+}
+
+// Buffers are a little larger than the packets so both writers stay in range.
+constexpr intp kPacketBytes = 1 << 20;
+constexpr intp kBufferBytes = kPacketBytes + 64;
+
+}  // namespace
+
+
+DEFINE_TESTCASE( BitBufTestRoundTrip, BitBufTestSuite )
+{
+	Msg( "bf_read / bf_write round trip test...\n" );
+
+	CUtlVector<PacketField_t> fields;
+	BuildPacketFields( fields, 100000 );
+
+	// Size the buffers to the fields so the last writes land in the final
+	// bytes, where the qword paths fall back to dwords.
+	intp nFieldBits = 0;
+	for ( const auto &field : fields )
+	{
+		nFieldBits += field.m_nBits;
+	}
+	const intp nDataBytes = ( BitByte( nFieldBits ) + 3 ) & ~3;
+
+	CUtlVector<uint32> newData, oldData;
+	newData.SetCount( nDataBytes / sizeof(uint32) );
+	oldData.SetCount( nDataBytes / sizeof(uint32) );
+	memset( newData.Base(), 0, nDataBytes );
+	memset( oldData.Base(), 0, nDataBytes );
+
+	// Both writers must produce the same bits.
+	bf_write write( "BitBufTestRoundTrip", newData.Base(), nDataBytes );
+	CDWordBitWriter oldWrite( oldData.Base(), nDataBytes );
+	for ( const auto &field : fields )
+	{
+		write.WriteUBitLong( field.m_nValue, field.m_nBits );
+		oldWrite.WriteUBitLong( field.m_nValue, field.m_nBits );
+	}
+	Shipping_Assert( !write.IsOverflowed() );
+	Shipping_Assert( write.GetNumBitsWritten() == oldWrite.GetNumBitsWritten() );
+	Shipping_Assert( !memcmp( newData.Base(), oldData.Base(), nDataBytes ) );
+
+	bf_read read( "BitBufTestRoundTrip", newData.Base(), write.GetNumBytesWritten() );
+	for ( const auto &field : fields )
+	{
+		Shipping_Assert( read.ReadUBitLong( field.m_nBits ) == field.m_nValue );
+	}
+	Shipping_Assert( !read.IsOverflowed() );
+
+	// Bulk copies at every source and destination bit alignment.
+	for ( int iSrcBit = 0; iSrcBit < 8; ++iSrcBit )
+	{
+		for ( int iDstBit = 0; iDstBit < 8; ++iDstBit )
+		{
+			for ( intp nBits : { 0, 5, 63, 64, 65, 1000, 4099 } )
+			{
+				alignas(uint64) byte copy[1024];
+				memset( copy, 0xA5, sizeof(copy) );
+
+				bf_read src( "BitBufTestRoundTrip", newData.Base(), write.GetNumBytesWritten() );
+				src.Seek( iSrcBit );
+
+				bf_write dst( "BitBufTestRoundTrip", copy );
+				dst.SeekToBit( iDstBit );
+				Shipping_Assert( dst.WriteBitsFromBuffer( &src, nBits ) );
+				Shipping_Assert( dst.GetNumBitsWritten() == iDstBit + nBits );
+				Shipping_Assert( src.GetNumBitsRead() == iSrcBit + nBits );
+
+				// Bits before and after the copy are untouched.
+				bf_read check( "BitBufTestRoundTrip", copy );
+				for ( int i = 0; i < iDstBit; ++i )
+				{
+					Shipping_Assert( check.ReadOneBit() == ( ( 0xA5 >> i ) & 1 ) );
+				}
+
+				src.Seek( iSrcBit );
+				for ( intp i = 0; i < nBits; ++i )
+				{
+					Shipping_Assert( src.ReadOneBit() == check.ReadOneBit() );
+				}
+
+				bf_read tail( "BitBufTestRoundTrip", copy );
+				tail.Seek( iDstBit + nBits );
+				const intp nTailBits = Min( static_cast<intp>( 8 - ( ( iDstBit + nBits ) & 7 ) ) & 7, tail.GetNumBitsLeft() );
+				for ( intp i = 0; i < nTailBits; ++i )
+				{
+					Shipping_Assert( tail.ReadOneBit() == ( ( 0xA5 >> ( ( iDstBit + nBits + i ) & 7 ) ) & 1 ) );
+				}
+
+				// ReadBits must agree with the bit by bit view.
+				alignas(uint64) byte bits[1024] = {};
+				src.Seek( iSrcBit );
+				src.ReadBits( bits, nBits );
+				Shipping_Assert( !src.IsOverflowed() );
+				bf_read bitsRead( "BitBufTestRoundTrip", bits );
+				src.Seek( iSrcBit );
+				for ( intp i = 0; i < nBits; ++i )
+				{
+					Shipping_Assert( src.ReadOneBit() == bitsRead.ReadOneBit() );
+				}
+			}
+		}
+	}
+}
+
+
+DEFINE_TESTCASE( BitBufTestThroughput, BitBufTestSuite )
+{
+	Msg( "bf_read / bf_write throughput, qword vs dword at a time...\n" );
+
+	CUtlVector<PacketField_t> fields;
+	BuildPacketFields( fields, 400000 );
+
+	CUtlVector<uint32> packet, copy;
+	packet.SetCount( kBufferBytes / sizeof(uint32) );
+	copy.SetCount( kBufferBytes / sizeof(uint32) );
+	memset( packet.Base(), 0, kBufferBytes );
+	memset( copy.Base(), 0, kBufferBytes );
+
+	constexpr int kPasses = 20;
+	uint32 nNewSum = 0, nOldSum = 0;
+
+	double flStart = Plat_FloatTime();
+	intp nPacketBits = 0;
+	for ( int iPass = 0; iPass < kPasses; ++iPass )
+	{
+		bf_write write( "BitBufTestThroughput", packet.Base(), kPacketBytes );
+		for ( const auto &field : fields )
+		{
+			write.WriteUBitLong( field.m_nValue, field.m_nBits );
+		}
+		nPacketBits = write.GetNumBitsWritten();
+	}
+	const double flNewWrite = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	for ( int iPass = 0; iPass < kPasses; ++iPass )
+	{
+		CDWordBitWriter write( copy.Base(), kPacketBytes );
+		for ( const auto &field : fields )
+		{
+			write.WriteUBitLong( field.m_nValue, field.m_nBits );
+		}
+	}
+	const double flOldWrite = Plat_FloatTime() - flStart;
+	Shipping_Assert( !memcmp( packet.Base(), copy.Base(), kBufferBytes ) );
+
+	flStart = Plat_FloatTime();
+	for ( int iPass = 0; iPass < kPasses; ++iPass )
+	{
+		bf_read read( "BitBufTestThroughput", packet.Base(), kPacketBytes );
+		for ( const auto &field : fields )
+		{
+			nNewSum += read.ReadUBitLong( field.m_nBits );
+		}
+	}
+	const double flNewRead = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	for ( int iPass = 0; iPass < kPasses; ++iPass )
+	{
+		CDWordBitReader read( packet.Base(), kPacketBytes );
+		for ( const auto &field : fields )
+		{
+			nOldSum += read.ReadUBitLong( field.m_nBits );
+		}
+	}
+	const double flOldRead = Plat_FloatTime() - flStart;
+	Shipping_Assert( nNewSum == nOldSum );
+
+	// Unaligned bulk copy, like relaying a delta out of one packet into another.
+	const intp nCopyBits = nPacketBits - 16;
+
+	flStart = Plat_FloatTime();
+	for ( int iPass = 0; iPass < kPasses; ++iPass )
+	{
+		bf_read read( "BitBufTestThroughput", packet.Base(), kPacketBytes );
+		read.Seek( 3 );
+		bf_write write( "BitBufTestThroughput", copy.Base(), kPacketBytes );
+		write.SeekToBit( 5 );
+		write.WriteBitsFromBuffer( &read, nCopyBits );
+	}
+	const double flNewCopy = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	for ( int iPass = 0; iPass < kPasses; ++iPass )
+	{
+		CDWordBitReader read( packet.Base(), kPacketBytes );
+		(void)read.ReadUBitLong( 3 );
+		CDWordBitWriter write( copy.Base(), kPacketBytes );
+		write.WriteUBitLong( 0, 5 );
+		write.WriteBitsFromBuffer( read, nCopyBits );
+	}
+	const double flOldCopy = Plat_FloatTime() - flStart;
+
+	const double flMegabytes = kPasses * ( nPacketBits / 8.0 ) / ( 1024.0 * 1024.0 );
+	Msg( "  WriteUBitLong:       %7.1f MB/s (dword %7.1f MB/s)\n", flMegabytes / flNewWrite, flMegabytes / flOldWrite );
+	Msg( "  ReadUBitLong:        %7.1f MB/s (dword %7.1f MB/s)\n", flMegabytes / flNewRead, flMegabytes / flOldRead );
+	Msg( "  WriteBitsFromBuffer: %7.1f MB/s (dword %7.1f MB/s)\n", flMegabytes / flNewCopy, flMegabytes / flOldCopy );
+}
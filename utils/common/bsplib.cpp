@@ -49,6 +49,19 @@
 #include "lzma/lzma.h"
 #include "posix_file_stream.h"
 
+#ifdef _WIN32
+#include "winlite.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef MPI
+#include "vmpi.h"
+#endif
+
 #include <memory>
 
 #include "tier0/memdbgon.h"
@@ -1230,13 +1243,12 @@ void CGameLump::ParseGameLump( dheader_t* pHeader )
 
 	g_Lumps.bLumpParsed[LUMP_GAME_LUMP] = true;
 
-	int length = pHeader->lumps[LUMP_GAME_LUMP].filelen;
-	int ofs = pHeader->lumps[LUMP_GAME_LUMP].fileofs;
+	int length = BSPLumpSize( pHeader, LUMP_GAME_LUMP );
 	
 	if (length > 0)
 	{
 		// Read dictionary...
-		dgamelumpheader_t* pGameLumpHeader = (dgamelumpheader_t*)((byte *)pHeader + ofs);
+		dgamelumpheader_t* pGameLumpHeader = (dgamelumpheader_t*)GetBSPLump( pHeader, LUMP_GAME_LUMP );
 		if ( g_bSwapOnLoad )
 		{
 			g_Swap.SwapFieldsToTargetEndian( pGameLumpHeader );
@@ -1250,14 +1262,42 @@ void CGameLump::ParseGameLump( dheader_t* pHeader )
 			}
 
 			int filelen = pGameLump[i].filelen;
-			GameLumpHandle_t lump = g_GameLumps.CreateGameLump( pGameLump[i].id, filelen, pGameLump[i].flags, pGameLump[i].version );
+			unsigned short flags = pGameLump[i].flags;
+
+			// RepackBSP ends a compressed dictionary with an empty lump
+			if ( !pGameLump[i].id && !filelen )
+				continue;
+
+			// compressed game lumps are compressed one by one, filelen is their uncompressed size
+			byte *pSrc = (byte *)pHeader + pGameLump[i].fileofs;
+			std::unique_ptr<byte[]> decompressed;
+			if ( filelen && ( flags & GAMELUMPFLAG_COMPRESSED ) )
+			{
+				if ( !CLZMA::IsCompressed( pSrc ) || CLZMA::GetActualSize( pSrc ) != static_cast<unsigned>( filelen ) )
+				{
+					Error( "Unsupported BSP: Unrecognized compressed game lump %d.\n", pGameLump[i].id );
+				}
+
+				decompressed = std::make_unique<byte[]>( filelen );
+				const size_t outSize = CLZMA::Uncompress( pSrc, decompressed.get(), filelen );
+				if ( outSize != static_cast<size_t>( filelen ) )
+				{
+					Error( "Decompressed size %zu of game lump %d differs from header %d one, BSP may be corrupt.\n",
+						outSize, pGameLump[i].id, filelen );
+				}
+
+				pSrc = decompressed.get();
+				flags &= ~GAMELUMPFLAG_COMPRESSED;
+			}
+
+			GameLumpHandle_t lump = g_GameLumps.CreateGameLump( pGameLump[i].id, filelen, flags, pGameLump[i].version );
 			if ( g_bSwapOnLoad )
 			{
-				SwapGameLump( pGameLump[i].id, pGameLump[i].version, (byte*)g_GameLumps.GetGameLump(lump), (byte *)pHeader + pGameLump[i].fileofs, filelen );
+				SwapGameLump( pGameLump[i].id, pGameLump[i].version, (byte*)g_GameLumps.GetGameLump(lump), pSrc, filelen );
 			}
 			else
 			{
-				memcpy( g_GameLumps.GetGameLump(lump), (byte *)pHeader + pGameLump[i].fileofs, filelen );
+				memcpy( g_GameLumps.GetGameLump(lump), pSrc, filelen );
 			}
 		}
 	}
@@ -1415,14 +1455,11 @@ static void LoadOcclusionLump( dheader_t *dheader )
 	g_OccluderPolyData.RemoveAll();
 	g_OccluderVertexIndices.RemoveAll();
 
-	int		length, ofs;
-
 	g_Lumps.bLumpParsed[LUMP_OCCLUSION] = true;
 
-	length = dheader->lumps[LUMP_OCCLUSION].filelen;
-	ofs = dheader->lumps[LUMP_OCCLUSION].fileofs;
+	int length = BSPLumpSize( dheader, LUMP_OCCLUSION );
 	
-	CUtlBuffer buf( (byte *)dheader + ofs, length, CUtlBuffer::READ_ONLY );
+	CUtlBuffer buf( GetBSPLump( dheader, LUMP_OCCLUSION ), length, CUtlBuffer::READ_ONLY );
 	buf.ActivateByteSwapping( g_bSwapOnLoad );
 	int version = dheader->lumps[LUMP_OCCLUSION].version;
 	switch ( version )
@@ -1863,8 +1900,8 @@ int CopyLumpInternal( dheader_t *header, int fieldType, int lump, T *dest, int f
 
 	// Vectors are passed in as floats
 	int fieldSize = ( fieldType == FIELD_VECTOR ) ? sizeof(Vector) : sizeof(T);
-	unsigned int length = header->lumps[lump].filelen;
-	unsigned int ofs = header->lumps[lump].fileofs;
+	unsigned int length = BSPLumpSize( header, lump );
+	byte *pLump = GetBSPLump( header, lump );
 
 	// count must be of the integral type
 	unsigned int count = length / sizeof(T);
@@ -1876,27 +1913,27 @@ int CopyLumpInternal( dheader_t *header, int fieldType, int lump, T *dest, int f
 		switch( lump )
 		{
 		case LUMP_VISIBILITY:
-			SwapVisibilityLump( (byte*)dest, ((byte*)header + ofs), count );
+			SwapVisibilityLump( (byte*)dest, pLump, count );
 			break;
 		
 		case LUMP_PHYSCOLLIDE:
 			// SwapPhyscollideLump may change size
-			SwapPhyscollideLump( (byte*)dest, ((byte*)header + ofs), count );
+			SwapPhyscollideLump( (byte*)dest, pLump, count );
 			length = count;
 			break;
 
 		case LUMP_PHYSDISP:
-			SwapPhysdispLump( (byte*)dest, ((byte*)header + ofs), count );
+			SwapPhysdispLump( (byte*)dest, pLump, count );
 			break;
 
 		default:
-			g_Swap.SwapBufferToTargetEndian( dest, (T*)((byte*)header + ofs), count );
+			g_Swap.SwapBufferToTargetEndian( dest, (T*)pLump, count );
 			break;
 		}
 	}
-	else
+	else if ( length )
 	{
-		memcpy( dest, (byte*)header + ofs, length );
+		memcpy( dest, pLump, length );
 	}
 
 	// Return actual count of elements
@@ -1913,7 +1950,7 @@ template< class T >
 void CopyLump( dheader_t *header, int fieldType, int lump, CUtlVector<T> &dest, int forceVersion = -1 )
 {
 	Assert( fieldType != FIELD_VECTOR ); // TODO: Support this if necessary
-	dest.SetSize( header->lumps[lump].filelen / sizeof(T) );
+	dest.SetSize( BSPLumpSize( header, lump ) / sizeof(T) );
 	CopyLumpInternal( header, fieldType, lump, dest.Base(), forceVersion );
 }
 
@@ -1924,14 +1961,14 @@ void CopyOptionalLump( dheader_t* header, int fieldType, int lump, CUtlVector<T>
 	if ( !HasLump( header, lump ) )
 		return;
 
-	dest.SetSize( header->lumps[lump].filelen / sizeof(T) );
+	dest.SetSize( BSPLumpSize( header, lump ) / sizeof(T) );
 	CopyLumpInternal( header, fieldType, lump, dest.Base(), forceVersion );
 }
 
 template< class T >
 int CopyVariableLump( dheader_t* header, int fieldType, int lump, void **dest, int forceVersion = -1 )
 {
-	int length = header->lumps[lump].filelen;
+	int length = BSPLumpSize( header, lump );
 	*dest = malloc( length );
 
 	return CopyLumpInternal<T>( header, fieldType, lump, static_cast<T*>(*dest), forceVersion );
@@ -1945,19 +1982,19 @@ int CopyLumpInternal( dheader_t* header, int lump, T *dest, int forceVersion )
 {
 	g_Lumps.bLumpParsed[lump] = true;
 
-	unsigned int length = header->lumps[lump].filelen;
-	unsigned int ofs = header->lumps[lump].fileofs;
+	unsigned int length = BSPLumpSize( header, lump );
+	byte *pLump = GetBSPLump( header, lump );
 	unsigned int count = length / sizeof(T);
 	
 	ValidateLump( header, lump, length, sizeof(T), forceVersion );
 
 	if ( g_bSwapOnLoad )
 	{
-		g_Swap.SwapFieldsToTargetEndian( dest, (T*)((byte*)header + ofs), count );
+		g_Swap.SwapFieldsToTargetEndian( dest, (T*)pLump, count );
 	}
-	else
+	else if ( length )
 	{
-		memcpy( dest, (byte*)header + ofs, length );
+		memcpy( dest, pLump, length );
 	}
 
 	return count;
@@ -1972,7 +2009,7 @@ int CopyLump( dheader_t *header, int lump, T *dest, int forceVersion = -1 )
 template< class T >
 void CopyLump( dheader_t *header, int lump, CUtlVector<T> &dest, int forceVersion = -1 )
 {
-	dest.SetSize( header->lumps[lump].filelen / sizeof(T) );
+	dest.SetSize( BSPLumpSize( header, lump ) / sizeof(T) );
 	CopyLumpInternal( header, lump, dest.Base(), forceVersion );
 }
 
@@ -1983,14 +2020,14 @@ void CopyOptionalLump( dheader_t *header, int lump, CUtlVector<T> &dest, int for
 	if ( !HasLump( header, lump ) )
 		return;
 
-	dest.SetSize( header->lumps[lump].filelen / sizeof(T) );
+	dest.SetSize( BSPLumpSize( header, lump ) / sizeof(T) );
 	CopyLumpInternal( header, lump, dest.Base(), forceVersion );
 }
 
 template< class T >
 int CopyVariableLump( dheader_t *header, int lump, void **dest, int forceVersion = -1 )
 {
-	int length = header->lumps[lump].filelen;
+	int length = BSPLumpSize( header, lump );
 	*dest = malloc( length );
 
 	return CopyLumpInternal<T>( header, lump, (T*)*dest, forceVersion );
@@ -2031,7 +2068,7 @@ void Lumps_Write( dheader_t *header, FileHandle_t file )
 int LoadLeafs( dheader_t *header )
 {
 #if defined( BSP_USE_LESS_MEMORY )
-	dleafs = (dleaf_t*)malloc( header->lumps[LUMP_LEAFS].filelen );
+	dleafs = (dleaf_t*)malloc( BSPLumpSize( header, LUMP_LEAFS ) );
 #endif
 	int version = LumpVersion( header, LUMP_LEAFS );
 	switch ( version )
@@ -2039,7 +2076,7 @@ int LoadLeafs( dheader_t *header )
 	case 0:
 		{
 			g_Lumps.bLumpParsed[LUMP_LEAFS] = true;
-			int length = header->lumps[LUMP_LEAFS].filelen;
+			int length = BSPLumpSize( header, LUMP_LEAFS );
 			int size = sizeof( dleaf_version_0_t );
 			if ( length % size )
 			{
@@ -2047,7 +2084,7 @@ int LoadLeafs( dheader_t *header )
 			}
 			int count = length / size;
 
-			void *pSrcBase = ( ( byte * )header + header->lumps[LUMP_LEAFS].fileofs );
+			void *pSrcBase = GetBSPLump( header, LUMP_LEAFS );
 			dleaf_version_0_t *pSrc = (dleaf_version_0_t *)pSrcBase;
 			dleaf_t *pDst = dleafs;
 
@@ -2108,7 +2145,7 @@ void LoadLeafAmbientLighting( dheader_t *header, int numLeafs )
 			Assert( LumpVersion( header, LUMP_LEAF_AMBIENT_LIGHTING_HDR ) != LUMP_LEAF_AMBIENT_LIGHTING_VERSION );
 		}
 
-		void *pSrcBase = ( ( byte * )header + header->lumps[LUMP_LEAF_AMBIENT_LIGHTING].fileofs );
+		void *pSrcBase = GetBSPLump( header, LUMP_LEAF_AMBIENT_LIGHTING );
 		CompressedLightCube *pSrc = NULL;
 		if ( HasLump( header, LUMP_LEAF_AMBIENT_LIGHTING ) )
 		{
@@ -2117,7 +2154,7 @@ void LoadLeafAmbientLighting( dheader_t *header, int numLeafs )
 		g_LeafAmbientIndexLDR.SetCount( numLeafs );
 		g_LeafAmbientLightingLDR.SetCount( numLeafs );
 
-		void *pSrcBaseHDR = ( ( byte * )header + header->lumps[LUMP_LEAF_AMBIENT_LIGHTING_HDR].fileofs );
+		void *pSrcBaseHDR = GetBSPLump( header, LUMP_LEAF_AMBIENT_LIGHTING_HDR );
 		CompressedLightCube *pSrcHDR = NULL;
 		if ( HasLump( header, LUMP_LEAF_AMBIENT_LIGHTING_HDR ) )
 		{
@@ -2181,23 +2218,208 @@ void ValidateHeader( const char *filename, const dheader_t *pHeader )
 	}
 }
 
+//-----------------------------------------------------------------------------
+//	CMappedBSPFile
+//-----------------------------------------------------------------------------
+CMappedBSPFile::CMappedBSPFile() : m_pHeader( nullptr ), m_nFileSize( 0 ), m_bMapped( false )
+{
+	BitwiseClear( m_pDecompressed );
+}
+
+CMappedBSPFile::~CMappedBSPFile()
+{
+	Close();
+}
+
+bool CMappedBSPFile::Open( const char *pFilename, bool bMap )
+{
+	Close();
+
+#ifdef MPI
+	// Workers only see the map through the VMPI filesystem, the path is the master's
+	if ( g_bUseMPI && !g_bMPIMaster )
+	{
+		bMap = false;
+	}
+#endif
+
+	// Relative paths are left to the filesystem's search paths
+	if ( bMap && V_IsAbsolutePath( pFilename ) )
+	{
+#ifdef _WIN32
+		HANDLE hFile = ::CreateFileA( pFilename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+		if ( hFile != INVALID_HANDLE_VALUE )
+		{
+			LARGE_INTEGER size;
+			if ( ::GetFileSizeEx( hFile, &size ) && size.QuadPart >= static_cast<LONGLONG>( sizeof( dheader_t ) ) )
+			{
+				HANDLE hMapping = ::CreateFileMappingA( hFile, nullptr, PAGE_WRITECOPY, 0, 0, nullptr );
+				if ( hMapping )
+				{
+					m_pHeader = static_cast<dheader_t *>( ::MapViewOfFile( hMapping, FILE_MAP_COPY, 0, 0, 0 ) );
+					m_nFileSize = static_cast<intp>( size.QuadPart );
+					// The view keeps the mapping alive
+					::CloseHandle( hMapping );
+				}
+			}
+			::CloseHandle( hFile );
+		}
+#else
+		const int fd = open( pFilename, O_RDONLY );
+		if ( fd >= 0 )
+		{
+			struct stat st;
+			if ( fstat( fd, &st ) == 0 && st.st_size >= static_cast<off_t>( sizeof( dheader_t ) ) )
+			{
+				void *pData = mmap( nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+				if ( pData != MAP_FAILED )
+				{
+					m_pHeader = static_cast<dheader_t *>( pData );
+					m_nFileSize = st.st_size;
+				}
+			}
+			close( fd );
+		}
+#endif
+		if ( m_pHeader )
+		{
+			m_bMapped = true;
+			return true;
+		}
+	}
+
+	void *pData = nullptr;
+	const int nSize = LoadFile( pFilename, &pData );
+	if ( nSize < static_cast<int>( sizeof( dheader_t ) ) )
+	{
+		free( pData );
+		return false;
+	}
+
+	m_pHeader = static_cast<dheader_t *>( pData );
+	m_nFileSize = nSize;
+	return true;
+}
+
+void CMappedBSPFile::Close()
+{
+	for ( auto *&pLump : m_pDecompressed )
+	{
+		free( pLump );
+		pLump = nullptr;
+	}
+
+	if ( m_pHeader )
+	{
+		if ( m_bMapped )
+		{
+#ifdef _WIN32
+			::UnmapViewOfFile( m_pHeader );
+#else
+			munmap( m_pHeader, m_nFileSize );
+#endif
+		}
+		else
+		{
+			free( m_pHeader );
+		}
+	}
+
+	m_pHeader = nullptr;
+	m_nFileSize = 0;
+	m_bMapped = false;
+}
+
+int CMappedBSPFile::LumpSize( int lump ) const
+{
+	const lump_t &l = m_pHeader->lumps[lump];
+	return l.uncompressedSize ? l.uncompressedSize : l.filelen;
+}
+
+byte *CMappedBSPFile::Lump( int lump )
+{
+	const lump_t &l = m_pHeader->lumps[lump];
+	if ( l.filelen <= 0 )
+		return nullptr;
+
+	if ( l.fileofs < 0 || static_cast<intp>( l.fileofs ) + l.filelen > m_nFileSize )
+	{
+		Error( "Lump %d (%d bytes at %d) is past the end of the %zd byte BSP, BSP may be corrupt.\n",
+			lump, l.filelen, l.fileofs, static_cast<ptrdiff_t>( m_nFileSize ) );
+	}
+
+	byte *pLump = (byte *)m_pHeader + l.fileofs;
+	if ( !l.uncompressedSize )
+		return pLump;
+
+	if ( !m_pDecompressed[lump] )
+	{
+		if ( !CLZMA::IsCompressed( pLump ) || CLZMA::GetActualSize( pLump ) != static_cast<unsigned>( l.uncompressedSize ) )
+		{
+			Error( "Unsupported BSP: Unrecognized compressed lump %d.\n", lump );
+		}
+
+		m_pDecompressed[lump] = static_cast<byte *>( malloc( l.uncompressedSize ) );
+		const size_t outSize = CLZMA::Uncompress( pLump, m_pDecompressed[lump], l.uncompressedSize );
+		if ( outSize != static_cast<size_t>( l.uncompressedSize ) )
+		{
+			Error( "Decompressed size %zu of lump %d differs from header %d one, BSP may be corrupt.\n",
+				outSize, lump, l.uncompressedSize );
+		}
+	}
+	return m_pDecompressed[lump];
+}
+
+// Files opened with OpenBSPFile, found by their header
+static CUtlVector<CMappedBSPFile *> s_OpenBSPFiles;
+
+static CMappedBSPFile *FindOpenBSPFile( const dheader_t *header )
+{
+	for ( auto *pFile : s_OpenBSPFiles )
+	{
+		if ( pFile->Header() == header )
+			return pFile;
+	}
+	return nullptr;
+}
+
+int BSPLumpSize( const dheader_t *header, int lump )
+{
+	const lump_t &l = header->lumps[lump];
+	return l.uncompressedSize ? l.uncompressedSize : l.filelen;
+}
+
+byte *GetBSPLump( dheader_t *header, int lump )
+{
+	CMappedBSPFile *pFile = FindOpenBSPFile( header );
+	if ( pFile )
+		return pFile->Lump( lump );
+
+	// a header not from OpenBSPFile, the lumps follow it in memory
+	if ( header->lumps[lump].uncompressedSize )
+	{
+		Error( "Compressed lump %d in a BSP not opened with OpenBSPFile.\n", lump );
+	}
+	return header->lumps[lump].filelen > 0 ? (byte *)header + header->lumps[lump].fileofs : nullptr;
+}
+
 //-----------------------------------------------------------------------------
 //	Low level BSP opener for external parsing. Parses headers, but nothing else.
 //	You must close the BSP, via CloseBSPFile().
 //-----------------------------------------------------------------------------
-dheader_t* OpenBSPFile( const char *filename )
+dheader_t* OpenBSPFile( const char *filename, bool bMap )
 {
 	Lumps_Init();
 
-	dheader_t *header = nullptr;
-
-	// load the file header
-	if (!LoadFile( filename, (void **)&header ))
+	auto *pFile = new CMappedBSPFile;
+	if ( !pFile->Open( filename, bMap ) )
 	{
 		Warning("Unable to load map '%s'.\n", filename);
+		delete pFile;
 		return nullptr;
 	}
 
+	dheader_t *header = pFile->Header();
 	if ( g_bSwapOnLoad )
 	{
 		g_Swap.ActivateByteSwapping( true );
@@ -2208,6 +2430,7 @@ dheader_t* OpenBSPFile( const char *filename )
 
 	g_MapRevision = header->mapRevision;
 
+	s_OpenBSPFiles.AddToTail( pFile );
 	return header;
 }
 
@@ -2216,7 +2439,13 @@ dheader_t* OpenBSPFile( const char *filename )
 //-----------------------------------------------------------------------------
 void CloseBSPFile( dheader_t *header )
 {
-	free( header );
+	CMappedBSPFile *pFile = FindOpenBSPFile( header );
+	Assert( pFile );
+	if ( !pFile )
+		return;
+
+	s_OpenBSPFiles.FindAndRemove( pFile );
+	delete pFile;
 }
 
 //-----------------------------------------------------------------------------
@@ -2310,15 +2539,14 @@ bool LoadBSPFile( const char *filename )
 
 	CopyLump( header, FIELD_SHORT, LUMP_LEAFMINDISTTOWATER, g_LeafMinDistToWater );
 
-	// Load PAK file lump into appropriate data structure
-	byte *pakbuffer = NULL;
-	int paksize = CopyVariableLump<byte>( header, FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer );
-	RunCodeAtScopeExit(free( pakbuffer ));
+	// Load PAK file lump into appropriate data structure, straight from the file
+	g_Lumps.bLumpParsed[LUMP_PAKFILE] = true;
+	int paksize = BSPLumpSize( header, LUMP_PAKFILE );
 	
 	if ( paksize > 0 )
 	{
 		GetPakFile()->ActivateByteSwapping( IsX360() );
-		GetPakFile()->ParseFromBuffer( pakbuffer, paksize );
+		GetPakFile()->ParseFromBuffer( GetBSPLump( header, LUMP_PAKFILE ), paksize );
 	}
 	else
 	{
@@ -2447,28 +2675,24 @@ bool LoadBSPFile_FileSystemOnly( const char *filename )
 {
 	Lumps_Init();
 
-	dheader_t *header = nullptr;
-	//
-	// load the file header
-	//
-	if (!LoadFile( filename, (void **)&header ))
+	CMappedBSPFile file;
+	if ( !file.Open( filename ) )
 	{
 		Warning("Unable to load map '%s'.\n", filename);
 		return false;
 	}
-	RunCodeAtScopeExit(free( header ));
 
+	dheader_t *header = file.Header();
 	ValidateHeader( filename, header );
 
-	// Load PAK file lump into appropriate data structure
-	byte *pakbuffer = NULL;
-	int paksize = CopyVariableLump<byte>( header, FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer, 1 );
-
-	RunCodeAtScopeExit(free( pakbuffer ));
+	// Load PAK file lump into appropriate data structure, straight from the file
+	g_Lumps.bLumpParsed[LUMP_PAKFILE] = true;
+	int paksize = file.LumpSize( LUMP_PAKFILE );
+	ValidateLump( header, LUMP_PAKFILE, paksize, 1, 1 );
 
 	if ( paksize > 0 )
 	{
-		GetPakFile()->ParseFromBuffer( pakbuffer, paksize );
+		GetPakFile()->ParseFromBuffer( file.Lump( LUMP_PAKFILE ), paksize );
 	}
 	else
 	{
@@ -2482,20 +2706,20 @@ bool ExtractZipFileFromBSP( char *pBSPFileName, char *pZipFileName )
 {
 	Lumps_Init();
 	
-	dheader_t *header = nullptr;
-	//
-	// load the file header
-	//
-	if (!LoadFile( pBSPFileName, (void **)&header))
+	CMappedBSPFile file;
+	if ( !file.Open( pBSPFileName ) )
 	{
 		Warning("Unable to load map '%s'.\n", pBSPFileName);
 		return false;
 	}
 
-	ValidateHeader( pBSPFileName, header );
+	ValidateHeader( pBSPFileName, file.Header() );
+
+	const byte *pakbuffer = file.Lump( LUMP_PAKFILE );
+	int paksize = file.LumpSize( LUMP_PAKFILE );
+	// Any version, the pak lump is written with version 0
+	ValidateLump( file.Header(), LUMP_PAKFILE, paksize, 1, -1 );
 
-	byte *pakbuffer = NULL;
-	int paksize = CopyVariableLump<byte>( header, FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer );
 	if ( paksize > 0 )
 	{
 		auto [fp, errc] = se::posix::posix_file_stream_factory::open( pZipFileName, "wb" );
@@ -2817,8 +3041,8 @@ bool WriteLumpToFile( dheader_t *header, char *filename, int lump )
 
 	RunCodeAtScopeExit(g_pFileSystem->Close(lumpfile));
 
-	int ofs = header->lumps[lump].fileofs;
-	int length = header->lumps[lump].filelen;
+	// Lump files are never compressed, and the header may come from a mapped file
+	int length = BSPLumpSize( header, lump );
 
 	// Write the header
 	lumpfileheader_t lumpHeader = {};
@@ -2830,7 +3054,7 @@ bool WriteLumpToFile( dheader_t *header, char *filename, int lump )
 	SafeWrite (lumpfile, &lumpHeader, sizeof(lumpfileheader_t));
 
 	// Write the lump
-	SafeWrite (lumpfile, (byte *)header + ofs, length);
+	SafeWrite (lumpfile, GetBSPLump( header, lump ), length);
 
 	return true;
 }
@@ -5062,16 +5286,17 @@ bool GetPakFileLump( const char *pBSPFilename, void **pPakData, int *pPakSize )
 	}
 
 	// determine endian nature
-	dheader_t *pHeader;
-	if (!LoadFile( pBSPFilename, (void **)&pHeader ))
+	bool bSwap;
 	{
-		Warning("Unable to load map '%s'.\n", pBSPFilename);
-		return false;
-	}
-
-	RunCodeAtScopeExit(free( pHeader ));
+		CMappedBSPFile file;
+		if ( !file.Open( pBSPFilename ) )
+		{
+			Warning("Unable to load map '%s'.\n", pBSPFilename);
+			return false;
+		}
 
-	bool bSwap = ( pHeader->ident == BigLong( IDBSPHEADER ) );
+		bSwap = ( file.Header()->ident == BigLong( IDBSPHEADER ) );
+	}
 
 	g_bSwapOnLoad = bSwap;
 	g_bSwapOnWrite = !bSwap;
@@ -5152,21 +5377,23 @@ bool SetPakFileLump( const char *pBSPFilename, const char *pNewFilename, void *p
 	}
 
 	// determine endian nature
-	dheader_t *pHeader;
-	if ( !LoadFile( pBSPFilename, (void **)&pHeader ) )
+	bool bSwap;
 	{
-		Warning( "Unable to load map '%s'.\n", pBSPFilename );
-		return false;
-	}
-	
-	RunCodeAtScopeExit(free( pHeader ));
+		CMappedBSPFile file;
+		if ( !file.Open( pBSPFilename ) )
+		{
+			Warning( "Unable to load map '%s'.\n", pBSPFilename );
+			return false;
+		}
 
-	bool bSwap = ( pHeader->ident == BigLong( IDBSPHEADER ) );
+		bSwap = ( file.Header()->ident == BigLong( IDBSPHEADER ) );
+	}
 
 	g_bSwapOnLoad = bSwap;
 	g_bSwapOnWrite = bSwap;
 
-	dheader_t *header = OpenBSPFile(pBSPFilename);
+	// not mapped, pNewFilename may be the same file
+	dheader_t *header = OpenBSPFile( pBSPFilename, false );
 	if (!header) return false;
 
 	RunCodeAtScopeExit(CloseBSPFile(header));
@@ -287,10 +287,49 @@ intp					TexDataStringTable_AddOrFindString( const char *pString );
 void	DecompressVis (byte *in, byte *decompressed);
 int		CompressVis (byte *vis, byte *dest);
 
+//-----------------------------------------------------------------------------
+// A BSP file mapped into memory. Opening it reads nothing up front, pages are
+// faulted in as lumps are used, and tools working on the same map at the same
+// time share them. The mapping is copy-on-write, so the header can still be
+// byte swapped in place. Uncompressed lumps point straight into the mapping,
+// LZMA compressed ones are decompressed the first time they are asked for.
+//-----------------------------------------------------------------------------
+class CMappedBSPFile
+{
+public:
+	CMappedBSPFile();
+	~CMappedBSPFile();
+
+	CMappedBSPFile( const CMappedBSPFile & ) = delete;
+	CMappedBSPFile& operator=( const CMappedBSPFile & ) = delete;
+
+	// Maps the file, or reads it through the filesystem if it can't be mapped.
+	// bMap false always reads it, for callers that write the file while it is open.
+	bool Open( const char *pFilename, bool bMap = true );
+	void Close();
+
+	dheader_t *Header() const { return m_pHeader; }
+
+	// Size of the lump once decompressed.
+	int LumpSize( int lump ) const;
+	// The lump data, decompressed if needed. nullptr if the lump is empty.
+	byte *Lump( int lump );
+
+private:
+	dheader_t	*m_pHeader;
+	intp		m_nFileSize;
+	bool		m_bMapped;						// Else m_pHeader came from LoadFile
+	byte		*m_pDecompressed[HEADER_LUMPS];
+};
+
 // dimhotepus: Make stateless. Return header for open file. Call CloseBSPFile when done.
-[[nodiscard]] dheader_t* OpenBSPFile( const char *filename );
+// bMap false reads the whole file instead of mapping it, see CMappedBSPFile::Open.
+[[nodiscard]] dheader_t* OpenBSPFile( const char *filename, bool bMap = true );
 // dimhotepus: Make stateless. Call when done.
 void CloseBSPFile(dheader_t *header);
+// Lumps of a file opened with OpenBSPFile. Compressed lumps are decompressed on first use.
+int		BSPLumpSize( const dheader_t *header, int lump );
+byte	*GetBSPLump( dheader_t *header, int lump );
 // dimhotepus: Signal errors.
 bool	LoadBSPFile( const char *filename );
 // dimhotepus: Signal errors.
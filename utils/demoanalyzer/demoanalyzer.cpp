@@ -0,0 +1,230 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Headless demo analyzer. Decodes the entities and game events of
+//			many demos in parallel into tab separated tables, one table per
+//			server class and per game event:
+//
+//			<outdir>/<demo>/entities/<server class>.tsv
+//			<outdir>/<demo>/events/<game event>.tsv
+//
+//=============================================================================//
+
+#include "tier0/dbg.h"
+#include "tier0/platform.h"
+#include "tier1/strtools.h"
+#include "tier1/utlstring.h"
+#include "tier1/utlvector.h"
+#include "vstdlib/jobthread.h"
+#include "filesystem.h"
+#include "filesystem_tools.h"
+#include "cmdlib.h"
+#include "demodecoder.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+namespace
+{
+
+struct DemoJob_t
+{
+	CUtlString			m_FileName;
+	DemoDecoderStats_t	m_Stats = {};
+	double				m_flSeconds = 0.0;
+	bool				m_bSuccess = false;
+};
+
+DemoDecoderOptions_t g_Options;
+
+void PrintUsage()
+{
+	Msg( "usage: demoanalyzer [options] <.dem files or directories>\n"
+		"\t-o <dir>         output directory, default demoanalyzer_out\n"
+		"\t-threads <n>     demos decoded at once, default one per logical processor\n"
+		"\t-class <name>    only write entities of this server class, can repeat\n"
+		"\t-noentities      don't write entity tables\n"
+		"\t-noevents        don't write game event tables\n"
+		"\n"
+		"e.g.: demoanalyzer -o tables -class CCSPlayer demos/\n" );
+}
+
+// Adds a demo, or every demo of a directory.
+void AddDemos( const char *pszPath, CUtlVector<DemoJob_t> &jobs )
+{
+	if ( !g_pFullFileSystem->IsDirectory( pszPath ) )
+	{
+		jobs[jobs.AddToTail()].m_FileName = pszPath;
+		return;
+	}
+
+	char szWildcard[MAX_PATH];
+	V_ComposeFileName( pszPath, "*.dem", szWildcard );
+
+	FileFindHandle_t hFind;
+	for ( const char *pszName = g_pFullFileSystem->FindFirst( szWildcard, &hFind ); pszName; pszName = g_pFullFileSystem->FindNext( hFind ) )
+	{
+		if ( g_pFullFileSystem->FindIsDirectory( hFind ) )
+			continue;
+
+		char szFileName[MAX_PATH];
+		V_ComposeFileName( pszPath, pszName, szFileName );
+		jobs[jobs.AddToTail()].m_FileName = szFileName;
+	}
+	g_pFullFileSystem->FindClose( hFind );
+}
+
+void DecodeDemo( DemoJob_t &job )
+{
+	const double flStart = Plat_FloatTime();
+
+	// Decoders share nothing, each job has its own.
+	CDemoDecoder decoder( g_Options );
+	job.m_bSuccess = decoder.Decode( job.m_FileName.Get() );
+	job.m_Stats = decoder.GetStats();
+	job.m_flSeconds = Plat_FloatTime() - flStart;
+
+	Msg( "%s %s: %d ticks, %d packets, %d entity rows, %d event rows in %.2fs.\n",
+		job.m_bSuccess ? "Decoded" : "Partially decoded", job.m_FileName.Get(),
+		job.m_Stats.m_nTicks, job.m_Stats.m_nPackets, job.m_Stats.m_nEntityRows, job.m_Stats.m_nEventRows,
+		job.m_flSeconds );
+}
+
+}  // namespace
+
+int main( int argc, char *argv[] )
+{
+	InstallSpewFunction();
+
+	Msg( "Valve Software - demoanalyzer (%s)\n", __DATE__ );
+
+	const char *pszOutputDir = "demoanalyzer_out";
+	int nThreads = GetCPUInformation()->m_nLogicalProcessors;
+	CUtlVector<CUtlString> classFilter;
+	CUtlVector<const char *> paths;
+
+	g_Options.m_bEntities = true;
+	g_Options.m_bEvents = true;
+
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( !V_stricmp( argv[i], "-o" ) && i + 1 < argc )
+		{
+			pszOutputDir = argv[++i];
+		}
+		else if ( !V_stricmp( argv[i], "-threads" ) && i + 1 < argc )
+		{
+			nThreads = Max( 1, V_atoi( argv[++i] ) );
+		}
+		else if ( !V_stricmp( argv[i], "-class" ) && i + 1 < argc )
+		{
+			classFilter.AddToTail( argv[++i] );
+		}
+		else if ( !V_stricmp( argv[i], "-noentities" ) )
+		{
+			g_Options.m_bEntities = false;
+		}
+		else if ( !V_stricmp( argv[i], "-noevents" ) )
+		{
+			g_Options.m_bEvents = false;
+		}
+		else if ( argv[i][0] == '-' )
+		{
+			Warning( "Unknown option %s.\n", argv[i] );
+			PrintUsage();
+			return 1;
+		}
+		else
+		{
+			paths.AddToTail( argv[i] );
+		}
+	}
+
+	if ( paths.IsEmpty() )
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	char szWorkingDir[MAX_PATH];
+	if ( !V_GetCurrentDirectory( szWorkingDir ) )
+	{
+		Warning( "Unable to get current directory.\n" );
+		return 1;
+	}
+
+	if ( !FileSystem_Init( NULL, 0, FS_INIT_FULL ) )
+		return 1;
+
+	// Add this so relative filenames work.
+	g_pFullFileSystem->AddSearchPath( szWorkingDir, "game", PATH_ADD_TO_HEAD );
+
+	char szOutputDir[MAX_PATH];
+	V_MakeAbsolutePath( szOutputDir, pszOutputDir, szWorkingDir );
+
+	g_Options.m_pszOutputDir = szOutputDir;
+	g_Options.m_pClassFilter = &classFilter;
+
+	CUtlVector<DemoJob_t> jobs;
+	for ( const char *pszPath : paths )
+	{
+		char szPath[MAX_PATH];
+		V_MakeAbsolutePath( szPath, pszPath, szWorkingDir );
+		AddDemos( szPath, jobs );
+	}
+
+	if ( jobs.IsEmpty() )
+	{
+		Warning( "No demos found.\n" );
+		FileSystem_Term();
+		return 1;
+	}
+
+	nThreads = Min( nThreads, static_cast<int>( jobs.Count() ) );
+	Msg( "Decoding %zd demo(s) on %d thread(s) into %s.\n", jobs.Count(), nThreads, szOutputDir );
+
+	const double flStart = Plat_FloatTime();
+
+	if ( nThreads > 1 )
+	{
+		// The calling thread decodes too.
+		IThreadPool *pPool = CreateThreadPool();
+		ThreadPoolStartParams_t params;
+		params.nThreads = nThreads - 1;
+		pPool->Start( params, "DemoAnalyzer" );
+
+		ParallelProcess( "DecodeDemo", pPool, jobs.Base(), jobs.Count(), &DecodeDemo );
+
+		pPool->Stop();
+		DestroyThreadPool( pPool );
+	}
+	else
+	{
+		for ( auto &job : jobs )
+		{
+			DecodeDemo( job );
+		}
+	}
+
+	DemoDecoderStats_t total = {};
+	int nFailed = 0;
+	for ( const auto &job : jobs )
+	{
+		total.m_nTicks += job.m_Stats.m_nTicks;
+		total.m_nPackets += job.m_Stats.m_nPackets;
+		total.m_nEntityRows += job.m_Stats.m_nEntityRows;
+		total.m_nEventRows += job.m_Stats.m_nEventRows;
+		if ( !job.m_bSuccess )
+		{
+			++nFailed;
+		}
+	}
+
+	const double flSeconds = Plat_FloatTime() - flStart;
+	Msg( "%zd demo(s), %d failed: %d ticks, %d entity rows, %d event rows in %.2fs (%.0f ticks/s).\n",
+		jobs.Count(), nFailed, total.m_nTicks, total.m_nEntityRows, total.m_nEventRows,
+		flSeconds, flSeconds > 0.0 ? total.m_nTicks / flSeconds : 0.0 );
+
+	FileSystem_Term();
+
+	return nFailed ? 2 : 0;
+}
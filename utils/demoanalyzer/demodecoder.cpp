@@ -0,0 +1,1326 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Decodes the entities and game events of one demo into tables.
+//
+//=============================================================================//
+
+#include "demodecoder.h"
+
+#include <snappy.h>
+
+#include "tier0/dbg.h"
+#include "tier1/lzss.h"
+#include "tier1/strtools.h"
+#include "mathlib/mathlib.h"
+#include "filesystem.h"
+#include "dt.h"
+#include "dt_encode.h"
+#include "dt_send.h"
+#include "protocol.h"
+#include "networkstringtableitem.h"
+#include "GameEventManager.h"
+#include "tooldemofile.h"
+#include "tablewriter.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+// Same as networkstringtable.cpp.
+#define SUBSTRING_BITS	5
+
+// dt_encode.cpp names the object in its debug watch output.
+const char *GetObjectClassName( int )
+{
+	return "entity";
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Inflates the data of a compressed svc_CreateStringTable like
+//			COM_BufferToBufferDecompress, without the deflate dictionary of
+//			the engine.
+//-----------------------------------------------------------------------------
+static bool UncompressStringTableData( bf_read &buf, CUtlBuffer &data )
+{
+	const unsigned int nUncompressedSize = buf.ReadLong();
+	const unsigned int nCompressedSize = buf.ReadLong();
+
+	if ( buf.TotalBytesAvailable() <= 0 ||
+		 nCompressedSize <= sizeof( uint32 ) ||
+		 nCompressedSize > (unsigned int)buf.TotalBytesAvailable() ||
+		 nUncompressedSize >= UINT_MAX / 2 )
+	{
+		return false;
+	}
+
+	CUtlVector<byte> compressed;
+	compressed.SetCount( nCompressedSize );
+	buf.ReadBytes( compressed.Base(), nCompressedSize );
+
+	data.Clear();
+	data.EnsureCapacity( nUncompressedSize );
+
+	const lzss_header_t *pHeader = reinterpret_cast<const lzss_header_t *>( compressed.Base() );
+	unsigned int nActualSize = 0;
+
+	if ( nCompressedSize >= sizeof( lzss_header_t ) && pHeader->id == LZSS_ID )
+	{
+		CLZSS lzss;
+		nActualSize = lzss.SafeUncompress( compressed.Base(), static_cast<unsigned char *>( data.Base() ), nUncompressedSize );
+	}
+	else if ( pHeader->id == SNAPPY_ID )
+	{
+		const char *pSource = reinterpret_cast<const char *>( compressed.Base() ) + sizeof( pHeader->id );
+		const size_t nSourceSize = nCompressedSize - sizeof( pHeader->id );
+
+		size_t nSnappySize;
+		if ( snappy::GetUncompressedLength( pSource, nSourceSize, &nSnappySize ) &&
+			 nSnappySize == nUncompressedSize &&
+			 snappy::RawUncompress( pSource, nSourceSize, static_cast<char *>( data.Base() ) ) )
+		{
+			nActualSize = nSnappySize;
+		}
+	}
+	else
+	{
+		Warning( "Unsupported string table compression %08x.\n", pHeader->id );
+		return false;
+	}
+
+	if ( nActualSize != nUncompressedSize )
+		return false;
+
+	data.SeekPut( CUtlBuffer::SEEK_HEAD, nActualSize );
+	return true;
+}
+
+CDemoDecoder::CDemoDecoder( const DemoDecoderOptions_t &options )
+	: m_Options( options ), m_PacketData( 0, NET_MAX_PAYLOAD )
+{
+	memset( &m_Stats, 0, sizeof( m_Stats ) );
+	m_szOutputDir[0] = '\0';
+
+	m_nDemoProtocol = DEMO_PROTOCOL;
+	m_nServerTick = -1;
+	m_nServerClassBits = 0;
+	m_iInstanceBaselineTable = -1;
+
+	m_pFrames = new Frame_t[MAX_DELTA_FRAMES];
+	m_pEntityBaselines[0] = new EntityBaseline_t[MAX_EDICTS];
+	m_pEntityBaselines[1] = new EntityBaseline_t[MAX_EDICTS];
+
+	INetChannel *chan = &m_NetChannel;
+
+	REGISTER_NET_MSG( Tick );
+	REGISTER_NET_MSG( StringCmd );
+	REGISTER_NET_MSG( SetConVar );
+	REGISTER_NET_MSG( SignonState );
+
+	REGISTER_SVC_MSG( Print );
+	REGISTER_SVC_MSG( ServerInfo );
+	REGISTER_SVC_MSG( SendTable );
+	REGISTER_SVC_MSG( ClassInfo );
+	REGISTER_SVC_MSG( SetPause );
+	REGISTER_SVC_MSG( CreateStringTable );
+	REGISTER_SVC_MSG( UpdateStringTable );
+	REGISTER_SVC_MSG( VoiceInit );
+	REGISTER_SVC_MSG( VoiceData );
+	REGISTER_SVC_MSG( Sounds );
+	REGISTER_SVC_MSG( SetView );
+	REGISTER_SVC_MSG( FixAngle );
+	REGISTER_SVC_MSG( CrosshairAngle );
+	REGISTER_SVC_MSG( BSPDecal );
+	REGISTER_SVC_MSG( GameEvent );
+	REGISTER_SVC_MSG( UserMessage );
+	REGISTER_SVC_MSG( EntityMessage );
+	REGISTER_SVC_MSG( PacketEntities );
+	REGISTER_SVC_MSG( TempEntities );
+	REGISTER_SVC_MSG( Prefetch );
+	REGISTER_SVC_MSG( Menu );
+	REGISTER_SVC_MSG( GameEventList );
+	REGISTER_SVC_MSG( GetCvarValue );
+	REGISTER_SVC_MSG( CmdKeyValues );
+	REGISTER_SVC_MSG( SetPauseTimed );
+}
+
+CDemoDecoder::~CDemoDecoder()
+{
+	CloseTables();
+	FreeDataTables();
+
+	// Messages point back at us.
+	m_NetChannel.RemoveMessages();
+
+	delete [] m_pEntityBaselines[1];
+	delete [] m_pEntityBaselines[0];
+	delete [] m_pFrames;
+}
+
+bool CDemoDecoder::Decode( const char *pszDemoFile )
+{
+	CToolDemoFile demoFile;
+	if ( !demoFile.Open( pszDemoFile, true ) )
+	{
+		Warning( "Couldn't open %s.\n", pszDemoFile );
+		return false;
+	}
+
+	const demoheader_t *pHeader = demoFile.ReadDemoHeader();
+	if ( !pHeader )
+		return false;
+
+	m_nDemoProtocol = pHeader->demoprotocol;
+	m_NetChannel.SetProtocolVersion( pHeader->networkprotocol );
+
+	char szDemoName[MAX_PATH];
+	V_FileBase( pszDemoFile, szDemoName );
+	V_ComposeFileName( m_Options.m_pszOutputDir, szDemoName, m_szOutputDir );
+
+	democmdinfo_t info;
+	int nSeqNrIn, nSeqNrOutAck;
+	bool bSuccess = true;
+	bool bFinished = false;
+
+	while ( bSuccess && !bFinished )
+	{
+		unsigned char cmd;
+		int tick;
+		demoFile.ReadCmdHeader( cmd, tick );
+
+		switch ( cmd )
+		{
+		case dem_signon:
+		case dem_packet:
+			{
+				demoFile.ReadCmdInfo( info );
+				demoFile.ReadSequenceInfo( nSeqNrIn, nSeqNrOutAck );
+
+				if ( demoFile.ReadRawData( m_PacketData ) < 0 )
+				{
+					bSuccess = false;
+					break;
+				}
+
+				bf_read buf( "CDemoDecoder::Decode", m_PacketData.Base(), m_PacketData.TellPut() );
+				bSuccess = m_NetChannel.ProcessMessages( buf );
+				++m_Stats.m_nPackets;
+			}
+			break;
+		case dem_synctick:
+			break;
+		case dem_consolecmd:
+			demoFile.ReadRawData( NULL, 0 );
+			break;
+		case dem_usercmd:
+			{
+				int nSize = 0;
+				demoFile.ReadUserCmd( NULL, nSize );
+			}
+			break;
+		case dem_datatables:
+			{
+				CUtlBuffer dataTables;
+				demoFile.ReadNetworkDataTables( &dataTables );
+
+				bf_read buf( "CDemoDecoder::Decode", dataTables.Base(), dataTables.TellPut() );
+				bSuccess = ParseDataTables( buf ) && LinkDataTables();
+			}
+			break;
+		case dem_stringtables:
+			{
+				if ( demoFile.ReadRawData( m_PacketData ) < 0 )
+				{
+					bSuccess = false;
+					break;
+				}
+
+				bf_read buf( "CDemoDecoder::Decode", m_PacketData.Base(), m_PacketData.TellPut() );
+				bSuccess = ParseStringTables( buf );
+			}
+			break;
+		case dem_keyframe:
+			// Only used to seek, reading front to back already has this state.
+			demoFile.ReadRawData( NULL, 0 );
+			demoFile.ReadCmdInfo( info );
+			demoFile.ReadSequenceInfo( nSeqNrIn, nSeqNrOutAck );
+			demoFile.ReadRawData( NULL, 0 );
+			break;
+		case dem_stop:
+			bFinished = true;
+			break;
+		default:
+			Warning( "%s: unknown demo command %i.\n", pszDemoFile, cmd );
+			bSuccess = false;
+			break;
+		}
+	}
+
+	if ( !bSuccess )
+	{
+		Warning( "%s: stopped at tick %i.\n", pszDemoFile, m_nServerTick );
+	}
+
+	CloseTables();
+	return bSuccess;
+}
+
+void CDemoDecoder::CloseTables()
+{
+	for ( auto &serverClass : m_ServerClasses )
+	{
+		delete serverClass.m_pWriter;
+		serverClass.m_pWriter = nullptr;
+	}
+
+	for ( auto &descriptor : m_GameEvents )
+	{
+		delete descriptor.m_pWriter;
+		descriptor.m_pWriter = nullptr;
+	}
+}
+
+CTableWriter *CDemoDecoder::OpenTable( const char *pszSubDir, const char *pszName, const CUtlVector<const char *> &columns )
+{
+	char szFileName[MAX_PATH];
+	V_snprintf( szFileName, sizeof( szFileName ), "%s%c%s%c%s.tsv",
+		m_szOutputDir, CORRECT_PATH_SEPARATOR, pszSubDir, CORRECT_PATH_SEPARATOR, pszName );
+
+	// A table which failed to open stays closed and drops its rows, so the
+	// failure is reported once.
+	CTableWriter *pWriter = new CTableWriter;
+	pWriter->Open( szFileName, columns );
+	return pWriter;
+}
+
+//-----------------------------------------------------------------------------
+// Data tables
+//-----------------------------------------------------------------------------
+bool CDemoDecoder::ParseDataTables( bf_read &buf )
+{
+	FreeDataTables();
+
+	// Same layout DataTable_LoadDataTablesFromBuffer and RecvTable_ReadInfos
+	// read, kept as SendTables since that is what the precalc flattens.
+	while ( buf.ReadOneBit() != 0 )
+	{
+		// Needs decoder, only the client cares.
+		(void)buf.ReadOneBit();
+
+		SendTable *pTable = new SendTable;
+		m_SendTables.AddToTail( pTable );
+
+		pTable->m_pNetTableName = buf.ReadAndAllocateString();
+
+		pTable->m_nProps = buf.ReadUBitLong( PROPINFOBITS_NUMPROPS );
+		pTable->m_pProps = pTable->m_nProps ? new SendProp[ pTable->m_nProps ] : NULL;
+
+		for ( int iProp = 0; iProp < pTable->m_nProps; iProp++ )
+		{
+			SendProp *pProp = &pTable->m_pProps[iProp];
+
+			pProp->m_Type = (SendPropType)buf.ReadUBitLong( PROPINFOBITS_TYPE );
+			pProp->m_pVarName = buf.ReadAndAllocateString();
+
+			// SPROP_NUMFLAGBITS was 11 in demo protocol 2.
+			pProp->SetFlags( buf.ReadUBitLong( m_nDemoProtocol == 2 ? 11 : PROPINFOBITS_FLAGS ) );
+
+			if ( pProp->m_Type == DPT_DataTable )
+			{
+				pProp->m_pExcludeDTName = buf.ReadAndAllocateString();
+			}
+			else if ( pProp->IsExcludeProp() )
+			{
+				pProp->m_pExcludeDTName = buf.ReadAndAllocateString();
+			}
+			else if ( pProp->GetType() == DPT_Array )
+			{
+				pProp->SetNumElements( buf.ReadUBitLong( PROPINFOBITS_NUMELEMENTS ) );
+			}
+			else
+			{
+				pProp->m_fLowValue = buf.ReadBitFloat();
+				pProp->m_fHighValue = buf.ReadBitFloat();
+				pProp->m_nBits = buf.ReadUBitLong( PROPINFOBITS_NUMBITS );
+			}
+		}
+
+		if ( buf.IsOverflowed() )
+		{
+			Warning( "Data tables are truncated.\n" );
+			return false;
+		}
+	}
+
+	// Same layout DataTable_ParseClassInfosFromBuffer reads.
+	const int nServerClasses = buf.ReadShort();
+	if ( nServerClasses <= 0 || nServerClasses > MAX_SERVER_CLASSES )
+	{
+		Warning( "Bad number of server classes %i.\n", nServerClasses );
+		return false;
+	}
+
+	m_ServerClasses.SetCount( nServerClasses );
+
+	for ( int i = 0; i < nServerClasses; i++ )
+	{
+		const int iClass = buf.ReadShort();
+		if ( iClass < 0 || iClass >= nServerClasses )
+		{
+			Warning( "Invalid server class index %i.\n", iClass );
+			return false;
+		}
+
+		char szName[256];
+		buf.ReadString( szName );
+		m_ServerClasses[iClass].m_Name = szName;
+		buf.ReadString( szName );
+		m_ServerClasses[iClass].m_TableName = szName;
+	}
+
+	return !buf.IsOverflowed();
+}
+
+SendTable *CDemoDecoder::FindSendTable( const char *pszName )
+{
+	for ( auto *pTable : m_SendTables )
+	{
+		if ( !V_stricmp( pTable->m_pNetTableName, pszName ) )
+			return pTable;
+	}
+
+	return nullptr;
+}
+
+bool CDemoDecoder::LinkDataTables()
+{
+	for ( auto *pTable : m_SendTables )
+	{
+		for ( int iProp = 0; iProp < pTable->m_nProps; iProp++ )
+		{
+			SendProp *pProp = &pTable->m_pProps[iProp];
+			if ( pProp->GetType() != DPT_DataTable )
+				continue;
+
+			SendTable *pChild = FindSendTable( pProp->m_pExcludeDTName );
+			if ( !pChild )
+			{
+				Warning( "%s.%s references missing data table %s.\n",
+					pTable->m_pNetTableName, pProp->m_pVarName, pProp->m_pExcludeDTName );
+				return false;
+			}
+
+			pProp->SetDataTable( pChild );
+		}
+	}
+
+	const CUtlVector<CUtlString> *pFilter = m_Options.m_pClassFilter;
+
+	for ( auto &serverClass : m_ServerClasses )
+	{
+		serverClass.m_bWrite = m_Options.m_bEntities && ( !pFilter || pFilter->IsEmpty() );
+		if ( !serverClass.m_bWrite && m_Options.m_bEntities )
+		{
+			for ( const auto &name : *pFilter )
+			{
+				if ( !V_stricmp( name.Get(), serverClass.m_Name.Get() ) )
+				{
+					serverClass.m_bWrite = true;
+					break;
+				}
+			}
+		}
+
+		SendTable *pTable = FindSendTable( serverClass.m_TableName.Get() );
+		if ( !pTable )
+		{
+			Warning( "Server class %s references missing data table %s.\n",
+				serverClass.m_Name.Get(), serverClass.m_TableName.Get() );
+			continue;
+		}
+
+		// Classes never share a table, but the precalc belongs to the class
+		// so it is not linked back from the table.
+		CSendTablePrecalc *pPrecalc = new CSendTablePrecalc;
+		pPrecalc->m_pSendTable = pTable;
+
+		if ( !pPrecalc->SetupFlatPropertyArray() )
+		{
+			Warning( "Couldn't flatten data table %s.\n", pTable->m_pNetTableName );
+			delete pPrecalc;
+			continue;
+		}
+
+		serverClass.m_pPrecalc = pPrecalc;
+	}
+
+	return true;
+}
+
+void CDemoDecoder::FreeDataTables()
+{
+	// Precalcs reference their table when they are deleted.
+	for ( auto &serverClass : m_ServerClasses )
+	{
+		delete serverClass.m_pWriter;
+		delete serverClass.m_pPrecalc;
+	}
+	m_ServerClasses.Purge();
+
+	for ( auto *pTable : m_SendTables )
+	{
+		for ( int iProp = 0; iProp < pTable->m_nProps; iProp++ )
+		{
+			SendProp *pProp = &pTable->m_pProps[iProp];
+
+			delete [] pProp->m_pVarName;
+			delete [] pProp->m_pExcludeDTName;
+		}
+
+		delete [] pTable->m_pProps;
+		delete [] pTable->m_pNetTableName;
+		delete pTable;
+	}
+	m_SendTables.Purge();
+}
+
+//-----------------------------------------------------------------------------
+// String tables
+//-----------------------------------------------------------------------------
+CDemoDecoder::StringTable_t *CDemoDecoder::FindStringTable( const char *pszName )
+{
+	for ( auto &table : m_StringTables )
+	{
+		if ( !V_stricmp( table.m_Name.Get(), pszName ) )
+			return &table;
+	}
+
+	return nullptr;
+}
+
+void CDemoDecoder::SetStringTableEntry( StringTable_t &table, int iEntry, const char *pszString, const void *pUserData, int nBytes )
+{
+	if ( iEntry >= table.m_Entries.Count() )
+	{
+		Assert( iEntry == table.m_Entries.Count() );
+		table.m_Entries.EnsureCount( iEntry + 1 );
+		table.m_Entries[iEntry].m_String = pszString ? pszString : "";
+	}
+
+	StringTableEntry_t &entry = table.m_Entries[iEntry];
+	entry.m_UserData.SetCount( nBytes );
+	if ( nBytes )
+	{
+		memcpy( entry.m_UserData.Base(), pUserData, nBytes );
+	}
+
+	// Instance baselines are keyed by class index.
+	if ( &table == m_StringTables.Base() + m_iInstanceBaselineTable )
+	{
+		const int iClass = V_atoi( entry.m_String.Get() );
+		if ( m_ServerClasses.IsValidIndex( iClass ) )
+		{
+			m_ServerClasses[iClass].m_bBaselineValid = false;
+		}
+	}
+}
+
+bool CDemoDecoder::ParseStringTableUpdate( StringTable_t &table, bf_read &buf, int nEntries )
+{
+	struct StringHistoryEntry_t
+	{
+		char m_szString[1 << SUBSTRING_BITS];
+	};
+
+	CUtlVector<StringHistoryEntry_t> history;
+	const int nEntryBits = Q_log2( table.m_nMaxEntries );
+	int iLastEntry = -1;
+
+	// Same layout CNetworkStringTable::ParseUpdate reads.
+	for ( int i = 0; i < nEntries; i++ )
+	{
+		int iEntry = iLastEntry + 1;
+		if ( !buf.ReadOneBit() )
+		{
+			iEntry = buf.ReadUBitLong( nEntryBits );
+		}
+		iLastEntry = iEntry;
+
+		if ( iEntry < 0 || iEntry >= table.m_nMaxEntries || iEntry > table.m_Entries.Count() )
+		{
+			Warning( "Bogus string index %i for table %s.\n", iEntry, table.m_Name.Get() );
+			return false;
+		}
+
+		const char *pszEntry = NULL;
+		char szEntry[1024];
+
+		if ( buf.ReadOneBit() )
+		{
+			if ( buf.ReadOneBit() )
+			{
+				const unsigned int iHistory = buf.ReadUBitLong( 5 );
+				const unsigned int nBytesToCopy = buf.ReadUBitLong( SUBSTRING_BITS );
+				if ( iHistory >= (unsigned int)history.Count() )
+				{
+					Warning( "Bogus substring index %u for table %s.\n", iHistory, table.m_Name.Get() );
+					return false;
+				}
+
+				char szSubstring[1024];
+				V_strncpy( szEntry, history[iHistory].m_szString, Min( sizeof( szEntry ), (size_t)nBytesToCopy + 1 ) );
+				buf.ReadString( szSubstring );
+				V_strncat( szEntry, szSubstring, sizeof( szEntry ), COPY_ALL_CHARACTERS );
+			}
+			else
+			{
+				buf.ReadString( szEntry );
+			}
+
+			pszEntry = szEntry;
+		}
+
+		unsigned char userData[CNetworkStringTableItem::MAX_USERDATA_SIZE];
+		int nBytes = 0;
+
+		if ( buf.ReadOneBit() )
+		{
+			if ( table.m_bUserDataFixedSize )
+			{
+				nBytes = table.m_nUserDataSize;
+				userData[nBytes - 1] = 0;
+				buf.ReadBits( userData, table.m_nUserDataSizeBits );
+			}
+			else
+			{
+				nBytes = buf.ReadUBitLong( CNetworkStringTableItem::MAX_USERDATA_BITS );
+				buf.ReadBytes( userData, nBytes );
+			}
+		}
+
+		SetStringTableEntry( table, iEntry, pszEntry, userData, nBytes );
+
+		if ( history.Count() > 31 )
+		{
+			history.Remove( 0 );
+		}
+
+		StringHistoryEntry_t &historyEntry = history[history.AddToTail()];
+		V_strncpy( historyEntry.m_szString, table.m_Entries[iEntry].m_String.Get(), sizeof( historyEntry.m_szString ) );
+	}
+
+	return !buf.IsOverflowed();
+}
+
+bool CDemoDecoder::ParseStringTables( bf_read &buf )
+{
+	// Same layout CNetworkStringTableContainer::ReadStringTables reads.
+	const int nTables = buf.ReadByte();
+	for ( int i = 0; i < nTables; i++ )
+	{
+		char szName[256];
+		buf.ReadString( szName );
+
+		StringTable_t *pTable = FindStringTable( szName );
+		if ( !pTable )
+		{
+			Warning( "Could not find string table \"%s\".\n", szName );
+			return false;
+		}
+
+		pTable->m_Entries.Purge();
+
+		const int nEntries = buf.ReadWord();
+		for ( int iEntry = 0; iEntry < nEntries; iEntry++ )
+		{
+			char szEntry[4096];
+			buf.ReadString( szEntry );
+
+			unsigned char userData[CNetworkStringTableItem::MAX_USERDATA_SIZE];
+			int nBytes = 0;
+			if ( buf.ReadOneBit() )
+			{
+				nBytes = buf.ReadWord();
+				if ( nBytes > static_cast<int>( sizeof( userData ) ) )
+				{
+					Warning( "String table %s user data too large (%i bytes).\n", szName, nBytes );
+					return false;
+				}
+
+				buf.ReadBytes( userData, nBytes );
+			}
+
+			SetStringTableEntry( *pTable, iEntry, szEntry, userData, nBytes );
+		}
+
+		// Client side entries, nothing server side references them.
+		if ( buf.ReadOneBit() )
+		{
+			const int nClientEntries = buf.ReadWord();
+			for ( int iEntry = 0; iEntry < nClientEntries; iEntry++ )
+			{
+				char szEntry[4096];
+				buf.ReadString( szEntry );
+
+				if ( buf.ReadOneBit() )
+				{
+					buf.SeekRelative( buf.ReadWord() * 8 );
+				}
+			}
+		}
+	}
+
+	return !buf.IsOverflowed();
+}
+
+bool CDemoDecoder::ProcessCreateStringTable( SVC_CreateStringTable *msg )
+{
+	// Table ids are handed out in creation order.
+	const int iTable = m_StringTables.AddToTail();
+	StringTable_t &table = m_StringTables[iTable];
+
+	table.m_Name = msg->m_szTableName;
+	table.m_nMaxEntries = msg->m_nMaxEntries;
+	table.m_bUserDataFixedSize = msg->m_bUserDataFixedSize;
+	table.m_nUserDataSize = msg->m_nUserDataSize;
+	table.m_nUserDataSizeBits = msg->m_nUserDataSizeBits;
+
+	if ( !V_stricmp( msg->m_szTableName, INSTANCE_BASELINE_TABLENAME ) )
+	{
+		m_iInstanceBaselineTable = iTable;
+	}
+
+	if ( !msg->m_bDataCompressed )
+		return ParseStringTableUpdate( table, msg->m_DataIn, msg->m_nNumEntries );
+
+	CUtlBuffer data;
+	if ( !UncompressStringTableData( msg->m_DataIn, data ) )
+	{
+		Warning( "Malformed compressed string table %s.\n", msg->m_szTableName );
+		return false;
+	}
+
+	bf_read buf( "CDemoDecoder::ProcessCreateStringTable", data.Base(), data.TellPut() );
+	return ParseStringTableUpdate( table, buf, msg->m_nNumEntries );
+}
+
+bool CDemoDecoder::ProcessUpdateStringTable( SVC_UpdateStringTable *msg )
+{
+	if ( !m_StringTables.IsValidIndex( msg->m_nTableID ) )
+	{
+		Warning( "Update of unknown string table %i.\n", msg->m_nTableID );
+		return false;
+	}
+
+	return ParseStringTableUpdate( m_StringTables[msg->m_nTableID], msg->m_DataIn, msg->m_nChangedEntries );
+}
+
+//-----------------------------------------------------------------------------
+// Entities
+//-----------------------------------------------------------------------------
+bool CDemoDecoder::ProcessTick( NET_Tick *msg )
+{
+	if ( msg->m_nTick != m_nServerTick )
+	{
+		m_nServerTick = msg->m_nTick;
+		++m_Stats.m_nTicks;
+	}
+
+	return true;
+}
+
+bool CDemoDecoder::ProcessServerInfo( SVC_ServerInfo *msg )
+{
+	m_nServerClassBits = Q_log2( msg->m_nMaxClasses ) + 1;
+	return true;
+}
+
+CDemoDecoder::Frame_t *CDemoDecoder::FindFrame( int nTick )
+{
+	for ( int i = 0; i < MAX_DELTA_FRAMES; i++ )
+	{
+		if ( m_pFrames[i].m_nTick == nTick )
+			return &m_pFrames[i];
+	}
+
+	return nullptr;
+}
+
+CDemoDecoder::Frame_t &CDemoDecoder::AllocFrame( int nTick, const Frame_t *pFrom )
+{
+	// Reuse the frame of the same tick, a free one or the oldest, but never
+	// the one the new frame is built from.
+	Frame_t *pFrame = nullptr;
+	for ( int i = 0; i < MAX_DELTA_FRAMES; i++ )
+	{
+		Frame_t &frame = m_pFrames[i];
+		if ( &frame == pFrom )
+			continue;
+
+		if ( frame.m_nTick == nTick || frame.m_nTick < 0 )
+		{
+			pFrame = &frame;
+			break;
+		}
+
+		if ( !pFrame || frame.m_nTick < pFrame->m_nTick )
+		{
+			pFrame = &frame;
+		}
+	}
+
+	pFrame->m_nTick = nTick;
+	for ( int i = 0; i < MAX_EDICTS; i++ )
+	{
+		pFrame->m_Entities[i] = pFrom ? pFrom->m_Entities[i] : nullptr;
+	}
+
+	return *pFrame;
+}
+
+void CDemoDecoder::DecodeProp( bf_read &buf, const SendProp *pProp, PropValue_t &value )
+{
+	DecodeInfo decodeInfo;
+	decodeInfo.m_pRecvProp = NULL;	// no proxy, the value is taken from m_Value
+	decodeInfo.m_pStruct = NULL;
+	decodeInfo.m_pData = NULL;
+	decodeInfo.m_ObjectID = 0;
+	decodeInfo.m_iElement = 0;
+	decodeInfo.m_pProp = pProp;
+	decodeInfo.m_pIn = &buf;
+
+	switch ( pProp->GetType() )
+	{
+	case DPT_Int:
+		g_PropTypeFns[DPT_Int].Decode( &decodeInfo );
+		value.m_Int = decodeInfo.m_Value.m_Int;
+		break;
+	case DPT_Float:
+		g_PropTypeFns[DPT_Float].Decode( &decodeInfo );
+		value.m_Float = decodeInfo.m_Value.m_Float;
+		break;
+	case DPT_Vector:
+		g_PropTypeFns[DPT_Vector].Decode( &decodeInfo );
+		value.m_Vector[0] = decodeInfo.m_Value.m_Vector[0];
+		value.m_Vector[1] = decodeInfo.m_Value.m_Vector[1];
+		value.m_Vector[2] = decodeInfo.m_Value.m_Vector[2];
+		break;
+	case DPT_VectorXY:
+		g_PropTypeFns[DPT_VectorXY].Decode( &decodeInfo );
+		value.m_Vector[0] = decodeInfo.m_Value.m_Vector[0];
+		value.m_Vector[1] = decodeInfo.m_Value.m_Vector[1];
+		break;
+	case DPT_String:
+		g_PropTypeFns[DPT_String].Decode( &decodeInfo );
+		value.m_String = decodeInfo.m_Value.m_pString;
+		break;
+	case DPT_Array:
+		{
+			// Array_Decode hands every element to a recv proxy, without one
+			// only the last element would survive.
+			const SendProp *pElement = pProp->GetArrayProp();
+			const int nElements = buf.ReadUBitLong( pProp->GetNumArrayLengthBits() );
+
+			decodeInfo.m_pProp = pElement;
+			value.m_String.Clear();
+
+			for ( int i = 0; i < nElements; i++ )
+			{
+				g_PropTypeFns[pElement->GetType()].Decode( &decodeInfo );
+
+				const DVariant &element = decodeInfo.m_Value;
+				char szElement[DT_MAX_STRING_BUFFERSIZE];
+				switch ( pElement->GetType() )
+				{
+				case DPT_Int:
+					V_snprintf( szElement, sizeof( szElement ), "%d", element.m_Int );
+					break;
+				case DPT_Float:
+					V_snprintf( szElement, sizeof( szElement ), "%.7g", element.m_Float );
+					break;
+				case DPT_Vector:
+					V_snprintf( szElement, sizeof( szElement ), "%.7g %.7g %.7g", element.m_Vector[0], element.m_Vector[1], element.m_Vector[2] );
+					break;
+				case DPT_VectorXY:
+					V_snprintf( szElement, sizeof( szElement ), "%.7g %.7g", element.m_Vector[0], element.m_Vector[1] );
+					break;
+				case DPT_String:
+					V_strcpy_safe( szElement, element.m_pString );
+					break;
+#ifdef SUPPORTS_INT64
+				case DPT_Int64:
+					V_snprintf( szElement, sizeof( szElement ), "%lld", static_cast<long long>( element.m_Int64 ) );
+					break;
+#endif
+				default:
+					szElement[0] = '\0';
+					break;
+				}
+
+				if ( i )
+				{
+					value.m_String.Append( ',' );
+				}
+				value.m_String.Append( szElement );
+			}
+		}
+		break;
+#ifdef SUPPORTS_INT64
+	case DPT_Int64:
+		g_PropTypeFns[DPT_Int64].Decode( &decodeInfo );
+		value.m_Int64 = decodeInfo.m_Value.m_Int64;
+		break;
+#endif
+	default:
+		// Data tables are flattened away by the precalc.
+		Assert( 0 );
+		break;
+	}
+}
+
+bool CDemoDecoder::ReadDelta( bf_read &buf, ServerClass_t &serverClass, PropValues_t &values )
+{
+	const CSendTablePrecalc *pPrecalc = serverClass.m_pPrecalc;
+	const int nProps = pPrecalc->GetNumProps();
+
+	if ( values.Count() != nProps )
+	{
+		values.SetCount( nProps );
+	}
+
+	CDeltaBitsReader deltaBitsReader( &buf );
+	unsigned int iProp;
+	while ( ( iProp = deltaBitsReader.ReadNextPropIndex() ) < MAX_DATATABLE_PROPS )
+	{
+		if ( iProp >= (unsigned int)nProps )
+		{
+			deltaBitsReader.ForceFinished();
+			Warning( "Bad property index %u for server class %s.\n", iProp, serverClass.m_Name.Get() );
+			return false;
+		}
+
+		DecodeProp( buf, pPrecalc->GetProp( iProp ), values[iProp] );
+	}
+
+	return !buf.IsOverflowed();
+}
+
+const CDemoDecoder::PropValues_t *CDemoDecoder::GetInstanceBaseline( int iClass )
+{
+	ServerClass_t &serverClass = m_ServerClasses[iClass];
+	if ( serverClass.m_bBaselineValid )
+		return &serverClass.m_Baseline;
+
+	if ( !m_StringTables.IsValidIndex( m_iInstanceBaselineTable ) )
+		return nullptr;
+
+	// Same key CClientState::GetClassBaseline looks up.
+	char szClass[16];
+	V_snprintf( szClass, sizeof( szClass ), "%d", iClass );
+
+	for ( const auto &entry : m_StringTables[m_iInstanceBaselineTable].m_Entries )
+	{
+		if ( V_strcmp( entry.m_String.Get(), szClass ) )
+			continue;
+
+		bf_read buf( "CDemoDecoder::GetInstanceBaseline", entry.m_UserData.Base(), entry.m_UserData.Count() );
+
+		serverClass.m_Baseline.Purge();
+		if ( !ReadDelta( buf, serverClass, serverClass.m_Baseline ) )
+			return nullptr;
+
+		serverClass.m_bBaselineValid = true;
+		return &serverClass.m_Baseline;
+	}
+
+	return nullptr;
+}
+
+bool CDemoDecoder::ReadEnterPVS( bf_read &buf, int iEntity, const SVC_PacketEntities *msg, Frame_t &frame )
+{
+	const int iClass = buf.ReadUBitLong( m_nServerClassBits );
+	const int nSerial = buf.ReadUBitLong( NUM_NETWORKED_EHANDLE_SERIAL_NUMBER_BITS );
+
+	if ( !m_ServerClasses.IsValidIndex( iClass ) || !m_ServerClasses[iClass].m_pPrecalc )
+	{
+		Warning( "Entity %i enters with invalid server class %i.\n", iEntity, iClass );
+		return false;
+	}
+
+	ServerClass_t &serverClass = m_ServerClasses[iClass];
+
+	// Like CL_CopyNewEntity, deltas against the entity baseline if it has the
+	// same class, otherwise against the instance baseline of the class.
+	const EntityBaseline_t &entityBaseline = m_pEntityBaselines[msg->m_nBaseline][iEntity];
+	const PropValues_t *pBaseline = msg->m_bIsDelta && entityBaseline.m_iClass == iClass
+		? &entityBaseline.m_Props
+		: GetInstanceBaseline( iClass );
+
+	if ( !pBaseline )
+	{
+		Warning( "Missing baseline for server class %s.\n", serverClass.m_Name.Get() );
+		return false;
+	}
+
+	auto pEntity = std::make_shared<EntityState_t>();
+	pEntity->m_iClass = iClass;
+	pEntity->m_nSerial = nSerial;
+	pEntity->m_Props = *pBaseline;
+
+	if ( !ReadDelta( buf, serverClass, pEntity->m_Props ) )
+		return false;
+
+	if ( msg->m_bUpdateBaseline )
+	{
+		EntityBaseline_t &newBaseline = m_pEntityBaselines[msg->m_nBaseline == 0 ? 1 : 0][iEntity];
+		newBaseline.m_iClass = iClass;
+		newBaseline.m_Props = pEntity->m_Props;
+	}
+
+	frame.m_Entities[iEntity] = std::move( pEntity );
+	m_ChangedEntities.AddToTail( iEntity );
+	return true;
+}
+
+bool CDemoDecoder::ProcessPacketEntities( SVC_PacketEntities *msg )
+{
+	if ( !m_Options.m_bEntities )
+		return true;
+
+	// Like CL_ParsePacketEntities, deltas apply to the frame of the tick the
+	// packet was delta compressed against. Full updates start from nothing.
+	const Frame_t *pFrom = nullptr;
+	if ( msg->m_bIsDelta )
+	{
+		pFrom = FindFrame( msg->m_nDeltaFrom );
+		if ( !pFrom )
+		{
+			Warning( "Packet entities delta from unknown tick %i.\n", msg->m_nDeltaFrom );
+			return false;
+		}
+	}
+	else
+	{
+		for ( int i = 0; i < MAX_DELTA_FRAMES; i++ )
+		{
+			m_pFrames[i].m_nTick = -1;
+		}
+	}
+
+	Frame_t &frame = AllocFrame( m_nServerTick, pFrom );
+
+	if ( msg->m_bUpdateBaseline )
+	{
+		// Entities entering the PVS below update the other baseline.
+		const EntityBaseline_t *pFromBaselines = m_pEntityBaselines[msg->m_nBaseline];
+		EntityBaseline_t *pToBaselines = m_pEntityBaselines[msg->m_nBaseline == 0 ? 1 : 0];
+		for ( int i = 0; i < MAX_EDICTS; i++ )
+		{
+			pToBaselines[i].m_iClass = pFromBaselines[i].m_iClass;
+			pToBaselines[i].m_Props = pFromBaselines[i].m_Props;
+		}
+	}
+
+	// Same headers CL_ParseDeltaHeader reads.
+	bf_read &buf = msg->m_DataIn;
+	int iEntity = -1;
+
+	for ( int iHeader = 0; iHeader < msg->m_nUpdatedEntries; iHeader++ )
+	{
+		iEntity += 1 + buf.ReadUBitVar();
+		if ( iEntity < 0 || iEntity >= MAX_EDICTS )
+		{
+			Warning( "Bad entity index %i in packet entities.\n", iEntity );
+			return false;
+		}
+
+		if ( buf.ReadOneBit() == 0 )
+		{
+			if ( buf.ReadOneBit() != 0 )
+			{
+				if ( !ReadEnterPVS( buf, iEntity, msg, frame ) )
+					return false;
+			}
+			else
+			{
+				const EntityStatePtr_t &pOld = frame.m_Entities[iEntity];
+				if ( !pOld )
+				{
+					Warning( "Delta for missing entity %i.\n", iEntity );
+					return false;
+				}
+
+				// Older frames still share the previous state.
+				auto pEntity = std::make_shared<EntityState_t>();
+				pEntity->m_iClass = pOld->m_iClass;
+				pEntity->m_nSerial = pOld->m_nSerial;
+				pEntity->m_Props = pOld->m_Props;
+				if ( !ReadDelta( buf, m_ServerClasses[pEntity->m_iClass], pEntity->m_Props ) )
+					return false;
+
+				frame.m_Entities[iEntity] = std::move( pEntity );
+				m_ChangedEntities.AddToTail( iEntity );
+			}
+		}
+		else
+		{
+			// Leaving the PVS, deleted or not. It enters again from a baseline.
+			frame.m_Entities[iEntity] = nullptr;
+			buf.ReadOneBit();
+		}
+	}
+
+	if ( msg->m_bIsDelta )
+	{
+		// Explicit deletions.
+		while ( buf.ReadOneBit() != 0 )
+		{
+			frame.m_Entities[buf.ReadUBitLong( MAX_EDICT_BITS )] = nullptr;
+		}
+	}
+
+	if ( buf.IsOverflowed() )
+	{
+		Warning( "Packet entities are truncated.\n" );
+		return false;
+	}
+
+	// The client drops the frames older than the acknowledged one as well.
+	if ( pFrom )
+	{
+		for ( int i = 0; i < MAX_DELTA_FRAMES; i++ )
+		{
+			if ( m_pFrames[i].m_nTick < pFrom->m_nTick )
+			{
+				m_pFrames[i].m_nTick = -1;
+			}
+		}
+	}
+
+	WriteEntityRows( frame );
+	return true;
+}
+
+void CDemoDecoder::WriteProp( CTableWriter *pWriter, const SendProp *pProp, const PropValue_t &value )
+{
+	char szValue[64];
+
+	switch ( pProp->GetType() )
+	{
+	case DPT_Int:
+		pWriter->AddInt( value.m_Int );
+		break;
+	case DPT_Float:
+		pWriter->AddFloat( value.m_Float );
+		break;
+	case DPT_Vector:
+		V_snprintf( szValue, sizeof( szValue ), "%.7g %.7g %.7g", value.m_Vector[0], value.m_Vector[1], value.m_Vector[2] );
+		pWriter->AddString( szValue );
+		break;
+	case DPT_VectorXY:
+		V_snprintf( szValue, sizeof( szValue ), "%.7g %.7g", value.m_Vector[0], value.m_Vector[1] );
+		pWriter->AddString( szValue );
+		break;
+	case DPT_String:
+	case DPT_Array:
+		pWriter->AddString( value.m_String.Get() );
+		break;
+#ifdef SUPPORTS_INT64
+	case DPT_Int64:
+		pWriter->AddInt64( value.m_Int64 );
+		break;
+#endif
+	default:
+		pWriter->AddString( "" );
+		break;
+	}
+}
+
+CTableWriter *CDemoDecoder::OpenClassTable( ServerClass_t &serverClass )
+{
+	const CSendTablePrecalc *pPrecalc = serverClass.m_pPrecalc;
+	const int nProps = pPrecalc->GetNumProps();
+
+	// Flat properties of nested tables can share names, prefix the table
+	// which declares them.
+	serverClass.m_PropNames.SetCount( nProps );
+	for ( int iProp = 0; iProp < nProps; iProp++ )
+	{
+		const SendProp *pProp = pPrecalc->GetProp( iProp );
+
+		const char *pszTableName = "";
+		for ( const auto *pTable : m_SendTables )
+		{
+			if ( pProp >= pTable->m_pProps && pProp < pTable->m_pProps + pTable->m_nProps )
+			{
+				pszTableName = pTable->m_pNetTableName;
+				break;
+			}
+		}
+
+		char szColumn[256];
+		V_snprintf( szColumn, sizeof( szColumn ), "%s.%s", pszTableName, pProp->GetName() );
+		serverClass.m_PropNames[iProp] = szColumn;
+	}
+
+	CUtlVector<const char *> columns;
+	columns.EnsureCapacity( nProps + 3 );
+	columns.AddToTail( "tick" );
+	columns.AddToTail( "entity" );
+	columns.AddToTail( "serial" );
+	for ( const auto &name : serverClass.m_PropNames )
+	{
+		columns.AddToTail( name.Get() );
+	}
+
+	return OpenTable( "entities", serverClass.m_Name.Get(), columns );
+}
+
+void CDemoDecoder::WriteEntityRows( const Frame_t &frame )
+{
+	for ( int iEntity : m_ChangedEntities )
+	{
+		// Deleted after it changed.
+		if ( !frame.m_Entities[iEntity] )
+			continue;
+
+		const EntityState_t &entity = *frame.m_Entities[iEntity];
+		ServerClass_t &serverClass = m_ServerClasses[entity.m_iClass];
+		if ( !serverClass.m_bWrite )
+			continue;
+
+		if ( !serverClass.m_pWriter )
+		{
+			serverClass.m_pWriter = OpenClassTable( serverClass );
+		}
+
+		CTableWriter *pWriter = serverClass.m_pWriter;
+		if ( !pWriter->IsOpen() )
+			continue;
+
+		const CSendTablePrecalc *pPrecalc = serverClass.m_pPrecalc;
+
+		pWriter->AddInt( m_nServerTick );
+		pWriter->AddInt( iEntity );
+		pWriter->AddInt( entity.m_nSerial );
+		for ( int iProp = 0; iProp < entity.m_Props.Count(); iProp++ )
+		{
+			WriteProp( pWriter, pPrecalc->GetProp( iProp ), entity.m_Props[iProp] );
+		}
+		pWriter->EndRow();
+
+		++m_Stats.m_nEntityRows;
+	}
+
+	m_ChangedEntities.RemoveAll();
+}
+
+//-----------------------------------------------------------------------------
+// Game events
+//-----------------------------------------------------------------------------
+bool CDemoDecoder::ProcessGameEventList( SVC_GameEventList *msg )
+{
+	for ( auto &descriptor : m_GameEvents )
+	{
+		delete descriptor.m_pWriter;
+	}
+	m_GameEvents.Purge();
+
+	// Same layout CGameEventManager::ParseEventList reads.
+	bf_read &buf = msg->m_DataIn;
+	for ( int i = 0; i < msg->m_nNumEvents; i++ )
+	{
+		const int iEvent = buf.ReadUBitLong( MAX_EVENT_BITS );
+		char szName[MAX_EVENT_NAME_LENGTH];
+		buf.ReadString( szName );
+
+		m_GameEvents.EnsureCount( iEvent + 1 );
+		GameEventDescriptor_t &descriptor = m_GameEvents[iEvent];
+		descriptor.m_Name = szName;
+		descriptor.m_Keys.RemoveAll();
+
+		int nType = buf.ReadUBitLong( 3 );
+		while ( nType != CGameEventManager::TYPE_LOCAL )
+		{
+			GameEventKey_t &key = descriptor.m_Keys[descriptor.m_Keys.AddToTail()];
+			buf.ReadString( szName );
+			key.m_Name = szName;
+			key.m_nType = nType;
+
+			nType = buf.ReadUBitLong( 3 );
+		}
+	}
+
+	return !buf.IsOverflowed();
+}
+
+bool CDemoDecoder::ProcessGameEvent( SVC_GameEvent *msg )
+{
+	if ( !m_Options.m_bEvents )
+		return true;
+
+	// Same layout CGameEventManager::UnserializeEvent reads.
+	bf_read &buf = msg->m_DataIn;
+	const int iEvent = buf.ReadUBitLong( MAX_EVENT_BITS );
+
+	if ( !m_GameEvents.IsValidIndex( iEvent ) || m_GameEvents[iEvent].m_Name.IsEmpty() )
+	{
+		DevMsg( "Unknown game event id %i.\n", iEvent );
+		return true;
+	}
+
+	GameEventDescriptor_t &descriptor = m_GameEvents[iEvent];
+
+	if ( !descriptor.m_pWriter )
+	{
+		CUtlVector<const char *> columns;
+		columns.AddToTail( "tick" );
+		for ( const auto &key : descriptor.m_Keys )
+		{
+			columns.AddToTail( key.m_Name.Get() );
+		}
+
+		descriptor.m_pWriter = OpenTable( "events", descriptor.m_Name.Get(), columns );
+	}
+
+	CTableWriter *pWriter = descriptor.m_pWriter;
+	if ( !pWriter->IsOpen() )
+		return true;
+
+	pWriter->AddInt( m_nServerTick );
+
+	for ( const auto &key : descriptor.m_Keys )
+	{
+		switch ( key.m_nType )
+		{
+		case CGameEventManager::TYPE_STRING:
+			{
+				char szValue[MAX_EVENT_BYTES];
+				buf.ReadString( szValue );
+				pWriter->AddString( szValue );
+			}
+			break;
+		case CGameEventManager::TYPE_FLOAT:
+			pWriter->AddFloat( buf.ReadFloat() );
+			break;
+		case CGameEventManager::TYPE_LONG:
+			pWriter->AddInt( buf.ReadLong() );
+			break;
+		case CGameEventManager::TYPE_SHORT:
+			pWriter->AddInt( buf.ReadShort() );
+			break;
+		case CGameEventManager::TYPE_BYTE:
+			pWriter->AddInt( buf.ReadByte() );
+			break;
+		case CGameEventManager::TYPE_BOOL:
+			pWriter->AddInt( buf.ReadOneBit() );
+			break;
+		default:
+			pWriter->AddString( "" );
+			break;
+		}
+	}
+
+	pWriter->EndRow();
+	++m_Stats.m_nEventRows;
+
+	return true;
+}
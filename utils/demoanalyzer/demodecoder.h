@@ -0,0 +1,237 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Decodes the entities and game events of one demo into tables.
+//
+//=============================================================================//
+
+#ifndef DEMODECODER_H
+#define DEMODECODER_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <memory>
+
+#include "tier0/platform.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/utlstring.h"
+#include "tier1/utlvector.h"
+#include "const.h"
+#include "netmessages.h"
+#include "demonetchannel.h"
+
+class SendTable;
+class CSendTablePrecalc;
+class CTableWriter;
+
+struct DemoDecoderOptions_t
+{
+	const char	*m_pszOutputDir;	// tables go to <m_pszOutputDir>/<demo name>/
+	const CUtlVector<CUtlString> *m_pClassFilter;	// server classes to write, all if NULL or empty
+	bool		m_bEntities;		// write entity tables
+	bool		m_bEvents;			// write game event tables
+};
+
+struct DemoDecoderStats_t
+{
+	int		m_nTicks;
+	int		m_nPackets;
+	int		m_nEntityRows;
+	int		m_nEventRows;
+};
+
+//-----------------------------------------------------------------------------
+// Plays one demo like a client without the client: the data tables of the
+// demo are flattened with the engine's CSendTablePrecalc, entity deltas are
+// decoded with the engine's prop decoders against the same instance and
+// entity baselines CL_CopyNewEntity uses, and game events are unpacked with
+// the descriptors from svc_GameEventList.
+//
+// A demo is read front to back, so a single current state per entity stands
+// in for the CClientFrame history of the client. After every packet the full
+// current state of each entity it touched becomes a row of its server class
+// table (tick, entity, serial, then one column per flat property), and every
+// game event becomes a row of its event table.
+//
+// Decoders share no state, one per worker thread decodes demos in parallel.
+//-----------------------------------------------------------------------------
+class CDemoDecoder : public IServerMessageHandler
+{
+public:
+	explicit CDemoDecoder( const DemoDecoderOptions_t &options );
+	~CDemoDecoder() override;
+
+	// Decodes the demo and writes its tables. Returns false if the demo could
+	// not be read to the end, tables written so far are kept.
+	bool	Decode( const char *pszDemoFile );
+
+	const DemoDecoderStats_t &GetStats() const { return m_Stats; }
+
+	// INetMessageHandler
+	PROCESS_NET_MESSAGE( Tick ) override;
+	PROCESS_NET_MESSAGE( StringCmd ) override { return true; }
+	PROCESS_NET_MESSAGE( SetConVar ) override { return true; }
+	PROCESS_NET_MESSAGE( SignonState ) override { return true; }
+
+	// IServerMessageHandler
+	int GetDemoProtocolVersion() const override { return m_nDemoProtocol; }
+
+	PROCESS_SVC_MESSAGE( Print ) override { return true; }
+	PROCESS_SVC_MESSAGE( ServerInfo ) override;
+	PROCESS_SVC_MESSAGE( SendTable ) override { return true; }
+	PROCESS_SVC_MESSAGE( ClassInfo ) override { return true; }
+	PROCESS_SVC_MESSAGE( SetPause ) override { return true; }
+	PROCESS_SVC_MESSAGE( CreateStringTable ) override;
+	PROCESS_SVC_MESSAGE( UpdateStringTable ) override;
+	PROCESS_SVC_MESSAGE( VoiceInit ) override { return true; }
+	PROCESS_SVC_MESSAGE( VoiceData ) override { return true; }
+	PROCESS_SVC_MESSAGE( Sounds ) override { return true; }
+	PROCESS_SVC_MESSAGE( SetView ) override { return true; }
+	PROCESS_SVC_MESSAGE( FixAngle ) override { return true; }
+	PROCESS_SVC_MESSAGE( CrosshairAngle ) override { return true; }
+	PROCESS_SVC_MESSAGE( BSPDecal ) override { return true; }
+	PROCESS_SVC_MESSAGE( GameEvent ) override;
+	PROCESS_SVC_MESSAGE( UserMessage ) override { return true; }
+	PROCESS_SVC_MESSAGE( EntityMessage ) override { return true; }
+	PROCESS_SVC_MESSAGE( PacketEntities ) override;
+	PROCESS_SVC_MESSAGE( TempEntities ) override { return true; }
+	PROCESS_SVC_MESSAGE( Prefetch ) override { return true; }
+	PROCESS_SVC_MESSAGE( Menu ) override { return true; }
+	PROCESS_SVC_MESSAGE( GameEventList ) override;
+	PROCESS_SVC_MESSAGE( GetCvarValue ) override { return true; }
+	PROCESS_SVC_MESSAGE( CmdKeyValues ) override { return true; }
+	PROCESS_SVC_MESSAGE( SetPauseTimed ) override { return true; }
+
+private:
+	// Decoded value of one flat property.
+	struct PropValue_t
+	{
+		PropValue_t() { memset( m_Vector, 0, sizeof( m_Vector ) ); }
+
+		union
+		{
+			int		m_Int;
+			float	m_Float;
+			float	m_Vector[3];
+			int64	m_Int64;
+		};
+		CUtlString	m_String;	// DPT_String, and DPT_Array elements separated by commas
+	};
+
+	typedef CUtlVector<PropValue_t> PropValues_t;
+
+	struct ServerClass_t
+	{
+		CUtlString			m_Name;
+		CUtlString			m_TableName;
+		CSendTablePrecalc	*m_pPrecalc = nullptr;	// flat property list, NULL if the table is missing
+		CUtlVector<CUtlString>	m_PropNames;	// <table>.<property> column names
+		CTableWriter		*m_pWriter = nullptr;	// created with the first row
+		bool				m_bWrite = false;	// passes the class filter
+		PropValues_t		m_Baseline;		// decoded instance baseline
+		bool				m_bBaselineValid = false;
+	};
+
+	// Decoded entity, never changed once decoded. Frames share the states of
+	// entities which did not change between them.
+	struct EntityState_t
+	{
+		int				m_iClass = -1;
+		int				m_nSerial = 0;
+		PropValues_t	m_Props;
+	};
+
+	typedef std::shared_ptr<const EntityState_t> EntityStatePtr_t;
+
+	// Entities in the PVS after one packet. Client recorded demos delta from
+	// the frame the client acknowledged, which may be several packets old.
+	struct Frame_t
+	{
+		int					m_nTick = -1;	// -1 if unused
+		EntityStatePtr_t	m_Entities[MAX_EDICTS];	// NULL if not in the PVS
+	};
+
+	// Same as the client's MAX_CLIENT_FRAMES.
+	enum { MAX_DELTA_FRAMES = 128 };
+
+	struct EntityBaseline_t
+	{
+		int				m_iClass = -1;		// -1 if there is none
+		PropValues_t	m_Props;
+	};
+
+	struct StringTableEntry_t
+	{
+		CUtlString			m_String;
+		CUtlVector<byte>	m_UserData;
+	};
+
+	struct StringTable_t
+	{
+		CUtlString		m_Name;
+		int				m_nMaxEntries = 0;
+		bool			m_bUserDataFixedSize = false;
+		int				m_nUserDataSize = 0;
+		int				m_nUserDataSizeBits = 0;
+		CUtlVector<StringTableEntry_t>	m_Entries;
+	};
+
+	struct GameEventKey_t
+	{
+		CUtlString		m_Name;
+		int				m_nType = 0;
+	};
+
+	struct GameEventDescriptor_t
+	{
+		CUtlString		m_Name;
+		CUtlVector<GameEventKey_t>	m_Keys;
+		CTableWriter	*m_pWriter = nullptr;	// created with the first row
+	};
+
+	void	CloseTables();
+
+	bool	ParseDataTables( bf_read &buf );
+	bool	LinkDataTables();
+	void	FreeDataTables();
+	SendTable	*FindSendTable( const char *pszName );
+
+	bool	ParseStringTables( bf_read &buf );
+	bool	ParseStringTableUpdate( StringTable_t &table, bf_read &buf, int nEntries );
+	void	SetStringTableEntry( StringTable_t &table, int iEntry, const char *pszString, const void *pUserData, int nBytes );
+	StringTable_t	*FindStringTable( const char *pszName );
+
+	Frame_t	*FindFrame( int nTick );
+	Frame_t	&AllocFrame( int nTick, const Frame_t *pFrom );
+	bool	ReadEnterPVS( bf_read &buf, int iEntity, const SVC_PacketEntities *msg, Frame_t &frame );
+	bool	ReadDelta( bf_read &buf, ServerClass_t &serverClass, PropValues_t &values );
+	const PropValues_t *GetInstanceBaseline( int iClass );
+	void	DecodeProp( bf_read &buf, const SendProp *pProp, PropValue_t &value );
+	void	WriteEntityRows( const Frame_t &frame );
+
+	void	WriteProp( CTableWriter *pWriter, const SendProp *pProp, const PropValue_t &value );
+	CTableWriter	*OpenClassTable( ServerClass_t &serverClass );
+	CTableWriter	*OpenTable( const char *pszSubDir, const char *pszName, const CUtlVector<const char *> &columns );
+
+	DemoDecoderOptions_t	m_Options;
+	DemoDecoderStats_t		m_Stats;
+	char					m_szOutputDir[MAX_PATH];
+
+	CDemoNetChannel			m_NetChannel;
+	CUtlBuffer				m_PacketData;
+	int						m_nDemoProtocol;
+	int						m_nServerTick;
+	int						m_nServerClassBits;
+
+	CUtlVector<SendTable *>			m_SendTables;
+	CUtlVector<ServerClass_t>		m_ServerClasses;
+	CUtlVector<StringTable_t>		m_StringTables;
+	CUtlVector<GameEventDescriptor_t>	m_GameEvents;	// indexed by event id, may have gaps
+	int								m_iInstanceBaselineTable;
+
+	Frame_t					*m_pFrames;				// MAX_DELTA_FRAMES
+	CUtlVector<int>			m_ChangedEntities;		// entered or updated by the current packet
+	EntityBaseline_t		*m_pEntityBaselines[2];	// MAX_EDICTS each
+};
+
+#endif // DEMODECODER_H
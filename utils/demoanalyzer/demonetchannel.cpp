@@ -0,0 +1,105 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Receive only net channel feeding demo packets to message handlers.
+//
+//=============================================================================//
+
+#include "demonetchannel.h"
+
+#include "tier0/dbg.h"
+#include "inetmessage.h"
+#include "protocol.h"
+#include "proto_version.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+CDemoNetChannel::CDemoNetChannel()
+{
+	memset( m_pMessages, 0, sizeof( m_pMessages ) );
+	m_nProtocolVersion = PROTOCOL_VERSION;
+}
+
+CDemoNetChannel::~CDemoNetChannel()
+{
+	RemoveMessages();
+}
+
+void CDemoNetChannel::RemoveMessages()
+{
+	for ( auto *&pMessage : m_pMessages )
+	{
+		delete pMessage;
+		pMessage = nullptr;
+	}
+}
+
+bool CDemoNetChannel::RegisterMessage( INetMessage *msg )
+{
+	const int nType = msg->GetType();
+	if ( nType < 0 || nType >= static_cast<int>( ARRAYSIZE( m_pMessages ) ) || m_pMessages[nType] )
+	{
+		Assert( 0 );
+		return false;
+	}
+
+	msg->SetNetChannel( this );
+	m_pMessages[nType] = msg;
+	return true;
+}
+
+bool CDemoNetChannel::ProcessMessages( bf_read &buf )
+{
+	char string[1024];
+
+	while ( true )
+	{
+		if ( buf.IsOverflowed() )
+		{
+			Warning( "Buffer overflow in demo packet.\n" );
+			return false;
+		}
+
+		// Are we at the end?
+		if ( buf.GetNumBitsLeft() < NETMSG_TYPE_BITS )
+			break;
+
+		const unsigned char cmd = buf.ReadUBitLong( NETMSG_TYPE_BITS );
+
+		if ( cmd == net_NOP )
+			continue;
+
+		if ( cmd == net_Disconnect )
+		{
+			// The server dropped the recording client, nothing follows.
+			buf.ReadString( string );
+			break;
+		}
+
+		if ( cmd == net_File )
+		{
+			(void)buf.ReadUBitLong( 32 );
+			buf.ReadString( string );
+			(void)buf.ReadOneBit();
+			continue;
+		}
+
+		INetMessage *netmsg = m_pMessages[cmd];
+		if ( !netmsg )
+		{
+			Warning( "Unknown net message %i in demo packet.\n", cmd );
+			return false;
+		}
+
+		if ( !netmsg->ReadFromBuffer( buf ) )
+		{
+			Warning( "Failed reading message %s from demo packet.\n", netmsg->GetName() );
+			return false;
+		}
+
+		if ( !netmsg->Process() )
+			return false;
+	}
+
+	return true;
+}
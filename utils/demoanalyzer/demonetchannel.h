@@ -0,0 +1,120 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Receive only net channel feeding demo packets to message handlers.
+//
+//=============================================================================//
+
+#ifndef DEMONETCHANNEL_H
+#define DEMONETCHANNEL_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+#include "tier1/bitbuf.h"
+#include "tier1/netadr.h"
+#include "inetchannel.h"
+#include "net.h"
+
+//-----------------------------------------------------------------------------
+// Net messages read the network protocol of the demo from their channel, so
+// the analyzer needs one even though nothing is ever sent. Messages are
+// registered like on CNetChan and ProcessMessages() walks a demo packet the
+// same way CNetChan::ProcessMessages does, without stats or message blocking.
+// Everything else is a no-op.
+//-----------------------------------------------------------------------------
+class CDemoNetChannel : public INetChannel
+{
+public:
+	CDemoNetChannel();
+	~CDemoNetChannel() override;
+
+	void	SetProtocolVersion( int nProtocol ) { m_nProtocolVersion = nProtocol; }
+
+	// Returns false on a malformed packet or if a handler fails.
+	bool	ProcessMessages( bf_read &buf );
+
+	// Deletes the registered messages.
+	void	RemoveMessages();
+
+	// INetChannelInfo
+	const char	*GetName( void ) const override { return "demo"; }
+	const char	*GetAddress( void ) const override { return "demo"; }
+	float		GetTime( void ) const override { return 0.0f; }
+	float		GetTimeConnected( void ) const override { return 0.0f; }
+	int			GetBufferSize( void ) const override { return 0; }
+	int			GetDataRate( void ) const override { return 0; }
+	bool		IsLoopback( void ) const override { return false; }
+	bool		IsTimingOut( void ) const override { return false; }
+	bool		IsPlayback( void ) const override { return true; }
+	float		GetLatency( int ) const override { return 0.0f; }
+	float		GetAvgLatency( int ) const override { return 0.0f; }
+	float		GetAvgLoss( int ) const override { return 0.0f; }
+	float		GetAvgChoke( int ) const override { return 0.0f; }
+	float		GetAvgData( int ) const override { return 0.0f; }
+	float		GetAvgPackets( int ) const override { return 0.0f; }
+	int			GetTotalData( int ) const override { return 0; }
+	int			GetSequenceNr( int ) const override { return 0; }
+	bool		IsValidPacket( int, int ) const override { return true; }
+	float		GetPacketTime( int, int ) const override { return 0.0f; }
+	int			GetPacketBytes( int, int, int ) const override { return 0; }
+	bool		GetStreamProgress( int, int *, int * ) const override { return false; }
+	float		GetTimeSinceLastReceived( void ) const override { return 0.0f; }
+	float		GetCommandInterpolationAmount( int, int ) const override { return 0.0f; }
+	void		GetPacketResponseLatency( int, int, int *pnLatencyMsecs, int *pnChoke ) const override { *pnLatencyMsecs = 0; *pnChoke = 0; }
+	void		GetRemoteFramerate( float *pflFrameTime, float *pflFrameTimeStdDeviation ) const override { *pflFrameTime = 0.0f; *pflFrameTimeStdDeviation = 0.0f; }
+	float		GetTimeoutSeconds() const override { return 0.0f; }
+
+	// INetChannel
+	void	SetDataRate( float ) override {}
+	bool	RegisterMessage( INetMessage *msg ) override;
+	bool	StartStreaming( unsigned int ) override { return false; }
+	void	ResetStreaming( void ) override {}
+	void	SetTimeout( float ) override {}
+	void	SetDemoRecorder( IDemoRecorder * ) override {}
+	void	SetChallengeNr( unsigned int ) override {}
+	void	Reset( void ) override {}
+	void	Clear( void ) override {}
+	void	Shutdown( const char * ) override {}
+	void	ProcessPlayback( void ) override {}
+	bool	ProcessStream( void ) override { return true; }
+	void	ProcessPacket( struct netpacket_s *, bool ) override {}
+	bool	SendNetMsg( INetMessage &, bool = false, bool = false ) override { return false; }
+	bool	SendData( bf_write &, bool = true ) override { return false; }
+	bool	SendFile( const char *, unsigned int ) override { return false; }
+	void	DenyFile( const char *, unsigned int ) override {}
+	void	RequestFile_OLD( const char *, unsigned int ) override {}
+	void	SetChoked( void ) override {}
+	int		SendDatagram( bf_write * ) override { return 0; }
+	bool	Transmit( bool = false ) override { return false; }
+	const netadr_t	&GetRemoteAddress( void ) const override { return m_Address; }
+	INetChannelHandler *GetMsgHandler( void ) const override { return nullptr; }
+	int		GetDropNumber( void ) const override { return 0; }
+	intp	GetSocket( void ) const override { return -1; }
+	unsigned int	GetChallengeNr( void ) const override { return 0; }
+	void	GetSequenceData( int &nOutSequenceNr, int &nInSequenceNr, int &nOutSequenceNrAck ) override { nOutSequenceNr = nInSequenceNr = nOutSequenceNrAck = 0; }
+	void	SetSequenceData( int, int, int ) override {}
+	void	UpdateMessageStats( int, int ) override {}
+	bool	CanPacket( void ) const override { return false; }
+	bool	IsOverflowed( void ) const override { return false; }
+	bool	IsTimedOut( void ) const override { return false; }
+	bool	HasPendingReliableData( void ) override { return false; }
+	void	SetFileTransmissionMode( bool ) override {}
+	void	SetCompressionMode( bool ) override {}
+	unsigned int RequestFile( const char * ) override { return 0; }
+	void	SetMaxBufferSize( bool, int, bool = false ) override {}
+	bool	IsNull() const override { return false; }
+	int		GetNumBitsWritten( bool ) override { return 0; }
+	void	SetInterpolationAmount( float ) override {}
+	void	SetRemoteFramerate( float, float ) override {}
+	void	SetMaxRoutablePayloadSize( int ) override {}
+	int		GetMaxRoutablePayloadSize() override { return NET_MAX_PAYLOAD; }
+	int		GetProtocolVersion() override { return m_nProtocolVersion; }
+
+private:
+	INetMessage	*m_pMessages[ 1 << NETMSG_TYPE_BITS ];
+	netadr_t	m_Address;
+	int			m_nProtocolVersion;
+};
+
+#endif // DEMONETCHANNEL_H
@@ -0,0 +1,143 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Buffered tab separated table output of the demo analyzer.
+//
+//=============================================================================//
+
+#include "tablewriter.h"
+
+#include "tier0/dbg.h"
+#include "tier1/strtools.h"
+#include "cmdlib.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+extern IBaseFileSystem *g_pFileSystem;
+
+CTableWriter::CTableWriter()
+{
+	m_hFile = FILESYSTEM_INVALID_HANDLE;
+	m_nColumn = 0;
+	m_nRows = 0;
+}
+
+CTableWriter::~CTableWriter()
+{
+	Close();
+}
+
+bool CTableWriter::Open( const char *pszFileName, const CUtlVector<const char *> &columns )
+{
+	Assert( !IsOpen() );
+
+	char szPath[MAX_PATH];
+	V_strcpy_safe( szPath, pszFileName );
+	V_FixSlashes( szPath );
+	CreatePath( szPath );
+
+	m_hFile = g_pFileSystem->Open( szPath, "wb" );
+	if ( m_hFile == FILESYSTEM_INVALID_HANDLE )
+	{
+		Warning( "Couldn't open %s for writing.\n", szPath );
+		return false;
+	}
+
+	m_Buffer.EnsureCapacity( FLUSH_SIZE + 64 * 1024 );
+	m_nColumn = 0;
+	m_nRows = 0;
+
+	for ( auto *pszColumn : columns )
+	{
+		AddString( pszColumn );
+	}
+	EndRow();
+
+	// The header is not a record.
+	m_nRows = 0;
+	return true;
+}
+
+void CTableWriter::Close()
+{
+	if ( !IsOpen() )
+		return;
+
+	Assert( m_nColumn == 0 );
+
+	Flush();
+	g_pFileSystem->Close( m_hFile );
+	m_hFile = FILESYSTEM_INVALID_HANDLE;
+	m_Buffer.Purge();
+}
+
+void CTableWriter::NextColumn()
+{
+	if ( m_nColumn++ )
+	{
+		m_Buffer.PutChar( '\t' );
+	}
+}
+
+void CTableWriter::AddInt( int nValue )
+{
+	char szValue[16];
+	const int nLength = V_snprintf( szValue, sizeof( szValue ), "%d", nValue );
+
+	NextColumn();
+	m_Buffer.Put( szValue, nLength );
+}
+
+void CTableWriter::AddInt64( int64 nValue )
+{
+	char szValue[32];
+	const int nLength = V_snprintf( szValue, sizeof( szValue ), "%lld", static_cast<long long>( nValue ) );
+
+	NextColumn();
+	m_Buffer.Put( szValue, nLength );
+}
+
+void CTableWriter::AddFloat( float flValue )
+{
+	char szValue[32];
+	const int nLength = V_snprintf( szValue, sizeof( szValue ), "%.7g", flValue );
+
+	NextColumn();
+	m_Buffer.Put( szValue, nLength );
+}
+
+void CTableWriter::AddString( const char *pszValue )
+{
+	NextColumn();
+
+	for ( const char *p = pszValue; *p; ++p )
+	{
+		const char c = *p;
+		m_Buffer.PutChar( ( c == '\t' || c == '\n' || c == '\r' ) ? ' ' : c );
+	}
+}
+
+void CTableWriter::EndRow()
+{
+	Assert( IsOpen() );
+
+	m_Buffer.PutChar( '\n' );
+	m_nColumn = 0;
+	++m_nRows;
+
+	if ( m_Buffer.TellPut() >= FLUSH_SIZE )
+	{
+		Flush();
+	}
+}
+
+void CTableWriter::Flush()
+{
+	const int nBytes = static_cast<int>( m_Buffer.TellPut() );
+	if ( nBytes && g_pFileSystem->Write( m_Buffer.Base(), nBytes, m_hFile ) != nBytes )
+	{
+		Warning( "Failed writing %d bytes of table data.\n", nBytes );
+	}
+
+	m_Buffer.Clear();
+}
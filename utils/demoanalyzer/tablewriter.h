@@ -0,0 +1,55 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Buffered tab separated table output of the demo analyzer.
+//
+//=============================================================================//
+
+#ifndef TABLEWRITER_H
+#define TABLEWRITER_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/utlvector.h"
+#include "filesystem.h"
+
+//-----------------------------------------------------------------------------
+// One table file: a header row with the column names, then one row per
+// record. Rows are formatted into memory and written in large blocks, a demo
+// produces millions of short rows.
+//-----------------------------------------------------------------------------
+class CTableWriter
+{
+public:
+	CTableWriter();
+	~CTableWriter();
+
+	// Creates the file and missing directories, and writes the header row.
+	bool	Open( const char *pszFileName, const CUtlVector<const char *> &columns );
+	void	Close();
+
+	bool	IsOpen() const { return m_hFile != FILESYSTEM_INVALID_HANDLE; }
+	int		GetNumRows() const { return m_nRows; }
+
+	void	AddInt( int nValue );
+	void	AddInt64( int64 nValue );
+	void	AddFloat( float flValue );
+	// Tabs and line breaks in the value are written as spaces.
+	void	AddString( const char *pszValue );
+	void	EndRow();
+
+private:
+	enum { FLUSH_SIZE = 1024 * 1024 };
+
+	void	NextColumn();
+	void	Flush();
+
+	FileHandle_t	m_hFile;
+	CUtlBuffer		m_Buffer;
+	int				m_nColumn;
+	int				m_nRows;
+};
+
+#endif // TABLEWRITER_H
@@ -143,6 +143,16 @@ void ParseSmoothingInfo(CToolDemoFile &demoFile,
           demoFile.ReadUserCmd(NULL, dummy);
 
         } break;
+        case dem_stringtables: {
+          demoFile.ReadRawData(NULL, 0);
+        } break;
+        case dem_keyframe: {
+          // string tables, then a full update packet only used to seek
+          demoFile.ReadRawData(NULL, 0);
+          demoFile.ReadCmdInfo(info);
+          demoFile.ReadSequenceInfo(dummy, dummy);
+          demoFile.ReadRawData(NULL, 0);
+        } break;
         default: {
           swallowmessages = false;
         } break;
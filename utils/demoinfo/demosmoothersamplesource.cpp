@@ -2553,6 +2553,20 @@ void CDemoSmootherPanel::ParseSmoothingInfo( CDemoFile &demoFile, CUtlVector< de
 					
 				}
 				break;
+			case dem_stringtables:
+				{
+					demoFile.ReadRawData( NULL, 0 );
+				}
+				break;
+			case dem_keyframe:
+				{
+					// string tables, then a full update packet only used to seek
+					demoFile.ReadRawData( NULL, 0 );
+					demoFile.ReadCmdInfo( info );
+					demoFile.ReadSequenceInfo( dummy, dummy );
+					demoFile.ReadRawData( NULL, 0 );
+				}
+				break;
 			default:
 				{
 					swallowmessages = false;
@@ -195,6 +195,39 @@ int CToolDemoFile::ReadRawData( char *buffer, int length )
 	return size;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Reads a data block without knowing its size up front
+//-----------------------------------------------------------------------------
+int CToolDemoFile::ReadRawData( CUtlBuffer &buf )
+{
+	Assert( m_hDemoFile != FILESYSTEM_INVALID_HANDLE );
+
+	int size;
+
+	// read length of data block
+	g_pFileSystem->Read( size, m_hDemoFile );
+
+	buf.Clear();
+
+	if ( size < 0 )
+	{
+		Warning( "Bad demo message data length %i.\n", size );
+		return -1;
+	}
+
+	buf.EnsureCapacity( size );
+
+	int r = g_pFileSystem->Read( buf.Base(), size, m_hDemoFile );
+	if ( r != size )
+	{
+		Warning( "Error reading demo message data.\n");
+		return -1;
+	}
+
+	buf.SeekPut( CUtlBuffer::SEEK_HEAD, size );
+	return size;
+}
+
 demoheader_t *CToolDemoFile::ReadDemoHeader()
 {
 	if ( m_hDemoFile == FILESYSTEM_INVALID_HANDLE )
@@ -229,7 +262,7 @@ demoheader_t *CToolDemoFile::ReadDemoHeader()
 	}
 	*/
 
-	if ( m_DemoHeader.demoprotocol != DEMO_PROTOCOL )
+	if ( m_DemoHeader.demoprotocol < DEMO_PROTOCOL_LINEAR || m_DemoHeader.demoprotocol > DEMO_PROTOCOL )
 	{
 		Warning ("ERROR: demo file protocol %i outdated, engine version is %i \n", 
 			m_DemoHeader.demoprotocol, DEMO_PROTOCOL );
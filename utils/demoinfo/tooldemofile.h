@@ -33,6 +33,8 @@ public:
 	int GetSize();
 
 	int		ReadRawData( char *buffer, int length );
+	// Reads a data block of any size, buf is cleared first. Returns the size or -1.
+	int		ReadRawData( CUtlBuffer &buf );
 
 	void	ReadSequenceInfo(int &nSeqNrIn, int &nSeqNrOutAck);
 
@@ -0,0 +1,836 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Keeps the direct lighting and transfers of the last run so the
+//			next run only relights the faces whose lights or occluders changed.
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "lightmap.h"
+#include "lightcache.h"
+#include "bsptreedata.h"
+#include "bspflags.h"
+#include "collisionutils.h"
+#include "filesystem.h"
+#include "tier1/generichash.h"
+
+#include <algorithm>
+
+// Layout of a .vrc file:
+//	header
+//	numcells * LightCacheCell_t
+//	numfaces * ( LightCacheFace_t, direct lighting )
+//	numpatches * ( numtransfers, transferbytes, packed transfers )
+#define LIGHTCACHE_ID		(('1'<<24)+('C'<<16)+('R'<<8)+'V')
+#define LIGHTCACHE_VERSION	1
+
+// Size of the cells occluders are hashed into.
+#define LIGHTCACHE_CELL_SIZE	128.0f
+
+// Past this many changed cells it's cheaper to relight everything.
+#define LIGHTCACHE_MAX_CHANGED_CELLS	1024
+
+extern float luxeldensity;
+extern float minchop;
+extern std::atomic_int total_transfer;
+extern std::atomic_int max_transfer;
+extern std::atomic<int64> total_transfer_bytes;
+
+CLightCache *g_pLightCache = nullptr;
+
+namespace
+{
+
+struct LightCacheHeader_t
+{
+	int		m_nId;
+	int		m_nVersion;
+	uint64	m_nSettings;
+	uint64	m_nTransfers;		// Key of the transfers, see CLightCache::TransferKey
+	int		m_nCells;
+	int		m_nFaces;
+	int		m_nPatches;			// 0 if there are no transfers
+	int		m_nPad;
+};
+
+struct LightCacheFace_t
+{
+	uint64	m_nKey;
+	uint64	m_nReach;
+	int		m_nSamples;
+	int		m_nNormals;
+	byte	m_Styles[MAXLIGHTMAPS];
+};
+
+template <typename T>
+void PutValue( CUtlBuffer &buf, const T &value )
+{
+	buf.Put( &value, sizeof( value ) );
+}
+
+uint64 HashBuffer( const CUtlBuffer &buf )
+{
+	return MurmurHash64( buf.Base(), static_cast<int>( buf.TellPut() ), LIGHTCACHE_VERSION );
+}
+
+uint64 CellKey( const Vector &vecPoint )
+{
+	uint64 nKey = 0;
+	for ( int i = 0; i < 3; i++ )
+	{
+		const int nCell = static_cast<int>( floorf( vecPoint[i] * ( 1.0f / LIGHTCACHE_CELL_SIZE ) ) );
+		nKey = ( nKey << 21 ) | ( static_cast<uint64>( nCell + ( 1 << 20 ) ) & 0x1fffff );
+	}
+	return nKey;
+}
+
+int StyleCount( const byte *pStyles )
+{
+	int nStyles = 0;
+	while ( nStyles < MAXLIGHTMAPS && pStyles[nStyles] != 255 )
+	{
+		nStyles++;
+	}
+	return nStyles;
+}
+
+// Clusters of the non solid leaves in a box.
+class CClusterList : public ISpatialLeafEnumerator
+{
+public:
+	bool EnumerateLeaf( int leaf, intp context ) override
+	{
+		const dleaf_t &l = dleafs[leaf];
+		if ( l.cluster >= 0 && !( l.contents & CONTENTS_SOLID ) && m_Clusters.Find( l.cluster ) < 0 )
+		{
+			m_Clusters.AddToTail( l.cluster );
+		}
+		return true;
+	}
+
+	CUtlVectorFixedGrowable<int, 64> m_Clusters;
+};
+
+}  // namespace
+
+
+CLightCache::CLightCache() :
+	m_nSettings( 0 ), m_nOccluders( 0 ), m_nTransfers( 0 ), m_bOccludersChanged( false ),
+	m_vecWorldMins( vec3_origin ), m_vecWorldMaxs( vec3_origin ), m_pszCacheFilename( nullptr ),
+	m_nOldTransfers( -1 ), m_nOldTransferKey( 0 ), m_nOldPatches( 0 ), m_nRestored( 0 ), m_nRelit( 0 )
+{
+}
+
+
+//-----------------------------------------------------------------------------
+// Sums the triangle hashes per cell, a triangle goes in the cell of its center.
+//-----------------------------------------------------------------------------
+void CLightCache::HashOccluders()
+{
+	const intp nTriangles = g_RtEnv.OptimizedTriangleList.Count();
+	const bool bMaterials = g_RtEnv.TriangleMaterials.Count() == nTriangles;
+
+	CUtlVector<Cell_t> triangles;
+	triangles.SetCount( nTriangles );
+
+	m_nOccluders = 0;
+	ClearBounds( m_vecWorldMins, m_vecWorldMaxs );
+	for ( intp i = 0; i < nTriangles; i++ )
+	{
+		const TriGeometryData_t &tri = g_RtEnv.OptimizedTriangleList[i].m_Data.m_GeometryData;
+		const uint32 nSeed = tri.m_nFlags | ( bMaterials ? static_cast<uint32>( g_RtEnv.TriangleMaterials[i] ) << 8 : 0 );
+
+		Cell_t &cell = triangles[i];
+		cell.m_nHash = MurmurHash64( tri.m_VertexCoordData, sizeof( tri.m_VertexCoordData ), nSeed );
+
+		ClearBounds( cell.m_vecMins, cell.m_vecMaxs );
+		for ( int j = 0; j < 3; j++ )
+		{
+			AddPointToBounds( Vector( tri.m_VertexCoordData[j * 3], tri.m_VertexCoordData[j * 3 + 1], tri.m_VertexCoordData[j * 3 + 2] ),
+				cell.m_vecMins, cell.m_vecMaxs );
+		}
+		cell.m_nKey = CellKey( ( cell.m_vecMins + cell.m_vecMaxs ) * 0.5f );
+
+		m_nOccluders += cell.m_nHash;
+		AddPointToBounds( cell.m_vecMins, m_vecWorldMins, m_vecWorldMaxs );
+		AddPointToBounds( cell.m_vecMaxs, m_vecWorldMins, m_vecWorldMaxs );
+	}
+
+	std::sort( triangles.begin(), triangles.end(),
+		[]( const Cell_t &a, const Cell_t &b ) { return a.m_nKey < b.m_nKey; } );
+
+	m_Cells.RemoveAll();
+	for ( const Cell_t &tri : triangles )
+	{
+		if ( m_Cells.Count() && m_Cells.Tail().m_nKey == tri.m_nKey )
+		{
+			Cell_t &cell = m_Cells.Tail();
+			cell.m_nHash += tri.m_nHash;
+			VectorMin( cell.m_vecMins, tri.m_vecMins, cell.m_vecMins );
+			VectorMax( cell.m_vecMaxs, tri.m_vecMaxs, cell.m_vecMaxs );
+		}
+		else
+		{
+			m_Cells.AddToTail( tri );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Everything on the command line that changes the direct lighting or the
+// transfers. Any difference relights the whole map.
+//-----------------------------------------------------------------------------
+uint64 CLightCache::SettingsHash() const
+{
+	CUtlBuffer buf;
+	PutValue( buf, g_bHDR );
+	PutValue( buf, do_extra );
+	PutValue( buf, extrapasses );
+	PutValue( buf, do_fast );
+	PutValue( buf, do_centersamples );
+	PutValue( buf, debug_extra );
+	PutValue( buf, dlight_map );
+	PutValue( buf, g_flSkySampleScale );
+	PutValue( buf, g_SunAngularExtent );
+	PutValue( buf, g_sunSamplesAreaLight );
+	PutValue( buf, smoothing_threshold );
+	PutValue( buf, luxeldensity );
+	PutValue( buf, g_bTextureShadows );
+	PutValue( buf, g_bStaticPropPolys );
+	PutValue( buf, g_bDisablePropSelfShadowing );
+	PutValue( buf, g_bLargeDispSampleRadius );
+	PutValue( buf, g_flMaxDispSampleSize );
+	PutValue( buf, g_bNoSkyRecurse );
+	PutValue( buf, minchop );
+	PutValue( buf, maxchop );
+	PutValue( buf, dispchop );
+	PutValue( buf, g_MaxDispPatchRadius );
+
+	PutValue( buf, num_sky_cameras );
+	buf.Put( sky_cameras, num_sky_cameras * static_cast<int>( sizeof( sky_camera_t ) ) );
+	buf.Put( area_sky_cameras, numareas * static_cast<int>( sizeof( area_sky_cameras[0] ) ) );
+
+	return HashBuffer( buf );
+}
+
+
+//-----------------------------------------------------------------------------
+// Hashes what the gather sees of the face: its samples, the vertex normals
+// they get smoothed with and the vectors bumped normals are built from.
+//-----------------------------------------------------------------------------
+uint64 CLightCache::FaceKey( const lightinfo_t &l, const facelight_t *fl, int nNormals ) const
+{
+	const texinfo_t *tx = &texinfo[l.face->texinfo];
+
+	CUtlBuffer buf;
+	PutValue( buf, nNormals );
+	PutValue( buf, l.isflat );
+	PutValue( buf, l.facenormal );
+	PutValue( buf, l.modelorg );
+	PutValue( buf, l.luxelOrigin );
+	PutValue( buf, l.worldToLuxelSpace );
+	PutValue( buf, l.luxelToWorldSpace );
+	PutValue( buf, tx->flags );
+	PutValue( buf, tx->textureVecsTexelsPerWorldUnits );
+	PutValue( buf, l.face->m_LightmapTextureMinsInLuxels );
+	PutValue( buf, l.face->m_LightmapTextureSizeInLuxels );
+	PutValue( buf, ValidDispFace( l.face ) );
+
+	if ( !l.isflat )
+	{
+		const faceneighbor_t *fn = &faceneighbor[l.facenum];
+		buf.Put( fn->normal, l.face->numedges * static_cast<int>( sizeof( Vector ) ) );
+	}
+
+	PutValue( buf, fl->numsamples );
+	PutValue( buf, fl->worldAreaPerLuxel );
+	for ( int i = 0; i < fl->numsamples; i++ )
+	{
+		const sample_t &sample = fl->sample[i];
+		PutValue( buf, sample.s );
+		PutValue( buf, sample.t );
+		PutValue( buf, sample.coord );
+		PutValue( buf, sample.mins );
+		PutValue( buf, sample.maxs );
+		PutValue( buf, sample.pos );
+		PutValue( buf, sample.normal );
+		PutValue( buf, sample.area );
+	}
+
+	return HashBuffer( buf );
+}
+
+
+//-----------------------------------------------------------------------------
+// Transfers only depend on the patches, what blocks the rays between them
+// and vis.
+//-----------------------------------------------------------------------------
+uint64 CLightCache::TransferKey() const
+{
+	CUtlBuffer buf;
+	PutValue( buf, m_nOccluders );
+	PutValue( buf, visdatasize );
+	buf.Put( dvisdata, visdatasize );
+
+	PutValue( buf, g_Patches.Count() );
+	for ( const CPatch &patch : g_Patches )
+	{
+		PutValue( buf, patch.origin );
+		PutValue( buf, patch.normal );
+		PutValue( buf, patch.plane->normal );
+		PutValue( buf, patch.plane->dist );
+		PutValue( buf, patch.planeDist );
+		PutValue( buf, patch.area );
+		PutValue( buf, patch.mins );
+		PutValue( buf, patch.maxs );
+		PutValue( buf, patch.face_mins );
+		PutValue( buf, patch.face_maxs );
+		PutValue( buf, patch.faceNumber );
+		PutValue( buf, patch.clusterNumber );
+		PutValue( buf, patch.parent );
+		PutValue( buf, patch.child1 );
+		PutValue( buf, patch.child2 );
+		PutValue( buf, patch.ndxNextClusterChild );
+		PutValue( buf, static_cast<int>( patch.sky ) );
+		if ( patch.winding )
+		{
+			buf.Put( patch.winding->p, patch.winding->numpoints * static_cast<int>( sizeof( Vector ) ) );
+		}
+	}
+
+	return HashBuffer( buf );
+}
+
+
+void CLightCache::Init( const char *pszCacheFilename )
+{
+	m_pszCacheFilename = pszCacheFilename;
+	m_nSettings = SettingsHash();
+	m_nTransfers = TransferKey();
+
+	m_NewFaces.SetCount( numfaces );
+	for ( Face_t &face : m_NewFaces )
+	{
+		face.m_nNormals = 0;
+	}
+
+	// The cluster, texinfo and owner of a light are just indices, the rest of
+	// it is what the gather sees.
+	m_LightKeys.SetCount( numdlights );
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		CUtlBuffer buf;
+		dworldlight_t light = dl->light;
+		light.cluster = light.texinfo = light.owner = 0;
+		PutValue( buf, light );
+		PutValue( buf, dl->facenum == -1 );
+		PutValue( buf, dl->m_flStartFadeDistance );
+		PutValue( buf, dl->m_flEndFadeDistance );
+		PutValue( buf, dl->m_flCapDist );
+
+		m_LightKeys[dl->index] = HashBuffer( buf );
+	}
+
+	m_ChangedCells.RemoveAll();
+	m_bOccludersChanged = false;
+	m_nOldTransfers = -1;
+
+	if ( !g_pFileSystem->ReadFile( m_pszCacheFilename, NULL, m_Buffer ) )
+	{
+		Msg( "No lighting cache %s, lighting all faces.\n", m_pszCacheFilename );
+		return;
+	}
+
+	LightCacheHeader_t header;
+	m_Buffer.Get( &header, sizeof( header ) );
+	if ( !m_Buffer.IsValid() || header.m_nId != LIGHTCACHE_ID || header.m_nVersion != LIGHTCACHE_VERSION ||
+		header.m_nCells < 0 || header.m_nFaces < 0 || header.m_nPatches < 0 )
+	{
+		Warning( "Ignoring lighting cache %s, unknown format.\n", m_pszCacheFilename );
+		m_Buffer.Purge();
+		return;
+	}
+
+	if ( header.m_nSettings != m_nSettings )
+	{
+		Msg( "Lighting settings changed since %s was written, lighting all faces.\n", m_pszCacheFilename );
+		m_Buffer.Purge();
+		return;
+	}
+
+	CUtlVector<Cell_t> oldCells;
+	oldCells.SetCount( header.m_nCells );
+	m_Buffer.Get( oldCells.Base(), header.m_nCells * static_cast<int>( sizeof( Cell_t ) ) );
+	if ( !m_Buffer.IsValid() )
+	{
+		Warning( "Ignoring lighting cache %s, file is truncated.\n", m_pszCacheFilename );
+		m_Buffer.Purge();
+		return;
+	}
+
+	// Both lists are sorted by key. A cell that was added, removed or
+	// changed covers the triangles it had before and has now.
+	for ( intp i = 0, j = 0; i < oldCells.Count() || j < m_Cells.Count(); )
+	{
+		Box_t box;
+		if ( j == m_Cells.Count() || ( i < oldCells.Count() && oldCells[i].m_nKey < m_Cells[j].m_nKey ) )
+		{
+			box.m_vecMins = oldCells[i].m_vecMins;
+			box.m_vecMaxs = oldCells[i].m_vecMaxs;
+			i++;
+		}
+		else if ( i == oldCells.Count() || m_Cells[j].m_nKey < oldCells[i].m_nKey )
+		{
+			box.m_vecMins = m_Cells[j].m_vecMins;
+			box.m_vecMaxs = m_Cells[j].m_vecMaxs;
+			j++;
+		}
+		else
+		{
+			const Cell_t &oldCell = oldCells[i++];
+			const Cell_t &cell = m_Cells[j++];
+			if ( oldCell.m_nHash == cell.m_nHash )
+				continue;
+
+			VectorMin( oldCell.m_vecMins, cell.m_vecMins, box.m_vecMins );
+			VectorMax( oldCell.m_vecMaxs, cell.m_vecMaxs, box.m_vecMaxs );
+		}
+		m_ChangedCells.AddToTail( box );
+	}
+
+	if ( m_ChangedCells.Count() > LIGHTCACHE_MAX_CHANGED_CELLS )
+	{
+		Msg( "%zd occluder cells changed since %s was written, relighting all shadowed faces.\n",
+			m_ChangedCells.Count(), m_pszCacheFilename );
+		m_bOccludersChanged = true;
+	}
+
+	if ( !LoadFaces( header.m_nFaces ) )
+	{
+		Warning( "Ignoring lighting cache %s, file is truncated.\n", m_pszCacheFilename );
+		m_OldFaces.RemoveAll();
+		m_Buffer.Purge();
+		return;
+	}
+
+	if ( header.m_nPatches )
+	{
+		m_nOldTransfers = m_Buffer.TellGet();
+		m_nOldTransferKey = header.m_nTransfers;
+		m_nOldPatches = header.m_nPatches;
+	}
+
+	Msg( "Lighting cache: %zd faces, %zd occluder cells changed.\n", m_OldFaces.Count(), m_ChangedCells.Count() );
+}
+
+
+//-----------------------------------------------------------------------------
+// Indexes the face records, they're read straight out of m_Buffer by the
+// lighting threads.
+//-----------------------------------------------------------------------------
+bool CLightCache::LoadFaces( int nFaces )
+{
+	m_OldFaces.RemoveAll();
+	m_OldFaces.EnsureCapacity( nFaces );
+
+	for ( int i = 0; i < nFaces; i++ )
+	{
+		const intp nOffset = m_Buffer.TellGet();
+
+		LightCacheFace_t face;
+		m_Buffer.Get( &face, sizeof( face ) );
+		if ( !m_Buffer.IsValid() || face.m_nSamples < 0 || face.m_nNormals < 1 || face.m_nNormals > NUM_BUMP_VECTS + 1 )
+			return false;
+
+		const intp nBytes = static_cast<intp>( StyleCount( face.m_Styles ) ) * face.m_nNormals * face.m_nSamples * sizeof( LightingValue_t );
+		if ( nBytes > m_Buffer.GetBytesRemaining() )
+			return false;
+
+		m_Buffer.SeekGet( CUtlBuffer::SEEK_CURRENT, nBytes );
+
+		FaceHash_t &hash = m_OldFaces[m_OldFaces.AddToTail()];
+		hash.m_nHash = face.m_nKey;
+		hash.m_nOffset = nOffset;
+	}
+
+	// Faces that hash the same can't be told apart, drop them.
+	std::sort( m_OldFaces.begin(), m_OldFaces.end() );
+
+	intp nUnique = 0;
+	for ( intp i = 0; i < m_OldFaces.Count(); )
+	{
+		intp j = i + 1;
+		while ( j < m_OldFaces.Count() && m_OldFaces[j].m_nHash == m_OldFaces[i].m_nHash )
+		{
+			j++;
+		}
+		if ( j == i + 1 )
+		{
+			m_OldFaces[nUnique++] = m_OldFaces[i];
+		}
+		i = j;
+	}
+	m_OldFaces.SetCountNonDestructively( nUnique );
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Could a change in the occluders between the face and the light change its
+// shadow? Every ray from the light to the face stays inside the box around
+// both, sky rays inside the face swept toward the sky.
+//-----------------------------------------------------------------------------
+bool CLightCache::IsShadowChanged( const directlight_t *dl, const lightinfo_t &l, const Vector &vecMins, const Vector &vecMaxs ) const
+{
+	if ( m_bOccludersChanged )
+		return true;
+
+	if ( !m_ChangedCells.Count() )
+		return false;
+
+	// Sky rays continue in the 3d skybox.
+	const bool bSkyRecurse = num_sky_cameras && !g_bNoSkyRecurse;
+
+	Vector vecBoxMins = vecMins;
+	Vector vecBoxMaxs = vecMaxs;
+	switch ( dl->light.type )
+	{
+	case emit_surface:
+	case emit_point:
+	case emit_spotlight:
+		AddPointToBounds( dl->light.origin, vecBoxMins, vecBoxMaxs );
+		break;
+
+	case emit_skylight:
+		{
+			if ( bSkyRecurse )
+				return true;
+
+			const float flLength = m_vecWorldMins.DistTo( m_vecWorldMaxs );
+			const Vector vecSweep = dl->light.normal * -flLength;
+			AddPointToBounds( vecMins + vecSweep, vecBoxMins, vecBoxMaxs );
+			AddPointToBounds( vecMaxs + vecSweep, vecBoxMins, vecBoxMaxs );
+
+			// Soft sun rays are jittered around the sun direction.
+			const float flJitter = flLength * g_SunAngularExtent + 1.0f;
+			const Vector vecJitter( flJitter, flJitter, flJitter );
+			vecBoxMins -= vecJitter;
+			vecBoxMaxs += vecJitter;
+		}
+		break;
+
+	case emit_skyambient:
+		{
+			// Flat faces only shoot rays in front of them.
+			if ( bSkyRecurse || !l.isflat || ValidDispFace( l.face ) )
+				return true;
+
+			const float flFaceDist = DotProduct( l.facenormal, vecMins + vecMaxs ) * 0.5f;
+			const float flExtent = 0.5f * ( fabsf( l.facenormal.x ) * ( vecMaxs.x - vecMins.x ) +
+				fabsf( l.facenormal.y ) * ( vecMaxs.y - vecMins.y ) + fabsf( l.facenormal.z ) * ( vecMaxs.z - vecMins.z ) );
+			for ( const Box_t &box : m_ChangedCells )
+			{
+				float flMaxDist = 0;
+				for ( int i = 0; i < 3; i++ )
+				{
+					flMaxDist += l.facenormal[i] * ( l.facenormal[i] > 0 ? box.m_vecMaxs[i] : box.m_vecMins[i] );
+				}
+				if ( flMaxDist >= flFaceDist - flExtent )
+					return true;
+			}
+		}
+		return false;
+
+	default:
+		return true;
+	}
+
+	for ( const Box_t &box : m_ChangedCells )
+	{
+		if ( IsBoxIntersectingBox( vecBoxMins, vecBoxMaxs, box.m_vecMins, box.m_vecMaxs ) )
+			return true;
+	}
+	return false;
+}
+
+
+//-----------------------------------------------------------------------------
+// A light reaches the face if it can see one of the clusters the samples or
+// supersamples of the face can be in. Returns false if the shadow of one of
+// them may have changed.
+//-----------------------------------------------------------------------------
+bool CLightCache::LightsReachingFace( const lightinfo_t &l, const facelight_t *fl, uint64 &nReach ) const
+{
+	// Supersamples spread over the luxel around each sample, and everything is
+	// lit from a unit off the face.
+	const float flMargin = 1.5f * sqrtf( fl->worldAreaPerLuxel ) + 2.0f;
+
+	Vector vecMins, vecMaxs;
+	ClearBounds( vecMins, vecMaxs );
+
+	CClusterList clusters;
+	bool bAllClusters = false;
+	for ( int i = 0; i < fl->numsamples; i++ )
+	{
+		AddPointToBounds( fl->sample[i].pos, vecMins, vecMaxs );
+
+		// Samples outside the world see every light, see PVSCheck.
+		const int nCluster = ClusterFromPoint( fl->sample[i].pos );
+		if ( nCluster < 0 )
+		{
+			bAllClusters = true;
+		}
+		else if ( clusters.m_Clusters.Find( nCluster ) < 0 )
+		{
+			clusters.m_Clusters.AddToTail( nCluster );
+		}
+	}
+	vecMins -= Vector( flMargin, flMargin, flMargin );
+	vecMaxs += Vector( flMargin, flMargin, flMargin );
+
+	ToolBSPTree()->EnumerateLeavesInBox( vecMins, vecMaxs, &clusters, 0 );
+
+	nReach = 0;
+	bool bClean = true;
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		bool bVisible = bAllClusters;
+		for ( intp i = 0; i < clusters.m_Clusters.Count() && !bVisible; i++ )
+		{
+			bVisible = PVSCheck( dl->pvs, clusters.m_Clusters[i] ) != 0;
+		}
+		if ( !bVisible )
+			continue;
+
+		// Hard falloff lights are black past their end distance.
+		if ( dl->light.type == emit_point || dl->light.type == emit_spotlight || dl->light.type == emit_surface )
+		{
+			if ( dl->m_flEndFadeDistance > dl->m_flStartFadeDistance &&
+				CalcSqrDistanceToAABB( vecMins, vecMaxs, dl->light.origin ) > dl->m_flEndFadeDistance * dl->m_flEndFadeDistance )
+				continue;
+		}
+
+		// Sums don't care about the light order.
+		nReach += m_LightKeys[dl->index];
+
+		if ( bClean && IsShadowChanged( dl, l, vecMins, vecMaxs ) )
+		{
+			bClean = false;
+		}
+	}
+
+	return bClean;
+}
+
+
+bool CLightCache::RestoreFace( const lightinfo_t &l, facelight_t *fl, int nNormals )
+{
+	Face_t &face = m_NewFaces[l.facenum];
+	face.m_nKey = FaceKey( l, fl, nNormals );
+
+	const bool bClean = LightsReachingFace( l, fl, face.m_nReach );
+
+	FaceHash_t hash;
+	hash.m_nHash = face.m_nKey;
+	const FaceHash_t *pOld = std::lower_bound( m_OldFaces.begin(), m_OldFaces.end(), hash );
+	if ( !bClean || pOld == m_OldFaces.end() || pOld->m_nHash != face.m_nKey )
+	{
+		++m_nRelit;
+		return false;
+	}
+
+	const byte *pData = static_cast<const byte *>( m_Buffer.Base() ) + pOld->m_nOffset;
+
+	LightCacheFace_t oldFace;
+	memcpy( &oldFace, pData, sizeof( oldFace ) );
+	pData += sizeof( oldFace );
+
+	if ( oldFace.m_nReach != face.m_nReach || oldFace.m_nSamples != fl->numsamples || oldFace.m_nNormals != nNormals )
+	{
+		++m_nRelit;
+		return false;
+	}
+
+	const int nStyles = StyleCount( oldFace.m_Styles );
+	const intp nBytes = fl->numsamples * static_cast<intp>( sizeof( LightingValue_t ) );
+	for ( int k = 0; k < MAXLIGHTMAPS; k++ )
+	{
+		l.face->styles[k] = oldFace.m_Styles[k];
+		if ( k >= nStyles )
+			continue;
+
+		for ( int n = 0; n < nNormals; n++ )
+		{
+			fl->light[k][n] = static_cast<LightingValue_t *>( calloc( fl->numsamples, sizeof( LightingValue_t ) ) );
+			memcpy( fl->light[k][n], pData, nBytes );
+			pData += nBytes;
+		}
+	}
+
+	StoreFace( l.facenum, fl, nNormals );
+
+	++m_nRestored;
+	return true;
+}
+
+
+void CLightCache::StoreFace( int facenum, const facelight_t *fl, int nNormals )
+{
+	Face_t &face = m_NewFaces[facenum];
+	const dface_t *f = &g_pFaces[facenum];
+
+	memcpy( face.m_Styles, f->styles, sizeof( face.m_Styles ) );
+	face.m_nSamples = fl->numsamples;
+	face.m_nNormals = nNormals;
+
+	const int nStyles = StyleCount( face.m_Styles );
+	face.m_Lighting.SetCount( nStyles * nNormals * fl->numsamples );
+
+	LightingValue_t *pOut = face.m_Lighting.Base();
+	for ( int k = 0; k < nStyles; k++ )
+	{
+		for ( int n = 0; n < nNormals; n++ )
+		{
+			memcpy( pOut, fl->light[k][n], fl->numsamples * sizeof( LightingValue_t ) );
+			pOut += fl->numsamples;
+		}
+	}
+}
+
+
+bool CLightCache::RestoreTransfers()
+{
+	if ( m_nOldTransfers < 0 || m_nOldTransferKey != m_nTransfers || m_nOldPatches != g_Patches.Count() )
+		return false;
+
+	m_Buffer.SeekGet( CUtlBuffer::SEEK_HEAD, m_nOldTransfers );
+
+	intp nPatch;
+	for ( nPatch = 0; nPatch < g_Patches.Count(); nPatch++ )
+	{
+		CPatch &patch = g_Patches[nPatch];
+
+		int numtransfers = 0, transferbytes = 0;
+		m_Buffer.Get( &numtransfers, sizeof( numtransfers ) );
+		m_Buffer.Get( &transferbytes, sizeof( transferbytes ) );
+		if ( !m_Buffer.IsValid() || numtransfers < 0 || transferbytes < 0 || transferbytes > m_Buffer.GetBytesRemaining() )
+			break;
+
+		patch.numtransfers = numtransfers;
+		if ( numtransfers )
+		{
+			patch.transferbytes = transferbytes;
+			patch.transfers = (byte *)malloc( transferbytes );
+			if ( !patch.transfers )
+				Error( "Memory allocation failure" );
+			m_Buffer.Get( patch.transfers, transferbytes );
+		}
+	}
+
+	if ( nPatch != g_Patches.Count() )
+	{
+		Warning( "Ignoring transfers in %s, file is truncated.\n", m_pszCacheFilename );
+		for ( CPatch &patch : g_Patches )
+		{
+			free( patch.transfers );
+			patch.transfers = nullptr;
+			patch.transferbytes = 0;
+			patch.numtransfers = 0;
+		}
+		return false;
+	}
+
+	for ( const CPatch &patch : g_Patches )
+	{
+		total_transfer += patch.numtransfers;
+		total_transfer_bytes += patch.transferbytes;
+		if ( max_transfer < patch.numtransfers )
+			max_transfer = patch.numtransfers;
+	}
+
+	Msg( "Restored transfers from %s.\n", m_pszCacheFilename );
+	return true;
+}
+
+
+void CLightCache::Save()
+{
+	Msg( "Lighting cache: restored %d faces, relit %d.\n", m_nRestored.load(), m_nRelit.load() );
+
+	// Old data isn't needed any more.
+	m_Buffer.Purge();
+	m_OldFaces.Purge();
+
+	bool bTransfers = false;
+	for ( const CPatch &patch : g_Patches )
+	{
+		if ( patch.numtransfers )
+		{
+			bTransfers = true;
+			break;
+		}
+	}
+
+	int nFaces = 0;
+	for ( const Face_t &face : m_NewFaces )
+	{
+		if ( face.m_nNormals )
+		{
+			nFaces++;
+		}
+	}
+
+	CUtlBuffer buf;
+
+	LightCacheHeader_t header;
+	memset( &header, 0, sizeof( header ) );
+	header.m_nId = LIGHTCACHE_ID;
+	header.m_nVersion = LIGHTCACHE_VERSION;
+	header.m_nSettings = m_nSettings;
+	header.m_nTransfers = m_nTransfers;
+	header.m_nCells = static_cast<int>( m_Cells.Count() );
+	header.m_nFaces = nFaces;
+	header.m_nPatches = bTransfers ? static_cast<int>( g_Patches.Count() ) : 0;
+	buf.Put( &header, sizeof( header ) );
+
+	buf.Put( m_Cells.Base(), static_cast<int>( m_Cells.Count() * sizeof( Cell_t ) ) );
+
+	for ( const Face_t &face : m_NewFaces )
+	{
+		if ( !face.m_nNormals )
+			continue;
+
+		LightCacheFace_t record;
+		memset( &record, 0, sizeof( record ) );
+		record.m_nKey = face.m_nKey;
+		record.m_nReach = face.m_nReach;
+		record.m_nSamples = face.m_nSamples;
+		record.m_nNormals = face.m_nNormals;
+		memcpy( record.m_Styles, face.m_Styles, sizeof( record.m_Styles ) );
+		buf.Put( &record, sizeof( record ) );
+		buf.Put( face.m_Lighting.Base(), static_cast<int>( face.m_Lighting.Count() * sizeof( LightingValue_t ) ) );
+	}
+
+	if ( bTransfers )
+	{
+		for ( const CPatch &patch : g_Patches )
+		{
+			const int transferbytes = patch.numtransfers ? patch.transferbytes : 0;
+			PutValue( buf, patch.numtransfers );
+			PutValue( buf, transferbytes );
+			buf.Put( patch.transfers, transferbytes );
+		}
+	}
+
+	m_NewFaces.Purge();
+
+	if ( !g_pFileSystem->WriteFile( m_pszCacheFilename, NULL, buf ) )
+	{
+		Warning( "Unable to write lighting cache %s.\n", m_pszCacheFilename );
+		return;
+	}
+
+	Msg( "Wrote lighting cache %s (%s).\n", m_pszCacheFilename, V_pretifymem( (float)buf.TellPut(), 2, true ) );
+}
@@ -0,0 +1,137 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Keeps the direct lighting and transfers of the last run so the
+//			next run only relights the faces whose lights or occluders changed.
+//
+//=============================================================================//
+
+#ifndef LIGHTCACHE_H
+#define LIGHTCACHE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "vrad.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/utlvector.h"
+
+#include <atomic>
+
+struct lightinfo_t;
+struct facelight_t;
+
+
+//-----------------------------------------------------------------------------
+// Faces are matched across compiles by a hash of their samples, so the face
+// numbering may change freely. A face is restored when:
+//	- the hash of every light whose PVS reaches it is the same, and
+//	- no occluder changed between it and one of those lights.
+// Occluders are the ray trace triangles, hashed into coarse cells. A cell
+// that changed is a box any shadow ray crossing it may see differently.
+//-----------------------------------------------------------------------------
+class CLightCache
+{
+public:
+	CLightCache();
+
+	CLightCache(const CLightCache &) = delete;
+	CLightCache& operator=(const CLightCache &) = delete;
+
+	// Hashes the ray trace triangles. Must run before
+	// g_RtEnv.SetupAccelerationStructure turns them into intersection format.
+	void HashOccluders();
+
+	// Loads the cache and works out what changed since it was written.
+	// Lights and patches must be set up.
+	void Init( const char *pszCacheFilename );
+
+	// Restores the styles and direct lighting of a face if nothing reaching it
+	// changed. CalcPoints must have run. Called from the lighting threads.
+	bool RestoreFace( const lightinfo_t &l, facelight_t *fl, int nNormals );
+
+	// Keeps the direct lighting of a face that was just lit, before
+	// BuildPatchLights adds the ambient term to it.
+	void StoreFace( int facenum, const facelight_t *fl, int nNormals );
+
+	// Restores the transfers of every patch if the patches, occluders and vis
+	// are all the same as last time.
+	bool RestoreTransfers();
+
+	// Writes everything for the next run.
+	void Save();
+
+private:
+	struct Cell_t
+	{
+		uint64	m_nKey;
+		uint64	m_nHash;			// Sum of the hashes of the triangles in the cell
+		Vector	m_vecMins;			// Bounds of those triangles
+		Vector	m_vecMaxs;
+	};
+
+	struct Box_t
+	{
+		Vector	m_vecMins;
+		Vector	m_vecMaxs;
+	};
+
+	struct FaceHash_t
+	{
+		uint64	m_nHash;
+		intp	m_nOffset;			// Of the face record in m_Buffer
+
+		bool operator<( const FaceHash_t &other ) const
+		{
+			return m_nHash < other.m_nHash;
+		}
+	};
+
+	struct Face_t
+	{
+		uint64	m_nKey;
+		uint64	m_nReach;
+		int		m_nSamples;
+		int		m_nNormals;
+		byte	m_Styles[MAXLIGHTMAPS];
+		CUtlVector<LightingValue_t>	m_Lighting;		// Style major, then normal, then sample
+	};
+
+	uint64 SettingsHash() const;
+	uint64 FaceKey( const lightinfo_t &l, const facelight_t *fl, int nNormals ) const;
+	uint64 TransferKey() const;
+
+	// Hash of the lights reaching the face, false if one of their shadows changed.
+	bool LightsReachingFace( const lightinfo_t &l, const facelight_t *fl, uint64 &nReach ) const;
+	bool IsShadowChanged( const directlight_t *dl, const lightinfo_t &l, const Vector &vecMins, const Vector &vecMaxs ) const;
+
+	bool LoadFaces( int nFaces );
+
+	uint64					m_nSettings;
+	uint64					m_nOccluders;		// Sum of all triangle hashes
+	uint64					m_nTransfers;
+
+	CUtlVector<Cell_t>		m_Cells;			// Sorted by key
+	CUtlVector<Box_t>		m_ChangedCells;
+	bool					m_bOccludersChanged;	// Too much changed to look at cells
+
+	CUtlVector<uint64>		m_LightKeys;		// Indexed by directlight_t::index
+	Vector					m_vecWorldMins;
+	Vector					m_vecWorldMaxs;
+
+	const char				*m_pszCacheFilename;
+	CUtlBuffer				m_Buffer;			// The old cache
+	CUtlVector<FaceHash_t>	m_OldFaces;			// Sorted by hash
+	intp					m_nOldTransfers;	// Offset of the transfers in m_Buffer or -1
+	uint64					m_nOldTransferKey;
+	int						m_nOldPatches;
+
+	CUtlVector<Face_t>		m_NewFaces;			// Indexed by face
+	std::atomic_int			m_nRestored;
+	std::atomic_int			m_nRelit;
+};
+
+// Null if not using -incremental.
+extern CLightCache *g_pLightCache;
+
+
+#endif // LIGHTCACHE_H
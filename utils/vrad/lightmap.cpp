@@ -8,6 +8,7 @@
 
 #include "vrad.h"
 #include "lightmap.h"
+#include "lightcache.h"
 #include "radial.h"
 #include "mathlib/bumpvects.h"
 #include "tier1/utlvector.h"
@@ -3110,9 +3111,15 @@ void BuildFacelights (int iThread, int facenum)
 	// Allocate sample positions/normals to SSE
 	int numGroups = ( fl->numsamples & 0x3) ? ( fl->numsamples / 4 ) + 1 : ( fl->numsamples / 4 );
 
+	// reuse the lighting of the last run if nothing that reaches the face changed
+	const bool bCached = g_pLightCache && g_pLightCache->RestoreFace( l, fl, sampleInfo.m_NormalCount );
+
 	// always allocate style 0 lightmap
-	f->styles[0] = 0;
-	AllocateLightstyleSamples( fl, 0, sampleInfo.m_NormalCount );
+	if ( !bCached )
+	{
+		f->styles[0] = 0;
+		AllocateLightstyleSamples( fl, 0, sampleInfo.m_NormalCount );
+	}
 
 	// sample the lights at each sample location
 	for ( int grp = 0; grp < numGroups; ++grp )
@@ -3143,7 +3150,8 @@ void BuildFacelights (int iThread, int facenum)
 		}
 
 		// Iterate over all the lights and add their contribution to this group of spots
-		GatherSampleLightAt4Points( sampleInfo, nSample, numSamples );
+		if ( !bCached )
+			GatherSampleLightAt4Points( sampleInfo, nSample, numSamples );
 	}
 	
 	// Tell the incremental light manager that we're done with this face.
@@ -3162,7 +3170,7 @@ void BuildFacelights (int iThread, int facenum)
 	}
 
 	// get rid of the -extra functionality on displacement surfaces
-	if (do_extra && !sampleInfo.m_IsDispFace)
+	if (do_extra && !sampleInfo.m_IsDispFace && !bCached)
 	{
 		// For each lightstyle, perform a supersampling pass
 		for ( int i = 0; i < MAXLIGHTMAPS; ++i )
@@ -3175,6 +3183,12 @@ void BuildFacelights (int iThread, int facenum)
 		}
 	}
 
+	// keep the direct lighting before BuildPatchLights adds ambient to it
+	if ( g_pLightCache && !bCached )
+	{
+		g_pLightCache->StoreFace( facenum, fl, sampleInfo.m_NormalCount );
+	}
+
 #ifdef MPI
 	if (!g_bUseMPI) 
 #endif
@@ -37,6 +37,7 @@ CUtlVector<char> g_LightResultsFilename;
 
 extern std::atomic_int total_transfer;
 extern std::atomic_int max_transfer;
+extern std::atomic<int64> total_transfer_bytes;
 
 extern void BuildVisLeafs(int);
 extern void BuildPatchLights( int facenum );
@@ -293,8 +294,10 @@ void MPI_ReceiveVisLeafsResults( uint64 iWorkUnit, MessageBuffer *pBuf, int iWor
 		patch->numtransfers = numtransfers;
 		if (numtransfers) 
 		{
-			patch->transfers = new transfer_t[numtransfers];
-			pBuf->read(patch->transfers, numtransfers * sizeof(transfer_t));
+			pBuf->read( &patch->transferbytes, sizeof(patch->transferbytes) );
+			patch->transfers = (byte *)malloc( patch->transferbytes );
+			pBuf->read( patch->transfers, patch->transferbytes );
+			total_transfer_bytes += patch->transferbytes;
 		}
 		
 		total_transfer += numtransfers;
@@ -329,7 +332,11 @@ void MPI_AddPatchData( int iThread, int patchnum, CPatch *patch )
 		++pData->m_nPatchesInCluster;
 		pData->m_pVisLeafsMB->write(&patchnum, sizeof(patchnum));
 		pData->m_pVisLeafsMB->write(&patch->numtransfers, sizeof(patch->numtransfers));
-		pData->m_pVisLeafsMB->write( patch->transfers, patch->numtransfers * sizeof(transfer_t) );
+		if ( patch->numtransfers )
+		{
+			pData->m_pVisLeafsMB->write( &patch->transferbytes, sizeof(patch->transferbytes) );
+			pData->m_pVisLeafsMB->write( patch->transfers, patch->transferbytes );
+		}
 	}
 }
 
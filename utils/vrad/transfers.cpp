@@ -0,0 +1,148 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compact storage for the patch to patch transfer lists.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "vrad.h"
+#include "transfers.h"
+
+#include <algorithm>
+
+
+static inline int VarIntSize( unsigned nValue )
+{
+	int nSize = 1;
+	while ( nValue >= 0x80 )
+	{
+		nValue >>= 7;
+		++nSize;
+	}
+	return nSize;
+}
+
+static inline byte *WriteVarInt( byte *pOut, unsigned nValue )
+{
+	while ( nValue >= 0x80 )
+	{
+		*pOut++ = (byte)( nValue | 0x80 );
+		nValue >>= 7;
+	}
+	*pOut++ = (byte)nValue;
+	return pOut;
+}
+
+static inline const byte *ReadVarInt( const byte *pIn, unsigned &nValue )
+{
+	nValue = 0;
+	int nShift = 0;
+	byte b;
+	do
+	{
+		b = *pIn++;
+		nValue |= (unsigned)( b & 0x7f ) << nShift;
+		nShift += 7;
+	} while ( b & 0x80 );
+	return pIn;
+}
+
+
+//-----------------------------------------------------------------------------
+// Sorts pTransfers by patch and packs them into a malloc'd buffer.
+//-----------------------------------------------------------------------------
+byte *CompressTransfers( transfer_t *pTransfers, int nTransfers, int &nBytes )
+{
+	std::sort( pTransfers, pTransfers + nTransfers,
+		[]( const transfer_t &a, const transfer_t &b ) { return a.patch < b.patch; } );
+
+	nBytes = 0;
+	int nLastPatch = 0;
+	for ( int i = 0; i < nTransfers; ++i )
+	{
+		if ( ( i % TRANSFER_BLOCK_SIZE ) == 0 )
+		{
+			nBytes += sizeof( float );
+		}
+		nBytes += sizeof( uint16 ) + VarIntSize( pTransfers[i].patch - nLastPatch );
+		nLastPatch = pTransfers[i].patch;
+	}
+
+	byte *pData = (byte *)malloc( nBytes );
+	if ( !pData )
+		Error( "Memory allocation failure" );
+
+	byte *pOut = pData;
+	nLastPatch = 0;
+	for ( int i = 0; i < nTransfers; i += TRANSFER_BLOCK_SIZE )
+	{
+		const int nBlock = min( nTransfers - i, TRANSFER_BLOCK_SIZE );
+		const transfer_t *pBlock = pTransfers + i;
+
+		float flScale = 0.0f;
+		for ( int j = 0; j < nBlock; ++j )
+		{
+			flScale = max( flScale, pBlock[j].transfer );
+		}
+		memcpy( pOut, &flScale, sizeof( flScale ) );
+		pOut += sizeof( flScale );
+
+		const float flQuantize = flScale > 0.0f ? 65535.0f / flScale : 0.0f;
+		for ( int j = 0; j < nBlock; ++j )
+		{
+			const uint16 nWeight = (uint16)min( pBlock[j].transfer * flQuantize + 0.5f, 65535.0f );
+			memcpy( pOut, &nWeight, sizeof( nWeight ) );
+			pOut += sizeof( nWeight );
+		}
+
+		for ( int j = 0; j < nBlock; ++j )
+		{
+			pOut = WriteVarInt( pOut, pBlock[j].patch - nLastPatch );
+			nLastPatch = pBlock[j].patch;
+		}
+	}
+
+	Assert( pOut == pData + nBytes );
+	return pData;
+}
+
+
+CTransferReader::CTransferReader( const byte *pData, int nTransfers ) :
+	m_pData( pData ), m_nLeft( nTransfers ), m_nLastPatch( 0 )
+{
+}
+
+
+//-----------------------------------------------------------------------------
+// Unpacks the next block, returns its size or 0 at the end of the list.
+//-----------------------------------------------------------------------------
+int CTransferReader::NextBlock()
+{
+	const int nBlock = min( m_nLeft, TRANSFER_BLOCK_SIZE );
+	if ( !nBlock )
+		return 0;
+
+	float flScale;
+	memcpy( &flScale, m_pData, sizeof( flScale ) );
+	m_pData += sizeof( flScale );
+
+	const float flDequantize = flScale * ( 1.0f / 65535.0f );
+	for ( int j = 0; j < nBlock; ++j )
+	{
+		uint16 nWeight;
+		memcpy( &nWeight, m_pData, sizeof( nWeight ) );
+		m_pData += sizeof( nWeight );
+		m_flTransfer[j] = nWeight * flDequantize;
+	}
+
+	for ( int j = 0; j < nBlock; ++j )
+	{
+		unsigned nDelta;
+		m_pData = ReadVarInt( m_pData, nDelta );
+		m_nLastPatch += (int)nDelta;
+		m_nPatch[j] = m_nLastPatch;
+	}
+
+	m_nLeft -= nBlock;
+	return nBlock;
+}
@@ -0,0 +1,51 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compact storage for the patch to patch transfer lists.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef TRANSFERS_H
+#define TRANSFERS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+struct transfer_t;
+
+//-----------------------------------------------------------------------------
+// A patch's transfers are sorted by patch index and packed in blocks of
+// TRANSFER_BLOCK_SIZE. Each block is the largest weight in it as a float,
+// every weight as a 16 bit fraction of that, then the patch indices as
+// varint deltas from the previous one. That's about 3.5 bytes a transfer
+// instead of the 8 of a transfer_t.
+//-----------------------------------------------------------------------------
+#define TRANSFER_BLOCK_SIZE		16
+
+// Sorts pTransfers by patch and packs them into a malloc'd buffer.
+byte *CompressTransfers( transfer_t *pTransfers, int nTransfers, int &nBytes );
+
+
+//-----------------------------------------------------------------------------
+// Unpacks a transfer list a block at a time
+//-----------------------------------------------------------------------------
+class CTransferReader
+{
+public:
+	CTransferReader( const byte *pData, int nTransfers );
+
+	// Unpacks the next block into m_nPatch and m_flTransfer, returns the
+	// number of transfers in it or 0 at the end of the list.
+	int NextBlock();
+
+	int		m_nPatch[TRANSFER_BLOCK_SIZE];
+	float	m_flTransfer[TRANSFER_BLOCK_SIZE];
+
+private:
+	const byte	*m_pData;
+	int			m_nLeft;
+	int			m_nLastPatch;
+};
+
+
+#endif // TRANSFERS_H
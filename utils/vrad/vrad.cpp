@@ -11,6 +11,8 @@
 #include "vrad.h"
 #include "physdll.h"
 #include "lightmap.h"
+#include "transfers.h"
+#include "lightcache.h"
 #include "tier1/strtools.h"
 #include "vmpi.h"
 #include "macro_texture.h"
@@ -44,6 +46,8 @@ CUtlVector<intp>		faceParents;		// contains only root patches, use next parent t
 CUtlVector<intp>		clusterChildren;
 CUtlVector<Vector>		emitlight;
 CUtlVector<bumplights_t>	addlight;
+// emitlight * reflectivity, what GatherLight picks up from each patch
+CUtlVector<fltx4, CUtlMemoryAligned<fltx4, 16>>	g_ReflectedLight;
 
 int num_sky_cameras;
 sky_camera_t sky_cameras[MAX_MAP_AREAS];
@@ -87,6 +91,9 @@ char		level_lights[MAX_PATH] = "";
 
 char		vismatfile[MAX_PATH] = "";
 char		incrementfile[MAX_PATH] = "";
+char		lightcachefile[MAX_PATH] = "";
+
+bool		g_bLightCache = false;	// "-incremental" keeps direct lighting and transfers between runs
 
 IIncremental *g_pIncremental = 0;
 std::atomic_bool	g_bInterrupt = false;	// Used with background lighting in WC. Tells VRAD
@@ -1082,6 +1089,7 @@ MakeScales
 */
 std::atomic_int	total_transfer;
 std::atomic_int max_transfer;
+std::atomic<int64> total_transfer_bytes;
 
 
 //-----------------------------------------------------------------------------
@@ -1226,7 +1234,7 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 {
 	int		j;
 	float	total;
-	transfer_t	*t, *t2;
+	transfer_t	*t;
 	total = 0;
 
 	if( ndxPatch == g_Patches.InvalidIndex() )
@@ -1241,18 +1249,13 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 			max_transfer = patch->numtransfers;
 		}
 
-
-		patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
-		if (!patch->transfers)
-			Error ("Memory allocation failure");
-
 		// get total transfer energy
-		t2 = all_transfers;
+		t = all_transfers;
 
 		// overflow check!
-		for (j=0 ; j<patch->numtransfers ; j++, t2++)
+		for (j=0 ; j<patch->numtransfers ; j++, t++)
 		{
-			total += t2->transfer;
+			total += t->transfer;
 		}
 
 		// the total transfer should be PI, but we need to correct errors due to overlaping surfaces
@@ -1261,17 +1264,14 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		else	
 			total = 1.0f/M_PI;
 
-		t = patch->transfers;
-		t2 = all_transfers;
-		for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
-		{
-			t->transfer = t2->transfer*total;
-			t->patch = t2->patch;
-		}
-		if (patch->numtransfers > max_transfer)
+		t = all_transfers;
+		for (j=0 ; j<patch->numtransfers ; j++, t++)
 		{
-			max_transfer = patch->numtransfers;
+			t->transfer *= total;
 		}
+
+		patch->transfers = CompressTransfers( all_transfers, patch->numtransfers, patch->transferbytes );
+		total_transfer_bytes += patch->transferbytes;
 	}
 	else
 	{
@@ -1541,10 +1541,7 @@ void PreGetBumpNormalsForDisp( texinfo_t *pTexinfo, Vector &vecU, Vector &vecV,
 void GatherLight (int threadnum, void *pUserData)
 {
 	int			i, j, k;
-	transfer_t	*trans;
-	int			num;
 	CPatch		*patch;
-	Vector		sum, v;
 
 	while (1)
 	{
@@ -1554,12 +1551,11 @@ void GatherLight (int threadnum, void *pUserData)
 
 		patch = &g_Patches[j];
 
-		trans = patch->transfers;
-		num = patch->numtransfers;
+		CTransferReader transfers( patch->transfers, patch->numtransfers );
 		if ( patch->needsBumpmap )
 		{
 			Vector delta;
-			Vector bumpSum[NUM_BUMP_VECTS+1];
+			fltx4 bumpSum[NUM_BUMP_VECTS+1];
 			Vector normals[NUM_BUMP_VECTS+1];
 
 			// Disps
@@ -1596,57 +1592,52 @@ void GatherLight (int threadnum, void *pUserData)
 
 			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
 			{
-				VectorFill( bumpSum[i], 0 );
+				bumpSum[i] = Four_Zeros;
 			}
 
 			float dot;
-			for (k=0 ; k<num ; k++, trans++)
+			for ( int num = transfers.NextBlock(); num; num = transfers.NextBlock() )
 			{
-				CPatch *patch2 = &g_Patches[trans->patch];
-
-				// get vector to other patch
-				VectorSubtract (patch2->origin, patch->origin, delta);
-				VectorNormalize (delta);
-				// find light emitted from other patch
-				for(i=0; i<3; i++)
-				{
-					v[i] = emitlight[trans->patch][i] * patch2->reflectivity[i];
-				}
-				// remove normal already factored into transfer steradian
-				float scale = 1.0f / DotProduct (delta, patch->normal);
-				VectorScale( v, trans->transfer * scale, v );
-				
-				Vector bumpTransfer;
-				for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
+				for (k=0 ; k<num ; k++)
 				{
-					dot = DotProduct( delta, normals[i] );
-					if ( dot <= 0 )
+					const int ndxPatch2 = transfers.m_nPatch[k];
+
+					// get vector to other patch
+					VectorSubtract (g_Patches[ndxPatch2].origin, patch->origin, delta);
+					VectorNormalize (delta);
+					// remove normal already factored into transfer steradian
+					float scale = 1.0f / DotProduct (delta, patch->normal);
+					// find light emitted from other patch
+					fltx4 v = MulSIMD( g_ReflectedLight[ndxPatch2], ReplicateX4( transfers.m_flTransfer[k] * scale ) );
+
+					for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
 					{
-//						Assert( i > 0 ); // if this hits, then the transfer shouldn't be here.  It doesn't face the flat normal of this face!
-						continue;
+						dot = DotProduct( delta, normals[i] );
+						if ( dot <= 0 )
+						{
+//							Assert( i > 0 ); // if this hits, then the transfer shouldn't be here.  It doesn't face the flat normal of this face!
+							continue;
+						}
+						bumpSum[i] = MaddSIMD( v, ReplicateX4( dot ), bumpSum[i] );
 					}
-					bumpTransfer = v * dot;
-					VectorAdd( bumpSum[i], bumpTransfer, bumpSum[i] );
 				}
 			}
 			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
 			{
-				VectorCopy( bumpSum[i], addlight[j].light[i] );
+				StoreUnaligned3SIMD( addlight[j].light[i].Base(), bumpSum[i] );
 			}
 		}
 		else
 		{
-			VectorFill( sum, 0 );
-			for (k=0 ; k<num ; k++, trans++)
+			fltx4 sum = Four_Zeros;
+			for ( int num = transfers.NextBlock(); num; num = transfers.NextBlock() )
 			{
-				for(i=0; i<3; i++)
+				for (k=0 ; k<num ; k++)
 				{
-					v[i] = emitlight[trans->patch][i] * g_Patches[trans->patch].reflectivity[i];
+					sum = MaddSIMD( g_ReflectedLight[transfers.m_nPatch[k]], ReplicateX4( transfers.m_flTransfer[k] ), sum );
 				}
-				VectorScale( v, trans->transfer, v );
-				VectorAdd( sum, v, sum );
 			}
-			VectorCopy( sum, addlight[j].light[0] );
+			StoreUnaligned3SIMD( addlight[j].light[0].Base(), sum );
 		}
 	}
 }
@@ -1674,12 +1665,22 @@ void BounceLight (void)
 		VectorFill( g_Patches[i].totallight.light[0], 0 );
 	}
 
+	g_ReflectedLight.SetCount( uiPatchCount );
+
 	i = 0;
 	while ( bouncing )
 	{
+		// the light each patch sends out along its transfers, worked out once
+		// per bounce instead of once per transfer
+		for (unsigned p=0 ; p<uiPatchCount ; p++)
+		{
+			const Vector &reflectivity = g_Patches[p].reflectivity;
+			g_ReflectedLight[p] = LoadAlignedSIMD( VectorAligned( emitlight[p].x * reflectivity.x,
+				emitlight[p].y * reflectivity.y, emitlight[p].z * reflectivity.z ) );
+		}
+
 		// transfer light from to the leaf patches from other patches via transfers
 		// this moves shooter->emitlight to receiver->addlight
-		unsigned int uiPatchCount = g_Patches.Count();
 		RunThreadsOn (uiPatchCount, true, GatherLight);
 		// move newly received light (addlight) to light to be sent out (emitlight)
 		// start at children and pull light up to parents
@@ -1699,6 +1700,8 @@ void BounceLight (void)
 			WriteWorld (name, 0);
 		}
 	}
+
+	g_ReflectedLight.Purge();
 }
 
 
@@ -1885,15 +1888,19 @@ void BuildFacesVisibleToLights( bool bAllVisible )
 
 void MakeAllScales (void)
 {
-	// determine visibility between patches
-	BuildVisMatrix ();
-	
-	// release visibility matrix
-	FreeVisMatrix ();
+	// determine visibility between patches, unless the last run already did
+	if ( !g_pLightCache || !g_pLightCache->RestoreTransfers() )
+	{
+		BuildVisMatrix ();
+
+		// release visibility matrix
+		FreeVisMatrix ();
+	}
 
 	Msg("transfers %d, max %d\n", static_cast<int>(total_transfer), static_cast<int>(max_transfer) );
 
-	qprintf ("transfer lists: %s\n"
+	qprintf ("transfer lists: %s (%s unpacked)\n"
+		, V_pretifymem( (float)total_transfer_bytes, 2, true )
 		, V_pretifymem( (float)total_transfer * sizeof(transfer_t), 2, true ) );
 }
 
@@ -2056,6 +2063,11 @@ bool RadWorld_Go()
 #endif
 			
 		Msg("FinalLightFace Done\n"); fflush(stdout);
+
+		if ( g_pLightCache )
+		{
+			g_pLightCache->Save();
+		}
 	}
 
 	return true;
@@ -2148,6 +2160,7 @@ void VRAD_LoadBSP( char const *pFilename )
 
 	V_strcpy_safe(incrementfile, source);
 	Q_DefaultExtension(incrementfile, ".r0");
+	V_sprintf_safe(lightcachefile, "%s_%s.vrc", source, g_bHDR ? "hdr" : "ldr");
 	Q_DefaultExtension(source, ".bsp");
 
 	Msg( "Loading %s.\n", source );
@@ -2242,10 +2255,28 @@ void VRAD_LoadBSP( char const *pFilename )
 	if ( g_bDumpRtEnv )
 		WriteRTEnv("trace.txt");
 
+	// Hash what blocks light while the triangles still have their vertices
+	if ( g_pLightCache )
+		g_pLightCache->HashOccluders();
+
+	// Prop heavy maps are mostly small overlapping triangles, which the BVH handles
+	// better than the kd-tree
+	int nPropTriangles = 0;
+	for ( int i = 0; i < g_RtEnv.OptimizedTriangleList.Count(); i++ )
+	{
+		if ( g_RtEnv.OptimizedTriangleList[i].m_Data.m_GeometryData.m_nTriangleID & TRACE_ID_STATICPROP )
+			nPropTriangles++;
+	}
+	if ( nPropTriangles * 2 > g_RtEnv.OptimizedTriangleList.Count() )
+	{
+		Msg( "Using a BVH for %d static prop triangles out of %d\n", nPropTriangles, g_RtEnv.OptimizedTriangleList.Count() );
+		g_RtEnv.Flags |= RTE_FLAGS_USE_BVH;
+	}
+
 	// Build acceleration structure
 	Msg ( "Setting up ray-trace acceleration structure...");
 	double start = Plat_FloatTime();
-	g_RtEnv.SetupAccelerationStructure();
+	g_RtEnv.SetupAccelerationStructure( numthreads );
 	Msg ( "Done (%.2fs)", Plat_FloatTime()-start );
 	Msg ( "\n" );
 
@@ -2255,6 +2286,12 @@ void VRAD_LoadBSP( char const *pFilename )
 
 	RadWorld_Start();
 
+	// Work out what changed since the last -incremental run.
+	if ( g_pLightCache )
+	{
+		g_pLightCache->Init( lightcachefile );
+	}
+
 	// Setup incremental lighting.
 	if( g_pIncremental )
 	{
@@ -2494,6 +2531,11 @@ static int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 				return -1;
 			}
 		}
+		else if (V_strieq(argv[i],"-incremental"))
+		{
+			Msg( "--incremental: true\n" );
+			g_bLightCache = true;
+		}
 		else if (V_strieq(argv[i],"-noextra"))
 		{
 			Msg( "--no-extra: true\n" );
@@ -2936,6 +2978,8 @@ void PrintUsage( int argc, char **argv )
 		"                            or processors on your machine).\n"
 		"  -lights <file>          : Load a lights file in addition to lights.rad and the\n"
 		"                            level lights file.\n"
+		"  -incremental            : Keep direct lighting in <mapname>_ldr.vrc / _hdr.vrc and\n"
+		"                            only relight faces whose lights or occluders changed.\n"
 		"  -noextra                : Disable supersampling.\n"
 		"  -debugextra             : Places debugging data in lightmaps to visualize\n"
 		"                            supersampling.\n"
@@ -3034,6 +3078,21 @@ int RunVRAD( int argc, char **argv )
 	Q_StripExtension( argv[ i ], source );
 	Q_FileBase( source, source );
 
+	static CLightCache s_LightCache;
+	if ( g_bLightCache && !onlydetail && !g_bOnlyStaticProps )
+	{
+#ifdef MPI
+		if ( g_bUseMPI )
+		{
+			Warning( "Can't use -incremental in MPI mode, lighting all faces.\n" );
+		}
+		else
+#endif
+		{
+			g_pLightCache = &s_LightCache;
+		}
+	}
+
 	VRAD_LoadBSP( argv[i] );
 
 	if ( (! onlydetail) && (! g_bOnlyStaticProps ) )
@@ -231,7 +231,8 @@ struct CPatch
 //	struct		patch_s		*nextclusterchild;		// next terminal child in cluster
 
 	int			numtransfers;
-	transfer_t	*transfers;
+	int			transferbytes;
+	byte		*transfers;				// packed, see transfers.h
 
 	short		indices[3];				// displacement use these for subdivision
 };
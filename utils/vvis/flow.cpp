@@ -7,6 +7,10 @@
 //=============================================================================//
 #include "vis.h"
 #include "vmpi.h"
+#include "threads.h"
+#include "pacifier.h"
+
+#include <atomic>
 
 int g_TraceClusterStart = -1;
 int g_TraceClusterStop = -1;
@@ -31,6 +35,9 @@ int g_TraceClusterStop = -1;
 
 int CountBits (byte *bits, int numbits)
 {
+	if (g_bUseSIMD)
+		return CountBitsSIMD (bits, numbits);
+
 	int c = 0;
 	for (int i=0 ; i<numbits ; i++)
 		if ( CheckBit( bits, i ) )
@@ -451,9 +458,11 @@ RecursiveLeafFlow
 
 Flood fill through the leafs
 If src_portal is NULL, this is the originating leaf
+bSIMD selects the kernels from flowsimd.cpp
 ==================
 */
-void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
+template <bool bSIMD>
+static void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 {
 	pstack_t	stack;
 	plane_t		backplane;
@@ -507,11 +516,18 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 			test = (intp *)p->portalflood;
 		}
 
-		more = 0;
-		for (j=0 ; j<portalarchwords ; j++)
+		if constexpr (bSIMD)
 		{
-			might[j] = ((intp *)prevstack->mightsee)[j] & test[j];
-			more |= (might[j] & ~vis[j]);
+			more = MightSeeMoreSIMD (prevstack->mightsee, (byte *)test, (byte *)vis, stack.mightsee, portalbytes);
+		}
+		else
+		{
+			more = 0;
+			for (j=0 ; j<portalarchwords ; j++)
+			{
+				might[j] = ((intp *)prevstack->mightsee)[j] & test[j];
+				more |= (might[j] & ~vis[j]);
+			}
 		}
 		
 		if ( !more && CheckBit( thread->base->portalvis, pnum ) )
@@ -542,7 +558,8 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 		}
 		else	
 		{
-			stack.pass = ChopWinding (p->winding, &stack, &thread->pstack_head.portalplane);
+			stack.pass = bSIMD ? ChopWindingSIMD (p->winding, &stack, &thread->pstack_head.portalplane)
+				: ChopWinding (p->winding, &stack, &thread->pstack_head.portalplane);
 			if (!stack.pass)
 				continue;
 		}
@@ -560,7 +577,8 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 		}
 		else	
 		{
-			stack.source = ChopWinding (prevstack->source, &stack, &backplane);
+			stack.source = bSIMD ? ChopWindingSIMD (prevstack->source, &stack, &backplane)
+				: ChopWinding (prevstack->source, &stack, &backplane);
 			if (!stack.source)
 				continue;
 		}
@@ -572,15 +590,17 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 			// mark the portal as visible
 			SetBit( thread->base->portalvis, pnum );
 
-			RecursiveLeafFlow (p->leaf, thread, &stack);
+			RecursiveLeafFlow<bSIMD> (p->leaf, thread, &stack);
 			continue;
 		}
 
-		stack.pass = ClipToSeperators (stack.source, prevstack->pass, stack.pass, false, &stack);
+		stack.pass = bSIMD ? ClipToSeperatorsSIMD (stack.source, prevstack->pass, stack.pass, false, &stack)
+			: ClipToSeperators (stack.source, prevstack->pass, stack.pass, false, &stack);
 		if (!stack.pass)
 			continue;
 		
-		stack.pass = ClipToSeperators (prevstack->pass, stack.source, stack.pass, true, &stack);
+		stack.pass = bSIMD ? ClipToSeperatorsSIMD (prevstack->pass, stack.source, stack.pass, true, &stack)
+			: ClipToSeperators (prevstack->pass, stack.source, stack.pass, true, &stack);
 		if (!stack.pass)
 			continue;
 
@@ -588,24 +608,25 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 		SetBit( thread->base->portalvis, pnum );
 
 		// flow through it for real
-		RecursiveLeafFlow (p->leaf, thread, &stack);
+		RecursiveLeafFlow<bSIMD> (p->leaf, thread, &stack);
 	}	
 }
 
 
 /*
 ===============
-PortalFlow
+FlowPortal
 
 generates the portalvis bit vector
 ===============
 */
-void PortalFlow (int iThread, int portalnum)
+static void FlowPortal (portal_t *p)
 {
-	portal_t *p = sorted_portals[portalnum];
 	p->status = stat_working;
 
-	const int c_might = CountBits (p->portalflood, g_numportals*2);
+	// The counts are only printed, don't bother unless verbose.
+	const bool bCount = !g_bUseSIMD || verbose;
+	const int c_might = bCount ? CountBits (p->portalflood, g_numportals*2) : 0;
 	
 	threaddata_t	data;
 	memset (&data, 0, sizeof(data));
@@ -617,16 +638,202 @@ void PortalFlow (int iThread, int portalnum)
 	for (int i=0 ; i<portalarchwords ; i++)
 		((intp *)data.pstack_head.mightsee)[i] = ((intp *)p->portalflood)[i];
 
-	RecursiveLeafFlow (p->leaf, &data, &data.pstack_head);
+	if (g_bUseSIMD)
+		RecursiveLeafFlow<true> (p->leaf, &data, &data.pstack_head);
+	else
+		RecursiveLeafFlow<false> (p->leaf, &data, &data.pstack_head);
 
 	p->status = stat_done;
 
-	const int c_can = CountBits (p->portalvis, g_numportals*2);
+	const int c_can = bCount ? CountBits (p->portalvis, g_numportals*2) : 0;
 
 	qprintf ("portal:%4zi  mightsee:%4i  cansee:%4i (%i chains)\n", 
 		p - portals, c_might, c_can, data.c_chains);
 }
 
+void PortalFlow (int iThread, int portalnum)
+{
+	FlowPortal (sorted_portals[portalnum]);
+}
+
+
+//-----------------------------------------------------------------------------
+// Portal flow scheduling
+//
+// Portals are flowed cheapest first so the expensive ones can prune with the
+// finished portalvis of the cheap ones. The list is cut into blocks of about
+// the same estimated cost, dealt round robin to per thread queues so all the
+// threads move through the list at the same pace without a shared counter.
+// A thread that runs dry steals the expensive half of the work left in the
+// busiest queue, so the few big portals at the end don't leave cores idle.
+//-----------------------------------------------------------------------------
+namespace
+{
+
+struct FlowQueue_t
+{
+	CThreadFastMutex		m_Mutex;
+	CUtlVector<portal_t *>	m_Portals;
+	int						m_nHead;
+	int64					m_nCost;		// Estimated cost of m_Portals[m_nHead..]
+};
+
+FlowQueue_t			g_FlowQueues[MAX_TOOL_THREADS];
+int					g_nFlowQueues;
+int					g_nFlowPortals;
+std::atomic<int>	g_nFlowPortalsDone;
+
+// Chains through a portal grow with the square of what it might see.
+int64 PortalFlowCost( const portal_t *p )
+{
+	return (int64)p->nummightsee * p->nummightsee + 1;
+}
+
+portal_t *PopFlowPortal( FlowQueue_t &queue )
+{
+	AUTO_LOCK( queue.m_Mutex );
+	if ( queue.m_nHead == queue.m_Portals.Count() )
+		return NULL;
+
+	portal_t *p = queue.m_Portals[queue.m_nHead++];
+	queue.m_nCost -= PortalFlowCost( p );
+	return p;
+}
+
+// Moves the back of the busiest queue into the empty queue of iThread.
+bool StealFlowPortals( int iThread )
+{
+	int iVictim = -1;
+	int64 nVictimCost = 0;
+	for ( int i = 0; i < g_nFlowQueues; i++ )
+	{
+		if ( i == iThread )
+			continue;
+
+		AUTO_LOCK( g_FlowQueues[i].m_Mutex );
+		if ( g_FlowQueues[i].m_nCost > nVictimCost )
+		{
+			iVictim = i;
+			nVictimCost = g_FlowQueues[i].m_nCost;
+		}
+	}
+
+	if ( iVictim < 0 )
+		return false;
+
+	CUtlVector<portal_t *> stolen;
+	{
+		FlowQueue_t &victim = g_FlowQueues[iVictim];
+		AUTO_LOCK( victim.m_Mutex );
+
+		// Take from the back until about half the cost is gone.
+		int nFirst = victim.m_Portals.Count();
+		int64 nCost = 0;
+		while ( nFirst > victim.m_nHead && nCost * 2 < victim.m_nCost )
+		{
+			nCost += PortalFlowCost( victim.m_Portals[--nFirst] );
+		}
+
+		if ( nFirst == victim.m_Portals.Count() )
+			return false;
+
+		stolen.CopyArray( victim.m_Portals.Base() + nFirst, victim.m_Portals.Count() - nFirst );
+		victim.m_Portals.RemoveMultipleFromTail( stolen.Count() );
+		victim.m_nCost -= nCost;
+	}
+
+	FlowQueue_t &queue = g_FlowQueues[iThread];
+	AUTO_LOCK( queue.m_Mutex );
+	Assert( queue.m_nHead == queue.m_Portals.Count() );
+	queue.m_Portals.Swap( stolen );
+	queue.m_nHead = 0;
+	queue.m_nCost = 0;
+	for ( auto *p : queue.m_Portals )
+	{
+		queue.m_nCost += PortalFlowCost( p );
+	}
+	return true;
+}
+
+void PortalFlowThread( int iThread, void *pUserData )
+{
+	FlowQueue_t &queue = g_FlowQueues[iThread];
+	while ( true )
+	{
+		portal_t *p = PopFlowPortal( queue );
+		if ( !p )
+		{
+			if ( !StealFlowPortals( iThread ) )
+				break;
+			continue;
+		}
+
+		FlowPortal( p );
+
+		const int nDone = ++g_nFlowPortalsDone;
+		if ( iThread == 0 )
+		{
+			UpdatePacifier( (float)nDone / g_nFlowPortals );
+		}
+	}
+}
+
+}  // namespace
+
+/*
+==================
+RunPortalFlow
+
+Flows the portals with all threads, cheapest first
+==================
+*/
+void RunPortalFlow (portal_t **ppPortals, int nCount)
+{
+	if (numthreads == -1)
+		ThreadSetDefault ();
+
+	g_nFlowQueues = clamp( numthreads, 1, MAX_TOOL_THREADS );
+	g_nFlowPortals = nCount;
+	g_nFlowPortalsDone = 0;
+
+	int64 nTotalCost = 0;
+	for (int i=0 ; i<nCount ; i++)
+		nTotalCost += PortalFlowCost (ppPortals[i]);
+
+	// Enough blocks per thread that the pace evens out before stealing
+	// has to kick in.
+	const int64 nBlockCost = Max( nTotalCost / ( g_nFlowQueues * 64 ), (int64)1 );
+
+	for (int i=0 ; i<g_nFlowQueues ; i++)
+	{
+		g_FlowQueues[i].m_Portals.RemoveAll ();
+		g_FlowQueues[i].m_nHead = 0;
+		g_FlowQueues[i].m_nCost = 0;
+	}
+
+	int iQueue = 0;
+	int64 nCost = 0;
+	for (int i=0 ; i<nCount ; i++)
+	{
+		FlowQueue_t &queue = g_FlowQueues[iQueue];
+		queue.m_Portals.AddToTail (ppPortals[i]);
+
+		const int64 nPortalCost = PortalFlowCost (ppPortals[i]);
+		queue.m_nCost += nPortalCost;
+		nCost += nPortalCost;
+		if (nCost >= nBlockCost)
+		{
+			iQueue = (iQueue + 1) % g_nFlowQueues;
+			nCost = 0;
+		}
+	}
+
+	RunThreadsOn (nCount, true, PortalFlowThread);
+
+	for (int i=0 ; i<g_nFlowQueues ; i++)
+		g_FlowQueues[i].m_Portals.Purge ();
+}
+
 
 /*
 ===============================================================================
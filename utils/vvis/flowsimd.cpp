@@ -0,0 +1,391 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: SSE versions of the portal flow kernels, used with -simd. They
+//			must flow exactly the same portalvis as the scalar ones in flow.cpp.
+//
+//			They stay 4 wide on purpose: most windings have only a few points,
+//			so 8 lanes would mostly be padding, and the mightsee pass is bound
+//			by memory, not by lane count. If that changes, an AVX path can go
+//			behind a cpu check the way raytrace/trace_avx.cpp does it.
+//
+//=============================================================================//
+#include "vis.h"
+#include "mathlib/ssemath.h"
+
+#include <emmintrin.h>
+#include <type_traits>
+
+bool g_bUseSIMD = false;
+
+static_assert( std::is_same_v<vec_t, float>, "SIMD flow kernels expect float windings" );
+
+namespace
+{
+
+// Winding points as structure of arrays, padded to a multiple of 4.
+struct windingsoa_t
+{
+	alignas(16) float	x[MAX_POINTS_ON_WINDING];
+	alignas(16) float	y[MAX_POINTS_ON_WINDING];
+	alignas(16) float	z[MAX_POINTS_ON_WINDING];
+	int					numpoints;
+};
+
+void WindingToSOA( const winding_t *w, windingsoa_t &soa )
+{
+	soa.numpoints = w->numpoints;
+
+	int i;
+	for ( i = 0; i < w->numpoints; i++ )
+	{
+		soa.x[i] = w->points[i].x;
+		soa.y[i] = w->points[i].y;
+		soa.z[i] = w->points[i].z;
+	}
+	for ( ; i & 3; i++ )
+	{
+		soa.x[i] = soa.y[i] = soa.z[i] = 0.0f;
+	}
+}
+
+// Distance of every point to the plane, 4 at a time. Products are summed in
+// the same order as DotProduct so the distances match it bit for bit.
+void PlaneDistsSIMD( const windingsoa_t &soa, const plane_t &plane, float *pDists )
+{
+	const fltx4 nx = ReplicateX4( plane.normal.x );
+	const fltx4 ny = ReplicateX4( plane.normal.y );
+	const fltx4 nz = ReplicateX4( plane.normal.z );
+	const fltx4 dist = ReplicateX4( plane.dist );
+
+	for ( int i = 0; i < soa.numpoints; i += 4 )
+	{
+		fltx4 dot = AddSIMD( MulSIMD( LoadAlignedSIMD( &soa.x[i] ), nx ), MulSIMD( LoadAlignedSIMD( &soa.y[i] ), ny ) );
+		dot = AddSIMD( dot, MulSIMD( LoadAlignedSIMD( &soa.z[i] ), nz ) );
+		StoreAlignedSIMD( pDists + i, SubSIMD( dot, dist ) );
+	}
+}
+
+inline bool IsZero( __m128i a )
+{
+	return _mm_movemask_epi8( _mm_cmpeq_epi8( a, _mm_setzero_si128() ) ) == 0xffff;
+}
+
+inline uint64 PopCount64( uint64 v )
+{
+	v = v - ( ( v >> 1 ) & 0x5555555555555555ull );
+	v = ( v & 0x3333333333333333ull ) + ( ( v >> 2 ) & 0x3333333333333333ull );
+	v = ( v + ( v >> 4 ) ) & 0x0f0f0f0f0f0f0f0full;
+	return ( v * 0x0101010101010101ull ) >> 56;
+}
+
+}  // namespace
+
+
+/*
+==============
+ChopWindingSIMD
+
+ChopWinding with the point distances evaluated 4 at a time
+==============
+*/
+winding_t *ChopWindingSIMD (winding_t *in, pstack_t *stack, plane_t *split)
+{
+	windingsoa_t soa;
+	WindingToSOA( in, soa );
+
+	alignas(16) vec_t dists[MAX_POINTS_ON_WINDING + 1];
+	PlaneDistsSIMD( soa, *split, dists );
+
+	SideType	sides[MAX_POINTS_ON_WINDING + 1];
+	int			counts[3];
+	int			i;
+
+	counts[0] = counts[1] = counts[2] = 0;
+
+	for (i=0 ; i<in->numpoints ; i++)
+	{
+		vec_t dot = dists[i];
+		if (dot > ON_VIS_EPSILON)
+			sides[i] = SIDE_FRONT;
+		else if (dot < -ON_VIS_EPSILON)
+			sides[i] = SIDE_BACK;
+		else
+			sides[i] = SIDE_ON;
+		counts[sides[i]]++;
+	}
+
+	if (!counts[1])
+		return in;		// completely on front side
+
+	if (!counts[0])
+	{
+		FreeStackWinding (in, stack);
+		return NULL;
+	}
+
+	sides[i] = sides[0];
+	dists[i] = dists[0];
+
+	winding_t *neww = AllocStackWinding (stack);
+
+	neww->numpoints = 0;
+
+	for (i=0 ; i<in->numpoints ; i++)
+	{
+		Vector& p1 = in->points[i];
+
+		if (neww->numpoints == MAX_POINTS_ON_FIXED_WINDING)
+		{
+			FreeStackWinding (neww, stack);
+			return in;		// can't chop -- fall back to original
+		}
+
+		if (sides[i] == SIDE_ON)
+		{
+			VectorCopy (p1, neww->points[neww->numpoints]);
+			neww->numpoints++;
+			continue;
+		}
+
+		if (sides[i] == SIDE_FRONT)
+		{
+			VectorCopy (p1, neww->points[neww->numpoints]);
+			neww->numpoints++;
+		}
+
+		if (sides[i+1] == SIDE_ON || sides[i+1] == sides[i])
+			continue;
+
+		if (neww->numpoints == MAX_POINTS_ON_FIXED_WINDING)
+		{
+			FreeStackWinding (neww, stack);
+			return in;		// can't chop -- fall back to original
+		}
+
+	// generate a split point
+		Vector& p2 = in->points[(i+1)%in->numpoints];
+		Vector	mid;
+
+		vec_t dot = dists[i] / (dists[i]-dists[i+1]);
+		for (int j=0 ; j<3 ; j++)
+		{	// avoid round off error when possible
+			if (split->normal[j] == 1)
+				mid[j] = split->dist;
+			else if (split->normal[j] == -1)
+				mid[j] = -split->dist;
+			else
+				mid[j] = p1[j] + dot*(p2[j]-p1[j]);
+		}
+
+		VectorCopy (mid, neww->points[neww->numpoints]);
+		neww->numpoints++;
+	}
+
+// free the original winding
+	FreeStackWinding (in, stack);
+
+	return neww;
+}
+
+
+/*
+==============
+ClipToSeperatorsSIMD
+
+ClipToSeperators with source and pass kept as structure of arrays, so each
+candidate plane tests all their points 4 at a time
+==============
+*/
+winding_t *ClipToSeperatorsSIMD (winding_t *source, winding_t *pass, winding_t *target, bool flipclip, pstack_t *stack)
+{
+	int			i, j, k, l;
+	plane_t		plane;
+	Vector		v1, v2;
+	vec_t		length;
+	int			counts[3];
+	bool		fliptest;
+
+	windingsoa_t sourcesoa, passsoa;
+	WindingToSOA( source, sourcesoa );
+	WindingToSOA( pass, passsoa );
+
+	alignas(16) vec_t sourcedists[MAX_POINTS_ON_WINDING];
+	alignas(16) vec_t passdists[MAX_POINTS_ON_WINDING];
+
+// check all combinations
+	for (i=0 ; i<source->numpoints ; i++)
+	{
+		l = (i+1)%source->numpoints;
+		VectorSubtract (source->points[l] , source->points[i], v1);
+
+	// fing a vertex of pass that makes a plane that puts all of the
+	// vertexes of pass on the front side and all of the vertexes of
+	// source on the back side
+		for (j=0 ; j<pass->numpoints ; j++)
+		{
+			VectorSubtract (pass->points[j], source->points[i], v2);
+
+			plane.normal[0] = v1[1]*v2[2] - v1[2]*v2[1];
+			plane.normal[1] = v1[2]*v2[0] - v1[0]*v2[2];
+			plane.normal[2] = v1[0]*v2[1] - v1[1]*v2[0];
+
+		// if points don't make a valid plane, skip it
+
+			length = plane.normal[0] * plane.normal[0]
+			+ plane.normal[1] * plane.normal[1]
+			+ plane.normal[2] * plane.normal[2];
+
+			if (length < ON_VIS_EPSILON)
+				continue;
+
+			length = 1/sqrt(length);
+
+			plane.normal[0] *= length;
+			plane.normal[1] *= length;
+			plane.normal[2] *= length;
+
+			plane.dist = DotProduct (pass->points[j], plane.normal);
+
+		//
+		// find out which side of the generated seperating plane has the
+		// source portal
+		//
+			PlaneDistsSIMD( sourcesoa, plane, sourcedists );
+
+			fliptest = false;
+			for (k=0 ; k<source->numpoints ; k++)
+			{
+				if (k == i || k == l)
+					continue;
+				vec_t d = sourcedists[k];
+				if (d < -ON_VIS_EPSILON)
+				{	// source is on the negative side, so we want all
+					// pass and target on the positive side
+					fliptest = false; //-V1048
+					break;
+				}
+				else if (d > ON_VIS_EPSILON)
+				{	// source is on the positive side, so we want all
+					// pass and target on the negative side
+					fliptest = true;
+					break;
+				}
+			}
+			if (k == source->numpoints)
+				continue;		// planar with source portal
+
+		//
+		// flip the normal if the source portal is backwards
+		//
+			if (fliptest)
+			{
+				VectorSubtract (vec3_origin, plane.normal, plane.normal);
+				plane.dist = -plane.dist;
+			}
+
+		//
+		// if all of the pass portal points are now on the positive side,
+		// this is the seperating plane
+		//
+			PlaneDistsSIMD( passsoa, plane, passdists );
+
+			counts[0] = counts[1] = counts[2] = 0;
+			for (k=0 ; k<pass->numpoints ; k++)
+			{
+				if (k==j)
+					continue;
+				vec_t d = passdists[k];
+				if (d < -ON_VIS_EPSILON)
+					break;
+				else if (d > ON_VIS_EPSILON)
+					counts[0]++;
+				else
+					counts[2]++;
+			}
+			if (k != pass->numpoints)
+				continue;	// points on negative side, not a seperating plane
+
+			if (!counts[0])
+				continue;	// planar with seperating plane
+
+		//
+		// flip the normal if we want the back side
+		//
+			if (flipclip)
+			{
+				VectorSubtract (vec3_origin, plane.normal, plane.normal);
+				plane.dist = -plane.dist;
+			}
+
+		//
+		// clip target by the seperating plane
+		//
+			target = ChopWindingSIMD (target, stack, &plane);
+			if (!target)
+				return NULL;		// target is not visible
+		}
+	}
+
+	return target;
+}
+
+
+/*
+==============
+MightSeeMoreSIMD
+
+might = prevmight & test, returns true if might has bits vis doesn't.
+nBytes is portalbytes, a multiple of 8.
+==============
+*/
+bool MightSeeMoreSIMD (const byte *prevmight, const byte *test, const byte *vis, byte *might, int nBytes)
+{
+	__m128i more = _mm_setzero_si128();
+
+	int i = 0;
+	for ( ; i + 16 <= nBytes; i += 16 )
+	{
+		const __m128i m = _mm_and_si128( _mm_loadu_si128( (const __m128i *)( prevmight + i ) ),
+			_mm_loadu_si128( (const __m128i *)( test + i ) ) );
+		_mm_storeu_si128( (__m128i *)( might + i ), m );
+		more = _mm_or_si128( more, _mm_andnot_si128( _mm_loadu_si128( (const __m128i *)( vis + i ) ), m ) );
+	}
+
+	if ( i < nBytes )
+	{
+		const __m128i m = _mm_and_si128( _mm_loadl_epi64( (const __m128i *)( prevmight + i ) ),
+			_mm_loadl_epi64( (const __m128i *)( test + i ) ) );
+		_mm_storel_epi64( (__m128i *)( might + i ), m );
+		more = _mm_or_si128( more, _mm_andnot_si128( _mm_loadl_epi64( (const __m128i *)( vis + i ) ), m ) );
+	}
+
+	return !IsZero( more );
+}
+
+
+/*
+==============
+CountBitsSIMD
+
+CountBits a word at a time, skipping empty words
+==============
+*/
+int CountBitsSIMD (const byte *bits, int numbits)
+{
+	const int nWords = numbits >> 6;
+
+	uint64 c = 0;
+	for (int i=0 ; i<nWords ; i++)
+	{
+		uint64 w;
+		memcpy (&w, bits + i*8, sizeof(w));
+		if (w)
+			c += PopCount64 (w);
+	}
+
+	for (int i=nWords<<6 ; i<numbits ; i++)
+		if ( CheckBit( bits, i ) )
+			c++;
+
+	return (int)c;
+}
@@ -115,13 +115,28 @@ void LeafFlow (int leafnum);
 void BasePortalVis (int iThread, int portalnum);
 void BetterPortalVis (int portalnum);
 void PortalFlow (int iThread, int portalnum);
+void RunPortalFlow (portal_t **ppPortals, int nCount);
 void WritePortalTrace( const char *source );
 
+int LoadVisCache (const char *pszCacheFile);
+void SaveVisCache (const char *pszCacheFile);
+
 extern	portal_t	*sorted_portals[MAX_MAP_PORTALS*2];
 extern int g_TraceClusterStart, g_TraceClusterStop;
 
 int CountBits (byte *bits, int numbits);
 
+winding_t *AllocStackWinding (pstack_t *stack);
+void FreeStackWinding (winding_t *w, pstack_t *stack);
+
+// SSE flow kernels, flowsimd.cpp
+extern bool g_bUseSIMD;
+
+winding_t *ChopWindingSIMD (winding_t *in, pstack_t *stack, plane_t *split);
+winding_t *ClipToSeperatorsSIMD (winding_t *source, winding_t *pass, winding_t *target, bool flipclip, pstack_t *stack);
+bool MightSeeMoreSIMD (const byte *prevmight, const byte *test, const byte *vis, byte *might, int nBytes);
+int CountBitsSIMD (const byte *bits, int numbits);
+
 #define CheckBit( bitstring, bitNumber )	( (bitstring)[ ((bitNumber) >> 3) ] & ( 1 << ( (bitNumber) & 7 ) ) )
 #define SetBit( bitstring, bitNumber )	( (bitstring)[ ((bitNumber) >> 3) ] |= ( 1 << ( (bitNumber) & 7 ) ) )
 #define ClearBit( bitstring, bitNumber )	( (bitstring)[ ((bitNumber) >> 3) ] &= ~( 1 << ( (bitNumber) & 7 ) ) )
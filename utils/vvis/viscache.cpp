@@ -0,0 +1,402 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Keeps the portal vis of the last run so the next run only flows
+//			the portals near what the mapper changed.
+//
+//=============================================================================//
+
+#include "vis.h"
+#include "filesystem.h"
+#include "tier1/generichash.h"
+#include "tier1/utlbuffer.h"
+
+#include <algorithm>
+
+// Layout of a .vvc file:
+//	header
+//	numportals * VisCachePortal_t
+//	numportals * zero run compressed portalvis
+#define VISCACHE_ID			(('1'<<24)+('C'<<16)+('V'<<8)+'V')
+#define VISCACHE_VERSION	1
+
+namespace
+{
+
+struct VisCacheHeader_t
+{
+	int		m_nId;
+	int		m_nVersion;
+	int		m_nClusters;
+	int		m_nPortals;			// Both directions, g_numportals * 2
+	int		m_bUseRadius;
+	double	m_flVisRadius;
+};
+
+struct VisCachePortal_t
+{
+	uint64	m_nHash;			// Geometry and clusters of the portal
+	int		m_nCluster;			// Cluster the portal leads out of
+	int		m_nLeaf;			// Cluster the portal leads into
+};
+
+struct PortalHash_t
+{
+	uint64	m_nHash;
+	int		m_iPortal;
+
+	bool operator<( const PortalHash_t &other ) const
+	{
+		return m_nHash < other.m_nHash;
+	}
+};
+
+// Cluster the portal leads out of, portal_t only knows the one it leads into.
+void GetPortalClusters( CUtlVector<int> &clusters )
+{
+	clusters.SetCount( g_numportals * 2 );
+	for ( int i = 0; i < portalclusters; i++ )
+	{
+		for ( auto *p : leafs[i].portals )
+		{
+			clusters[p - portals] = i;
+		}
+	}
+}
+
+uint64 HashPortal( const portal_t *p, int nCluster )
+{
+	const winding_t *w = p->winding;
+	return MurmurHash64( w->points, w->numpoints * static_cast<int>( sizeof( Vector ) ),
+		( static_cast<uint32>( nCluster ) << 16 ) | static_cast<uint32>( p->leaf ) );
+}
+
+// Sorted by hash, hashes that show up more than once can't be matched and are dropped.
+void SortPortalHashes( CUtlVector<PortalHash_t> &hashes )
+{
+	std::sort( hashes.begin(), hashes.end() );
+
+	int nUnique = 0;
+	for ( int i = 0; i < hashes.Count(); )
+	{
+		int j = i + 1;
+		while ( j < hashes.Count() && hashes[j].m_nHash == hashes[i].m_nHash )
+		{
+			j++;
+		}
+		if ( j == i + 1 )
+		{
+			hashes[nUnique++] = hashes[i];
+		}
+		i = j;
+	}
+	hashes.SetCountNonDestructively( nUnique );
+}
+
+// Zero bytes are stored as a 0 followed by the length of the run.
+void CompressPortalBits( const byte *pBits, int nBytes, CUtlBuffer &buf )
+{
+	for ( int i = 0; i < nBytes; )
+	{
+		if ( pBits[i] )
+		{
+			buf.PutUnsignedChar( pBits[i++] );
+			continue;
+		}
+
+		int nRun = 1;
+		while ( i + nRun < nBytes && !pBits[i + nRun] && nRun < 255 )
+		{
+			nRun++;
+		}
+		buf.PutUnsignedChar( 0 );
+		buf.PutUnsignedChar( static_cast<unsigned char>( nRun ) );
+		i += nRun;
+	}
+}
+
+bool DecompressPortalBits( CUtlBuffer &buf, byte *pBits, int nBytes )
+{
+	for ( int i = 0; i < nBytes; )
+	{
+		const unsigned char c = buf.GetUnsignedChar();
+		if ( c )
+		{
+			pBits[i++] = c;
+			continue;
+		}
+
+		const int nRun = buf.GetUnsignedChar();
+		if ( !nRun || i + nRun > nBytes )
+			return false;
+
+		memset( pBits + i, 0, nRun );
+		i += nRun;
+	}
+	return buf.IsValid();
+}
+
+}  // namespace
+
+
+/*
+==================
+LoadVisCache
+
+Restores the portalvis of every portal whose mightsee doesn't reach a
+cluster that changed since the cache was written, and marks it done.
+BasePortalVis must have run. Returns the number of restored portals.
+==================
+*/
+int LoadVisCache (const char *pszCacheFile)
+{
+	CUtlBuffer buf;
+	if ( !g_pFileSystem->ReadFile( pszCacheFile, NULL, buf ) )
+	{
+		Msg( "No vis cache %s, flowing all portals.\n", pszCacheFile );
+		return 0;
+	}
+
+	VisCacheHeader_t header;
+	buf.Get( &header, sizeof( header ) );
+	if ( !buf.IsValid() || header.m_nId != VISCACHE_ID || header.m_nVersion != VISCACHE_VERSION ||
+		header.m_nClusters <= 0 || header.m_nPortals <= 0 || header.m_nPortals > MAX_PORTALS )
+	{
+		Warning( "Ignoring vis cache %s, unknown format.\n", pszCacheFile );
+		return 0;
+	}
+
+	if ( !!header.m_bUseRadius != g_bUseRadius || ( g_bUseRadius && header.m_flVisRadius != g_VisRadius ) )
+	{
+		Msg( "Vis radius changed since %s was written, flowing all portals.\n", pszCacheFile );
+		return 0;
+	}
+
+	const int nOldPortals = header.m_nPortals;
+	CUtlVector<VisCachePortal_t> oldPortals;
+	oldPortals.SetCount( nOldPortals );
+	buf.Get( oldPortals.Base(), nOldPortals * static_cast<int>( sizeof( VisCachePortal_t ) ) );
+	if ( !buf.IsValid() )
+	{
+		Warning( "Ignoring vis cache %s, file is truncated.\n", pszCacheFile );
+		return 0;
+	}
+
+	// Old vis is read on demand.
+	const int nOldPortalBytes = ( ( nOldPortals + 63 ) & ~63 ) >> 3;
+	CUtlVector<int> oldVisOffsets;
+	oldVisOffsets.SetCount( nOldPortals );
+	{
+		CUtlVector<byte> skip;
+		skip.SetCount( nOldPortalBytes );
+		for ( int i = 0; i < nOldPortals; i++ )
+		{
+			oldVisOffsets[i] = static_cast<int>( buf.TellGet() );
+			if ( !DecompressPortalBits( buf, skip.Base(), nOldPortalBytes ) )
+			{
+				Warning( "Ignoring vis cache %s, file is truncated.\n", pszCacheFile );
+				return 0;
+			}
+		}
+	}
+
+	const int nPortals = g_numportals * 2;
+	CUtlVector<int> portalClusters;
+	GetPortalClusters( portalClusters );
+
+	// Match portals by geometry, the numbering changes with every compile.
+	CUtlVector<PortalHash_t> oldHashes, newHashes;
+	oldHashes.SetCount( nOldPortals );
+	for ( int i = 0; i < nOldPortals; i++ )
+	{
+		oldHashes[i].m_nHash = oldPortals[i].m_nHash;
+		oldHashes[i].m_iPortal = i;
+	}
+	newHashes.SetCount( nPortals );
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		newHashes[i].m_nHash = HashPortal( &portals[i], portalClusters[i] );
+		newHashes[i].m_iPortal = i;
+	}
+	SortPortalHashes( oldHashes );
+	SortPortalHashes( newHashes );
+
+	CUtlVector<int> oldToNew, newToOld;
+	oldToNew.SetCount( nOldPortals );
+	newToOld.SetCount( nPortals );
+	memset( oldToNew.Base(), 0xff, oldToNew.Count() * sizeof( int ) );
+	memset( newToOld.Base(), 0xff, newToOld.Count() * sizeof( int ) );
+	for ( int i = 0, j = 0; i < oldHashes.Count() && j < newHashes.Count(); )
+	{
+		if ( oldHashes[i].m_nHash < newHashes[j].m_nHash )
+		{
+			i++;
+		}
+		else if ( newHashes[j].m_nHash < oldHashes[i].m_nHash )
+		{
+			j++;
+		}
+		else
+		{
+			oldToNew[oldHashes[i].m_iPortal] = newHashes[j].m_iPortal;
+			newToOld[newHashes[j].m_iPortal] = oldHashes[i].m_iPortal;
+			i++;
+			j++;
+		}
+	}
+
+	// A cluster changed if it gained or lost a portal.
+	CUtlVector<bool> changedClusters;
+	changedClusters.SetCount( portalclusters );
+	memset( changedClusters.Base(), 0, changedClusters.Count() * sizeof( bool ) );
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		if ( newToOld[i] < 0 )
+		{
+			changedClusters[portalClusters[i]] = true;
+			changedClusters[portals[i].leaf] = true;
+		}
+	}
+	for ( int i = 0; i < nOldPortals; i++ )
+	{
+		if ( oldToNew[i] >= 0 )
+			continue;
+
+		if ( oldPortals[i].m_nCluster >= 0 && oldPortals[i].m_nCluster < portalclusters )
+		{
+			changedClusters[oldPortals[i].m_nCluster] = true;
+		}
+		if ( oldPortals[i].m_nLeaf >= 0 && oldPortals[i].m_nLeaf < portalclusters )
+		{
+			changedClusters[oldPortals[i].m_nLeaf] = true;
+		}
+	}
+
+	int nChangedClusters = 0;
+	for ( int i = 0; i < portalclusters; i++ )
+	{
+		if ( changedClusters[i] )
+		{
+			nChangedClusters++;
+		}
+	}
+
+	// Portals on either side of a changed cluster. Flow only walks the
+	// clusters behind the mightsee of a portal, so a portal whose mightsee
+	// misses these sees exactly what it saw last time.
+	CUtlVector<intp> changedPortals;
+	changedPortals.SetCount( portalarchwords );
+	memset( changedPortals.Base(), 0, portalbytes );
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		if ( changedClusters[portalClusters[i]] || changedClusters[portals[i].leaf] )
+		{
+			SetBit( (byte *)changedPortals.Base(), i );
+		}
+	}
+
+	CUtlVector<byte> oldVis;
+	oldVis.SetCount( nOldPortalBytes );
+
+	int nRestored = 0;
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		portal_t *p = &portals[i];
+		const int iOld = newToOld[i];
+		if ( iOld < 0 || CheckBit( (byte *)changedPortals.Base(), i ) )
+			continue;
+
+		intp nTouched = 0;
+		for ( int j = 0; j < portalarchwords; j++ )
+		{
+			nTouched |= ((intp *)p->portalflood)[j] & changedPortals[j];
+		}
+		if ( nTouched )
+			continue;
+
+		buf.SeekGet( CUtlBuffer::SEEK_HEAD, oldVisOffsets[iOld] );
+		DecompressPortalBits( buf, oldVis.Base(), nOldPortalBytes );
+
+		bool bMapped = true;
+		for ( int j = 0; j < nOldPortalBytes && bMapped; j++ )
+		{
+			if ( !oldVis[j] )
+				continue;
+
+			for ( int k = j << 3; k < ( j << 3 ) + 8; k++ )
+			{
+				if ( !CheckBit( oldVis.Base(), k ) )
+					continue;
+
+				if ( k >= nOldPortals || oldToNew[k] < 0 )
+				{
+					bMapped = false;
+					break;
+				}
+				SetBit( p->portalvis, oldToNew[k] );
+			}
+		}
+
+		if ( !bMapped )
+		{
+			memset( p->portalvis, 0, portalbytes );
+			continue;
+		}
+
+		p->status = stat_done;
+		nRestored++;
+	}
+
+	Msg( "Vis cache: %d clusters changed, restored %d of %d portals.\n", nChangedClusters, nRestored, nPortals );
+	return nRestored;
+}
+
+
+/*
+==================
+SaveVisCache
+
+Writes the portalvis of all portals for the next incremental run
+==================
+*/
+void SaveVisCache (const char *pszCacheFile)
+{
+	const int nPortals = g_numportals * 2;
+
+	CUtlVector<int> portalClusters;
+	GetPortalClusters( portalClusters );
+
+	CUtlBuffer buf;
+
+	VisCacheHeader_t header;
+	memset( &header, 0, sizeof( header ) );
+	header.m_nId = VISCACHE_ID;
+	header.m_nVersion = VISCACHE_VERSION;
+	header.m_nClusters = portalclusters;
+	header.m_nPortals = nPortals;
+	header.m_bUseRadius = g_bUseRadius;
+	header.m_flVisRadius = g_VisRadius;
+	buf.Put( &header, sizeof( header ) );
+
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		VisCachePortal_t portal;
+		portal.m_nHash = HashPortal( &portals[i], portalClusters[i] );
+		portal.m_nCluster = portalClusters[i];
+		portal.m_nLeaf = portals[i].leaf;
+		buf.Put( &portal, sizeof( portal ) );
+	}
+
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		Assert( portals[i].status == stat_done );
+		CompressPortalBits( portals[i].portalvis, portalbytes, buf );
+	}
+
+	if ( !g_pFileSystem->WriteFile( pszCacheFile, NULL, buf ) )
+	{
+		Warning( "Unable to write vis cache %s.\n", pszCacheFile );
+		return;
+	}
+
+	Msg( "Wrote vis cache %s (%zd bytes).\n", pszCacheFile, buf.TellPut() );
+}
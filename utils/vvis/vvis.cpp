@@ -49,6 +49,8 @@ int			portalbytes, portalarchwords;
 
 bool		fastvis;
 bool		nosort;
+bool		incremental;
+bool		simdcheck;
 
 int			totalvis;
 
@@ -265,7 +267,7 @@ static int CompressAndCrosscheckClusterVis( int clusternum )
 CalcPortalVis
 ==================
 */
-void CalcPortalVis (void)
+void CalcPortalVis (const char *visCacheFile)
 {
 	int		i;
 
@@ -288,11 +290,94 @@ void CalcPortalVis (void)
 #endif
 	else 
 	{
-		RunThreadsOnIndividual (g_numportals*2, true, PortalFlow);
+		if ( visCacheFile )
+		{
+			LoadVisCache( visCacheFile );
+		}
+
+		// Portals restored from the cache are done already.
+		CUtlVector<portal_t *> flowPortals;
+		flowPortals.EnsureCapacity( g_numportals*2 );
+		for (i=0 ; i<g_numportals*2 ; i++)
+		{
+			if ( sorted_portals[i]->status != stat_done )
+			{
+				flowPortals.AddToTail( sorted_portals[i] );
+			}
+		}
+
+		RunPortalFlow (flowPortals.Base(), flowPortals.Count());
+
+		if ( visCacheFile )
+		{
+			SaveVisCache( visCacheFile );
+		}
 	}
 }
 
 
+/*
+==================
+CheckSIMDPortalFlow
+
+Flows every portal in sorted order once with the scalar kernels and once with
+the SIMD ones and compares the portalvis. Single threaded, so both runs see
+the same finished portals. Returns the number of portals that differ.
+==================
+*/
+int CheckSIMDPortalFlow (void)
+{
+	RunThreadsOnIndividual (g_numportals*2, true, BasePortalVis);
+	SortPortals ();
+
+	const int nPortals = g_numportals*2;
+
+	CUtlVector<byte> scalarVis;
+	scalarVis.SetCount( nPortals * portalbytes );
+
+	for ( int nPass = 0; nPass < 2; nPass++ )
+	{
+		g_bUseSIMD = nPass != 0;
+
+		for ( int i = 0; i < nPortals; i++ )
+		{
+			portals[i].status = stat_none;
+			memset( portals[i].portalvis, 0, portalbytes );
+		}
+
+		double start = Plat_FloatTime();
+		for ( int i = 0; i < nPortals; i++ )
+		{
+			PortalFlow( 0, i );
+		}
+		Msg( "%s flow := %.2f\n", g_bUseSIMD ? "simd" : "scalar", Plat_FloatTime() - start );
+
+		if ( !g_bUseSIMD )
+		{
+			for ( int i = 0; i < nPortals; i++ )
+			{
+				memcpy( &scalarVis[i * portalbytes], portals[i].portalvis, portalbytes );
+			}
+		}
+	}
+
+	int nDiffer = 0;
+	int nVisible = 0;
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		if ( memcmp( &scalarVis[i * portalbytes], portals[i].portalvis, portalbytes ) )
+		{
+			Warning( "simdcheck: portal %d differs\n", i );
+			nDiffer++;
+		}
+		nVisible += CountBits( portals[i].portalvis, nPortals );
+	}
+
+	Msg( "simdcheck: %d portals, %d visible, %d differ\n", nPortals, nVisible, nDiffer );
+	return nDiffer;
+}
+
+
 void CalcVisTrace (void)
 {
     RunThreadsOnIndividual (g_numportals*2, true, BasePortalVis);
@@ -307,7 +392,7 @@ void CalcVisTrace (void)
 CalcVis
 ==================
 */
-void CalcVis (void)
+void CalcVis (const char *visCacheFile)
 {
 	int		i;
 
@@ -324,7 +409,7 @@ void CalcVis (void)
 
 	SortPortals ();
 
-	CalcPortalVis ();
+	CalcPortalVis (visCacheFile);
 
 	//
 	// assemble the leaf vis lists by oring the portal lists
@@ -988,6 +1073,21 @@ int ParseCommandLine( int argc, char **argv )
 			Msg ("--no-sort: true\n");
 			nosort = true;
 		}
+		else if (V_strieq (argv[i],"-incremental"))
+		{
+			Msg ("--incremental: true\n");
+			incremental = true;
+		}
+		else if (V_strieq (argv[i],"-simd"))
+		{
+			Msg ("--simd: true\n");
+			g_bUseSIMD = true;
+		}
+		else if (V_strieq (argv[i],"-simdcheck"))
+		{
+			Msg ("--simdcheck: true\n");
+			simdcheck = true;
+		}
 		else if (V_strieq (argv[i],"-tmpin"))
 		{
 			Msg ("--tmpin: Read from /tmp\n");
@@ -1086,6 +1186,11 @@ void PrintUsage( int argc, char **argv )
 		"  -threads        : Control the number of threads vbsp uses (defaults to the #\n"
 		"                    or processors on your machine).\n"
 		"  -nosort         : Don't sort portals (sorting is an optimization).\n"
+		"  -incremental    : Keep portal vis in <mapname>.vvc and only flow the portals\n"
+		"                    that can see clusters changed since the last run.\n"
+		"  -simd           : Flow portals with the SSE winding clip and bit vector kernels.\n"
+		"  -simdcheck      : Flow <mapname>.prt with both the scalar and the -simd kernels\n"
+		"                    and fail if the portal vis differs. Doesn't touch the bsp.\n"
 		"  -tmpin          : Make portals come from \\tmp\\<mapname>.\n"
 		"  -tmpout         : Make portals come from \\tmp\\<mapname>.\n"
 		"  -trace <start cluster> <end cluster> : Writes a linefile that traces the vis from one cluster to another for debugging map vis.\n"
@@ -1183,6 +1288,23 @@ int RunVVis( int argc, char **argv )
 
 	ThreadSetDefault();
 
+	if ( simdcheck )
+	{
+		V_sprintf_safe( portalfile, "%s.prt", source );
+
+		Msg ("reading %s\n", portalfile);
+		LoadPortals (portalfile);
+
+		if ( CheckSIMDPortalFlow() )
+		{
+			Error( "SIMD portal flow doesn't match the scalar one.\n" );
+		}
+
+		CmdLib_Cleanup();
+		SpewDeactivate();
+		return 0;
+	}
+
 	Msg ("reading %s\n", mapFile);
 	LoadBSPFile (mapFile);
 	if (numnodes == 0 || numfaces == 0)
@@ -1222,7 +1344,18 @@ int RunVVis( int argc, char **argv )
 	// don't write out results when simply doing a trace
 	if ( g_TraceClusterStart < 0 )
 	{
-		CalcVis ();
+		char visCacheFile[MAX_FILEPATH];
+		V_sprintf_safe( visCacheFile, "%s.vvc", source );
+
+		bool bUseVisCache = incremental && !fastvis;
+#ifdef MPI
+		if ( bUseVisCache && g_bUseMPI )
+		{
+			Warning( "Can't use -incremental in MPI mode, flowing all portals.\n" );
+			bUseVisCache = false;
+		}
+#endif
+		CalcVis ( bUseVisCache ? visCacheFile : nullptr );
 		CalcPAS ();
 
 		// We need a mapping from cluster to leaves, since the PVS
@@ -31,6 +31,14 @@ class CJobThread;
 
 inline void ServiceJobAndRelease( CJob *pJob, intp iThread = -1 )
 {
+	if ( pJob->GetFlags() & JF_RANGE )
+	{
+		// Range jobs are executed by several threads, no ownership to take.
+		static_cast<CRangeJob *>( pJob )->Help();
+		pJob->Release();
+		return;
+	}
+
 	// TryLock() would only fail if another thread has entered
 	// Execute() or Abort()
 	if ( !pJob->IsFinished() && pJob->TryLock() )
@@ -174,6 +182,107 @@ private:
 
 };
 
+//-----------------------------------------------------------------------------
+// Fixed size Chase-Lev deque for the work-stealing mode. The owning thread
+// pushes and pops at the bottom (LIFO), other threads steal from the top (FIFO)
+// without locks. Push fails when full, callers fall back to the inject queue.
+//-----------------------------------------------------------------------------
+class CJobStealDeque
+{
+	// Must be a power of 2.
+	static constexpr intp MAX_JOBS = 1024;
+	static_assert( ( MAX_JOBS & ( MAX_JOBS - 1 ) ) == 0 );
+
+public:
+	CJobStealDeque()
+	{
+		m_nTop.store( 0, std::memory_order::memory_order_relaxed );
+		m_nBottom.store( 0, std::memory_order::memory_order_relaxed );
+
+		for ( auto &job : m_Jobs )
+		{
+			job.store( nullptr, std::memory_order::memory_order_relaxed );
+		}
+	}
+
+	// Owner thread only.
+	bool Push( CJob *pJob )
+	{
+		const intp b = m_nBottom.load( std::memory_order::memory_order_relaxed );
+		const intp t = m_nTop.load( std::memory_order::memory_order_acquire );
+
+		if ( b - t >= MAX_JOBS )
+		{
+			return false;
+		}
+
+		m_Jobs[b & ( MAX_JOBS - 1 )].store( pJob, std::memory_order::memory_order_relaxed );
+		std::atomic_thread_fence( std::memory_order::memory_order_release );
+		m_nBottom.store( b + 1, std::memory_order::memory_order_relaxed );
+		return true;
+	}
+
+	// Owner thread only.
+	CJob *Pop()
+	{
+		const intp b = m_nBottom.load( std::memory_order::memory_order_relaxed ) - 1;
+		m_nBottom.store( b, std::memory_order::memory_order_relaxed );
+		std::atomic_thread_fence( std::memory_order::memory_order_seq_cst );
+		intp t = m_nTop.load( std::memory_order::memory_order_relaxed );
+
+		if ( t > b )
+		{
+			// Empty
+			m_nBottom.store( b + 1, std::memory_order::memory_order_relaxed );
+			return nullptr;
+		}
+
+		CJob *pJob = m_Jobs[b & ( MAX_JOBS - 1 )].load( std::memory_order::memory_order_relaxed );
+		if ( t == b )
+		{
+			// Last item, race against thieves for it
+			if ( !m_nTop.compare_exchange_strong( t, t + 1, std::memory_order::memory_order_seq_cst, std::memory_order::memory_order_relaxed ) )
+			{
+				pJob = nullptr;
+			}
+			m_nBottom.store( b + 1, std::memory_order::memory_order_relaxed );
+		}
+		return pJob;
+	}
+
+	// Any thread. May fail when racing another thief, the caller moves on to the next victim.
+	CJob *Steal()
+	{
+		intp t = m_nTop.load( std::memory_order::memory_order_acquire );
+		std::atomic_thread_fence( std::memory_order::memory_order_seq_cst );
+		const intp b = m_nBottom.load( std::memory_order::memory_order_acquire );
+
+		if ( t >= b )
+		{
+			return nullptr;
+		}
+
+		CJob *pJob = m_Jobs[t & ( MAX_JOBS - 1 )].load( std::memory_order::memory_order_relaxed );
+		if ( !m_nTop.compare_exchange_strong( t, t + 1, std::memory_order::memory_order_seq_cst, std::memory_order::memory_order_relaxed ) )
+		{
+			return nullptr;
+		}
+		return pJob;
+	}
+
+	[[nodiscard]] bool IsEmpty() const
+	{
+		return m_nBottom.load( std::memory_order::memory_order_relaxed ) <= m_nTop.load( std::memory_order::memory_order_relaxed );
+	}
+
+private:
+	std::atomic<intp>	m_nTop;
+	// Keep thieves and the owner off the same cache line.
+	byte				m_Pad[64 - sizeof( std::atomic<intp> )];
+	std::atomic<intp>	m_nBottom;
+	std::atomic<CJob *>	m_Jobs[MAX_JOBS];
+};
+
 //-----------------------------------------------------------------------------
 //
 // CThreadPool
@@ -244,7 +353,10 @@ public:
 	int ExecuteToPriority( JobPriority_t toPriority, JobFilter_t pfnFilter = nullptr ) override;
 	int AbortAll() override;
 
-	void Reserved1() override {}
+	//-----------------------------------------------------
+	// Queue a job which idle threads execute together
+	//-----------------------------------------------------
+	void AddRangeJob( CRangeJob *pJob ) override;
 
 	void WaitForIdle( bool bAll = true );
 
@@ -261,6 +373,19 @@ private:
 	CJob *PeekJob();
 	CJob *GetDummyJob() override;
 
+	//-----------------------------------------------------
+	// Work-stealing mode
+	//-----------------------------------------------------
+	CJobThread *GetCurrentJobThread() const;
+	void PushStealJob( CJob *pJob );
+	CJob *FindStealJob( CJobThread *pThread );
+	bool HasStealJobs( CJobThread *pThread ) const;
+	void DrainStealJobs( CUtlVector<CJob *> &jobs );
+	void WakeParkedThread();
+
+	// Services a job taken from any of the queues.
+	void ServiceQueuedJob( CJob *pJob, intp iThread );
+
 	//-----------------------------------------------------
 	// Thread functions
 	//-----------------------------------------------------
@@ -282,6 +407,12 @@ private:
 	//	and the main thread coming in and "helping" with jobs breaks that pretty nicely. This flag states that
 	//	only the threadpool threads should execute these jobs.
 	bool					m_bExecOnThreadPoolThreadsOnly{ 0 };
+
+	// Work-stealing mode: jobs added from threads outside of the pool land in
+	// the inject queue, jobs added by pool threads go to their own deque.
+	bool					m_bWorkStealing{ false };
+	CTSQueue<CJob *>		*m_pStealInjectQueue;
+	CInterlockedInt			m_nParkedThreads;
 };
 
 //-----------------------------------------------------------------------------
@@ -315,6 +446,11 @@ public:
 			// Cap the GlobPool threads at 4.
 			startParams.nThreadsMax = 4;
 		}
+
+		if ( CommandLine()->FindParm( "-workstealing" ) )
+		{
+			startParams.bWorkStealing = true;
+		}
 		return CThreadPool::Start( startParams, "GlobJob" );
 	}
 
@@ -325,6 +461,11 @@ public:
 	}
 };
 
+//-----------------------------------------------------------------------------
+
+// Pool thread the calling thread is, if any.
+static thread_local CJobThread *s_pCurrentJobThread;
+
 //-----------------------------------------------------------------------------
 // dimhotepus: Fix aligned alloc.
 class CJobThread final : public CAlignedNewDelete<16, CWorkerThread>
@@ -347,6 +488,33 @@ public:
 		return m_DirectQueue;
 	}
 
+	CJobStealDeque &AccessStealDeque()
+	{
+		return m_StealDeque;
+	}
+
+	// Wakes the thread if it is parked. Returns false if it was not.
+	bool TryUnpark()
+	{
+		if ( m_bParked.load( std::memory_order::memory_order_relaxed ) && m_bParked.exchange( false ) )
+		{
+			--m_pOwner->m_nParkedThreads;
+			m_WakeEvent.Set();
+			return true;
+		}
+		return false;
+	}
+
+	const CThreadPool *GetOwner() const
+	{
+		return m_pOwner;
+	}
+
+	intp GetThreadIndex() const
+	{
+		return m_iThread;
+	}
+
 private:
 	unsigned Wait()
 	{
@@ -400,9 +568,126 @@ private:
 		return waitResult;
 	}
 
-	int Run() override
+	// Returns true if the thread should exit.
+	bool ServiceCall()
+	{
+		CFunctor *pFunctor = nullptr;
+		tmZone( TELEMETRY_LEVEL0, TMZF_NONE, "%s PeekCall():%d", __FUNCTION__, GetCallParam() );
+
+		bool bExit = false;
+
+		switch ( GetCallParam( &pFunctor ) )
+		{
+		case TPM_EXIT:
+			Reply( true );
+			bExit = true;
+			break;
+
+		case TPM_SUSPEND:
+			Reply( true );
+			SuspendCooperative();
+			break;
+
+		case TPM_RUNFUNCTOR:
+			if( pFunctor )
+			{
+				( *pFunctor )();
+				Reply( true );
+			}
+			else
+			{
+				Assert( pFunctor );
+				Reply( false );
+			}
+			break;
+
+		default:
+			AssertMsg( 0, "Unknown call to thread" );
+			Reply( false );
+			break;
+		}
+
+		return bExit;
+	}
+
+	// Sleeps until a job is pushed, a call from the master thread arrives or the
+	// wait times out. Pushers only touch the wake event when a thread is parked.
+	void Park()
+	{
+		tmZone( TELEMETRY_LEVEL0, TMZF_IDLE, "%s", __FUNCTION__ );
+
+		m_bParked.store( true );
+		++m_pOwner->m_nParkedThreads;
+
+		// A pusher which did not see us parked yet must have made the job visible by now.
+		if ( !m_pOwner->HasStealJobs( this ) && !PeekCall() )
+		{
+#ifdef WIN32
+			CThreadEvent *waitEvents[] = { &m_WakeEvent, &GetCallHandle() };
+			ThreadWaitForEvents( static_cast<int>( ssize( waitEvents ) ), waitEvents, false, TT_INFINITE );
+#else
+			// Calls from the master thread are polled, same as Wait().
+			m_WakeEvent.Wait( 100 );
+#endif
+		}
+
+		if ( m_bParked.exchange( false ) )
+		{
+			--m_pOwner->m_nParkedThreads;
+		}
+	}
+
+	int RunWorkStealing()
 	{
+		tmZone( TELEMETRY_LEVEL0, TMZF_NONE, "%s", __FUNCTION__ );
+
+		s_pCurrentJobThread = this;
 
+		++m_pOwner->m_nIdleThreads;
+		m_IdleEvent.Set();
+
+		bool bExit = false;
+		while ( !bExit )
+		{
+			if ( PeekCall() )
+			{
+				bExit = ServiceCall();
+				continue;
+			}
+
+			CJob *pJob = m_pOwner->FindStealJob( this );
+			if ( !pJob )
+			{
+				Park();
+				continue;
+			}
+
+			m_IdleEvent.Reset();
+			--m_pOwner->m_nIdleThreads;
+
+			do
+			{
+				m_pOwner->ServiceQueuedJob( pJob, m_iThread );
+				--m_pOwner->m_nJobs;
+			} while ( !PeekCall() && ( pJob = m_pOwner->FindStealJob( this ) ) != nullptr );
+
+			++m_pOwner->m_nIdleThreads;
+			m_IdleEvent.Set();
+		}
+
+		--m_pOwner->m_nIdleThreads;
+		m_IdleEvent.Reset();
+
+		s_pCurrentJobThread = nullptr;
+		return 0;
+	}
+
+	int Run() override
+	{
+		if ( m_pOwner->m_bWorkStealing )
+		{
+			return RunWorkStealing();
+		}
 
 		// Wait for either a call from the master thread, or an item in the queue...
 		unsigned waitResult;
@@ -416,39 +701,7 @@ private:
 		{
 			if ( PeekCall() )
 			{
-				CFunctor *pFunctor = nullptr;
-				tmZone( TELEMETRY_LEVEL0, TMZF_NONE, "%s PeekCall():%d", __FUNCTION__, GetCallParam() );
-
-				switch ( GetCallParam( &pFunctor ) )
-				{
-				case TPM_EXIT:
-					Reply( true );
-					bExit = TRUE;
-					break;
-
-				case TPM_SUSPEND:
-					Reply( true );
-					SuspendCooperative();
-					break;
-
-				case TPM_RUNFUNCTOR:
-					if( pFunctor )
-					{
-						( *pFunctor )();
-						Reply( true );
-					}
-					else
-					{
-						Assert( pFunctor );
-						Reply( false );
-					}
-					break;
-
-				default:
-					AssertMsg( 0, "Unknown call to thread" );
-					Reply( false );
-					break;
-				}
+				bExit = ServiceCall();
 			}
 			else
 			{
@@ -493,6 +746,11 @@ private:
 	CThreadPool *		m_pOwner;
 	CThreadManualEvent	m_IdleEvent;
 	intp				m_iThread;
+
+	// Work-stealing mode
+	CJobStealDeque		m_StealDeque;
+	std::atomic_bool	m_bParked{ false };
+	CThreadEvent		m_WakeEvent;
 };
 
 //-----------------------------------------------------------------------------
@@ -508,7 +766,9 @@ IThreadPool *g_pThreadPool = &g_ThreadPool;
 
 CThreadPool::CThreadPool() :
 	m_nIdleThreads( 0 ),
-	m_nJobs( 0 )
+	m_nJobs( 0 ),
+	m_pStealInjectQueue( new CTSQueue<CJob *> ),
+	m_nParkedThreads( 0 )
 {
 }
 
@@ -517,6 +777,8 @@ CThreadPool::CThreadPool() :
 CThreadPool::~CThreadPool()
 {
 	Stop();
+
+	delete m_pStealInjectQueue;
 }
 
 //---------------------------------------------------------
@@ -619,9 +881,22 @@ unsigned CThreadPool::YieldWait( CThreadEvent **pEvents, int nEvents, bool bWait
 	timeout = 0;
 	while ( ( result = ThreadWaitForEvents( nEvents, pEvents, bWaitAll, timeout ) ) == WAIT_TIMEOUT )
 	{
-		if ( !m_bExecOnThreadPoolThreadsOnly && m_SharedQueue.Pop( &pJob ) )
+		if ( m_bExecOnThreadPoolThreadsOnly )
 		{
-			ServiceJobAndRelease( pJob );
+			pJob = nullptr;
+		}
+		else if ( m_bWorkStealing )
+		{
+			pJob = FindStealJob( GetCurrentJobThread() );
+		}
+		else if ( !m_SharedQueue.Pop( &pJob ) )
+		{
+			pJob = nullptr;
+		}
+
+		if ( pJob )
+		{
+			ServiceQueuedJob( pJob, -1 );
 			--m_nJobs;
 		}
 		else
@@ -735,25 +1010,213 @@ void CThreadPool::AddJob( CJob *pJob )
 void CThreadPool::InsertJobInQueue( CJob *pJob )
 {
 	CJobQueue *pQueue;
+	CJobThread *pThread = nullptr;
 
 	if ( !( pJob->GetFlags() & JF_SERIAL ) )
 	{
 		int iThread = pJob->GetServiceThread();
 		if ( iThread == -1 || !m_Threads.IsValidIndex( iThread ) )
 		{
+			if ( m_bWorkStealing )
+			{
+				PushStealJob( pJob );
+				return;
+			}
+
 			pQueue = &m_SharedQueue;
 		}
 		else
 		{
-			pQueue = &(m_Threads[iThread]->AccessDirectQueue());
+			pThread = m_Threads[iThread];
+			pQueue = &(pThread->AccessDirectQueue());
 		}
 	}
 	else
 	{
-		pQueue = &(m_Threads[0]->AccessDirectQueue());
+		pThread = m_Threads[0];
+		pQueue = &(pThread->AccessDirectQueue());
 	}
 
 	m_nJobs -= pQueue->Push( pJob );
+
+	if ( m_bWorkStealing && pThread )
+	{
+		// Parked threads don't wait on the direct queue event.
+		pThread->TryUnpark();
+	}
+}
+
+//---------------------------------------------------------
+// Add a job which idle threads execute together
+//---------------------------------------------------------
+
+void CThreadPool::AddRangeJob( CRangeJob *pJob )
+{
+	if ( !pJob || m_Threads.Count() == 0 )
+	{
+		// The submitter processes the whole range.
+		return;
+	}
+
+	pJob->m_pThreadPool = this;
+	pJob->m_status = JOB_STATUS_PENDING;
+
+	if ( m_bWorkStealing )
+	{
+		// Single entry, threads picking it up fan it out. See ServiceQueuedJob.
+		PushStealJob( pJob );
+		++m_nJobs;
+		return;
+	}
+
+	const intp nHelpers = min( pJob->NumHelperSlots(), m_Threads.Count() );
+	for ( intp i = 0; i < nHelpers; i++ )
+	{
+		m_nJobs -= m_SharedQueue.Push( pJob );
+		++m_nJobs;
+	}
+}
+
+//---------------------------------------------------------
+// Work-stealing mode
+//---------------------------------------------------------
+
+CJobThread *CThreadPool::GetCurrentJobThread() const
+{
+	return s_pCurrentJobThread && s_pCurrentJobThread->GetOwner() == this ? s_pCurrentJobThread : nullptr;
+}
+
+void CThreadPool::PushStealJob( CJob *pJob )
+{
+	pJob->AddRef();
+
+	CJobThread *pThread = GetCurrentJobThread();
+	if ( !pThread || !pThread->AccessStealDeque().Push( pJob ) )
+	{
+		m_pStealInjectQueue->PushItem( pJob );
+	}
+
+	WakeParkedThread();
+}
+
+CJob *CThreadPool::FindStealJob( CJobThread *pThread )
+{
+	CJob *pJob;
+
+	if ( pThread )
+	{
+		// Serial and thread bound jobs first, the count check avoids the queue mutex.
+		CJobQueue &directQueue = pThread->AccessDirectQueue();
+		if ( directQueue.Count() && directQueue.Pop( &pJob ) )
+		{
+			return pJob;
+		}
+
+		if ( ( pJob = pThread->AccessStealDeque().Pop() ) != nullptr )
+		{
+			return pJob;
+		}
+	}
+
+	if ( m_pStealInjectQueue->PopItem( &pJob ) )
+	{
+		return pJob;
+	}
+
+	// Steal the oldest job of another thread, start after ourselves to spread thieves.
+	const intp nThreads = m_Threads.Count();
+	const intp iFirst = pThread ? pThread->GetThreadIndex() + 1 : 0;
+
+	for ( intp i = 0; i < nThreads; i++ )
+	{
+		CJobThread *pVictim = m_Threads[( iFirst + i ) % nThreads];
+		if ( pVictim != pThread && ( pJob = pVictim->AccessStealDeque().Steal() ) != nullptr )
+		{
+			return pJob;
+		}
+	}
+
+	return nullptr;
+}
+
+bool CThreadPool::HasStealJobs( CJobThread *pThread ) const
+{
+	if ( pThread && pThread->AccessDirectQueue().Count() )
+	{
+		return true;
+	}
+
+	if ( m_pStealInjectQueue->Count() )
+	{
+		return true;
+	}
+
+	for ( auto *t : m_Threads )
+	{
+		if ( !t->AccessStealDeque().IsEmpty() )
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void CThreadPool::DrainStealJobs( CUtlVector<CJob *> &jobs )
+{
+	// Only safe while the pool is suspended or stopped.
+	CJob *pJob;
+
+	while ( m_pStealInjectQueue->PopItem( &pJob ) )
+	{
+		jobs.AddToTail( pJob );
+	}
+
+	for ( auto *t : m_Threads )
+	{
+		while ( !t->AccessStealDeque().IsEmpty() )
+		{
+			if ( ( pJob = t->AccessStealDeque().Steal() ) != nullptr )
+			{
+				jobs.AddToTail( pJob );
+			}
+		}
+	}
+}
+
+void CThreadPool::WakeParkedThread()
+{
+	// Pairs with the parked count increment in CJobThread::Park. Either we see the
+	// thread parked, or it sees the job we just pushed.
+	std::atomic_thread_fence( std::memory_order::memory_order_seq_cst );
+
+	if ( m_nParkedThreads <= 0 )
+	{
+		return;
+	}
+
+	for ( auto *t : m_Threads )
+	{
+		if ( t->TryUnpark() )
+		{
+			break;
+		}
+	}
+}
+
+void CThreadPool::ServiceQueuedJob( CJob *pJob, intp iThread )
+{
+	if ( m_bWorkStealing && ( pJob->GetFlags() & JF_RANGE ) )
+	{
+		// Leave the range for the next idle thread before joining in.
+		if ( static_cast<CRangeJob *>( pJob )->NumHelperSlots() > 1 && m_nIdleThreads > 0 )
+		{
+			PushStealJob( pJob );
+			++m_nJobs;
+		}
+	}
+
+	ServiceJobAndRelease( pJob, iThread );
 }
 
 //---------------------------------------------------------
@@ -790,7 +1253,16 @@ void CThreadPool::ChangePriority( CJob *pJob, JobPriority_t priority )
 	if ( pJob->GetPriority() < priority )
 	{
 		pJob->SetPriority( priority );
-		m_SharedQueue.Push( pJob );
+
+		if ( m_bWorkStealing )
+		{
+			// No priorities in this mode, just make sure the job is not stuck behind a busy thread.
+			PushStealJob( pJob );
+		}
+		else
+		{
+			m_SharedQueue.Push( pJob );
+		}
 	}
 	else
 	{
@@ -812,6 +1284,34 @@ int CThreadPool::ExecuteToPriority( JobPriority_t iToPriority, JobFilter_t pfnFi
 	int nJobsTotal = GetJobCount();
 	CUtlVector<CJob *> jobsToPutBack;
 
+	if ( m_bWorkStealing )
+	{
+		// Deques don't keep priorities, filter them here.
+		CUtlVector<CJob *> stealJobs;
+		DrainStealJobs( stealJobs );
+
+		for ( auto *j : stealJobs )
+		{
+			if ( j->GetPriority() < iToPriority || ( pfnFilter && !(*pfnFilter)( j ) ) )
+			{
+				if ( j->CanExecute() || ( j->GetFlags() & JF_RANGE ) )
+				{
+					jobsToPutBack.AddToTail( j );
+				}
+				else
+				{
+					--m_nJobs;
+					j->Release(); // see below
+				}
+				continue;
+			}
+
+			ServiceJobAndRelease( j );
+			--m_nJobs;
+			nExecuted++;
+		}
+	}
+
 	for ( int iCurPriority = JP_HIGH; iCurPriority >= iToPriority; --iCurPriority )
 	{
 		for ( auto &&t : m_Threads )
@@ -893,6 +1393,16 @@ int CThreadPool::AbortAll()
 		iAborted++;
 	}
 
+	CUtlVector<CJob *> stealJobs;
+	DrainStealJobs( stealJobs );
+
+	for ( auto *j : stealJobs )
+	{
+		j->Abort();
+		j->Release();
+		iAborted++;
+	}
+
 	for ( auto &&t : m_Threads )
 	{
 		CJobQueue &queue = t->AccessDirectQueue();
@@ -921,6 +1431,7 @@ bool CThreadPool::Start( const ThreadPoolStartParams_t &startParams, const char
 	int nThreads = startParams.nThreads;
 
 	m_bExecOnThreadPoolThreadsOnly = startParams.bExecOnThreadPoolThreadsOnly;
+	m_bWorkStealing = startParams.bWorkStealing;
 
 	if ( nThreads < 0 )
 	{
@@ -1122,12 +1633,26 @@ bool CThreadPool::Stop( [[maybe_unused]] int timeout )
 		{
 			ThreadSleep( 0 );
 		}
+	}
+
+	CUtlVector<CJob *> stealJobs;
+	DrainStealJobs( stealJobs );
+
+	for ( auto *j : stealJobs )
+	{
+		j->Abort();
+		j->Release();
+	}
+
+	for ( auto &&t : m_Threads )
+	{
 		delete t;
 	}
 
 	m_nJobs = 0;
 	m_SharedQueue.Flush();
 	m_nIdleThreads = 0;
+	m_nParkedThreads = 0;
 	m_Threads.RemoveAll();
 	m_IdleEvents.RemoveAll();
 